@@ -132,6 +132,7 @@
 #define IA32_FEATURE_EPB	(1 << 3) //IA32_ENERGY_PERF_BIAS
 
 // cr4 flags
+#define IA32_CR4_PSE					(1UL << 4)
 #define IA32_CR4_PAE					(1UL << 5)
 #define IA32_CR4_GLOBAL_PAGES			(1UL << 7)
 
@@ -376,6 +377,7 @@ status_t x86_get_mtrr(uint32 index, uint64* _base, uint64* _length,
 	uint8* _type);
 void x86_set_mtrrs(uint8 defaultType, const x86_mtrr_info* infos,
 	uint32 count);
+bool x86_has_uniform_memory_type(phys_addr_t base, phys_size_t size);
 void x86_init_fpu();
 bool x86_check_feature(uint32 feature, enum x86_feature_type type);
 void* x86_get_double_fault_stack(int32 cpu, size_t* _size);
@@ -56,6 +56,11 @@ typedef struct cpu_ent {
 	bool			invoke_scheduler_if_idle;
 	bool			disabled;
 
+	// scheduler statistics, protected by the scheduler lock
+	int64			context_switches;
+	int64			involuntary_switches;
+	int64			migrations;
+
 	// arch-specific stuff
 	arch_cpu_info arch;
 } cpu_ent __attribute__((aligned(64)));
@@ -16,6 +16,8 @@
 
 #define CACHE_CLEAR			1	// takes no parameters
 #define CACHE_SET_MODULE	2	// gets the module name as parameter
+#define CACHE_GET_READ_AHEAD_STATS	3
+	// fills in a file_cache_read_ahead_stats structure
 
 #define CACHE_MODULES_NAME	"file_cache"
 
@@ -23,6 +25,14 @@
 #define FILE_CACHE_LOADED_COMPLETELY 	0x02
 #define FILE_CACHE_NO_IO				0x04
 
+struct file_cache_read_ahead_stats {
+	uint64	hits;				// reads that found their data read ahead
+	uint64	misses;				// reads whose data had been evicted again
+	uint64	read_ahead_pages;	// pages read ahead
+	uint64	wasted_pages;		// pages read ahead that were not used
+	uint64	streams;			// sequential streams detected
+};
+
 struct cache_module_info {
 	module_info	info;
 
@@ -13,8 +13,10 @@
 #include <thread_types.h>
 
 
+struct scheduler_thread_info;
 struct scheduling_analysis;
 struct SchedulerListener;
+struct system_scheduler_info;
 
 
 struct scheduler_ops {
@@ -67,6 +69,12 @@ struct scheduler_ops {
 		lock.
 	*/
 	void (*start)(void);
+
+	/*!	Returns the number of threads waiting in the run queue the given CPU
+		picks its threads from, not counting idle threads.
+		The caller must hold the scheduler lock (with disabled interrupts).
+	*/
+	int32 (*run_queue_depth)(int32 cpu);
 };
 
 extern struct scheduler_ops* gScheduler;
@@ -94,8 +102,11 @@ void scheduler_remove_listener(struct SchedulerListener* listener);
 
 void scheduler_init(void);
 void scheduler_enable_scheduling(void);
+void scheduler_get_info(struct system_scheduler_info* info);
 
 bigtime_t _user_estimate_max_scheduling_latency(thread_id thread);
+status_t _user_get_scheduler_thread_info(thread_id thread,
+	struct scheduler_thread_info* info, size_t size);
 status_t _user_analyze_scheduling(bigtime_t from, bigtime_t until, void* buffer,
 	size_t size, struct scheduling_analysis* analysis);
 
@@ -22,9 +22,16 @@ typedef struct object_depot {
 	size_t					empty_count;
 	size_t					max_count;
 	size_t					magazine_capacity;
+	size_t					min_magazine_capacity;
 	struct depot_cpu_store*	stores;
 	void*					cookie;
 
+	// statistics, protected by inner_lock
+	uint64					exchange_count;
+	uint64					contention_count;
+	uint32					resize_contention_count;
+	uint32					resize_count;
+
 	void (*return_object)(struct object_depot* depot, void* cookie,
 		void* object, uint32 flags);
 } object_depot;
@@ -32,6 +32,7 @@ enum {
 
 struct ObjectCache;
 typedef struct ObjectCache object_cache;
+struct system_object_cache_info;
 
 typedef status_t (*object_cache_constructor)(void* cookie, void* object);
 typedef void (*object_cache_destructor)(void* cookie, void* object);
@@ -64,6 +65,9 @@ status_t object_cache_reserve(object_cache* cache, size_t object_count,
 
 void object_cache_get_usage(object_cache* cache, size_t* _allocatedMemory);
 
+status_t object_cache_get_user_info(struct system_object_cache_info* userInfo,
+	size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -277,6 +277,8 @@ status_t	_user_socketpair(int family, int type, int protocol,
 				int *socketVector);
 status_t	_user_get_next_socket_stat(int family, uint32 *cookie,
 				struct net_stat *stat);
+ssize_t		_user_splice(int fromFD, off_t *fromOffset, int toFD,
+				off_t *toOffset, size_t count, uint32 flags);
 
 #ifdef __cplusplus
 }
@@ -160,6 +160,8 @@ public:
 									{ return -1; } // no restriction
 	virtual	int32				MaxPagesPerAsyncWrite() const
 									{ return -1; } // no restriction
+	virtual	dev_t				WriteBackDevice() const
+									{ return -1; } // no device
 
 	virtual	status_t			Fault(struct VMAddressSpace *aspace,
 									off_t offset);
@@ -72,6 +72,10 @@ struct VMTranslationMap {
 
 	virtual	void				Flush() = 0;
 
+	// large pages -- map locked
+	virtual	size_t				LargePageSize() const;
+	virtual	void				Promote(addr_t base, size_t size);
+
 protected:
 			void				PageUnmapped(VMArea* area,
 									page_num_t pageNumber, bool accessed,
@@ -23,6 +23,10 @@ struct vm_page_reservation {
 };
 
 
+// colour hint for vm_page_allocate_page_etc(), if the caller has no preference
+#define VM_PAGE_NO_COLOR_HINT	((page_num_t)-1)
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,6 +56,8 @@ status_t vm_page_write_modified_pages(struct VMCache *cache);
 void vm_page_schedule_write_page(struct vm_page *page);
 void vm_page_schedule_write_page_range(struct VMCache *cache,
 	uint32 firstPage, uint32 endPage);
+void vm_page_modified_pages_changed(struct VMCache *cache, int32 count);
+void vm_page_throttle_dirty_pages(struct VMCache *cache);
 
 void vm_page_unreserve_pages(vm_page_reservation* reservation);
 void vm_page_reserve_pages(vm_page_reservation* reservation, uint32 count,
@@ -61,8 +67,13 @@ bool vm_page_try_reserve_pages(vm_page_reservation* reservation, uint32 count,
 
 struct vm_page *vm_page_allocate_page(vm_page_reservation* reservation,
 	uint32 flags);
+struct vm_page *vm_page_allocate_page_etc(vm_page_reservation* reservation,
+	uint32 flags, page_num_t colorHint);
 struct vm_page *vm_page_allocate_page_run(uint32 flags, page_num_t length,
 	const physical_address_restrictions* restrictions, int priority);
+struct vm_page *vm_page_allocate_reserved_page_run(
+	vm_page_reservation* reservation, uint32 flags, page_num_t length,
+	const physical_address_restrictions* restrictions);
 struct vm_page *vm_page_at_index(int32 index);
 struct vm_page *vm_lookup_page(page_num_t pageNumber);
 bool vm_page_is_dummy(struct vm_page *page);
@@ -35,6 +35,9 @@ typedef struct net_buffer {
 	uint32					flags;
 	uint32					size;
 	uint8					protocol;
+	uint16					segment_size;
+		// if not 0, the buffer is a TCP super-segment that has to be split
+		// into segments carrying this many bytes of payload each
 } net_buffer;
 
 struct ancillary_data_container;
@@ -67,6 +70,9 @@ struct net_buffer_module_info {
 	status_t		(*trim)(net_buffer* buffer, size_t newSize);
 	status_t		(*append_cloned)(net_buffer* buffer, net_buffer* source,
 						uint32 offset, size_t bytes);
+	status_t		(*append_external)(net_buffer* buffer, const void* data,
+						size_t bytes, void (*release)(void* cookie),
+						void* cookie);
 
 	status_t		(*associate_data)(net_buffer* buffer, void* data);
 
@@ -14,6 +14,12 @@
 typedef struct net_buffer net_buffer;
 
 
+// net_device::offload
+#define NET_DEVICE_OFFLOAD_TCP_SEGMENTATION	0x01
+	// the device accepts TCP super-segments (see net_buffer::segment_size)
+	// and splits them itself
+
+
 struct net_hardware_address {
 	uint8	data[64];
 	uint8	length;
@@ -31,6 +37,7 @@ typedef struct net_device {
 	uint64	link_speed;
 	uint32	link_quality;
 	size_t	header_length;
+	uint32	offload;	// NET_DEVICE_OFFLOAD_*
 
 	struct net_hardware_address address;
 
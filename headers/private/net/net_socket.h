@@ -112,6 +112,9 @@ struct net_socket_module_info {
 					size_t length, int flags);
 	ssize_t		(*send)(net_socket* socket, struct msghdr* , const void* data,
 					size_t length, int flags);
+	ssize_t		(*send_external)(net_socket* socket, const void* data,
+					size_t length, int flags, void (*release)(void* cookie),
+					void* cookie);
 	int			(*setsockopt)(net_socket* socket, int level, int option,
 					const void* optionValue, int optionLength);
 	int			(*shutdown)(net_socket* socket, int direction);
@@ -50,6 +50,9 @@ struct net_stack_interface_module_info {
 					socklen_t addressLength);
 	ssize_t (*sendmsg)(net_socket* socket, const struct msghdr* message,
 					int flags);
+	ssize_t (*send_external)(net_socket* socket, const void* data,
+					size_t length, int flags, void (*release)(void* cookie),
+					void* cookie);
 
 	status_t (*getsockopt)(net_socket* socket, int level, int option,
 					void* value, socklen_t* _length);
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef _SYSTEM_EVENT_QUEUE_DEFS_H
+#define _SYSTEM_EVENT_QUEUE_DEFS_H
+
+
+#include <OS.h>
+
+
+// flags for event_wait_info::flags
+#define B_EVENT_LEVEL_TRIGGERED		0x0001
+	// The object is reported by _kern_event_queue_wait() for as long as the
+	// events are pending. Without this flag, it is only reported again after
+	// a new event occurred (edge triggered).
+
+
+/*!	Used to describe the interest in an object when passed to
+	_kern_event_queue_select(), and the events that occurred when returned
+	from _kern_event_queue_wait().
+	An \c events mask of 0 removes the object from the queue.
+*/
+typedef struct event_wait_info {
+	int32		object;
+	uint16		type;		// B_OBJECT_TYPE_*
+	uint16		flags;		// B_EVENT_LEVEL_TRIGGERED
+	uint16		events;		// B_EVENT_* mask
+	void*		user_data;
+} event_wait_info;
+
+
+#endif	/* _SYSTEM_EVENT_QUEUE_DEFS_H */
@@ -8,6 +8,30 @@
 #include <OS.h>
 
 
+// wait-to-run latency histogram: bucket i counts the latencies below
+// 16 << (2 * i) microseconds, the last one all longer ones
+#define SCHEDULER_LATENCY_BUCKET_COUNT	8
+
+
+struct scheduler_thread_info {
+	int64		latencies;
+	bigtime_t	total_latency;
+	bigtime_t	max_latency;
+	int64		latency_histogram[SCHEDULER_LATENCY_BUCKET_COUNT];
+
+	int64		involuntary_switches;
+	int64		migrations;
+};
+
+
+struct scheduler_cpu_info {
+	int32		run_queue_depth;
+	int64		context_switches;
+	int64		involuntary_switches;
+	int64		migrations;
+};
+
+
 struct scheduling_analysis_thread_wait_object;
 
 struct scheduling_analysis_thread {
@@ -32,8 +56,9 @@ struct scheduling_analysis_thread {
 	bigtime_t	unspecified_wait_time;
 
 	int64		preemptions;
+	int64		migrations;
 
-	scheduling_analysis_thread_wait_object* wait_objects;
+	struct scheduling_analysis_thread_wait_object* wait_objects;
 };
 
 
@@ -46,19 +71,28 @@ struct scheduling_analysis_wait_object {
 
 
 struct scheduling_analysis_thread_wait_object {
-	thread_id								thread;
-	scheduling_analysis_wait_object*		wait_object;
-	bigtime_t								wait_time;
-	int64									waits;
-	scheduling_analysis_thread_wait_object*	next_in_list;
+	thread_id										thread;
+	struct scheduling_analysis_wait_object*			wait_object;
+	bigtime_t										wait_time;
+	int64											waits;
+	struct scheduling_analysis_thread_wait_object*	next_in_list;
+};
+
+
+struct scheduling_analysis_cpu {
+	int64		runs;
+	bigtime_t	total_run_time;
+	int64		migrations;
 };
 
 
 struct scheduling_analysis {
-	uint32							thread_count;
-	scheduling_analysis_thread**	threads;
-	uint64							wait_object_count;
-	uint64							thread_wait_object_count;
+	uint32								thread_count;
+	struct scheduling_analysis_thread**	threads;
+	uint64								wait_object_count;
+	uint64								thread_wait_object_count;
+	uint32								cpu_count;
+	struct scheduling_analysis_cpu*		cpus;
 };
 
 
@@ -22,6 +22,7 @@ extern "C" {
 struct attr_info;
 struct dirent;
 struct Elf32_Sym;
+struct event_wait_info;
 struct fd_info;
 struct fd_set;
 struct fs_info;
@@ -30,6 +31,7 @@ struct msqid_ds;
 struct net_stat;
 struct pollfd;
 struct rlimit;
+struct scheduler_thread_info;
 struct scheduling_analysis;
 struct _sem_t;
 struct sembuf;
@@ -73,6 +75,14 @@ extern status_t		_kern_get_safemode_option(const char *parameter,
 extern ssize_t		_kern_wait_for_objects(object_wait_info* infos, int numInfos,
 						uint32 flags, bigtime_t timeout);
 
+/* event queue functions */
+extern int			_kern_event_queue_create(int openFlags);
+extern status_t		_kern_event_queue_select(int queue,
+						struct event_wait_info* infos, int numInfos);
+extern ssize_t		_kern_event_queue_wait(int queue,
+						struct event_wait_info* infos, int numInfos,
+						uint32 flags, bigtime_t timeout);
+
 /* user mutex functions */
 extern status_t		_kern_mutex_lock(int32* mutex, const char* name,
 						uint32 flags, bigtime_t timeout);
@@ -191,6 +201,8 @@ extern status_t		_kern_unblock_threads(thread_id* threads, uint32 count,
 						status_t status);
 
 extern bigtime_t	_kern_estimate_max_scheduling_latency(thread_id thread);
+extern status_t		_kern_get_scheduler_thread_info(thread_id thread,
+						struct scheduler_thread_info* info, size_t size);
 
 // user/group functions
 extern gid_t		_kern_getgid(bool effective);
@@ -368,6 +380,8 @@ extern status_t		_kern_socketpair(int family, int type, int protocol,
 						int *socketVector);
 extern status_t		_kern_get_next_socket_stat(int family, uint32 *cookie,
 						struct net_stat *stat);
+extern ssize_t		_kern_splice(int fromFD, off_t *fromOffset, int toFD,
+						off_t *toOffset, size_t count, uint32 flags);
 
 // node monitor functions
 extern status_t		_kern_stop_notifying(port_id port, uint32 token);
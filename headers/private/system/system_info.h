@@ -8,8 +8,12 @@
 
 #include <OS.h>
 
+#include <scheduler_defs.h>
 
-#define B_MEMORY_INFO	'memo'
+
+#define B_MEMORY_INFO			'memo'
+#define B_SCHEDULER_INFO		'schd'
+#define B_OBJECT_CACHE_INFO		'objc'
 
 struct system_memory_info {
 	uint64		max_memory;
@@ -23,6 +27,30 @@ struct system_memory_info {
 	// TODO: add active/inactive page counts, swap in/out, ...
 };
 
+struct object_cache_info {
+	char		name[B_OS_NAME_LENGTH];
+	size_t		object_size;
+	size_t		usage;
+	size_t		used_count;
+	size_t		total_objects;
+
+	// per-CPU magazine depot
+	size_t		magazine_capacity;
+	uint64		depot_exchanges;
+	uint64		depot_contentions;
+};
+
+struct system_object_cache_info {
+	uint32					cache_count;	// caches in the system
+	uint32					info_count;		// entries filled in below
+	struct object_cache_info	caches[0];
+};
+
+struct system_scheduler_info {
+	uint32						cpu_count;
+	struct scheduler_cpu_info	cpus[B_MAX_CPU_COUNT];
+};
+
 
 enum {
 	// team creation or deletion; object == -1; either one also triggers on
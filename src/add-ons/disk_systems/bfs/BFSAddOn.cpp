@@ -235,7 +235,7 @@ BFSPartitionHandle::Repair(bool checkOnly)
 	struct check_control result;
 	memset(&result, 0, sizeof(result));
 	result.magic = BFS_IOCTL_CHECK_MAGIC;
-	result.flags = 0;
+	result.flags = BFS_CHECK_EXTENDED_STATS;
 	if (!checkOnly) {
 		//printf("will fix any severe errors!\n");
 		result.flags |= BFS_FIX_BITMAP_ERRORS | BFS_REMOVE_WRONG_TYPES
@@ -326,6 +326,27 @@ BFSPartitionHandle::Repair(bool checkOnly)
 	// TODO: this is currently not maintained correctly
 	//printf("\tpartial block runs\t%" B_PRIu64 "\n",
 	//	result.stats.partial_block_runs);
+	printf("\tfile fragments\t\t\t%" B_PRIu64 " (%" B_PRIu64
+		" fragmented files)\n", result.extended_stats.file_fragments,
+		result.extended_stats.fragmented_files);
+
+	free_space_report freeSpace;
+	if (ioctl(fd, BFS_IOCTL_FREE_SPACE_REPORT, &freeSpace,
+			sizeof(freeSpace)) == 0) {
+		printf("\n\tfree extents\t\t\t%" B_PRIu64 " (%s, largest %s)\n",
+			freeSpace.free_extents, size_string(1.0 * freeSpace.free_blocks
+				* freeSpace.block_size).String(),
+			size_string(1.0 * freeSpace.largest_free_extent
+				* freeSpace.block_size).String());
+		for (int32 i = 0; i < BFS_FREE_EXTENT_SIZE_CLASSES; i++) {
+			if (freeSpace.extents_by_size[i] == 0)
+				continue;
+			printf("\t  %6" B_PRIu64 "+ blocks\t\t%" B_PRIu64 "\n",
+				(uint64)1 << i, freeSpace.extents_by_size[i]);
+		}
+		printf("\tfragmented groups\t\t%" B_PRIu32 "\n",
+			freeSpace.fragmented_groups);
+	}
 
 	if (result.status == B_ENTRY_NOT_FOUND)
 		result.status = B_OK;
@@ -25,7 +25,7 @@
 #include <vm/vm_page.h>
 
 #include "IOCache.h"
-#include "IOSchedulerSimple.h"
+#include "IOSchedulerRoster.h"
 
 
 //#define TRACE_CD_DISK
@@ -1002,9 +1002,9 @@ cd_set_capacity(cd_driver_info* info, uint64 capacity, uint32 blockSize)
 			info->io_scheduler = new(std::nothrow) IOCache(info->dma_resource,
 				1024 * 1024);
 		} else {
-			dprintf("scsi_cd: Using IOSchedulerSimple instead of IOCache to "
+			dprintf("scsi_cd: Using an I/O scheduler instead of IOCache to "
 				"avoid memory allocation issues.\n");
-			info->io_scheduler = new(std::nothrow) IOSchedulerSimple(
+			info->io_scheduler = IOSchedulerRoster::Default()->CreateScheduler(
 				info->dma_resource);
 		}
 
@@ -214,6 +214,149 @@ private:
 };
 
 
+// The number of changes made in a single transaction by BPlusTree::Compact()
+static const uint32 kCompactionStepsPerTransaction = 16;
+// Duplicate chains must be packed in a single transaction; longer chains
+// are left alone
+static const int32 kMaxPackedDuplicateNodes = 64;
+
+
+struct TreeCompaction {
+	enum {
+		kUnknownNode = 0,
+		kHeaderNode,
+		kFreeNode,
+		kIndexNode,
+		kLeafNode,
+		kDuplicateNode,
+		kFragmentNode
+	};
+
+	TreeCompaction(BPlusTree* tree, Transaction& transaction)
+		:
+		fTree(tree),
+		fTransaction(transaction),
+		fNodeSize(tree->NodeSize()),
+		fSteps(0),
+		fNodeCount(0),
+		fKinds(NULL),
+		fParents(NULL)
+	{
+		fBuffer = (uint8*)malloc(fNodeSize);
+	}
+
+	~TreeCompaction()
+	{
+		free(fBuffer);
+		free(fKinds);
+		free(fParents);
+	}
+
+	status_t InitCheck() const
+	{
+		return fBuffer != NULL ? B_OK : B_NO_MEMORY;
+	}
+
+	Transaction& GetTransaction()
+	{
+		return fTransaction;
+	}
+
+	uint8* Buffer() const
+	{
+		return fBuffer;
+	}
+
+	/*!	Counts a change to the tree, and restarts the transaction every
+		few of them, so that it doesn't get too large.
+	*/
+	status_t Step()
+	{
+		if (++fSteps % kCompactionStepsPerTransaction != 0)
+			return B_OK;
+
+		return Restart();
+	}
+
+	status_t Restart()
+	{
+		Inode* stream = fTree->Stream();
+
+		status_t status = fTransaction.Done();
+		if (status != B_OK)
+			return status;
+
+		status = fTransaction.Start(stream->GetVolume(), stream->BlockNumber());
+		if (status != B_OK)
+			return status;
+
+		stream->WriteLockInTransaction(fTransaction);
+		return B_OK;
+	}
+
+	status_t InitNodes(uint32 count)
+	{
+		fKinds = (uint8*)calloc(count, sizeof(uint8));
+		fParents = (off_t*)calloc(count, sizeof(off_t));
+		if (fKinds == NULL || fParents == NULL)
+			return B_NO_MEMORY;
+
+		fNodeCount = count;
+		return B_OK;
+	}
+
+	off_t End() const
+	{
+		return (off_t)fNodeCount * fNodeSize;
+	}
+
+	void SetEnd(off_t end)
+	{
+		fNodeCount = end / fNodeSize;
+	}
+
+	bool IsValidNode(off_t offset) const
+	{
+		return offset >= 0 && offset < End() && offset % fNodeSize == 0;
+	}
+
+	bool IsUnknown(off_t offset) const
+	{
+		return IsValidNode(offset) && Kind(offset) == kUnknownNode;
+	}
+
+	uint8 Kind(off_t offset) const
+	{
+		return fKinds[offset / fNodeSize];
+	}
+
+	void SetKind(off_t offset, uint8 kind)
+	{
+		fKinds[offset / fNodeSize] = kind;
+	}
+
+	off_t Parent(off_t offset) const
+	{
+		return fParents[offset / fNodeSize];
+	}
+
+	void SetParent(off_t offset, off_t parent)
+	{
+		fParents[offset / fNodeSize] = parent;
+	}
+
+private:
+			BPlusTree*			fTree;
+			Transaction&		fTransaction;
+			uint32				fNodeSize;
+			uint32				fSteps;
+			uint8*				fBuffer;
+			uint32				fNodeCount;
+			uint8*				fKinds;
+			off_t*				fParents;
+};
+
+
 // #pragma mark -
 
 
@@ -2198,6 +2341,105 @@ BPlusTree::Replace(Transaction& transaction, const uint8* key, uint16 keyLength,
 }
 
 
+/*!	Estimates the relative position of the key in the tree, without
+	reading more than one node per level. The position is between 0 for the
+	start, and BPLUSTREE_POSITION_SCALE for the end of the tree; a \c NULL
+	key refers to the start of the tree.
+	This assumes that the keys are evenly distributed among the nodes, which
+	is usually good enough to estimate how many entries lie between two
+	keys.
+*/
+status_t
+BPlusTree::EstimatePosition(const uint8* key, uint16 keyLength,
+	uint32& _position)
+{
+	if (key != NULL && (keyLength < BPLUSTREE_MIN_KEY_LENGTH
+			|| keyLength > BPLUSTREE_MAX_KEY_LENGTH))
+		RETURN_ERROR(B_BAD_VALUE);
+
+	InodeReadLocker locker(fStream);
+
+	uint64 position = 0;
+	uint64 span = BPLUSTREE_POSITION_SCALE;
+	uint32 levels = 0;
+
+	off_t nodeOffset = fHeader.RootNode();
+	CachedNode cached(this);
+	const bplustree_node* node;
+	while ((node = cached.SetTo(nodeOffset)) != NULL) {
+		bool isLeaf = node->OverflowLink() == BPLUSTREE_NULL;
+		uint16 keyIndex = 0;
+		off_t nextOffset;
+
+		if (key != NULL) {
+			status_t status = _FindKey(node, key, keyLength, &keyIndex,
+				&nextOffset);
+			if (status != B_OK && status != B_ENTRY_NOT_FOUND)
+				return status;
+		} else if (node->NumKeys() == 0)
+			nextOffset = node->OverflowLink();
+		else
+			nextOffset = BFS_ENDIAN_TO_HOST_INT64(node->Values()[0]);
+
+		// Inner nodes have one more child than they have keys
+		uint32 children = node->NumKeys() + (isLeaf ? 0 : 1);
+		if (children > 0) {
+			position += span * keyIndex / children;
+			span /= children;
+		}
+
+		if (isLeaf) {
+			_position = (uint32)min_c(position,
+				(uint64)BPLUSTREE_POSITION_SCALE);
+			return B_OK;
+		}
+
+		if (nextOffset == nodeOffset
+			|| ++levels > fHeader.MaxNumberOfLevels())
+			RETURN_ERROR(B_ERROR);
+
+		nodeOffset = nextOffset;
+	}
+
+	RETURN_ERROR(B_ERROR);
+}
+
+
+/*!	Estimates the number of entries in the tree from its size, and the
+	number of keys in its first leaf node. Duplicates are not taken into
+	account.
+*/
+off_t
+BPlusTree::EstimateEntries()
+{
+	InodeReadLocker locker(fStream);
+
+	off_t nodeOffset = fHeader.RootNode();
+	CachedNode cached(this);
+	const bplustree_node* node;
+	for (uint32 levels = 0; (node = cached.SetTo(nodeOffset)) != NULL;
+			levels++) {
+		if (node->OverflowLink() == BPLUSTREE_NULL) {
+			// the header occupies the first node
+			off_t nodes = fStream->Size() / fNodeSize - 1;
+			if (nodes < 1)
+				nodes = 1;
+
+			return nodes * max_c(node->NumKeys(), 1);
+		}
+
+		if (levels >= fHeader.MaxNumberOfLevels())
+			break;
+
+		nodeOffset = node->NumKeys() > 0
+			? BFS_ENDIAN_TO_HOST_INT64(node->Values()[0])
+			: node->OverflowLink();
+	}
+
+	return 0;
+}
+
+
 /*!	Searches the key in the tree, and stores the offset found in _value,
 	if successful.
 	It's very similar to BPlusTree::SeekDown(), but doesn't fill a stack
@@ -2481,6 +2723,808 @@ BPlusTree::_ValidateChild(TreeCheck& check, CachedNode& cached, uint32 level,
 }
 
 
+//	#pragma mark - compaction
+
+
+/*!	Rebuilds a tree that has become sparse by removals: neighbouring nodes
+	below the same parent are merged if they fit into a single node, the
+	nodes of duplicate chains are packed, index levels that only lead to a
+	single child are dropped, and finally, the used nodes are moved to the
+	start of the stream, so that it can be truncated behind the last one.
+	The work is split into several small transactions, each of which leaves
+	a valid tree behind. Since the tree must not be changed by anyone else
+	in between, the volume's journal must be locked by the caller (as during
+	the file system check).
+	Trees that are currently iterated over are left alone.
+*/
+status_t
+BPlusTree::Compact(uint32& _freedNodes, uint32& _removedLevels)
+{
+	_freedNodes = 0;
+	_removedLevels = 0;
+
+	WriteLocker locker(fStream->Lock());
+
+	{
+		MutexLocker iteratorLocker(fIteratorLock);
+		if (!fIterators.IsEmpty())
+			return B_BUSY;
+	}
+
+	off_t size = fHeader.MaximumSize();
+	uint32 levels = fHeader.MaxNumberOfLevels();
+	status_t status;
+
+	{
+		Transaction transaction(fStream->GetVolume(), fStream->BlockNumber());
+		fStream->WriteLockInTransaction(transaction);
+
+		TreeCompaction compaction(this, transaction);
+		status = compaction.InitCheck();
+		if (status == B_OK)
+			status = _CompactNode(compaction, fHeader.RootNode());
+		if (status == B_OK)
+			status = _CollapseRoot(compaction);
+		// Trees with inconsistent references are not rearranged
+		if (status == B_OK && _ClassifyNodes(compaction) == B_OK)
+			status = _RelocateNodes(compaction);
+		if (status == B_OK)
+			status = transaction.Done();
+	}
+
+	// The header has been reverted in case the last transaction failed
+	_freedNodes = (size - fHeader.MaximumSize()) / fNodeSize;
+	_removedLevels = levels - fHeader.MaxNumberOfLevels();
+
+	return status;
+}
+
+
+/*!	Compacts the subtree below the node at \a offset: the children of an
+	index node are compacted first, and then merged with each other where
+	possible. For leaf nodes, the duplicate chains are packed.
+*/
+status_t
+BPlusTree::_CompactNode(TreeCompaction& compaction, off_t offset)
+{
+	CachedNode cached(this);
+	const bplustree_node* node = cached.SetTo(offset);
+	if (node == NULL)
+		return B_IO_ERROR;
+
+	uint16 count = node->NumKeys();
+
+	if (node->IsLeaf()) {
+		if (!fAllowDuplicates)
+			return B_OK;
+
+		for (uint16 i = 0; i < count; i++) {
+			node = cached.SetTo(offset);
+			if (node == NULL)
+				return B_IO_ERROR;
+
+			off_t value = BFS_ENDIAN_TO_HOST_INT64(node->Values()[i]);
+			cached.Unset();
+
+			if (bplustree_node::LinkType(value) != BPLUSTREE_DUPLICATE_NODE)
+				continue;
+
+			status_t status = _PackDuplicates(compaction,
+				bplustree_node::FragmentOffset(value));
+			if (status != B_OK)
+				return status;
+		}
+		return B_OK;
+	}
+
+	off_t* children = (off_t*)malloc((count + 1) * sizeof(off_t));
+	if (children == NULL)
+		return B_NO_MEMORY;
+
+	MemoryDeleter childrenDeleter(children);
+
+	off_t* values = node->Values();
+	for (uint16 i = 0; i < count; i++)
+		children[i] = BFS_ENDIAN_TO_HOST_INT64(values[i]);
+	children[count] = node->OverflowLink();
+
+	cached.Unset();
+
+	for (uint16 i = 0; i <= count; i++) {
+		status_t status = _CompactNode(compaction, children[i]);
+		if (status != B_OK)
+			return status;
+	}
+
+	uint16 index = 0;
+	while (true) {
+		bool merged;
+		status_t status = _MergeChildren(compaction, offset, index, merged);
+		if (status == B_ENTRY_NOT_FOUND)
+			return B_OK;
+		if (status != B_OK)
+			return status;
+
+		if (merged) {
+			status = compaction.Step();
+			if (status != B_OK)
+				return status;
+		} else
+			index++;
+	}
+}
+
+
+/*!	Merges the right neighbour of the child at \a index of the parent node
+	into that child, if both of them fit into a single node, and leave some
+	room for it to grow.
+	Returns B_ENTRY_NOT_FOUND if there is no right neighbour below the
+	same parent.
+*/
+status_t
+BPlusTree::_MergeChildren(TreeCompaction& compaction, off_t parentOffset,
+	uint16 index, bool& _merged)
+{
+	Transaction& transaction = compaction.GetTransaction();
+	_merged = false;
+
+	CachedNode cachedParent(this);
+	const bplustree_node* parent = cachedParent.SetTo(parentOffset);
+	if (parent == NULL)
+		return B_IO_ERROR;
+
+	uint16 count = parent->NumKeys();
+	if (index >= count)
+		return B_ENTRY_NOT_FOUND;
+
+	off_t* values = parent->Values();
+	off_t leftOffset = BFS_ENDIAN_TO_HOST_INT64(values[index]);
+	off_t rightOffset = index + 1 < count
+		? BFS_ENDIAN_TO_HOST_INT64(values[index + 1]) : parent->OverflowLink();
+
+	CachedNode cachedLeft(this);
+	const bplustree_node* left = cachedLeft.SetTo(leftOffset);
+	CachedNode cachedRight(this);
+	const bplustree_node* right = cachedRight.SetTo(rightOffset);
+	if (left == NULL || right == NULL)
+		return B_IO_ERROR;
+
+	if (left->RightLink() != rightOffset || right->LeftLink() != leftOffset
+		|| left->IsLeaf() != right->IsLeaf())
+		return B_OK;
+
+	// Index nodes also get the key that separates them in the parent; its
+	// value is the overflow link of the left node
+	bool isLeaf = left->IsLeaf();
+	uint16 separatorLength = 0;
+	uint8* separator = parent->KeyAt(index, &separatorLength);
+
+	int32 keyCount = left->NumKeys() + right->NumKeys();
+	int32 keyLength = left->AllKeyLength() + right->AllKeyLength();
+	if (!isLeaf) {
+		keyCount++;
+		keyLength += separatorLength;
+	}
+
+	if (key_align(sizeof(bplustree_node) + keyLength)
+			+ keyCount * (sizeof(uint16) + sizeof(off_t)) > fNodeSize * 3 / 4)
+		return B_OK;
+
+	bplustree_node* merged = (bplustree_node*)compaction.Buffer();
+	memset(merged, 0, fNodeSize);
+	merged->left_link = left->left_link;
+	merged->right_link = right->right_link;
+	merged->overflow_link = right->overflow_link;
+	merged->all_key_count = HOST_ENDIAN_TO_BFS_INT16(keyCount);
+	merged->all_key_length = HOST_ENDIAN_TO_BFS_INT16(keyLength);
+
+	uint8* keys = merged->Keys();
+	uint16* keyLengths = merged->KeyLengths();
+	off_t* mergedValues = merged->Values();
+
+	memcpy(keys, left->Keys(), left->AllKeyLength());
+	memcpy(keyLengths, left->KeyLengths(), left->NumKeys() * sizeof(uint16));
+	memcpy(mergedValues, left->Values(), left->NumKeys() * sizeof(off_t));
+
+	uint16 length = left->AllKeyLength();
+	int32 next = left->NumKeys();
+	if (!isLeaf) {
+		memcpy(keys + length, separator, separatorLength);
+		length += separatorLength;
+		keyLengths[next] = HOST_ENDIAN_TO_BFS_INT16(length);
+		mergedValues[next] = left->overflow_link;
+		next++;
+	}
+
+	memcpy(keys + length, right->Keys(), right->AllKeyLength());
+	uint16* rightKeyLengths = right->KeyLengths();
+	for (int32 i = 0; i < right->NumKeys(); i++) {
+		keyLengths[next + i] = HOST_ENDIAN_TO_BFS_INT16(
+			BFS_ENDIAN_TO_HOST_INT16(rightKeyLengths[i]) + length);
+	}
+	memcpy(mergedValues + next, right->Values(),
+		right->NumKeys() * sizeof(off_t));
+
+	off_t nextOffset = right->RightLink();
+
+	// Replace the left node, and remove the right one from its level
+	bplustree_node* writableLeft = cachedLeft.MakeWritable(transaction);
+	if (writableLeft == NULL)
+		return B_IO_ERROR;
+
+	memcpy(writableLeft, merged, fNodeSize);
+
+	if (nextOffset != BPLUSTREE_NULL) {
+		CachedNode cachedNext(this);
+		bplustree_node* nextNode = cachedNext.SetToWritable(transaction,
+			nextOffset);
+		if (nextNode == NULL)
+			return B_IO_ERROR;
+
+		nextNode->left_link = HOST_ENDIAN_TO_BFS_INT64(leftOffset);
+	}
+
+	// The merged node takes over the place of the right one in the parent
+	bplustree_node* writableParent = cachedParent.MakeWritable(transaction);
+	if (writableParent == NULL)
+		return B_IO_ERROR;
+
+	if (index + 1 < count) {
+		writableParent->Values()[index + 1]
+			= HOST_ENDIAN_TO_BFS_INT64(leftOffset);
+	} else
+		writableParent->overflow_link = HOST_ENDIAN_TO_BFS_INT64(leftOffset);
+
+	_RemoveKey(writableParent, index);
+
+	if (cachedRight.MakeWritable(transaction) == NULL)
+		return B_IO_ERROR;
+
+	status_t status = cachedRight.Free(transaction, rightOffset);
+	if (status == B_OK)
+		_merged = true;
+
+	return status;
+}
+
+
+/*!	Moves the values of the duplicate chain starting at \a offset into as
+	few nodes as possible, and frees the nodes that are no longer needed.
+	Values are added to the first node that has room for them, so the chain
+	as a whole is not sorted; only the array of each node is.
+*/
+status_t
+BPlusTree::_PackDuplicates(TreeCompaction& compaction, off_t offset)
+{
+	Transaction& transaction = compaction.GetTransaction();
+	CachedNode cached(this);
+
+	int32 nodeCount = 0;
+	int32 valueCount = 0;
+	for (off_t duplicate = offset; duplicate != BPLUSTREE_NULL;) {
+		const bplustree_node* node = cached.SetTo(duplicate, false);
+		if (node == NULL)
+			return B_IO_ERROR;
+
+		// Long chains don't fit into a single transaction
+		if (++nodeCount > kMaxPackedDuplicateNodes)
+			return B_OK;
+
+		valueCount += node->DuplicateArray()->Count();
+		duplicate = node->RightLink();
+	}
+
+	int32 neededNodes = max_c(1, (valueCount + NUM_DUPLICATE_VALUES - 1)
+		/ NUM_DUPLICATE_VALUES);
+	if (neededNodes >= nodeCount)
+		return B_OK;
+
+	off_t* buffer = (off_t*)compaction.Buffer();
+	off_t readOffset = offset;
+	int32 readIndex = 0;
+	off_t writeOffset = offset;
+
+	for (int32 i = 0; i < neededNodes; i++) {
+		// Collect the values for the next node; since no node can hold more
+		// than that, all nodes up to the one we write have been read by now
+		int32 count = 0;
+		while (count < NUM_DUPLICATE_VALUES && readOffset != BPLUSTREE_NULL) {
+			const bplustree_node* node = cached.SetTo(readOffset, false);
+			if (node == NULL)
+				return B_IO_ERROR;
+
+			duplicate_array* array = node->DuplicateArray();
+			while (readIndex < array->Count() && count < NUM_DUPLICATE_VALUES)
+				buffer[count++] = array->ValueAt(readIndex++);
+
+			if (readIndex >= array->Count()) {
+				readOffset = node->RightLink();
+				readIndex = 0;
+			}
+		}
+
+		bplustree_node* node = cached.SetToWritable(transaction, writeOffset,
+			false);
+		if (node == NULL)
+			return B_IO_ERROR;
+
+		duplicate_array* array = node->DuplicateArray();
+		array->count = 0;
+		for (int32 j = 0; j < count; j++)
+			array->Insert(buffer[j]);
+
+		writeOffset = node->RightLink();
+		if (i == neededNodes - 1) {
+			node->right_link
+				= HOST_ENDIAN_TO_BFS_INT64((uint64)BPLUSTREE_NULL);
+		}
+	}
+
+	// Free the rest of the chain
+	while (writeOffset != BPLUSTREE_NULL) {
+		bplustree_node* node = cached.SetToWritable(transaction, writeOffset,
+			false);
+		if (node == NULL)
+			return B_IO_ERROR;
+
+		off_t next = node->RightLink();
+		status_t status = cached.Free(transaction, writeOffset);
+		if (status != B_OK)
+			return status;
+
+		writeOffset = next;
+	}
+
+	return compaction.Step();
+}
+
+
+//!	Removes index levels from the top of the tree that only have one child.
+status_t
+BPlusTree::_CollapseRoot(TreeCompaction& compaction)
+{
+	Transaction& transaction = compaction.GetTransaction();
+
+	while (true) {
+		off_t rootOffset = fHeader.RootNode();
+
+		CachedNode cached(this);
+		const bplustree_node* root = cached.SetTo(rootOffset);
+		if (root == NULL)
+			return B_IO_ERROR;
+
+		if (root->IsLeaf() || root->NumKeys() > 0)
+			return B_OK;
+
+		off_t child = root->OverflowLink();
+
+		if (cached.MakeWritable(transaction) == NULL)
+			return B_IO_ERROR;
+
+		status_t status = cached.Free(transaction, rootOffset);
+		if (status != B_OK)
+			return status;
+
+		CachedNode cachedHeader(this);
+		bplustree_header* header = cachedHeader.SetToWritableHeader(
+			transaction);
+		if (header == NULL)
+			return B_IO_ERROR;
+
+		header->root_node_pointer = HOST_ENDIAN_TO_BFS_INT64(child);
+		header->max_number_of_levels = HOST_ENDIAN_TO_BFS_INT32(
+			header->MaxNumberOfLevels() - 1);
+		cachedHeader.Unset();
+
+		status = compaction.Step();
+		if (status != B_OK)
+			return status;
+	}
+}
+
+
+/*!	Determines the kind of each node of the tree, and who references it, so
+	that nodes can be moved around later. Nodes that cannot be reached are
+	left in place.
+*/
+status_t
+BPlusTree::_ClassifyNodes(TreeCompaction& compaction)
+{
+	status_t status = compaction.InitNodes(fHeader.MaximumSize() / fNodeSize);
+	if (status != B_OK)
+		return status;
+
+	compaction.SetKind(0, TreeCompaction::kHeaderNode);
+
+	CachedNode cached(this);
+	off_t offset = fHeader.FreeNode();
+	while (offset > 0) {
+		if (!compaction.IsUnknown(offset))
+			return B_BAD_DATA;
+
+		const bplustree_node* node = cached.SetTo(offset, false);
+		if (node == NULL)
+			return B_IO_ERROR;
+
+		compaction.SetKind(offset, TreeCompaction::kFreeNode);
+		offset = node->LeftLink();
+	}
+
+	Stack<off_t> stack;
+	if (stack.Push(fHeader.RootNode()) != B_OK)
+		return B_NO_MEMORY;
+
+	CachedNode cachedDuplicate(this);
+
+	while (stack.Pop(&offset)) {
+		if (!compaction.IsUnknown(offset))
+			return B_BAD_DATA;
+
+		const bplustree_node* node = cached.SetTo(offset);
+		if (node == NULL)
+			return B_BAD_DATA;
+
+		off_t* values = node->Values();
+		uint16 count = node->NumKeys();
+
+		if (!node->IsLeaf()) {
+			compaction.SetKind(offset, TreeCompaction::kIndexNode);
+
+			for (uint16 i = 0; i <= count; i++) {
+				off_t child = i < count
+					? BFS_ENDIAN_TO_HOST_INT64(values[i])
+					: node->OverflowLink();
+				if (!compaction.IsValidNode(child))
+					return B_BAD_DATA;
+
+				compaction.SetParent(child, offset);
+				if (stack.Push(child) != B_OK)
+					return B_NO_MEMORY;
+			}
+			continue;
+		}
+
+		compaction.SetKind(offset, TreeCompaction::kLeafNode);
+
+		for (uint16 i = 0; i < count; i++) {
+			off_t value = BFS_ENDIAN_TO_HOST_INT64(values[i]);
+			off_t duplicate = bplustree_node::FragmentOffset(value);
+
+			switch (bplustree_node::LinkType(value)) {
+				case BPLUSTREE_DUPLICATE_FRAGMENT:
+					// Fragment nodes may be shared by several keys
+					if (compaction.IsUnknown(duplicate)) {
+						compaction.SetKind(duplicate,
+							TreeCompaction::kFragmentNode);
+					} else if (!compaction.IsValidNode(duplicate)
+						|| compaction.Kind(duplicate)
+							!= TreeCompaction::kFragmentNode)
+						return B_BAD_DATA;
+					break;
+
+				case BPLUSTREE_DUPLICATE_NODE:
+					// Only the first node of the chain is referenced by the
+					// leaf, the others are found via their siblings
+					if (!compaction.IsValidNode(duplicate))
+						return B_BAD_DATA;
+
+					compaction.SetParent(duplicate, offset);
+
+					while (duplicate != BPLUSTREE_NULL) {
+						if (!compaction.IsUnknown(duplicate))
+							return B_BAD_DATA;
+
+						const bplustree_node* duplicateNode
+							= cachedDuplicate.SetTo(duplicate, false);
+						if (duplicateNode == NULL)
+							return B_IO_ERROR;
+
+						compaction.SetKind(duplicate,
+							TreeCompaction::kDuplicateNode);
+						duplicate = duplicateNode->RightLink();
+					}
+					break;
+			}
+		}
+	}
+
+	return B_OK;
+}
+
+
+/*!	Moves the used nodes at the end of the stream into the free nodes before
+	them, and truncates the stream behind the last used node. This is done
+	in batches; the free nodes list is adapted to the outcome of each batch
+	before it is carried out, as it is overwritten by the moved nodes.
+*/
+status_t
+BPlusTree::_RelocateNodes(TreeCompaction& compaction)
+{
+	Transaction& transaction = compaction.GetTransaction();
+
+	while (true) {
+		off_t sources[kCompactionStepsPerTransaction];
+		off_t targets[kCompactionStepsPerTransaction];
+		int32 count = 0;
+
+		off_t low = fNodeSize;
+		off_t high = compaction.End() - fNodeSize;
+		while (count < (int32)kCompactionStepsPerTransaction) {
+			while (high > 0
+				&& compaction.Kind(high) == TreeCompaction::kFreeNode)
+				high -= fNodeSize;
+			while (low < high
+				&& compaction.Kind(low) != TreeCompaction::kFreeNode)
+				low += fNodeSize;
+
+			// Unreachable nodes cannot be moved
+			if (low >= high
+				|| compaction.Kind(high) == TreeCompaction::kUnknownNode)
+				break;
+
+			sources[count] = high;
+			targets[count] = low;
+			count++;
+
+			high -= fNodeSize;
+			low += fNodeSize;
+		}
+
+		// Find out where the stream ends after this batch
+		while (high > 0 && compaction.Kind(high) == TreeCompaction::kFreeNode)
+			high -= fNodeSize;
+		if (count > 0 && targets[count - 1] > high)
+			high = targets[count - 1];
+
+		off_t end = high + fNodeSize;
+		if (count == 0 && end == fHeader.MaximumSize())
+			return B_OK;
+
+		status_t status = _UnlinkFreeNodes(compaction, targets, count, end);
+		if (status != B_OK)
+			return status;
+
+		for (int32 i = 0; i < count; i++) {
+			status = _MoveNode(compaction, sources[i], targets[i]);
+			if (status != B_OK)
+				return status;
+		}
+
+		if (end < fHeader.MaximumSize()) {
+			CachedNode cached(this);
+			bplustree_header* header = cached.SetToWritableHeader(transaction);
+			if (header == NULL)
+				return B_IO_ERROR;
+
+			header->maximum_size = HOST_ENDIAN_TO_BFS_INT64(end);
+			cached.Unset();
+
+			status = fStream->SetFileSize(transaction, end);
+			if (status != B_OK)
+				return status;
+
+			compaction.SetEnd(end);
+		}
+
+		if (count == 0)
+			return B_OK;
+
+		status = compaction.Restart();
+		if (status != B_OK)
+			return status;
+	}
+}
+
+
+/*!	Copies the node at \a from to the free node at \a to, and updates all
+	references to it.
+*/
+status_t
+BPlusTree::_MoveNode(TreeCompaction& compaction, off_t from, off_t to)
+{
+	Transaction& transaction = compaction.GetTransaction();
+	uint8 kind = compaction.Kind(from);
+
+	CachedNode cachedSource(this);
+	const bplustree_node* source = cachedSource.SetTo(from, false);
+	CachedNode cachedTarget(this);
+	bplustree_node* target = cachedTarget.SetToWritable(transaction, to, false);
+	if (source == NULL || target == NULL)
+		return B_IO_ERROR;
+
+	memcpy(target, source, fNodeSize);
+	cachedSource.Unset();
+
+	compaction.SetKind(to, kind);
+	compaction.SetParent(to, compaction.Parent(from));
+	compaction.SetKind(from, TreeCompaction::kFreeNode);
+
+	off_t leftOffset = target->LeftLink();
+	off_t rightOffset = target->RightLink();
+	CachedNode cached(this);
+
+	switch (kind) {
+		case TreeCompaction::kIndexNode:
+		case TreeCompaction::kLeafNode:
+		{
+			off_t parentOffset = compaction.Parent(to);
+			if (parentOffset == 0) {
+				bplustree_header* header = cached.SetToWritableHeader(
+					transaction);
+				if (header == NULL)
+					return B_IO_ERROR;
+
+				header->root_node_pointer = HOST_ENDIAN_TO_BFS_INT64(to);
+			} else {
+				bplustree_node* parent = cached.SetToWritable(transaction,
+					parentOffset);
+				if (parent == NULL)
+					return B_IO_ERROR;
+
+				off_t* values = parent->Values();
+				for (uint16 i = 0; i < parent->NumKeys(); i++) {
+					if (BFS_ENDIAN_TO_HOST_INT64(values[i]) == from)
+						values[i] = HOST_ENDIAN_TO_BFS_INT64(to);
+				}
+				if (parent->OverflowLink() == from)
+					parent->overflow_link = HOST_ENDIAN_TO_BFS_INT64(to);
+			}
+
+			// Update the nodes that reference this one as their parent
+			off_t* values = target->Values();
+			uint16 count = target->NumKeys();
+			for (uint16 i = 0; i < count; i++) {
+				off_t value = BFS_ENDIAN_TO_HOST_INT64(values[i]);
+				if (kind == TreeCompaction::kIndexNode)
+					compaction.SetParent(value, to);
+				else if (bplustree_node::LinkType(value)
+						== BPLUSTREE_DUPLICATE_NODE) {
+					compaction.SetParent(
+						bplustree_node::FragmentOffset(value), to);
+				}
+			}
+			if (kind == TreeCompaction::kIndexNode)
+				compaction.SetParent(target->OverflowLink(), to);
+			break;
+		}
+
+		case TreeCompaction::kDuplicateNode:
+			if (leftOffset == BPLUSTREE_NULL) {
+				// This is the first node of the chain
+				bplustree_node* leaf = cached.SetToWritable(transaction,
+					compaction.Parent(to));
+				if (leaf == NULL)
+					return B_IO_ERROR;
+
+				off_t* values = leaf->Values();
+				for (uint16 i = 0; i < leaf->NumKeys(); i++) {
+					off_t value = BFS_ENDIAN_TO_HOST_INT64(values[i]);
+					if (bplustree_node::LinkType(value)
+							== BPLUSTREE_DUPLICATE_NODE
+						&& bplustree_node::FragmentOffset(value) == from) {
+						values[i] = HOST_ENDIAN_TO_BFS_INT64(
+							bplustree_node::MakeLink(BPLUSTREE_DUPLICATE_NODE,
+								to));
+					}
+				}
+			}
+			break;
+
+		case TreeCompaction::kFragmentNode:
+		{
+			// Fragments don't have a link back to the keys that use them, so
+			// all leaves have to be searched
+			for (off_t offset = fNodeSize; offset < compaction.End();
+					offset += fNodeSize) {
+				if (compaction.Kind(offset) != TreeCompaction::kLeafNode)
+					continue;
+
+				const bplustree_node* leaf = cached.SetTo(offset);
+				if (leaf == NULL)
+					return B_IO_ERROR;
+
+				off_t* values = leaf->Values();
+				for (uint16 i = 0; i < leaf->NumKeys(); i++) {
+					off_t value = BFS_ENDIAN_TO_HOST_INT64(values[i]);
+					if (bplustree_node::LinkType(value)
+							!= BPLUSTREE_DUPLICATE_FRAGMENT
+						|| bplustree_node::FragmentOffset(value) != from)
+						continue;
+
+					bplustree_node* writableLeaf
+						= cached.MakeWritable(transaction);
+					if (writableLeaf == NULL)
+						return B_IO_ERROR;
+
+					writableLeaf->Values()[i] = HOST_ENDIAN_TO_BFS_INT64(
+						bplustree_node::MakeLink(BPLUSTREE_DUPLICATE_FRAGMENT,
+							to, bplustree_node::FragmentIndex(value)));
+				}
+			}
+			return B_OK;
+		}
+
+		default:
+			return B_BAD_DATA;
+	}
+
+	// Update the siblings on the same level, or in the same duplicate chain
+	if (leftOffset != BPLUSTREE_NULL) {
+		bplustree_node* left = cached.SetToWritable(transaction, leftOffset,
+			false);
+		if (left == NULL)
+			return B_IO_ERROR;
+
+		left->right_link = HOST_ENDIAN_TO_BFS_INT64(to);
+	}
+	if (rightOffset != BPLUSTREE_NULL) {
+		bplustree_node* right = cached.SetToWritable(transaction, rightOffset,
+			false);
+		if (right == NULL)
+			return B_IO_ERROR;
+
+		right->left_link = HOST_ENDIAN_TO_BFS_INT64(to);
+	}
+
+	return B_OK;
+}
+
+
+/*!	Removes the nodes in \a targets that are about to be used, and all nodes
+	behind \a end from the free nodes list.
+*/
+status_t
+BPlusTree::_UnlinkFreeNodes(TreeCompaction& compaction, const off_t* targets,
+	int32 count, off_t end)
+{
+	Transaction& transaction = compaction.GetTransaction();
+	CachedNode cached(this);
+	CachedNode cachedPrevious(this);
+
+	off_t previous = 0;
+	off_t offset = fHeader.FreeNode();
+	while (offset > 0) {
+		const bplustree_node* node = cached.SetTo(offset, false);
+		if (node == NULL)
+			return B_IO_ERROR;
+
+		off_t next = node->LeftLink();
+		cached.Unset();
+
+		bool unlink = offset >= end;
+		for (int32 i = 0; !unlink && i < count; i++)
+			unlink = targets[i] == offset;
+
+		if (!unlink) {
+			previous = offset;
+			offset = next;
+			continue;
+		}
+
+		if (previous == 0) {
+			bplustree_header* header = cachedPrevious.SetToWritableHeader(
+				transaction);
+			if (header == NULL)
+				return B_IO_ERROR;
+
+			header->free_node_pointer = HOST_ENDIAN_TO_BFS_INT64(next);
+			cachedPrevious.Unset();
+		} else {
+			bplustree_node* previousNode = cachedPrevious.SetToWritable(
+				transaction, previous, false);
+			if (previousNode == NULL)
+				return B_IO_ERROR;
+
+			previousNode->left_link = HOST_ENDIAN_TO_BFS_INT64(next);
+		}
+
+		offset = next;
+	}
+
+	return B_OK;
+}
+
+
 //	#pragma mark -
 
 
@@ -2754,6 +3798,36 @@ TreeIterator::SkipDuplicates()
 }
 
 
+/*!	Copies the values of the entries of the current node, beginning with the
+	current one, into \a values, and returns how many of them have been
+	copied, at most \a maxCount. Entries with duplicates are left out.
+	This allows to read ahead the inodes of a directory while it's iterated.
+*/
+int32
+TreeIterator::GetNodeValues(off_t* values, int32 maxCount)
+{
+	if (fTree == NULL || fCurrentNodeOffset == BPLUSTREE_NULL
+		|| fCurrentNodeOffset == BPLUSTREE_FREE || fCurrentKey < 0)
+		return 0;
+
+	InodeReadLocker locker(fTree->fStream);
+
+	CachedNode cached(fTree);
+	const bplustree_node* node = cached.SetTo(fCurrentNodeOffset);
+	if (node == NULL)
+		return 0;
+
+	int32 count = 0;
+	for (int32 i = fCurrentKey; i < node->NumKeys() && count < maxCount; i++) {
+		off_t value = BFS_ENDIAN_TO_HOST_INT64(node->Values()[i]);
+		if (!bplustree_node::IsDuplicate(value))
+			values[count++] = value;
+	}
+
+	return count;
+}
+
+
 void
 TreeIterator::Update(off_t offset, off_t nextOffset, uint16 keyIndex,
 	uint16 splitAt, int8 change)
@@ -47,6 +47,9 @@ struct bplustree_header {
 #define BPLUSTREE_MAX_KEY_LENGTH	256
 #define BPLUSTREE_MIN_KEY_LENGTH	1
 
+// the scale of the positions returned by BPlusTree::EstimatePosition()
+#define BPLUSTREE_POSITION_SCALE	(1UL << 24)
+
 enum bplustree_types {
 	BPLUSTREE_STRING_TYPE	= 0,
 	BPLUSTREE_INT32_TYPE	= 1,
@@ -138,6 +141,7 @@ class TreeIterator;
 class CachedNode;
 class Inode;
 struct TreeCheck;
+struct TreeCompaction;
 
 // needed for searching (utilizing a stack)
 struct node_and_key {
@@ -221,6 +225,8 @@ public:
 
 			status_t			Validate(bool repair, bool& _errorsFound);
 			status_t			MakeEmpty();
+			status_t			Compact(uint32& _freedNodes,
+									uint32& _removedLevels);
 
 			status_t			Remove(Transaction& transaction,
 									const uint8* key, uint16 keyLength,
@@ -252,6 +258,10 @@ public:
 			status_t			Find(const uint8* key, uint16 keyLength,
 									off_t* value);
 
+			status_t			EstimatePosition(const uint8* key,
+									uint16 keyLength, uint32& _position);
+			off_t				EstimateEntries();
+
 	static	int32				TypeCodeToKeyType(type_code code);
 	static	int32				ModeToKeyType(mode_t mode);
 
@@ -311,10 +321,27 @@ private:
 									off_t nextOffset, const uint8* key,
 									uint16 keyLength);
 
+			status_t			_CompactNode(TreeCompaction& compaction,
+									off_t offset);
+			status_t			_MergeChildren(TreeCompaction& compaction,
+									off_t parentOffset, uint16 index,
+									bool& _merged);
+			status_t			_PackDuplicates(TreeCompaction& compaction,
+									off_t offset);
+			status_t			_CollapseRoot(TreeCompaction& compaction);
+			status_t			_ClassifyNodes(TreeCompaction& compaction);
+			status_t			_RelocateNodes(TreeCompaction& compaction);
+			status_t			_MoveNode(TreeCompaction& compaction,
+									off_t from, off_t to);
+			status_t			_UnlinkFreeNodes(TreeCompaction& compaction,
+									const off_t* targets, int32 count,
+									off_t end);
+
 private:
 			friend class TreeIterator;
 			friend class CachedNode;
 			friend class TreeCheck;
+			friend struct TreeCompaction;
 
 			Inode*				fStream;
 			bplustree_header	fHeader;
@@ -354,6 +381,11 @@ public:
 									uint16* duplicate = NULL);
 			void				SkipDuplicates();
 
+			int32				GetNodeValues(off_t* values, int32 maxCount);
+			bool				IsAtNodeStart() const
+									{ return fCurrentKey == 0
+										&& fDuplicateNode == BPLUSTREE_NULL; }
+
 			BPlusTree*			Tree() const { return fTree; }
 
 #ifdef DEBUG
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -32,6 +33,13 @@
 // group can span several blocks in the block bitmap, the AllocationBlock
 // class is there to make handling those easier.
 
+// To avoid scanning the bitmap on every allocation, each AllocationGroup
+// also keeps a sorted list of its free extents in memory. It is only a hint:
+// the bitmap stays authoritative, and the list is rebuilt from it whenever
+// it turns out to be wrong (for example, after a transaction has been
+// aborted). Groups that are too fragmented to be described by the list are
+// scanned as before.
+
 // The current implementation is only slightly optimized and could probably
 // be improved a lot. Furthermore, the allocation policies used here should
 // have some real world tests.
@@ -195,6 +203,8 @@ struct check_cookie {
 	TreeIterator*		iterator;
 	check_control		control;
 	Stack<check_index*>	indices;
+	off_t				next_block;
+	uint32				fragments;
 };
 
 
@@ -222,9 +232,23 @@ private:
 };
 
 
+struct free_extent {
+	int32	start;
+	int32	length;
+};
+
+static const int32 kMaxGroupExtents = 64;
+	// number of free extents an allocation group keeps track of; if there
+	// are more, the group is considered to be fragmented
+static const int32 kReservationFactor = 4;
+	// how much space is reserved behind an allocation for a file, relative
+	// to the size of the allocation
+
+
 class AllocationGroup {
 public:
 	AllocationGroup();
+	~AllocationGroup();
 
 	void AddFreeRange(int32 start, int32 blocks);
 	bool IsFull() const { return fFreeBits == 0; }
@@ -236,9 +260,20 @@ public:
 	uint32 NumBlocks() const { return fNumBlocks; }
 	int32 Start() const { return fStart; }
 
+	void ResetExtents();
+	void InvalidateExtents() { fExtentsValid = false; }
+	bool HasExtents() const { return fExtentsValid; }
+	bool CanRebuildExtents() const
+		{ return !fExtentsValid && !fExtentsOverflow; }
+	bool IsFree(Volume* volume, int32 start, int32 length);
+
 private:
 	friend class BlockAllocator;
 
+	void _AddExtent(int32 start, int32 length);
+	void _RemoveExtent(int32 start, int32 length);
+	bool _InsertExtent(int32 index, int32 start, int32 length);
+
 	uint32	fNumBits;
 	uint32	fNumBlocks;
 	int32	fStart;
@@ -248,6 +283,11 @@ private:
 	int32	fLargestStart;
 	int32	fLargestLength;
 	bool	fLargestValid;
+
+	free_extent* fExtents;
+	int32	fExtentCount;
+	bool	fExtentsValid;
+	bool	fExtentsOverflow;
 };
 
 
@@ -377,8 +417,18 @@ AllocationGroup::AllocationGroup()
 	:
 	fFirstFree(-1),
 	fFreeBits(0),
-	fLargestValid(false)
+	fLargestValid(false),
+	fExtents(NULL),
+	fExtentCount(0),
+	fExtentsValid(false),
+	fExtentsOverflow(false)
+{
+}
+
+
+AllocationGroup::~AllocationGroup()
 {
+	delete[] fExtents;
 }
 
 
@@ -398,6 +448,163 @@ AllocationGroup::AddFreeRange(int32 start, int32 blocks)
 	}
 
 	fFreeBits += blocks;
+
+	if (fExtentsValid)
+		_AddExtent(start, blocks);
+}
+
+
+/*!	Empties the list of free extents, and marks it valid again, so that it
+	can be filled using AddFreeRange(), or _AddExtent().
+*/
+void
+AllocationGroup::ResetExtents()
+{
+	if (fExtents == NULL) {
+		fExtents = new(std::nothrow) free_extent[kMaxGroupExtents];
+		if (fExtents == NULL) {
+			fExtentsValid = false;
+			fExtentsOverflow = true;
+			return;
+		}
+	}
+
+	fExtentCount = 0;
+	fExtentsValid = true;
+	fExtentsOverflow = false;
+}
+
+
+/*!	Checks the on-disk bitmap whether or not all blocks in the specified
+	range are free.
+*/
+bool
+AllocationGroup::IsFree(Volume* volume, int32 start, int32 length)
+{
+	uint32 bitsPerBlock = volume->BlockSize() << 3;
+	uint32 block = start / bitsPerBlock;
+	uint32 bit = start % bitsPerBlock;
+
+	AllocationBlock cached(volume);
+
+	while (length > 0) {
+		if (cached.SetTo(*this, block) != B_OK)
+			return false;
+
+		for (; bit < cached.NumBlockBits() && length > 0; bit++, length--) {
+			if (cached.IsUsed(bit))
+				return false;
+		}
+
+		bit = 0;
+		block++;
+	}
+
+	return true;
+}
+
+
+/*!	Adds the range to the list of free extents, and merges it with its
+	neighbours. If the range overlaps an existing extent, the list is
+	out of date, and will be rebuilt on next use.
+*/
+void
+AllocationGroup::_AddExtent(int32 start, int32 length)
+{
+	// find the first extent that starts after the range
+	int32 index = 0;
+	while (index < fExtentCount && fExtents[index].start < start)
+		index++;
+
+	bool mergePrevious = false;
+	bool mergeNext = false;
+
+	if (index > 0) {
+		free_extent& previous = fExtents[index - 1];
+		if (previous.start + previous.length > start) {
+			fExtentsValid = false;
+			return;
+		}
+		mergePrevious = previous.start + previous.length == start;
+	}
+	if (index < fExtentCount) {
+		free_extent& next = fExtents[index];
+		if (start + length > next.start) {
+			fExtentsValid = false;
+			return;
+		}
+		mergeNext = start + length == next.start;
+	}
+
+	if (mergePrevious && mergeNext) {
+		fExtents[index - 1].length += length + fExtents[index].length;
+		memmove(&fExtents[index], &fExtents[index + 1],
+			(fExtentCount - index - 1) * sizeof(free_extent));
+		fExtentCount--;
+	} else if (mergePrevious)
+		fExtents[index - 1].length += length;
+	else if (mergeNext) {
+		fExtents[index].start = start;
+		fExtents[index].length += length;
+	} else
+		_InsertExtent(index, start, length);
+}
+
+
+/*!	Removes the range from the list of free extents. The range must be
+	completely contained in one of the extents, or else the list is
+	out of date, and will be rebuilt on next use.
+*/
+void
+AllocationGroup::_RemoveExtent(int32 start, int32 length)
+{
+	int32 index = 0;
+	while (index < fExtentCount
+		&& fExtents[index].start + fExtents[index].length <= start)
+		index++;
+
+	if (index == fExtentCount || fExtents[index].start > start
+		|| fExtents[index].start + fExtents[index].length < start + length) {
+		fExtentsValid = false;
+		return;
+	}
+
+	free_extent& extent = fExtents[index];
+	int32 end = extent.start + extent.length;
+
+	if (extent.start == start && end == start + length) {
+		memmove(&fExtents[index], &fExtents[index + 1],
+			(fExtentCount - index - 1) * sizeof(free_extent));
+		fExtentCount--;
+	} else if (extent.start == start) {
+		extent.start += length;
+		extent.length -= length;
+	} else if (end == start + length)
+		extent.length -= length;
+	else {
+		// the range is in the middle of the extent - split it
+		extent.length = start - extent.start;
+		_InsertExtent(index + 1, start + length, end - start - length);
+	}
+}
+
+
+bool
+AllocationGroup::_InsertExtent(int32 index, int32 start, int32 length)
+{
+	if (fExtentCount == kMaxGroupExtents) {
+		// this group is too fragmented for the list
+		fExtentsValid = false;
+		fExtentsOverflow = true;
+		return false;
+	}
+
+	memmove(&fExtents[index + 1], &fExtents[index],
+		(fExtentCount - index) * sizeof(free_extent));
+	fExtents[index].start = start;
+	fExtents[index].length = length;
+	fExtentCount++;
+	return true;
 }
 
 
@@ -419,6 +626,9 @@ AllocationGroup::Allocate(Transaction& transaction, uint16 start, int32 length)
 		fFirstFree = start + length;
 	fFreeBits -= length;
 
+	if (fExtentsValid)
+		_RemoveExtent(start, length);
+
 	if (fLargestValid) {
 		bool cut = false;
 		if (fLargestStart == start) {
@@ -487,6 +697,14 @@ AllocationGroup::Free(Transaction& transaction, uint16 start, int32 length)
 		fFirstFree = start;
 	fFreeBits += length;
 
+	if (fFreeBits == (int32)fNumBits) {
+		// the group is empty now, no matter what the extents said before
+		ResetExtents();
+		if (fExtentsValid)
+			_AddExtent(0, fNumBits);
+	} else if (fExtentsValid)
+		_AddExtent(start, length);
+
 	// The range to be freed cannot be part of the valid largest range
 	ASSERT(!fLargestValid || start + length <= fLargestStart
 		|| start > fLargestStart);
@@ -538,7 +756,8 @@ BlockAllocator::BlockAllocator(Volume* volume)
 	fVolume(volume),
 	fGroups(NULL),
 	fCheckBitmap(NULL),
-	fCheckCookie(NULL)
+	fCheckCookie(NULL),
+	fReservationCount(0)
 {
 	recursive_lock_init(&fLock, "bfs allocator");
 }
@@ -622,6 +841,10 @@ BlockAllocator::InitializeAndClearBitmap(Transaction& transaction)
 		fGroups[i].fFreeBits = fGroups[i].fLargestLength = fGroups[i].fNumBits;
 		fGroups[i].fLargestValid = true;
 
+		fGroups[i].ResetExtents();
+		if (fGroups[i].HasExtents())
+			fGroups[i]._AddExtent(0, fGroups[i].fNumBits);
+
 		offset += fBlocksPerGroup;
 	}
 	free(buffer);
@@ -675,6 +898,7 @@ BlockAllocator::_Initialize(BlockAllocator* allocator)
 			groups[i].fNumBlocks = blocks;
 		}
 		groups[i].fStart = offset;
+		groups[i].ResetExtents();
 
 		// finds all free ranges in this allocation group
 		int32 start = -1, range = 0;
@@ -768,6 +992,8 @@ BlockAllocator::AllocateBlocks(Transaction& transaction, int32 groupIndex,
 	RecursiveLocker lock(fLock);
 
 	uint32 bitsPerFullBlock = fVolume->BlockSize() << 3;
+	int32 firstGroup = groupIndex;
+	uint16 firstStart = start;
 
 	// Find the block_run that can fulfill the request best
 	int32 bestGroup = -1;
@@ -783,6 +1009,27 @@ BlockAllocator::AllocateBlocks(Transaction& transaction, int32 groupIndex,
 		if (start >= group.NumBits() || group.IsFull())
 			continue;
 
+		if (group.CanRebuildExtents())
+			_RebuildExtents(group);
+
+		if (group.HasExtents()) {
+			// The free extents tell us where to look, no need to scan
+			// the bitmap
+			int32 extentStart;
+			int32 extentLength;
+			if (_FindFreeExtent(groupIndex, start, maximum, extentStart,
+					extentLength)
+				&& extentLength > bestLength) {
+				bestGroup = groupIndex;
+				bestStart = extentStart;
+				bestLength = extentLength;
+			}
+			if (bestLength >= maximum)
+				break;
+
+			continue;
+		}
+
 		// The wanted maximum is smaller than the largest free block in the
 		// group or already smaller than the minimum
 
@@ -905,8 +1152,15 @@ BlockAllocator::AllocateBlocks(Transaction& transaction, int32 groupIndex,
 
 	// If we found a suitable range, mark the blocks as in use, and
 	// write the updated block bitmap back to disk
-	if (bestLength < minimum)
+	if (bestLength < minimum) {
+		if (fReservationCount > 0) {
+			// the reserved space might be all that is left
+			fReservationCount = 0;
+			return AllocateBlocks(transaction, firstGroup, firstStart, maximum,
+				minimum, run);
+		}
 		return B_DEVICE_FULL;
+	}
 
 	if (bestLength > maximum)
 		bestLength = maximum;
@@ -915,6 +1169,17 @@ BlockAllocator::AllocateBlocks(Transaction& transaction, int32 groupIndex,
 		bestLength = round_down(bestLength, minimum);
 	}
 
+	if (fGroups[bestGroup].HasExtents()
+		&& !fGroups[bestGroup].IsFree(fVolume, bestStart, bestLength)) {
+		// The free extents were out of date (for example, because a
+		// transaction has been aborted) - rebuild them, and try again
+		FATAL(("free extents of group %" B_PRId32 " were out of date\n",
+			bestGroup));
+		fGroups[bestGroup].InvalidateExtents();
+		return AllocateBlocks(transaction, firstGroup, firstStart, maximum,
+			minimum, run);
+	}
+
 	if (fGroups[bestGroup].Allocate(transaction, bestStart, bestLength) != B_OK)
 		RETURN_ERROR(B_IO_ERROR);
 
@@ -942,6 +1207,40 @@ BlockAllocator::AllocateBlocks(Transaction& transaction, int32 groupIndex,
 }
 
 
+/*!	Allocates exactly the blocks of the specified \a run. Fails with
+	B_DEVICE_FULL if any of them is already in use.
+*/
+status_t
+BlockAllocator::AllocateBlockRun(Transaction& transaction, block_run run)
+{
+	RecursiveLocker lock(fLock);
+
+	int32 group = run.AllocationGroup();
+	uint16 start = run.Start();
+	uint16 length = run.Length();
+
+	if (group < 0 || group >= fNumGroups || length == 0
+		|| uint32(start + length) > fGroups[group].NumBits())
+		return B_BAD_VALUE;
+
+	if (!fGroups[group].IsFree(fVolume, start, length))
+		return B_DEVICE_FULL;
+
+	if (fGroups[group].Allocate(transaction, start, length) != B_OK)
+		RETURN_ERROR(B_IO_ERROR);
+
+	CHECK_ALLOCATION_GROUP(group);
+
+	fVolume->SuperBlock().used_blocks
+		= HOST_ENDIAN_TO_BFS_INT64(fVolume->UsedBlocks() + length);
+
+	block_cache_discard(fVolume->BlockCache(), fVolume->ToBlock(run), length);
+
+	T(Allocate(run));
+	return B_OK;
+}
+
+
 status_t
 BlockAllocator::AllocateForInode(Transaction& transaction,
 	const block_run* parent, mode_t type, block_run& run)
@@ -985,6 +1284,18 @@ BlockAllocator::Allocate(Transaction& transaction, Inode* inode,
 	if (numBlocks > MAX_BLOCK_RUN_LENGTH)
 		numBlocks = MAX_BLOCK_RUN_LENGTH;
 
+	RecursiveLocker lock(fLock);
+
+	// Continue in the space reserved for this file, if possible
+	allocation_reservation* reservation = NULL;
+	if (inode->IsFile())
+		reservation = _FindReservation(inode->ID());
+	if (reservation != NULL && reservation->length > 0
+		&& _AllocateFromReservation(transaction, *reservation, numBlocks,
+			minimum, run) == B_OK) {
+		return B_OK;
+	}
+
 	// Apply some allocation policies here (AllocateBlocks() will break them
 	// if necessary)
 	uint16 group = inode->BlockRun().AllocationGroup();
@@ -1016,7 +1327,36 @@ BlockAllocator::Allocate(Transaction& transaction, Inode* inode,
 		group = inode->BlockRun().AllocationGroup() + 1;
 	}
 
-	return AllocateBlocks(transaction, group, start, numBlocks, minimum, run);
+	if (reservation != NULL
+		&& reservation->start < (int32)fGroups[reservation->group].NumBits()) {
+		// continue where the last allocation for this file ended; unlike
+		// the above, this also works for the indirect ranges
+		group = reservation->group;
+		start = reservation->start;
+	}
+
+	status_t status = AllocateBlocks(transaction, group, start, numBlocks,
+		minimum, run);
+	if (status == B_OK && inode->IsFile()) {
+		_Reserve(inode->ID(), run,
+			min_c(numBlocks * kReservationFactor, MAX_BLOCK_RUN_LENGTH));
+	}
+	return status;
+}
+
+
+/*!	Gives the space that is reserved for the file with the given \a id
+	back to everyone else. This is called when the file has been closed, or
+	its preallocated blocks have been trimmed.
+*/
+void
+BlockAllocator::ReleaseReservation(ino_t id)
+{
+	RecursiveLocker lock(fLock);
+
+	allocation_reservation* reservation = _FindReservation(id);
+	if (reservation != NULL)
+		*reservation = fReservations[--fReservationCount];
 }
 
 
@@ -1085,6 +1425,63 @@ BlockAllocator::BitmapSize() const
 }
 
 
+static void
+add_free_extent(free_space_report& report, uint64 length)
+{
+	int32 sizeClass = 0;
+	while (sizeClass < BFS_FREE_EXTENT_SIZE_CLASSES - 1
+		&& (length >> (sizeClass + 1)) != 0)
+		sizeClass++;
+
+	report.extents_by_size[sizeClass]++;
+	report.free_extents++;
+	report.free_blocks += length;
+	if (length > report.largest_free_extent)
+		report.largest_free_extent = length;
+}
+
+
+/*!	Walks the whole block bitmap, and reports how the free space is
+	distributed over free extents of different sizes.
+*/
+status_t
+BlockAllocator::GetFreeSpaceReport(free_space_report& report)
+{
+	memset(&report, 0, sizeof(free_space_report));
+	report.block_size = fVolume->BlockSize();
+
+	AllocationBlock cached(fVolume);
+	RecursiveLocker lock(fLock);
+
+	for (int32 i = 0; i < fNumGroups; i++) {
+		AllocationGroup& group = fGroups[i];
+		if (!group.HasExtents() && !group.CanRebuildExtents())
+			report.fragmented_groups++;
+
+		// free extents cannot span allocation groups
+		uint64 length = 0;
+
+		for (uint32 block = 0; block < group.NumBlocks(); block++) {
+			if (cached.SetTo(group, block) != B_OK)
+				RETURN_ERROR(B_IO_ERROR);
+
+			for (uint32 bit = 0; bit < cached.NumBlockBits(); bit++) {
+				if (!cached.IsUsed(bit))
+					length++;
+				else if (length > 0) {
+					add_free_extent(report, length);
+					length = 0;
+				}
+			}
+		}
+		if (length > 0)
+			add_free_extent(report, length);
+	}
+
+	return B_OK;
+}
+
+
 #ifdef DEBUG_FRAGMENTER
 void
 BlockAllocator::Fragment()
@@ -1112,10 +1509,235 @@ BlockAllocator::Fragment()
 			transaction.Done();
 		}
 	}
+
+	_InvalidateExtents();
 }
 #endif	// DEBUG_FRAGMENTER
 
 
+/*!	Rebuilds the list of free extents of the \a group from the block bitmap.
+	If the group turns out to have too many free extents, it is marked as
+	being fragmented, and will be scanned on allocation instead.
+*/
+void
+BlockAllocator::_RebuildExtents(AllocationGroup& group)
+{
+	ASSERT_LOCKED_RECURSIVE(&fLock);
+
+	AllocationBlock cached(fVolume);
+	int32 rangeStart = 0;
+	int32 rangeLength = 0;
+	int32 bit = 0;
+
+	group.ResetExtents();
+
+	for (uint32 block = 0; block < group.NumBlocks() && group.HasExtents();
+			block++) {
+		if (cached.SetTo(group, block) != B_OK) {
+			group.InvalidateExtents();
+			return;
+		}
+
+		for (uint32 i = 0; i < cached.NumBlockBits(); i++, bit++) {
+			if (!cached.IsUsed(i)) {
+				if (rangeLength++ == 0)
+					rangeStart = bit;
+			} else if (rangeLength > 0) {
+				group._AddExtent(rangeStart, rangeLength);
+				rangeLength = 0;
+			}
+		}
+	}
+
+	if (rangeLength > 0 && group.HasExtents())
+		group._AddExtent(rangeStart, rangeLength);
+}
+
+
+/*!	Is called whenever the block bitmap has been changed behind the back of
+	the allocation groups.
+*/
+void
+BlockAllocator::_InvalidateExtents()
+{
+	for (int32 i = 0; i < fNumGroups; i++) {
+		fGroups[i].fExtentsValid = false;
+		fGroups[i].fExtentsOverflow = false;
+	}
+}
+
+
+/*!	Looks for a free extent at or after \a start in the free extents of the
+	group, leaving out the space that is reserved for other files.
+	Returns the first one that can hold \a maximum blocks, or the largest one
+	if there is no such extent.
+*/
+bool
+BlockAllocator::_FindFreeExtent(int32 groupIndex, int32 start, int32 maximum,
+	int32& extentStart, int32& extentLength) const
+{
+	const AllocationGroup& group = fGroups[groupIndex];
+	int32 bestStart = -1;
+	int32 bestLength = 0;
+
+	for (int32 i = 0; i < group.fExtentCount; i++) {
+		const free_extent& extent = group.fExtents[i];
+		int32 end = extent.start + extent.length;
+		int32 position = max_c(extent.start, start);
+
+		while (position < end) {
+			// cut the first reservation out of the rest of the extent
+			int32 pieceEnd = end;
+			int32 next = end;
+			for (int32 j = 0; j < fReservationCount; j++) {
+				const allocation_reservation& reservation = fReservations[j];
+				int32 reservationEnd = reservation.start + reservation.length;
+				if (reservation.group != groupIndex || reservation.length == 0
+					|| reservationEnd <= position
+					|| reservation.start >= pieceEnd)
+					continue;
+
+				pieceEnd = max_c(reservation.start, position);
+				next = reservationEnd;
+			}
+
+			int32 length = pieceEnd - position;
+			if (length >= maximum) {
+				extentStart = position;
+				extentLength = length;
+				return true;
+			}
+			if (length > bestLength) {
+				bestStart = position;
+				bestLength = length;
+			}
+
+			position = next;
+		}
+	}
+
+	if (bestLength == 0)
+		return false;
+
+	extentStart = bestStart;
+	extentLength = bestLength;
+	return true;
+}
+
+
+allocation_reservation*
+BlockAllocator::_FindReservation(ino_t id)
+{
+	for (int32 i = 0; i < fReservationCount; i++) {
+		if (fReservations[i].id == id)
+			return &fReservations[i];
+	}
+
+	return NULL;
+}
+
+
+/*!	Reserves up to \a length free blocks directly behind \a run for the file
+	with the given \a id, so that its next allocation can continue where this
+	one ended, even if other files are written at the same time.
+	The reservation only exists in memory, and is only honoured by
+	allocations that are served from the free extents.
+*/
+void
+BlockAllocator::_Reserve(ino_t id, const block_run& run, int32 length)
+{
+	allocation_reservation* reservation = _FindReservation(id);
+	if (reservation == NULL) {
+		if (fReservationCount < BFS_MAX_RESERVATIONS)
+			reservation = &fReservations[fReservationCount++];
+		else {
+			// replace the least recently used one
+			reservation = &fReservations[0];
+			for (int32 i = 1; i < fReservationCount; i++) {
+				if (fReservations[i].last_used < reservation->last_used)
+					reservation = &fReservations[i];
+			}
+		}
+		reservation->id = id;
+	}
+
+	reservation->group = run.AllocationGroup();
+	reservation->start = run.Start() + run.Length();
+	reservation->length = 0;
+	reservation->last_used = system_time();
+
+	// Only reserve space if it is known to be free, and if there is
+	// enough of it
+	AllocationGroup& group = fGroups[reservation->group];
+	if (!group.HasExtents() || fVolume->FreeBlocks() < 4 * (off_t)length)
+		return;
+
+	for (int32 i = 0; i < group.fExtentCount; i++) {
+		const free_extent& extent = group.fExtents[i];
+		if (extent.start != reservation->start)
+			continue;
+
+		length = min_c(length, extent.length);
+
+		// don't overlap with the space reserved for other files
+		for (int32 j = 0; j < fReservationCount; j++) {
+			const allocation_reservation& other = fReservations[j];
+			if (&other == reservation || other.group != reservation->group
+				|| other.length == 0
+				|| other.start + other.length <= reservation->start)
+				continue;
+
+			length = min_c(length, max_c(0,
+				other.start - reservation->start));
+		}
+
+		reservation->length = length;
+		break;
+	}
+}
+
+
+status_t
+BlockAllocator::_AllocateFromReservation(Transaction& transaction,
+	allocation_reservation& reservation, off_t numBlocks, uint16 minimum,
+	block_run& run)
+{
+	int32 length = min_c(numBlocks, reservation.length);
+	if (minimum > 1)
+		length = round_down(length, minimum);
+	if (length <= 0)
+		return B_DEVICE_FULL;
+
+	AllocationGroup& group = fGroups[reservation.group];
+	if (!group.IsFree(fVolume, reservation.start, length)) {
+		// the space has been taken by someone that does not know about
+		// reservations
+		reservation.length = 0;
+		return B_BUSY;
+	}
+
+	if (group.Allocate(transaction, reservation.start, length) != B_OK)
+		RETURN_ERROR(B_IO_ERROR);
+
+	run.allocation_group = HOST_ENDIAN_TO_BFS_INT32(reservation.group);
+	run.start = HOST_ENDIAN_TO_BFS_INT16(reservation.start);
+	run.length = HOST_ENDIAN_TO_BFS_INT16(length);
+
+	reservation.start += length;
+	reservation.length -= length;
+	reservation.last_used = system_time();
+
+	// see AllocateBlocks()
+	fVolume->SuperBlock().used_blocks
+		= HOST_ENDIAN_TO_BFS_INT64(fVolume->UsedBlocks() + length);
+	block_cache_discard(fVolume->BlockCache(), fVolume->ToBlock(run),
+		run.Length());
+
+	T(Allocate(run));
+	return B_OK;
+}
+
+
 #ifdef DEBUG_ALLOCATION_GROUPS
 void
 BlockAllocator::_CheckGroup(int32 groupIndex) const
@@ -1242,6 +1864,8 @@ BlockAllocator::StartChecking(const check_control* control)
 
 	memcpy(&fCheckCookie->control, control, sizeof(check_control));
 	memset(&fCheckCookie->control.stats, 0, sizeof(control->stats));
+	memset(&fCheckCookie->control.extended_stats, 0,
+		sizeof(control->extended_stats));
 
 	// initialize bitmap
 	memset(fCheckBitmap, 0, size);
@@ -1285,7 +1909,7 @@ BlockAllocator::StopChecking(check_control* control)
 
 	if (fVolume->IsReadOnly()) {
 		// We can't fix errors on this volume
-		fCheckCookie->control.flags = 0;
+		fCheckCookie->control.flags &= BFS_CHECK_EXTENDED_STATS;
 	}
 
 	if (fCheckCookie->control.status != B_ENTRY_NOT_FOUND)
@@ -1388,6 +2012,8 @@ BlockAllocator::CheckNextNode(check_control* control)
 
 			if (!inode->IsContainer()) {
 				// Check file
+				_OptimizeInode(inode);
+
 				fCheckCookie->control.errors = 0;
 				fCheckCookie->control.status = CheckInode(inode, NULL);
 
@@ -1408,6 +2034,9 @@ BlockAllocator::CheckNextNode(check_control* control)
 			fCheckCookie->parent = inode;
 			fCheckCookie->parent_mode = inode->Mode();
 
+			// the tree cannot be compacted anymore once it has an iterator
+			_OptimizeInode(inode);
+
 			// get iterator for the next directory
 			fCheckCookie->iterator = new(std::nothrow) TreeIterator(tree);
 			if (fCheckCookie->iterator == NULL)
@@ -1546,6 +2175,7 @@ BlockAllocator::CheckNextNode(check_control* control)
 			fCheckCookie->stack.Push(inode->BlockRun());
 		else {
 			// check it now
+			_OptimizeInode(inode);
 			fCheckCookie->control.status = CheckInode(inode, name);
 			return B_OK;
 		}
@@ -1684,6 +2314,9 @@ BlockAllocator::_WriteBackCheckBitmap()
 			}
 			transaction.Done();
 		}
+
+		RecursiveLocker locker(fLock);
+		_InvalidateExtents();
 	}
 
 	return B_OK;
@@ -1847,10 +2480,20 @@ BlockAllocator::CheckInode(Inode* inode, const char* name)
 	switch (fCheckCookie->pass) {
 		case BFS_CHECK_PASS_BITMAP:
 		{
+			fCheckCookie->next_block = -1;
+			fCheckCookie->fragments = 0;
+
 			status_t status = _CheckInodeBlocks(inode, name);
 			if (status != B_OK)
 				return status;
 
+			if (inode->IsFile()) {
+				fCheckCookie->control.extended_stats.file_fragments
+					+= fCheckCookie->fragments;
+				if (fCheckCookie->fragments > 1)
+					fCheckCookie->control.extended_stats.fragmented_files++;
+			}
+
 			// Check the B+tree as well
 			if (inode->IsContainer()) {
 				bool repairErrors
@@ -1904,6 +2547,18 @@ BlockAllocator::_CheckInodeBlocks(Inode* inode, const char* name)
 
 	data_stream* data = &inode->Node().data;
 
+	if (inode->HasInlineData()) {
+		// the data is stored in the inode, there must not be a data stream
+		if (!inode->IsFile() || data->MaxDirectRange() != 0
+			|| data->MaxIndirectRange() != 0
+			|| data->MaxDoubleIndirectRange() != 0
+			|| (off_t)inode->InlineDataSize() != inode->Size())
+			return B_BAD_DATA;
+
+		fCheckCookie->control.extended_stats.inline_files++;
+		return B_OK;
+	}
+
 	// check the direct range
 
 	if (data->max_direct_range) {
@@ -1918,6 +2573,7 @@ BlockAllocator::_CheckInodeBlocks(Inode* inode, const char* name)
 			fCheckCookie->control.stats.direct_block_runs++;
 			fCheckCookie->control.stats.blocks_in_direct
 				+= data->direct[i].Length();
+			_CountFragment(data->direct[i]);
 		}
 	}
 
@@ -1950,6 +2606,7 @@ BlockAllocator::_CheckInodeBlocks(Inode* inode, const char* name)
 				fCheckCookie->control.stats.indirect_block_runs++;
 				fCheckCookie->control.stats.blocks_in_indirect
 					+= runs[index].Length();
+				_CountFragment(runs[index]);
 			}
 			fCheckCookie->control.stats.indirect_array_blocks++;
 
@@ -2010,6 +2667,7 @@ BlockAllocator::_CheckInodeBlocks(Inode* inode, const char* name)
 					fCheckCookie->control.stats.double_indirect_block_runs++;
 					fCheckCookie->control.stats.blocks_in_double_indirect
 						+= runs[index % runsPerBlock].Length();
+					_CountFragment(runs[index % runsPerBlock]);
 				} while ((++index % runsPerArray) != 0);
 			}
 
@@ -2021,6 +2679,58 @@ BlockAllocator::_CheckInodeBlocks(Inode* inode, const char* name)
 }
 
 
+/*!	Counts the data stream \a run of the inode currently being checked as
+	a new fragment, unless it directly follows the previous one.
+*/
+void
+BlockAllocator::_CountFragment(const block_run& run)
+{
+	off_t start = fVolume->ToBlock(run);
+	if (start != fCheckCookie->next_block)
+		fCheckCookie->fragments++;
+
+	fCheckCookie->next_block = start + run.Length();
+}
+
+
+/*!	Compacts the B+tree, or defragments the data stream of the \a inode,
+	depending on the flags of the check. This has to happen before the inode
+	is checked, so that the check bitmap gets to see its new blocks.
+*/
+void
+BlockAllocator::_OptimizeInode(Inode* inode)
+{
+	check_control& control = fCheckCookie->control;
+
+	// If blocks in use are missing from the bitmap, we could allocate them
+	// a second time
+	if (fCheckCookie->pass != BFS_CHECK_PASS_BITMAP || fVolume->IsReadOnly()
+		|| inode->IsDeleted() || control.stats.missing != 0)
+		return;
+
+	if ((control.flags & BFS_COMPACT_BPLUSTREES) != 0
+		&& inode->IsContainer() && inode->Tree() != NULL) {
+		uint32 freedNodes;
+		uint32 removedLevels;
+		if (inode->Tree()->Compact(freedNodes, removedLevels) == B_OK
+			&& (freedNodes > 0 || removedLevels > 0)) {
+			control.extended_stats.compacted_trees++;
+			control.extended_stats.freed_tree_nodes += freedNodes;
+			control.extended_stats.removed_tree_levels += removedLevels;
+		}
+	}
+
+	if ((control.flags & BFS_DEFRAGMENT_FILES) != 0 && inode->IsFile()) {
+		uint32 removedFragments;
+		if (inode->Defragment(removedFragments) == B_OK
+			&& removedFragments > 0) {
+			control.extended_stats.defragmented_files++;
+			control.extended_stats.removed_fragments += removedFragments;
+		}
+	}
+}
+
+
 status_t
 BlockAllocator::_PrepareIndices()
 {
@@ -2147,6 +2857,9 @@ BlockAllocator::Dump(int32 index)
 			group.fLargestValid ? "" : "  (invalid)");
 		kprintf("      largest length: %ld\n", group.fLargestLength);
 		kprintf("      free bits:      %ld\n", group.fFreeBits);
+		kprintf("      free extents:   %ld%s\n", group.fExtentCount,
+			group.fExtentsOverflow ? "  (fragmented)"
+				: group.fExtentsValid ? "" : "  (invalid)");
 	}
 }
 
@@ -18,11 +18,27 @@ struct disk_super_block;
 struct block_run;
 struct check_control;
 struct check_cookie;
+struct free_space_report;
 
 
 //#define DEBUG_ALLOCATION_GROUPS
 //#define DEBUG_FRAGMENTER
 
+#define BFS_MAX_RESERVATIONS	32
+
+
+/*!	Free space directly behind the last allocation for a file that is
+	kept for its next allocation, so that files that are written at the
+	same time do not interleave their blocks.
+*/
+struct allocation_reservation {
+	ino_t		id;
+	int32		group;
+	int32		start;
+	int32		length;
+	bigtime_t	last_used;
+};
+
 
 class BlockAllocator {
 public:
@@ -41,10 +57,13 @@ public:
 								off_t numBlocks, block_run& run,
 								uint16 minimum = 1);
 			status_t		Free(Transaction& transaction, block_run run);
+			void			ReleaseReservation(ino_t id);
 
 			status_t		AllocateBlocks(Transaction& transaction,
 								int32 group, uint16 start, uint16 numBlocks,
 								uint16 minimum, block_run& run);
+			status_t		AllocateBlockRun(Transaction& transaction,
+								block_run run);
 
 			status_t		StartChecking(const check_control* control);
 			status_t		StopChecking(check_control* control);
@@ -58,6 +77,7 @@ public:
 			status_t		CheckInode(Inode* inode, const char* name);
 
 			size_t			BitmapSize() const;
+			status_t		GetFreeSpaceReport(free_space_report& report);
 
 #ifdef BFS_DEBUGGER_COMMANDS
 			void			Dump(int32 index);
@@ -76,12 +96,28 @@ private:
 			bool			_CheckBitmapIsUsedAt(off_t block) const;
 			void			_SetCheckBitmapAt(off_t block);
 			status_t		_CheckInodeBlocks(Inode* inode, const char* name);
+			void			_CountFragment(const block_run& run);
+			void			_OptimizeInode(Inode* inode);
 			status_t		_FinishBitmapPass();
 			status_t		_PrepareIndices();
 			void			_FreeIndices();
 			status_t		_AddInodeToIndex(Inode* inode);
 			status_t		_WriteBackCheckBitmap();
 
+			void			_RebuildExtents(AllocationGroup& group);
+			void			_InvalidateExtents();
+			bool			_FindFreeExtent(int32 groupIndex, int32 start,
+								int32 maximum, int32& extentStart,
+								int32& extentLength) const;
+
+			allocation_reservation* _FindReservation(ino_t id);
+			void			_Reserve(ino_t id, const block_run& run,
+								int32 length);
+			status_t		_AllocateFromReservation(Transaction& transaction,
+								allocation_reservation& reservation,
+								off_t numBlocks, uint16 minimum,
+								block_run& run);
+
 	static	status_t		_Initialize(BlockAllocator* self);
 
 private:
@@ -94,6 +130,9 @@ private:
 
 			uint32*			fCheckBitmap;
 			check_cookie*	fCheckCookie;
+
+			allocation_reservation fReservations[BFS_MAX_RESERVATIONS];
+			int32			fReservationCount;
 };
 
 #ifdef BFS_DEBUGGER_COMMANDS
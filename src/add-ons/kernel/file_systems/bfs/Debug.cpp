@@ -57,7 +57,9 @@ dump_super_block(const disk_super_block* superBlock)
 	kprintf("  inode_size     = %u\n", (unsigned)superBlock->InodeSize());
 	kprintf("  magic2         = %#08x (%s) %s\n", (int)superBlock->Magic2(),
 		get_tupel(superBlock->magic2),
-		(superBlock->magic2 == (int)SUPER_BLOCK_MAGIC2 ? "valid" : "INVALID"));
+		(superBlock->Magic2() == (int32)(superBlock->Features() != 0
+			? SUPER_BLOCK_MAGIC2_FEATURES : SUPER_BLOCK_MAGIC2)
+				? "valid" : "INVALID"));
 	kprintf("  blocks_per_ag  = %u\n",
 		(unsigned)superBlock->BlocksPerAllocationGroup());
 	kprintf("  ag_shift       = %u (%ld bytes)\n",
@@ -74,6 +76,7 @@ dump_super_block(const disk_super_block* superBlock)
 		(superBlock->magic3 == SUPER_BLOCK_MAGIC3 ? "valid" : "INVALID"));
 	dump_block_run("  root_dir       = ", superBlock->root_dir);
 	dump_block_run("  indices        = ", superBlock->indices);
+	kprintf("  features       = %#08x\n", (unsigned)superBlock->Features());
 }
 
 
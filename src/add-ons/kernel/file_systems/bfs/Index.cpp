@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2010, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -12,6 +13,7 @@
 #include "Volume.h"
 #include "Inode.h"
 #include "BPlusTree.h"
+#include "Journal.h"
 
 
 Index::Index(Volume* volume)
@@ -158,6 +160,17 @@ Index::KeySize()
 }
 
 
+/*!	Returns whether or not the index contains all entries it should contain.
+	This is only not the case for an index derived from the name until
+	FillNameIndex() is done with it; queries must not use it before that.
+*/
+bool
+Index::IsComplete() const
+{
+	return fNode != NULL && (fNode->Flags() & INODE_INDEX_INCOMPLETE) == 0;
+}
+
+
 status_t
 Index::Create(Transaction& transaction, const char* name, uint32 type)
 {
@@ -193,6 +206,10 @@ Index::Create(Transaction& transaction, const char* name, uint32 type)
 			return B_BAD_TYPE;
 	}
 
+	// the indices derived from the name can only contain strings
+	if (IsDerivedNameIndex(name) && mode != S_STR_INDEX)
+		return B_BAD_TYPE;
+
 	// do we need to create the index directory first?
 	if (fVolume->IndicesNode() == NULL) {
 		status_t status = fVolume->CreateIndicesRoot(transaction);
@@ -201,8 +218,14 @@ Index::Create(Transaction& transaction, const char* name, uint32 type)
 	}
 
 	// Inode::Create() will keep the inode locked for us
-	return Inode::Create(transaction, fVolume->IndicesNode(), name,
+	status_t status = Inode::Create(transaction, fVolume->IndicesNode(), name,
 		S_INDEX_DIR | S_DIRECTORY | mode, 0, type, NULL, NULL, &fNode);
+	if (status != B_OK || !IsDerivedNameIndex(name))
+		return status;
+
+	// the index only becomes usable once FillNameIndex() is done with it
+	fNode->Node().flags |= HOST_ENDIAN_TO_BFS_INT32(INODE_INDEX_INCOMPLETE);
+	return fNode->WriteBack(transaction);
 }
 
 
@@ -211,11 +234,26 @@ Index::Create(Transaction& transaction, const char* name, uint32 type)
 	If the method returns B_BAD_INDEX, it means the index couldn't be found -
 	the most common reason will be that the index doesn't exist.
 	You may not want to let the whole transaction fail because of that.
+	The indices derived from the name can only be updated via UpdateName(),
+	attributes of the same name are not indexed.
 */
 status_t
 Index::Update(Transaction& transaction, const char* name, int32 type,
 	const uint8* oldKey, uint16 oldLength, const uint8* newKey,
 	uint16 newLength, Inode* inode)
+{
+	if (name != NULL && IsDerivedNameIndex(name))
+		return B_BAD_INDEX;
+
+	return _Update(transaction, name, type, oldKey, oldLength, newKey,
+		newLength, inode);
+}
+
+
+status_t
+Index::_Update(Transaction& transaction, const char* name, int32 type,
+	const uint8* oldKey, uint16 oldLength, const uint8* newKey,
+	uint16 newLength, Inode* inode)
 {
 	if (name == NULL
 		|| (oldKey == NULL && newKey == NULL)
@@ -294,8 +332,65 @@ Index::UpdateName(Transaction& transaction, const char* oldName,
 
 	uint16 oldLength = oldName != NULL ? strlen(oldName) : 0;
 	uint16 newLength = newName != NULL ? strlen(newName) : 0;
-	return Update(transaction, "name", B_STRING_TYPE, (uint8*)oldName,
-		oldLength, (uint8*)newName, newLength, inode);
+	status_t status = Update(transaction, "name", B_STRING_TYPE,
+		(uint8*)oldName, oldLength, (uint8*)newName, newLength, inode);
+	if (status != B_OK)
+		return status;
+
+	return _UpdateDerivedNames(transaction, oldName, newName, inode);
+}
+
+
+/*!	Adds all entries of the "name" index to the specified index, which must
+	be one of the indices derived from the name, and must have just been
+	created.
+	Since this might be a lot of work, it is split up into as many
+	transactions as needed. In between, the "name" index may change; those
+	changes are only applied to the part of the index that has already been
+	filled, the rest is left to this method.
+	Only if all entries could be added, the index is marked complete, and
+	can be used by queries.
+*/
+status_t
+Index::FillNameIndex(const char* name)
+{
+	if (!IsDerivedNameIndex(name))
+		return B_BAD_VALUE;
+
+	Index nameIndex(fVolume);
+	status_t status = nameIndex.SetTo("name");
+	if (status == B_OK)
+		status = SetTo(name);
+	if (status != B_OK)
+		RETURN_ERROR(status);
+
+	BPlusTree* nameTree = nameIndex.Node()->Tree();
+	BPlusTree* tree = Node()->Tree();
+	if (nameTree == NULL || tree == NULL)
+		RETURN_ERROR(B_BAD_VALUE);
+
+	uint32* trigrams = NULL;
+	if (!strcmp(name, BFS_NAME_TRIGRAM_INDEX)) {
+		trigrams = (uint32*)malloc(BFS_MAX_NAME_TRIGRAMS * sizeof(uint32));
+		if (trigrams == NULL)
+			return B_NO_MEMORY;
+	}
+	MemoryDeleter trigramDeleter(trigrams);
+
+	name_index_fill fill;
+	fill.index = Node()->ID();
+	fill.last_key_length = 0;
+
+	MutexLocker locker(fVolume->Lock());
+	fVolume->NameIndexFills().Add(&fill);
+	locker.Unlock();
+
+	status = _FillNameIndex(nameTree, tree, trigrams, fill);
+
+	locker.Lock();
+	fVolume->NameIndexFills().Remove(&fill);
+
+	RETURN_ERROR(status);
 }
 
 
@@ -384,3 +479,315 @@ Index::UpdateLastModified(Transaction& transaction, Inode* inode,
 	return status;
 }
 
+
+/*!	Returns whether or not the specified index is one of those that are
+	maintained alongside the "name" index.
+*/
+/*static*/ bool
+Index::IsDerivedNameIndex(const char* name)
+{
+	return !strcmp(name, BFS_FOLDED_NAME_INDEX)
+		|| !strcmp(name, BFS_NAME_TRIGRAM_INDEX);
+}
+
+
+/*!	Folds the case of the name as it is stored in the derived name indices.
+	Only ASCII characters are folded, all other bytes are kept as is.
+	\a folded must be able to hold INODE_FILE_NAME_LENGTH bytes.
+	Returns the length of the folded name.
+*/
+/*static*/ size_t
+Index::FoldName(const char* name, char* folded)
+{
+	size_t length = 0;
+	for (; name[length] != '\0' && length < INODE_FILE_NAME_LENGTH - 1;
+			length++) {
+		char c = name[length];
+		folded[length] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
+	folded[length] = '\0';
+
+	return length;
+}
+
+
+/*!	Retrieves the distinct trigrams of the case folded name, sorted by their
+	value. \a trigrams must be able to hold BFS_MAX_NAME_TRIGRAMS entries.
+	Returns the number of trigrams found.
+*/
+/*static*/ int32
+Index::GetNameTrigrams(const char* name, uint32* trigrams)
+{
+	char folded[INODE_FILE_NAME_LENGTH];
+	size_t length = FoldName(name, folded);
+	int32 count = 0;
+
+	for (size_t i = 0; i + BFS_NAME_TRIGRAM_LENGTH <= length; i++) {
+		uint32 trigram = ((uint8)folded[i] << 16)
+			| ((uint8)folded[i + 1] << 8) | (uint8)folded[i + 2];
+
+		// insert it sorted, and ignore duplicates
+		int32 index = count;
+		while (index > 0 && trigrams[index - 1] > trigram)
+			index--;
+		if (index > 0 && trigrams[index - 1] == trigram)
+			continue;
+
+		memmove(&trigrams[index + 1], &trigrams[index],
+			(count - index) * sizeof(uint32));
+		trigrams[index] = trigram;
+		count++;
+	}
+
+	return count;
+}
+
+
+/*static*/ void
+Index::TrigramToKey(uint32 trigram, uint8* key)
+{
+	key[0] = (uint8)(trigram >> 16);
+	key[1] = (uint8)(trigram >> 8);
+	key[2] = (uint8)trigram;
+}
+
+
+/*!	Does the actual work for FillNameIndex(); \a fill is updated whenever
+	a transaction is done. The transactions always end between two names,
+	so that it can tell for every name whether or not it's in the index.
+*/
+status_t
+Index::_FillNameIndex(BPlusTree* nameTree, BPlusTree* tree, uint32* trigrams,
+	name_index_fill& fill)
+{
+	TreeIterator iterator(nameTree);
+	Transaction transaction;
+	char key[BPLUSTREE_MAX_KEY_LENGTH + 1];
+	char lastKey[BPLUSTREE_MAX_KEY_LENGTH];
+	uint16 lastKeyLength = 0;
+	bool tooLarge = false;
+	status_t status;
+
+	while (true) {
+		if (!transaction.IsStarted()) {
+			status = transaction.Start(fVolume, Node()->BlockNumber());
+			if (status != B_OK)
+				return status;
+
+			Node()->WriteLockInTransaction(transaction);
+
+			// the "name" index might have changed in the mean time, so we
+			// need to look up where we stopped
+			if (fill.last_key_length > 0)
+				iterator.Find(fill.last_key, fill.last_key_length);
+		}
+
+		uint16 keyLength;
+		uint16 duplicate;
+		off_t id;
+		status = iterator.GetNextEntry(key, &keyLength,
+			BPLUSTREE_MAX_KEY_LENGTH, &id, &duplicate);
+		if (status != B_OK)
+			break;
+
+		if (fill.last_key_length > 0 && compareKeys(B_STRING_TYPE, key,
+				keyLength, fill.last_key, fill.last_key_length) <= 0) {
+			// this one has been added before already
+			iterator.SkipDuplicates();
+			continue;
+		}
+
+		if (tooLarge && compareKeys(B_STRING_TYPE, key, keyLength, lastKey,
+				lastKeyLength) != 0) {
+			// all entries of the last name are in, we can stop here
+			memcpy(fill.last_key, lastKey, lastKeyLength);
+			fill.last_key_length = lastKeyLength;
+			tooLarge = false;
+
+			status = transaction.Done();
+			if (status != B_OK)
+				return status;
+			continue;
+		}
+
+		memcpy(lastKey, key, keyLength);
+		lastKeyLength = keyLength;
+		key[keyLength] = '\0';
+
+		if (trigrams != NULL) {
+			int32 count = GetNameTrigrams(key, trigrams);
+			for (int32 i = 0; i < count && status == B_OK; i++) {
+				uint8 trigram[BFS_NAME_TRIGRAM_LENGTH];
+				TrigramToKey(trigrams[i], trigram);
+				status = tree->Insert(transaction, trigram,
+					BFS_NAME_TRIGRAM_LENGTH, id);
+			}
+		} else {
+			char folded[INODE_FILE_NAME_LENGTH];
+			size_t length = FoldName(key, folded);
+			if (length > 0) {
+				status = tree->Insert(transaction, (uint8*)folded, length,
+					id);
+			}
+		}
+		if (status != B_OK)
+			return status;
+
+		if (transaction.IsTooLarge())
+			tooLarge = true;
+	}
+
+	if (status != B_ENTRY_NOT_FOUND)
+		return status;
+
+	// all names are in, the index can be used from now on
+	Node()->Node().flags &= ~HOST_ENDIAN_TO_BFS_INT32(INODE_INDEX_INCOMPLETE);
+	status = Node()->WriteBack(transaction);
+	if (status == B_OK)
+		status = transaction.Done();
+
+	return status;
+}
+
+
+/*!	Returns \a name if the derived name index the object is set to is
+	supposed to contain the entries with that name, or NULL if not: while
+	FillNameIndex() is running, it still has to add the names it did not go
+	through yet, and an index whose filling failed is not maintained at all.
+*/
+const char*
+Index::_FilledName(const char* name)
+{
+	if (name == NULL || IsComplete())
+		return name;
+
+	MutexLocker locker(fVolume->Lock());
+
+	NameIndexFillList::Iterator iterator
+		= fVolume->NameIndexFills().GetIterator();
+	while (name_index_fill* fill = iterator.Next()) {
+		if (fill->index != fNode->ID())
+			continue;
+
+		if (compareKeys(B_STRING_TYPE, name, strlen(name), fill->last_key,
+				fill->last_key_length) <= 0)
+			return name;
+		break;
+	}
+
+	return NULL;
+}
+
+
+/*!	Updates the optional indices derived from the name, if they exist.
+*/
+status_t
+Index::_UpdateDerivedNames(Transaction& transaction, const char* oldName,
+	const char* newName, Inode* inode)
+{
+	struct derived_names {
+		char	old_folded[INODE_FILE_NAME_LENGTH];
+		char	new_folded[INODE_FILE_NAME_LENGTH];
+		uint32	old_trigrams[BFS_MAX_NAME_TRIGRAMS];
+		uint32	new_trigrams[BFS_MAX_NAME_TRIGRAMS];
+	};
+
+	bool hasFoldedNames = SetTo(BFS_FOLDED_NAME_INDEX) == B_OK;
+	bool hasTrigrams = SetTo(BFS_NAME_TRIGRAM_INDEX) == B_OK;
+	if (!hasFoldedNames && !hasTrigrams)
+		return B_OK;
+
+	derived_names* names = (derived_names*)malloc(sizeof(derived_names));
+	if (names == NULL)
+		return B_NO_MEMORY;
+	MemoryDeleter namesDeleter(names);
+
+	if (hasFoldedNames && SetTo(BFS_FOLDED_NAME_INDEX) == B_OK) {
+		const char* oldFilled = _FilledName(oldName);
+		const char* newFilled = _FilledName(newName);
+
+		uint16 oldLength = 0;
+		uint16 newLength = 0;
+		if (oldFilled != NULL)
+			oldLength = FoldName(oldFilled, names->old_folded);
+		if (newFilled != NULL)
+			newLength = FoldName(newFilled, names->new_folded);
+
+		if (oldLength > 0 || newLength > 0) {
+			status_t status = _Update(transaction, BFS_FOLDED_NAME_INDEX,
+				B_STRING_TYPE,
+				oldLength > 0 ? (uint8*)names->old_folded : NULL, oldLength,
+				newLength > 0 ? (uint8*)names->new_folded : NULL, newLength,
+				inode);
+			if (status != B_OK && status != B_BAD_INDEX)
+				return status;
+		}
+	}
+
+	if (!hasTrigrams || SetTo(BFS_NAME_TRIGRAM_INDEX) != B_OK)
+		return B_OK;
+
+	oldName = _FilledName(oldName);
+	newName = _FilledName(newName);
+
+	int32 oldCount = oldName != NULL
+		? GetNameTrigrams(oldName, names->old_trigrams) : 0;
+	int32 newCount = newName != NULL
+		? GetNameTrigrams(newName, names->new_trigrams) : 0;
+
+	return _UpdateNameTrigrams(transaction, names->old_trigrams, oldCount,
+		names->new_trigrams, newCount, inode);
+}
+
+
+/*!	Removes the trigrams that are only part of the old name from the trigram
+	index, and adds those that are only part of the new one. Both arrays
+	must be sorted.
+	The index must have been set to the trigram index already.
+*/
+status_t
+Index::_UpdateNameTrigrams(Transaction& transaction,
+	const uint32* oldTrigrams, int32 oldCount, const uint32* newTrigrams,
+	int32 newCount, Inode* inode)
+{
+	BPlusTree* tree = Node()->Tree();
+	if (tree == NULL)
+		return B_BAD_VALUE;
+
+	if (oldCount == 0 && newCount == 0)
+		return B_OK;
+
+	Node()->WriteLockInTransaction(transaction);
+
+	int32 oldIndex = 0;
+	int32 newIndex = 0;
+	while (oldIndex < oldCount || newIndex < newCount) {
+		uint8 key[BFS_NAME_TRIGRAM_LENGTH];
+		status_t status;
+
+		if (newIndex == newCount || (oldIndex < oldCount
+				&& oldTrigrams[oldIndex] < newTrigrams[newIndex])) {
+			TrigramToKey(oldTrigrams[oldIndex++], key);
+			status = tree->Remove(transaction, key, sizeof(key), inode->ID());
+			if (status == B_ENTRY_NOT_FOUND) {
+				// That's not nice, but no reason to let the whole thing fail
+				INFORM(("Could not find trigram in index!\n"));
+				status = B_OK;
+			}
+		} else if (oldIndex == oldCount
+			|| newTrigrams[newIndex] < oldTrigrams[oldIndex]) {
+			TrigramToKey(newTrigrams[newIndex++], key);
+			status = tree->Insert(transaction, key, sizeof(key), inode->ID());
+		} else {
+			// the trigram is part of both names
+			oldIndex++;
+			newIndex++;
+			continue;
+		}
+
+		if (status != B_OK)
+			RETURN_ERROR(status);
+	}
+
+	return B_OK;
+}
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef INDEX_H
@@ -9,9 +10,22 @@
 #include "system_dependencies.h"
 
 
+class BPlusTree;
 class Transaction;
 class Volume;
 class Inode;
+struct name_index_fill;
+
+
+// Optional indices that are maintained alongside the "name" index, and
+// allow case-insensitive and substring queries on the name: the first one
+// contains the case folded names, the second one every distinct three
+// character sequence of them.
+#define BFS_FOLDED_NAME_INDEX		"name:folded"
+#define BFS_NAME_TRIGRAM_INDEX		"name:trigram"
+
+#define BFS_NAME_TRIGRAM_LENGTH		3
+#define BFS_MAX_NAME_TRIGRAMS		(INODE_FILE_NAME_LENGTH - 2)
 
 
 class Index {
@@ -25,6 +39,7 @@ public:
 			Inode*			Node() const { return fNode; };
 			uint32			Type();
 			size_t			KeySize();
+			bool			IsComplete() const;
 
 			status_t		Create(Transaction& transaction, const char* name,
 								uint32 type);
@@ -41,6 +56,7 @@ public:
 			status_t		UpdateName(Transaction& transaction,
 								const char* oldName, const char* newName,
 								Inode* inode);
+			status_t		FillNameIndex(const char* name);
 
 			status_t		InsertSize(Transaction& transaction, Inode* inode);
 			status_t		RemoveSize(Transaction& transaction, Inode* inode);
@@ -53,11 +69,34 @@ public:
 			status_t		UpdateLastModified(Transaction& transaction,
 								Inode* inode, bigtime_t modified = -1);
 
+	static	bool			IsDerivedNameIndex(const char* name);
+	static	size_t			FoldName(const char* name, char* folded);
+	static	int32			GetNameTrigrams(const char* name,
+								uint32* trigrams);
+	static	void			TrigramToKey(uint32 trigram, uint8* key);
+
 private:
 							Index(const Index& other);
 							Index& operator=(const Index& other);
 								// no implementation
 
+			status_t		_Update(Transaction& transaction,
+								const char* name, int32 type,
+								const uint8* oldKey, uint16 oldLength,
+								const uint8* newKey, uint16 newLength,
+								Inode* inode);
+			status_t		_FillNameIndex(BPlusTree* nameTree,
+								BPlusTree* tree, uint32* trigrams,
+								name_index_fill& fill);
+			const char*		_FilledName(const char* name);
+			status_t		_UpdateDerivedNames(Transaction& transaction,
+								const char* oldName, const char* newName,
+								Inode* inode);
+			status_t		_UpdateNameTrigrams(Transaction& transaction,
+								const uint32* oldTrigrams, int32 oldCount,
+								const uint32* newTrigrams, int32 newCount,
+								Inode* inode);
+
 private:
 			Volume*			fVolume;
 			Inode*			fNode;
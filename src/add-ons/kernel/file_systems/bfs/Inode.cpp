@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -398,6 +399,9 @@ Inode::~Inode()
 {
 	PRINT(("Inode::~Inode() @ %p\n", this));
 
+	if (IsFile())
+		fVolume->Allocator().ReleaseReservation(ID());
+
 	file_cache_delete(FileCache());
 	file_map_delete(Map());
 	delete fTree;
@@ -564,7 +568,9 @@ Inode::_MakeSpaceForSmallData(Transaction& transaction, bfs_inode* node,
 		int32 index = 0, maxIndex = 0;
 		for (; !item->IsLast(node); item = item->Next(), index++) {
 			// should not remove those
-			if (*item->Name() == FILE_NAME_NAME || !strcmp(name, item->Name()))
+			if (*item->Name() == FILE_NAME_NAME
+				|| *item->Name() == FILE_DATA_NAME
+				|| !strcmp(name, item->Name()))
 				continue;
 
 			if (max == NULL || max->Size() < item->Size()) {
@@ -722,6 +728,9 @@ Inode::_AddSmallData(Transaction& transaction, NodeGetter& nodeGetter,
 	nodeGetter.MakeWritable(transaction);
 	RecursiveLocker locker(fSmallDataLock);
 
+	// the end of the space we may use without forcing other items out
+	uint8* end = (uint8*)node + fVolume->InodeSize() - _NameReserve(node, name);
+
 	// Find the last item or one with the same name we have to add
 	small_data* item = node->SmallDataStart();
 	int32 index = 0;
@@ -741,8 +750,7 @@ Inode::_AddSmallData(Transaction& transaction, NodeGetter& nodeGetter,
 		// try to change the attributes value
 		if (item->data_size > pos + length
 			|| force
-			|| ((uint8*)last + pos + length - item->DataSize())
-					<= ((uint8*)node + fVolume->InodeSize())) {
+			|| ((uint8*)last + pos + length - item->DataSize()) <= end) {
 			// Make room for the new attribute if needed (and we are forced
 			// to do so)
 			if (force && ((uint8*)last + pos + length - item->DataSize())
@@ -811,7 +819,7 @@ Inode::_AddSmallData(Transaction& transaction, NodeGetter& nodeGetter,
 
 	// try to add the new attribute!
 
-	if ((uint8*)item + spaceNeeded > (uint8*)node + fVolume->InodeSize()) {
+	if ((uint8*)item + spaceNeeded > end) {
 		// there is not enough space for it!
 		if (!force)
 			return B_DEVICE_FULL;
@@ -832,7 +840,7 @@ Inode::_AddSmallData(Transaction& transaction, NodeGetter& nodeGetter,
 	memset(item, 0, spaceNeeded);
 	item->type = HOST_ENDIAN_TO_BFS_INT32(type);
 	item->name_size = HOST_ENDIAN_TO_BFS_INT16(nameLength);
-	item->data_size = HOST_ENDIAN_TO_BFS_INT16(length);
+	item->data_size = HOST_ENDIAN_TO_BFS_INT16(pos + length);
 	strcpy(item->Name(), name);
 	memcpy(item->Data() + pos, data, length);
 
@@ -965,6 +973,34 @@ Inode::SetName(Transaction& transaction, const char* name)
 }
 
 
+/*!	Returns the number of bytes at the end of the small_data section that
+	must stay free when the item \a name is added, or grows.
+	Files with inline data always keep enough space for the longest possible
+	name, so that renaming them never has to push their data out of the
+	inode.
+	You need to hold the fSmallDataLock when you call this method
+*/
+int32
+Inode::_NameReserve(const bfs_inode* node, const char* name) const
+{
+	ASSERT_LOCKED_RECURSIVE(&fSmallDataLock);
+
+	if (!HasInlineData() || *name == FILE_NAME_NAME)
+		return 0;
+
+	int32 reserve = sizeof(small_data) + FILE_NAME_NAME_LENGTH + 3
+		+ B_FILE_NAME_LENGTH;
+
+	small_data* item = NULL;
+	while (_GetNextSmallData(const_cast<bfs_inode*>(node), &item) == B_OK) {
+		if (*item->Name() == FILE_NAME_NAME
+			&& item->NameSize() == FILE_NAME_NAME_LENGTH)
+			return max_c(reserve - (int32)item->Size(), 0);
+	}
+	return reserve;
+}
+
+
 status_t
 Inode::_RemoveAttribute(Transaction& transaction, const char* name,
 	bool hasIndex, Index* index)
@@ -1229,6 +1265,10 @@ Inode::WriteAttribute(Transaction& transaction, const char* name, int32 type,
 status_t
 Inode::RemoveAttribute(Transaction& transaction, const char* name)
 {
+	// the inline data of a file cannot be removed this way
+	if (name[0] == FILE_DATA_NAME && name[1] == '\0')
+		return B_NOT_ALLOWED;
+
 	Index index(fVolume);
 	bool hasIndex = index.SetTo(name) == B_OK;
 	NodeGetter node(fVolume, this);
@@ -1390,8 +1430,9 @@ Inode::ContainerContentsChanged(Transaction& transaction)
 off_t
 Inode::AllocatedSize() const
 {
-	if (IsSymLink() && (Flags() & INODE_LONG_SYMLINK) == 0) {
-		// This symlink does not have a data stream
+	if ((IsSymLink() && (Flags() & INODE_LONG_SYMLINK) == 0)
+		|| HasInlineData()) {
+		// This node does not have a data stream
 		return Node().InodeSize();
 	}
 
@@ -1546,6 +1587,9 @@ Inode::ReadAt(off_t pos, uint8* buffer, size_t* _length)
 
 	locker.Unlock();
 
+	// inline data is read through the file cache, too, so that changes made
+	// through a mapping are visible; bfs_read_pages() fills the pages from
+	// the inode
 	return file_cache_read(FileCache(), NULL, pos, buffer, _length);
 }
 
@@ -1573,8 +1617,9 @@ Inode::WriteAt(Transaction& transaction, off_t pos, const uint8* buffer,
 
 	locker.Unlock();
 
-	// the transaction doesn't have to be started already
-	if (changeSize && !transaction.IsStarted())
+	// the transaction doesn't have to be started already; inline data is
+	// always changed as part of one
+	if ((changeSize || HasInlineData()) && !transaction.IsStarted())
 		transaction.Start(fVolume, BlockNumber());
 
 	WriteLocker writeLocker(fLock);
@@ -1582,7 +1627,8 @@ Inode::WriteAt(Transaction& transaction, off_t pos, const uint8* buffer,
 	// Work around possible race condition: Someone might have shrunken the file
 	// while we had no lock.
 	if (!transaction.IsStarted()
-		&& (uint64)pos + (uint64)length > (uint64)Size()) {
+		&& ((uint64)pos + (uint64)length > (uint64)Size()
+			|| HasInlineData())) {
 		writeLocker.Unlock();
 		transaction.Start(fVolume, BlockNumber());
 		writeLocker.Lock();
@@ -1612,6 +1658,19 @@ Inode::WriteAt(Transaction& transaction, off_t pos, const uint8* buffer,
 		}
 	}
 
+	if (HasInlineData() && length > 0) {
+		// The data still fits into the inode; any gap has already been
+		// filled with zeros when the inline data was resized. The inode is
+		// the backing store of the file cache, and must be changed in this
+		// transaction; the cache is updated below, just like for any other
+		// file, so that cached and mapped pages stay coherent.
+		status_t status = WriteInlineData(transaction, pos, buffer, _length);
+		if (status != B_OK) {
+			WriteLockInTransaction(transaction);
+			return status;
+		}
+	}
+
 	writeLocker.Unlock();
 
 	if (oldSize < pos)
@@ -1640,6 +1699,11 @@ Inode::WriteAt(Transaction& transaction, off_t pos, const uint8* buffer,
 status_t
 Inode::FillGapWithZeros(off_t pos, off_t newSize)
 {
+	if (HasInlineData()) {
+		// inline data is always cleared when it grows
+		return B_OK;
+	}
+
 	while (pos < newSize) {
 		size_t size;
 		if (newSize > pos + 1024 * 1024 * 1024)
@@ -1658,6 +1722,242 @@ Inode::FillGapWithZeros(off_t pos, off_t newSize)
 }
 
 
+/*!	Reads from the data of a file that is stored in its inode; the caller
+	must have the inode read locked, and has to make sure that \a pos lies
+	within the file.
+*/
+status_t
+Inode::ReadInlineData(off_t pos, uint8* buffer, size_t* _length)
+{
+	NodeGetter node(fVolume, this);
+	if (node.Node() == NULL)
+		return B_IO_ERROR;
+
+	RecursiveLocker locker(fSmallDataLock);
+
+	const char dataTag[2] = {FILE_DATA_NAME, 0};
+	small_data* item = FindSmallData(node.Node(), dataTag);
+	if (item == NULL || pos >= item->DataSize()) {
+		*_length = 0;
+		return B_OK;
+	}
+
+	size_t length = min_c(*_length, item->DataSize() - pos);
+	if (user_memcpy(buffer, item->Data() + pos, length) != B_OK)
+		return B_BAD_ADDRESS;
+
+	*_length = length;
+	return B_OK;
+}
+
+
+/*!	Overwrites the data of a file that is stored in its inode. The file
+	must already have been resized via SetFileSize() to cover the range
+	written, and the caller must have the inode write locked.
+*/
+status_t
+Inode::WriteInlineData(Transaction& transaction, off_t pos,
+	const uint8* buffer, size_t* _length)
+{
+	NodeGetter node(fVolume, transaction, this);
+	if (node.WritableNode() == NULL)
+		return B_IO_ERROR;
+
+	RecursiveLocker locker(fSmallDataLock);
+
+	const char dataTag[2] = {FILE_DATA_NAME, 0};
+	small_data* item = FindSmallData(node.WritableNode(), dataTag);
+	if (item == NULL || pos + *_length > item->DataSize())
+		RETURN_ERROR(B_BAD_DATA);
+
+	if (user_memcpy(item->Data() + pos, buffer, *_length) != B_OK) {
+		*_length = 0;
+		return B_BAD_ADDRESS;
+	}
+
+	return B_OK;
+}
+
+
+/*!	Returns the size of the data stored in the inode, which must match the
+	file size. Only used by the file system check.
+*/
+size_t
+Inode::InlineDataSize() const
+{
+	NodeGetter node(fVolume, this);
+	if (node.Node() == NULL)
+		return 0;
+
+	RecursiveLocker locker(fSmallDataLock);
+
+	const char dataTag[2] = {FILE_DATA_NAME, 0};
+	small_data* item = FindSmallData(node.Node(), dataTag);
+	return item != NULL ? item->DataSize() : 0;
+}
+
+
+/*!	Resizes the inline data of the file to \a size bytes, filling any
+	new space with zeros. Returns \c B_DEVICE_FULL if the data would no
+	longer fit into the inode.
+*/
+status_t
+Inode::_SetInlineDataSize(Transaction& transaction, off_t size)
+{
+	// _AddSmallData() computes the space needed in 32 bits only
+	if (size > fVolume->InodeSize() - sizeof(bfs_inode))
+		return B_DEVICE_FULL;
+
+	NodeGetter node(fVolume, transaction, this);
+	if (node.WritableNode() == NULL)
+		return B_IO_ERROR;
+
+	const char dataTag[2] = {FILE_DATA_NAME, 0};
+	status_t status;
+	if (size == 0) {
+		status = _RemoveSmallData(transaction, node, dataTag);
+		if (status == B_ENTRY_NOT_FOUND)
+			status = B_OK;
+	} else {
+		// _AddSmallData() keeps the data in front of "pos", and clears the
+		// gap to it
+		status = _AddSmallData(transaction, node, dataTag, FILE_DATA_TYPE,
+			size, (const uint8*)"", 0);
+	}
+	if (status != B_OK)
+		return status;
+
+	Node().data.size = HOST_ENDIAN_TO_BFS_INT64(size);
+
+	file_cache_set_size(FileCache(), size);
+	file_map_set_size(Map(), size);
+
+	return WriteBack(transaction);
+}
+
+
+/*!	Moves the data of the file out of its inode into a newly allocated data
+	stream of \a size bytes, and clears the INODE_INLINE_DATA flag.
+	The data is written to its new block directly: the file cache is left
+	alone, as it may contain newer pages changed through a mapping; those are
+	still modified, and will be written to the new stream by the page writer.
+	Must only be called from SetFileSize() with the inode write locked.
+*/
+status_t
+Inode::_MoveInlineDataToStream(Transaction& transaction, off_t size)
+{
+	off_t oldSize = Size();
+	uint8* buffer = NULL;
+	if (oldSize > 0) {
+		// the inline data is always smaller than a block
+		buffer = (uint8*)calloc(1, fVolume->BlockSize());
+		if (buffer == NULL)
+			return B_NO_MEMORY;
+
+		size_t length = oldSize;
+		status_t status = ReadInlineData(0, buffer, &length);
+		if (status != B_OK) {
+			free(buffer);
+			return status;
+		}
+	}
+	MemoryDeleter bufferDeleter(buffer);
+
+	{
+		NodeGetter node(fVolume, transaction, this);
+		const char dataTag[2] = {FILE_DATA_NAME, 0};
+		status_t status = _RemoveSmallData(transaction, node, dataTag);
+		if (status != B_OK && status != B_ENTRY_NOT_FOUND)
+			return status;
+	}
+
+	Node().flags &= ~HOST_ENDIAN_TO_BFS_INT32(INODE_INLINE_DATA);
+	Node().data.size = 0;
+
+	status_t status = SetFileSize(transaction, size);
+	if (status != B_OK || oldSize == 0)
+		return status;
+
+	block_run run;
+	off_t offset;
+	status = FindBlockRun(0, run, offset);
+	if (status != B_OK)
+		return status;
+
+	ssize_t written = write_pos(fVolume->Device(), fVolume->ToOffset(run),
+		buffer, fVolume->BlockSize());
+	if (written != (ssize_t)fVolume->BlockSize())
+		return written < 0 ? (status_t)written : B_IO_ERROR;
+
+	return B_OK;
+}
+
+
+/*!	Stores changes made to the cached data of a file that keeps its data in
+	the inode in the inode. Those can only come from a mapping, as WriteAt()
+	changes the inode and the cache together, and bfs_write_pages() cannot
+	store them, as it must not start a transaction.
+*/
+status_t
+Inode::_SyncInlineData()
+{
+	while (true) {
+		off_t size = Size();
+		if (!HasInlineData() || size == 0)
+			return B_OK;
+
+		uint8* buffer = (uint8*)malloc(2 * size);
+		if (buffer == NULL)
+			return B_NO_MEMORY;
+		MemoryDeleter bufferDeleter(buffer);
+
+		// the cache must not be accessed with the inode locked, as the page
+		// writer might hold one of its pages busy while waiting for the lock
+		size_t length = size;
+		status_t status = file_cache_read(FileCache(), NULL, 0, buffer,
+			&length);
+		if (status != B_OK)
+			return status;
+
+		uint8* data = buffer + size;
+
+		{
+			InodeReadLocker locker(this);
+			if (!HasInlineData())
+				return B_OK;
+			if (Size() != size || length != (size_t)size)
+				continue;
+
+			size_t dataLength = size;
+			status = ReadInlineData(0, data, &dataLength);
+			if (status != B_OK)
+				return status;
+			if (dataLength == length && !memcmp(buffer, data, length))
+				return B_OK;
+		}
+
+		Transaction transaction(fVolume, BlockNumber());
+		WriteLockInTransaction(transaction);
+
+		if (!HasInlineData()) {
+			// the data has been moved into a stream, the page writer will
+			// write the pages there
+			return B_OK;
+		}
+		if (Size() != size) {
+			// the file has been resized in the mean time, try again
+			continue;
+		}
+
+		status = WriteInlineData(transaction, 0, buffer, &length);
+		if (status == B_OK)
+			status = transaction.Done();
+
+		return status;
+	}
+}
+
+
 /*!	Allocates \a length blocks, and clears their contents. Growing
 	the indirect and double indirect range uses this method.
 	The allocated block_run is saved in "run"
@@ -1804,7 +2104,10 @@ Inode::_GrowStream(Transaction& transaction, off_t size)
 					break;
 			}
 
-			if (free < NUM_DIRECT_BLOCKS) {
+			// Even if all direct runs are in use, the last one can still
+			// grow, as long as there is no indirect range yet
+			if (free < NUM_DIRECT_BLOCKS || (data->MaxIndirectRange() == 0
+					&& data->direct[NUM_DIRECT_BLOCKS - 1].MergeableWith(run))) {
 				// can we merge the last allocated run with the new one?
 				int32 last = free - 1;
 				if (free > 0 && data->direct[last].MergeableWith(run)) {
@@ -1830,6 +2133,9 @@ Inode::_GrowStream(Transaction& transaction, off_t size)
 			block_run* runs = NULL;
 			uint32 free = 0;
 			off_t block;
+			off_t previousBlock = -1;
+				// the block containing the last run, if it is not the one
+				// the new run would be inserted in
 
 			// if there is no indirect block yet, create one
 			if (data->indirect.IsZero()) {
@@ -1858,23 +2164,46 @@ Inode::_GrowStream(Transaction& transaction, off_t size)
 
 					if (free < numberOfRuns)
 						break;
+
+					previousBlock = block + i;
 				}
 				if (i == data->indirect.Length())
 					runs = NULL;
 			}
 
 			if (runs != NULL) {
-				// try to insert the run to the last one - note that this
-				// doesn't take block borders into account, so it could be
-				// further optimized
-				cached.MakeWritable(transaction);
+				// try to insert the run to the last one - if the new run
+				// would start a new array block, the last one is in the
+				// previous block
+				bool merged = false;
+				if (free == 0 && previousBlock >= 0) {
+					CachedBlock cachedPrevious(fVolume);
+					block_run* previousRuns
+						= (block_run*)cachedPrevious.SetTo(previousBlock);
+					if (previousRuns == NULL)
+						return B_IO_ERROR;
 
-				int32 last = free - 1;
-				if (free > 0 && runs[last].MergeableWith(run)) {
-					runs[last].length = HOST_ENDIAN_TO_BFS_INT16(
-						runs[last].Length() + run.Length());
-				} else
-					runs[free] = run;
+					int32 last = fVolume->BlockSize() / sizeof(block_run) - 1;
+					if (previousRuns[last].MergeableWith(run)) {
+						if (cachedPrevious.MakeWritable(transaction) != B_OK)
+							return B_IO_ERROR;
+
+						previousRuns[last].length = HOST_ENDIAN_TO_BFS_INT16(
+							previousRuns[last].Length() + run.Length());
+						merged = true;
+					}
+				}
+
+				if (!merged) {
+					cached.MakeWritable(transaction);
+
+					int32 last = free - 1;
+					if (free > 0 && runs[last].MergeableWith(run)) {
+						runs[last].length = HOST_ENDIAN_TO_BFS_INT16(
+							runs[last].Length() + run.Length());
+					} else
+						runs[free] = run;
+				}
 
 				data->max_indirect_range = HOST_ENDIAN_TO_BFS_INT64(
 					data->MaxIndirectRange()
@@ -2235,6 +2564,15 @@ Inode::SetFileSize(Transaction& transaction, off_t size)
 
 	T(Resize(this, oldSize, size, false));
 
+	if (HasInlineData()) {
+		status_t status = _SetInlineDataSize(transaction, size);
+		if (status != B_DEVICE_FULL)
+			return status;
+
+		// the data no longer fits into the inode
+		return _MoveInlineDataToStream(transaction, size);
+	}
+
 	// should the data stream grow or shrink?
 	status_t status;
 	if (size > oldSize) {
@@ -2253,6 +2591,15 @@ Inode::SetFileSize(Transaction& transaction, off_t size)
 	file_cache_set_size(FileCache(), size);
 	file_map_set_size(Map(), size);
 
+	if (size == 0 && IsFile() && fVolume->SupportsInlineData()) {
+		// An empty file can keep its data in the inode again. Resizing the
+		// file cache has removed all of its pages, and their mappings, so
+		// no page of the old stream is left; new pages are filled from, and
+		// compared against the inode just like for any other inline file.
+		fVolume->Allocator().ReleaseReservation(ID());
+		Node().flags |= HOST_ENDIAN_TO_BFS_INT32(INODE_INLINE_DATA);
+	}
+
 	return WriteBack(transaction);
 }
 
@@ -2275,7 +2622,7 @@ Inode::NeedsTrimming() const
 	// possible. There are only few indices anyway, so this doesn't hurt.
 	// Also, if an inode is already in deleted state, we don't bother trimming
 	// it.
-	if (IsIndex() || IsDeleted()
+	if (IsIndex() || IsDeleted() || HasInlineData()
 		|| (IsSymLink() && (Flags() & INODE_LONG_SYMLINK) == 0))
 		return false;
 
@@ -2297,10 +2644,130 @@ Inode::TrimPreallocation(Transaction& transaction)
 	if (status < B_OK)
 		return status;
 
+	// the file is done growing for now
+	fVolume->Allocator().ReleaseReservation(ID());
+
 	return WriteBack(transaction);
 }
 
 
+/*!	Moves the data of a fragmented file into a single block_run, if there
+	is enough contiguous free space for it. \a _removedFragments is set to
+	the number of fragments the file lost.
+	Like BPlusTree::Compact(), this is meant to be used during the file
+	system check, and needs the volume's journal to be locked.
+*/
+status_t
+Inode::Defragment(uint32& _removedFragments)
+{
+	_removedFragments = 0;
+
+	if (!IsFile() || IsDeleted() || HasInlineData()
+		|| (Flags() & INODE_LOGGED) != 0)
+		return B_BAD_TYPE;
+
+	// Write back the file cache, so that the data on disk is current; pages
+	// that are changed later will go to the new location, as the file map
+	// is invalidated before the inode is unlocked again
+	status_t status = file_cache_sync(FileCache());
+	if (status != B_OK)
+		return status;
+
+	Transaction transaction(fVolume, BlockNumber());
+	WriteLockInTransaction(transaction);
+
+	off_t size = Size();
+	uint32 blockShift = fVolume->BlockShift();
+	off_t numBlocks = (size + fVolume->BlockSize() - 1) >> blockShift;
+	if (numBlocks < 2 || numBlocks > MAX_BLOCK_RUN_LENGTH)
+		return B_OK;
+
+	uint32 fragments = 0;
+	off_t nextBlock = -1;
+	for (off_t pos = 0; pos < size;) {
+		block_run run;
+		off_t offset;
+		status = FindBlockRun(pos, run, offset);
+		if (status != B_OK)
+			return status;
+
+		if (fVolume->ToBlock(run) != nextBlock)
+			fragments++;
+
+		nextBlock = fVolume->ToBlock(run) + run.Length();
+		pos = offset + ((off_t)run.Length() << blockShift);
+	}
+
+	if (fragments < 2)
+		return B_OK;
+
+	block_run newRun;
+	status = fVolume->Allocate(transaction, this, numBlocks, newRun,
+		numBlocks);
+	if (status != B_OK)
+		return status;
+
+	// the file doesn't need to grow in place anymore
+	fVolume->Allocator().ReleaseReservation(ID());
+
+	// Copy the data over
+	size_t bufferSize = 65536;
+	uint8* buffer = (uint8*)malloc(bufferSize);
+	if (buffer == NULL)
+		return B_NO_MEMORY;
+
+	MemoryDeleter bufferDeleter(buffer);
+
+	off_t end = numBlocks << blockShift;
+	for (off_t pos = 0; pos < end;) {
+		block_run run;
+		off_t offset;
+		status = FindBlockRun(pos, run, offset);
+		if (status != B_OK)
+			return status;
+
+		off_t runEnd = min_c(end, offset + ((off_t)run.Length() << blockShift));
+		size_t length = min_c(bufferSize, runEnd - pos);
+
+		ssize_t bytesRead = read_pos(fVolume->Device(),
+			fVolume->ToOffset(run) + pos - offset, buffer, length);
+		if (bytesRead != (ssize_t)length)
+			return bytesRead < 0 ? bytesRead : B_IO_ERROR;
+
+		ssize_t bytesWritten = write_pos(fVolume->Device(),
+			fVolume->ToOffset(newRun) + pos, buffer, length);
+		if (bytesWritten != (ssize_t)length)
+			return bytesWritten < 0 ? bytesWritten : B_IO_ERROR;
+
+		pos += length;
+	}
+
+	// Replace the data stream
+	status = _ShrinkStream(transaction, 0);
+	if (status != B_OK)
+		return status;
+
+	data_stream* data = &Node().data;
+	memset(data, 0, sizeof(data_stream));
+	data->direct[0] = newRun;
+	data->max_direct_range = HOST_ENDIAN_TO_BFS_INT64(end);
+	data->size = HOST_ENDIAN_TO_BFS_INT64(size);
+
+	status = WriteBack(transaction);
+	if (status != B_OK)
+		return status;
+
+	file_map_invalidate(Map(), 0, size);
+
+	status = transaction.Done();
+	if (status != B_OK)
+		return status;
+
+	_removedFragments = fragments - 1;
+	return B_OK;
+}
+
+
 //!	Frees the file's data stream and removes all attributes
 status_t
 Inode::Free(Transaction& transaction)
@@ -2342,8 +2809,14 @@ Inode::Free(Transaction& transaction)
 status_t
 Inode::Sync()
 {
-	if (FileCache())
+	if (FileCache()) {
+		if (HasInlineData()) {
+			status_t status = _SyncInlineData();
+			if (status != B_OK)
+				return status;
+		}
 		return file_cache_sync(FileCache());
+	}
 
 	// We may also want to flush the attribute's data stream to
 	// disk here... (do we?)
@@ -2691,6 +3164,11 @@ Inode::Create(Transaction& transaction, Inode* parent, const char* name,
 
 	node->type = HOST_ENDIAN_TO_BFS_INT32(type);
 
+	if (inode->IsFile() && volume->SupportsInlineData()) {
+		// new files keep their data in the inode until it grows too large
+		node->flags |= HOST_ENDIAN_TO_BFS_INT32(INODE_INLINE_DATA);
+	}
+
 	inode->WriteBack(transaction);
 		// make sure the initialized node is available to others
 
@@ -2841,7 +3319,8 @@ AttributeIterator::GetNext(char* name, size_t* _length, uint32* _type,
 		int32 index = 0;
 		for (; !item->IsLast(node); item = item->Next(), index++) {
 			if (item->NameSize() == FILE_NAME_NAME_LENGTH
-				&& *item->Name() == FILE_NAME_NAME)
+				&& (*item->Name() == FILE_NAME_NAME
+					|| *item->Name() == FILE_DATA_NAME))
 				continue;
 
 			if (index >= fCurrentSmallData)
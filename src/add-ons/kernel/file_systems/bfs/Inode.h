@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2010, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef INODE_H
@@ -71,6 +72,9 @@ public:
 			bool				IsLongSymLink() const
 									{ return (Flags() & INODE_LONG_SYMLINK)
 										!= 0; }
+			bool				HasInlineData() const
+									{ return (Flags() & INODE_INLINE_DATA)
+										!= 0; }
 
 			bool				HasUserAccessableStream() const
 									{ return IsFile(); }
@@ -143,11 +147,20 @@ public:
 									const uint8* buffer, size_t* length);
 			status_t			FillGapWithZeros(off_t oldSize, off_t newSize);
 
+			// inline data access, for files with INODE_INLINE_DATA set
+			status_t			ReadInlineData(off_t pos, uint8* buffer,
+									size_t* _length);
+			status_t			WriteInlineData(Transaction& transaction,
+									off_t pos, const uint8* buffer,
+									size_t* _length);
+			size_t				InlineDataSize() const;
+
 			status_t			SetFileSize(Transaction& transaction,
 									off_t size);
 			status_t			Append(Transaction& transaction, off_t bytes);
 			status_t			TrimPreallocation(Transaction& transaction);
 			bool				NeedsTrimming() const;
+			status_t			Defragment(uint32& _removedFragments);
 
 			status_t			Free(Transaction& transaction);
 			status_t			Sync();
@@ -228,6 +241,14 @@ private:
 			status_t			_RemoveAttribute(Transaction& transaction,
 									const char* name, bool hasIndex,
 									Index* index);
+			int32				_NameReserve(const bfs_inode* node,
+									const char* name) const;
+
+			status_t			_SetInlineDataSize(Transaction& transaction,
+									off_t size);
+			status_t			_MoveInlineDataToStream(
+									Transaction& transaction, off_t size);
+			status_t			_SyncInlineData();
 
 			void				_AddIterator(AttributeIterator* iterator);
 			void				_RemoveIterator(AttributeIterator* iterator);
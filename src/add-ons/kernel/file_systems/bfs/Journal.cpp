@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2010, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -9,10 +10,15 @@
 
 #include "Journal.h"
 
+#include "bfs_control.h"
 #include "Debug.h"
 #include "Inode.h"
 
 
+static const int32 kMaxLogVecs = 256;
+	// maximum number of vecs that are written to the log at once
+
+
 struct run_array {
 	int32		count;
 	int32		max_runs;
@@ -47,8 +53,6 @@ public:
 			uint32			LogEntryLength() const
 								{ return CountBlocks() + CountArrays(); }
 
-			int32			MaxArrayLength();
-
 private:
 			status_t		_AddArray();
 			bool			_ContainsRun(block_run& run);
@@ -85,6 +89,36 @@ private:
 #endif
 };
 
+/*!	Collects the blocks of a log entry, and writes them to the log area with
+	as few writes as possible; the entry is only split when the log wraps
+	around, or when there are more vecs than can be written at once.
+*/
+class LogWriter {
+public:
+							LogWriter(Volume* volume, uint32 logSize,
+								off_t logStart);
+							~LogWriter();
+
+			status_t		InitCheck() const
+								{ return fVecs != NULL ? B_OK : B_NO_MEMORY; }
+
+			status_t		Add(const void* data);
+			status_t		Flush();
+
+			off_t			Position() const { return fPosition; }
+			int32			CountWrites() const { return fWrites; }
+
+private:
+			Volume*			fVolume;
+			uint32			fLogSize;
+			off_t			fLogOffset;
+			iovec*			fVecs;
+			int32			fCount;
+			off_t			fStart;
+			off_t			fPosition;
+			int32			fWrites;
+};
+
 
 #if BFS_TRACING && !defined(BFS_SHELL) && !defined(_BOOT_MODE)
 namespace BFSJournalTracing {
@@ -380,16 +414,72 @@ RunArrays::Insert(off_t blockNumber)
 }
 
 
-int32
-RunArrays::MaxArrayLength()
+//	#pragma mark - LogWriter
+
+
+LogWriter::LogWriter(Volume* volume, uint32 logSize, off_t logStart)
+	:
+	fVolume(volume),
+	fLogSize(logSize),
+	fLogOffset(volume->ToOffset(volume->Log())),
+	fCount(0),
+	fStart(logStart),
+	fPosition(logStart),
+	fWrites(0)
 {
-	int32 max = 0;
-	for (int32 i = 0; i < CountArrays(); i++) {
-		if (ArrayAt(i)->CountRuns() > max)
-			max = ArrayAt(i)->CountRuns();
+	fVecs = (iovec*)malloc(sizeof(iovec) * kMaxLogVecs);
+}
+
+
+LogWriter::~LogWriter()
+{
+	free(fVecs);
+}
+
+
+/*!	Adds the block at \a data to the log entry. Pending blocks are written
+	to disk first if the log wraps around at this point, or if there are no
+	vecs left.
+*/
+status_t
+LogWriter::Add(const void* data)
+{
+	if (fCount > 0 && (fPosition == fLogSize || fCount == kMaxLogVecs)) {
+		status_t status = Flush();
+		if (status != B_OK)
+			return status;
+	}
+
+	if (fPosition == fLogSize) {
+		// the log wraps around
+		fPosition = 0;
 	}
+	if (fCount == 0)
+		fStart = fPosition;
 
-	return max;
+	add_to_iovec(fVecs, fCount, kMaxLogVecs, data, fVolume->BlockSize());
+	fPosition++;
+	return B_OK;
+}
+
+
+status_t
+LogWriter::Flush()
+{
+	if (fCount == 0)
+		return B_OK;
+
+	ssize_t written = writev_pos(fVolume->Device(),
+		fLogOffset + (fStart << fVolume->BlockShift()), fVecs, fCount);
+
+	fCount = 0;
+	fWrites++;
+
+	if (written < 0) {
+		FATAL(("could not write log area: %s!\n", strerror(written)));
+		return written;
+	}
+	return B_OK;
 }
 
 
@@ -405,7 +495,14 @@ Journal::Journal(Volume* volume)
 	fUsed(0),
 	fUnwrittenTransactions(0),
 	fHasSubtransaction(false),
-	fSeparateSubTransactions(false)
+	fSeparateSubTransactions(false),
+	fTransactions(0),
+	fLogWrites(0),
+	fLoggedBlocks(0),
+	fLockWaits(0),
+	fLockWaitTime(0),
+	fLogFullStalls(0),
+	fLogFullStallTime(0)
 {
 	recursive_lock_init(&fLock, "bfs journal");
 	mutex_init(&fEntriesLock, "bfs journal entries");
@@ -722,10 +819,7 @@ Journal::_WriteTransactionToLog()
 
 	fHasSubtransaction = false;
 
-	int32 blockShift = fVolume->BlockShift();
-	off_t logOffset = fVolume->ToBlock(fVolume->Log()) << blockShift;
 	off_t logStart = fVolume->LogEnd() % fLogSize;
-	off_t logPosition = logStart;
 	status_t status;
 
 	// create run_array structures for all changed blocks
@@ -761,87 +855,68 @@ Journal::_WriteTransactionToLog()
 	// If necessary, flush the log, so that we have enough space for this
 	// transaction
 	if (runArrays.LogEntryLength() > FreeLogBlocks()) {
-		cache_sync_transaction(fVolume->BlockCache(), fTransactionID);
+		_SyncTransaction();
 		if (runArrays.LogEntryLength() > FreeLogBlocks()) {
 			panic("no space in log after sync (%ld for %ld blocks)!",
 				(long)FreeLogBlocks(), (long)runArrays.LogEntryLength());
 		}
 	}
 
-	// Write log entries to disk
-
-	int32 maxVecs = runArrays.MaxArrayLength() + 1;
-		// one extra for the index block
+	// Write the whole log entry to disk; all transactions that were batched
+	// into the current one are committed with a single write, unless the
+	// log wraps around.
 
-	iovec* vecs = (iovec*)malloc(sizeof(iovec) * maxVecs);
-	if (vecs == NULL) {
-		// TODO: write back log entries directly?
-		return B_NO_MEMORY;
-	}
+	LogWriter writer(fVolume, fLogSize, logStart);
+	status = writer.InitCheck();
 
-	for (int32 k = 0; k < runArrays.CountArrays(); k++) {
+	int32 blocksInCache = 0;
+	for (int32 k = 0; k < runArrays.CountArrays() && status == B_OK; k++) {
 		run_array* array = runArrays.ArrayAt(k);
-		int32 index = 0, count = 1;
-		int32 wrap = fLogSize - logStart;
-
-		add_to_iovec(vecs, index, maxVecs, (void*)array, fVolume->BlockSize());
+		status = writer.Add(array);
 
-		// add block runs
-
-		for (int32 i = 0; i < array->CountRuns(); i++) {
+		for (int32 i = 0; i < array->CountRuns() && status == B_OK; i++) {
 			const block_run& run = array->RunAt(i);
 			off_t blockNumber = fVolume->ToBlock(run);
 
-			for (int32 j = 0; j < run.Length(); j++) {
-				if (count >= wrap) {
-					// We need to write back the first half of the entry
-					// directly as the log wraps around
-					if (writev_pos(fVolume->Device(), logOffset
-						+ (logStart << blockShift), vecs, index) < 0)
-						FATAL(("could not write log area!\n"));
-
-					logPosition = logStart + count;
-					logStart = 0;
-					wrap = fLogSize;
-					count = 0;
-					index = 0;
-				}
-
+			for (int32 j = 0; j < run.Length() && status == B_OK; j++) {
 				// make blocks available in the cache
 				const void* data = block_cache_get(fVolume->BlockCache(),
 					blockNumber + j);
 				if (data == NULL) {
-					free(vecs);
-					return B_IO_ERROR;
+					status = B_IO_ERROR;
+					break;
 				}
 
-				add_to_iovec(vecs, index, maxVecs, data, fVolume->BlockSize());
-				count++;
+				blocksInCache++;
+				status = writer.Add(data);
 			}
 		}
+	}
 
-		// write back the rest of the log entry
-		if (count > 0) {
-			logPosition = logStart + count;
-			if (writev_pos(fVolume->Device(), logOffset
-					+ (logStart << blockShift), vecs, index) < 0)
-				FATAL(("could not write log area: %s!\n", strerror(errno)));
-		}
+	if (status == B_OK)
+		status = writer.Flush();
 
-		// release blocks again
-		for (int32 i = 0; i < array->CountRuns(); i++) {
+	// release blocks again
+	for (int32 k = 0; k < runArrays.CountArrays() && blocksInCache > 0; k++) {
+		run_array* array = runArrays.ArrayAt(k);
+
+		for (int32 i = 0; i < array->CountRuns() && blocksInCache > 0; i++) {
 			const block_run& run = array->RunAt(i);
 			off_t blockNumber = fVolume->ToBlock(run);
 
-			for (int32 j = 0; j < run.Length(); j++) {
+			for (int32 j = 0; j < run.Length() && blocksInCache > 0; j++) {
 				block_cache_put(fVolume->BlockCache(), blockNumber + j);
+				blocksInCache--;
 			}
 		}
-
-		logStart = logPosition % fLogSize;
 	}
 
-	free(vecs);
+	if (status != B_OK)
+		return status;
+
+	off_t logPosition = writer.Position();
+	fLogWrites += writer.CountWrites();
+	fLoggedBlocks += runArrays.LogEntryLength();
 
 	LogEntry* logEntry = new LogEntry(this, fVolume->LogEnd(),
 		runArrays.LogEntryLength());
@@ -945,9 +1020,19 @@ Journal::FlushLogAndBlocks()
 status_t
 Journal::Lock(Transaction* owner, bool separateSubTransactions)
 {
-	status_t status = recursive_lock_lock(&fLock);
-	if (status != B_OK)
-		return status;
+	status_t status = recursive_lock_trylock(&fLock);
+	if (status != B_OK) {
+		// someone else owns the journal - wait for it, and keep track of
+		// how long that took
+		bigtime_t start = system_time();
+
+		status = recursive_lock_lock(&fLock);
+		if (status != B_OK)
+			return status;
+
+		fLockWaits++;
+		fLockWaitTime += system_time() - start;
+	}
 
 	if (!fSeparateSubTransactions && recursive_lock_get_recursion(&fLock) > 1) {
 		// we'll just use the current transaction again
@@ -1063,16 +1148,169 @@ Journal::_TransactionDone(bool success)
 		// Flush the log from time to time, so that we have enough space
 		// for this transaction
 		if (size > FreeLogBlocks())
-			cache_sync_transaction(fVolume->BlockCache(), fTransactionID);
+			_SyncTransaction();
 
 		fUnwrittenTransactions++;
+		fTransactions++;
 		return B_OK;
 	}
 
+	fTransactions++;
 	return _WriteTransactionToLog();
 }
 
 
+/*!	Waits until the blocks of the current transaction have been written
+	back, so that the space they occupy in the log can be reused.
+	The time spent here is accounted as a log full stall.
+*/
+void
+Journal::_SyncTransaction()
+{
+	bigtime_t start = system_time();
+
+	cache_sync_transaction(fVolume->BlockCache(), fTransactionID);
+
+	fLogFullStalls++;
+	fLogFullStallTime += system_time() - start;
+}
+
+
+/*!	Writes the current transaction to the log, and all blocks to their final
+	location on disk, so that the log does not contain any valid entries
+	anymore.
+	The journal lock must be held.
+*/
+status_t
+Journal::_EmptyLog()
+{
+	if (fUnwrittenTransactions != 0 && _TransactionSize() != 0) {
+		status_t status = _WriteTransactionToLog();
+		if (status != B_OK)
+			return status;
+	}
+
+	status_t status = fVolume->FlushDevice();
+	if (status != B_OK)
+		return status;
+
+	MutexLocker locker(fEntriesLock);
+	return fEntries.IsEmpty() ? B_OK : B_BUSY;
+}
+
+
+/*!	Changes the size of the log area to \a length blocks. The log always
+	directly follows the block bitmap, as all BFS implementations consider
+	everything up to its end reserved; it can therefore only grow into free
+	blocks right after its current end. The log is emptied before, so that
+	nothing needs to be copied over.
+*/
+status_t
+Journal::ResizeLog(uint32 length)
+{
+	if (length < BFS_MIN_LOG_SIZE || length > BFS_MAX_LOG_SIZE)
+		return B_BAD_VALUE;
+	if (length == fLogSize)
+		return B_OK;
+
+	disk_super_block& superBlock = fVolume->SuperBlock();
+	block_run oldLog = superBlock.log_blocks;
+	block_run newLog = oldLog;
+	newLog.length = HOST_ENDIAN_TO_BFS_INT16(length);
+	bool grow = length > oldLog.Length();
+
+	// the blocks that are added to, or removed from the log area
+	block_run tail = oldLog;
+	tail.start = HOST_ENDIAN_TO_BFS_INT16(
+		oldLog.Start() + min_c(length, oldLog.Length()));
+	tail.length = HOST_ENDIAN_TO_BFS_INT16(
+		max_c(length, oldLog.Length()) - min_c(length, oldLog.Length()));
+
+	Transaction transaction;
+	status_t status;
+
+	if (grow) {
+		// reserve the space after the log in its own transaction
+		status = transaction.Start(fVolume, 0);
+		if (status == B_OK)
+			status = fVolume->Allocator().AllocateBlockRun(transaction, tail);
+		if (status == B_OK)
+			status = transaction.Done();
+		if (status != B_OK)
+			return status;
+	}
+
+	recursive_lock_lock(&fLock);
+
+	if (recursive_lock_get_recursion(&fLock) > 1)
+		status = B_BUSY;
+	else
+		status = _EmptyLog();
+
+	if (status == B_OK) {
+		superBlock.log_blocks = newLog;
+		superBlock.log_start = superBlock.log_end = 0;
+
+		status = fVolume->WriteSuperBlock();
+		if (status == B_OK) {
+			fVolume->LogStart() = 0;
+			fVolume->LogEnd() = 0;
+			fLogSize = length;
+			fMaxTransactionSize = fLogSize / 2 - 5;
+
+			ioctl(fVolume->Device(), B_FLUSH_DRIVE_CACHE);
+		} else {
+			superBlock.log_blocks = oldLog;
+			superBlock.log_start = HOST_ENDIAN_TO_BFS_INT64(
+				fVolume->LogStart());
+			superBlock.log_end = HOST_ENDIAN_TO_BFS_INT64(fVolume->LogEnd());
+		}
+	}
+
+	recursive_lock_unlock(&fLock);
+
+	// Free the blocks the log no longer uses, or the ones we reserved for
+	// it if growing failed; this has to wait until the super block is
+	// written, as blocks of the log area cannot be freed.
+
+	if (grow == (status != B_OK)) {
+		status_t freeStatus = transaction.Start(fVolume, 0);
+		if (freeStatus == B_OK)
+			freeStatus = fVolume->Allocator().Free(transaction, tail);
+		if (freeStatus == B_OK)
+			freeStatus = transaction.Done();
+		if (freeStatus != B_OK) {
+			FATAL(("could not free log area: %s\n", strerror(freeStatus)));
+			if (status == B_OK)
+				status = freeStatus;
+		}
+	}
+
+	if (status == B_OK) {
+		INFORM(("log resized to %" B_PRIu32 " blocks\n", length));
+	}
+	return status;
+}
+
+
+void
+Journal::GetStatistics(journal_statistics& stats) const
+{
+	memset(&stats, 0, sizeof(journal_statistics));
+
+	stats.log_size = fLogSize;
+	stats.free_log_blocks = FreeLogBlocks();
+	stats.max_transaction_size = fMaxTransactionSize;
+	stats.transactions = fTransactions;
+	stats.log_writes = fLogWrites;
+	stats.logged_blocks = fLoggedBlocks;
+	stats.lock_waits = fLockWaits;
+	stats.lock_wait_time = fLockWaitTime;
+	stats.log_full_stalls = fLogFullStalls;
+	stats.log_full_stall_time = fLogFullStallTime;
+}
+
+
 //	#pragma mark - debugger commands
 
 
@@ -1094,6 +1332,13 @@ Journal::Dump()
 	kprintf("  transaction ID:       %ld\n", fTransactionID);
 	kprintf("  has subtransaction:   %d\n", fHasSubtransaction);
 	kprintf("  separate sub-trans.:  %d\n", fSeparateSubTransactions);
+	kprintf("  transactions:         %lld\n", fTransactions);
+	kprintf("  log writes:           %lld (%lld blocks)\n", fLogWrites,
+		fLoggedBlocks);
+	kprintf("  lock waits:           %lld (%lld usecs)\n", fLockWaits,
+		fLockWaitTime);
+	kprintf("  log full stalls:      %lld (%lld usecs)\n", fLogFullStalls,
+		fLogFullStallTime);
 	kprintf("entries:\n");
 	kprintf("  address        id  start length\n");
 
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef JOURNAL_H
@@ -12,6 +13,7 @@
 #include "Utility.h"
 
 
+struct journal_statistics;
 struct run_array;
 class Inode;
 class LogEntry;
@@ -41,6 +43,9 @@ public:
 
 	inline	uint32			FreeLogBlocks() const;
 
+			status_t		ResizeLog(uint32 length);
+			void			GetStatistics(journal_statistics& stats) const;
+
 #ifdef BFS_DEBUGGER_COMMANDS
 			void			Dump();
 #endif
@@ -55,6 +60,8 @@ private:
 			status_t		_CheckRunArray(const run_array* array);
 			status_t		_ReplayRunArray(int32* start);
 			status_t		_TransactionDone(bool success);
+			void			_SyncTransaction();
+			status_t		_EmptyLog();
 
 	static	void			_TransactionWritten(int32 transactionID,
 								int32 event, void* _logEntry);
@@ -74,6 +81,15 @@ private:
 			int32			fTransactionID;
 			bool			fHasSubtransaction;
 			bool			fSeparateSubTransactions;
+
+			// statistics
+			int64			fTransactions;
+			int64			fLogWrites;
+			int64			fLoggedBlocks;
+			int64			fLockWaits;
+			bigtime_t		fLockWaitTime;
+			int64			fLogFullStalls;
+			bigtime_t		fLogFullStallTime;
 };
 
 
@@ -1,6 +1,7 @@
 /*
  * Copyright 2001-2009, Axel Dörfler, axeld@pinc-software.de.
  * Copyright 2010, Clemens Zeidler <haiku@clemens-zeidler.de>
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -79,6 +80,32 @@ union value {
 	char	String[INODE_FILE_NAME_LENGTH];
 };
 
+class Equation;
+
+/*!	Restricts the candidates of an index scan: if \c ids is set, only entries
+	that are part of this sorted array are considered, and entries that
+	match one of the \c excluded scans are skipped, as they have already
+	been returned by it.
+*/
+struct QueryScanFilter {
+	const off_t*	ids;
+	int32			idCount;
+	Equation**		excluded;
+	int32			excludedCount;
+};
+
+// the maximum number of entries an index may contribute to intersect
+// another index scan with
+static const int32 kMaxFilterEntries = 4096;
+
+// reading an index entry is assumed to be that much cheaper than reading
+// an inode
+static const off_t kIndexEntryCostRatio = 16;
+
+// the maximum number of entries of a trigram that are counted to find the
+// least common one
+static const off_t kMaxTrigramCount = 8192;
+
 
 /*!	Abstract base class for the operator/equation classes.
 */
@@ -97,8 +124,9 @@ public:
 							size_t size = 0) = 0;
 	virtual	void		Complement() = 0;
 
-	virtual	void		CalculateScore(Index& index) = 0;
-	virtual	int32		Score() const = 0;
+	virtual	void		Estimate(Index& index, off_t totalEntries) = 0;
+	virtual	off_t		EstimatedMatches() const = 0;
+	virtual	bool		IsIndexed() const = 0;
 
 	virtual	status_t	InitCheck() = 0;
 
@@ -117,7 +145,8 @@ protected:
 	Although an Equation object is quite independent from the volume on which
 	the query is run, there are some dependencies that are produced while
 	querying:
-	The type/size of the value, the score, and if it has an index or not.
+	The type/size of the value, the estimated number of matches, and if it
+	has an index or not.
 	So you could run more than one query on the same volume, but it might return
 	wrong values when it runs concurrently on another volume.
 	That's not an issue right now, because we run single-threaded and don't use
@@ -141,10 +170,38 @@ public:
 			status_t	PrepareQuery(Volume* volume, Index& index,
 							TreeIterator** iterator, bool queryNonIndexed);
 			status_t	GetNextMatching(Volume* volume, TreeIterator* iterator,
-							struct dirent* dirent, size_t bufferSize);
-
-	virtual	void		CalculateScore(Index &index);
-	virtual	int32		Score() const { return fScore; }
+							struct dirent* dirent, size_t bufferSize,
+							const QueryScanFilter& filter);
+			status_t	CollectMatching(Volume* volume, off_t* ids,
+							int32 maxCount, int32& _count);
+			status_t	MatchPath(Inode* inode, bool matchSelf);
+
+			const char*	Attribute() const { return fAttribute; }
+			bool		IsValueLookup() const
+							{ return fOp == OP_EQUAL && !fIsPattern
+								&& !fIsSpecialTime; }
+			bool		IsRangeLookup() const
+							{ return fOp >= OP_GREATER_THAN
+								&& fOp <= OP_LESS_THAN_OR_EQUAL; }
+			bool		IsLowerBound() const
+							{ return fOp == OP_GREATER_THAN
+								|| fOp == OP_GREATER_THAN_OR_EQUAL; }
+			status_t	MatchKey(int32 type, const uint8* key, size_t size);
+			status_t	ValueHash(type_code type, uint32& _hash);
+			status_t	CompareBound(type_code type, Equation& other,
+							int32& _compare);
+
+	virtual	void		Estimate(Index& index, off_t totalEntries);
+	virtual	off_t		EstimatedMatches() const
+							{ return fEstimatedMatches; }
+	virtual	bool		IsIndexed() const { return fIsIndexed; }
+			bool		IsPattern() const { return fIsPattern; }
+			const char*	AuxiliaryIndex() const { return fAuxiliaryIndex; }
+			bool		IsPrefixScan() const
+							{ return fOp == OP_EQUAL && fIsPattern
+								&& _PrefixLength() > 0; }
+
+			void		Describe(char* buffer, size_t bufferSize);
 
 #ifdef DEBUG
 	virtual	void		PrintToStream();
@@ -159,6 +216,13 @@ private:
 			bool		CompareTo(const uint8* value, uint16 size);
 			uint8*		Value() const { return (uint8*)&fValue; }
 			status_t	MatchEmptyString();
+			int32		_PrefixLength() const;
+			void		_PlanNameScan(Index& index);
+			void		_SetAuxiliaryScan(const char* indexName,
+							const char* key, uint16 keyLength,
+							off_t estimatedMatches);
+			status_t	_NextIndexEntry(TreeIterator* iterator,
+							off_t& _offset);
 
 			char*		fAttribute;
 			char*		fString;
@@ -168,8 +232,16 @@ private:
 			bool		fIsPattern;
 			bool		fIsSpecialTime;
 
-			int32		fScore;
+			off_t		fEstimatedMatches;
+			bool		fIsIndexed;
 			bool		fHasIndex;
+
+			// used when a name pattern can be looked up in one of the
+			// indices derived from the name
+			const char*	fAuxiliaryIndex;
+			uint8		fAuxiliaryKey[INODE_FILE_NAME_LENGTH];
+			uint16		fAuxiliaryKeyLength;
+			bool		fUsesAuxiliaryIndex;
 };
 
 
@@ -189,8 +261,11 @@ public:
 							size_t size = 0);
 	virtual	void		Complement();
 
-	virtual	void		CalculateScore(Index& index);
-	virtual	int32		Score() const;
+	virtual	void		Estimate(Index& index, off_t totalEntries);
+	virtual	off_t		EstimatedMatches() const;
+	virtual	bool		IsIndexed() const;
+
+			Term*		CheaperTerm() const;
 
 	virtual	status_t	InitCheck();
 
@@ -293,6 +368,169 @@ isPattern(char* string)
 }
 
 
+/*!	Sorts the array of IDs in place (heapsort, as we cannot use qsort()
+	everywhere this code is used).
+*/
+static void
+sortIDs(off_t* ids, int32 count)
+{
+	for (int32 start = count / 2 - 1; start >= -count + 1; start--) {
+		int32 root = start;
+		int32 end = count;
+		if (start < 0) {
+			// extract the largest element of the heap
+			end = count + start;
+			off_t largest = ids[0];
+			ids[0] = ids[end];
+			ids[end] = largest;
+			root = 0;
+		}
+
+		// sift down
+		while (root * 2 + 1 < end) {
+			int32 child = root * 2 + 1;
+			if (child + 1 < end && ids[child] < ids[child + 1])
+				child++;
+			if (ids[root] >= ids[child])
+				break;
+
+			off_t id = ids[root];
+			ids[root] = ids[child];
+			ids[child] = id;
+			root = child;
+		}
+	}
+}
+
+
+static bool
+containsID(const off_t* ids, int32 count, off_t id)
+{
+	int32 first = 0;
+	int32 last = count - 1;
+
+	while (first <= last) {
+		int32 middle = (first + last) / 2;
+		if (ids[middle] == id)
+			return true;
+
+		if (ids[middle] < id)
+			first = middle + 1;
+		else
+			last = middle - 1;
+	}
+
+	return false;
+}
+
+
+/*!	Translates a name pattern into the case folded characters a matching
+	name has to contain, in that order, as they can be looked up in the
+	indices derived from the name (see Index::FoldName()).
+	Character sets that only contain a single letter in either case, like
+	"[Hh]" as used for case-insensitive queries, count as that letter. All
+	other wildcards and sets separate the runs of characters, which is
+	marked by a '\0' in \a folded.
+	Returns the length of \a folded.
+*/
+static int32
+foldPattern(const char* pattern, char* folded, int32 size)
+{
+	int32 length = 0;
+
+	while (pattern[0] != '\0' && length < size - 1) {
+		char c = *pattern++;
+		int32 literal = -1;
+
+		switch (c) {
+			case '*':
+			case '?':
+				break;
+
+			case '\\':
+				if (pattern[0] != '\0')
+					literal = (uint8)*pattern++;
+				break;
+
+			case '[':
+			{
+				char first = pattern[0];
+				char second = pattern[1];
+				if (first != '^' && first != '!' && first != '\\'
+					&& first != '\0' && second == ']') {
+					literal = (uint8)first;
+					pattern += 2;
+					break;
+				}
+				if (first != '^' && first != '!' && first != '\\'
+					&& first != '\0' && second != '\0' && pattern[2] == ']'
+					&& first != second && (first | 0x20) == (second | 0x20)
+					&& (first | 0x20) >= 'a' && (first | 0x20) <= 'z') {
+					literal = (uint8)first;
+					pattern += 3;
+					break;
+				}
+
+				// skip the whole set
+				while (pattern[0] != '\0' && pattern[0] != ']') {
+					if (pattern[0] == '\\' && pattern[1] != '\0')
+						pattern++;
+					pattern++;
+				}
+				if (pattern[0] == ']')
+					pattern++;
+				break;
+			}
+
+			default:
+				literal = (uint8)c;
+				break;
+		}
+
+		if (literal >= 0) {
+			folded[length++] = literal >= 'A' && literal <= 'Z'
+				? literal - 'A' + 'a' : literal;
+		} else if (length == 0 || folded[length - 1] != '\0')
+			folded[length++] = '\0';
+	}
+
+	folded[length] = '\0';
+	return length;
+}
+
+
+/*!	Counts the entries of the tree with the specified key, but not more
+	than \a limit.
+*/
+static off_t
+countKeyEntries(BPlusTree* tree, const uint8* key, uint16 keyLength,
+	off_t limit)
+{
+	TreeIterator iterator(tree);
+	if (iterator.Find(key, keyLength) != B_OK)
+		return 0;
+
+	off_t count = 0;
+	while (count < limit) {
+		union value indexValue;
+		uint16 length;
+		uint16 duplicate;
+		off_t value;
+		if (iterator.GetNextEntry(&indexValue, &length,
+				(uint16)sizeof(indexValue), &value, &duplicate) != B_OK)
+			break;
+
+		if (duplicate < 2
+			&& (length != keyLength || memcmp(&indexValue, key, keyLength)))
+			break;
+
+		count++;
+	}
+
+	return count;
+}
+
+
 status_t
 isValidPattern(char* pattern)
 {
@@ -467,6 +705,57 @@ matchString(char* pattern, char* string)
 }
 
 
+/*!	Returns whether or not keys of the given type can be hashed so that
+	keys that compareKeys() regards as equal get the same hash value.
+*/
+bool
+isHashableType(type_code type)
+{
+	switch (type) {
+		case B_STRING_TYPE:
+		case B_INT32_TYPE:
+		case B_UINT32_TYPE:
+		case B_INT64_TYPE:
+		case B_UINT64_TYPE:
+			return true;
+
+		default:
+			// floating point values can be equal without having the same
+			// representation
+			return false;
+	}
+}
+
+
+uint32
+hashKey(type_code type, const uint8* key, size_t length)
+{
+	if (type == B_STRING_TYPE) {
+		// compareKeys() ignores trailing null bytes
+		if (key == NULL)
+			length = 0;
+		while (length > 0 && key[length - 1] == '\0')
+			length--;
+	} else if (type == B_INT32_TYPE || type == B_UINT32_TYPE)
+		length = sizeof(int32);
+	else
+		length = sizeof(int64);
+
+	uint32 hash = 0;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash << 5) + (hash >> 27) + key[i];
+
+	return hash;
+}
+
+
+uint32
+hashString(const char* string)
+{
+	return hashKey(B_STRING_TYPE, (const uint8*)string, strlen(string));
+}
+
+
 //	#pragma mark -
 
 
@@ -475,7 +764,13 @@ Equation::Equation(char** expr)
 	fAttribute(NULL),
 	fString(NULL),
 	fType(0),
-	fIsPattern(false)
+	fIsPattern(false),
+	fEstimatedMatches(0),
+	fIsIndexed(false),
+	fHasIndex(false),
+	fAuxiliaryIndex(NULL),
+	fAuxiliaryKeyLength(0),
+	fUsesAuxiliaryIndex(false)
 {
 	char* string = *expr;
 	char* start = string;
@@ -815,15 +1110,10 @@ Equation::Match(Inode* inode, const char* attributeName, int32 type,
 	bool locked = false;
 
 	// first, check if we are matching for a live query and use that value
-	if (attributeName != NULL && !strcmp(fAttribute, attributeName)) {
-		if (key == NULL) {
-			if (type == B_STRING_TYPE)
-				return MatchEmptyString();
+	if (attributeName != NULL && !strcmp(fAttribute, attributeName))
+		RETURN_ERROR(MatchKey(type, key, size));
 
-			return NO_MATCH;
-		}
-		buffer = const_cast<uint8*>(key);
-	} else if (!strcmp(fAttribute, "name")) {
+	if (!strcmp(fAttribute, "name")) {
 		// we need to lock before accessing Inode::Name()
 		nodeGetter.SetToNode(inode);
 
@@ -901,37 +1191,308 @@ Equation::Match(Inode* inode, const char* attributeName, int32 type,
 }
 
 
+/*!	Matches the given key of the equation's attribute with the equation.
+	A \c NULL key means that the inode doesn't have the attribute.
+	Returns MATCH_OK if it matches, NO_MATCH if not, < 0 if something went
+	wrong.
+*/
+status_t
+Equation::MatchKey(int32 type, const uint8* key, size_t size)
+{
+	if (key == NULL) {
+		if (type == B_STRING_TYPE)
+			return MatchEmptyString();
+
+		return NO_MATCH;
+	}
+
+	status_t status = ConvertValue(type);
+	if (status == B_OK)
+		status = CompareTo(key, size) ? MATCH_OK : NO_MATCH;
+
+	return status;
+}
+
+
+/*!	Computes the hash of the value the equation is looking for, as it would
+	be computed by hashKey() for a key of the given type.
+	Only works for value lookups, see IsValueLookup().
+*/
+status_t
+Equation::ValueHash(type_code type, uint32& _hash)
+{
+	if (fOp != OP_EQUAL || fIsSpecialTime)
+		return B_BAD_VALUE;
+
+	status_t status = ConvertValue(type);
+	if (status != B_OK)
+		return status;
+
+	// the conversion may have changed the type, and the pattern state
+	if (fIsPattern || !isHashableType(fType))
+		return B_BAD_VALUE;
+
+	_hash = hashKey(fType, Value(), fSize);
+	return B_OK;
+}
+
+
+/*!	Compares the bound of this range lookup with the one of \a other, for
+	keys of the given type. Both must be either lower or upper bounds, see
+	IsRangeLookup() and IsLowerBound().
+	\a _compare is set to a value less than zero if this equation matches
+	more keys than \a other, to zero if they match the same keys, and to a
+	value greater than zero if it matches fewer.
+*/
+status_t
+Equation::CompareBound(type_code type, Equation& other, int32& _compare)
+{
+	if (!IsRangeLookup() || !other.IsRangeLookup()
+		|| IsLowerBound() != other.IsLowerBound()
+		|| fIsSpecialTime != other.fIsSpecialTime)
+		return B_BAD_VALUE;
+
+	status_t status = ConvertValue(type);
+	if (status == B_OK)
+		status = other.ConvertValue(type);
+	if (status != B_OK)
+		return status;
+
+	int32 compare = compareKeys(fType, Value(), fSize, other.Value(),
+		other.fSize);
+	if (compare == 0) {
+		// an inclusive bound matches more keys than an exclusive one
+		bool inclusive = fOp == OP_GREATER_THAN_OR_EQUAL
+			|| fOp == OP_LESS_THAN_OR_EQUAL;
+		bool otherInclusive = other.fOp == OP_GREATER_THAN_OR_EQUAL
+			|| other.fOp == OP_LESS_THAN_OR_EQUAL;
+		_compare = (int32)otherInclusive - (int32)inclusive;
+	} else if (IsLowerBound())
+		_compare = compare < 0 ? -1 : 1;
+	else
+		_compare = compare < 0 ? 1 : -1;
+
+	return B_OK;
+}
+
+
+/*!	Estimates how many entries the equation will find, based on where the
+	values it looks for are located in its index.
+	Equations that cannot use their own index have to go through the "name"
+	index, and are therefore expected to visit all of the \a totalEntries
+	entries of the volume.
+	Only indexed equations can be scanned without B_QUERY_NON_INDEXED, so
+	the planner must not compare their estimates with those of unindexed
+	ones; see Operator::CheaperTerm().
+*/
 void
-Equation::CalculateScore(Index &index)
+Equation::Estimate(Index& index, off_t totalEntries)
 {
-	// As always, these values could be tuned and refined.
-	// And the code could also need some real world testing :-)
+	fEstimatedMatches = max_c(totalEntries, 1);
+	fIsIndexed = false;
+	fAuxiliaryIndex = NULL;
+
+	if (index.SetTo(fAttribute) != B_OK || !index.IsComplete())
+		return;
+
+	fIsIndexed = true;
+
+	// OP_UNEQUAL always has to iterate over the whole "name" index
+	if (fOp == OP_UNEQUAL)
+		return;
+
+	BPlusTree* tree = index.Node()->Tree();
+	if (tree == NULL || ConvertValue(index.Type()) != B_OK)
+		return;
 
-	// do we have to operate on a "foreign" index?
-	if (fOp == OP_UNEQUAL || index.SetTo(fAttribute) < B_OK) {
-		fScore = 0;
+	off_t entries = tree->EstimateEntries();
+	fEstimatedMatches = max_c(entries, 1);
+
+	// build the key the iterator will be positioned at
+
+	uint8 key[BPLUSTREE_MAX_KEY_LENGTH];
+	int32 keyLength;
+
+	if (fIsSpecialTime) {
+		off_t value = fValue.Int64 << INODE_TIME_SHIFT;
+		memcpy(key, &value, sizeof(off_t));
+		keyLength = sizeof(off_t);
+	} else if (fType == B_STRING_TYPE) {
+		keyLength = fIsPattern ? _PrefixLength() : strlen(fValue.String);
+		if (keyLength == 0 && !fIsPattern)
+			keyLength = 1;
+		// leave room for the upper bound of the key range
+		keyLength = min_c(keyLength, BPLUSTREE_MAX_KEY_LENGTH - 1);
+		memcpy(key, fValue.String, keyLength);
+	} else {
+		memcpy(key, Value(), fSize);
+		keyLength = fSize;
+	}
+
+	// a pattern that doesn't start with a fixed prefix has to go through
+	// the whole index - unless there is a better index for name patterns
+	if (keyLength <= 0) {
+		if (fIsPattern && !strcmp(fAttribute, "name"))
+			_PlanNameScan(index);
 		return;
 	}
 
-	// if we have a pattern, how much does it help our search?
-	if (fIsPattern)
-		fScore = getFirstPatternSymbol(fString) << 3;
-	else {
-		// Score by operator
-		if (fOp == OP_EQUAL)
-			// higher than pattern="255 chars+*"
-			fScore = 2048;
-		else
-			// the pattern search is regarded cheaper when you have at
-			// least one character to set your index to
-			fScore = 5;
+	uint32 lower = 0;
+	uint32 upper = BPLUSTREE_POSITION_SCALE;
+
+	switch (fOp) {
+		case OP_EQUAL:
+			if (tree->EstimatePosition(key, keyLength, lower) != B_OK)
+				return;
+
+			if (fType == B_STRING_TYPE && !fIsSpecialTime) {
+				// all keys starting with the string (or prefix) are found
+				// before this one
+				key[keyLength] = 0xff;
+				if (tree->EstimatePosition(key, keyLength + 1, upper) != B_OK)
+					return;
+			} else
+				upper = lower;
+			break;
+
+		case OP_GREATER_THAN:
+		case OP_GREATER_THAN_OR_EQUAL:
+			if (tree->EstimatePosition(key, keyLength, lower) != B_OK)
+				return;
+			break;
+
+		case OP_LESS_THAN:
+		case OP_LESS_THAN_OR_EQUAL:
+			if (tree->EstimatePosition(key, keyLength, upper) != B_OK)
+				return;
+			break;
+	}
+
+	off_t matches = 1;
+	if (upper > lower)
+		matches = entries * (upper - lower) / BPLUSTREE_POSITION_SCALE;
+
+	fEstimatedMatches = max_c(matches, 1);
+}
+
+
+/*!	Returns the number of characters at the start of a pattern that have
+	no special meaning, and can therefore be used to restrict the part of
+	the index the pattern has to be matched against.
+*/
+int32
+Equation::_PrefixLength() const
+{
+	if (!fIsPattern || fString == NULL)
+		return 0;
+
+	int32 length = 0;
+	for (char c; (c = fString[length]) != '\0'; length++) {
+		if (c == '*' || c == '?' || c == '[' || c == '\\')
+			break;
 	}
 
-	// take index size into account (1024 is the current node size
-	// in our B+trees)
-	// 2048 * 2048 == 4194304 is the maximum score (for an empty
-	// tree, since the header + 1 node are already 2048 bytes)
-	fScore = fScore * ((2048 * 1024LL) / index.Node()->Size());
+	return min_c(length, INODE_FILE_NAME_LENGTH - 1);
+}
+
+
+/*!	Checks if the optional indices derived from the name can be used to find
+	the candidates for a name pattern without a fixed prefix, and chooses
+	the one that is expected to find the fewest of them.
+	The candidates still have to be matched against the pattern.
+*/
+void
+Equation::_PlanNameScan(Index& index)
+{
+	char folded[INODE_FILE_NAME_LENGTH];
+	int32 length = foldPattern(fString, folded, sizeof(folded));
+
+	// a run of characters at the start of the pattern can be looked up in
+	// the folded name index
+	int32 prefixLength = 0;
+	while (prefixLength < length && folded[prefixLength] != '\0')
+		prefixLength++;
+	prefixLength = min_c(prefixLength, BPLUSTREE_MAX_KEY_LENGTH - 1);
+
+	if (prefixLength > 0 && index.SetTo(BFS_FOLDED_NAME_INDEX) == B_OK
+		&& index.IsComplete() && index.Node()->Tree() != NULL) {
+		BPlusTree* tree = index.Node()->Tree();
+		uint8 key[BPLUSTREE_MAX_KEY_LENGTH];
+		memcpy(key, folded, prefixLength);
+		key[prefixLength] = 0xff;
+
+		uint32 lower;
+		uint32 upper;
+		if (tree->EstimatePosition(key, prefixLength, lower) == B_OK
+			&& tree->EstimatePosition(key, prefixLength + 1, upper) == B_OK) {
+			off_t matches = 1;
+			if (upper > lower) {
+				matches = tree->EstimateEntries() * (upper - lower)
+					/ BPLUSTREE_POSITION_SCALE;
+			}
+			matches = max_c(matches, 1);
+
+			if (matches < fEstimatedMatches) {
+				_SetAuxiliaryScan(BFS_FOLDED_NAME_INDEX, folded, prefixLength,
+					matches);
+			}
+		}
+	}
+
+	// every run of at least three characters can be looked up in the
+	// trigram index - we choose the least common trigram
+	if (index.SetTo(BFS_NAME_TRIGRAM_INDEX) != B_OK || !index.IsComplete()
+		|| index.Node()->Tree() == NULL)
+		return;
+
+	BPlusTree* tree = index.Node()->Tree();
+	bool haveTrigram = false;
+
+	for (int32 i = 0; i + BFS_NAME_TRIGRAM_LENGTH <= length; i++) {
+		if (folded[i] == '\0' || folded[i + 1] == '\0'
+			|| folded[i + 2] == '\0')
+			continue;
+
+		off_t limit = min_c(fEstimatedMatches, kMaxTrigramCount);
+		off_t matches = countKeyEntries(tree, (uint8*)folded + i,
+			BFS_NAME_TRIGRAM_LENGTH, limit);
+
+		// if the count hit the limit, the trigram is not less common than
+		// the current choice; still, any trigram is better than going
+		// through all entries
+		if (matches < limit || (!haveTrigram
+				&& matches == kMaxTrigramCount
+				&& matches < fEstimatedMatches)) {
+			_SetAuxiliaryScan(BFS_NAME_TRIGRAM_INDEX, folded + i,
+				BFS_NAME_TRIGRAM_LENGTH, max_c(matches, 1));
+			haveTrigram = true;
+		}
+	}
+}
+
+
+void
+Equation::_SetAuxiliaryScan(const char* indexName, const char* key,
+	uint16 keyLength, off_t estimatedMatches)
+{
+	fAuxiliaryIndex = indexName;
+	memcpy(fAuxiliaryKey, key, keyLength);
+	fAuxiliaryKeyLength = keyLength;
+	fEstimatedMatches = estimatedMatches;
+}
+
+
+void
+Equation::Describe(char* buffer, size_t bufferSize)
+{
+	static const char* kOperators[] = {"==", "!=", ">", "<", ">=", "<="};
+
+	const char* op = "?";
+	if (fOp >= OP_EQUAL && fOp <= OP_LESS_THAN_OR_EQUAL)
+		op = kOperators[fOp - OP_EQUAL];
+
+	snprintf(buffer, bufferSize, "%s %s \"%s\"", fAttribute, op,
+		fString != NULL ? fString : "");
 }
 
 
@@ -939,7 +1500,34 @@ status_t
 Equation::PrepareQuery(Volume* /*volume*/, Index& index,
 	TreeIterator** iterator, bool queryNonIndexed)
 {
+	fHasIndex = false;
+	fUsesAuxiliaryIndex = false;
+
+	// look up the candidates for a name pattern in the derived name index
+	// chosen by Estimate(), if it still exists
+	if (fAuxiliaryIndex != NULL && index.SetTo(fAuxiliaryIndex) == B_OK
+		&& index.IsComplete() && ConvertValue(B_STRING_TYPE) == B_OK) {
+		BPlusTree* tree = index.Node()->Tree();
+		if (tree == NULL)
+			return B_ERROR;
+
+		*iterator = new TreeIterator(tree);
+		if (*iterator == NULL)
+			return B_NO_MEMORY;
+
+		fUsesAuxiliaryIndex = true;
+
+		status_t status = (*iterator)->Find(fAuxiliaryKey,
+			fAuxiliaryKeyLength);
+		if (status == B_ENTRY_NOT_FOUND)
+			return B_OK;
+
+		RETURN_ERROR(status);
+	}
+
 	status_t status = index.SetTo(fAttribute);
+	if (status == B_OK && !index.IsComplete())
+		status = B_ENTRY_NOT_FOUND;
 
 	// if we should query attributes without an index, we can just proceed here
 	if (status != B_OK && !queryNonIndexed)
@@ -988,7 +1576,7 @@ Equation::PrepareQuery(Volume* /*volume*/, Index& index,
 			// let's see if we can use the beginning of the key for positioning
 			// the iterator and adjust the key size; if not, just leave the
 			// iterator at the start and return success
-			keySize = getFirstPatternSymbol(fString);
+			keySize = _PrefixLength();
 			if (keySize <= 0)
 				return B_OK;
 		}
@@ -1032,10 +1620,17 @@ Equation::PrepareQuery(Volume* /*volume*/, Index& index,
 }
 
 
+/*!	Retrieves the next entry of the iterator that matches the equation,
+	as far as this can be decided by looking at the index alone.
+	Returns B_ENTRY_NOT_FOUND if there are no more entries that could match.
+*/
 status_t
-Equation::GetNextMatching(Volume* volume, TreeIterator* iterator,
-	struct dirent* dirent, size_t bufferSize)
+Equation::_NextIndexEntry(TreeIterator* iterator, off_t& _offset)
 {
+	// a pattern scan can stop as soon as the keys no longer start with its
+	// prefix
+	int32 prefixLength = fHasIndex && IsPrefixScan() ? _PrefixLength() : 0;
+
 	while (true) {
 		union value indexValue;
 		uint16 keyLength;
@@ -1047,24 +1642,57 @@ Equation::GetNextMatching(Volume* volume, TreeIterator* iterator,
 		if (status != B_OK)
 			return status;
 
+		// all candidates found in a derived name index start with its key
+		if (fUsesAuxiliaryIndex && duplicate < 2
+			&& (keyLength < fAuxiliaryKeyLength
+				|| memcmp(&indexValue, fAuxiliaryKey, fAuxiliaryKeyLength)))
+			return B_ENTRY_NOT_FOUND;
+
 		// only compare against the index entry when this is the correct
 		// index for the equation
-		if (fHasIndex && duplicate < 2
-			&& !CompareTo((uint8*)&indexValue, keyLength)) {
-			// They aren't equal? Let the operation decide what to do. Since
-			// we always start at the beginning of the index (or the correct
-			// position), only some needs to be stopped if the entry doesn't
-			// fit.
-			if (fOp == OP_LESS_THAN
-				|| fOp == OP_LESS_THAN_OR_EQUAL
-				|| (fOp == OP_EQUAL && !fIsPattern))
+		if (fHasIndex && duplicate < 2) {
+			if (prefixLength > 0 && (keyLength < prefixLength
+					|| memcmp(&indexValue, fValue.String, prefixLength) != 0))
 				return B_ENTRY_NOT_FOUND;
 
-			if (duplicate > 0)
-				iterator->SkipDuplicates();
-			continue;
+			if (!CompareTo((uint8*)&indexValue, keyLength)) {
+				// They aren't equal? Let the operation decide what to do.
+				// Since we always start at the beginning of the index (or
+				// the correct position), only some needs to be stopped if
+				// the entry doesn't fit.
+				if (fOp == OP_LESS_THAN
+					|| fOp == OP_LESS_THAN_OR_EQUAL
+					|| (fOp == OP_EQUAL && !fIsPattern))
+					return B_ENTRY_NOT_FOUND;
+
+				if (duplicate > 0)
+					iterator->SkipDuplicates();
+				continue;
+			}
 		}
 
+		_offset = offset;
+		return B_OK;
+	}
+}
+
+
+status_t
+Equation::GetNextMatching(Volume* volume, TreeIterator* iterator,
+	struct dirent* dirent, size_t bufferSize, const QueryScanFilter& filter)
+{
+	while (true) {
+		off_t offset;
+		status_t status = _NextIndexEntry(iterator, offset);
+		if (status != B_OK)
+			return status;
+
+		// entries that are not part of the intersecting index cannot match,
+		// and don't need to be read at all
+		if (filter.ids != NULL
+			&& !containsID(filter.ids, filter.idCount, offset))
+			continue;
+
 		Vnode vnode(volume, offset);
 		Inode* inode;
 		if ((status = vnode.Get(&inode)) != B_OK) {
@@ -1084,38 +1712,14 @@ Equation::GetNextMatching(Volume* volume, TreeIterator* iterator,
 		// query will do something similar (and we don't have
 		// to do it for root, either).
 
-		// go up in the tree until a &&-operator is found, and check if the
-		// inode matches with the rest of the expression - we don't have to
-		// check ||-operators for that
-		Term* term = this;
-		status = MATCH_OK;
+		status = MatchPath(inode, !fHasIndex);
 
-		if (!fHasIndex)
-			status = Match(inode);
-
-		while (term != NULL && status == MATCH_OK) {
-			Operator* parent = (Operator*)term->Parent();
-			if (parent == NULL)
-				break;
-
-			if (parent->Op() == OP_AND) {
-				// choose the other child of the parent
-				Term* other = parent->Right();
-				if (other == term)
-					other = parent->Left();
-
-				if (other == NULL) {
-					FATAL(("&&-operator has only one child... (parent = %p)\n",
-						parent));
-					break;
-				}
-				status = other->Match(inode);
-				if (status < 0) {
-					REPORT_ERROR(status);
-					status = NO_MATCH;
-				}
-			}
-			term = (Term*)parent;
+		// entries that would have been found by a previous scan have
+		// already been returned
+		for (int32 i = 0; status == MATCH_OK && i < filter.excludedCount;
+				i++) {
+			if (filter.excluded[i]->MatchPath(inode, true) == MATCH_OK)
+				status = NO_MATCH;
 		}
 
 		if (status == MATCH_OK) {
@@ -1130,12 +1734,102 @@ Equation::GetNextMatching(Volume* volume, TreeIterator* iterator,
 			}
 
 			dirent->d_reclen = sizeof(struct dirent) + strlen(dirent->d_name);
+			return B_OK;
 		}
+	}
+	RETURN_ERROR(B_ERROR);
+}
+
 
-		if (status == MATCH_OK)
+/*!	Collects the IDs of all entries that match the equation according to its
+	index, sorted by their ID.
+	Fails with B_BUFFER_OVERFLOW if there are more than \a maxCount of them.
+*/
+status_t
+Equation::CollectMatching(Volume* volume, off_t* ids, int32 maxCount,
+	int32& _count)
+{
+	Index index(volume);
+	TreeIterator* iterator = NULL;
+
+	status_t status = PrepareQuery(volume, index, &iterator, false);
+	if (status == B_OK && !fHasIndex && !fUsesAuxiliaryIndex)
+		status = B_BAD_VALUE;
+	if (status != B_OK) {
+		delete iterator;
+
+		// the exact value we're looking for doesn't exist in the index
+		if (status == B_ENTRY_NOT_FOUND && fHasIndex) {
+			_count = 0;
 			return B_OK;
+		}
+		return status;
 	}
-	RETURN_ERROR(B_ERROR);
+
+	int32 count = 0;
+	off_t offset;
+	while ((status = _NextIndexEntry(iterator, offset)) == B_OK) {
+		if (count == maxCount) {
+			status = B_BUFFER_OVERFLOW;
+			break;
+		}
+		ids[count++] = offset;
+	}
+
+	delete iterator;
+
+	if (status != B_ENTRY_NOT_FOUND)
+		return status;
+
+	sortIDs(ids, count);
+	_count = count;
+	return B_OK;
+}
+
+
+/*!	Matches the inode against the part of the expression that has to be
+	true for it to be found via this equation, that is, the other children
+	of all &&-operators above it. If \a matchSelf is true, the equation
+	itself is matched as well; this isn't necessary when the inode has been
+	found via the equation's own index.
+*/
+status_t
+Equation::MatchPath(Inode* inode, bool matchSelf)
+{
+	status_t status = MATCH_OK;
+	if (matchSelf)
+		status = Match(inode);
+
+	// go up in the tree until a &&-operator is found, and check if the
+	// inode matches with the rest of the expression - we don't have to
+	// check ||-operators for that
+	Term* term = this;
+	while (term != NULL && status == MATCH_OK) {
+		Operator* parent = (Operator*)term->Parent();
+		if (parent == NULL)
+			break;
+
+		if (parent->Op() == OP_AND) {
+			// choose the other child of the parent
+			Term* other = parent->Right();
+			if (other == term)
+				other = parent->Left();
+
+			if (other == NULL) {
+				FATAL(("&&-operator has only one child... (parent = %p)\n",
+					parent));
+				break;
+			}
+			status = other->Match(inode);
+			if (status < 0) {
+				REPORT_ERROR(status);
+				status = NO_MATCH;
+			}
+		}
+		term = (Term*)parent;
+	}
+
+	return status;
 }
 
 
@@ -1166,19 +1860,20 @@ Operator::Match(Inode* inode, const char* attribute, int32 type,
 	const uint8* key, size_t size)
 {
 	if (fOp == OP_AND) {
-		status_t status = fLeft->Match(inode, attribute, type, key, size);
+		// start with the term that is least likely to match
+		Term* first = CheaperTerm();
+		Term* second = first == fLeft ? fRight : fLeft;
+
+		status_t status = first->Match(inode, attribute, type, key, size);
 		if (status != MATCH_OK)
 			return status;
 
-		return fRight->Match(inode, attribute, type, key, size);
+		return second->Match(inode, attribute, type, key, size);
 	} else {
-		// choose the term with the better score for OP_OR
-		Term* first;
-		Term* second;
-		if (fRight->Score() > fLeft->Score()) {
-			first = fLeft;
-			second = fRight;
-		} else {
+		// start with the term that is most likely to match for OP_OR
+		Term* first = fLeft;
+		Term* second = fRight;
+		if (fRight->EstimatedMatches() > fLeft->EstimatedMatches()) {
 			first = fRight;
 			second = fLeft;
 		}
@@ -1206,29 +1901,51 @@ Operator::Complement()
 
 
 void
-Operator::CalculateScore(Index &index)
+Operator::Estimate(Index& index, off_t totalEntries)
 {
-	fLeft->CalculateScore(index);
-	fRight->CalculateScore(index);
+	fLeft->Estimate(index, totalEntries);
+	fRight->Estimate(index, totalEntries);
 }
 
 
-int32
-Operator::Score() const
+off_t
+Operator::EstimatedMatches() const
 {
-	if (fOp == OP_AND) {
-		// return the one with the better score
-		if (fRight->Score() > fLeft->Score())
-			return fRight->Score();
+	// OP_AND only needs to iterate over the cheaper term, OP_OR has to
+	// iterate over both of them
+	if (fOp == OP_AND)
+		return CheaperTerm()->EstimatedMatches();
+
+	return fLeft->EstimatedMatches() + fRight->EstimatedMatches();
+}
+
+
+/*!	Returns whether or not the operator can be evaluated without scanning
+	attributes that have no index.
+*/
+bool
+Operator::IsIndexed() const
+{
+	if (fOp == OP_AND)
+		return fLeft->IsIndexed() || fRight->IsIndexed();
+
+	return fLeft->IsIndexed() && fRight->IsIndexed();
+}
 
-		return fLeft->Score();
-	}
 
-	// for OP_OR, be honest, and return the one with the worse score
-	if (fRight->Score() < fLeft->Score())
-		return fRight->Score();
+/*!	Returns the term an OP_AND has to iterate over. An indexed term always
+	wins over an unindexed one, as the latter could only be evaluated with
+	B_QUERY_NON_INDEXED; the estimates only decide between terms of the
+	same kind.
+*/
+Term*
+Operator::CheaperTerm() const
+{
+	if (fLeft->IsIndexed() != fRight->IsIndexed())
+		return fLeft->IsIndexed() ? fLeft : fRight;
 
-	return fLeft->Score();
+	return fRight->EstimatedMatches() < fLeft->EstimatedMatches()
+		? fRight : fLeft;
 }
 
 
@@ -1486,7 +2203,11 @@ Query::Query(Volume* volume, Expression* expression, uint32 flags)
 	fIterator(NULL),
 	fIndex(volume),
 	fFlags(flags),
-	fPort(-1)
+	fPort(-1),
+	fFilterIDs(NULL),
+	fFilterCount(0),
+	fLiveLinks(NULL),
+	fReceivesAllUpdates(false)
 {
 	// If the expression has a valid root pointer, the whole tree has
 	// already passed the sanity check, so that we don't have to check
@@ -1494,8 +2215,13 @@ Query::Query(Volume* volume, Expression* expression, uint32 flags)
 	if (volume == NULL || expression == NULL || expression->Root() == NULL)
 		return;
 
-	// create index on the stack and delete it afterwards
-	fExpression->Root()->CalculateScore(fIndex);
+	// estimate how many entries each term is going to find, so that we can
+	// choose the cheapest way to evaluate the query
+	off_t totalEntries = 0;
+	if (fIndex.SetTo("name") == B_OK && fIndex.Node()->Tree() != NULL)
+		totalEntries = fIndex.Node()->Tree()->EstimateEntries();
+
+	fExpression->Root()->Estimate(fIndex, totalEntries);
 	fIndex.Unset();
 
 	Rewind();
@@ -1509,6 +2235,9 @@ Query::~Query()
 {
 	if ((fFlags & B_LIVE_QUERY) != 0)
 		fVolume->RemoveQuery(this);
+
+	delete fIterator;
+	_UnsetFilter();
 }
 
 
@@ -1518,10 +2247,12 @@ Query::Rewind()
 	// free previous stuff
 
 	fStack.MakeEmpty();
+	fDoneScans.MakeEmpty();
 
 	delete fIterator;
 	fIterator = NULL;
 	fCurrent = NULL;
+	_UnsetFilter();
 
 	// put the whole expression on the stack
 
@@ -1537,12 +2268,9 @@ Query::Rewind()
 				stack.Push(op->Left());
 				stack.Push(op->Right());
 			} else {
-				// For OP_AND, we can use the scoring system to decide which
-				// path to add
-				if (op->Right()->Score() > op->Left()->Score())
-					stack.Push(op->Right());
-				else
-					stack.Push(op->Left());
+				// For OP_AND, we only need to iterate over the term that is
+				// expected to find the fewest entries
+				stack.Push(op->CheaperTerm());
 			}
 		} else if (term->Op() == OP_EQUATION
 			|| fStack.Push((Equation*)term) != B_OK)
@@ -1568,21 +2296,37 @@ Query::GetNextEntry(struct dirent* dirent, size_t size)
 				&fIterator, fFlags & B_QUERY_NON_INDEXED);
 			if (status == B_ENTRY_NOT_FOUND) {
 				// try next equation
+				delete fIterator;
+				fIterator = NULL;
 				continue;
 			}
 
 			if (status != B_OK)
 				return status;
+
+			_PrepareFilter();
 		}
 		if (fCurrent == NULL)
 			RETURN_ERROR(B_ERROR);
 
+		QueryScanFilter filter;
+		filter.ids = fFilterIDs;
+		filter.idCount = fFilterCount;
+		filter.excluded = fDoneScans.Array();
+		filter.excludedCount = fDoneScans.CountItems();
+
 		status_t status = fCurrent->GetNextMatching(fVolume, fIterator, dirent,
-			size);
+			size, filter);
 		if (status != B_OK) {
+			// Entries of a completed scan must not be returned again by the
+			// following ones
+			if (status == B_ENTRY_NOT_FOUND)
+				fDoneScans.Push(fCurrent);
+
 			delete fIterator;
 			fIterator = NULL;
 			fCurrent = NULL;
+			_UnsetFilter();
 		} else {
 			// only return if we have another entry
 			return B_OK;
@@ -1591,6 +2335,156 @@ Query::GetNextEntry(struct dirent* dirent, size_t size)
 }
 
 
+/*!	Describes how the query is going to be evaluated: which index scans are
+	run in which order, how many entries each of them is expected to find,
+	and how their results are combined.
+	The description is only accurate as long as the query has not been
+	iterated yet.
+*/
+status_t
+Query::Explain(char* buffer, size_t bufferSize)
+{
+	if (fExpression == NULL || fExpression->Root() == NULL)
+		return B_BAD_VALUE;
+	if (bufferSize == 0)
+		return B_BUFFER_OVERFLOW;
+
+	Equation** scans = fStack.Array();
+	int32 count = fStack.CountItems();
+	bool hadScan = false;
+	size_t length = 0;
+
+	length += snprintf(buffer + length, bufferSize - length,
+		"estimated matches: %" B_PRIdOFF "\n",
+		fExpression->Root()->EstimatedMatches());
+
+	// the equations are popped from the end of the stack
+	for (int32 i = count - 1; i >= 0 && length < bufferSize; i--) {
+		Equation* scan = scans[i];
+		char equation[INODE_FILE_NAME_LENGTH + 64];
+		scan->Describe(equation, sizeof(equation));
+
+		const char* kind;
+		if (!scan->IsIndexed()) {
+			if ((fFlags & B_QUERY_NON_INDEXED) == 0) {
+				length += snprintf(buffer + length, bufferSize - length,
+					"%" B_PRId32 ". skipped (no index): %s\n", count - i,
+					equation);
+				continue;
+			}
+			kind = "full scan of the name index";
+		} else if (scan->Op() == OP_UNEQUAL) {
+			// has its own index, but still needs to go through all entries
+			kind = "full scan of the name index";
+		} else if (scan->AuxiliaryIndex() != NULL) {
+			kind = !strcmp(scan->AuxiliaryIndex(), BFS_NAME_TRIGRAM_INDEX)
+				? "name trigram scan" : "case-insensitive name prefix scan";
+		} else if (scan->IsPrefixScan())
+			kind = "index prefix scan";
+		else if (scan->IsPattern())
+			kind = "full index scan";
+		else if (scan->Op() == OP_EQUAL)
+			kind = "index lookup";
+		else
+			kind = "index range scan";
+
+		length += snprintf(buffer + length, bufferSize - length,
+			"%" B_PRId32 ". %s: %s (about %" B_PRIdOFF " entries)\n",
+			count - i, kind, equation, scan->EstimatedMatches());
+
+		Equation* filter = _FilterFor(scan);
+		if (filter != NULL && length < bufferSize) {
+			filter->Describe(equation, sizeof(equation));
+			length += snprintf(buffer + length, bufferSize - length,
+				"   intersected with: %s (about %" B_PRIdOFF " entries)\n",
+				equation, filter->EstimatedMatches());
+		}
+		if (hadScan && length < bufferSize) {
+			length += snprintf(buffer + length, bufferSize - length,
+				"   without the entries of the previous scans\n");
+		}
+
+		hadScan = true;
+	}
+
+	return length < bufferSize ? B_OK : B_BUFFER_OVERFLOW;
+}
+
+
+/*!	Looks for an indexed equation that has to be true as well for the
+	entries found by \a scan to match the query, and that is cheap enough
+	to collect all of its matching entries up front: these can then be
+	used to filter the candidates of the scan without having to read their
+	inodes.
+*/
+Equation*
+Query::_FilterFor(Equation* scan) const
+{
+	Equation* best = NULL;
+	off_t bestMatches = min_c(scan->EstimatedMatches() * kIndexEntryCostRatio,
+		(off_t)kMaxFilterEntries + 1);
+
+	Term* term = scan;
+	Operator* parent;
+	while ((parent = (Operator*)term->Parent()) != NULL) {
+		if (parent->Op() == OP_AND) {
+			Term* other = parent->Right();
+			if (other == term)
+				other = parent->Left();
+
+			if (other != NULL && other->Op() > OP_EQUATION) {
+				Equation* equation = (Equation*)other;
+				if (equation->IsIndexed() && equation->Op() != OP_UNEQUAL
+					&& equation->EstimatedMatches() < bestMatches) {
+					best = equation;
+					bestMatches = equation->EstimatedMatches();
+				}
+			}
+		}
+		term = parent;
+	}
+
+	return best;
+}
+
+
+/*!	Collects the entries of the filter for the current scan, if there is
+	one. If that fails, the scan just proceeds without it.
+*/
+void
+Query::_PrepareFilter()
+{
+	_UnsetFilter();
+
+	Equation* equation = _FilterFor(fCurrent);
+	if (equation == NULL)
+		return;
+
+	off_t* ids = (off_t*)malloc(kMaxFilterEntries * sizeof(off_t));
+	if (ids == NULL)
+		return;
+
+	int32 count;
+	if (equation->CollectMatching(fVolume, ids, kMaxFilterEntries, count)
+			!= B_OK) {
+		free(ids);
+		return;
+	}
+
+	fFilterIDs = ids;
+	fFilterCount = count;
+}
+
+
+void
+Query::_UnsetFilter()
+{
+	free(fFilterIDs);
+	fFilterIDs = NULL;
+	fFilterCount = 0;
+}
+
+
 void
 Query::SetLiveMode(port_id port, int32 token)
 {
@@ -1614,7 +2508,8 @@ Query::LiveUpdate(Inode* inode, const char* attribute, int32 type,
 	if (fPort < 0 || fExpression == NULL || attribute == NULL)
 		return;
 
-	// TODO: check if the attribute is part of the query at all...
+	// The volume's LiveQueryMap only passes us changes of attributes that
+	// are part of the query, unless we want to know about all of them
 
 	status_t oldStatus = fExpression->Root()->Match(inode, attribute, type,
 		oldKey, oldLength);
@@ -1695,3 +2590,519 @@ Query::LiveUpdateRenameMove(Inode* inode, ino_t oldDirectoryID,
 	notify_query_entry_created(fPort, fToken, fVolume->ID(),
 		newDirectoryID, newName, inode->ID());
 }
+
+
+//	#pragma mark - LiveQueryMap
+
+
+static const uint32 kValueHashSize = 128;
+
+
+struct LiveQueryLink : DoublyLinkedListLinkImpl<LiveQueryLink> {
+	LiveQueryLink*		query_next;
+	LiveQueryLink*		value_next;
+	Query*				query;
+	LiveQueryAttribute*	attribute;
+	Equation*			guard;
+		// a term of the query that must match for the query to match
+	uint32				value_hash;
+	bool				value_lookup;
+		// whether or not the link is in the attribute's value links
+	bool				range_lookup;
+		// whether or not the link is in one of the attribute's bound lists
+};
+
+typedef DoublyLinkedList<LiveQueryLink> LiveQueryLinkList;
+
+
+struct LiveQueryAttribute {
+	LiveQueryAttribute*	hash_next;
+	LiveQueryLinkList	links;
+		// the links that need to be checked on every change
+	LiveQueryLinkList	value_links;
+		// the links whose guard is a value lookup
+	LiveQueryLink**		values;
+		// the value links hashed by their value, if value_type is not 0
+	type_code			value_type;
+	LiveQueryLinkList	lower_bounds;
+	LiveQueryLinkList	upper_bounds;
+		// the links whose guard is a range lookup; if range_type is not 0,
+		// they are sorted from the widest to the narrowest bound
+	type_code			range_type;
+	int32				link_count;
+	uint32				hash;
+	char				name[1];
+};
+
+
+/*!	Returns whether or not the term needs to match for the whole expression
+	to match, that is, if all of its parents are "and" operators.
+*/
+static bool
+isRequiredTerm(Term* term)
+{
+	for (Term* parent = term->Parent(); parent != NULL;
+			parent = parent->Parent()) {
+		if (parent->Op() != OP_AND)
+			return false;
+	}
+
+	return true;
+}
+
+
+/*!	Returns how well the equation can be used as a guard of a link: value
+	lookups can be hashed, range lookups can be sorted.
+*/
+static int32
+guardPriority(Equation* equation)
+{
+	if (equation->IsValueLookup())
+		return 2;
+	if (equation->IsRangeLookup())
+		return 1;
+
+	return 0;
+}
+
+
+/*!	Returns whether or not the query the link belongs to could be affected
+	by the change of the link's attribute from \a oldKey to \a newKey.
+*/
+static bool
+mayBeAffected(LiveQueryLink* link, int32 type, const uint8* oldKey,
+	size_t oldLength, const uint8* newKey, size_t newLength)
+{
+	if (link->guard == NULL)
+		return true;
+
+	return link->guard->MatchKey(type, oldKey, oldLength) != NO_MATCH
+		|| link->guard->MatchKey(type, newKey, newLength) != NO_MATCH;
+}
+
+
+LiveQueryMap::LiveQueryMap()
+{
+	memset(fAttributes, 0, sizeof(fAttributes));
+}
+
+
+LiveQueryMap::~LiveQueryMap()
+{
+}
+
+
+void
+LiveQueryMap::Add(Query* query)
+{
+	query->fLiveLinks = NULL;
+	query->fReceivesAllUpdates = false;
+
+	Term* root = query->fExpression != NULL
+		? query->fExpression->Root() : NULL;
+	if (root != NULL && (query->fFlags & B_ATTR_CHANGE_NOTIFICATION) == 0) {
+		// Create a link for every attribute that is part of the query
+		Stack<Term*> stack;
+		status_t status = stack.Push(root);
+
+		Term* term;
+		while (status == B_OK && stack.Pop(&term)) {
+			if (term->Op() < OP_EQUATION) {
+				Operator* op = (Operator*)term;
+				status = stack.Push(op->Left());
+				if (status == B_OK)
+					status = stack.Push(op->Right());
+				continue;
+			}
+
+			Equation* equation = (Equation*)term;
+
+			LiveQueryLink* link = query->fLiveLinks;
+			while (link != NULL
+				&& strcmp(link->attribute->name, equation->Attribute()) != 0)
+				link = link->query_next;
+
+			if (link == NULL) {
+				link = new(std::nothrow) LiveQueryLink;
+				LiveQueryAttribute* attribute = link != NULL
+					? _Get(equation->Attribute()) : NULL;
+				if (attribute == NULL) {
+					delete link;
+					status = B_NO_MEMORY;
+					break;
+				}
+
+				link->query = query;
+				link->attribute = attribute;
+				link->guard = NULL;
+				link->query_next = query->fLiveLinks;
+				query->fLiveLinks = link;
+			}
+
+			// Prefer value lookups as guards, as they can be hashed, and
+			// range lookups over anything else, as they can be sorted
+			if (isRequiredTerm(equation) && (link->guard == NULL
+					|| guardPriority(equation) > guardPriority(link->guard)))
+				link->guard = equation;
+		}
+
+		if (status == B_OK) {
+			for (LiveQueryLink* link = query->fLiveLinks; link != NULL;
+					link = link->query_next) {
+				LiveQueryAttribute* attribute = link->attribute;
+				attribute->link_count++;
+
+				link->value_lookup = link->guard != NULL
+					&& link->guard->IsValueLookup();
+				link->range_lookup = link->guard != NULL
+					&& link->guard->IsRangeLookup();
+				if (link->range_lookup) {
+					_InsertRange(attribute, link);
+					continue;
+				}
+				if (!link->value_lookup) {
+					attribute->links.Add(link);
+					continue;
+				}
+
+				attribute->value_links.Add(link);
+				if (attribute->value_type == 0)
+					continue;
+
+				if (link->guard->ValueHash(attribute->value_type,
+						link->value_hash) == B_OK) {
+					uint32 index = link->value_hash % kValueHashSize;
+					link->value_next = attribute->values[index];
+					attribute->values[index] = link;
+				} else {
+					// rehash on next use
+					attribute->value_type = 0;
+				}
+			}
+			return;
+		}
+
+		// We ran out of memory, just notify the query about every change
+		while (LiveQueryLink* link = query->fLiveLinks) {
+			query->fLiveLinks = link->query_next;
+			_Put(link->attribute);
+			delete link;
+		}
+	}
+
+	query->fReceivesAllUpdates = true;
+	fAllUpdatesQueries.Add(query);
+}
+
+
+void
+LiveQueryMap::Remove(Query* query)
+{
+	if (query->fReceivesAllUpdates) {
+		fAllUpdatesQueries.Remove(query);
+		query->fReceivesAllUpdates = false;
+		return;
+	}
+
+	while (LiveQueryLink* link = query->fLiveLinks) {
+		query->fLiveLinks = link->query_next;
+
+		LiveQueryAttribute* attribute = link->attribute;
+		if (link->range_lookup) {
+			if (link->guard->IsLowerBound())
+				attribute->lower_bounds.Remove(link);
+			else
+				attribute->upper_bounds.Remove(link);
+		} else if (!link->value_lookup)
+			attribute->links.Remove(link);
+		else {
+			attribute->value_links.Remove(link);
+
+			if (attribute->value_type != 0) {
+				LiveQueryLink** next
+					= &attribute->values[link->value_hash % kValueHashSize];
+				while (*next != NULL && *next != link)
+					next = &(*next)->value_next;
+				if (*next == link)
+					*next = link->value_next;
+			}
+		}
+
+		attribute->link_count--;
+		_Put(attribute);
+		delete link;
+	}
+}
+
+
+/*!	Returns whether or not a change of the specified attribute could affect
+	any live query.
+*/
+bool
+LiveQueryMap::HasQueriesFor(const char* attribute) const
+{
+	return !fAllUpdatesQueries.IsEmpty()
+		|| _Lookup(attribute, hashString(attribute)) != NULL;
+}
+
+
+void
+LiveQueryMap::Update(Inode* inode, const char* attribute, int32 type,
+	const uint8* oldKey, size_t oldLength, const uint8* newKey,
+	size_t newLength)
+{
+	QueryList::Iterator iterator = fAllUpdatesQueries.GetIterator();
+	while (Query* query = iterator.Next()) {
+		query->LiveUpdate(inode, attribute, type, oldKey, oldLength, newKey,
+			newLength);
+	}
+
+	LiveQueryAttribute* entry = _Lookup(attribute, hashString(attribute));
+	if (entry == NULL)
+		return;
+
+	LiveQueryLinkList::Iterator linkIterator = entry->links.GetIterator();
+	while (LiveQueryLink* link = linkIterator.Next()) {
+		if (mayBeAffected(link, type, oldKey, oldLength, newKey, newLength)) {
+			link->query->LiveUpdate(inode, attribute, type, oldKey, oldLength,
+				newKey, newLength);
+		}
+	}
+
+	type_code hashType = type == B_MIME_STRING_TYPE ? B_STRING_TYPE : type;
+
+	if (!entry->lower_bounds.IsEmpty() || !entry->upper_bounds.IsEmpty()) {
+		_SortRanges(entry, hashType);
+		_UpdateRanges(entry, true, inode, attribute, type, oldKey, oldLength,
+			newKey, newLength);
+		_UpdateRanges(entry, false, inode, attribute, type, oldKey, oldLength,
+			newKey, newLength);
+	}
+
+	if (entry->value_links.IsEmpty())
+		return;
+
+	_HashValues(entry, hashType);
+
+	if (entry->value_type == 0) {
+		// we can't use the hash for this type
+		linkIterator = entry->value_links.GetIterator();
+		while (LiveQueryLink* link = linkIterator.Next()) {
+			if (mayBeAffected(link, type, oldKey, oldLength, newKey,
+					newLength)) {
+				link->query->LiveUpdate(inode, attribute, type, oldKey,
+					oldLength, newKey, newLength);
+			}
+		}
+		return;
+	}
+
+	// Only queries that look for either the old or the new value can be
+	// affected. A missing attribute can only match an empty string.
+	uint32 hashes[2];
+	int32 hashCount = 0;
+	if (oldKey != NULL || hashType == B_STRING_TYPE)
+		hashes[hashCount++] = hashKey(hashType, oldKey, oldLength);
+	if (newKey != NULL || hashType == B_STRING_TYPE) {
+		uint32 hash = hashKey(hashType, newKey, newLength);
+		if (hashCount == 0
+			|| hash % kValueHashSize != hashes[0] % kValueHashSize)
+			hashes[hashCount++] = hash;
+	}
+
+	for (int32 i = 0; i < hashCount; i++) {
+		LiveQueryLink* link = entry->values[hashes[i] % kValueHashSize];
+		for (; link != NULL; link = link->value_next) {
+			if (mayBeAffected(link, type, oldKey, oldLength, newKey,
+					newLength)) {
+				link->query->LiveUpdate(inode, attribute, type, oldKey,
+					oldLength, newKey, newLength);
+			}
+		}
+	}
+}
+
+
+LiveQueryAttribute*
+LiveQueryMap::_Lookup(const char* name, uint32 hash) const
+{
+	LiveQueryAttribute* attribute = fAttributes[hash % kAttributeHashSize];
+	while (attribute != NULL) {
+		if (attribute->hash == hash && strcmp(attribute->name, name) == 0)
+			return attribute;
+
+		attribute = attribute->hash_next;
+	}
+
+	return NULL;
+}
+
+
+/*!	Returns the entry for the attribute, and creates it if needed.
+	If the entry doesn't get any links, it must be released with _Put().
+*/
+LiveQueryAttribute*
+LiveQueryMap::_Get(const char* name)
+{
+	uint32 hash = hashString(name);
+	LiveQueryAttribute* attribute = _Lookup(name, hash);
+	if (attribute != NULL)
+		return attribute;
+
+	void* buffer = malloc(sizeof(LiveQueryAttribute) + strlen(name));
+	if (buffer == NULL)
+		return NULL;
+
+	attribute = new(buffer) LiveQueryAttribute;
+	attribute->values = NULL;
+	attribute->value_type = 0;
+	attribute->range_type = 0;
+	attribute->link_count = 0;
+	attribute->hash = hash;
+	strcpy(attribute->name, name);
+
+	attribute->hash_next = fAttributes[hash % kAttributeHashSize];
+	fAttributes[hash % kAttributeHashSize] = attribute;
+	return attribute;
+}
+
+
+/*!	Frees the attribute entry in case it is no longer in use. */
+void
+LiveQueryMap::_Put(LiveQueryAttribute* attribute)
+{
+	if (attribute->link_count > 0)
+		return;
+
+	LiveQueryAttribute** next = &fAttributes[attribute->hash
+		% kAttributeHashSize];
+	while (*next != attribute)
+		next = &(*next)->hash_next;
+	*next = attribute->hash_next;
+
+	free(attribute->values);
+	attribute->~LiveQueryAttribute();
+	free(attribute);
+}
+
+
+/*!	Makes sure the value links of the attribute are hashed for keys of the
+	given type. If that is not possible, the attribute's value_type is left
+	at 0.
+*/
+void
+LiveQueryMap::_HashValues(LiveQueryAttribute* attribute, type_code type)
+{
+	if (attribute->value_type == type)
+		return;
+
+	attribute->value_type = 0;
+	if (!isHashableType(type))
+		return;
+
+	if (attribute->values == NULL) {
+		attribute->values = (LiveQueryLink**)malloc(
+			sizeof(LiveQueryLink*) * kValueHashSize);
+		if (attribute->values == NULL)
+			return;
+	}
+
+	memset(attribute->values, 0, sizeof(LiveQueryLink*) * kValueHashSize);
+
+	LiveQueryLinkList::Iterator iterator
+		= attribute->value_links.GetIterator();
+	while (LiveQueryLink* link = iterator.Next()) {
+		if (link->guard->ValueHash(type, link->value_hash) != B_OK)
+			return;
+
+		uint32 index = link->value_hash % kValueHashSize;
+		link->value_next = attribute->values[index];
+		attribute->values[index] = link;
+	}
+
+	attribute->value_type = type;
+}
+
+
+/*!	Inserts the range link into the attribute's list of lower or upper
+	bounds. If the list is sorted, it is kept sorted.
+*/
+void
+LiveQueryMap::_InsertRange(LiveQueryAttribute* attribute, LiveQueryLink* link)
+{
+	LiveQueryLinkList& list = link->guard->IsLowerBound()
+		? attribute->lower_bounds : attribute->upper_bounds;
+
+	if (attribute->range_type != 0) {
+		LiveQueryLinkList::Iterator iterator = list.GetIterator();
+		while (LiveQueryLink* other = iterator.Next()) {
+			int32 compare;
+			if (link->guard->CompareBound(attribute->range_type,
+					*other->guard, compare) != B_OK) {
+				// resort on next use
+				attribute->range_type = 0;
+				break;
+			}
+			if (compare < 0) {
+				list.Insert(other, link);
+				return;
+			}
+		}
+	}
+
+	list.Add(link);
+}
+
+
+/*!	Makes sure the range links of the attribute are sorted for keys of the
+	given type. If that is not possible, the attribute's range_type is left
+	at 0.
+*/
+void
+LiveQueryMap::_SortRanges(LiveQueryAttribute* attribute, type_code type)
+{
+	if (attribute->range_type == type)
+		return;
+
+	// Floating point values are not sorted, since NaN does not compare
+	// consistently with the other values
+	attribute->range_type = 0;
+	if (!isHashableType(type))
+		return;
+
+	LiveQueryLinkList links;
+	links.MoveFrom(&attribute->lower_bounds);
+	links.MoveFrom(&attribute->upper_bounds);
+
+	attribute->range_type = type;
+
+	while (LiveQueryLink* link = links.RemoveHead())
+		_InsertRange(attribute, link);
+}
+
+
+/*!	Notifies the queries with a lower or upper bound of the attribute that
+	could be affected by the change. Since the matching bounds of a sorted
+	list always form its head, the first bound that matches neither key ends
+	the search.
+*/
+void
+LiveQueryMap::_UpdateRanges(LiveQueryAttribute* entry, bool lowerBounds,
+	Inode* inode, const char* attribute, int32 type, const uint8* oldKey,
+	size_t oldLength, const uint8* newKey, size_t newLength)
+{
+	LiveQueryLinkList::Iterator iterator = lowerBounds
+		? entry->lower_bounds.GetIterator()
+		: entry->upper_bounds.GetIterator();
+	while (LiveQueryLink* link = iterator.Next()) {
+		if (!mayBeAffected(link, type, oldKey, oldLength, newKey,
+				newLength)) {
+			if (entry->range_type != 0)
+				break;
+			continue;
+		}
+
+		link->query->LiveUpdate(inode, attribute, type, oldKey, oldLength,
+			newKey, newLength);
+	}
+}
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2008, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef QUERY_H
@@ -15,6 +16,8 @@ class Term;
 class Equation;
 class TreeIterator;
 class Query;
+struct LiveQueryAttribute;
+struct LiveQueryLink;
 
 
 class Expression {
@@ -63,17 +66,89 @@ public:
 
 			Expression*		GetExpression() const { return fExpression; }
 
+			status_t		Explain(char* buffer, size_t bufferSize);
+
 private:
+	friend class LiveQueryMap;
+
+			Equation*		_FilterFor(Equation* scan) const;
+			void			_PrepareFilter();
+			void			_UnsetFilter();
+
 			Volume*			fVolume;
 			Expression*		fExpression;
 			Equation*		fCurrent;
 			TreeIterator*	fIterator;
 			Index			fIndex;
 			Stack<Equation*> fStack;
+			Stack<Equation*> fDoneScans;
+			off_t*			fFilterIDs;
+			int32			fFilterCount;
 
 			uint32			fFlags;
 			port_id			fPort;
 			int32			fToken;
+
+			// maintained by the volume's LiveQueryMap
+			LiveQueryLink*	fLiveLinks;
+			DoublyLinkedListLink<Query> fAllUpdatesLink;
+			bool			fReceivesAllUpdates;
+};
+
+
+/*!	Dispatches attribute changes to the live queries that could be affected
+	by them, so that not every live query has to be evaluated on every
+	change.
+	A query is registered under each attribute it references. If a term that
+	must be true for the query to match compares that attribute, it is used
+	to filter out changes that cannot affect the query; if it compares for
+	equality, the query is additionally hashed by the value it is looking
+	for, and if it compares with \c <, \c <=, \c >, or \c >=, it is kept in a
+	list of lower or upper bounds that is sorted by the value, so that only
+	the bounds that match the old or new value have to be looked at.
+	Queries that want to know about all attribute changes of their entries
+	are always notified.
+	The map must be protected by the volume's query lock.
+*/
+class LiveQueryMap {
+public:
+							LiveQueryMap();
+							~LiveQueryMap();
+
+			void			Add(Query* query);
+			void			Remove(Query* query);
+
+			bool			HasQueriesFor(const char* attribute) const;
+			void			Update(Inode* inode, const char* attribute,
+								int32 type, const uint8* oldKey,
+								size_t oldLength, const uint8* newKey,
+								size_t newLength);
+
+private:
+			typedef DoublyLinkedList<Query,
+				DoublyLinkedListMemberGetLink<Query,
+					&Query::fAllUpdatesLink> > QueryList;
+
+	static	const uint32	kAttributeHashSize = 64;
+
+			LiveQueryAttribute* _Lookup(const char* name, uint32 hash) const;
+			LiveQueryAttribute* _Get(const char* name);
+			void			_Put(LiveQueryAttribute* attribute);
+			void			_HashValues(LiveQueryAttribute* attribute,
+								type_code type);
+			void			_InsertRange(LiveQueryAttribute* attribute,
+								LiveQueryLink* link);
+			void			_SortRanges(LiveQueryAttribute* attribute,
+								type_code type);
+			void			_UpdateRanges(LiveQueryAttribute* entry,
+								bool lowerBounds, Inode* inode,
+								const char* attribute, int32 type,
+								const uint8* oldKey, size_t oldLength,
+								const uint8* newKey, size_t newLength);
+
+			LiveQueryAttribute* fAttributes[kAttributeHashSize];
+			QueryList		fAllUpdatesQueries;
 };
 
+
 #endif	// QUERY_H
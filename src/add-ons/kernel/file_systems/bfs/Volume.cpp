@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -25,6 +26,9 @@ static const int32 kDesiredAllocationGroups = 56;
 	// with this setting, though (i.e. you can create a 400 MB
 	// file on a 1 GB disk without the need for double indirect
 	// blocks).
+static const off_t kMaxReadAheadGap = 4;
+	// ReadAheadInodes() also reads blocks between two inodes, as long as
+	// there are not more than this many of them
 
 
 class DeviceOpener {
@@ -193,7 +197,8 @@ bool
 disk_super_block::IsValid() const
 {
 	if (Magic1() != (int32)SUPER_BLOCK_MAGIC1
-		|| Magic2() != (int32)SUPER_BLOCK_MAGIC2
+		|| Magic2() != (int32)(Features() != 0
+			? SUPER_BLOCK_MAGIC2_FEATURES : SUPER_BLOCK_MAGIC2)
 		|| Magic3() != (int32)SUPER_BLOCK_MAGIC3
 		|| (int32)block_size != inode_size
 		|| ByteOrder() != SUPER_BLOCK_FS_LENDIAN
@@ -271,6 +276,18 @@ disk_super_block::Initialize(const char* diskName, off_t numBlocks,
 }
 
 
+/*!	Sets the features of the volume. Volumes that use any feature get a
+	different magic2, so that older drivers will not mount them.
+*/
+void
+disk_super_block::SetFeatures(uint32 newFeatures)
+{
+	features = HOST_ENDIAN_TO_BFS_INT32(newFeatures);
+	magic2 = HOST_ENDIAN_TO_BFS_INT32(newFeatures != 0
+		? SUPER_BLOCK_MAGIC2_FEATURES : SUPER_BLOCK_MAGIC2);
+}
+
+
 //	#pragma mark -
 
 
@@ -347,6 +364,11 @@ Volume::Mount(const char* deviceName, uint32 flags)
 		FATAL(("invalid super block!\n"));
 		return B_BAD_VALUE;
 	}
+	if ((fSuperBlock.Features() & ~SUPER_BLOCK_KNOWN_FEATURES) != 0) {
+		FATAL(("unsupported features %#" B_PRIx32 "!\n",
+			fSuperBlock.Features() & ~SUPER_BLOCK_KNOWN_FEATURES));
+		return B_NOT_SUPPORTED;
+	}
 
 	// initialize short hands to the super block (to save byte swapping)
 	fBlockSize = fSuperBlock.BlockSize();
@@ -556,6 +578,39 @@ Volume::WriteSuperBlock()
 }
 
 
+/*!	Reads the blocks of the inodes with the given \a ids into the block cache,
+	so that opening them later on does not have to wait for the disk each
+	time. The blocks are read in the order they appear on disk, and blocks
+	that are close to each other are read with a single request.
+	Note, the \a ids array is overwritten with the sorted block numbers.
+*/
+void
+Volume::ReadAheadInodes(off_t* ids, int32 count)
+{
+	// sort the valid IDs by block number (there are only a few of them)
+	int32 valid = 0;
+	for (int32 i = 0; i < count; i++) {
+		off_t block = VnodeToBlock(ids[i]);
+		if (!IsValidInodeBlock(block))
+			continue;
+
+		int32 index = valid++;
+		for (; index > 0 && ids[index - 1] > block; index--)
+			ids[index] = ids[index - 1];
+		ids[index] = block;
+	}
+
+	for (int32 i = 0; i < valid;) {
+		off_t first = ids[i];
+		off_t last = first;
+		while (++i < valid && ids[i] <= last + kMaxReadAheadGap)
+			last = ids[i];
+
+		block_cache_prefetch(fBlockCache, first, last + 1 - first);
+	}
+}
+
+
 void
 Volume::UpdateLiveQueries(Inode* inode, const char* attribute, int32 type,
 	const uint8* oldKey, size_t oldLength, const uint8* newKey,
@@ -563,12 +618,8 @@ Volume::UpdateLiveQueries(Inode* inode, const char* attribute, int32 type,
 {
 	MutexLocker _(fQueryLock);
 
-	SinglyLinkedList<Query>::Iterator iterator = fQueries.GetIterator();
-	while (iterator.HasNext()) {
-		Query* query = iterator.Next();
-		query->LiveUpdate(inode, attribute, type, oldKey, oldLength, newKey,
-			newLength);
-	}
+	fLiveQueries.Update(inode, attribute, type, oldKey, oldLength, newKey,
+		newLength);
 }
 
 
@@ -576,6 +627,8 @@ void
 Volume::UpdateLiveQueriesRenameMove(Inode* inode, ino_t oldDirectoryID,
 	const char* oldName, ino_t newDirectoryID, const char* newName)
 {
+	// Since the path of the entry changes, all live queries that contain it
+	// need to know about this, not only those that depend on its name
 	MutexLocker _(fQueryLock);
 
 	size_t oldLength = strlen(oldName);
@@ -598,8 +651,8 @@ Volume::UpdateLiveQueriesRenameMove(Inode* inode, ino_t oldDirectoryID,
 bool
 Volume::CheckForLiveQuery(const char* attribute)
 {
-	// TODO: check for a live query that depends on the specified attribute
-	return true;
+	MutexLocker _(fQueryLock);
+	return fLiveQueries.HasQueriesFor(attribute);
 }
 
 
@@ -608,6 +661,7 @@ Volume::AddQuery(Query* query)
 {
 	MutexLocker _(fQueryLock);
 	fQueries.Add(query);
+	fLiveQueries.Add(query);
 }
 
 
@@ -616,6 +670,7 @@ Volume::RemoveQuery(Query* query)
 {
 	MutexLocker _(fQueryLock);
 	fQueries.Remove(query);
+	fLiveQueries.Remove(query);
 }
 
 
@@ -664,7 +719,7 @@ Volume::Identify(int fd, disk_super_block* superBlock)
 
 status_t
 Volume::Initialize(int fd, const char* name, uint32 blockSize,
-	uint32 flags)
+	uint32 logSize, uint32 flags)
 {
 	// although there is no really good reason for it, we won't
 	// accept '/' in disk names (mkbfs does this, too - and since
@@ -676,6 +731,10 @@ Volume::Initialize(int fd, const char* name, uint32 blockSize,
 		&& blockSize != 8192)
 		return B_BAD_VALUE;
 
+	if (logSize != 0
+		&& (logSize < BFS_MIN_LOG_SIZE || logSize > BFS_MAX_LOG_SIZE))
+		return B_BAD_VALUE;
+
 	DeviceOpener opener(fd, O_RDWR);
 	if (opener.Device() < B_OK)
 		return B_BAD_VALUE;
@@ -695,23 +754,35 @@ Volume::Initialize(int fd, const char* name, uint32 blockSize,
 	// create valid super block
 
 	fSuperBlock.Initialize(name, numBlocks, blockSize);
+	if ((flags & VOLUME_INLINE_DATA) != 0)
+		fSuperBlock.SetFeatures(SUPER_BLOCK_INLINE_DATA);
 
 	// initialize short hands to the super block (to save byte swapping)
 	fBlockSize = fSuperBlock.BlockSize();
 	fBlockShift = fSuperBlock.BlockShift();
 	fAllocationGroupShift = fSuperBlock.AllocationGroupShift();
 
-	// determine log size depending on the size of the volume
-	off_t logSize = 2048;
-	if (numBlocks <= 20480)
-		logSize = 512;
-	if (deviceSize > 1LL * 1024 * 1024 * 1024)
-		logSize = 4096;
+	// determine log size depending on the size of the volume, if it has
+	// not been specified
+	if (logSize == 0) {
+		logSize = 2048;
+		if (numBlocks <= 20480)
+			logSize = 512;
+		if (deviceSize > 1LL * 1024 * 1024 * 1024)
+			logSize = 4096;
+	}
 
 	// since the allocator has not been initialized yet, we
 	// cannot use BlockAllocator::BitmapSize() here
 	off_t bitmapBlocks = (numBlocks + blockSize * 8 - 1) / (blockSize * 8);
 
+	// the log has to fit into the first allocation group, and must leave
+	// some space for the rest of the file system
+	if (bitmapBlocks + 1 + logSize
+			> (1LL << fSuperBlock.AllocationGroupShift())
+		|| bitmapBlocks + 1 + logSize >= numBlocks)
+		return B_BAD_VALUE;
+
 	fSuperBlock.log_blocks = ToBlockRun(bitmapBlocks + 1);
 	fSuperBlock.log_blocks.length = HOST_ENDIAN_TO_BFS_INT16(logSize);
 	fSuperBlock.log_start = fSuperBlock.log_end = HOST_ENDIAN_TO_BFS_INT64(
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef VOLUME_H
@@ -10,11 +11,11 @@
 
 #include "bfs.h"
 #include "BlockAllocator.h"
+#include "Query.h"
 
 
 class Journal;
 class Inode;
-class Query;
 
 
 enum volume_flags {
@@ -23,10 +24,21 @@ enum volume_flags {
 
 enum volume_initialize_flags {
 	VOLUME_NO_INDICES	= 0x0001,
+	VOLUME_INLINE_DATA	= 0x0002,
 };
 
 typedef DoublyLinkedList<Inode> InodeList;
 
+// The progress of Index::FillNameIndex(): the index already contains the
+// entries of all names up to, and including, the last key.
+struct name_index_fill : SinglyLinkedListLinkImpl<name_index_fill> {
+	ino_t		index;
+	uint8		last_key[INODE_FILE_NAME_LENGTH];
+	uint16		last_key_length;
+};
+
+typedef SinglyLinkedList<name_index_fill> NameIndexFillList;
+
 
 class Volume {
 public:
@@ -36,7 +48,8 @@ public:
 			status_t		Mount(const char* device, uint32 flags);
 			status_t		Unmount();
 			status_t		Initialize(int fd, const char* name,
-								uint32 blockSize, uint32 flags);
+								uint32 blockSize, uint32 logSize,
+								uint32 flags);
 
 			bool			IsInitializing() const { return fVolume == NULL; }
 
@@ -71,6 +84,9 @@ public:
 			uint32			BlockShift() const { return fBlockShift; }
 			uint32			InodeSize() const
 								{ return fSuperBlock.InodeSize(); }
+			bool			SupportsInlineData() const
+								{ return (fSuperBlock.Features()
+									& SUPER_BLOCK_INLINE_DATA) != 0; }
 			uint32			AllocationGroups() const
 								{ return fSuperBlock.AllocationGroups(); }
 			uint32			AllocationGroupShift() const
@@ -97,6 +113,8 @@ public:
 
 			InodeList&		RemovedInodes() { return fRemovedInodes; }
 				// This list is guarded by the transaction lock
+			NameIndexFillList& NameIndexFills() { return fNameIndexFills; }
+				// This list is guarded by the volume lock
 
 			// block bitmap
 			BlockAllocator&	Allocator();
@@ -118,6 +136,7 @@ public:
 			// cache access
 			status_t		WriteSuperBlock();
 			status_t		FlushDevice();
+			void			ReadAheadInodes(off_t* ids, int32 count);
 
 			// queries
 			void			UpdateLiveQueries(Inode* inode,
@@ -164,6 +183,7 @@ protected:
 
 			mutex			fQueryLock;
 			SinglyLinkedList<Query> fQueries;
+			LiveQueryMap	fLiveQueries;
 
 			uint32			fFlags;
 
@@ -171,6 +191,7 @@ protected:
 			thread_id		fCheckingThread;
 
 			InodeList		fRemovedInodes;
+			NameIndexFillList fNameIndexFills;
 };
 
 
@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2010, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Parts of this code is based on work previously done by Marcus Overhagen.
  *
  * This file may be used under the terms of the MIT License.
@@ -76,7 +77,8 @@ struct disk_super_block {
 	int32		magic3;
 	inode_addr	root_dir;
 	inode_addr	indices;
-	int32		_reserved[8];
+	uint32		features;
+	int32		_reserved[7];
 	int32		pad_to_block[87];
 		// this also contains parts of the boot block
 
@@ -97,21 +99,37 @@ struct disk_super_block {
 	int32 Flags() const { return BFS_ENDIAN_TO_HOST_INT32(flags); }
 	off_t LogStart() const { return BFS_ENDIAN_TO_HOST_INT64(log_start); }
 	off_t LogEnd() const { return BFS_ENDIAN_TO_HOST_INT64(log_end); }
+	uint32 Features() const { return BFS_ENDIAN_TO_HOST_INT32(features); }
 
 	// implemented in Volume.cpp:
 	bool IsValid() const;
 	void Initialize(const char *name, off_t numBlocks, uint32 blockSize);
+	void SetFeatures(uint32 features);
 } _PACKED;
 
 #define SUPER_BLOCK_FS_LENDIAN		'BIGE'		/* BIGE */
 
 #define SUPER_BLOCK_MAGIC1			'BFS1'		/* BFS1 */
 #define SUPER_BLOCK_MAGIC2			0xdd121031
+#define SUPER_BLOCK_MAGIC2_FEATURES	0xdd121032
+	// replaces SUPER_BLOCK_MAGIC2 on volumes with a non-zero features field,
+	// so that drivers which predate that field refuse to mount them
 #define SUPER_BLOCK_MAGIC3			0x15b6830e
 
 #define SUPER_BLOCK_DISK_CLEAN		'CLEN'		/* CLEN */
 #define SUPER_BLOCK_DISK_DIRTY		'DIRT'		/* DIRT */
 
+// features that change the on-disk layout; a driver must not mount a volume
+// that uses features it doesn't know about
+// (use disk_super_block::SetFeatures() to change them)
+#define SUPER_BLOCK_INLINE_DATA		0x00000001
+	// the contents of small files may be stored in their inode
+#define SUPER_BLOCK_KNOWN_FEATURES	SUPER_BLOCK_INLINE_DATA
+
+// the log area is a single block run
+#define BFS_MIN_LOG_SIZE			512
+#define BFS_MAX_LOG_SIZE			MAX_BLOCK_RUN_LENGTH
+
 //**************************************
 
 #define NUM_DIRECT_BLOCKS			12
@@ -171,6 +189,12 @@ struct small_data {
 #define FILE_NAME_NAME			0x13
 #define FILE_NAME_NAME_LENGTH	1
 
+// the contents of a file with INODE_INLINE_DATA set are stored in the
+// small_data section as well
+#define FILE_DATA_TYPE			'RAWT'
+#define FILE_DATA_NAME			0x14
+#define FILE_DATA_NAME_LENGTH	1
+
 
 //**************************************
 
@@ -253,6 +277,8 @@ enum inode_flags {
 	INODE_DELETED			= 0x00000010,
 	INODE_NOT_READY			= 0x00000020,	// used during Inode construction
 	INODE_LONG_SYMLINK		= 0x00000040,	// symlink in data stream
+	INODE_INLINE_DATA		= 0x00000080,	// file data in small_data section
+	INODE_INDEX_INCOMPLETE	= 0x00000100,	// derived name index being filled
 
 	INODE_PERMANENT_FLAGS	= 0x0000ffff,
 
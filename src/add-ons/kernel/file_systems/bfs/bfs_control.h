@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2012, Axel Dörfler, axeld@pinc-software.de
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 #ifndef BFS_CONTROL_H
@@ -29,6 +30,72 @@ struct update_boot_block {
 	uint32			length;
 };
 
+/* ioctl to get a description of how a query would be evaluated; the
+ * description is written to the buffer as a null-terminated string
+ */
+#define BFS_IOCTL_EXPLAIN_QUERY		14205
+
+struct explain_query {
+	const char*		query;
+	size_t			query_length;
+	uint32			flags;
+	char*			buffer;
+	size_t			buffer_size;
+};
+
+/* ioctl to retrieve the journal statistics - parameter is a
+ * struct journal_statistics
+ */
+#define BFS_IOCTL_JOURNAL_STATISTICS	14206
+
+struct journal_statistics {
+	uint32			log_size;
+	uint32			free_log_blocks;
+	uint32			max_transaction_size;
+	uint32			_reserved;
+	int64			transactions;
+		/* number of transactions that have been completed */
+	int64			log_writes;
+	int64			logged_blocks;
+		/* number of log entries, and blocks written to the log */
+	int64			lock_waits;
+	bigtime_t		lock_wait_time;
+		/* how often, and how long writers had to wait for the journal */
+	int64			log_full_stalls;
+	bigtime_t		log_full_stall_time;
+		/* how often, and how long writers had to wait for the log to be
+		 * flushed, because there was not enough space left in it
+		 */
+};
+
+/* ioctl to change the size of the log area - parameter is a uint32 * with
+ * the number of blocks; the log can only grow into free blocks directly
+ * following it
+ */
+#define BFS_IOCTL_RESIZE_LOG			14207
+
+/* ioctl to get a report on how fragmented the free space of the volume is -
+ * parameter is a struct free_space_report
+ */
+#define BFS_IOCTL_FREE_SPACE_REPORT		14208
+
+#define BFS_FREE_EXTENT_SIZE_CLASSES	17
+
+struct free_space_report {
+	uint64			free_blocks;
+	uint64			free_extents;
+	uint64			largest_free_extent;
+	uint64			extents_by_size[BFS_FREE_EXTENT_SIZE_CLASSES];
+		/* extents_by_size[i] is the number of free extents with a length
+		 * between 2^i and 2^(i + 1) - 1 blocks
+		 */
+	uint32			fragmented_groups;
+		/* allocation groups with too many free extents to be tracked in
+		 * memory; allocating from these requires a bitmap scan
+		 */
+	uint32			block_size;
+};
+
 /* ioctls to use the "chkbfs" feature from the outside
  * all calls use a struct check_result as single parameter
  */
@@ -68,6 +135,26 @@ struct check_control {
 		uint32	block_size;
 	} stats;
 	status_t	status;
+
+	/* Appended to keep the layout of the fields above unchanged; only
+	 * copied if BFS_CHECK_EXTENDED_STATS is set in "flags"
+	 */
+	struct {
+		uint64	file_fragments;
+		uint64	fragmented_files;
+			/* a fragment is a block_run that does not directly follow the
+			 * previous one of the same file
+			 */
+		uint64	compacted_trees;
+		uint64	freed_tree_nodes;
+		uint64	removed_tree_levels;
+			/* gains of BFS_COMPACT_BPLUSTREES */
+		uint64	defragmented_files;
+		uint64	removed_fragments;
+			/* gains of BFS_DEFRAGMENT_FILES */
+		uint64	inline_files;
+			/* files that keep their data in the inode */
+	} extended_stats;
 };
 
 /* values for the flags field */
@@ -84,6 +171,16 @@ struct check_control {
 	 */
 #define BFS_FIX_NAME_MISMATCHES	8
 #define BFS_FIX_BPLUSTREES		16
+#define BFS_COMPACT_BPLUSTREES	32
+	/* merges sparse B+tree nodes, packs duplicate arrays, and truncates
+	 * the tree's stream behind its last used node
+	 */
+#define BFS_DEFRAGMENT_FILES	64
+	/* moves the data of fragmented files into a single block_run, if
+	 * there is enough contiguous free space for it
+	 */
+#define BFS_CHECK_EXTENDED_STATS	128
+	/* the caller's check_control includes the extended_stats field */
 
 /* values for the errors field */
 #define BFS_MISSING_BLOCKS		1
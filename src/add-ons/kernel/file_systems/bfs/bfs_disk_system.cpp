@@ -22,6 +22,8 @@ parse_initialize_parameters(const char* parameterString,
 
 	if (get_driver_boolean_parameter(handle, "noindex", false, true))
 		parameters.flags |= VOLUME_NO_INDICES;
+	if (get_driver_boolean_parameter(handle, "inline_data", false, true))
+		parameters.flags |= VOLUME_INLINE_DATA;
 	if (get_driver_boolean_parameter(handle, "verbose", false, true))
 		parameters.verbose = true;
 
@@ -31,14 +33,24 @@ parse_initialize_parameters(const char* parameterString,
 	if (string != NULL)
 		blockSize = strtoul(string, NULL, 0);
 
+	// the log size is given in blocks, 0 lets Volume::Initialize() choose
+	string = get_driver_parameter(handle, "log_size", NULL, NULL);
+	uint32 logSize = 0;
+	if (string != NULL)
+		logSize = strtoul(string, NULL, 0);
+
 	delete_driver_settings(handle);
 
 	if (blockSize != 1024 && blockSize != 2048 && blockSize != 4096
 		&& blockSize != 8192) {
 		return B_BAD_VALUE;
 	}
+	if (logSize != 0
+		&& (logSize < BFS_MIN_LOG_SIZE || logSize > BFS_MAX_LOG_SIZE))
+		return B_BAD_VALUE;
 
 	parameters.blockSize = blockSize;
+	parameters.logSize = logSize;
 
 	return B_OK;
 }
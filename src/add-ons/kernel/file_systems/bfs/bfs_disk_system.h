@@ -10,6 +10,7 @@
 
 struct initialize_parameters {
 	uint32	blockSize;
+	uint32	logSize;
 	uint32	flags;
 	bool	verbose;
 };
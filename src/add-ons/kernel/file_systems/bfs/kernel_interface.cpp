@@ -1,5 +1,6 @@
 /*
  * Copyright 2001-2010, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * This file may be used under the terms of the MIT License.
  */
 
@@ -20,9 +21,14 @@
 // TODO: temporary solution as long as there is no public I/O requests API
 #ifndef BFS_SHELL
 #	include <io_requests.h>
+#	include <kernel.h>
+#else
+#	define IS_USER_ADDRESS(x)	true
+		// the shell does not have a separate kernel address space
 #endif
 
 #define BFS_IO_SIZE	65536
+#define BFS_READ_AHEAD_INODES	64
 
 
 struct identify_cookie {
@@ -105,6 +111,82 @@ iterative_io_finished_hook(void* cookie, io_request* request, status_t status,
 }
 
 
+/*!	Reads pages of a file that keeps its data in the inode; the part of the
+	pages beyond the end of the file is cleared.
+	The inode must be read locked.
+*/
+static status_t
+read_inline_data_pages(Inode* inode, off_t pos, const iovec* vecs,
+	size_t count, size_t* _numBytes)
+{
+	size_t bytesLeft = *_numBytes;
+
+	for (size_t i = 0; i < count && bytesLeft > 0; i++) {
+		size_t length = min_c(vecs[i].iov_len, bytesLeft);
+		size_t bytesRead = length;
+		status_t status = inode->ReadInlineData(pos,
+			(uint8*)vecs[i].iov_base, &bytesRead);
+		if (status != B_OK)
+			return status;
+
+		if (bytesRead < length)
+			memset((uint8*)vecs[i].iov_base + bytesRead, 0, length - bytesRead);
+
+		pos += length;
+		bytesLeft -= length;
+	}
+
+	*_numBytes -= bytesLeft;
+	return B_OK;
+}
+
+
+/*!	Writes pages of a file that keeps its data in the inode. The inode can
+	only be changed in a transaction, and this is called from the page writer
+	which must never wait for the journal. Since Inode::WriteAt() changes the
+	inode along with the file cache, the pages are only compared with the
+	inode; pages changed through a mapping stay modified until Inode::Sync()
+	stored them in the inode.
+	The inode must be read locked.
+*/
+static status_t
+write_inline_data_pages(Inode* inode, off_t pos, const iovec* vecs,
+	size_t count, size_t* _numBytes)
+{
+	if (pos >= inode->Size())
+		return B_BAD_VALUE;
+
+	uint8 data[256];
+	size_t bytesLeft = *_numBytes;
+
+	for (size_t i = 0; i < count && bytesLeft > 0; i++) {
+		const uint8* buffer = (const uint8*)vecs[i].iov_base;
+		size_t length = min_c(vecs[i].iov_len, bytesLeft);
+
+		for (size_t offset = 0; offset < length;) {
+			size_t bytesRead = min_c(sizeof(data), length - offset);
+			status_t status = inode->ReadInlineData(pos + offset, data,
+				&bytesRead);
+			if (status != B_OK)
+				return status;
+			if (bytesRead == 0)
+				break;
+
+			if (memcmp(buffer + offset, data, bytesRead) != 0) {
+				// keep the pages modified
+				return B_BUSY;
+			}
+			offset += bytesRead;
+		}
+
+		pos += length;
+		bytesLeft -= length;
+	}
+
+	return B_OK;
+}
+
+
 //	#pragma mark - Scanning
 
 
@@ -404,6 +486,9 @@ bfs_read_pages(fs_volume* _volume, fs_vnode* _node, void* _cookie,
 
 	InodeReadLocker _(inode);
 
+	if (inode->HasInlineData())
+		return read_inline_data_pages(inode, pos, vecs, count, _numBytes);
+
 	uint32 vecIndex = 0;
 	size_t vecOffset = 0;
 	size_t bytesLeft = *_numBytes;
@@ -449,6 +534,9 @@ bfs_write_pages(fs_volume* _volume, fs_vnode* _node, void* _cookie,
 
 	InodeReadLocker _(inode);
 
+	if (inode->HasInlineData())
+		return write_inline_data_pages(inode, pos, vecs, count, _numBytes);
+
 	uint32 vecIndex = 0;
 	size_t vecOffset = 0;
 	size_t bytesLeft = *_numBytes;
@@ -502,6 +590,13 @@ bfs_io(fs_volume* _volume, fs_vnode* _node, void* _cookie, io_request* request)
 	// We lock the node here and will unlock it in the "finished" hook.
 	rw_lock_read_lock(&inode->Lock());
 
+	if (inode->HasInlineData()) {
+		// there are no blocks to do I/O on; let the VFS fall back to
+		// bfs_read_pages(), and bfs_write_pages()
+		rw_lock_read_unlock(&inode->Lock());
+		return B_UNSUPPORTED;
+	}
+
 	return do_iterative_fd_io(volume->Device(), request,
 		iterative_io_get_vecs_hook, iterative_io_finished_hook, inode);
 }
@@ -514,6 +609,9 @@ bfs_get_file_map(fs_volume* _volume, fs_vnode* _node, off_t offset, size_t size,
 	Volume* volume = (Volume*)_volume->private_volume;
 	Inode* inode = (Inode*)_node->private_node;
 
+	if (inode->HasInlineData())
+		return B_BAD_VALUE;
+
 	int32 blockShift = volume->BlockShift();
 	uint32 index = 0, max = *_count;
 	block_run run;
@@ -584,6 +682,8 @@ bfs_lookup(fs_volume* _volume, fs_vnode* _directory, const char* file,
 	status = tree->Find((uint8*)file, (uint16)strlen(file), _vnodeID);
 	if (status != B_OK) {
 		//PRINT(("bfs_walk() could not find %Ld:\"%s\": %s\n", directory->BlockNumber(), file, strerror(status)));
+		if (status == B_ENTRY_NOT_FOUND)
+			entry_cache_add_missing(volume->ID(), directory->ID(), file);
 		return status;
 	}
 
@@ -612,6 +712,33 @@ bfs_get_vnode_name(fs_volume* _volume, fs_vnode* _node, char* buffer,
 }
 
 
+/*!	Returns how much of a check_control the caller of the checking ioctls
+	knows about; older callers do not have the extended_stats field.
+*/
+static size_t
+check_control_size(uint32 flags)
+{
+	if ((flags & BFS_CHECK_EXTENDED_STATS) != 0)
+		return sizeof(check_control);
+
+	return offsetof(check_control, extended_stats);
+}
+
+
+static status_t
+copy_check_control(void* buffer, size_t bufferLength,
+	const check_control& control)
+{
+	size_t size = check_control_size(control.flags);
+	if (bufferLength < size)
+		return B_BAD_VALUE;
+	if (!IS_USER_ADDRESS(buffer))
+		return B_BAD_ADDRESS;
+
+	return user_memcpy(buffer, &control, size);
+}
+
+
 static status_t
 bfs_ioctl(fs_volume* _volume, fs_vnode* _node, void* _cookie, uint32 cmd,
 	void* buffer, size_t bufferLength)
@@ -632,8 +759,16 @@ bfs_ioctl(fs_volume* _volume, fs_vnode* _node, void* _cookie, uint32 cmd,
 			// start checking
 			BlockAllocator& allocator = volume->Allocator();
 			check_control control;
-			if (user_memcpy(&control, buffer, sizeof(check_control)) != B_OK)
+			memset(&control, 0, sizeof(check_control));
+
+			size_t size = check_control_size(0);
+			if (bufferLength < size)
+				return B_BAD_VALUE;
+			if (!IS_USER_ADDRESS(buffer)
+				|| user_memcpy(&control, buffer, size) != B_OK)
 				return B_BAD_ADDRESS;
+			if (bufferLength < check_control_size(control.flags))
+				return B_BAD_VALUE;
 
 			status_t status = allocator.StartChecking(&control);
 			if (status == B_OK) {
@@ -655,7 +790,7 @@ bfs_ioctl(fs_volume* _volume, fs_vnode* _node, void* _cookie, uint32 cmd,
 				cookie->open_mode &= ~BFS_OPEN_MODE_CHECKING;
 			}
 			if (status == B_OK)
-				status = user_memcpy(buffer, &control, sizeof(check_control));
+				status = copy_check_control(buffer, bufferLength, control);
 
 			return status;
 		}
@@ -667,7 +802,7 @@ bfs_ioctl(fs_volume* _volume, fs_vnode* _node, void* _cookie, uint32 cmd,
 
 			status_t status = allocator.CheckNextNode(&control);
 			if (status == B_OK)
-				status = user_memcpy(buffer, &control, sizeof(check_control));
+				status = copy_check_control(buffer, bufferLength, control);
 
 			return status;
 		}
@@ -689,6 +824,98 @@ bfs_ioctl(fs_volume* _volume, fs_vnode* _node, void* _cookie, uint32 cmd,
 
 			return volume->WriteSuperBlock();
 		}
+		case BFS_IOCTL_EXPLAIN_QUERY:
+		{
+			explain_query explain;
+			if (bufferLength != sizeof(explain_query))
+				return B_BAD_VALUE;
+			if (!IS_USER_ADDRESS(buffer)
+				|| user_memcpy(&explain, buffer, sizeof(explain_query)) != B_OK)
+				return B_BAD_ADDRESS;
+			if (explain.query == NULL || explain.query_length == 0
+				|| explain.query_length >= 65536 || explain.buffer == NULL
+				|| explain.buffer_size == 0)
+				return B_BAD_VALUE;
+			if (!IS_USER_ADDRESS(explain.query)
+				|| !IS_USER_ADDRESS(explain.buffer))
+				return B_BAD_ADDRESS;
+
+			size_t size = min_c(explain.buffer_size, 65536);
+			MemoryDeleter queryDeleter(malloc(explain.query_length + 1));
+			MemoryDeleter bufferDeleter(malloc(size));
+			char* queryString = (char*)queryDeleter.Get();
+			char* description = (char*)bufferDeleter.Get();
+			if (queryString == NULL || description == NULL)
+				return B_NO_MEMORY;
+
+			if (user_memcpy(queryString, explain.query,
+					explain.query_length) != B_OK)
+				return B_BAD_ADDRESS;
+			queryString[explain.query_length] = '\0';
+
+			Expression expression(queryString);
+			if (expression.InitCheck() != B_OK)
+				return B_BAD_VALUE;
+
+			Query query(volume, &expression,
+				explain.flags & ~B_LIVE_QUERY);
+			status_t status = query.Explain(description, size);
+			if (status != B_OK && status != B_BUFFER_OVERFLOW)
+				return status;
+
+			description[size - 1] = '\0';
+			if (user_memcpy(explain.buffer, description,
+					strlen(description) + 1) != B_OK)
+				return B_BAD_ADDRESS;
+
+			return status;
+		}
+		case BFS_IOCTL_JOURNAL_STATISTICS:
+		{
+			if (bufferLength != sizeof(journal_statistics))
+				return B_BAD_VALUE;
+			if (volume->GetJournal(0) == NULL)
+				return B_NOT_SUPPORTED;
+
+			if (!IS_USER_ADDRESS(buffer))
+				return B_BAD_ADDRESS;
+
+			journal_statistics stats;
+			volume->GetJournal(0)->GetStatistics(stats);
+
+			return user_memcpy(buffer, &stats, sizeof(journal_statistics));
+		}
+		case BFS_IOCTL_RESIZE_LOG:
+		{
+			uint32 length;
+			if (geteuid() != 0)
+				return B_NOT_ALLOWED;
+			if (volume->IsReadOnly())
+				return B_READ_ONLY_DEVICE;
+			if (volume->GetJournal(0) == NULL)
+				return B_NOT_SUPPORTED;
+			if (bufferLength != sizeof(uint32))
+				return B_BAD_VALUE;
+			if (!IS_USER_ADDRESS(buffer)
+				|| user_memcpy(&length, buffer, sizeof(uint32)) != B_OK)
+				return B_BAD_ADDRESS;
+
+			return volume->GetJournal(0)->ResizeLog(length);
+		}
+		case BFS_IOCTL_FREE_SPACE_REPORT:
+		{
+			if (bufferLength != sizeof(free_space_report))
+				return B_BAD_VALUE;
+			if (!IS_USER_ADDRESS(buffer))
+				return B_BAD_ADDRESS;
+
+			free_space_report report;
+			status_t status = volume->Allocator().GetFreeSpaceReport(report);
+			if (status != B_OK)
+				return status;
+
+			return user_memcpy(buffer, &report, sizeof(free_space_report));
+		}
 
 #ifdef DEBUG_FRAGMENTER
 		case 56741:
@@ -1646,6 +1873,14 @@ bfs_read_dir(fs_volume* _volume, fs_vnode* _node, void* _cookie,
 
 	Volume* volume = (Volume*)_volume->private_volume;
 
+	if (iterator->IsAtNodeStart()) {
+		// We just entered a new node of the directory - as its entries are
+		// likely to be opened or stat()ed next, read their inodes ahead
+		off_t ids[BFS_READ_AHEAD_INODES];
+		int32 count = iterator->GetNodeValues(ids, BFS_READ_AHEAD_INODES);
+		volume->ReadAheadInodes(ids, count);
+	}
+
 	dirent->d_dev = volume->ID();
 	dirent->d_ino = id;
 
@@ -2072,6 +2307,21 @@ bfs_create_index(fs_volume* _volume, const char* name, uint32 type,
 	if (status == B_OK)
 		status = transaction.Done();
 
+	// the indices derived from the name need to know about all existing
+	// entries right away, as they are maintained by the file system only
+	if (status == B_OK && Index::IsDerivedNameIndex(name)) {
+		status = index.FillNameIndex(name);
+		if (status != B_OK) {
+			// it would never become complete, so don't keep it around
+			index.Unset();
+
+			if (transaction.Start(volume, volume->ToBlock(volume->Indices()))
+					== B_OK
+				&& volume->IndicesNode()->Remove(transaction, name) == B_OK)
+				transaction.Done();
+		}
+	}
+
 	RETURN_ERROR(status);
 }
 
@@ -2258,7 +2508,7 @@ bfs_initialize(int fd, partition_id partitionID, const char* name,
 	// initialize the volume
 	Volume volume(NULL);
 	status = volume.Initialize(fd, name, parameters.blockSize,
-		parameters.flags);
+		parameters.logSize, parameters.flags);
 	if (status < B_OK) {
 		INFORM(("Initializing volume failed: %s\n", strerror(status)));
 		return status;
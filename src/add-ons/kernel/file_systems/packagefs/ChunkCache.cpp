@@ -0,0 +1,268 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "ChunkCache.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+#include <low_resource_manager.h>
+#include <util/AutoLock.h>
+
+#include "DebugSupport.h"
+
+
+// #pragma mark - CachedChunk
+
+
+CachedChunk::CachedChunk(const void* owner, uint64 index, size_t size)
+	:
+	fHashLink(NULL),
+	fOwner(owner),
+	fIndex(index),
+	fSize(size),
+	fReferenceCount(1)
+{
+}
+
+
+/*static*/ CachedChunk*
+CachedChunk::Create(const void* owner, uint64 index, size_t size)
+{
+	void* memory = malloc(sizeof(CachedChunk) + size);
+	if (memory == NULL)
+		return NULL;
+
+	return new(memory) CachedChunk(owner, index, size);
+}
+
+
+void
+CachedChunk::AcquireReference()
+{
+	atomic_add(&fReferenceCount, 1);
+}
+
+
+void
+CachedChunk::ReleaseReference()
+{
+	if (atomic_add(&fReferenceCount, -1) == 1) {
+		this->~CachedChunk();
+		free(this);
+	}
+}
+
+
+// #pragma mark - ChunkCache
+
+
+ChunkCache::ChunkCache()
+	:
+	fMaxSize(0),
+	fSize(0),
+	fNextReclaimStripe(0),
+	fLowResourceHandlerRegistered(false)
+{
+	for (uint32 i = 0; i < kStripeCount; i++)
+		mutex_init(&fStripes[i].lock, "packagefs chunk cache");
+}
+
+
+ChunkCache::~ChunkCache()
+{
+	if (fLowResourceHandlerRegistered)
+		unregister_low_resource_handler(&_LowResourceHandler, this);
+
+	_Reclaim(0);
+
+	for (uint32 i = 0; i < kStripeCount; i++)
+		mutex_destroy(&fStripes[i].lock);
+}
+
+
+status_t
+ChunkCache::Init(int64 maxSize)
+{
+	fMaxSize = maxSize;
+
+	for (uint32 i = 0; i < kStripeCount; i++) {
+		status_t error = fStripes[i].table.Init();
+		if (error != B_OK)
+			RETURN_ERROR(error);
+	}
+
+	status_t error = register_low_resource_handler(&_LowResourceHandler, this,
+		B_KERNEL_RESOURCE_PAGES | B_KERNEL_RESOURCE_MEMORY, 0);
+	if (error != B_OK)
+		RETURN_ERROR(error);
+
+	fLowResourceHandlerRegistered = true;
+	return B_OK;
+}
+
+
+/*!	Returns the chunk with the given \a index of \a owner, or \c NULL, if it
+	is not cached. The caller gets a reference to the returned chunk.
+*/
+CachedChunk*
+ChunkCache::Lookup(const void* owner, uint64 index)
+{
+	Stripe& stripe = _StripeFor(owner, index);
+	MutexLocker locker(stripe.lock);
+
+	CachedChunk* chunk = stripe.table.Lookup(ChunkKey(owner, index));
+	if (chunk == NULL)
+		return NULL;
+
+	// move it to the end of the LRU list
+	stripe.chunks.Remove(chunk);
+	stripe.chunks.Add(chunk);
+
+	chunk->AcquireReference();
+	return chunk;
+}
+
+
+/*!	Adds the given \a chunk to the cache. The caller must own a reference to
+	the chunk, which is transferred to the returned chunk: if another thread
+	added a chunk with the same key in the meantime, the reference to \a chunk
+	is released, and the already cached chunk is returned instead.
+	When memory is getting tight, the chunk is not added to the cache at all.
+*/
+CachedChunk*
+ChunkCache::Insert(CachedChunk* chunk)
+{
+	if (low_resource_state(B_KERNEL_RESOURCE_PAGES | B_KERNEL_RESOURCE_MEMORY)
+			>= B_LOW_RESOURCE_WARNING) {
+		return chunk;
+	}
+
+	Stripe& stripe = _StripeFor(chunk->Owner(), chunk->Index());
+	MutexLocker locker(stripe.lock);
+
+	CachedChunk* existing = stripe.table.Lookup(
+		ChunkKey(chunk->Owner(), chunk->Index()));
+	if (existing != NULL) {
+		existing->AcquireReference();
+		locker.Unlock();
+
+		chunk->ReleaseReference();
+		return existing;
+	}
+
+	if (stripe.table.Insert(chunk) != B_OK)
+		return chunk;
+
+	chunk->AcquireReference();
+	stripe.chunks.Add(chunk);
+	int64 size = atomic_add64(&fSize, chunk->Size()) + chunk->Size();
+
+	locker.Unlock();
+
+	if (size > fMaxSize)
+		_Reclaim(fMaxSize);
+
+	return chunk;
+}
+
+
+/*!	Removes all chunks of \a owner from the cache. Must be called before the
+	owner goes away, as the pointer could otherwise be reused by a different
+	file.
+*/
+void
+ChunkCache::RemoveOwner(const void* owner)
+{
+	for (uint32 i = 0; i < kStripeCount; i++) {
+		Stripe& stripe = fStripes[i];
+		MutexLocker locker(stripe.lock);
+
+		ChunkList::Iterator iterator = stripe.chunks.GetIterator();
+		while (CachedChunk* chunk = iterator.Next()) {
+			if (chunk->Owner() == owner)
+				_Remove(stripe, chunk);
+		}
+	}
+}
+
+
+/*!	Returns the stripe responsible for the given chunk.
+	The stripe's hash table uses the low bits of the hash to pick a bucket, so
+	the stripe is chosen by the upper bits of a multiplicatively mixed hash --
+	otherwise all chunks of a stripe would end up in the same 1/kStripeCount
+	of its buckets. The mixing still spreads consecutive chunks of a file over
+	all stripes.
+*/
+ChunkCache::Stripe&
+ChunkCache::_StripeFor(const void* owner, uint64 index)
+{
+	uint32 hash = ChunkHashDefinition().HashKey(ChunkKey(owner, index));
+	return fStripes[((hash * 0x9e3779b1) >> 24) % kStripeCount];
+}
+
+
+/*!	Removes \a chunk from the cache, and releases the cache's reference to it.
+	The stripe must be locked.
+*/
+void
+ChunkCache::_Remove(Stripe& stripe, CachedChunk* chunk)
+{
+	stripe.table.RemoveUnchecked(chunk);
+	stripe.chunks.Remove(chunk);
+	atomic_add64(&fSize, -(int64)chunk->Size());
+
+	chunk->ReleaseReference();
+}
+
+
+/*!	Throws out the least recently used chunks of the stripes in a round robin
+	fashion, until the cache is no larger than \a targetSize.
+*/
+void
+ChunkCache::_Reclaim(int64 targetSize)
+{
+	uint32 emptyStripes = 0;
+
+	while (atomic_get64(&fSize) > targetSize && emptyStripes < kStripeCount) {
+		uint32 index = (uint32)atomic_add(&fNextReclaimStripe, 1)
+			% kStripeCount;
+		Stripe& stripe = fStripes[index];
+		MutexLocker locker(stripe.lock);
+
+		CachedChunk* chunk = stripe.chunks.Head();
+		if (chunk == NULL) {
+			emptyStripes++;
+			continue;
+		}
+
+		emptyStripes = 0;
+		_Remove(stripe, chunk);
+	}
+}
+
+
+/*static*/ void
+ChunkCache::_LowResourceHandler(void* data, uint32 resources, int32 level)
+{
+	ChunkCache* cache = (ChunkCache*)data;
+	int64 size = atomic_get64(&cache->fSize);
+
+	switch (level) {
+		case B_NO_LOW_RESOURCE:
+			return;
+		case B_LOW_RESOURCE_NOTE:
+			cache->_Reclaim(size - size / 4);
+			break;
+		case B_LOW_RESOURCE_WARNING:
+			cache->_Reclaim(size / 2);
+			break;
+		case B_LOW_RESOURCE_CRITICAL:
+			cache->_Reclaim(0);
+			break;
+	}
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef CHUNK_CACHE_H
+#define CHUNK_CACHE_H
+
+
+#include <SupportDefs.h>
+
+#include <lock.h>
+#include <util/DoublyLinkedList.h>
+#include <util/OpenHashTable.h>
+
+
+/*!	A chunk of uncompressed file data. The owner is an opaque pointer that
+	identifies the file the chunk belongs to, the index is the number of the
+	chunk within that file.
+	A chunk is reference counted; the cache holds one reference as long as the
+	chunk is part of it.
+*/
+class CachedChunk : public DoublyLinkedListLinkImpl<CachedChunk> {
+public:
+	static	CachedChunk*		Create(const void* owner, uint64 index,
+									size_t size);
+
+			void				AcquireReference();
+			void				ReleaseReference();
+
+			const void*			Owner() const	{ return fOwner; }
+			uint64				Index() const	{ return fIndex; }
+			size_t				Size() const	{ return fSize; }
+			uint8*				Data()			{ return fData; }
+
+			CachedChunk*&		HashLink()		{ return fHashLink; }
+
+private:
+								CachedChunk(const void* owner, uint64 index,
+									size_t size);
+
+private:
+			CachedChunk*		fHashLink;
+			const void*			fOwner;
+			uint64				fIndex;
+			size_t				fSize;
+			int32				fReferenceCount;
+			uint8				fData[0];
+};
+
+
+/*!	A global cache for uncompressed chunks of package files, shared by all
+	packagefs volumes.
+	Lookups are spread over a number of independently locked stripes, so that
+	concurrent readers rarely contend. The total size of the cached chunks is
+	bounded, and the cache shrinks when the system runs low on memory.
+*/
+class ChunkCache {
+public:
+								ChunkCache();
+								~ChunkCache();
+
+			status_t			Init(int64 maxSize);
+
+			CachedChunk*		Lookup(const void* owner, uint64 index);
+			CachedChunk*		Insert(CachedChunk* chunk);
+			void				RemoveOwner(const void* owner);
+
+			int64				Size() const	{ return fSize; }
+			int64				MaxSize() const	{ return fMaxSize; }
+
+private:
+			struct ChunkKey {
+				const void*		owner;
+				uint64			index;
+
+				ChunkKey(const void* owner, uint64 index)
+					:
+					owner(owner),
+					index(index)
+				{
+				}
+			};
+
+			struct ChunkHashDefinition {
+				typedef ChunkKey	KeyType;
+				typedef	CachedChunk	ValueType;
+
+				size_t HashKey(const ChunkKey& key) const
+				{
+					return ((size_t)key.owner >> 4) * 31 + (size_t)key.index;
+				}
+
+				size_t Hash(const CachedChunk* value) const
+				{
+					return HashKey(ChunkKey(value->Owner(), value->Index()));
+				}
+
+				bool Compare(const ChunkKey& key,
+					const CachedChunk* value) const
+				{
+					return value->Owner() == key.owner
+						&& value->Index() == key.index;
+				}
+
+				CachedChunk*& GetLink(CachedChunk* value) const
+				{
+					return value->HashLink();
+				}
+			};
+
+			typedef BOpenHashTable<ChunkHashDefinition> ChunkHashTable;
+			typedef DoublyLinkedList<CachedChunk> ChunkList;
+
+			struct Stripe {
+				mutex			lock;
+				ChunkHashTable	table;
+				ChunkList		chunks;
+					// least recently used first
+			};
+
+	static	const uint32		kStripeCount = 16;
+
+private:
+			Stripe&				_StripeFor(const void* owner, uint64 index);
+			void				_Remove(Stripe& stripe, CachedChunk* chunk);
+			void				_Reclaim(int64 targetSize);
+
+	static	void				_LowResourceHandler(void* data,
+									uint32 resources, int32 level);
+
+private:
+			Stripe				fStripes[kStripeCount];
+			int64				fMaxSize;
+			vint64				fSize;
+			int32				fNextReclaimStripe;
+			bool				fLowResourceHandlerRegistered;
+};
+
+
+#endif	// CHUNK_CACHE_H
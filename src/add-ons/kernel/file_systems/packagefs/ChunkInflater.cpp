@@ -0,0 +1,208 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "ChunkInflater.h"
+
+#include <new>
+
+#include <util/AutoLock.h>
+
+#include "DebugSupport.h"
+
+
+struct ChunkInflater::Batch {
+	ConditionVariable	condition;
+	int32				pending;
+	status_t			status;
+};
+
+
+// #pragma mark - Job
+
+
+ChunkInflater::Job::Job()
+	:
+	fBatch(NULL),
+	fQueued(false)
+{
+}
+
+
+ChunkInflater::Job::~Job()
+{
+}
+
+
+// #pragma mark - ChunkInflater
+
+
+ChunkInflater::ChunkInflater()
+	:
+	fThreads(NULL),
+	fThreadCount(0),
+	fTerminating(false)
+{
+	mutex_init(&fLock, "packagefs chunk inflater");
+	fJobCondition.Init(this, "packagefs inflater jobs");
+}
+
+
+ChunkInflater::~ChunkInflater()
+{
+	MutexLocker locker(fLock);
+	fTerminating = true;
+	fJobCondition.NotifyAll();
+	locker.Unlock();
+
+	for (int32 i = 0; i < fThreadCount; i++)
+		wait_for_thread(fThreads[i], NULL);
+
+	delete[] fThreads;
+	mutex_destroy(&fLock);
+}
+
+
+status_t
+ChunkInflater::Init(int32 threadCount)
+{
+	if (threadCount == 0)
+		return B_OK;
+
+	fThreads = new(std::nothrow) thread_id[threadCount];
+	if (fThreads == NULL)
+		RETURN_ERROR(B_NO_MEMORY);
+
+	for (int32 i = 0; i < threadCount; i++) {
+		thread_id thread = spawn_kernel_thread(&_WorkerEntry,
+			"packagefs inflater", B_NORMAL_PRIORITY, this);
+		if (thread < 0) {
+			// we can live with fewer threads
+			if (fThreadCount > 0)
+				break;
+			RETURN_ERROR(thread);
+		}
+
+		fThreads[fThreadCount++] = thread;
+		resume_thread(thread);
+	}
+
+	return B_OK;
+}
+
+
+/*!	Executes the given \a jobs, and waits until all of them are done. The
+	first job is always executed by the calling thread, the others are handed
+	to the worker threads.
+	Returns the first error any of the jobs returned.
+*/
+status_t
+ChunkInflater::Run(Job** jobs, int32 count)
+{
+	if (count <= 0)
+		return B_OK;
+
+	Batch batch;
+	batch.condition.Init(&batch, "packagefs inflater batch");
+	batch.pending = count;
+	batch.status = B_OK;
+
+	// queue all but the first job
+	MutexLocker locker(fLock);
+
+	for (int32 i = 0; i < count; i++) {
+		jobs[i]->fBatch = &batch;
+		jobs[i]->fQueued = i > 0;
+		if (jobs[i]->fQueued)
+			fJobs.Add(jobs[i]);
+	}
+
+	if (count > 1)
+		fJobCondition.NotifyAll();
+
+	locker.Unlock();
+
+	// do the first job, and all the others no worker picked up in the
+	// meantime
+	for (int32 i = 0; i < count; i++) {
+		if (i > 0) {
+			locker.Lock();
+			bool queued = jobs[i]->fQueued;
+			if (queued) {
+				fJobs.Remove(jobs[i]);
+				jobs[i]->fQueued = false;
+			}
+			locker.Unlock();
+
+			if (!queued)
+				continue;
+		}
+
+		_JobDone(jobs[i], jobs[i]->Do());
+	}
+
+	// wait for the workers to finish the rest
+	locker.Lock();
+
+	while (batch.pending > 0) {
+		ConditionVariableEntry waitEntry;
+		batch.condition.Add(&waitEntry);
+		locker.Unlock();
+		waitEntry.Wait();
+		locker.Lock();
+	}
+
+	return batch.status;
+}
+
+
+/*static*/ status_t
+ChunkInflater::_WorkerEntry(void* data)
+{
+	return ((ChunkInflater*)data)->_Worker();
+}
+
+
+status_t
+ChunkInflater::_Worker()
+{
+	MutexLocker locker(fLock);
+
+	while (!fTerminating) {
+		Job* job = fJobs.RemoveHead();
+		if (job == NULL) {
+			// nothing to do yet -- wait for someone notifying us
+			ConditionVariableEntry waitEntry;
+			fJobCondition.Add(&waitEntry);
+			locker.Unlock();
+			waitEntry.Wait();
+			locker.Lock();
+			continue;
+		}
+
+		job->fQueued = false;
+		locker.Unlock();
+
+		_JobDone(job, job->Do());
+
+		locker.Lock();
+	}
+
+	return B_OK;
+}
+
+
+void
+ChunkInflater::_JobDone(Job* job, status_t status)
+{
+	MutexLocker locker(fLock);
+
+	Batch* batch = job->fBatch;
+	if (status != B_OK && batch->status == B_OK)
+		batch->status = status;
+
+	if (--batch->pending == 0)
+		batch->condition.NotifyAll();
+}
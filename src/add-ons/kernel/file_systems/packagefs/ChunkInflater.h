@@ -0,0 +1,70 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef CHUNK_INFLATER_H
+#define CHUNK_INFLATER_H
+
+
+#include <OS.h>
+
+#include <condition_variable.h>
+#include <lock.h>
+#include <util/DoublyLinkedList.h>
+
+
+/*!	A small pool of worker threads that uncompress independent chunks of
+	package file data in parallel.
+	The thread calling Run() takes part in the work; jobs that no worker has
+	picked up yet when it is done with its own are executed by it, too, so a
+	batch never waits for workers that are busy with other batches.
+*/
+class ChunkInflater {
+private:
+			struct Batch;
+
+public:
+			class Job : public DoublyLinkedListLinkImpl<Job> {
+			public:
+								Job();
+				virtual			~Job();
+
+				virtual	status_t Do() = 0;
+
+			private:
+				friend class ChunkInflater;
+
+				Batch*			fBatch;
+				bool			fQueued;
+			};
+
+public:
+								ChunkInflater();
+								~ChunkInflater();
+
+			status_t			Init(int32 threadCount);
+
+			int32				ThreadCount() const	{ return fThreadCount; }
+
+			status_t			Run(Job** jobs, int32 count);
+
+private:
+			typedef DoublyLinkedList<Job> JobList;
+
+private:
+	static	status_t			_WorkerEntry(void* data);
+			status_t			_Worker();
+
+			void				_JobDone(Job* job, status_t status);
+
+private:
+			mutex				fLock;
+			ConditionVariable	fJobCondition;
+			JobList				fJobs;
+			thread_id*			fThreads;
+			int32				fThreadCount;
+			bool				fTerminating;
+};
+
+
+#endif	// CHUNK_INFLATER_H
@@ -53,6 +53,10 @@ public:
 									Version* resolvableVersion) const;
 
 			const char*			Name() const	{ return fName; }
+			BPackageResolvableOperator VersionOperator() const
+									{ return fVersionOperator; }
+			Version*			RequiredVersion() const
+									{ return fVersion; }
 
 private:
 			::Package*			fPackage;
@@ -6,13 +6,25 @@
 
 #include "GlobalFactory.h"
 
+#include <algorithm>
 #include <new>
 
 #include <package/hpkg/HPKGDefsPrivate.h>
 
+#ifdef _KERNEL_MODE
+#	include <smp.h>
+#	include <vm/vm_page.h>
+#endif
+
 
 static const uint32 kMaxCachedBuffers = 32;
 
+// bounds for the size of the uncompressed chunk cache
+static const int64 kMinChunkCacheSize = 2 * 1024 * 1024;
+static const int64 kMaxChunkCacheSize = 64 * 1024 * 1024;
+
+static const int32 kMaxInflaterThreads = 4;
+
 /*static*/ GlobalFactory* GlobalFactory::sDefaultInstance = NULL;
 
 
@@ -81,5 +93,27 @@ GlobalFactory::_Init()
 	if (error != B_OK)
 		return error;
 
+	// Use 1/64 of the memory for the chunk cache; the threads calling into
+	// the inflater take part in the work, so we need one thread less than
+	// there are CPUs.
+#ifdef _KERNEL_MODE
+	int64 chunkCacheSize = (int64)vm_page_num_pages() * B_PAGE_SIZE / 64;
+	int32 inflaterThreads = smp_get_num_cpus() - 1;
+#else
+	int64 chunkCacheSize = kMinChunkCacheSize;
+	int32 inflaterThreads = 1;
+#endif
+	chunkCacheSize = std::max(kMinChunkCacheSize,
+		std::min(kMaxChunkCacheSize, chunkCacheSize));
+	inflaterThreads = std::min(kMaxInflaterThreads, inflaterThreads);
+
+	error = fChunkCache.Init(chunkCacheSize);
+	if (error != B_OK)
+		return error;
+
+	error = fChunkInflater.Init(inflaterThreads);
+	if (error != B_OK)
+		return error;
+
 	return B_OK;
 }
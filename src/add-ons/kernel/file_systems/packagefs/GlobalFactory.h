@@ -10,6 +10,8 @@
 #include <package/hpkg/PackageDataReader.h>
 
 #include "BlockBufferCacheKernel.h"
+#include "ChunkCache.h"
+#include "ChunkInflater.h"
 
 
 using BPackageKit::BHPKG::BDataReader;
@@ -33,6 +35,11 @@ public:
 									const BPackageData& data,
 									BPackageDataReader*& _reader);
 
+			ChunkCache*			GetChunkCache()
+									{ return &fChunkCache; }
+			ChunkInflater*		GetChunkInflater()
+									{ return &fChunkInflater; }
+
 private:
 			status_t			_Init();
 
@@ -41,6 +48,8 @@ private:
 
 			BlockBufferCacheKernel fBufferCache;
 			BPackageDataReaderFactory fPackageDataReaderFactory;
+			ChunkCache			fChunkCache;
+			ChunkInflater		fChunkInflater;
 };
 
 #endif	// GLOBAL_FACTORY_H
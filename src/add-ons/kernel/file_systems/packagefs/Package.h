@@ -37,9 +37,17 @@ public:
 								~Package();
 
 			status_t			Init(const char* fileName);
+			status_t			Load();
 
 			PackageDomain*		Domain() const		{ return fDomain; }
 			const char*			FileName() const	{ return fFileName; }
+			ino_t				NodeID() const		{ return fNodeID; }
+
+			void				SetFileInfo(off_t size,
+									const timespec& modifiedTime);
+			off_t				FileSize() const	{ return fFileSize; }
+			const timespec&		ModifiedTime() const
+									{ return fModifiedTime; }
 
 			status_t			SetName(const char* name);
 			const char*			Name() const		{ return fName; }
@@ -81,6 +89,10 @@ public:
 			const DependencyList& Dependencies() const
 									{ return fDependencies; }
 
+private:
+			struct LoaderErrorOutput;
+			struct LoaderContentHandler;
+
 private:
 			mutex				fLock;
 			PackageDomain*		fDomain;
@@ -95,6 +107,8 @@ private:
 			Package*			fFileNameHashTableNext;
 			ino_t				fNodeID;
 			dev_t				fDeviceID;
+			off_t				fFileSize;
+			timespec			fModifiedTime;
 			PackageNodeList		fNodes;
 			ResolvableList		fResolvables;
 			DependencyList		fDependencies;
@@ -0,0 +1,957 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "PackageContentCache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <StorageDefs.h>
+
+#include <AutoDeleter.h>
+#include <syscalls.h>
+#include <zlib.h>
+
+#include "DebugSupport.h"
+#include "Package.h"
+#include "PackageDirectory.h"
+#include "PackageFile.h"
+#include "PackageSymlink.h"
+#include "Version.h"
+
+
+static const uint32 kContentCacheMagic = 'PkCc';
+static const uint32 kContentCacheVersion = 1;
+
+static const char* const kContentCacheFileName = ".PackageFSContentCache";
+static const char* const kContentCacheTempFileName
+	= ".PackageFSContentCache.tmp";
+
+// sanity limits for reading the cache
+static const uint32 kMaxContentCacheEntries = 64 * 1024;
+static const uint32 kMaxPackageContentSize = 64 * 1024 * 1024;
+static const int32 kMaxNodeDepth = 256;
+
+static const uint16 kNullStringLength = 0xffff;
+
+
+struct package_content_cache_header {
+	uint32	magic;
+	uint32	version;
+	uint32	entry_count;
+	uint32	checksum;
+		// CRC32 of the header (with this field set to 0) and the entry table
+	uint64	file_size;
+};
+
+
+struct package_content_cache_entry {
+	int64	node_id;
+	int64	file_size;
+	int64	modified_time;
+	int32	modified_time_nsec;
+	uint32	data_checksum;
+	uint64	data_offset;
+	uint32	data_size;
+	uint32	_reserved;
+	char	file_name[B_FILE_NAME_LENGTH];
+};
+
+
+// #pragma mark - ContentWriter
+
+
+/*!	Serializes package contents into a growing memory buffer. */
+class ContentWriter {
+public:
+	ContentWriter()
+		:
+		fBuffer(NULL),
+		fSize(0),
+		fCapacity(0),
+		fError(B_OK)
+	{
+	}
+
+	~ContentWriter()
+	{
+		free(fBuffer);
+	}
+
+	status_t Error() const
+	{
+		return fError;
+	}
+
+	size_t Size() const
+	{
+		return fSize;
+	}
+
+	uint8* DetachBuffer()
+	{
+		uint8* buffer = fBuffer;
+		fBuffer = NULL;
+		fSize = fCapacity = 0;
+		return buffer;
+	}
+
+	void Write(const void* data, size_t size)
+	{
+		if (fError != B_OK)
+			return;
+
+		if (fSize + size > fCapacity) {
+			size_t capacity = fCapacity > 0 ? fCapacity * 2 : 4096;
+			while (capacity < fSize + size)
+				capacity *= 2;
+
+			uint8* buffer = (uint8*)realloc(fBuffer, capacity);
+			if (buffer == NULL) {
+				fError = B_NO_MEMORY;
+				return;
+			}
+
+			fBuffer = buffer;
+			fCapacity = capacity;
+		}
+
+		memcpy(fBuffer + fSize, data, size);
+		fSize += size;
+	}
+
+	template<typename Type>
+	void Write(const Type& value)
+	{
+		Write(&value, sizeof(value));
+	}
+
+	void WriteString(const char* string)
+	{
+		if (string == NULL) {
+			Write(kNullStringLength);
+			return;
+		}
+
+		size_t length = strlen(string);
+		if (length >= kNullStringLength) {
+			fError = B_NAME_TOO_LONG;
+			return;
+		}
+
+		Write((uint16)length);
+		Write(string, length + 1);
+	}
+
+	void WriteVersion(const Version* version)
+	{
+		Write((uint8)(version != NULL));
+		if (version == NULL)
+			return;
+
+		WriteString(version->Major());
+		WriteString(version->Minor());
+		WriteString(version->Micro());
+		WriteString(version->PreRelease());
+		Write(version->Release());
+	}
+
+	void WriteData(const BPackageData& data)
+	{
+		Write(data.Compression());
+		Write(data.ChunkSize());
+		Write(data.UncompressedSize());
+		Write(data.CompressedSize());
+		Write((uint8)data.IsEncodedInline());
+		if (data.IsEncodedInline())
+			Write(data.InlineData(), data.CompressedSize());
+		else
+			Write(data.Offset());
+	}
+
+private:
+	uint8*		fBuffer;
+	size_t		fSize;
+	size_t		fCapacity;
+	status_t	fError;
+};
+
+
+// #pragma mark - ContentReader
+
+
+/*!	Reads what a ContentWriter wrote, checking every access against the
+	bounds of the buffer.
+*/
+class ContentReader {
+public:
+	ContentReader(const uint8* data, size_t size)
+		:
+		fData(data),
+		fSize(size),
+		fPosition(0)
+	{
+	}
+
+	bool IsAtEnd() const
+	{
+		return fPosition == fSize;
+	}
+
+	status_t Read(void* buffer, size_t size)
+	{
+		if (size > fSize - fPosition)
+			return B_BAD_DATA;
+
+		memcpy(buffer, fData + fPosition, size);
+		fPosition += size;
+		return B_OK;
+	}
+
+	template<typename Type>
+	status_t Read(Type& value)
+	{
+		return Read(&value, sizeof(value));
+	}
+
+	status_t ReadString(const char*& _string)
+	{
+		uint16 length;
+		status_t error = Read(length);
+		if (error != B_OK)
+			return error;
+
+		if (length == kNullStringLength) {
+			_string = NULL;
+			return B_OK;
+		}
+
+		if ((size_t)length + 1 > fSize - fPosition
+			|| fData[fPosition + length] != '\0') {
+			return B_BAD_DATA;
+		}
+
+		_string = (const char*)fData + fPosition;
+		fPosition += length + 1;
+		return B_OK;
+	}
+
+	status_t ReadVersion(Version*& _version)
+	{
+		uint8 hasVersion;
+		status_t error = Read(hasVersion);
+		if (error != B_OK)
+			return error;
+
+		if (!hasVersion) {
+			_version = NULL;
+			return B_OK;
+		}
+
+		const char* major;
+		const char* minor;
+		const char* micro;
+		const char* preRelease;
+		uint8 release;
+		if ((error = ReadString(major)) != B_OK
+			|| (error = ReadString(minor)) != B_OK
+			|| (error = ReadString(micro)) != B_OK
+			|| (error = ReadString(preRelease)) != B_OK
+			|| (error = Read(release)) != B_OK) {
+			return error;
+		}
+
+		if (major == NULL)
+			return B_BAD_DATA;
+
+		return Version::Create(major, minor, micro, preRelease, release,
+			_version);
+	}
+
+	status_t ReadData(BPackageData& data)
+	{
+		uint32 compression;
+		uint32 chunkSize;
+		uint64 uncompressedSize;
+		uint64 compressedSize;
+		uint8 encodedInline;
+		status_t error;
+		if ((error = Read(compression)) != B_OK
+			|| (error = Read(chunkSize)) != B_OK
+			|| (error = Read(uncompressedSize)) != B_OK
+			|| (error = Read(compressedSize)) != B_OK
+			|| (error = Read(encodedInline)) != B_OK) {
+			return error;
+		}
+
+		if (encodedInline) {
+			uint8 inlineData[B_HPKG_MAX_INLINE_DATA_SIZE];
+			if (compressedSize > B_HPKG_MAX_INLINE_DATA_SIZE)
+				return B_BAD_DATA;
+
+			error = Read(inlineData, compressedSize);
+			if (error != B_OK)
+				return error;
+
+			data.SetData((uint8)compressedSize, inlineData);
+		} else {
+			uint64 offset;
+			error = Read(offset);
+			if (error != B_OK)
+				return error;
+
+			data.SetData(compressedSize, offset);
+		}
+
+		data.SetCompression(compression);
+		data.SetChunkSize(chunkSize);
+		data.SetUncompressedSize(uncompressedSize);
+		return B_OK;
+	}
+
+private:
+	const uint8*	fData;
+	size_t			fSize;
+	size_t			fPosition;
+};
+
+
+// #pragma mark - serialization
+
+
+static void
+write_node(ContentWriter& writer, PackageNode* node)
+{
+	writer.Write((uint32)node->Mode());
+	writer.Write((int64)node->ModifiedTime().tv_sec);
+	writer.Write((int32)node->ModifiedTime().tv_nsec);
+	writer.WriteString(node->Name());
+
+	if (S_ISREG(node->Mode()))
+		writer.WriteData(static_cast<PackageFile*>(node)->Data());
+	else if (S_ISLNK(node->Mode()))
+		writer.WriteString(static_cast<PackageSymlink*>(node)->SymlinkPath());
+
+	writer.Write((uint32)node->Attributes().Count());
+	for (PackageNodeAttributeList::ConstIterator it
+			= node->Attributes().GetIterator();
+			PackageNodeAttribute* attribute = it.Next();) {
+		writer.Write(attribute->Type());
+		writer.WriteString(attribute->Name());
+		writer.WriteData(attribute->Data());
+	}
+
+	if (S_ISDIR(node->Mode())) {
+		PackageDirectory* directory = static_cast<PackageDirectory*>(node);
+		writer.Write((uint32)directory->Children().Size());
+		for (PackageNodeList::Iterator it = directory->Children().GetIterator();
+				PackageNode* child = it.Next();) {
+			write_node(writer, child);
+		}
+	}
+}
+
+
+static void
+write_package(ContentWriter& writer, Package* package)
+{
+	writer.WriteString(package->Name());
+	writer.WriteString(package->InstallPath());
+	writer.WriteVersion(package->Version());
+	writer.Write((uint32)package->Architecture());
+
+	writer.Write((uint32)package->Resolvables().Count());
+	for (ResolvableList::ConstIterator it
+			= package->Resolvables().GetIterator();
+			Resolvable* resolvable = it.Next();) {
+		writer.WriteString(resolvable->Name());
+		writer.WriteVersion(resolvable->Version());
+		writer.WriteVersion(resolvable->CompatibleVersion());
+	}
+
+	writer.Write((uint32)package->Dependencies().Count());
+	for (DependencyList::ConstIterator it
+			= package->Dependencies().GetIterator();
+			Dependency* dependency = it.Next();) {
+		writer.WriteString(dependency->Name());
+		writer.Write((uint32)dependency->VersionOperator());
+		writer.WriteVersion(dependency->RequiredVersion());
+	}
+
+	writer.Write((uint32)package->Nodes().Size());
+	for (PackageNodeList::Iterator it = package->Nodes().GetIterator();
+			PackageNode* node = it.Next();) {
+		write_node(writer, node);
+	}
+}
+
+
+/*!	Reads \a count nodes into \a list. Since adding to a PackageNodeList
+	prepends, the nodes end up in reverse order.
+*/
+static status_t
+read_nodes(ContentReader& reader, Package* package, PackageDirectory* parent,
+	uint32 count, int32 depth, PackageNodeList& list)
+{
+	if (depth > kMaxNodeDepth)
+		RETURN_ERROR(B_BAD_DATA);
+
+	for (uint32 i = 0; i < count; i++) {
+		uint32 mode;
+		int64 modifiedTime;
+		int32 modifiedTimeNanoSeconds;
+		const char* name;
+		status_t error;
+		if ((error = reader.Read(mode)) != B_OK
+			|| (error = reader.Read(modifiedTime)) != B_OK
+			|| (error = reader.Read(modifiedTimeNanoSeconds)) != B_OK
+			|| (error = reader.ReadString(name)) != B_OK) {
+			RETURN_ERROR(error);
+		}
+
+		if (name == NULL)
+			RETURN_ERROR(B_BAD_DATA);
+
+		// create the node
+		PackageNode* node;
+		if (S_ISREG(mode)) {
+			BPackageData data;
+			error = reader.ReadData(data);
+			if (error != B_OK)
+				RETURN_ERROR(error);
+
+			node = new(std::nothrow) PackageFile(package, mode, data);
+		} else if (S_ISLNK(mode)) {
+			const char* path;
+			error = reader.ReadString(path);
+			if (error != B_OK)
+				RETURN_ERROR(error);
+			if (path == NULL)
+				RETURN_ERROR(B_BAD_DATA);
+
+			PackageSymlink* symlink = new(std::nothrow) PackageSymlink(
+				package, mode);
+			if (symlink == NULL)
+				RETURN_ERROR(B_NO_MEMORY);
+
+			error = symlink->SetSymlinkPath(path);
+			if (error != B_OK) {
+				delete symlink;
+				RETURN_ERROR(error);
+			}
+
+			node = symlink;
+		} else if (S_ISDIR(mode)) {
+			node = new(std::nothrow) PackageDirectory(package, mode);
+		} else
+			RETURN_ERROR(B_BAD_DATA);
+
+		if (node == NULL)
+			RETURN_ERROR(B_NO_MEMORY);
+		BReference<PackageNode> nodeReference(node, true);
+
+		error = node->Init(parent, name);
+		if (error != B_OK)
+			RETURN_ERROR(error);
+
+		timespec time;
+		time.tv_sec = modifiedTime;
+		time.tv_nsec = modifiedTimeNanoSeconds;
+		node->SetModifiedTime(time);
+
+		// attributes
+		uint32 attributeCount;
+		error = reader.Read(attributeCount);
+		if (error != B_OK)
+			RETURN_ERROR(error);
+
+		for (uint32 k = 0; k < attributeCount; k++) {
+			uint32 type;
+			const char* attributeName;
+			BPackageData data;
+			if ((error = reader.Read(type)) != B_OK
+				|| (error = reader.ReadString(attributeName)) != B_OK
+				|| (error = reader.ReadData(data)) != B_OK) {
+				RETURN_ERROR(error);
+			}
+
+			if (attributeName == NULL)
+				RETURN_ERROR(B_BAD_DATA);
+
+			PackageNodeAttribute* attribute = new(std::nothrow)
+				PackageNodeAttribute(type, data);
+			if (attribute == NULL)
+				RETURN_ERROR(B_NO_MEMORY);
+
+			error = attribute->Init(attributeName);
+			if (error != B_OK) {
+				delete attribute;
+				RETURN_ERROR(error);
+			}
+
+			node->AddAttribute(attribute);
+		}
+
+		// children
+		if (S_ISDIR(mode)) {
+			PackageDirectory* directory = static_cast<PackageDirectory*>(node);
+
+			uint32 childCount;
+			error = reader.Read(childCount);
+			if (error != B_OK)
+				RETURN_ERROR(error);
+
+			PackageNodeList children;
+			error = read_nodes(reader, package, directory, childCount,
+				depth + 1, children);
+
+			// adding them to the directory restores the original order
+			while (PackageNode* child = children.RemoveHead()) {
+				if (error == B_OK)
+					directory->AddChild(child);
+				child->ReleaseReference();
+			}
+
+			if (error != B_OK)
+				RETURN_ERROR(error);
+		}
+
+		list.Add(nodeReference.Detach());
+	}
+
+	return B_OK;
+}
+
+
+/*!	Reads the contents of a package. The package is only changed when all of
+	its contents could be read.
+*/
+static status_t
+read_package(ContentReader& reader, Package* package)
+{
+	const char* name;
+	const char* installPath;
+	Version* version;
+	uint32 architecture;
+	status_t error;
+	if ((error = reader.ReadString(name)) != B_OK
+		|| (error = reader.ReadString(installPath)) != B_OK
+		|| (error = reader.ReadVersion(version)) != B_OK) {
+		RETURN_ERROR(error);
+	}
+	ObjectDeleter<Version> versionDeleter(version);
+
+	error = reader.Read(architecture);
+	if (error != B_OK)
+		RETURN_ERROR(error);
+	if (architecture > B_PACKAGE_ARCHITECTURE_ENUM_COUNT)
+		RETURN_ERROR(B_BAD_DATA);
+
+	ResolvableList resolvables;
+	DependencyList dependencies;
+	PackageNodeList nodes;
+
+	// resolvables
+	uint32 count;
+	error = reader.Read(count);
+
+	for (uint32 i = 0; error == B_OK && i < count; i++) {
+		const char* resolvableName;
+		Version* resolvableVersion = NULL;
+		Version* compatibleVersion = NULL;
+		if ((error = reader.ReadString(resolvableName)) != B_OK
+			|| (error = reader.ReadVersion(resolvableVersion)) != B_OK
+			|| (error = reader.ReadVersion(compatibleVersion)) != B_OK
+			|| (error = resolvableName != NULL ? B_OK : B_BAD_DATA) != B_OK) {
+			delete resolvableVersion;
+			delete compatibleVersion;
+			break;
+		}
+
+		Resolvable* resolvable = new(std::nothrow) Resolvable(package);
+		if (resolvable == NULL) {
+			delete resolvableVersion;
+			delete compatibleVersion;
+			error = B_NO_MEMORY;
+			break;
+		}
+
+		resolvables.Add(resolvable);
+		error = resolvable->Init(resolvableName, resolvableVersion,
+			compatibleVersion);
+	}
+
+	// dependencies
+	if (error == B_OK)
+		error = reader.Read(count);
+
+	for (uint32 i = 0; error == B_OK && i < count; i++) {
+		const char* dependencyName;
+		uint32 op;
+		Version* requiredVersion = NULL;
+		if ((error = reader.ReadString(dependencyName)) != B_OK
+			|| (error = reader.Read(op)) != B_OK
+			|| (error = reader.ReadVersion(requiredVersion)) != B_OK
+			|| (error = dependencyName != NULL ? B_OK : B_BAD_DATA) != B_OK) {
+			delete requiredVersion;
+			break;
+		}
+
+		Dependency* dependency = new(std::nothrow) Dependency(package);
+		if (dependency == NULL) {
+			delete requiredVersion;
+			error = B_NO_MEMORY;
+			break;
+		}
+
+		dependencies.Add(dependency);
+		error = dependency->Init(dependencyName);
+		if (error != B_OK) {
+			delete requiredVersion;
+			break;
+		}
+
+		if (requiredVersion != NULL) {
+			dependency->SetVersionRequirement((BPackageResolvableOperator)op,
+				requiredVersion);
+		}
+	}
+
+	// nodes
+	if (error == B_OK)
+		error = reader.Read(count);
+	if (error == B_OK)
+		error = read_nodes(reader, package, NULL, count, 0, nodes);
+
+	if (error == B_OK && !reader.IsAtEnd())
+		error = B_BAD_DATA;
+
+	if (error == B_OK) {
+		error = package->SetName(name);
+		if (error == B_OK && installPath != NULL)
+			error = package->SetInstallPath(installPath);
+	}
+
+	if (error != B_OK) {
+		while (Resolvable* resolvable = resolvables.RemoveHead())
+			delete resolvable;
+		while (Dependency* dependency = dependencies.RemoveHead())
+			delete dependency;
+		while (PackageNode* node = nodes.RemoveHead())
+			node->ReleaseReference();
+		RETURN_ERROR(error);
+	}
+
+	// everything is fine -- hand the contents over to the package
+	package->SetVersion(versionDeleter.Detach());
+	package->SetArchitecture((BPackageArchitecture)architecture);
+
+	while (Resolvable* resolvable = resolvables.RemoveHead())
+		package->AddResolvable(resolvable);
+	while (Dependency* dependency = dependencies.RemoveHead())
+		package->AddDependency(dependency);
+	while (PackageNode* node = nodes.RemoveHead()) {
+		package->AddNode(node);
+		node->ReleaseReference();
+	}
+
+	return B_OK;
+}
+
+
+// #pragma mark - PackageContentCache
+
+
+PackageContentCache::PackageContentCache()
+	:
+	fFD(-1),
+	fEntries(NULL),
+	fEntryCount(0),
+	fLoadedPackages(0),
+	fFileSize(0)
+{
+}
+
+
+PackageContentCache::~PackageContentCache()
+{
+	free(fEntries);
+
+	if (fFD >= 0)
+		close(fFD);
+}
+
+
+/*!	Opens the content cache file in the given package domain directory, and
+	reads and validates its entry table.
+*/
+status_t
+PackageContentCache::Init(int directoryFD)
+{
+	fFD = openat(directoryFD, kContentCacheFileName, O_RDONLY);
+	if (fFD < 0)
+		return errno;
+
+	struct stat st;
+	if (fstat(fFD, &st) < 0)
+		RETURN_ERROR(errno);
+	fFileSize = st.st_size;
+
+	// read and check the header
+	package_content_cache_header header;
+	ssize_t bytesRead = read_pos(fFD, 0, &header, sizeof(header));
+	if (bytesRead != (ssize_t)sizeof(header)
+		|| header.magic != kContentCacheMagic
+		|| header.version != kContentCacheVersion
+		|| header.entry_count > kMaxContentCacheEntries
+		|| header.file_size != (uint64)fFileSize) {
+		RETURN_ERROR(B_BAD_DATA);
+	}
+
+	// read the entry table
+	size_t tableSize = header.entry_count * sizeof(package_content_cache_entry);
+	if (tableSize > 0) {
+		fEntries = (package_content_cache_entry*)malloc(tableSize);
+		if (fEntries == NULL)
+			RETURN_ERROR(B_NO_MEMORY);
+
+		bytesRead = read_pos(fFD, sizeof(header), fEntries, tableSize);
+		if (bytesRead != (ssize_t)tableSize)
+			RETURN_ERROR(B_BAD_DATA);
+	}
+
+	uint32 checksum = header.checksum;
+	header.checksum = 0;
+	uLong crc = crc32(0, (const Bytef*)&header, sizeof(header));
+	if (tableSize > 0)
+		crc = crc32(crc, (const Bytef*)fEntries, tableSize);
+	if (crc != checksum)
+		RETURN_ERROR(B_BAD_DATA);
+
+	for (uint32 i = 0; i < header.entry_count; i++) {
+		const package_content_cache_entry& entry = fEntries[i];
+		if (entry.data_offset > (uint64)fFileSize
+			|| entry.data_size > (uint64)fFileSize - entry.data_offset
+			|| entry.data_size > kMaxPackageContentSize
+			|| strnlen(entry.file_name, sizeof(entry.file_name))
+				== sizeof(entry.file_name)) {
+			RETURN_ERROR(B_BAD_DATA);
+		}
+	}
+
+	fEntryCount = header.entry_count;
+	return B_OK;
+}
+
+
+/*!	Fills in the contents of the given package from the cache, if the cache
+	has an entry for the very same package file.
+*/
+status_t
+PackageContentCache::LoadPackage(Package* package)
+{
+	const package_content_cache_entry* entry = _FindEntry(package->FileName());
+	if (entry == NULL)
+		return B_ENTRY_NOT_FOUND;
+
+	if (entry->node_id != package->NodeID()
+		|| entry->file_size != package->FileSize()
+		|| entry->modified_time != package->ModifiedTime().tv_sec
+		|| entry->modified_time_nsec != package->ModifiedTime().tv_nsec) {
+		return B_ENTRY_NOT_FOUND;
+	}
+
+	uint8* data = (uint8*)malloc(entry->data_size);
+	if (data == NULL)
+		RETURN_ERROR(B_NO_MEMORY);
+	MemoryDeleter dataDeleter(data);
+
+	ssize_t bytesRead = read_pos(fFD, entry->data_offset, data,
+		entry->data_size);
+	if (bytesRead != (ssize_t)entry->data_size
+		|| crc32(0, data, entry->data_size) != entry->data_checksum) {
+		RETURN_ERROR(B_BAD_DATA);
+	}
+
+	ContentReader reader(data, entry->data_size);
+	status_t error = read_package(reader, package);
+	if (error != B_OK)
+		RETURN_ERROR(error);
+
+	fLoadedPackages++;
+	return B_OK;
+}
+
+
+/*static*/ bool
+PackageContentCache::IsCacheFileName(const char* name)
+{
+	return strcmp(name, kContentCacheFileName) == 0
+		|| strcmp(name, kContentCacheTempFileName) == 0;
+}
+
+
+const package_content_cache_entry*
+PackageContentCache::_FindEntry(const char* fileName) const
+{
+	for (uint32 i = 0; i < fEntryCount; i++) {
+		if (strcmp(fEntries[i].file_name, fileName) == 0)
+			return &fEntries[i];
+	}
+
+	return NULL;
+}
+
+
+// #pragma mark - PackageContentCacheWriter
+
+
+struct PackageContentCacheWriter::Entry {
+	package_content_cache_entry	header;
+	uint8*						data;
+};
+
+
+PackageContentCacheWriter::PackageContentCacheWriter()
+	:
+	fEntries(NULL),
+	fEntryCount(0),
+	fEntryCapacity(0)
+{
+}
+
+
+PackageContentCacheWriter::~PackageContentCacheWriter()
+{
+	for (uint32 i = 0; i < fEntryCount; i++)
+		free(fEntries[i].data);
+	free(fEntries);
+}
+
+
+status_t
+PackageContentCacheWriter::AddPackage(Package* package)
+{
+	if (strlen(package->FileName()) >= B_FILE_NAME_LENGTH)
+		RETURN_ERROR(B_NAME_TOO_LONG);
+
+	if (fEntryCount == fEntryCapacity) {
+		uint32 capacity = fEntryCapacity > 0 ? fEntryCapacity * 2 : 64;
+		Entry* entries = (Entry*)realloc(fEntries, capacity * sizeof(Entry));
+		if (entries == NULL)
+			RETURN_ERROR(B_NO_MEMORY);
+
+		fEntries = entries;
+		fEntryCapacity = capacity;
+	}
+
+	ContentWriter writer;
+	write_package(writer, package);
+	if (writer.Error() != B_OK)
+		RETURN_ERROR(writer.Error());
+	if (writer.Size() > kMaxPackageContentSize)
+		RETURN_ERROR(B_BUFFER_OVERFLOW);
+
+	Entry& entry = fEntries[fEntryCount];
+	memset(&entry.header, 0, sizeof(entry.header));
+	entry.header.node_id = package->NodeID();
+	entry.header.file_size = package->FileSize();
+	entry.header.modified_time = package->ModifiedTime().tv_sec;
+	entry.header.modified_time_nsec = package->ModifiedTime().tv_nsec;
+	entry.header.data_size = writer.Size();
+	strlcpy(entry.header.file_name, package->FileName(),
+		sizeof(entry.header.file_name));
+
+	entry.data = writer.DetachBuffer();
+	entry.header.data_checksum = crc32(0, entry.data, entry.header.data_size);
+
+	fEntryCount++;
+	return B_OK;
+}
+
+
+/*!	Writes the cache file into the given package domain directory. The file
+	is written under a temporary name first, and then renamed, so that a
+	mount never sees a partially written cache.
+*/
+status_t
+PackageContentCacheWriter::Write(int directoryFD)
+{
+	int fd = openat(directoryFD, kContentCacheTempFileName,
+		O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		RETURN_ERROR(errno);
+	FileDescriptorCloser fdCloser(fd);
+
+	// write the package contents behind the header and the entry table
+	uint64 offset = sizeof(package_content_cache_header)
+		+ (uint64)fEntryCount * sizeof(package_content_cache_entry);
+	status_t error = B_OK;
+
+	for (uint32 i = 0; i < fEntryCount && error == B_OK; i++) {
+		Entry& entry = fEntries[i];
+		entry.header.data_offset = offset;
+
+		ssize_t written = write_pos(fd, offset, entry.data,
+			entry.header.data_size);
+		if (written != (ssize_t)entry.header.data_size)
+			error = written < 0 ? errno : B_IO_ERROR;
+
+		offset += entry.header.data_size;
+	}
+
+	// write the entry table and the header
+	package_content_cache_header header;
+	header.magic = kContentCacheMagic;
+	header.version = kContentCacheVersion;
+	header.entry_count = fEntryCount;
+	header.checksum = 0;
+	header.file_size = offset;
+
+	uLong crc = crc32(0, (const Bytef*)&header, sizeof(header));
+	offset = sizeof(header);
+
+	for (uint32 i = 0; i < fEntryCount && error == B_OK; i++) {
+		const package_content_cache_entry& entry = fEntries[i].header;
+		crc = crc32(crc, (const Bytef*)&entry, sizeof(entry));
+
+		ssize_t written = write_pos(fd, offset, &entry, sizeof(entry));
+		if (written != (ssize_t)sizeof(entry))
+			error = written < 0 ? errno : B_IO_ERROR;
+
+		offset += sizeof(entry);
+	}
+
+	if (error == B_OK) {
+		header.checksum = crc;
+		ssize_t written = write_pos(fd, 0, &header, sizeof(header));
+		if (written != (ssize_t)sizeof(header))
+			error = written < 0 ? errno : B_IO_ERROR;
+	}
+
+	if (error == B_OK && fsync(fd) < 0)
+		error = errno;
+
+	fdCloser.Unset();
+
+	if (error == B_OK) {
+		error = _kern_rename(directoryFD, kContentCacheTempFileName,
+			directoryFD, kContentCacheFileName);
+	}
+
+	if (error != B_OK) {
+		unlinkat(directoryFD, kContentCacheTempFileName, 0);
+		RETURN_ERROR(error);
+	}
+
+	return B_OK;
+}
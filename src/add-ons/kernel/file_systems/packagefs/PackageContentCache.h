@@ -0,0 +1,71 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef PACKAGE_CONTENT_CACHE_H
+#define PACKAGE_CONTENT_CACHE_H
+
+
+#include <SupportDefs.h>
+
+
+class Package;
+struct package_content_cache_entry;
+
+
+/*!	Gives access to the content cache file of a package domain. The file
+	contains the already parsed contents of the domain's packages -- their
+	node trees, attributes, and package info -- keyed by the identity of the
+	package file, so that unchanged packages don't have to be parsed again on
+	the next mount.
+*/
+class PackageContentCache {
+public:
+								PackageContentCache();
+								~PackageContentCache();
+
+			status_t			Init(int directoryFD);
+
+			status_t			LoadPackage(Package* package);
+
+			uint32				EntryCount() const	{ return fEntryCount; }
+			uint32				LoadedPackages() const
+									{ return fLoadedPackages; }
+
+	static	bool				IsCacheFileName(const char* name);
+
+private:
+			const package_content_cache_entry* _FindEntry(
+									const char* fileName) const;
+
+private:
+			int					fFD;
+			package_content_cache_entry* fEntries;
+			uint32				fEntryCount;
+			uint32				fLoadedPackages;
+			off_t				fFileSize;
+};
+
+
+/*!	Collects the contents of packages, and writes them to the content cache
+	file of a package domain.
+*/
+class PackageContentCacheWriter {
+public:
+								PackageContentCacheWriter();
+								~PackageContentCacheWriter();
+
+			status_t			AddPackage(Package* package);
+			status_t			Write(int directoryFD);
+
+private:
+			struct Entry;
+
+private:
+			Entry*				fEntries;
+			uint32				fEntryCount;
+			uint32				fEntryCapacity;
+};
+
+
+#endif	// PACKAGE_CONTENT_CACHE_H
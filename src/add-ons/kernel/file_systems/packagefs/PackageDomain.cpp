@@ -26,7 +26,8 @@ PackageDomain::PackageDomain(::Volume* volume)
 	fVolume(volume),
 	fPath(NULL),
 	fDirFD(-1),
-	fListener(NULL)
+	fListener(NULL),
+	fContentCache(NULL)
 {
 }
 
@@ -87,6 +88,10 @@ PackageDomain::Prepare(NotificationListener* listener)
 	fDeviceID = st.st_dev;
 	fNodeID = st.st_ino;
 
+	// without a listener the domain directory isn't watched
+	if (listener == NULL)
+		return B_OK;
+
 	status_t error = add_node_listener(fDeviceID, fNodeID, B_WATCH_DIRECTORY,
 		*listener);
 	if (error != B_OK)
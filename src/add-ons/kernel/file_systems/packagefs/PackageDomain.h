@@ -14,6 +14,7 @@
 
 
 class NotificationListener;
+class PackageContentCache;
 class Volume;
 
 
@@ -31,7 +32,8 @@ public:
 
 			status_t			Init(const char* path);
 			status_t			Prepare(NotificationListener* listener);
-									// takes over ownership of the listener
+									// takes over ownership of the listener,
+									// which may be NULL
 
 			void				AddPackage(Package* package);
 			void				RemovePackage(Package* package);
@@ -41,6 +43,13 @@ public:
 			const PackageFileNameHashTable& Packages() const
 									{ return fPackages; }
 
+			void				SetContentCache(PackageContentCache* cache)
+									{ fContentCache = cache; }
+			PackageContentCache* ContentCache() const
+									{ return fContentCache; }
+									// only set while the domain is being
+									// loaded
+
 private:
 			::Volume*			fVolume;
 			char*				fPath;
@@ -49,6 +58,7 @@ private:
 			ino_t				fNodeID;
 			NotificationListener* fListener;
 			PackageFileNameHashTable fPackages;
+			PackageContentCache* fContentCache;
 };
 
 
@@ -16,6 +16,8 @@
 #include <package/hpkg/DataReader.h>
 #include <package/hpkg/PackageDataReader.h>
 
+#include "ChunkCache.h"
+#include "ChunkInflater.h"
 #include "DebugSupport.h"
 #include "GlobalFactory.h"
 #include "Package.h"
@@ -24,6 +26,47 @@
 using namespace BPackageKit::BHPKG;
 
 
+// maximum size of chunks we keep in the chunk cache
+static const size_t kMaxCachedChunkSize = 256 * 1024;
+
+// maximum number of chunks handled at once, and maximum number of inflater
+// jobs they are distributed to
+static const uint32 kMaxBatchChunks = 16;
+static const int32 kMaxInflateJobs = 8;
+
+
+// #pragma mark - InflateChunksJob
+
+
+struct PackageFile::InflateChunksJob : ChunkInflater::Job {
+	InflateChunksJob()
+		:
+		fAccessor(NULL),
+		fChunks(NULL),
+		fCount(0),
+		fOwnReader(false)
+	{
+	}
+
+	void SetTo(DataAccessor* accessor, CachedChunk** chunks, uint32 count,
+		bool ownReader)
+	{
+		fAccessor = accessor;
+		fChunks = chunks;
+		fCount = count;
+		fOwnReader = ownReader;
+	}
+
+	virtual status_t Do();
+
+private:
+	DataAccessor*		fAccessor;
+	CachedChunk**		fChunks;
+	uint32				fCount;
+	bool				fOwnReader;
+};
+
+
 // #pragma mark - DataAccessor
 
 
@@ -51,16 +94,25 @@ struct PackageFile::DataAccessor {
 		fData(data),
 		fDataReader(NULL),
 		fReader(NULL),
-		fFileCache(NULL)
+		fFileCache(NULL),
+		fSpareReaderCount(0),
+		fUsesChunkCache(false)
 	{
 		mutex_init(&fLock, "file data accessor");
+		mutex_init(&fSpareReaderLock, "file data accessor readers");
 	}
 
 	~DataAccessor()
 	{
+		if (fUsesChunkCache)
+			GlobalFactory::Default()->GetChunkCache()->RemoveOwner(this);
+
 		file_cache_delete(fFileCache);
+		for (int32 i = 0; i < fSpareReaderCount; i++)
+			delete fSpareReaders[i];
 		delete fReader;
 		delete fDataReader;
+		mutex_destroy(&fSpareReaderLock);
 		mutex_destroy(&fLock);
 	}
 
@@ -113,6 +165,9 @@ struct PackageFile::DataAccessor {
 		size_t toRead = std::min((uint64)size,
 			fData->UncompressedSize() - offset);
 
+		if (toRead > 0 && _IsChunkCacheable())
+			return _ReadChunks(request, offset, toRead);
+
 		if (toRead > 0) {
 			IORequestOutput output(request);
 			MutexLocker locker(fLock);
@@ -124,15 +179,207 @@ struct PackageFile::DataAccessor {
 		return B_OK;
 	}
 
+	/*!	Uncompresses the given chunks. Since our own reader is not thread
+		safe, inflater jobs running on other threads use a reader of their
+		own. Those are kept around for the next jobs, so that every worker
+		does not need to set up a new one each time.
+	*/
+	status_t InflateChunks(CachedChunk** chunks, uint32 count,
+		bool ownReader)
+	{
+		BPackageDataReader* reader = fReader;
+		if (ownReader) {
+			status_t error = _GetSpareReader(reader);
+			if (error != B_OK)
+				RETURN_ERROR(error);
+		}
+
+		MutexLocker locker;
+		if (!ownReader)
+			locker.SetTo(&fLock, false);
+
+		status_t error = B_OK;
+		for (uint32 i = 0; i < count && error == B_OK; i++) {
+			CachedChunk* chunk = chunks[i];
+			error = reader->ReadData(chunk->Index() * reader->BlockSize(),
+				chunk->Data(), chunk->Size());
+		}
+
+		if (ownReader)
+			_PutSpareReader(reader);
+
+		RETURN_ERROR(error);
+	}
+
+private:
+	status_t _GetSpareReader(BPackageDataReader*& _reader)
+	{
+		MutexLocker locker(fSpareReaderLock);
+		if (fSpareReaderCount > 0) {
+			_reader = fSpareReaders[--fSpareReaderCount];
+			return B_OK;
+		}
+		locker.Unlock();
+
+		return GlobalFactory::Default()->CreatePackageDataReader(fDataReader,
+			*fData, _reader);
+	}
+
+	void _PutSpareReader(BPackageDataReader* reader)
+	{
+		MutexLocker locker(fSpareReaderLock);
+		if (fSpareReaderCount < kMaxInflateJobs) {
+			fSpareReaders[fSpareReaderCount++] = reader;
+			return;
+		}
+		locker.Unlock();
+
+		delete reader;
+	}
+
+	bool _IsChunkCacheable() const
+	{
+		return fData->Compression() == B_HPKG_COMPRESSION_ZLIB
+			&& fReader->BlockSize() <= kMaxCachedChunkSize;
+	}
+
+	status_t _ReadChunks(io_request* request, off_t offset, size_t size)
+	{
+		size_t chunkSize = fReader->BlockSize();
+		uint64 chunkIndex = offset / chunkSize;
+		size_t inChunkOffset = offset % chunkSize;
+
+		while (size > 0) {
+			uint32 chunkCount = std::min(
+				(uint64)(inChunkOffset + size + chunkSize - 1) / chunkSize,
+				(uint64)kMaxBatchChunks);
+
+			CachedChunk* chunks[kMaxBatchChunks];
+			status_t error = _GetChunks(chunkIndex, chunkCount, chunks);
+			if (error != B_OK)
+				RETURN_ERROR(error);
+
+			// copy the data to the request
+			for (uint32 i = 0; i < chunkCount; i++) {
+				size_t toCopy = std::min(size,
+					chunks[i]->Size() - inChunkOffset);
+				if (error == B_OK) {
+					error = write_to_io_request(request,
+						chunks[i]->Data() + inChunkOffset, toCopy);
+				}
+				chunks[i]->ReleaseReference();
+
+				size -= toCopy;
+				inChunkOffset = 0;
+			}
+
+			if (error != B_OK)
+				RETURN_ERROR(error);
+
+			chunkIndex += chunkCount;
+		}
+
+		return B_OK;
+	}
+
+	/*!	Gets references to the \a count chunks starting at \a firstIndex.
+		The ones not in the chunk cache yet are uncompressed -- in parallel,
+		if there are several of them -- and added to it.
+	*/
+	status_t _GetChunks(uint64 firstIndex, uint32 count, CachedChunk** chunks)
+	{
+		ChunkCache* cache = GlobalFactory::Default()->GetChunkCache();
+		size_t chunkSize = fReader->BlockSize();
+
+		CachedChunk* missingChunks[kMaxBatchChunks];
+		uint32 missingCount = 0;
+
+		for (uint32 i = 0; i < count; i++) {
+			uint64 index = firstIndex + i;
+			chunks[i] = cache->Lookup(this, index);
+			if (chunks[i] != NULL)
+				continue;
+
+			chunks[i] = CachedChunk::Create(this, index,
+				std::min((uint64)chunkSize,
+					fData->UncompressedSize() - index * chunkSize));
+			if (chunks[i] == NULL) {
+				_PutChunks(chunks, i);
+				RETURN_ERROR(B_NO_MEMORY);
+			}
+
+			missingChunks[missingCount++] = chunks[i];
+		}
+
+		if (missingCount == 0)
+			return B_OK;
+
+		// distribute the missing chunks to the inflater jobs -- the first one
+		// is done by this thread, using our own reader
+		ChunkInflater* inflater = GlobalFactory::Default()->GetChunkInflater();
+		int32 jobCount = std::min((int32)missingCount,
+			std::min(inflater->ThreadCount() + 1, kMaxInflateJobs));
+
+		InflateChunksJob jobs[kMaxInflateJobs];
+		ChunkInflater::Job* jobPointers[kMaxInflateJobs];
+		for (int32 i = 0; i < jobCount; i++) {
+			uint32 start = missingCount * i / jobCount;
+			uint32 end = missingCount * (i + 1) / jobCount;
+			jobs[i].SetTo(this, missingChunks + start, end - start, i > 0);
+			jobPointers[i] = &jobs[i];
+		}
+
+		status_t error = inflater->Run(jobPointers, jobCount);
+		if (error != B_OK) {
+			_PutChunks(chunks, count);
+			RETURN_ERROR(error);
+		}
+
+		// add the new chunks to the cache
+		MutexLocker locker(fLock);
+		fUsesChunkCache = true;
+		locker.Unlock();
+
+		for (uint32 i = 0; i < count; i++) {
+			for (uint32 k = 0; k < missingCount; k++) {
+				if (chunks[i] == missingChunks[k]) {
+					chunks[i] = cache->Insert(chunks[i]);
+					break;
+				}
+			}
+		}
+
+		return B_OK;
+	}
+
+	void _PutChunks(CachedChunk** chunks, uint32 count)
+	{
+		for (uint32 i = 0; i < count; i++)
+			chunks[i]->ReleaseReference();
+	}
+
 private:
 	mutex				fLock;
 	BPackageData*		fData;
 	BDataReader*			fDataReader;
 	BPackageDataReader*	fReader;
 	void*				fFileCache;
+	mutex				fSpareReaderLock;
+	BPackageDataReader*	fSpareReaders[kMaxInflateJobs];
+	int32				fSpareReaderCount;
+	bool				fUsesChunkCache;
 };
 
 
+status_t
+PackageFile::InflateChunksJob::Do()
+{
+	return fAccessor->InflateChunks(fChunks, fCount, fOwnReader);
+}
+
+
+
+
 // #pragma mark - PackageFile
 
 
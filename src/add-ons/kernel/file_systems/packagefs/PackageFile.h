@@ -25,6 +25,8 @@ public:
 
 	virtual	off_t				FileSize() const;
 
+			const BPackageData&	Data() const	{ return fData; }
+
 	virtual	status_t			Read(off_t offset, void* buffer,
 									size_t* bufferSize);
 	virtual	status_t			Read(io_request* request);
@@ -32,6 +34,7 @@ public:
 private:
 			struct IORequestOutput;
 			struct DataAccessor;
+			struct InflateChunksJob;
 
 private:
 			BPackageData		fData;
@@ -34,6 +34,12 @@ public:
 									// returns how big the buffer should have
 									// been (excluding the terminating null)
 
+			const char*			Major() const		{ return fMajor; }
+			const char*			Minor() const		{ return fMinor; }
+			const char*			Micro() const		{ return fMicro; }
+			const char*			PreRelease() const	{ return fPreRelease; }
+			uint8				Release() const		{ return fRelease; }
+
 private:
 			char*				fMajor;
 			char*				fMinor;
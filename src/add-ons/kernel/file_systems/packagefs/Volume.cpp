@@ -18,17 +18,13 @@
 #include <driver_settings.h>
 #include <KernelExport.h>
 #include <NodeMonitor.h>
-#include <package/PackageInfoAttributes.h>
 
 #include <AutoDeleter.h>
 
 #include <Notifications.h>
 #include <vfs.h>
 
-#include <package/hpkg/ErrorOutput.h>
-#include <package/hpkg/PackageEntry.h>
-#include <package/hpkg/PackageEntryAttribute.h>
-#include <package/hpkg/PackageReaderImpl.h>
+#include <package/hpkg/HPKGDefs.h>
 
 #include "AttributeIndex.h"
 #include "DebugSupport.h"
@@ -36,23 +32,21 @@
 #include "LastModifiedIndex.h"
 #include "NameIndex.h"
 #include "OldUnpackingNodeAttributes.h"
+#include "PackageContentCache.h"
 #include "PackageDirectory.h"
 #include "PackageFile.h"
 #include "PackageFSRoot.h"
 #include "PackageLinkDirectory.h"
 #include "PackageLinksDirectory.h"
-#include "PackageSymlink.h"
 #include "Resolvable.h"
 #include "SizeIndex.h"
 #include "UnpackingLeafNode.h"
 #include "UnpackingDirectory.h"
 #include "Utils.h"
-#include "Version.h"
 
 
 using namespace BPackageKit;
 using namespace BPackageKit::BHPKG;
-using BPackageKit::BHPKG::BPrivate::PackageReaderImpl;
 
 
 // node ID of the root directory
@@ -156,261 +150,30 @@ private:
 };
 
 
-// #pragma mark - PackageLoaderErrorOutput
+// #pragma mark - WriteContentCacheJob
 
 
-struct Volume::PackageLoaderErrorOutput : BErrorOutput {
-	PackageLoaderErrorOutput(Package* package)
+struct Volume::WriteContentCacheJob : Job {
+	WriteContentCacheJob(Volume* volume, PackageDomain* domain)
 		:
-		fPackage(package)
-	{
-	}
-
-	virtual void PrintErrorVarArgs(const char* format, va_list args)
-	{
-// TODO:...
-	}
-
-private:
-	Package*	fPackage;
-};
-
-
-// #pragma mark - PackageLoaderContentHandler
-
-
-struct Volume::PackageLoaderContentHandler : BPackageContentHandler {
-	PackageLoaderContentHandler(Package* package)
-		:
-		fPackage(package),
-		fErrorOccurred(false)
-	{
-	}
-
-	status_t Init()
-	{
-		return B_OK;
-	}
-
-	virtual status_t HandleEntry(BPackageEntry* entry)
-	{
-		if (fErrorOccurred)
-			return B_OK;
-
-		PackageDirectory* parentDir = NULL;
-		if (entry->Parent() != NULL) {
-			parentDir = dynamic_cast<PackageDirectory*>(
-				(PackageNode*)entry->Parent()->UserToken());
-			if (parentDir == NULL)
-				RETURN_ERROR(B_BAD_DATA);
-		}
-
-		status_t error;
-
-		// get the file mode -- filter out write permissions
-		mode_t mode = entry->Mode() & ~(mode_t)(S_IWUSR | S_IWGRP | S_IWOTH);
-
-		// create the package node
-		PackageNode* node;
-		if (S_ISREG(mode)) {
-			// file
-			node = new(std::nothrow) PackageFile(fPackage, mode, entry->Data());
-		} else if (S_ISLNK(mode)) {
-			// symlink
-			PackageSymlink* symlink = new(std::nothrow) PackageSymlink(
-				fPackage, mode);
-			if (symlink == NULL)
-				RETURN_ERROR(B_NO_MEMORY);
-
-			error = symlink->SetSymlinkPath(entry->SymlinkPath());
-			if (error != B_OK) {
-				delete symlink;
-				return error;
-			}
-
-			node = symlink;
-		} else if (S_ISDIR(mode)) {
-			// directory
-			node = new(std::nothrow) PackageDirectory(fPackage, mode);
-		} else
-			RETURN_ERROR(B_BAD_DATA);
-
-		if (node == NULL)
-			RETURN_ERROR(B_NO_MEMORY);
-		BReference<PackageNode> nodeReference(node, true);
-
-		error = node->Init(parentDir, entry->Name());
-		if (error != B_OK)
-			RETURN_ERROR(error);
-
-		node->SetModifiedTime(entry->ModifiedTime());
-
-		// add it to the parent directory
-		if (parentDir != NULL)
-			parentDir->AddChild(node);
-		else
-			fPackage->AddNode(node);
-
-		entry->SetUserToken(node);
-
-		return B_OK;
-	}
-
-	virtual status_t HandleEntryAttribute(BPackageEntry* entry,
-		BPackageEntryAttribute* attribute)
-	{
-		if (fErrorOccurred)
-			return B_OK;
-
-		PackageNode* node = (PackageNode*)entry->UserToken();
-
-		PackageNodeAttribute* nodeAttribute = new(std::nothrow)
-			PackageNodeAttribute(attribute->Type(), attribute->Data());
-		if (nodeAttribute == NULL)
-			RETURN_ERROR(B_NO_MEMORY)
-
-		status_t error = nodeAttribute->Init(attribute->Name());
-		if (error != B_OK) {
-			delete nodeAttribute;
-			RETURN_ERROR(error);
-		}
-
-		node->AddAttribute(nodeAttribute);
-
-		return B_OK;
-	}
-
-	virtual status_t HandleEntryDone(BPackageEntry* entry)
+		Job(volume),
+		fDomain(domain)
 	{
-		return B_OK;
+		fDomain->AcquireReference();
 	}
 
-	virtual status_t HandlePackageAttribute(
-		const BPackageInfoAttributeValue& value)
+	virtual ~WriteContentCacheJob()
 	{
-		switch (value.attributeID) {
-			case B_PACKAGE_INFO_NAME:
-				return fPackage->SetName(value.string);
-
-			case B_PACKAGE_INFO_INSTALL_PATH:
-				return fPackage->SetInstallPath(value.string);
-
-			case B_PACKAGE_INFO_VERSION:
-			{
-				Version* version;
-				status_t error = Version::Create(value.version.major,
-					value.version.minor, value.version.micro,
-					value.version.preRelease, value.version.release, version);
-				if (error != B_OK)
-					RETURN_ERROR(error);
-
-				fPackage->SetVersion(version);
-
-				break;
-			}
-
-			case B_PACKAGE_INFO_ARCHITECTURE:
-				if (value.unsignedInt >= B_PACKAGE_ARCHITECTURE_ENUM_COUNT)
-					RETURN_ERROR(B_BAD_VALUE);
-
-				fPackage->SetArchitecture(
-					(BPackageArchitecture)value.unsignedInt);
-				break;
-
-			case B_PACKAGE_INFO_PROVIDES:
-			{
-				// create a version object, if a version is specified
-				Version* version = NULL;
-				if (value.resolvable.haveVersion) {
-					const BPackageVersionData& versionInfo
-						= value.resolvable.version;
-					status_t error = Version::Create(versionInfo.major,
-						versionInfo.minor, versionInfo.micro,
-						versionInfo.preRelease, versionInfo.release, version);
-					if (error != B_OK)
-						RETURN_ERROR(error);
-				}
-				ObjectDeleter<Version> versionDeleter(version);
-
-				// create a version object, if a compatible version is specified
-				Version* compatibleVersion = NULL;
-				if (value.resolvable.haveCompatibleVersion) {
-					const BPackageVersionData& versionInfo
-						= value.resolvable.compatibleVersion;
-					status_t error = Version::Create(versionInfo.major,
-						versionInfo.minor, versionInfo.micro,
-						versionInfo.preRelease, versionInfo.release,
-						compatibleVersion);
-					if (error != B_OK)
-						RETURN_ERROR(error);
-				}
-				ObjectDeleter<Version> compatibleVersionDeleter(
-					compatibleVersion);
-
-				// create the resolvable
-				Resolvable* resolvable = new(std::nothrow) Resolvable(fPackage);
-				if (resolvable == NULL)
-					RETURN_ERROR(B_NO_MEMORY);
-				ObjectDeleter<Resolvable> resolvableDeleter(resolvable);
-
-				status_t error = resolvable->Init(value.resolvable.name,
-					versionDeleter.Detach(), compatibleVersionDeleter.Detach());
-				if (error != B_OK)
-					RETURN_ERROR(error);
-
-				fPackage->AddResolvable(resolvableDeleter.Detach());
-
-				break;
-			}
-
-			case B_PACKAGE_INFO_REQUIRES:
-			{
-				// create the dependency
-				Dependency* dependency = new(std::nothrow) Dependency(fPackage);
-				if (dependency == NULL)
-					RETURN_ERROR(B_NO_MEMORY);
-				ObjectDeleter<Dependency> dependencyDeleter(dependency);
-
-				status_t error = dependency->Init(
-					value.resolvableExpression.name);
-				if (error != B_OK)
-					RETURN_ERROR(error);
-
-				// create a version object, if a version is specified
-				Version* version = NULL;
-				if (value.resolvableExpression.haveOpAndVersion) {
-					const BPackageVersionData& versionInfo
-						= value.resolvableExpression.version;
-					status_t error = Version::Create(versionInfo.major,
-						versionInfo.minor, versionInfo.micro,
-						versionInfo.preRelease, versionInfo.release, version);
-					if (error != B_OK)
-						RETURN_ERROR(error);
-
-					dependency->SetVersionRequirement(
-						value.resolvableExpression.op, version);
-				}
-
-				fPackage->AddDependency(dependencyDeleter.Detach());
-
-				break;
-			}
-
-			default:
-				break;
-		}
-
-		return B_OK;
+		fDomain->ReleaseReference();
 	}
 
-	virtual void HandleErrorOccurred()
+	virtual void Do()
 	{
-		fErrorOccurred = true;
+		fVolume->_WriteContentCache(fDomain);
 	}
 
 private:
-	Package*	fPackage;
-	bool		fErrorOccurred;
+	PackageDomain*	fDomain;
 };
 
 
@@ -968,6 +731,13 @@ Volume::_AddPackageDomain(PackageDomain* domain, bool notify)
 	}
 	CObjectDeleter<DIR, int> dirCloser(dir, closedir);
 
+	// Packages that didn't change since the domain's content cache was
+	// written, don't need to be parsed again.
+	bigtime_t startTime = system_time();
+	PackageContentCache contentCache;
+	if (contentCache.Init(domain->DirectoryFD()) == B_OK)
+		domain->SetContentCache(&contentCache);
+
 	while (dirent* entry = readdir(dir)) {
 		// skip "." and ".."
 		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
@@ -978,6 +748,13 @@ Volume::_AddPackageDomain(PackageDomain* domain, bool notify)
 // TODO: -1 node ID?
 	}
 
+	domain->SetContentCache(NULL);
+
+	uint32 packageCount = domain->Packages().CountElements();
+	INFORM("loaded %" B_PRIu32 " packages from \"%s\" in %" B_PRId64 " ms, "
+		"%" B_PRIu32 " from the content cache\n", packageCount, domain->Path(),
+		(system_time() - startTime) / 1000, contentCache.LoadedPackages());
+
 	// add the packages to the node tree
 	VolumeWriteLocker systemVolumeLocker(_SystemVolumeIfNotSelf());
 	VolumeWriteLocker volumeLocker(this);
@@ -997,6 +774,15 @@ Volume::_AddPackageDomain(PackageDomain* domain, bool notify)
 	fPackageDomains.Add(domain);
 	domain->AcquireReference();
 
+	// update the content cache, if it doesn't match the packages anymore
+	if (contentCache.LoadedPackages() != packageCount
+		|| contentCache.EntryCount() != packageCount) {
+		WriteContentCacheJob* job = new(std::nothrow) WriteContentCacheJob(
+			this, domain);
+		if (job != NULL)
+			_PushJob(job);
+	}
+
 	return B_OK;
 }
 
@@ -1021,30 +807,34 @@ Volume::_RemovePackageDomain(PackageDomain* domain)
 status_t
 Volume::_LoadPackage(Package* package)
 {
-	// open package file
-	int fd = package->Open();
-	if (fd < 0)
-		RETURN_ERROR(fd);
-	PackageCloser packageCloser(package);
-
-	// initialize package reader
-	PackageLoaderErrorOutput errorOutput(package);
-	PackageReaderImpl packageReader(&errorOutput);
-	status_t error = packageReader.Init(fd, false);
-	if (error != B_OK)
-		RETURN_ERROR(error);
+	// try the content cache of the package's domain first
+	PackageContentCache* contentCache = package->Domain()->ContentCache();
+	if (contentCache != NULL && contentCache->LoadPackage(package) == B_OK)
+		return B_OK;
 
-	// parse content
-	PackageLoaderContentHandler handler(package);
-	error = handler.Init();
-	if (error != B_OK)
-		RETURN_ERROR(error);
+	return package->Load();
+}
 
-	error = packageReader.ParseContent(&handler);
-	if (error != B_OK)
-		RETURN_ERROR(error);
 
-	return B_OK;
+void
+Volume::_WriteContentCache(PackageDomain* domain)
+{
+	PackageContentCacheWriter writer;
+
+	VolumeReadLocker volumeLocker(this);
+	for (PackageFileNameHashTable::Iterator it
+			= domain->Packages().GetIterator(); Package* package = it.Next();) {
+		status_t error = writer.AddPackage(package);
+		if (error != B_OK)
+			return;
+	}
+	volumeLocker.Unlock();
+
+	status_t error = writer.Write(domain->DirectoryFD());
+	if (error != B_OK) {
+		INFORM("failed to write the content cache of \"%s\": %s\n",
+			domain->Path(), strerror(error));
+	}
 }
 
 
@@ -1592,6 +1382,10 @@ Volume::_DomainEntryCreated(PackageDomain* domain, dev_t deviceID,
 		return;
 	}
 
+	// ignore the domain's content cache
+	if (PackageContentCache::IsCacheFileName(name))
+		return;
+
 	// check whether the entry is a file
 	struct stat st;
 	if (fstatat(domain->DirectoryFD(), name, &st, 0) < 0
@@ -1609,6 +1403,8 @@ Volume::_DomainEntryCreated(PackageDomain* domain, dev_t deviceID,
 	if (error != B_OK)
 		return;
 
+	package->SetFileInfo(st.st_size, st.st_mtim);
+
 	error = _LoadPackage(package);
 	if (error != B_OK)
 		return;
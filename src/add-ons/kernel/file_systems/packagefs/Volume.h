@@ -108,13 +108,13 @@ private:
 			struct Job;
 			struct AddPackageDomainJob;
 			struct DomainDirectoryEventJob;
-			struct PackageLoaderErrorOutput;
-			struct PackageLoaderContentHandler;
+			struct WriteContentCacheJob;
 			struct DomainDirectoryListener;
 			struct ShineThroughDirectory;
 
 			friend struct AddPackageDomainJob;
 			friend struct DomainDirectoryEventJob;
+			friend struct WriteContentCacheJob;
 			friend struct DomainDirectoryListener;
 
 			typedef DoublyLinkedList<Job> JobList;
@@ -133,6 +133,7 @@ private:
 									bool notify);
 			void				_RemovePackageDomain(PackageDomain* domain);
 			status_t			_LoadPackage(Package* package);
+			void				_WriteContentCache(PackageDomain* domain);
 
 			status_t			_AddPackageContent(Package* package,
 									bool notify);
@@ -589,6 +589,28 @@ reassemble_fragments(const ipv4_header &header, net_buffer** _buffer)
 }
 
 
+/*!	Returns the length of the IP and TCP headers of the TCP segment in
+	\a buffer.
+*/
+static uint32
+segment_header_length(net_buffer* buffer)
+{
+	NetBufferHeaderReader<ipv4_header> header(buffer);
+	if (header.Status() != B_OK)
+		return buffer->size;
+
+	uint32 ipHeaderLength = header->HeaderLength();
+
+	// the TCP data offset is in the upper 4 bits of the 13th header byte
+	uint8 dataOffset;
+	if (gBufferModule->read(buffer, ipHeaderLength + 12, &dataOffset, 1)
+			!= B_OK)
+		return buffer->size;
+
+	return ipHeaderLength + ((dataOffset >> 4) << 2);
+}
+
+
 /*!	Fragments the incoming buffer and send all fragments via the specified
 	\a route.
 */
@@ -1399,7 +1421,14 @@ ipv4_send_routed_data(net_protocol* _protocol, struct net_route* route,
 		header->header_length = sizeof(ipv4_header) / 4;
 		header->service_type = protocol ? protocol->service_type : 0;
 		header->total_length = htons(buffer->size);
-		header->id = htons(atomic_add(&sPacketID, 1));
+
+		// reserve an ID for each segment of a TCP super-segment
+		int32 packetCount = 1;
+		if (buffer->segment_size != 0) {
+			packetCount = (buffer->size + buffer->segment_size - 1)
+				/ buffer->segment_size;
+		}
+		header->id = htons(atomic_add(&sPacketID, packetCount));
 		header->fragment_offset = 0;
 		if (protocol) {
 			header->time_to_live = (buffer->flags & MSG_MCAST) != 0
@@ -1451,7 +1480,15 @@ ipv4_send_routed_data(net_protocol* _protocol, struct net_route* route,
 
 	uint32 mtu = route->mtu ? route->mtu : interface->mtu;
 	if (buffer->size > mtu) {
+		if (buffer->segment_size != 0
+			&& segment_header_length(buffer) + buffer->segment_size <= mtu) {
+			// this is a TCP super-segment; it will be split into segments
+			// that fit the MTU before it reaches the device
+			return sDatalinkModule->send_routed_data(route, buffer);
+		}
+
 		// we need to fragment the packet
+		buffer->segment_size = 0;
 		return send_fragments(protocol, route, buffer, mtu);
 	}
 
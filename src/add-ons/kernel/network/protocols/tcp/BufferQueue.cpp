@@ -9,6 +9,8 @@
 
 #include "BufferQueue.h"
 
+#include <string.h>
+
 #include <KernelExport.h>
 
 
@@ -427,6 +429,62 @@ BufferQueue::Available(tcp_sequence sequence) const
 }
 
 
+/*!	Fills \a sacks with the blocks of data that have been received out of
+	order, as described in RFC 2018. The block containing \a sequence, ie.
+	the one that was received last, is reported first, the others follow in
+	ascending order as long as there is room for them.
+	Returns the number of SACK blocks.
+*/
+int
+BufferQueue::PopulateSackInfo(tcp_sequence sequence, int maxSackCount,
+	tcp_sack* sacks) const
+{
+	tcp_sequence next = NextSequence();
+	tcp_sequence start = 0;
+	tcp_sequence end = 0;
+	bool inBlock = false;
+	int sackCount = 0;
+
+	SegmentList::ConstIterator iterator = fList.GetIterator();
+	while (true) {
+		net_buffer* buffer = iterator.Next();
+		if (buffer != NULL) {
+			if (tcp_sequence(buffer->sequence + buffer->size) <= next)
+				continue;
+
+			if (inBlock && end == buffer->sequence) {
+				end += buffer->size;
+				continue;
+			}
+		}
+
+		if (inBlock) {
+			if (start <= sequence && sequence < end) {
+				// the most recent block goes first
+				int count = min_c(sackCount, maxSackCount - 1);
+				memmove(&sacks[1], &sacks[0], count * sizeof(tcp_sack));
+				sacks[0].left_edge = start.Number();
+				sacks[0].right_edge = end.Number();
+				sackCount = count + 1;
+			} else if (sackCount < maxSackCount) {
+				sacks[sackCount].left_edge = start.Number();
+				sacks[sackCount].right_edge = end.Number();
+				sackCount++;
+			}
+		}
+
+		if (buffer == NULL)
+			break;
+
+		start = buffer->sequence;
+		end = start + buffer->size;
+		inBlock = true;
+	}
+
+	return sackCount;
+}
+
+
 void
 BufferQueue::SetPushPointer()
 {
@@ -39,6 +39,8 @@ public:
 
 			size_t				Available() const { return fContiguousBytes; }
 			size_t				Available(tcp_sequence sequence) const;
+			int					PopulateSackInfo(tcp_sequence sequence,
+									int maxSackCount, tcp_sack* sacks) const;
 
 	inline	size_t				PushedData() const;
 			void				SetPushPointer();
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "CongestionControl.h"
+
+#include <limits.h>
+#include <new>
+#include <string.h>
+
+#include "CubicCongestionControl.h"
+#include "NewRenoCongestionControl.h"
+#include "tcp.h"
+
+
+// References:
+//	- RFC 5681 - TCP Congestion Control
+//	- RFC 6582 - The NewReno Modification to TCP's Fast Recovery Algorithm
+//	- RFC 6928 - Increasing TCP's Initial Window
+
+static const uint32 kMaxCongestionWindow
+	= (uint32)TCP_MAX_WINDOW << TCP_MAX_WINDOW_SHIFT;
+
+
+template<typename Algorithm>
+static CongestionControl*
+create_algorithm()
+{
+	return new(std::nothrow) Algorithm;
+}
+
+
+struct congestion_control_info {
+	const char*			name;
+	CongestionControl*	(*create)();
+};
+
+static const congestion_control_info kAlgorithms[] = {
+	{"cubic", &create_algorithm<CubicCongestionControl>},
+	{"newreno", &create_algorithm<NewRenoCongestionControl>},
+};
+
+static const int32 kAlgorithmCount
+	= sizeof(kAlgorithms) / sizeof(kAlgorithms[0]);
+
+
+CongestionControl::CongestionControl()
+	:
+	fMaxSegmentSize(TCP_DEFAULT_MAX_SEGMENT_SIZE),
+	fCongestionWindow(0),
+	fSlowStartThreshold(UINT_MAX),
+	fAcknowledgedBytes(0)
+{
+}
+
+
+CongestionControl::~CongestionControl()
+{
+}
+
+
+/*!	Called when the connection has been established. The initial window is
+	chosen according to RFC 6928, and the slow start threshold is set
+	arbitrarily high, as RFC 5681 recommends.
+*/
+void
+CongestionControl::Start(uint32 maxSegmentSize)
+{
+	fMaxSegmentSize = maxSegmentSize;
+	fCongestionWindow = min_c(10 * maxSegmentSize,
+		max_c(2 * maxSegmentSize, 14600));
+	fSlowStartThreshold = UINT_MAX;
+	fAcknowledgedBytes = 0;
+}
+
+
+/*!	Continues with the state of \a other; this is used when the algorithm of
+	a connection is changed.
+*/
+void
+CongestionControl::TakeOver(const CongestionControl& other)
+{
+	fMaxSegmentSize = other.fMaxSegmentSize;
+	fCongestionWindow = other.fCongestionWindow;
+	fSlowStartThreshold = other.fSlowStartThreshold;
+	fAcknowledgedBytes = 0;
+}
+
+
+/*!	Called when loss recovery has been completed. The window is reduced to
+	the slow start threshold, but not to more than the data still in flight
+	allows to send without causing a burst (RFC 6582, 3.2 step 3).
+*/
+void
+CongestionControl::ExitRecovery(uint32 flightSize)
+{
+	fCongestionWindow = min_c(fSlowStartThreshold,
+		max_c(flightSize, fMaxSegmentSize) + fMaxSegmentSize);
+	fAcknowledgedBytes = 0;
+}
+
+
+/*!	Artificially inflates the window during NewReno fast recovery for each
+	segment that has left the network.
+*/
+void
+CongestionControl::InflateWindow(uint32 bytes)
+{
+	_IncreaseWindow(bytes);
+}
+
+
+void
+CongestionControl::DeflateWindow(uint32 bytes)
+{
+	if (fCongestionWindow > bytes + fMaxSegmentSize)
+		fCongestionWindow -= bytes;
+	else
+		fCongestionWindow = fMaxSegmentSize;
+}
+
+
+/*!	Opens the window by the number of bytes acknowledged, but by no more
+	than two segments per acknowledgement (RFC 3465).
+*/
+void
+CongestionControl::_SlowStart(uint32 bytes)
+{
+	_IncreaseWindow(min_c(bytes, 2 * fMaxSegmentSize));
+}
+
+
+void
+CongestionControl::_IncreaseWindow(uint32 bytes)
+{
+	if (fCongestionWindow + bytes > kMaxCongestionWindow
+		|| fCongestionWindow + bytes < fCongestionWindow)
+		fCongestionWindow = kMaxCongestionWindow;
+	else
+		fCongestionWindow += bytes;
+}
+
+
+//	#pragma mark -
+
+
+/*!	Creates the congestion control algorithm with the given \a name, or the
+	default algorithm if \a name is \c NULL.
+	Returns \c NULL if there is no such algorithm, or if there is not enough
+	memory.
+*/
+CongestionControl*
+create_congestion_control(const char* name)
+{
+	if (name == NULL)
+		return kAlgorithms[0].create();
+
+	for (int32 i = 0; i < kAlgorithmCount; i++) {
+		if (strcmp(kAlgorithms[i].name, name) == 0)
+			return kAlgorithms[i].create();
+	}
+
+	return NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+
+#include <OS.h>
+
+
+/*!	Base class of the congestion control algorithms a TCPEndpoint can use.
+	The endpoint takes care of loss detection and recovery; it informs the
+	algorithm about acknowledged data and congestion events, and only ever
+	asks it for the congestion window to use.
+*/
+class CongestionControl {
+public:
+								CongestionControl();
+	virtual						~CongestionControl();
+
+	virtual	const char*			Name() const = 0;
+
+	virtual	void				Start(uint32 maxSegmentSize);
+			void				TakeOver(const CongestionControl& other);
+
+	virtual	void				Acknowledged(uint32 bytes,
+									bigtime_t roundTripTime) = 0;
+	virtual	void				EnterRecovery(uint32 flightSize) = 0;
+	virtual	void				ExitRecovery(uint32 flightSize);
+	virtual	void				RetransmitTimeout(uint32 flightSize) = 0;
+
+			void				InflateWindow(uint32 bytes);
+			void				DeflateWindow(uint32 bytes);
+
+			uint32				CongestionWindow() const
+									{ return fCongestionWindow; }
+			uint32				SlowStartThreshold() const
+									{ return fSlowStartThreshold; }
+			bool				InSlowStart() const
+									{ return fCongestionWindow
+										< fSlowStartThreshold; }
+
+protected:
+			void				_SlowStart(uint32 bytes);
+			void				_IncreaseWindow(uint32 bytes);
+
+protected:
+			uint32				fMaxSegmentSize;
+			uint32				fCongestionWindow;
+			uint32				fSlowStartThreshold;
+			uint32				fAcknowledgedBytes;
+};
+
+
+CongestionControl* create_congestion_control(const char* name);
+
+
+#endif	// CONGESTION_CONTROL_H
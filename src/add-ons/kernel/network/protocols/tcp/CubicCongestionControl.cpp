@@ -0,0 +1,186 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "CubicCongestionControl.h"
+
+
+// References:
+//	- RFC 8312 - CUBIC for Fast Long-Distance Networks
+//
+// Since we cannot use floating point in the kernel, the constants C = 0.4
+// and beta = 0.7 are folded into the integer computations below. Times are
+// computed in milliseconds, windows in bytes.
+
+static const int64 kMaxTimeOffset = 65536;
+	// in msecs; keeps the cube of the offset from overflowing
+
+
+static uint64
+cube_root(uint64 value)
+{
+	// binary search; the result is never larger than 2^21 - 1
+	uint64 low = 0;
+	uint64 high = 1 << 21;
+
+	while (high - low > 1) {
+		uint64 mid = (low + high) / 2;
+		if (mid * mid * mid <= value)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+
+//	#pragma mark -
+
+
+CubicCongestionControl::CubicCongestionControl()
+	:
+	fMaxWindow(0),
+	fOriginWindow(0),
+	fEstimatedWindow(0),
+	fEpochStart(0),
+	fTimeToOrigin(0)
+{
+}
+
+
+const char*
+CubicCongestionControl::Name() const
+{
+	return "cubic";
+}
+
+
+void
+CubicCongestionControl::Start(uint32 maxSegmentSize)
+{
+	CongestionControl::Start(maxSegmentSize);
+
+	fMaxWindow = 0;
+	fEpochStart = 0;
+}
+
+
+void
+CubicCongestionControl::Acknowledged(uint32 bytes, bigtime_t roundTripTime)
+{
+	if (InSlowStart()) {
+		_SlowStart(bytes);
+		return;
+	}
+
+	if (fEpochStart == 0) {
+		// this is the first acknowledgement in congestion avoidance after a
+		// congestion event
+		fEpochStart = system_time();
+		fAcknowledgedBytes = 0;
+		fEstimatedWindow = fCongestionWindow;
+
+		if (fCongestionWindow < fMaxWindow) {
+			// K = cubic_root(W_max * (1 - beta) / C), in msecs
+			uint64 difference = fMaxWindow - fCongestionWindow;
+			fTimeToOrigin = cube_root(difference * 1000 / fMaxSegmentSize
+				* 2500000);
+			fOriginWindow = fMaxWindow;
+		} else {
+			fTimeToOrigin = 0;
+			fOriginWindow = fCongestionWindow;
+		}
+	}
+
+	fAcknowledgedBytes += bytes;
+
+	// the window standard TCP would have reached by now: it grows by
+	// 3 * (1 - beta) / (1 + beta) segments per window of acknowledged data
+	fEstimatedWindow += (uint64)bytes * fMaxSegmentSize * 9
+		/ (17 * (uint64)fCongestionWindow);
+
+	uint32 target = _Target(roundTripTime);
+	if (target < fEstimatedWindow) {
+		// we are in the TCP-friendly region
+		target = fEstimatedWindow;
+	}
+
+	if (target > fCongestionWindow) {
+		uint32 increase = (uint64)(target - fCongestionWindow)
+			* fAcknowledgedBytes / fCongestionWindow;
+		if (increase > 0) {
+			_IncreaseWindow(increase);
+			fAcknowledgedBytes = 0;
+		}
+	} else if (fAcknowledgedBytes / 100 >= fCongestionWindow) {
+		// grow very slowly while we are at the target
+		_IncreaseWindow(fMaxSegmentSize);
+		fAcknowledgedBytes = 0;
+	}
+}
+
+
+void
+CubicCongestionControl::EnterRecovery(uint32 flightSize)
+{
+	_Reduce();
+	fCongestionWindow = fSlowStartThreshold;
+}
+
+
+void
+CubicCongestionControl::RetransmitTimeout(uint32 flightSize)
+{
+	_Reduce();
+	fCongestionWindow = fMaxSegmentSize;
+}
+
+
+void
+CubicCongestionControl::_Reduce()
+{
+	fEpochStart = 0;
+	fAcknowledgedBytes = 0;
+
+	// fast convergence: if the window did not reach its last maximum, we
+	// release some bandwidth to other flows
+	if (fCongestionWindow < fMaxWindow)
+		fMaxWindow = (uint64)fCongestionWindow * 17 / 20;
+	else
+		fMaxWindow = fCongestionWindow;
+
+	fSlowStartThreshold = max_c((uint32)((uint64)fCongestionWindow * 7 / 10),
+		2 * fMaxSegmentSize);
+}
+
+
+/*!	Returns the window the cubic function proposes for one round trip time
+	from now.
+*/
+uint32
+CubicCongestionControl::_Target(bigtime_t roundTripTime)
+{
+	int64 time = (system_time() - fEpochStart + roundTripTime) / 1000;
+	int64 offset = time - fTimeToOrigin;
+	if (offset > kMaxTimeOffset)
+		offset = kMaxTimeOffset;
+	else if (offset < -kMaxTimeOffset)
+		offset = -kMaxTimeOffset;
+
+	// W_cubic(t) = C * (t - K)^3 + W_max
+	int64 target = fOriginWindow
+		+ offset * offset * offset / 1000 * 4 * fMaxSegmentSize / 10000000;
+
+	if (target < (int64)fMaxSegmentSize)
+		return fMaxSegmentSize;
+
+	// do not grow faster than slow start would
+	int64 limit = (int64)fCongestionWindow * 3 / 2;
+	if (target > limit)
+		return limit;
+
+	return target;
+}
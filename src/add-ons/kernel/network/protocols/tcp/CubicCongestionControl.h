@@ -0,0 +1,44 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef CUBIC_CONGESTION_CONTROL_H
+#define CUBIC_CONGESTION_CONTROL_H
+
+
+#include "CongestionControl.h"
+
+
+/*!	CUBIC congestion control as described in RFC 8312: after a congestion
+	event, the window grows as a cubic function of the time since then,
+	which makes its growth independent of the round trip time, and lets it
+	probe for bandwidth quickly on links with a large bandwidth-delay
+	product.
+*/
+class CubicCongestionControl : public CongestionControl {
+public:
+								CubicCongestionControl();
+
+	virtual	const char*			Name() const;
+
+	virtual	void				Start(uint32 maxSegmentSize);
+
+	virtual	void				Acknowledged(uint32 bytes,
+									bigtime_t roundTripTime);
+	virtual	void				EnterRecovery(uint32 flightSize);
+	virtual	void				RetransmitTimeout(uint32 flightSize);
+
+private:
+			void				_Reduce();
+			uint32				_Target(bigtime_t roundTripTime);
+
+private:
+			uint32				fMaxWindow;
+			uint32				fOriginWindow;
+			uint32				fEstimatedWindow;
+			bigtime_t			fEpochStart;
+			int64				fTimeToOrigin;
+};
+
+
+#endif	// CUBIC_CONGESTION_CONTROL_H
@@ -11,6 +11,7 @@
 #include "EndpointManager.h"
 
 #include <new>
+#include <string.h>
 #include <unistd.h>
 
 #include <KernelExport.h>
@@ -132,6 +133,7 @@ protected:
 
 static const uint16 kLastReservedPort = 1023;
 static const uint16 kFirstEphemeralPort = 40000;
+static const bigtime_t kTimerInterval = 500000LL;
 
 
 ConnectionHashDefinition::ConnectionHashDefinition(EndpointManager* manager)
@@ -214,18 +216,44 @@ EndpointHashDefinition::GetLink(TCPEndpoint* endpoint) const
 //	#pragma mark -
 
 
+EndpointManager::ConnectionStripe::ConnectionStripe(EndpointManager* manager)
+	:
+	table(manager)
+{
+	rw_lock_init(&lock, "TCP connections");
+}
+
+
+EndpointManager::ConnectionStripe::~ConnectionStripe()
+{
+	rw_lock_destroy(&lock);
+}
+
+
+//	#pragma mark -
+
+
 EndpointManager::EndpointManager(net_domain* domain)
 	:
 	fDomain(domain),
-	fConnectionHash(this),
-	fLastPort(kFirstEphemeralPort)
+	fLastPort(kFirstEphemeralPort),
+	fSynCache(this),
+	fTimeWaitTable(this)
 {
 	rw_lock_init(&fLock, "TCP endpoint manager");
+	memset(fConnectionStripes, 0, sizeof(fConnectionStripes));
+	gStackModule->init_timer(&fTimer, &_Timer, this);
 }
 
 
 EndpointManager::~EndpointManager()
 {
+	gStackModule->cancel_timer(&fTimer);
+	gStackModule->wait_for_timer(&fTimer);
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++)
+		delete fConnectionStripes[i];
+
 	rw_lock_destroy(&fLock);
 }
 
@@ -233,9 +261,21 @@ EndpointManager::~EndpointManager()
 status_t
 EndpointManager::Init()
 {
-	status_t status = fConnectionHash.Init();
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		fConnectionStripes[i] = new(std::nothrow) ConnectionStripe(this);
+		if (fConnectionStripes[i] == NULL)
+			return B_NO_MEMORY;
+
+		status_t status = fConnectionStripes[i]->table.Init();
+		if (status != B_OK)
+			return status;
+	}
+
+	status_t status = fEndpointHash.Init();
 	if (status == B_OK)
-		status = fEndpointHash.Init();
+		status = fSynCache.Init();
+	if (status == B_OK)
+		status = fTimeWaitTable.Init();
 
 	return status;
 }
@@ -244,14 +284,33 @@ EndpointManager::Init()
 //	#pragma mark - connections
 
 
-/*!	Returns the endpoint matching the connection.
-	You must hold the manager's lock when calling this method (either read or
-	write).
+/*!	Returns the stripe of the connection table the connection between
+	\a local and \a peer belongs to. Only the lock of this stripe needs to
+	be held to look up, add, or remove the connection.
+*/
+EndpointManager::ConnectionStripe&
+EndpointManager::_StripeFor(const sockaddr* local, const sockaddr* peer) const
+{
+	return *fConnectionStripes[tcp_hash_stripe(
+		AddressModule()->hash_address_pair(local, peer))];
+}
+
+
+/*!	Returns the endpoint matching the connection, with a reference to its
+	socket, or \c NULL if there is none.
 */
 TCPEndpoint*
-EndpointManager::_LookupConnection(const sockaddr* local, const sockaddr* peer)
+EndpointManager::_AcquireConnection(const sockaddr* local,
+	const sockaddr* peer)
 {
-	return fConnectionHash.Lookup(std::make_pair(local, peer));
+	ConnectionStripe& stripe = _StripeFor(local, peer);
+	ReadLocker _(stripe.lock);
+
+	TCPEndpoint* endpoint = stripe.table.Lookup(std::make_pair(local, peer));
+	if (endpoint != NULL && gSocketModule->acquire_socket(endpoint->socket))
+		return endpoint;
+
+	return NULL;
 }
 
 
@@ -261,8 +320,6 @@ EndpointManager::SetConnection(TCPEndpoint* endpoint, const sockaddr* _local,
 {
 	TRACE(("EndpointManager::SetConnection(%p)\n", endpoint));
 
-	WriteLocker _(fLock);
-
 	SocketAddressStorage local(AddressModule());
 	local.SetTo(_local);
 
@@ -272,14 +329,18 @@ EndpointManager::SetConnection(TCPEndpoint* endpoint, const sockaddr* _local,
 		local.SetPort(port);
 	}
 
-	if (_LookupConnection(*local, peer) != NULL)
+	ConnectionStripe& stripe = _StripeFor(*local, peer);
+	WriteLocker _(stripe.lock);
+
+	if (stripe.table.Lookup(std::make_pair(*local, peer)) != NULL
+		|| !fTimeWaitTable.Recycle(*local, peer))
 		return EADDRINUSE;
 
 	endpoint->LocalAddress().SetTo(*local);
 	endpoint->PeerAddress().SetTo(peer);
 	T(Connect(endpoint));
 
-	fConnectionHash.Insert(endpoint);
+	stripe.table.Insert(endpoint);
 	return B_OK;
 }
 
@@ -302,51 +363,88 @@ EndpointManager::SetPassive(TCPEndpoint* endpoint)
 	SocketAddressStorage passive(AddressModule());
 	passive.SetToEmpty();
 
-	if (_LookupConnection(*endpoint->LocalAddress(), *passive))
+	ConnectionStripe& stripe = _StripeFor(*endpoint->LocalAddress(),
+		*passive);
+	WriteLocker stripeLocker(stripe.lock);
+
+	if (stripe.table.Lookup(std::make_pair(*endpoint->LocalAddress(),
+			*passive)) != NULL)
 		return EADDRINUSE;
 
 	endpoint->PeerAddress().SetTo(*passive);
-	fConnectionHash.Insert(endpoint);
+	stripe.table.Insert(endpoint);
+	return B_OK;
+}
+
+
+/*!	Hands the connection of \a endpoint, which just entered TIME_WAIT state,
+	over to the time-wait table. From now on, incoming segments will no longer
+	reach the endpoint, and it can be deleted as soon as its socket has been
+	closed.
+	You must hold the endpoint's lock when calling this method.
+*/
+status_t
+EndpointManager::EnterTimeWait(TCPEndpoint* endpoint, bool useTimestamps)
+{
+	uint32 window = endpoint->fReceiveWindow >> endpoint->fReceiveWindowShift;
+
+	status_t status = fTimeWaitTable.Add(*endpoint->LocalAddress(),
+		*endpoint->PeerAddress(), endpoint->fSendMax.Number(),
+		endpoint->fReceiveNext.Number(), min_c(window, TCP_MAX_WINDOW),
+		useTimestamps, endpoint->fReceivedTimestamp);
+	if (status != B_OK)
+		return status;
+
+	ConnectionStripe& stripe = _StripeFor(*endpoint->LocalAddress(),
+		*endpoint->PeerAddress());
+	WriteLocker _(stripe.lock);
+
+	stripe.table.Remove(endpoint);
 	return B_OK;
 }
 
 
+/*!	Returns the endpoint of the connection between \a local and \a peer,
+	with a reference to its socket.
+*/
 TCPEndpoint*
 EndpointManager::FindConnection(sockaddr* local, sockaddr* peer)
 {
-	ReadLocker _(fLock);
-
-	TCPEndpoint *endpoint = _LookupConnection(local, peer);
+	TCPEndpoint* endpoint = _AcquireConnection(local, peer);
 	if (endpoint != NULL) {
 		TRACE(("TCP: Received packet corresponds to explicit endpoint %p\n",
 			endpoint));
-		if (gSocketModule->acquire_socket(endpoint->socket))
-			return endpoint;
 	}
 
-	// no explicit endpoint exists, check for wildcard endpoints
+	return endpoint;
+}
+
 
+/*!	Returns the listening endpoint responsible for connections to \a local,
+	with a reference to its socket.
+*/
+TCPEndpoint*
+EndpointManager::FindListener(sockaddr* local)
+{
 	SocketAddressStorage wildcard(AddressModule());
 	wildcard.SetToEmpty();
 
-	endpoint = _LookupConnection(local, *wildcard);
+	TCPEndpoint* endpoint = _AcquireConnection(local, *wildcard);
 	if (endpoint != NULL) {
 		TRACE(("TCP: Received packet corresponds to wildcard endpoint %p\n",
 			endpoint));
-		if (gSocketModule->acquire_socket(endpoint->socket))
-			return endpoint;
+		return endpoint;
 	}
 
 	SocketAddressStorage localWildcard(AddressModule());
 	localWildcard.SetToEmpty();
 	localWildcard.SetPort(AddressModule()->get_port(local));
 
-	endpoint = _LookupConnection(*localWildcard, *wildcard);
+	endpoint = _AcquireConnection(*localWildcard, *wildcard);
 	if (endpoint != NULL) {
 		TRACE(("TCP: Received packet corresponds to local wildcard endpoint "
 			"%p\n", endpoint));
-		if (gSocketModule->acquire_socket(endpoint->socket))
-			return endpoint;
+		return endpoint;
 	}
 
 	// no matching endpoint exists
@@ -440,6 +538,10 @@ EndpointManager::_BindToAddress(WriteLocker& locker, TCPEndpoint* endpoint,
 		}
 	} while (retry-- > 0);
 
+	if ((endpoint->socket->options & SO_REUSEADDR) == 0
+		&& fTimeWaitTable.IsBound(*address))
+		return EADDRINUSE;
+
 	return _Bind(endpoint, *address);
 }
 
@@ -520,7 +622,13 @@ EndpointManager::Unbind(TCPEndpoint* endpoint)
 	if (!fEndpointHash.Remove(endpoint))
 		panic("bound endpoint %p not in hash!", endpoint);
 
-	fConnectionHash.Remove(endpoint);
+	ConnectionStripe& stripe = _StripeFor(*endpoint->LocalAddress(),
+		*endpoint->PeerAddress());
+	WriteLocker stripeLocker(stripe.lock);
+
+	// the endpoint is not in the table anymore if it entered TIME_WAIT state
+	stripe.table.Remove(endpoint);
+	stripeLocker.Unlock();
 
 	(*endpoint->LocalAddress())->sa_len = 0;
 
@@ -533,13 +641,6 @@ EndpointManager::ReplyWithReset(tcp_segment_header& segment, net_buffer* buffer)
 {
 	TRACE(("TCP: Sending RST...\n"));
 
-	net_buffer* reply = gBufferModule->create(512);
-	if (reply == NULL)
-		return B_NO_MEMORY;
-
-	AddressModule()->set_to(reply->source, buffer->destination);
-	AddressModule()->set_to(reply->destination, buffer->source);
-
 	tcp_segment_header outSegment(TCP_FLAG_RESET);
 	outSegment.sequence = 0;
 	outSegment.acknowledge = 0;
@@ -555,17 +656,76 @@ EndpointManager::ReplyWithReset(tcp_segment_header& segment, net_buffer* buffer)
 	} else
 		outSegment.sequence = segment.acknowledge;
 
-	status_t status = add_tcp_header(AddressModule(), outSegment, reply);
-	if (status == B_OK)
-		status = Domain()->module->send_data(NULL, reply);
+	net_buffer* reply = CreateSegment(buffer->destination, buffer->source,
+		outSegment);
+	if (reply == NULL)
+		return B_NO_MEMORY;
+
+	return SendSegment(reply);
+}
+
 
+/*!	Creates a segment without data from \a local to \a peer, for
+	connections that do not have an endpoint.
+*/
+net_buffer*
+EndpointManager::CreateSegment(const sockaddr* local, const sockaddr* peer,
+	tcp_segment_header& segment)
+{
+	net_buffer* buffer = gBufferModule->create(512);
+	if (buffer == NULL)
+		return NULL;
+
+	AddressModule()->set_to(buffer->source, local);
+	AddressModule()->set_to(buffer->destination, peer);
+
+	if (add_tcp_header(AddressModule(), segment, buffer) != B_OK) {
+		gBufferModule->free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+
+/*!	Sends a segment created by CreateSegment(); the buffer is always
+	consumed.
+*/
+status_t
+EndpointManager::SendSegment(net_buffer* buffer)
+{
+	status_t status = Domain()->module->send_data(NULL, buffer);
 	if (status != B_OK)
-		gBufferModule->free(reply);
+		gBufferModule->free(buffer);
 
 	return status;
 }
 
 
+/*!	Makes sure the timer that maintains the SYN cache and the time-wait
+	table is running.
+*/
+void
+EndpointManager::StartTimer()
+{
+	if (!gStackModule->is_timer_active(&fTimer))
+		gStackModule->set_timer(&fTimer, kTimerInterval);
+}
+
+
+/*static*/ void
+EndpointManager::_Timer(net_timer* timer, void* _manager)
+{
+	EndpointManager* manager = (EndpointManager*)_manager;
+
+	manager->fSynCache.Timer();
+	manager->fTimeWaitTable.Timer();
+
+	if (!manager->fSynCache.IsEmpty() || !manager->fTimeWaitTable.IsEmpty())
+		gStackModule->set_timer(&manager->fTimer, kTimerInterval);
+}
+
+
 void
 EndpointManager::Dump() const
 {
@@ -573,18 +733,24 @@ EndpointManager::Dump() const
 	kprintf("%10s %21s %21s %8s %8s %12s\n", "address", "local", "peer",
 		"recv-q", "send-q", "state");
 
-	ConnectionTable::Iterator iterator = fConnectionHash.GetIterator();
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		ConnectionTable::Iterator iterator
+			= fConnectionStripes[i]->table.GetIterator();
 
-	while (iterator.HasNext()) {
-		TCPEndpoint *endpoint = iterator.Next();
+		while (iterator.HasNext()) {
+			TCPEndpoint *endpoint = iterator.Next();
 
-		char localBuf[64], peerBuf[64];
-		endpoint->LocalAddress().AsString(localBuf, sizeof(localBuf), true);
-		endpoint->PeerAddress().AsString(peerBuf, sizeof(peerBuf), true);
+			char localBuf[64], peerBuf[64];
+			endpoint->LocalAddress().AsString(localBuf, sizeof(localBuf),
+				true);
+			endpoint->PeerAddress().AsString(peerBuf, sizeof(peerBuf), true);
 
-		kprintf("%p %21s %21s %8lu %8lu %12s\n", endpoint, localBuf, peerBuf,
-			endpoint->fReceiveQueue.Available(), endpoint->fSendQueue.Used(),
-			name_for_state(endpoint->State()));
+			kprintf("%p %21s %21s %8lu %8lu %12s\n", endpoint, localBuf,
+				peerBuf, endpoint->fReceiveQueue.Available(),
+				endpoint->fSendQueue.Used(), name_for_state(endpoint->State()));
+		}
 	}
-}
 
+	fSynCache.Dump();
+	fTimeWaitTable.Dump();
+}
@@ -10,7 +10,9 @@
 #define ENDPOINT_MANAGER_H
 
 
+#include "SynCache.h"
 #include "tcp.h"
+#include "TimeWaitTable.h"
 
 #include <AddressUtilities.h>
 
@@ -74,11 +76,14 @@ public:
 			status_t		Init();
 
 			TCPEndpoint*	FindConnection(sockaddr* local, sockaddr* peer);
+			TCPEndpoint*	FindListener(sockaddr* local);
 
 			status_t		SetConnection(TCPEndpoint* endpoint,
 								const sockaddr* local, const sockaddr* peer,
 								const sockaddr* interfaceLocal);
 			status_t		SetPassive(TCPEndpoint* endpoint);
+			status_t		EnterTimeWait(TCPEndpoint* endpoint,
+								bool useTimestamps);
 
 			status_t		Bind(TCPEndpoint* endpoint,
 								const sockaddr* address);
@@ -87,6 +92,14 @@ public:
 
 			status_t		ReplyWithReset(tcp_segment_header& segment,
 								net_buffer* buffer);
+			net_buffer*		CreateSegment(const sockaddr* local,
+								const sockaddr* peer,
+								tcp_segment_header& segment);
+			status_t		SendSegment(net_buffer* buffer);
+
+			SynCache&		GetSynCache() { return fSynCache; }
+			TimeWaitTable&	GetTimeWaitTable() { return fTimeWaitTable; }
+			void			StartTimer();
 
 			net_domain*		Domain() const { return fDomain; }
 			net_address_module_info* AddressModule() const
@@ -95,7 +108,20 @@ public:
 			void			Dump() const;
 
 private:
-			TCPEndpoint*	_LookupConnection(const sockaddr* local,
+	typedef BOpenHashTable<ConnectionHashDefinition> ConnectionTable;
+	typedef MultiHashTable<EndpointHashDefinition> EndpointTable;
+
+	struct ConnectionStripe {
+								ConnectionStripe(EndpointManager* manager);
+								~ConnectionStripe();
+
+			rw_lock				lock;
+			ConnectionTable		table;
+	};
+
+			ConnectionStripe& _StripeFor(const sockaddr* local,
+								const sockaddr* peer) const;
+			TCPEndpoint*	_AcquireConnection(const sockaddr* local,
 								const sockaddr* peer);
 			status_t		_Bind(TCPEndpoint* endpoint,
 								const sockaddr* address);
@@ -104,14 +130,17 @@ private:
 			status_t		_BindToEphemeral(TCPEndpoint* endpoint,
 								const sockaddr* address);
 
-	typedef BOpenHashTable<ConnectionHashDefinition> ConnectionTable;
-	typedef MultiHashTable<EndpointHashDefinition> EndpointTable;
+	static	void			_Timer(net_timer* timer, void* _manager);
 
 	rw_lock					fLock;
+		// protects fEndpointHash and fLastPort
 	net_domain*				fDomain;
-	ConnectionTable			fConnectionHash;
+	ConnectionStripe*		fConnectionStripes[TCP_HASH_STRIPES];
 	EndpointTable			fEndpointHash;
 	uint16					fLastPort;
+	SynCache				fSynCache;
+	TimeWaitTable			fTimeWaitTable;
+	net_timer				fTimer;
 };
 
 #endif	// ENDPOINT_MANAGER_H
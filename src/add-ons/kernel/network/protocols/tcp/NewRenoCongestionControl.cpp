@@ -0,0 +1,50 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "NewRenoCongestionControl.h"
+
+
+const char*
+NewRenoCongestionControl::Name() const
+{
+	return "newreno";
+}
+
+
+void
+NewRenoCongestionControl::Acknowledged(uint32 bytes, bigtime_t roundTripTime)
+{
+	if (InSlowStart()) {
+		_SlowStart(bytes);
+		return;
+	}
+
+	// congestion avoidance: open the window by one segment per window of
+	// acknowledged data
+	fAcknowledgedBytes += bytes;
+	if (fAcknowledgedBytes >= fCongestionWindow) {
+		fAcknowledgedBytes -= fCongestionWindow;
+		_IncreaseWindow(fMaxSegmentSize);
+	}
+}
+
+
+void
+NewRenoCongestionControl::EnterRecovery(uint32 flightSize)
+{
+	fSlowStartThreshold = max_c(flightSize / 2, 2 * fMaxSegmentSize);
+	fCongestionWindow = fSlowStartThreshold;
+	fAcknowledgedBytes = 0;
+}
+
+
+void
+NewRenoCongestionControl::RetransmitTimeout(uint32 flightSize)
+{
+	fSlowStartThreshold = max_c(flightSize / 2, 2 * fMaxSegmentSize);
+	fCongestionWindow = fMaxSegmentSize;
+	fAcknowledgedBytes = 0;
+}
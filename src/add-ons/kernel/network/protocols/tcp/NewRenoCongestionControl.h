@@ -0,0 +1,26 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef NEW_RENO_CONGESTION_CONTROL_H
+#define NEW_RENO_CONGESTION_CONTROL_H
+
+
+#include "CongestionControl.h"
+
+
+/*!	The standard TCP congestion control of RFC 5681, with appropriate byte
+	counting (RFC 3465).
+*/
+class NewRenoCongestionControl : public CongestionControl {
+public:
+	virtual	const char*			Name() const;
+
+	virtual	void				Acknowledged(uint32 bytes,
+									bigtime_t roundTripTime);
+	virtual	void				EnterRecovery(uint32 flightSize);
+	virtual	void				RetransmitTimeout(uint32 flightSize);
+};
+
+
+#endif	// NEW_RENO_CONGESTION_CONTROL_H
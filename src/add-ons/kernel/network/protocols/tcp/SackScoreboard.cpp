@@ -0,0 +1,274 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "SackScoreboard.h"
+
+#include <string.h>
+
+#include <KernelExport.h>
+
+
+SackScoreboard::SackScoreboard()
+	:
+	fBlockCount(0),
+	fSackedBytes(0)
+{
+}
+
+
+/*!	Forgets all SACK information; this must be done after a retransmission
+	timeout, as the peer is allowed to discard data it has SACKed before.
+*/
+void
+SackScoreboard::Reset()
+{
+	fBlockCount = 0;
+	fSackedBytes = 0;
+}
+
+
+/*!	Removes everything below \a unacknowledged from the scoreboard, and adds
+	the given SACK blocks to it. Blocks that lie outside of the data that is
+	currently in flight are ignored.
+	Returns the number of bytes that have been SACKed for the first time.
+*/
+uint32
+SackScoreboard::Update(tcp_sequence unacknowledged, tcp_sequence sendMax,
+	const tcp_sack* sacks, int sackCount)
+{
+	_RemoveUntil(unacknowledged);
+
+	uint32 newlySacked = 0;
+
+	for (int i = 0; i < sackCount; i++) {
+		tcp_sequence start = sacks[i].left_edge;
+		tcp_sequence end = sacks[i].right_edge;
+
+		if (start >= end || end <= unacknowledged || end > sendMax)
+			continue;
+		if (start < unacknowledged)
+			start = unacknowledged;
+
+		newlySacked += _Add(start, end);
+	}
+
+	return newlySacked;
+}
+
+
+tcp_sequence
+SackScoreboard::HighestSacked(tcp_sequence unacknowledged) const
+{
+	if (fBlockCount == 0)
+		return unacknowledged;
+
+	return fBlocks[fBlockCount - 1].end;
+}
+
+
+/*!	Implements IsLost() of RFC 6675: the data at \a sequence is considered
+	lost when enough discontiguous blocks or bytes above it have been SACKed.
+*/
+bool
+SackScoreboard::IsLost(tcp_sequence sequence, uint32 maxSegmentSize) const
+{
+	int32 blocksAbove = 0;
+	uint32 bytesAbove = 0;
+
+	for (int32 i = fBlockCount - 1; i >= 0; i--) {
+		if (fBlocks[i].end <= sequence)
+			break;
+
+		if (fBlocks[i].start > sequence) {
+			blocksAbove++;
+			bytesAbove += (fBlocks[i].end - fBlocks[i].start).Number();
+		} else
+			bytesAbove += (fBlocks[i].end - sequence).Number();
+	}
+
+	return _IsLost(blocksAbove, bytesAbove, maxSegmentSize);
+}
+
+
+/*!	Implements SetPipe() of RFC 6675: returns an estimate of the number of
+	bytes that are still in flight. Data considered lost is not counted,
+	retransmitted data, ie. everything below \a retransmitHigh that has not
+	been SACKed yet, is counted (again).
+*/
+uint32
+SackScoreboard::Pipe(tcp_sequence unacknowledged, tcp_sequence sendMax,
+	tcp_sequence retransmitHigh, uint32 maxSegmentSize) const
+{
+	uint32 pipe = 0;
+	uint32 bytesAbove = fSackedBytes;
+	tcp_sequence holeStart = unacknowledged;
+
+	for (int32 i = 0; i <= fBlockCount; i++) {
+		tcp_sequence holeEnd = i < fBlockCount ? fBlocks[i].start : sendMax;
+
+		if (holeEnd > holeStart) {
+			if (!_IsLost(fBlockCount - i, bytesAbove, maxSegmentSize))
+				pipe += (holeEnd - holeStart).Number();
+
+			if (retransmitHigh > holeStart) {
+				tcp_sequence end = retransmitHigh < holeEnd
+					? retransmitHigh : holeEnd;
+				pipe += (end - holeStart).Number();
+			}
+		}
+
+		if (i < fBlockCount) {
+			bytesAbove -= (fBlocks[i].end - fBlocks[i].start).Number();
+			holeStart = fBlocks[i].end;
+		}
+	}
+
+	return pipe;
+}
+
+
+/*!	Implements the first rule of NextSeg() of RFC 6675: finds the first
+	lost segment at or above \a retransmitHigh that has not been
+	retransmitted yet.
+	Returns \c false if there is no such segment.
+*/
+bool
+SackScoreboard::NextLostSegment(tcp_sequence unacknowledged,
+	tcp_sequence retransmitHigh, uint32 maxSegmentSize, tcp_sequence& _start,
+	uint32& _length) const
+{
+	uint32 bytesAbove = fSackedBytes;
+	tcp_sequence holeStart = unacknowledged;
+
+	for (int32 i = 0; i < fBlockCount; i++) {
+		// if this hole is not lost, none of the ones above it can be
+		if (!_IsLost(fBlockCount - i, bytesAbove, maxSegmentSize))
+			return false;
+
+		tcp_sequence holeEnd = fBlocks[i].start;
+		tcp_sequence start = holeStart > retransmitHigh
+			? holeStart : retransmitHigh;
+
+		if (start < holeEnd) {
+			_start = start;
+			_length = min_c((holeEnd - start).Number(), maxSegmentSize);
+			return true;
+		}
+
+		bytesAbove -= (fBlocks[i].end - fBlocks[i].start).Number();
+		holeStart = fBlocks[i].end;
+	}
+
+	return false;
+}
+
+
+void
+SackScoreboard::Dump() const
+{
+	kprintf("    sacked bytes: %lu\n", fSackedBytes);
+
+	for (int32 i = 0; i < fBlockCount; i++) {
+		kprintf("      %lu - %lu\n", fBlocks[i].start.Number(),
+			fBlocks[i].end.Number());
+	}
+}
+
+
+void
+SackScoreboard::_RemoveUntil(tcp_sequence sequence)
+{
+	int32 removed = 0;
+	while (removed < fBlockCount && fBlocks[removed].end <= sequence) {
+		fSackedBytes -= (fBlocks[removed].end - fBlocks[removed].start)
+			.Number();
+		removed++;
+	}
+
+	if (removed > 0) {
+		fBlockCount -= removed;
+		memmove(&fBlocks[0], &fBlocks[removed], fBlockCount * sizeof(Block));
+	}
+
+	if (fBlockCount > 0 && fBlocks[0].start < sequence) {
+		fSackedBytes -= (sequence - fBlocks[0].start).Number();
+		fBlocks[0].start = sequence;
+	}
+}
+
+
+/*!	Adds the block from \a start to \a end, and merges it with the blocks
+	it overlaps or touches.
+	Returns the number of bytes that were not part of the scoreboard before.
+*/
+uint32
+SackScoreboard::_Add(tcp_sequence start, tcp_sequence end)
+{
+	uint32 length = (end - start).Number();
+
+	// find the first block that is not completely below the new one
+	int32 first = 0;
+	while (first < fBlockCount && fBlocks[first].end < start)
+		first++;
+
+	// merge all blocks that overlap or touch the new one
+	int32 last = first;
+	uint32 mergedBytes = 0;
+	while (last < fBlockCount && fBlocks[last].start <= end) {
+		if (fBlocks[last].start < start)
+			start = fBlocks[last].start;
+		if (fBlocks[last].end > end)
+			end = fBlocks[last].end;
+
+		mergedBytes += (fBlocks[last].end - fBlocks[last].start).Number();
+		last++;
+	}
+
+	if (first == last) {
+		// this is a new block
+		if (fBlockCount == kMaxBlocks) {
+			if (first == kMaxBlocks)
+				return 0;
+
+			// forget about the highest block to make room
+			fBlockCount--;
+			fSackedBytes -= (fBlocks[fBlockCount].end
+				- fBlocks[fBlockCount].start).Number();
+		}
+
+		memmove(&fBlocks[first + 1], &fBlocks[first],
+			(fBlockCount - first) * sizeof(Block));
+		fBlockCount++;
+
+		fBlocks[first].start = start;
+		fBlocks[first].end = end;
+		fSackedBytes += length;
+		return length;
+	}
+
+	if (last > first + 1) {
+		memmove(&fBlocks[first + 1], &fBlocks[last],
+			(fBlockCount - last) * sizeof(Block));
+		fBlockCount -= last - first - 1;
+	}
+
+	uint32 mergedLength = (end - start).Number();
+	fBlocks[first].start = start;
+	fBlocks[first].end = end;
+	fSackedBytes += mergedLength - mergedBytes;
+
+	return mergedLength - mergedBytes;
+}
+
+
+bool
+SackScoreboard::_IsLost(int32 blocksAbove, uint32 bytesAbove,
+	uint32 maxSegmentSize) const
+{
+	return blocksAbove >= TCP_DUPLICATE_ACKNOWLEDGE_THRESHOLD
+		|| bytesAbove > (TCP_DUPLICATE_ACKNOWLEDGE_THRESHOLD - 1)
+			* maxSegmentSize;
+}
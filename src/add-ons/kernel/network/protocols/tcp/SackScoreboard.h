@@ -0,0 +1,69 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef SACK_SCOREBOARD_H
+#define SACK_SCOREBOARD_H
+
+
+#include "tcp.h"
+
+
+/*!	Keeps track of the data the peer has selectively acknowledged (RFC 2018),
+	and implements the loss detection and pipe estimation of RFC 6675 on top
+	of it.
+	The blocks are kept sorted in a small fixed size array; if the peer
+	reports more blocks than fit, the highest ones are forgotten. That is
+	always safe, as it can only lead to data being retransmitted needlessly.
+*/
+class SackScoreboard {
+public:
+								SackScoreboard();
+
+			void				Reset();
+
+			uint32				Update(tcp_sequence unacknowledged,
+									tcp_sequence sendMax,
+									const tcp_sack* sacks, int sackCount);
+
+			bool				IsEmpty() const { return fBlockCount == 0; }
+			uint32				SackedBytes() const { return fSackedBytes; }
+			tcp_sequence		HighestSacked(tcp_sequence unacknowledged)
+									const;
+
+			bool				IsLost(tcp_sequence sequence,
+									uint32 maxSegmentSize) const;
+			uint32				Pipe(tcp_sequence unacknowledged,
+									tcp_sequence sendMax,
+									tcp_sequence retransmitHigh,
+									uint32 maxSegmentSize) const;
+			bool				NextLostSegment(tcp_sequence unacknowledged,
+									tcp_sequence retransmitHigh,
+									uint32 maxSegmentSize,
+									tcp_sequence& _start,
+									uint32& _length) const;
+
+			void				Dump() const;
+
+private:
+			struct Block {
+				tcp_sequence	start;
+				tcp_sequence	end;
+			};
+
+	static	const int32			kMaxBlocks = 16;
+
+			void				_RemoveUntil(tcp_sequence sequence);
+			uint32				_Add(tcp_sequence start, tcp_sequence end);
+			bool				_IsLost(int32 blocksAbove,
+									uint32 bytesAbove,
+									uint32 maxSegmentSize) const;
+
+private:
+			Block				fBlocks[kMaxBlocks];
+			int32				fBlockCount;
+			uint32				fSackedBytes;
+};
+
+
+#endif	// SACK_SCOREBOARD_H
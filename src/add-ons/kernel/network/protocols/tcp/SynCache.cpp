@@ -0,0 +1,590 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "SynCache.h"
+
+#include <fcntl.h>
+#include <new>
+#include <string.h>
+
+#include <KernelExport.h>
+
+#include <AddressUtilities.h>
+#include <SHA256.h>
+#include <syscalls.h>
+#include <util/AutoLock.h>
+#include <util/list.h>
+
+#include "EndpointManager.h"
+
+
+// References:
+//	- RFC 4987 - TCP SYN Flooding Attacks and Common Mitigations
+//
+// A SYN cookie is the initial sequence number we choose for a connection we
+// do not keep any state for. It is made up of a 5 bit counter that is
+// incremented about every minute, 24 bits of a keyed hash over the
+// connection, and 3 bits that encode the maximum segment size of the peer.
+// Since cookies cannot carry more than that, the window scale, timestamp,
+// and SACK options are not offered in a SYN+ACK that contains a cookie.
+//
+// The hash is a SHA-256 over the connection, keyed with a secret that is
+// read from /dev/urandom. Every counter period gets a new secret; the one of
+// the previous period is kept, as its cookies are still accepted. Reading the
+// random device means file I/O, which must not happen while we are
+// processing packets. Therefore, the secrets are created in advance when the
+// cache is initialized, and by the timer that maintains the cache.
+
+static const int32 kMaxStripeEntries = 128;
+static const uint8 kMaxRetransmits = 3;
+static const bigtime_t kRetransmitTimeout = 1000000LL;
+
+static const uint32 kCookieCounterShift = 26;
+	// the counter is taken from the system time, in units of about 67 secs
+static const uint32 kCookieCounterMask = 0x1f;
+static const uint16 kCookieSegmentSizes[] = {
+	536, 1200, 1360, 1400, 1440, 1460, 4312, 8960
+};
+
+
+static status_t
+read_random(void* buffer, size_t size)
+{
+	int fd = _kern_open(-1, "/dev/urandom", O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	ssize_t bytesRead = _kern_read(fd, -1, buffer, size);
+	_kern_close(fd);
+
+	if (bytesRead < 0)
+		return bytesRead;
+	return (size_t)bytesRead == size ? B_OK : B_ERROR;
+}
+
+
+static void
+init_entry(syn_cache_entry& entry, const tcp_segment_header& segment,
+	uint32 maxSegmentSize, size_t receiveBufferSize, bool useOptions)
+{
+	entry.initial_receive_sequence = segment.sequence;
+	entry.received_timestamp = segment.timestamp_value;
+	entry.send_max_segment_size = useOptions ? segment.max_segment_size : 0;
+	entry.send_window_shift = segment.window_shift;
+	entry.receive_max_segment_size = useOptions ? maxSegmentSize : 0;
+	entry.receive_window = min_c(TCP_MAX_WINDOW, receiveBufferSize);
+		// the window of a SYN is never scaled
+	entry.options = useOptions ? segment.options
+		& (TCP_HAS_WINDOW_SCALE | TCP_HAS_TIMESTAMPS | TCP_SACK_PERMITTED)
+		: 0;
+
+	// compute the window shift in the same way TCPEndpoint does
+	entry.receive_window_shift = 0;
+	if ((entry.options & TCP_HAS_WINDOW_SCALE) != 0) {
+		while (entry.receive_window_shift < TCP_MAX_WINDOW_SHIFT
+			&& (0xffffUL << entry.receive_window_shift) < receiveBufferSize)
+			entry.receive_window_shift++;
+	}
+}
+
+
+//	#pragma mark -
+
+
+size_t
+SynCacheHashDefinition::HashKey(const KeyType& key) const
+{
+	return fModule->hash_address_pair(key.first, key.second);
+}
+
+
+size_t
+SynCacheHashDefinition::Hash(syn_cache_entry* entry) const
+{
+	return fModule->hash_address_pair((sockaddr*)&entry->local,
+		(sockaddr*)&entry->peer);
+}
+
+
+bool
+SynCacheHashDefinition::Compare(const KeyType& key,
+	syn_cache_entry* entry) const
+{
+	return fModule->equal_addresses_and_ports(key.first,
+			(sockaddr*)&entry->local)
+		&& fModule->equal_addresses_and_ports(key.second,
+			(sockaddr*)&entry->peer);
+}
+
+
+syn_cache_entry*&
+SynCacheHashDefinition::GetLink(syn_cache_entry* entry) const
+{
+	return entry->hash_link;
+}
+
+
+//	#pragma mark -
+
+
+SynCache::Stripe::Stripe(net_address_module_info* module)
+	:
+	table(SynCacheHashDefinition(module)),
+	count(0)
+{
+	mutex_init(&lock, "tcp syn cache");
+}
+
+
+SynCache::Stripe::~Stripe()
+{
+	while (syn_cache_entry* entry = list.RemoveHead())
+		delete entry;
+
+	mutex_destroy(&lock);
+}
+
+
+//	#pragma mark -
+
+
+SynCache::SynCache(EndpointManager* manager)
+	:
+	fManager(manager),
+	fCount(0),
+	fLastCookieTime(0)
+{
+	memset(fStripes, 0, sizeof(fStripes));
+	memset(fSecrets, 0, sizeof(fSecrets));
+	for (int32 i = 0; i < SYN_COOKIE_SECRET_COUNT; i++)
+		fSecrets[i].period = -1;
+
+	rw_lock_init(&fSecretLock, "tcp syn cookie secret");
+}
+
+
+SynCache::~SynCache()
+{
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++)
+		delete fStripes[i];
+
+	memset(fSecrets, 0, sizeof(fSecrets));
+	rw_lock_destroy(&fSecretLock);
+}
+
+
+status_t
+SynCache::Init()
+{
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		fStripes[i] = new(std::nothrow) Stripe(fManager->AddressModule());
+		if (fStripes[i] == NULL)
+			return B_NO_MEMORY;
+
+		status_t status = fStripes[i]->table.Init();
+		if (status != B_OK)
+			return status;
+	}
+
+	_RotateSecrets();
+	return B_OK;
+}
+
+
+/*!	Handles a SYN that has been received by a listening endpoint: the
+	connection is remembered in the cache, and answered with a SYN+ACK. If
+	the cache is full, a SYN cookie is sent instead, and the connection is
+	forgotten until the peer acknowledges it.
+*/
+status_t
+SynCache::SynchronizeReceived(tcp_segment_header& segment, net_buffer* buffer,
+	uint32 maxSegmentSize, size_t receiveBufferSize, bool useOptions)
+{
+	const sockaddr* local = buffer->destination;
+	const sockaddr* peer = buffer->source;
+
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	syn_cache_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL) {
+		if (stripe.count < kMaxStripeEntries)
+			entry = new(std::nothrow) syn_cache_entry;
+
+		if (entry == NULL) {
+			locker.Unlock();
+
+			syn_cache_entry cookie;
+			memcpy(&cookie.local, local, local->sa_len);
+			memcpy(&cookie.peer, peer, peer->sa_len);
+			init_entry(cookie, segment, maxSegmentSize, receiveBufferSize,
+				useOptions);
+			cookie.options = 0;
+			cookie.receive_window_shift = 0;
+
+			status_t status = _CreateCookie(local, peer, segment.sequence,
+				cookie.send_max_segment_size, cookie.initial_send_sequence);
+			if (status != B_OK)
+				return status;
+
+			fLastCookieTime = system_time();
+
+			net_buffer* reply = _CreateReply(cookie);
+			if (reply == NULL)
+				return B_NO_MEMORY;
+
+			return fManager->SendSegment(reply);
+		}
+
+		memcpy(&entry->local, local, local->sa_len);
+		memcpy(&entry->peer, peer, peer->sa_len);
+		entry->initial_send_sequence = system_time() >> 4;
+		entry->timeout = system_time() + kRetransmitTimeout;
+		entry->retransmits = 0;
+
+		stripe.table.Insert(entry);
+		stripe.list.Add(entry);
+		stripe.count++;
+		atomic_add(&fCount, 1);
+	}
+
+	// If the entry already existed, the peer has either retransmitted its
+	// SYN, or started over with a new one
+	init_entry(*entry, segment, maxSegmentSize, receiveBufferSize,
+		useOptions);
+
+	net_buffer* reply = _CreateReply(*entry);
+	locker.Unlock();
+
+	fManager->StartTimer();
+
+	if (reply == NULL)
+		return B_NO_MEMORY;
+
+	return fManager->SendSegment(reply);
+}
+
+
+/*!	Looks up the half-open connection the ACK in \a segment belongs to. This
+	may either be an entry of the cache, or a valid SYN cookie. On success,
+	the entry is copied to \a _entry, but it is not removed from the cache.
+*/
+bool
+SynCache::Lookup(const sockaddr* local, const sockaddr* peer,
+	tcp_segment_header& segment, syn_cache_entry& _entry)
+{
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	syn_cache_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry != NULL) {
+		if (segment.acknowledge != entry->initial_send_sequence + 1)
+			return false;
+
+		memcpy(&_entry, entry, sizeof(syn_cache_entry));
+		return true;
+	}
+
+	locker.Unlock();
+
+	uint16 maxSegmentSize;
+	if (!_CheckCookie(local, peer, segment, maxSegmentSize))
+		return false;
+
+	memset(&_entry, 0, sizeof(syn_cache_entry));
+	memcpy(&_entry.local, local, local->sa_len);
+	memcpy(&_entry.peer, peer, peer->sa_len);
+	_entry.initial_send_sequence = segment.acknowledge - 1;
+	_entry.initial_receive_sequence = segment.sequence - 1;
+	_entry.send_max_segment_size = maxSegmentSize;
+	return true;
+}
+
+
+void
+SynCache::Remove(const sockaddr* local, const sockaddr* peer)
+{
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	syn_cache_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL)
+		return;
+
+	stripe.table.RemoveUnchecked(entry);
+	stripe.list.Remove(entry);
+	stripe.count--;
+	atomic_add(&fCount, -1);
+
+	locker.Unlock();
+	delete entry;
+}
+
+
+/*!	The peer aborted a connection; if we know about it, and the sequence
+	number matches exactly, we forget about it.
+*/
+void
+SynCache::ResetReceived(tcp_segment_header& segment, net_buffer* buffer)
+{
+	const sockaddr* local = buffer->destination;
+	const sockaddr* peer = buffer->source;
+
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	syn_cache_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL
+		|| segment.sequence != entry->initial_receive_sequence + 1)
+		return;
+
+	stripe.table.RemoveUnchecked(entry);
+	stripe.list.Remove(entry);
+	stripe.count--;
+	atomic_add(&fCount, -1);
+
+	locker.Unlock();
+	delete entry;
+}
+
+
+/*!	Retransmits the SYN+ACK of all connections that are still not
+	acknowledged, and drops those that timed out.
+*/
+void
+SynCache::Timer()
+{
+	_RotateSecrets();
+
+	bigtime_t now = system_time();
+
+	// the replies are sent after the locks have been released
+	struct list replies;
+	list_init(&replies);
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		Stripe& stripe = *fStripes[i];
+		MutexLocker locker(stripe.lock);
+
+		EntryList::Iterator iterator = stripe.list.GetIterator();
+		while (syn_cache_entry* entry = iterator.Next()) {
+			if (entry->timeout > now)
+				continue;
+
+			if (entry->retransmits >= kMaxRetransmits) {
+				iterator.Remove();
+				stripe.table.RemoveUnchecked(entry);
+				stripe.count--;
+				atomic_add(&fCount, -1);
+
+				delete entry;
+				continue;
+			}
+
+			entry->retransmits++;
+			entry->timeout = now + (kRetransmitTimeout << entry->retransmits);
+
+			net_buffer* reply = _CreateReply(*entry);
+			if (reply != NULL)
+				list_add_item(&replies, reply);
+		}
+	}
+
+	while (net_buffer* reply = (net_buffer*)list_remove_head_item(&replies))
+		fManager->SendSegment(reply);
+}
+
+
+void
+SynCache::Dump() const
+{
+	kprintf("SYN cache: %ld entries, last cookie sent at %lld\n", fCount,
+		fLastCookieTime);
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		EntryList::Iterator iterator = fStripes[i]->list.GetIterator();
+		while (syn_cache_entry* entry = iterator.Next()) {
+			char localBuffer[64], peerBuffer[64];
+			ConstSocketAddress(fManager->AddressModule(),
+				(sockaddr*)&entry->local).AsString(localBuffer,
+					sizeof(localBuffer), true);
+			ConstSocketAddress(fManager->AddressModule(),
+				(sockaddr*)&entry->peer).AsString(peerBuffer,
+					sizeof(peerBuffer), true);
+
+			kprintf("%p %21s %21s iss %lu, irs %lu, retransmits %u, timeout "
+				"%lld\n", entry, localBuffer, peerBuffer,
+				entry->initial_send_sequence, entry->initial_receive_sequence,
+				entry->retransmits, entry->timeout);
+		}
+	}
+}
+
+
+SynCache::Stripe&
+SynCache::_StripeFor(const sockaddr* local, const sockaddr* peer) const
+{
+	return *fStripes[tcp_hash_stripe(
+		fManager->AddressModule()->hash_address_pair(local, peer))];
+}
+
+
+net_buffer*
+SynCache::_CreateReply(const syn_cache_entry& entry)
+{
+	tcp_segment_header segment(TCP_FLAG_SYNCHRONIZE | TCP_FLAG_ACKNOWLEDGE);
+	segment.sequence = entry.initial_send_sequence;
+	segment.acknowledge = entry.initial_receive_sequence + 1;
+	segment.advertised_window = entry.receive_window;
+	segment.urgent_offset = 0;
+	segment.max_segment_size = entry.receive_max_segment_size;
+
+	if ((entry.options & TCP_HAS_WINDOW_SCALE) != 0) {
+		segment.options |= TCP_HAS_WINDOW_SCALE;
+		segment.window_shift = entry.receive_window_shift;
+	}
+	if ((entry.options & TCP_HAS_TIMESTAMPS) != 0) {
+		segment.options |= TCP_HAS_TIMESTAMPS;
+		segment.timestamp_value = tcp_now();
+		segment.timestamp_reply = entry.received_timestamp;
+	}
+	if ((entry.options & TCP_SACK_PERMITTED) != 0)
+		segment.options |= TCP_SACK_PERMITTED;
+
+	return fManager->CreateSegment((const sockaddr*)&entry.local,
+		(const sockaddr*)&entry.peer, segment);
+}
+
+
+/*!	Makes sure that there are secrets for the current and the next cookie
+	counter period. They replace the secrets of periods whose cookies are no
+	longer accepted.
+	This reads from the random device, and must therefore only be called
+	from Init() or Timer(), never when processing a segment.
+*/
+void
+SynCache::_RotateSecrets()
+{
+	bigtime_t period = system_time() >> kCookieCounterShift;
+
+	for (bigtime_t next = period; next <= period + 1; next++) {
+		CookieSecret& secret = fSecrets[next % SYN_COOKIE_SECRET_COUNT];
+
+		ReadLocker readLocker(fSecretLock);
+		if (secret.period == next)
+			continue;
+		readLocker.Unlock();
+
+		uint8 key[SYN_COOKIE_SECRET_SIZE];
+		if (read_random(key, sizeof(key)) != B_OK)
+			continue;
+
+		WriteLocker writeLocker(fSecretLock);
+		memcpy(secret.key, key, sizeof(key));
+		secret.period = next;
+		writeLocker.Unlock();
+
+		memset(key, 0, sizeof(key));
+	}
+}
+
+
+/*!	Copies the secret of the given cookie counter \a period to \a key.
+	Returns \c false if there is none.
+*/
+bool
+SynCache::_GetSecret(bigtime_t period, uint8* key)
+{
+	CookieSecret& secret = fSecrets[period % SYN_COOKIE_SECRET_COUNT];
+
+	ReadLocker readLocker(fSecretLock);
+	if (secret.period != period)
+		return false;
+
+	memcpy(key, secret.key, sizeof(secret.key));
+	return true;
+}
+
+
+uint32
+SynCache::_CookieHash(const uint8* key, const sockaddr* local,
+	const sockaddr* peer, uint32 receiveSequence, uint32 counter) const
+{
+	net_address_module_info* module = fManager->AddressModule();
+
+	uint32 data[5];
+	data[0] = module->hash_address(local, false);
+	data[1] = module->hash_address(peer, false);
+	data[2] = ((uint32)module->get_port(local) << 16) | module->get_port(peer);
+	data[3] = receiveSequence;
+	data[4] = counter;
+
+	SHA256 sha;
+	sha.Update(key, SYN_COOKIE_SECRET_SIZE);
+	sha.Update(data, sizeof(data));
+
+	const uint8* digest = sha.Digest();
+	return digest[0] | ((uint32)digest[1] << 8) | ((uint32)digest[2] << 16)
+		| ((uint32)digest[3] << 24);
+}
+
+
+status_t
+SynCache::_CreateCookie(const sockaddr* local, const sockaddr* peer,
+	uint32 receiveSequence, uint16 maxSegmentSize, uint32& _cookie)
+{
+	uint32 index = 0;
+	while (index < 7 && kCookieSegmentSizes[index + 1] <= maxSegmentSize)
+		index++;
+
+	bigtime_t period = system_time() >> kCookieCounterShift;
+	uint32 counter = period & kCookieCounterMask;
+
+	uint8 key[SYN_COOKIE_SECRET_SIZE];
+	if (!_GetSecret(period, key)) {
+		// The timer has not been running for a while; it will create the
+		// secret, and the peer will retransmit its SYN.
+		fManager->StartTimer();
+		return B_ERROR;
+	}
+
+	_cookie = (counter << 27)
+		| ((_CookieHash(key, local, peer, receiveSequence, counter)
+			& 0xffffff) << 3)
+		| index;
+	return B_OK;
+}
+
+
+bool
+SynCache::_CheckCookie(const sockaddr* local, const sockaddr* peer,
+	tcp_segment_header& segment, uint16& _maxSegmentSize)
+{
+	// only accept cookies if we actually sent some lately, so that it does
+	// not become any easier to guess a valid connection
+	if (fLastCookieTime == 0
+		|| system_time() - fLastCookieTime > (2LL << kCookieCounterShift))
+		return false;
+
+	uint32 cookie = segment.acknowledge - 1;
+	uint32 counter = cookie >> 27;
+	bigtime_t period = system_time() >> kCookieCounterShift;
+	uint32 age = ((uint32)period - counter) & kCookieCounterMask;
+	if (age > 1)
+		return false;
+
+	uint8 key[SYN_COOKIE_SECRET_SIZE];
+	if (!_GetSecret(period - age, key))
+		return false;
+
+	uint32 hash = _CookieHash(key, local, peer, segment.sequence - 1,
+		counter);
+	if (((cookie >> 3) & 0xffffff) != (hash & 0xffffff))
+		return false;
+
+	_maxSegmentSize = kCookieSegmentSizes[cookie & 7];
+	return true;
+}
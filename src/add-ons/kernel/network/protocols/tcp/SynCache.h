@@ -0,0 +1,144 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef SYN_CACHE_H
+#define SYN_CACHE_H
+
+
+#include "tcp.h"
+
+#include <lock.h>
+#include <util/DoublyLinkedList.h>
+#include <util/OpenHashTable.h>
+
+#include <utility>
+
+
+class EndpointManager;
+
+
+#define SYN_COOKIE_SECRET_SIZE	16
+#define SYN_COOKIE_SECRET_COUNT	3
+
+
+/*!	Everything that needs to be remembered about a connection for which we
+	have received a SYN, and answered it with a SYN+ACK, but that has not yet
+	been acknowledged by the peer.
+*/
+struct syn_cache_entry : DoublyLinkedListLinkImpl<syn_cache_entry> {
+	syn_cache_entry*	hash_link;
+	sockaddr_storage	local;
+	sockaddr_storage	peer;
+	bigtime_t			timeout;
+	uint32				initial_send_sequence;
+	uint32				initial_receive_sequence;
+	uint32				received_timestamp;
+	uint16				send_max_segment_size;
+	uint16				receive_max_segment_size;
+	uint16				receive_window;
+	uint8				send_window_shift;
+	uint8				receive_window_shift;
+	uint8				options;
+	uint8				retransmits;
+};
+
+
+struct SynCacheHashDefinition {
+	typedef std::pair<const sockaddr*, const sockaddr*> KeyType;
+	typedef syn_cache_entry ValueType;
+
+							SynCacheHashDefinition(
+								net_address_module_info* module)
+								: fModule(module)
+							{
+							}
+							SynCacheHashDefinition(
+								const SynCacheHashDefinition& definition)
+								: fModule(definition.fModule)
+							{
+							}
+
+			size_t			HashKey(const KeyType& key) const;
+			size_t			Hash(syn_cache_entry* entry) const;
+			bool			Compare(const KeyType& key,
+								syn_cache_entry* entry) const;
+			syn_cache_entry*& GetLink(syn_cache_entry* entry) const;
+
+private:
+	net_address_module_info* fModule;
+};
+
+
+/*!	Keeps the half-open connections of all listening endpoints of a domain,
+	so that a full endpoint only needs to be created once the connection has
+	been established. When the cache is full, SYN cookies are used instead.
+*/
+class SynCache {
+public:
+							SynCache(EndpointManager* manager);
+							~SynCache();
+
+			status_t		Init();
+
+			status_t		SynchronizeReceived(tcp_segment_header& segment,
+								net_buffer* buffer, uint32 maxSegmentSize,
+								size_t receiveBufferSize, bool useOptions);
+			bool			Lookup(const sockaddr* local, const sockaddr* peer,
+								tcp_segment_header& segment,
+								syn_cache_entry& _entry);
+			void			Remove(const sockaddr* local,
+								const sockaddr* peer);
+			void			ResetReceived(tcp_segment_header& segment,
+								net_buffer* buffer);
+
+			bool			IsEmpty() const { return fCount == 0; }
+			void			Timer();
+
+			void			Dump() const;
+
+private:
+	typedef BOpenHashTable<SynCacheHashDefinition> EntryTable;
+	typedef DoublyLinkedList<syn_cache_entry> EntryList;
+
+	struct Stripe {
+								Stripe(net_address_module_info* module);
+								~Stripe();
+
+			mutex				lock;
+			EntryTable			table;
+			EntryList			list;
+			int32				count;
+	};
+
+	struct CookieSecret {
+			bigtime_t			period;
+			uint8				key[SYN_COOKIE_SECRET_SIZE];
+	};
+
+			Stripe&			_StripeFor(const sockaddr* local,
+								const sockaddr* peer) const;
+			net_buffer*		_CreateReply(const syn_cache_entry& entry);
+			void			_RotateSecrets();
+			bool			_GetSecret(bigtime_t period, uint8* key);
+			uint32			_CookieHash(const uint8* key,
+								const sockaddr* local, const sockaddr* peer,
+								uint32 receiveSequence, uint32 counter) const;
+			status_t		_CreateCookie(const sockaddr* local,
+								const sockaddr* peer, uint32 receiveSequence,
+								uint16 maxSegmentSize, uint32& _cookie);
+			bool			_CheckCookie(const sockaddr* local,
+								const sockaddr* peer,
+								tcp_segment_header& segment,
+								uint16& _maxSegmentSize);
+
+			EndpointManager* fManager;
+			Stripe*			fStripes[TCP_HASH_STRIPES];
+			int32			fCount;
+			rw_lock			fSecretLock;
+			CookieSecret	fSecrets[SYN_COOKIE_SECRET_COUNT];
+			bigtime_t		fLastCookieTime;
+};
+
+
+#endif	// SYN_CACHE_H
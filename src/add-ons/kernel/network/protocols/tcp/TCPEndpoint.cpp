@@ -41,17 +41,20 @@
 //  - RFC 793 - Transmission Control Protocol
 //  - RFC 813 - Window and Acknowledgement Strategy in TCP
 //	- RFC 1337 - TIME_WAIT Assassination Hazards in TCP
+//	- RFC 2018 - TCP Selective Acknowledgment Options
+//	- RFC 4987 - TCP SYN Flooding Attacks and Common Mitigations
+//	- RFC 5681 - TCP Congestion Control
+//	- RFC 6298 - Computing TCP's Retransmission Timer
+//	- RFC 6582 - The NewReno Modification to TCP's Fast Recovery Algorithm
+//	- RFC 6191 - Reducing the TIME-WAIT State Using TCP Timestamps
+//	- RFC 6675 - A Conservative Loss Recovery Algorithm Based on SACK
+//	- RFC 7323 - TCP Extensions for High Performance
 //
 // Things this implementation currently doesn't implement:
-//	- TCP Slow Start, Congestion Avoidance, Fast Retransmit, and Fast Recovery,
-//	  RFC 2001, RFC 2581, RFC 3042
-//	- NewReno Modification to TCP's Fast Recovery, RFC 2582
+//	- Limited Transmit, RFC 3042
 //	- Explicit Congestion Notification (ECN), RFC 3168
-//	- SYN-Cache
-//	- TCP Extensions for High Performance, RFC 1323
-//	- SACK, Selective Acknowledgment - RFC 2018, RFC 2883, RFC 3517
+//	- Duplicate SACK, RFC 2883
 //	- Forward RTO-Recovery, RFC 4138
-//	- Time-Wait hash instead of keeping sockets alive
 
 #define PrintAddress(address) \
 	AddressString(Domain(), address, true).Data()
@@ -69,15 +72,18 @@
 #endif
 
 #ifdef PROBE_TCP
-#	define PROBE(buffer, window) \
-	dprintf("TCP PROBE %llu %s %s %ld snxt %lu suna %lu cw %lu sst %lu win %lu swin %lu smax-suna %lu savail %lu sqused %lu rto %llu\n", \
+#	define PROBE(buffer) \
+	dprintf("TCP PROBE %llu %s %s %ld snxt %lu suna %lu cw %lu sst %lu swin %lu smax-suna %lu sacked %lu savail %lu sqused %lu srtt %llu rto %llu\n", \
 		system_time(), PrintAddress(buffer->source), \
 		PrintAddress(buffer->destination), buffer->size, fSendNext.Number(), \
-		fSendUnacknowledged.Number(), fCongestionWindow, fSlowStartThreshold, \
-		window, fSendWindow, (fSendMax - fSendUnacknowledged).Number(), \
-		fSendQueue.Available(fSendNext), fSendQueue.Used(), fRetransmitTimeout)
+		fSendUnacknowledged.Number(), \
+		fCongestionControl->CongestionWindow(), \
+		fCongestionControl->SlowStartThreshold(), fSendWindow, \
+		(fSendMax - fSendUnacknowledged).Number(), \
+		fSackScoreboard.SackedBytes(), fSendQueue.Available(fSendNext), \
+		fSendQueue.Used(), fRoundTripTime, fRetransmitTimeout)
 #else
-#	define PROBE(buffer, window)	do { } while (0)
+#	define PROBE(buffer)	do { } while (0)
 #endif
 
 #if TCP_TRACING
@@ -252,8 +258,9 @@ protected:
 #	define T(x)
 #endif	// TCP_TRACING
 
-// Initial estimate for packet round trip time (RTT)
-#define TCP_INITIAL_RTT		2000000
+// Initial retransmit timeout, before the round trip time has been measured
+// (RFC 6298)
+#define TCP_INITIAL_RETRANSMIT_TIMEOUT	1000000
 
 // constants for the fFlags field
 enum {
@@ -265,13 +272,13 @@ enum {
 	FLAG_NO_RECEIVE				= 0x04,
 	FLAG_CLOSED					= 0x08,
 	FLAG_DELETE_ON_CLOSE		= 0x10,
-	FLAG_LOCAL					= 0x20
+	FLAG_LOCAL					= 0x20,
+	FLAG_OPTION_SACK_PERMITTED	= 0x40,
+	FLAG_RECOVERY				= 0x80,
+	FLAG_SEGMENTATION_OFFLOAD	= 0x100
 };
 
 
-static const int kTimestampFactor = 1024;
-
-
 static inline bigtime_t
 absolute_timeout(bigtime_t timeout)
 {
@@ -326,20 +333,10 @@ is_writable(tcp_state state)
 }
 
 
-static inline uint32 tcp_now()
-{
-	return system_time() / kTimestampFactor;
-}
-
-
 static inline uint32 tcp_diff_timestamp(uint32 base)
 {
-	uint32 now = tcp_now();
-
-	if (now > base)
-		return now - base;
-
-	return now + UINT_MAX - base;
+	// this also works correctly when the timestamp clock wrapped around
+	return tcp_now() - base;
 }
 
 
@@ -429,20 +426,25 @@ TCPEndpoint::TCPEndpoint(net_socket* socket)
 	fSendQueue(socket->send.buffer_size),
 	fInitialSendSequence(0),
 	fDuplicateAcknowledgeCount(0),
+	fRecoveryPoint(0),
+	fRetransmitHigh(0),
 	fRoute(NULL),
 	fReceiveNext(0),
 	fReceiveMaxAdvertised(0),
 	fReceiveWindow(socket->receive.buffer_size),
 	fReceiveMaxSegmentSize(TCP_DEFAULT_MAX_SEGMENT_SIZE),
 	fReceiveQueue(socket->receive.buffer_size),
-	fRoundTripTime(TCP_INITIAL_RTT / kTimestampFactor),
-	fRoundTripDeviation(TCP_INITIAL_RTT / kTimestampFactor),
-	fRetransmitTimeout(TCP_INITIAL_RTT),
+	fLastOutOfOrderSequence(0),
+	fRoundTripTime(0),
+	fRoundTripDeviation(0),
+	fRetransmitTimeout(TCP_INITIAL_RETRANSMIT_TIMEOUT),
+	fRoundTripSequence(0),
+	fRoundTripStartTime(0),
 	fReceivedTimestamp(0),
-	fCongestionWindow(0),
-	fSlowStartThreshold(0),
+	fCongestionControl(create_congestion_control(NULL)),
 	fState(CLOSED),
-	fFlags(FLAG_OPTION_WINDOW_SCALE | FLAG_OPTION_TIMESTAMP)
+	fFlags(FLAG_OPTION_WINDOW_SCALE | FLAG_OPTION_TIMESTAMP
+		| FLAG_OPTION_SACK_PERMITTED)
 {
 	// TODO: to be replaced with a real read/write locking strategy!
 	mutex_init(&fLock, "tcp lock");
@@ -478,6 +480,8 @@ TCPEndpoint::~TCPEndpoint()
 	gStackModule->wait_for_timer(&fTimeWaitTimer);
 
 	gDatalinkModule->put_route(Domain(), fRoute);
+
+	delete fCongestionControl;
 }
 
 
@@ -490,6 +494,9 @@ TCPEndpoint::InitCheck() const
 	if (fSendList.InitCheck() < B_OK)
 		return fSendList.InitCheck();
 
+	if (fCongestionControl == NULL)
+		return B_NO_MEMORY;
+
 	return B_OK;
 }
 
@@ -803,6 +810,11 @@ TCPEndpoint::SendData(net_buffer *buffer)
 
 	while (left > 0) {
 		while (fSendQueue.Free() < socket->send.low_water_mark) {
+			// push out what is already queued, or no ACK would ever make
+			// room for the rest of the buffer
+			if (fState == ESTABLISHED || fState == FINISH_RECEIVED)
+				_SendQueued();
+
 			// wait until enough space is available
 			status_t status = fSendList.Wait(lock, timeout);
 			if (status < B_OK) {
@@ -1018,6 +1030,17 @@ TCPEndpoint::SetReceiveBufferSize(size_t length)
 status_t
 TCPEndpoint::GetOption(int option, void* _value, int* _length)
 {
+	if (option == TCP_CONGESTION) {
+		if (*_length <= 0)
+			return B_BAD_VALUE;
+
+		MutexLocker _(fLock);
+		if (*_length > TCP_CA_NAME_MAX)
+			*_length = TCP_CA_NAME_MAX;
+		strlcpy((char*)_value, fCongestionControl->Name(), *_length);
+		return B_OK;
+	}
+
 	if (*_length != sizeof(int))
 		return B_BAD_VALUE;
 
@@ -1044,6 +1067,25 @@ TCPEndpoint::GetOption(int option, void* _value, int* _length)
 status_t
 TCPEndpoint::SetOption(int option, const void* _value, int length)
 {
+	if (option == TCP_CONGESTION) {
+		if (length <= 0)
+			return B_BAD_VALUE;
+
+		char name[TCP_CA_NAME_MAX];
+		strlcpy(name, (const char*)_value,
+			min_c((size_t)length + 1, sizeof(name)));
+
+		CongestionControl* control = create_congestion_control(name);
+		if (control == NULL)
+			return ENOENT;
+
+		MutexLocker _(fLock);
+		control->TakeOver(*fCongestionControl);
+		delete fCongestionControl;
+		fCongestionControl = control;
+		return B_OK;
+	}
+
 	if (option != TCP_NODELAY)
 		return B_BAD_VALUE;
 
@@ -1115,10 +1157,20 @@ TCPEndpoint::_EnterTimeWait()
 
 	_CancelConnectionTimers();
 
-	if (fState == TIME_WAIT && IsLocal()) {
-		// we do not use TIME_WAIT state for local connections
-		fFlags |= FLAG_DELETE_ON_CLOSE;
-		return;
+	if (fState == TIME_WAIT) {
+		if ((fFlags & FLAG_DELETE_ON_CLOSE) != 0) {
+			// the connection has already been handed over
+			return;
+		}
+
+		// We do not use TIME_WAIT state for local connections; for all
+		// others, the time-wait table of the manager takes over, so that we
+		// do not need to keep the endpoint around
+		if (IsLocal() || fManager->EnterTimeWait(this,
+				(fFlags & FLAG_OPTION_TIMESTAMP) != 0) == B_OK) {
+			fFlags |= FLAG_DELETE_ON_CLOSE;
+			return;
+		}
 	}
 
 	_UpdateTimeWait();
@@ -1237,35 +1289,79 @@ TCPEndpoint::_HandleReset(status_t error)
 }
 
 
+/*!	Called for every acknowledgement that does not advance the left edge
+	of the send window while there is data in flight, but either reports new
+	SACK information, or is a duplicate as defined by RFC 5681.
+	Enters fast recovery when enough data is considered lost, and sends as
+	much as the congestion window allows while in recovery.
+*/
 void
 TCPEndpoint::_DuplicateAcknowledge(tcp_segment_header &segment)
 {
-	if (++fDuplicateAcknowledgeCount < 3)
+	fDuplicateAcknowledgeCount++;
+
+	bool sack = (fFlags & FLAG_OPTION_SACK_PERMITTED) != 0;
+
+	if ((fFlags & FLAG_RECOVERY) != 0) {
+		if (sack)
+			_SendRecovery();
+		else {
+			// every duplicate acknowledge means that another segment has
+			// left the network
+			fCongestionControl->InflateWindow(fSendMaxSegmentSize);
+			_SendQueued();
+		}
 		return;
+	}
 
-	if (fDuplicateAcknowledgeCount == 3) {
-		_ResetSlowStart();
-		fCongestionWindow = fSlowStartThreshold + 3
-			* fSendMaxSegmentSize;
-		fSendNext = segment.acknowledge;
-	} else if (fDuplicateAcknowledgeCount > 3)
-		fCongestionWindow += fSendMaxSegmentSize;
+	if (fDuplicateAcknowledgeCount < TCP_DUPLICATE_ACKNOWLEDGE_THRESHOLD
+		&& (!sack || !fSackScoreboard.IsLost(fSendUnacknowledged,
+			fSendMaxSegmentSize)))
+		return;
 
-	_SendQueued();
+	if (fSendUnacknowledged < fRecoveryPoint) {
+		// The data that is missing has been sent before the last congestion
+		// event; we already reacted to that (RFC 6582, section 4.1)
+		return;
+	}
+
+	TRACE("DuplicateAcknowledge(): entering fast recovery");
+
+	fFlags |= FLAG_RECOVERY;
+	fRecoveryPoint = fSendMax;
+	fRetransmitHigh = fSendUnacknowledged;
+
+	fCongestionControl->EnterRecovery(
+		(fSendMax - fSendUnacknowledged).Number());
+	if (!sack) {
+		fCongestionControl->InflateWindow(TCP_DUPLICATE_ACKNOWLEDGE_THRESHOLD
+			* fSendMaxSegmentSize);
+	}
+
+	_RetransmitSegment(fSendUnacknowledged, fSendMaxSegmentSize);
+
+	if (sack)
+		_SendRecovery();
+	else
+		_SendQueued();
 }
 
 
+/*!	Remembers the timestamp of the peer to echo it back as described in
+	RFC 7323, section 4.3.
+*/
 void
-TCPEndpoint::_UpdateTimestamps(tcp_segment_header& segment,
-	size_t segmentLength)
+TCPEndpoint::_UpdateTimestamps(tcp_segment_header& segment)
 {
-	if (fFlags & FLAG_OPTION_TIMESTAMP) {
-		tcp_sequence sequence(segment.sequence);
+	if ((fFlags & FLAG_OPTION_TIMESTAMP) == 0
+		|| (segment.options & TCP_HAS_TIMESTAMPS) == 0)
+		return;
 
-		if (fLastAcknowledgeSent >= sequence
-			&& fLastAcknowledgeSent < (sequence + segmentLength))
-			fReceivedTimestamp = segment.timestamp_value;
-	}
+	// the timestamp value is kept in network byte order
+	if (tcp_sequence(segment.sequence) <= fLastAcknowledgeSent
+		&& (int32)(ntohl(segment.timestamp_value)
+			- ntohl(fReceivedTimestamp)) >= 0)
+		fReceivedTimestamp = segment.timestamp_value;
 }
 
 
@@ -1356,10 +1452,15 @@ TCPEndpoint::_PrepareReceivePath(tcp_segment_header& segment)
 			fReceivedTimestamp = segment.timestamp_value;
 		} else
 			fFlags &= ~FLAG_OPTION_TIMESTAMP;
-	}
 
-	fCongestionWindow = 2 * fSendMaxSegmentSize;
-	fSlowStartThreshold = (uint32)segment.advertised_window << fSendWindowShift;
+		if ((segment.options & TCP_SACK_PERMITTED) != 0)
+			fFlags |= FLAG_OPTION_SACK_PERMITTED;
+		else
+			fFlags &= ~FLAG_OPTION_SACK_PERMITTED;
+	} else
+		fFlags &= ~FLAG_OPTION_SACK_PERMITTED;
+
+	fCongestionControl->Start(fSendMaxSegmentSize);
 }
 
 
@@ -1374,9 +1475,12 @@ TCPEndpoint::_ShouldReceive() const
 }
 
 
+/*!	Initializes a new endpoint for a connection that has just been
+	acknowledged by the peer, and that was only known to the SYN cache so far.
+*/
 int32
-TCPEndpoint::_Spawn(TCPEndpoint* parent, tcp_segment_header& segment,
-	net_buffer* buffer)
+TCPEndpoint::_Spawn(TCPEndpoint* parent, const syn_cache_entry& entry,
+	tcp_segment_header& segment, net_buffer* buffer)
 {
 	MutexLocker _(fLock);
 
@@ -1406,18 +1510,83 @@ TCPEndpoint::_Spawn(TCPEndpoint* parent, tcp_segment_header& segment,
 	fOptions = parent->fOptions;
 	fAcceptSemaphore = parent->fAcceptSemaphore;
 
-	_PrepareReceivePath(segment);
+	if (strcmp(parent->fCongestionControl->Name(),
+			fCongestionControl->Name()) != 0) {
+		// use the congestion control algorithm of the listening socket
+		CongestionControl* control = create_congestion_control(
+			parent->fCongestionControl->Name());
+		if (control != NULL) {
+			delete fCongestionControl;
+			fCongestionControl = control;
+		}
+	}
+
+	// our SYN+ACK has already been sent from the SYN cache
+	fInitialSendSequence = entry.initial_send_sequence;
+	fSendUnacknowledged = fInitialSendSequence;
+	fSendNext = fInitialSendSequence + 1;
+	fSendMax = fSendNext;
+	fSendUrgentOffset = fInitialSendSequence;
+	fRecoveryPoint = fInitialSendSequence;
+	fRetransmitHigh = fInitialSendSequence;
+	fSendQueue.SetInitialSequence(fSendNext);
+
+	// reconstruct the SYN of the peer
+	tcp_segment_header synchronize(TCP_FLAG_SYNCHRONIZE);
+	synchronize.sequence = entry.initial_receive_sequence;
+	synchronize.max_segment_size = entry.send_max_segment_size;
+	synchronize.window_shift = entry.send_window_shift;
+	synchronize.timestamp_value = entry.received_timestamp;
+	synchronize.options = entry.options;
+
+	_PrepareReceivePath(synchronize);
+	if ((fFlags & FLAG_OPTION_WINDOW_SCALE) != 0)
+		fReceiveWindowShift = entry.receive_window_shift;
+
+	fLastAcknowledgeSent = fReceiveNext;
+	fReceiveMaxAdvertised = fReceiveNext + entry.receive_window;
+
+	return _Receive(segment, buffer);
+}
 
-	// send SYN+ACK
-	if (_SendQueued() != B_OK) {
-		T(Error(this, "sending failed", __LINE__));
+
+/*!	Handles an ACK received by a listening endpoint: if it completes a
+	connection from the SYN cache, or with a SYN cookie, a new endpoint is
+	spawned for it.
+*/
+int32
+TCPEndpoint::_CompleteConnection(tcp_segment_header& segment,
+	net_buffer* buffer)
+{
+	syn_cache_entry entry;
+	if (!fManager->GetSynCache().Lookup(buffer->destination, buffer->source,
+			segment, entry)) {
+		// An earlier ACK might have completed the connection in the mean
+		// time, while we were waiting for our lock
+		TCPEndpoint* endpoint = fManager->FindConnection(buffer->destination,
+			buffer->source);
+		if (endpoint == NULL)
+			return DROP | RESET;
+
+		int32 action = endpoint->SegmentReceived(segment, buffer);
+		gSocketModule->release_socket(endpoint->socket);
+		return action & ~(ACKNOWLEDGE | IMMEDIATE_ACKNOWLEDGE);
+	}
+
+	// spawn new endpoint for accept()
+	net_socket* newSocket;
+	if (gSocketModule->spawn_pending_socket(socket, &newSocket) < B_OK) {
+		// the connection stays in the SYN cache, so that it can be completed
+		// when the peer retransmits
+		T(Error(this, "spawning failed", __LINE__));
 		return DROP;
 	}
 
-	segment.flags &= ~TCP_FLAG_SYNCHRONIZE;
-		// we handled this flag now, it must not be set for further processing
+	fManager->GetSynCache().Remove((sockaddr*)&entry.local,
+		(sockaddr*)&entry.peer);
 
-	return _Receive(segment, buffer);
+	return ((TCPEndpoint *)newSocket->first_protocol)->_Spawn(this, entry,
+		segment, buffer);
 }
 
 
@@ -1428,24 +1597,24 @@ TCPEndpoint::_ListenReceive(tcp_segment_header& segment, net_buffer* buffer)
 
 	// Essentially, we accept only TCP_FLAG_SYNCHRONIZE in this state,
 	// but the error behaviour differs
-	if (segment.flags & TCP_FLAG_RESET)
+	if (segment.flags & TCP_FLAG_RESET) {
+		fManager->GetSynCache().ResetReceived(segment, buffer);
 		return DROP;
+	}
 	if (segment.flags & TCP_FLAG_ACKNOWLEDGE)
-		return DROP | RESET;
+		return _CompleteConnection(segment, buffer);
 	if ((segment.flags & TCP_FLAG_SYNCHRONIZE) == 0)
 		return DROP;
 
 	// TODO: drop broadcast/multicast
 
-	// spawn new endpoint for accept()
-	net_socket* newSocket;
-	if (gSocketModule->spawn_pending_socket(socket, &newSocket) < B_OK) {
-		T(Error(this, "spawning failed", __LINE__));
-		return DROP;
-	}
+	// The endpoint is only spawned when the peer acknowledges our SYN, until
+	// then, the SYN cache keeps what is needed to establish the connection
+	fManager->GetSynCache().SynchronizeReceived(segment, buffer,
+		_MaxSegmentSize(buffer->source), socket->receive.buffer_size,
+		(fOptions & TCP_NOOPT) == 0);
 
-	return ((TCPEndpoint *)newSocket->first_protocol)->_Spawn(this,
-		segment, buffer);
+	return DROP;
 }
 
 
@@ -1502,7 +1671,7 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 		&& fReceiveNext == segment.sequence
 		&& advertisedWindow > 0 && advertisedWindow == fSendWindow
 		&& fSendNext == fSendMax) {
-		_UpdateTimestamps(segment, segmentLength);
+		_UpdateTimestamps(segment);
 
 		if (segmentLength == 0) {
 			// this is a pure acknowledge segment - we're on the sending end
@@ -1515,11 +1684,15 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 			&& fReceiveQueue.IsContiguous()
 			&& fReceiveQueue.Free() >= segmentLength
 			&& (fFlags & FLAG_NO_RECEIVE) == 0) {
+			// A coalesced buffer contains at least two full segments, which
+			// are acknowledged right away (RFC 5681, section 4.2)
+			bool immediate = (segment.flags & TCP_FLAG_PUSH) != 0
+				|| buffer->segment_size != 0;
+
 			if (_AddData(segment, buffer))
 				_NotifyReader();
 
-			return KEEP | ((segment.flags & TCP_FLAG_PUSH) != 0
-				? IMMEDIATE_ACKNOWLEDGE : ACKNOWLEDGE);
+			return KEEP | (immediate ? IMMEDIATE_ACKNOWLEDGE : ACKNOWLEDGE);
 		}
 	}
 
@@ -1628,6 +1801,8 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 	}
 #endif
 
+	bool windowUpdate = advertisedWindow != fSendWindow;
+
 	fSendWindow = advertisedWindow;
 	if (advertisedWindow > fSendMaxWindow)
 		fSendMaxWindow = advertisedWindow;
@@ -1643,24 +1818,33 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 			return DROP | IMMEDIATE_ACKNOWLEDGE;
 
 		if (segment.acknowledge < fSendUnacknowledged) {
-			if (buffer->size == 0 && advertisedWindow == fSendWindow
-				&& (segment.flags & TCP_FLAG_FINISH) == 0) {
+			// an old acknowledge
+			return DROP;
+		}
+
+		if (segment.acknowledge == fSendUnacknowledged) {
+			uint32 newlySacked = 0;
+			if ((fFlags & FLAG_OPTION_SACK_PERMITTED) != 0
+				&& segment.sack_count > 0) {
+				newlySacked = fSackScoreboard.Update(fSendUnacknowledged,
+					fSendMax, segment.sacks, segment.sack_count);
+			}
+
+			if (fSendMax > fSendUnacknowledged
+				&& ((buffer->size == 0 && !windowUpdate
+						&& (segment.flags & (TCP_FLAG_SYNCHRONIZE
+							| TCP_FLAG_FINISH)) == 0)
+					|| newlySacked > 0)) {
 				TRACE("Receive(): duplicate ack!");
 
 				_DuplicateAcknowledge(segment);
+			} else if (fSendQueue.Used() > 0) {
+				// the window might have opened
+				_SendQueued();
 			}
-
-			return DROP;
 		} else {
 			// this segment acknowledges in flight data
 
-			if (fDuplicateAcknowledgeCount >= 3) {
-				// deflate the window.
-				fCongestionWindow = fSlowStartThreshold;
-			}
-
-			fDuplicateAcknowledgeCount = 0;
-
 			if (fSendMax == segment.acknowledge)
 				TRACE("Receive(): all inflight data ack'd!");
 
@@ -1708,9 +1892,21 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 	uint32 bufferSize = buffer->size;
 
 	if ((bufferSize > 0 || (segment.flags & TCP_FLAG_FINISH) != 0)
-		&& _ShouldReceive())
+		&& _ShouldReceive()) {
+		if (bufferSize > 0 && (fReceiveNext != segment.sequence
+				|| !fReceiveQueue.IsContiguous())) {
+			// Out of order data, or data that fills a hole: the peer needs
+			// to know about it immediately (RFC 5681, section 4.2)
+			fLastOutOfOrderSequence = segment.sequence;
+			action |= IMMEDIATE_ACKNOWLEDGE;
+		}
+		if (buffer->segment_size != 0) {
+			// a coalesced buffer contains at least two full segments
+			action |= IMMEDIATE_ACKNOWLEDGE;
+		}
+
 		notify = _AddData(segment, buffer);
-	else {
+	} else {
 		if ((fFlags & FLAG_NO_RECEIVE) != 0)
 			fReceiveNext += buffer->size;
 
@@ -1764,7 +1960,7 @@ TCPEndpoint::_Receive(tcp_segment_header& segment, net_buffer* buffer)
 	if (bufferSize > 0 || (segment.flags & TCP_FLAG_SYNCHRONIZE) != 0)
 		action |= ACKNOWLEDGE;
 
-	_UpdateTimestamps(segment, segmentLength);
+	_UpdateTimestamps(segment);
 
 	TRACE("Receive() Action %ld", action);
 
@@ -1870,7 +2066,7 @@ TCPEndpoint::_ShouldSendSegment(tcp_segment_header& segment, uint32 length,
 		// - the buffer is at least larger than half of the maximum send window,
 		//   or
 		// - we're retransmitting data
-		if (length == segmentMaxSize
+		if (length >= segmentMaxSize
 			|| (fOptions & TCP_NODELAY) != 0
 			|| tcp_sequence(fSendNext + length) == fSendQueue.LastSequence()
 			|| (fSendMaxWindow > 0 && length >= fSendMaxWindow / 2))
@@ -1910,21 +2106,12 @@ TCPEndpoint::_SendQueued(bool force)
 }
 
 
-/*!	Sends one or more TCP segments with the data waiting in the queue, or some
-	specific flags that need to be sent.
+/*!	Fills in the options, the window, and the acknowledge number of the
+	\a segment that is about to be sent.
 */
-status_t
-TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
+void
+TCPEndpoint::_PrepareSegment(tcp_segment_header& segment)
 {
-	if (fRoute == NULL)
-		return B_ERROR;
-
-	// in passive state?
-	if (fState == LISTEN)
-		return B_ERROR;
-
-	tcp_segment_header segment(_CurrentFlags());
-
 	if ((fOptions & TCP_NOOPT) == 0) {
 		if ((fFlags & FLAG_OPTION_TIMESTAMP) != 0) {
 			segment.options |= TCP_HAS_TIMESTAMPS;
@@ -1940,6 +2127,15 @@ TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
 				segment.options |= TCP_HAS_WINDOW_SCALE;
 				segment.window_shift = fReceiveWindowShift;
 			}
+			if ((fFlags & FLAG_OPTION_SACK_PERMITTED) != 0)
+				segment.options |= TCP_SACK_PERMITTED;
+		}
+
+		if ((fFlags & FLAG_OPTION_SACK_PERMITTED) != 0
+			&& !fReceiveQueue.IsContiguous()) {
+			// tell the peer about the data we received out of order
+			segment.sack_count = fReceiveQueue.PopulateSackInfo(
+				fLastOutOfOrderSequence, TCP_MAX_SACK_BLOCKS, segment.sacks);
 		}
 	}
 
@@ -1961,9 +2157,124 @@ TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
 			// send window on overlap
 		segment.urgent_offset = 0;
 	}
+}
+
 
-	if (fCongestionWindow > 0 && fCongestionWindow < sendWindow)
-		sendWindow = fCongestionWindow;
+/*!	Sends a single segment with \a segmentLength bytes of data from the send
+	queue, starting at fSendNext, and updates the send state accordingly.
+*/
+status_t
+TCPEndpoint::_SendSegment(tcp_segment_header& segment, uint32 segmentLength)
+{
+	net_buffer *buffer = gBufferModule->create(256);
+	if (buffer == NULL)
+		return B_NO_MEMORY;
+
+	status_t status = B_OK;
+	if (segmentLength > 0)
+		status = fSendQueue.Get(buffer, fSendNext, segmentLength);
+	if (status < B_OK) {
+		gBufferModule->free(buffer);
+		return status;
+	}
+
+	LocalAddress().CopyTo(buffer->source);
+	PeerAddress().CopyTo(buffer->destination);
+
+	uint32 segmentMaxSize = fSendMaxSegmentSize - tcp_options_length(segment);
+	if (segmentLength > segmentMaxSize) {
+		// this is a super-segment, it will be split into segments of the
+		// maximum size on its way to the device
+		buffer->segment_size = segmentMaxSize;
+	}
+
+	uint32 size = buffer->size;
+	segment.sequence = fSendNext.Number();
+
+	TRACE("SendQueued(): buffer %p (%lu bytes) address %s to %s\n"
+		"\tflags 0x%x, seq %lu, ack %lu, rwnd %hu, cwnd %lu, ssthresh %lu\n"
+		"\tlen %lu first %lu last %lu",
+		buffer, buffer->size, PrintAddress(buffer->source),
+		PrintAddress(buffer->destination), segment.flags, segment.sequence,
+		segment.acknowledge, segment.advertised_window,
+		fCongestionControl->CongestionWindow(),
+		fCongestionControl->SlowStartThreshold(), segmentLength,
+		fSendQueue.FirstSequence().Number(),
+		fSendQueue.LastSequence().Number());
+	T(Send(this, segment, buffer, fSendQueue.FirstSequence(),
+		fSendQueue.LastSequence()));
+
+	PROBE(buffer);
+
+	status = add_tcp_header(AddressModule(), segment, buffer);
+	if (status != B_OK) {
+		gBufferModule->free(buffer);
+		return status;
+	}
+
+	// Update send status - we need to do this before we send the data
+	// for local connections as the answer is directly handled
+
+	if (segment.flags & TCP_FLAG_SYNCHRONIZE) {
+		segment.options &= ~(TCP_HAS_WINDOW_SCALE | TCP_SACK_PERMITTED);
+		segment.max_segment_size = 0;
+		size++;
+	}
+
+	if (segment.flags & TCP_FLAG_FINISH)
+		size++;
+
+	uint32 sendMax = fSendMax.Number();
+	if (size > 0 && fSendNext >= fSendMax && fRoundTripStartTime == 0
+		&& (segment.options & TCP_HAS_TIMESTAMPS) == 0) {
+		// without timestamps, we time one segment per round trip
+		fRoundTripSequence = fSendNext + size;
+		fRoundTripStartTime = system_time();
+	}
+
+	fSendNext += size;
+	if (fSendMax < fSendNext)
+		fSendMax = fSendNext;
+
+	fReceiveMaxAdvertised = fReceiveNext
+		+ ((uint32)segment.advertised_window << fReceiveWindowShift);
+
+	status = next->module->send_routed_data(next, fRoute, buffer);
+	if (status < B_OK) {
+		gBufferModule->free(buffer);
+
+		fSendNext = segment.sequence;
+		fSendMax = sendMax;
+			// restore send status
+		return status;
+	}
+
+	if (segment.flags & TCP_FLAG_ACKNOWLEDGE)
+		fLastAcknowledgeSent = segment.acknowledge;
+
+	atomic_add(&gSegmentsSent, 1);
+	if (segmentLength > segmentMaxSize)
+		atomic_add(&gSuperSegmentsSent, 1);
+
+	return B_OK;
+}
+
+
+/*!	Sends one or more TCP segments with the data waiting in the queue, or some
+	specific flags that need to be sent.
+*/
+status_t
+TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
+{
+	if (fRoute == NULL)
+		return B_ERROR;
+
+	// in passive state?
+	if (fState == LISTEN)
+		return B_ERROR;
+
+	tcp_segment_header segment(_CurrentFlags());
+	_PrepareSegment(segment);
 
 	// fSendUnacknowledged
 	//  |    fSendNext      fSendMax
@@ -1988,6 +2299,23 @@ TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
 	} else
 		sendWindow -= consumedWindow;
 
+	uint32 congestionWindow = fCongestionControl->CongestionWindow();
+	if (congestionWindow > 0) {
+		// During SACK based loss recovery, the data the peer has already
+		// received, or that is considered lost, does not count as in flight
+		uint32 inFlight = consumedWindow;
+		if ((fFlags & (FLAG_RECOVERY | FLAG_OPTION_SACK_PERMITTED))
+				== (FLAG_RECOVERY | FLAG_OPTION_SACK_PERMITTED)) {
+			inFlight = fSackScoreboard.Pipe(fSendUnacknowledged, fSendMax,
+				fRetransmitHigh, fSendMaxSegmentSize);
+		}
+
+		if (inFlight >= congestionWindow)
+			sendWindow = 0;
+		else if (congestionWindow - inFlight < sendWindow)
+			sendWindow = congestionWindow - inFlight;
+	}
+
 	if (force && sendWindow == 0 && fSendNext <= fSendQueue.LastSequence()) {
 		// send one byte of data to ask for a window update
 		// (triggered by the persist timer)
@@ -2002,6 +2330,16 @@ TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
 			- tcp_options_length(segment);
 		uint32 segmentLength = min_c(length, segmentMaxSize);
 
+		if ((fFlags & FLAG_SEGMENTATION_OFFLOAD) != 0
+			&& length >= 2 * segmentMaxSize
+			&& (segment.flags & (TCP_FLAG_SYNCHRONIZE | TCP_FLAG_URGENT))
+				== 0) {
+			// send as many full segments as possible at once, the rest is
+			// left to the usual silly window avoidance
+			segmentLength = min_c(length, TCP_MAX_SUPER_SEGMENT_SIZE);
+			segmentLength -= segmentLength % segmentMaxSize;
+		}
+
 		if (fSendNext + segmentLength == fSendQueue.LastSequence()) {
 			if (state_needs_finish(fState))
 				segment.flags |= TCP_FLAG_FINISH;
@@ -2019,94 +2357,90 @@ TCPEndpoint::_SendQueued(bool force, uint32 sendWindow)
 			break;
 		}
 
-		net_buffer *buffer = gBufferModule->create(256);
-		if (buffer == NULL)
-			return B_NO_MEMORY;
-
-		status_t status = B_OK;
-		if (segmentLength > 0)
-			status = fSendQueue.Get(buffer, fSendNext, segmentLength);
-		if (status < B_OK) {
-			gBufferModule->free(buffer);
+		status_t status = _SendSegment(segment, segmentLength);
+		if (status != B_OK)
 			return status;
-		}
 
-		LocalAddress().CopyTo(buffer->source);
-		PeerAddress().CopyTo(buffer->destination);
+		length -= segmentLength;
+		segment.flags &= ~(TCP_FLAG_SYNCHRONIZE | TCP_FLAG_RESET
+			| TCP_FLAG_FINISH);
+	} while (length > 0);
 
-		uint32 size = buffer->size;
-		segment.sequence = fSendNext.Number();
+	// if we sent data from the beggining of the send queue,
+	// start the retransmition timer
+	if (previousSendNext == fSendUnacknowledged
+		&& fSendNext > previousSendNext) {
+		TRACE("  SendQueue(): set retransmit timer with rto %llu",
+			fRetransmitTimeout);
 
-		TRACE("SendQueued(): buffer %p (%lu bytes) address %s to %s\n"
-			"\tflags 0x%x, seq %lu, ack %lu, rwnd %hu, cwnd %lu, ssthresh %lu\n"
-			"\tlen %lu first %lu last %lu",
-			buffer, buffer->size, PrintAddress(buffer->source),
-			PrintAddress(buffer->destination), segment.flags, segment.sequence,
-			segment.acknowledge, segment.advertised_window,
-			fCongestionWindow, fSlowStartThreshold, segmentLength,
-			fSendQueue.FirstSequence().Number(),
-			fSendQueue.LastSequence().Number());
-		T(Send(this, segment, buffer, fSendQueue.FirstSequence(),
-			fSendQueue.LastSequence()));
+		gStackModule->set_timer(&fRetransmitTimer, fRetransmitTimeout);
+	}
 
-		PROBE(buffer, sendWindow);
-		sendWindow -= buffer->size;
+	return B_OK;
+}
 
-		status = add_tcp_header(AddressModule(), segment, buffer);
-		if (status != B_OK) {
-			gBufferModule->free(buffer);
-			return status;
-		}
 
-		// Update send status - we need to do this before we send the data
-		// for local connections as the answer is directly handled
+/*!	Sends up to \a length bytes of data starting at \a sequence again, but
+	no more than fit into a single segment.
+*/
+status_t
+TCPEndpoint::_RetransmitSegment(tcp_sequence sequence, uint32 length)
+{
+	tcp_sequence sendNext = fSendNext;
+	fSendNext = sequence;
 
-		if (segment.flags & TCP_FLAG_SYNCHRONIZE) {
-			segment.options &= ~TCP_HAS_WINDOW_SCALE;
-			segment.max_segment_size = 0;
-			size++;
-		}
+	tcp_segment_header segment(_CurrentFlags());
+	_PrepareSegment(segment);
 
-		if (segment.flags & TCP_FLAG_FINISH)
-			size++;
+	uint32 segmentMaxSize = fSendMaxSegmentSize - tcp_options_length(segment);
+	if (length > segmentMaxSize)
+		length = segmentMaxSize;
+	if (length > fSendQueue.Available(sequence))
+		length = fSendQueue.Available(sequence);
 
-		uint32 sendMax = fSendMax.Number();
-		fSendNext += size;
-		if (fSendMax < fSendNext)
-			fSendMax = fSendNext;
+	if (sequence + length == fSendQueue.LastSequence()
+		&& state_needs_finish(fState))
+		segment.flags |= TCP_FLAG_FINISH;
 
-		fReceiveMaxAdvertised = fReceiveNext
-			+ ((uint32)segment.advertised_window << fReceiveWindowShift);
+	status_t status = B_BAD_VALUE;
+	if (length > 0 || (segment.flags & TCP_FLAG_FINISH) != 0)
+		status = _SendSegment(segment, length);
 
-		status = next->module->send_routed_data(next, fRoute, buffer);
-		if (status < B_OK) {
-			gBufferModule->free(buffer);
+	if (status == B_OK && fRetransmitHigh < fSendNext)
+		fRetransmitHigh = fSendNext;
 
-			fSendNext = segment.sequence;
-			fSendMax = sendMax;
-				// restore send status
-			return status;
-		}
+	if (fSendNext < sendNext)
+		fSendNext = sendNext;
 
-		if (segment.flags & TCP_FLAG_ACKNOWLEDGE)
-			fLastAcknowledgeSent = segment.acknowledge;
+	// Karn's algorithm: the timed segment might have been retransmitted
+	fRoundTripStartTime = 0;
 
-		length -= segmentLength;
-		segment.flags &= ~(TCP_FLAG_SYNCHRONIZE | TCP_FLAG_RESET
-			| TCP_FLAG_FINISH);
-	} while (length > 0);
+	return status;
+}
 
-	// if we sent data from the beggining of the send queue,
-	// start the retransmition timer
-	if (previousSendNext == fSendUnacknowledged
-		&& fSendNext > previousSendNext) {
-		TRACE("  SendQueue(): set retransmit timer with rto %llu",
-			fRetransmitTimeout);
 
-		gStackModule->set_timer(&fRetransmitTimer, fRetransmitTimeout);
+/*!	Implements the loss recovery of RFC 6675: retransmits the segments that
+	are considered lost as long as the congestion window allows, and then
+	continues with new data.
+*/
+void
+TCPEndpoint::_SendRecovery()
+{
+	uint32 congestionWindow = fCongestionControl->CongestionWindow();
+
+	while (fSackScoreboard.Pipe(fSendUnacknowledged, fSendMax, fRetransmitHigh,
+			fSendMaxSegmentSize) + fSendMaxSegmentSize <= congestionWindow) {
+		tcp_sequence start;
+		uint32 length;
+		if (!fSackScoreboard.NextLostSegment(fSendUnacknowledged,
+				fRetransmitHigh, fSendMaxSegmentSize, start, length))
+			break;
+
+		if (_RetransmitSegment(start, length) != B_OK)
+			break;
 	}
 
-	return B_OK;
+	_SendQueued();
 }
 
 
@@ -2129,6 +2463,10 @@ TCPEndpoint::_PrepareSendPath(const sockaddr* peer)
 			fFlags |= FLAG_LOCAL;
 	}
 
+	// super-segments are only split by the stack for IPv4
+	if (Domain()->family == AF_INET)
+		fFlags |= FLAG_SEGMENTATION_OFFLOAD;
+
 	// make sure connection does not already exist
 	status_t status = fManager->SetConnection(this, *LocalAddress(), peer,
 		fRoute->interface_address->local);
@@ -2140,6 +2478,8 @@ TCPEndpoint::_PrepareSendPath(const sockaddr* peer)
 	fSendUnacknowledged = fInitialSendSequence;
 	fSendMax = fInitialSendSequence;
 	fSendUrgentOffset = fInitialSendSequence;
+	fRecoveryPoint = fInitialSendSequence;
+	fRetransmitHigh = fInitialSendSequence;
 
 	// we are counting the SYN here
 	fSendQueue.SetInitialSequence(fSendNext + 1);
@@ -2162,48 +2502,77 @@ void
 TCPEndpoint::_Acknowledged(tcp_segment_header& segment)
 {
 	size_t previouslyUsed = fSendQueue.Used();
+	uint32 acknowledged = (tcp_sequence(segment.acknowledge)
+		- fSendUnacknowledged).Number();
 
 	fSendQueue.RemoveUntil(segment.acknowledge);
 	fSendUnacknowledged = segment.acknowledge;
+	fDuplicateAcknowledgeCount = 0;
+
+	if ((fFlags & FLAG_OPTION_SACK_PERMITTED) != 0) {
+		fSackScoreboard.Update(fSendUnacknowledged, fSendMax, segment.sacks,
+			segment.sack_count);
+	}
 
 	if (fSendNext < fSendUnacknowledged)
 		fSendNext = fSendUnacknowledged;
+	if (fRetransmitHigh < fSendUnacknowledged)
+		fRetransmitHigh = fSendUnacknowledged;
 
 	if (fSendUnacknowledged == fSendMax)
 		gStackModule->cancel_timer(&fRetransmitTimer);
+	else {
+		// restart the timer for the data that is still in flight
+		// (RFC 6298, section 5.3)
+		gStackModule->set_timer(&fRetransmitTimer, fRetransmitTimeout);
+	}
 
-	if (fSendQueue.Used() < previouslyUsed) {
-		// this ACK acknowledged data
-
-		if (segment.options & TCP_HAS_TIMESTAMPS)
-			_UpdateRoundTripTime(tcp_diff_timestamp(segment.timestamp_reply));
-		else {
-			// TODO: Fallback to RFC 793 type estimation
-		}
-
-		if (is_writable(fState)) {
-			// notify threads waiting on the socket to become writable again
-			fSendList.Signal();
-			gSocketModule->notify(socket, B_SELECT_WRITE, fSendQueue.Used());
+	if (acknowledged > 0) {
+		if ((segment.options & TCP_HAS_TIMESTAMPS) != 0
+			&& segment.timestamp_reply != 0) {
+			_UpdateRoundTripTime((bigtime_t)tcp_diff_timestamp(
+				segment.timestamp_reply) * TCP_TIMESTAMP_RESOLUTION);
+		} else if (fRoundTripStartTime != 0
+			&& fSendUnacknowledged >= fRoundTripSequence) {
+			_UpdateRoundTripTime(system_time() - fRoundTripStartTime);
+			fRoundTripStartTime = 0;
 		}
-
-		if (fCongestionWindow < fSlowStartThreshold)
-			fCongestionWindow += fSendMaxSegmentSize;
 	}
 
-	if (fCongestionWindow >= fSlowStartThreshold) {
-		uint32 increment = fSendMaxSegmentSize * fSendMaxSegmentSize;
+	bool sackRecovery = false;
 
-		if (increment < fCongestionWindow)
-			increment = 1;
-		else
-			increment /= fCongestionWindow;
+	if ((fFlags & FLAG_RECOVERY) != 0) {
+		if (fSendUnacknowledged >= fRecoveryPoint) {
+			// all data that was outstanding when we detected the loss has
+			// been acknowledged now
+			TRACE("Acknowledged(): leaving fast recovery");
+			fFlags &= ~FLAG_RECOVERY;
+			fCongestionControl->ExitRecovery(
+				(fSendMax - fSendUnacknowledged).Number());
+		} else if ((fFlags & FLAG_OPTION_SACK_PERMITTED) != 0)
+			sackRecovery = true;
+		else {
+			// A partial acknowledge: the next segment has been lost, too
+			// (RFC 6582, section 3.2, step 5)
+			_RetransmitSegment(fSendUnacknowledged, fSendMaxSegmentSize);
+
+			fCongestionControl->DeflateWindow(acknowledged);
+			if (acknowledged >= fSendMaxSegmentSize)
+				fCongestionControl->InflateWindow(fSendMaxSegmentSize);
+		}
+	} else if (acknowledged > 0)
+		fCongestionControl->Acknowledged(acknowledged, fRoundTripTime);
 
-		fCongestionWindow += increment;
+	if (fSendQueue.Used() < previouslyUsed && is_writable(fState)) {
+		// notify threads waiting on the socket to become writable again
+		fSendList.Signal();
+		gSocketModule->notify(socket, B_SELECT_WRITE, fSendQueue.Used());
 	}
 
 	// if there is data left to be send, send it now
-	if (fSendQueue.Used() > 0)
+	if (sackRecovery)
+		_SendRecovery();
+	else if (fSendQueue.Used() > 0)
 		_SendQueued();
 }
 
@@ -2212,42 +2581,60 @@ void
 TCPEndpoint::_Retransmit()
 {
 	TRACE("Retransmit()");
-	_ResetSlowStart();
+
+	fCongestionControl->RetransmitTimeout(
+		(fSendMax - fSendUnacknowledged).Number());
+
+	// The peer may have dropped the data it selectively acknowledged, and
+	// anything we sent so far has to be considered lost (RFC 6675, section 5.1)
+	fFlags &= ~FLAG_RECOVERY;
+	fRecoveryPoint = fSendMax;
+	fRetransmitHigh = fSendUnacknowledged;
+	fSackScoreboard.Reset();
+	fDuplicateAcknowledgeCount = 0;
+	fRoundTripStartTime = 0;
+
+	// back off the timer (RFC 6298, section 5.5)
+	fRetransmitTimeout = min_c(fRetransmitTimeout * 2,
+		TCP_MAX_RETRANSMIT_TIMEOUT);
+
 	fSendNext = fSendUnacknowledged;
 	_SendQueued();
 }
 
 
+/*!	Updates the smoothed round trip time, and its variation with the new
+	measurement \a roundTripTime, and computes the retransmit timeout from
+	them as specified in RFC 6298.
+*/
 void
-TCPEndpoint::_UpdateRoundTripTime(int32 roundTripTime)
+TCPEndpoint::_UpdateRoundTripTime(bigtime_t roundTripTime)
 {
-	int32 rtt = roundTripTime;
+	if (fRoundTripTime == 0) {
+		// this is the first measurement
+		fRoundTripTime = roundTripTime;
+		fRoundTripDeviation = roundTripTime / 2;
+	} else {
+		bigtime_t deviation = fRoundTripTime - roundTripTime;
+		if (deviation < 0)
+			deviation = -deviation;
 
-	// "smooth" round trip time as per Van Jacobson
-	rtt -= fRoundTripTime / 8;
-	fRoundTripTime += rtt;
-	if (rtt < 0)
-		rtt = -rtt;
-	rtt -= fRoundTripDeviation / 4;
-	fRoundTripDeviation += rtt;
+		fRoundTripDeviation = (3 * fRoundTripDeviation + deviation) / 4;
+		fRoundTripTime = (7 * fRoundTripTime + roundTripTime) / 8;
+	}
 
-	fRetransmitTimeout = ((fRoundTripTime / 4 + fRoundTripDeviation) / 2)
-		* kTimestampFactor;
+	fRetransmitTimeout = fRoundTripTime
+		+ max_c((bigtime_t)TCP_TIMESTAMP_RESOLUTION, 4 * fRoundTripDeviation);
+	if (fRetransmitTimeout < TCP_MIN_RETRANSMIT_TIMEOUT)
+		fRetransmitTimeout = TCP_MIN_RETRANSMIT_TIMEOUT;
+	else if (fRetransmitTimeout > TCP_MAX_RETRANSMIT_TIMEOUT)
+		fRetransmitTimeout = TCP_MAX_RETRANSMIT_TIMEOUT;
 
-	TRACE("  RTO is now %llu (after rtt %ldms)", fRetransmitTimeout,
+	TRACE("  RTO is now %llu (after rtt %lldus)", fRetransmitTimeout,
 		roundTripTime);
 }
 
 
-void
-TCPEndpoint::_ResetSlowStart()
-{
-	fSlowStartThreshold = max_c((fSendMax - fSendUnacknowledged).Number() / 2,
-		2 * fSendMaxSegmentSize);
-	fCongestionWindow = fSendMaxSegmentSize;
-}
-
-
 //	#pragma mark - timer
 
 
@@ -2365,10 +2752,17 @@ TCPEndpoint::Dump() const
 	kprintf("    initial sequence: %lu\n", fInitialReceiveSequence.Number());
 	kprintf("    duplicate acknowledge count: %lu\n",
 		fDuplicateAcknowledgeCount);
-	kprintf("  round trip time: %ld (deviation %ld)\n", fRoundTripTime,
+	kprintf("  round trip time: %lld (deviation %lld)\n", fRoundTripTime,
 		fRoundTripDeviation);
 	kprintf("  retransmit timeout: %lld\n", fRetransmitTimeout);
-	kprintf("  congestion window: %lu\n", fCongestionWindow);
-	kprintf("  slow start threshold: %lu\n", fSlowStartThreshold);
+	kprintf("  congestion control: %s\n", fCongestionControl->Name());
+	kprintf("    congestion window: %lu\n",
+		fCongestionControl->CongestionWindow());
+	kprintf("    slow start threshold: %lu\n",
+		fCongestionControl->SlowStartThreshold());
+	kprintf("  recovery: %s, point %lu, retransmit high %lu\n",
+		(fFlags & FLAG_RECOVERY) != 0 ? "yes" : "no", fRecoveryPoint.Number(),
+		fRetransmitHigh.Number());
+	fSackScoreboard.Dump();
 }
 
@@ -12,7 +12,9 @@
 
 
 #include "BufferQueue.h"
+#include "CongestionControl.h"
 #include "EndpointManager.h"
+#include "SackScoreboard.h"
 #include "tcp.h"
 
 #include <ProtocolUtilities.h>
@@ -93,15 +95,24 @@ private:
 			bool		_ShouldSendSegment(tcp_segment_header& segment,
 							uint32 length, uint32 segmentMaxSize,
 							uint32 flightSize);
+			void		_PrepareSegment(tcp_segment_header& segment);
+			status_t	_SendSegment(tcp_segment_header& segment,
+							uint32 segmentLength);
 			status_t	_SendQueued(bool force = false);
 			status_t	_SendQueued(bool force, uint32 sendWindow);
+			status_t	_RetransmitSegment(tcp_sequence sequence,
+							uint32 length);
+			void		_SendRecovery();
 			int			_MaxSegmentSize(const struct sockaddr* address) const;
 			status_t	_Disconnect(bool closing);
 			ssize_t		_AvailableData() const;
 			void		_NotifyReader();
 			bool		_ShouldReceive() const;
 			void		_HandleReset(status_t error);
-			int32		_Spawn(TCPEndpoint* parent, tcp_segment_header& segment,
+			int32		_Spawn(TCPEndpoint* parent,
+							const syn_cache_entry& entry,
+							tcp_segment_header& segment, net_buffer* buffer);
+			int32		_CompleteConnection(tcp_segment_header& segment,
 							net_buffer* buffer);
 			int32		_ListenReceive(tcp_segment_header& segment,
 							net_buffer* buffer);
@@ -111,8 +122,7 @@ private:
 							net_buffer* buffer);
 			int32		_Receive(tcp_segment_header& segment,
 							net_buffer* buffer);
-			void		_UpdateTimestamps(tcp_segment_header& segment,
-							size_t segmentLength);
+			void		_UpdateTimestamps(tcp_segment_header& segment);
 			void		_MarkEstablished();
 			status_t	_WaitForEstablished(MutexLocker& lock,
 							bigtime_t timeout);
@@ -122,8 +132,7 @@ private:
 			status_t	_PrepareSendPath(const sockaddr* peer);
 			void		_Acknowledged(tcp_segment_header& segment);
 			void		_Retransmit();
-			void		_UpdateRoundTripTime(int32 roundTripTime);
-			void		_ResetSlowStart();
+			void		_UpdateRoundTripTime(bigtime_t roundTripTime);
 			void		_DuplicateAcknowledge(tcp_segment_header& segment);
 
 	static	void		_TimeWaitTimer(net_timer* timer, void* _endpoint);
@@ -161,6 +170,11 @@ private:
 	tcp_sequence	fInitialSendSequence;
 	uint32			fDuplicateAcknowledgeCount;
 
+	// loss recovery
+	SackScoreboard	fSackScoreboard;
+	tcp_sequence	fRecoveryPoint;
+	tcp_sequence	fRetransmitHigh;
+
 	net_route 		*fRoute;
 		// TODO: don't use a net_route, but a net_route_info!!!
 		// (the latter will automatically adapt to routing changes)
@@ -173,16 +187,18 @@ private:
 	bool			fFinishReceived;
 	tcp_sequence	fFinishReceivedAt;
 	tcp_sequence	fInitialReceiveSequence;
+	tcp_sequence	fLastOutOfOrderSequence;
 
 	// round trip time and retransmit timeout computation
-	int32			fRoundTripTime;
-	int32			fRoundTripDeviation;
+	bigtime_t		fRoundTripTime;
+	bigtime_t		fRoundTripDeviation;
 	bigtime_t		fRetransmitTimeout;
+	tcp_sequence	fRoundTripSequence;
+	bigtime_t		fRoundTripStartTime;
 
 	uint32			fReceivedTimestamp;
 
-	uint32			fCongestionWindow;
-	uint32			fSlowStartThreshold;
+	CongestionControl* fCongestionControl;
 
 	tcp_state		fState;
 	uint32			fFlags;
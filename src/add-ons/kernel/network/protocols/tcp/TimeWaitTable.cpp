@@ -0,0 +1,356 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "TimeWaitTable.h"
+
+#include <new>
+#include <string.h>
+
+#include <KernelExport.h>
+
+#include <AddressUtilities.h>
+#include <util/AutoLock.h>
+
+#include "EndpointManager.h"
+
+
+// References:
+//	- RFC 1122 - Requirements for Internet Hosts, section 4.2.2.13
+//	- RFC 1337 - TIME_WAIT Assassination Hazards in TCP
+//	- RFC 6191 - Reducing the TIME-WAIT State Using TCP Timestamps
+
+
+static const bigtime_t kTimeWaitTimeout = TCP_MAX_SEGMENT_LIFETIME << 1;
+
+
+size_t
+TimeWaitHashDefinition::HashKey(const KeyType& key) const
+{
+	return fModule->hash_address_pair(key.first, key.second);
+}
+
+
+size_t
+TimeWaitHashDefinition::Hash(time_wait_entry* entry) const
+{
+	return fModule->hash_address_pair((sockaddr*)&entry->local,
+		(sockaddr*)&entry->peer);
+}
+
+
+bool
+TimeWaitHashDefinition::Compare(const KeyType& key,
+	time_wait_entry* entry) const
+{
+	return fModule->equal_addresses_and_ports(key.first,
+			(sockaddr*)&entry->local)
+		&& fModule->equal_addresses_and_ports(key.second,
+			(sockaddr*)&entry->peer);
+}
+
+
+time_wait_entry*&
+TimeWaitHashDefinition::GetLink(time_wait_entry* entry) const
+{
+	return entry->hash_link;
+}
+
+
+//	#pragma mark -
+
+
+TimeWaitTable::Stripe::Stripe(net_address_module_info* module)
+	:
+	table(TimeWaitHashDefinition(module))
+{
+	mutex_init(&lock, "tcp time wait");
+}
+
+
+TimeWaitTable::Stripe::~Stripe()
+{
+	while (time_wait_entry* entry = list.RemoveHead())
+		delete entry;
+
+	mutex_destroy(&lock);
+}
+
+
+//	#pragma mark -
+
+
+TimeWaitTable::TimeWaitTable(EndpointManager* manager)
+	:
+	fManager(manager),
+	fCount(0)
+{
+	memset(fStripes, 0, sizeof(fStripes));
+}
+
+
+TimeWaitTable::~TimeWaitTable()
+{
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++)
+		delete fStripes[i];
+}
+
+
+status_t
+TimeWaitTable::Init()
+{
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		fStripes[i] = new(std::nothrow) Stripe(fManager->AddressModule());
+		if (fStripes[i] == NULL)
+			return B_NO_MEMORY;
+
+		status_t status = fStripes[i]->table.Init();
+		if (status != B_OK)
+			return status;
+	}
+
+	return B_OK;
+}
+
+
+/*!	Remembers the connection between \a local and \a peer for the next
+	2 MSL. \a sendNext and \a receiveNext must already include the FINs that
+	have been exchanged.
+*/
+status_t
+TimeWaitTable::Add(const sockaddr* local, const sockaddr* peer,
+	uint32 sendNext, uint32 receiveNext, uint16 receiveWindow,
+	bool useTimestamps, uint32 receivedTimestamp)
+{
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	time_wait_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL) {
+		entry = new(std::nothrow) time_wait_entry;
+		if (entry == NULL)
+			return B_NO_MEMORY;
+
+		memcpy(&entry->local, local, local->sa_len);
+		memcpy(&entry->peer, peer, peer->sa_len);
+
+		stripe.table.Insert(entry);
+		atomic_add(&fCount, 1);
+	} else
+		stripe.list.Remove(entry);
+
+	entry->timeout = system_time() + kTimeWaitTimeout;
+	entry->send_next = sendNext;
+	entry->receive_next = receiveNext;
+	entry->receive_window = receiveWindow;
+	entry->use_timestamps = useTimestamps;
+	entry->received_timestamp = receivedTimestamp;
+
+	stripe.list.Add(entry);
+	locker.Unlock();
+
+	fManager->StartTimer();
+	return B_OK;
+}
+
+
+/*!	Is called when a new connection between \a local and \a peer is about to
+	be initiated locally. Returns \c false if an earlier incarnation of the
+	connection is still in TIME_WAIT state, and cannot be reused yet.
+	If the old connection used timestamps, the new one is protected against
+	its old duplicates by them, and the connection may be reused right away.
+*/
+bool
+TimeWaitTable::Recycle(const sockaddr* local, const sockaddr* peer)
+{
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	time_wait_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL)
+		return true;
+	if (!entry->use_timestamps)
+		return false;
+
+	_Remove(stripe, entry);
+	return true;
+}
+
+
+/*!	Returns whether or not there is a connection in TIME_WAIT state that is
+	bound to \a address.
+	This is only used when binding to a specific port, and therefore just
+	walks all entries.
+*/
+bool
+TimeWaitTable::IsBound(const sockaddr* address) const
+{
+	net_address_module_info* module = fManager->AddressModule();
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		Stripe& stripe = *fStripes[i];
+		MutexLocker locker(stripe.lock);
+
+		EntryList::Iterator iterator = stripe.list.GetIterator();
+		while (time_wait_entry* entry = iterator.Next()) {
+			if (module->equal_addresses_and_ports((sockaddr*)&entry->local,
+					address))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*!	Handles a segment that arrived for a connection in TIME_WAIT state.
+	Returns \c false if there is no such connection, or if the segment is a
+	SYN that may start a new incarnation of it; it must then be passed on to
+	a listening endpoint. Otherwise, the segment has been dealt with, and
+	can be dropped.
+*/
+bool
+TimeWaitTable::SegmentReceived(tcp_segment_header& segment,
+	net_buffer* buffer)
+{
+	const sockaddr* local = buffer->destination;
+	const sockaddr* peer = buffer->source;
+
+	Stripe& stripe = _StripeFor(local, peer);
+	MutexLocker locker(stripe.lock);
+
+	time_wait_entry* entry = stripe.table.Lookup(std::make_pair(local, peer));
+	if (entry == NULL)
+		return false;
+
+	if ((segment.flags & TCP_FLAG_RESET) != 0) {
+		// we ignore resets in time wait state (see RFC 1337)
+		return true;
+	}
+
+	bool hasTimestamps = entry->use_timestamps
+		&& (segment.options & TCP_HAS_TIMESTAMPS) != 0;
+
+	if ((segment.flags & (TCP_FLAG_SYNCHRONIZE | TCP_FLAG_ACKNOWLEDGE))
+			== TCP_FLAG_SYNCHRONIZE) {
+		// A new SYN may reopen the connection if it cannot be confused with
+		// the old one
+		bool acceptable;
+		if (hasTimestamps) {
+			acceptable = (int32)(ntohl(segment.timestamp_value)
+				- ntohl(entry->received_timestamp)) > 0;
+		} else {
+			acceptable = tcp_sequence(segment.sequence)
+				> tcp_sequence(entry->receive_next);
+		}
+
+		if (acceptable) {
+			_Remove(stripe, entry);
+			return false;
+		}
+	} else if ((segment.flags & TCP_FLAG_FINISH) != 0) {
+		// the peer retransmitted its FIN - our last ACK might have been lost;
+		// restart the 2 MSL timeout
+		entry->timeout = system_time() + kTimeWaitTimeout;
+		stripe.list.Remove(entry);
+		stripe.list.Add(entry);
+
+		if (hasTimestamps)
+			entry->received_timestamp = segment.timestamp_value;
+	} else if (segment.AcknowledgeOnly() && buffer->size == 0)
+		return true;
+
+	net_buffer* reply = _CreateAcknowledge(*entry);
+	locker.Unlock();
+
+	if (reply != NULL)
+		fManager->SendSegment(reply);
+
+	return true;
+}
+
+
+/*!	Forgets all connections whose 2 MSL timeout has passed. */
+void
+TimeWaitTable::Timer()
+{
+	bigtime_t now = system_time();
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		Stripe& stripe = *fStripes[i];
+		MutexLocker locker(stripe.lock);
+
+		while (time_wait_entry* entry = stripe.list.Head()) {
+			if (entry->timeout > now)
+				break;
+
+			_Remove(stripe, entry);
+		}
+	}
+}
+
+
+void
+TimeWaitTable::Dump() const
+{
+	kprintf("time wait: %ld entries\n", fCount);
+
+	for (int32 i = 0; i < TCP_HASH_STRIPES; i++) {
+		EntryList::Iterator iterator = fStripes[i]->list.GetIterator();
+		while (time_wait_entry* entry = iterator.Next()) {
+			char localBuffer[64], peerBuffer[64];
+			ConstSocketAddress(fManager->AddressModule(),
+				(sockaddr*)&entry->local).AsString(localBuffer,
+					sizeof(localBuffer), true);
+			ConstSocketAddress(fManager->AddressModule(),
+				(sockaddr*)&entry->peer).AsString(peerBuffer,
+					sizeof(peerBuffer), true);
+
+			kprintf("%p %21s %21s snd-nxt %lu, rcv-nxt %lu, timeout %lld\n",
+				entry, localBuffer, peerBuffer, entry->send_next,
+				entry->receive_next, entry->timeout);
+		}
+	}
+}
+
+
+TimeWaitTable::Stripe&
+TimeWaitTable::_StripeFor(const sockaddr* local, const sockaddr* peer) const
+{
+	return *fStripes[tcp_hash_stripe(
+		fManager->AddressModule()->hash_address_pair(local, peer))];
+}
+
+
+/*! You must hold the lock of the \a stripe when calling this method. */
+void
+TimeWaitTable::_Remove(Stripe& stripe, time_wait_entry* entry)
+{
+	stripe.table.RemoveUnchecked(entry);
+	stripe.list.Remove(entry);
+	atomic_add(&fCount, -1);
+
+	delete entry;
+}
+
+
+net_buffer*
+TimeWaitTable::_CreateAcknowledge(const time_wait_entry& entry)
+{
+	tcp_segment_header segment(TCP_FLAG_ACKNOWLEDGE);
+	segment.sequence = entry.send_next;
+	segment.acknowledge = entry.receive_next;
+	segment.advertised_window = entry.receive_window;
+	segment.urgent_offset = 0;
+
+	if (entry.use_timestamps) {
+		segment.options |= TCP_HAS_TIMESTAMPS;
+		segment.timestamp_value = tcp_now();
+		segment.timestamp_reply = entry.received_timestamp;
+	}
+
+	return fManager->CreateSegment((const sockaddr*)&entry.local,
+		(const sockaddr*)&entry.peer, segment);
+}
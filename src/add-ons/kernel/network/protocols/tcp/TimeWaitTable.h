@@ -0,0 +1,112 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef TIME_WAIT_TABLE_H
+#define TIME_WAIT_TABLE_H
+
+
+#include "tcp.h"
+
+#include <lock.h>
+#include <util/DoublyLinkedList.h>
+#include <util/OpenHashTable.h>
+
+#include <utility>
+
+
+class EndpointManager;
+
+
+/*!	What is left of a connection in TIME_WAIT state: just enough to answer
+	retransmissions of the peer's FIN, and to protect the next incarnation of
+	the connection from old duplicates.
+*/
+struct time_wait_entry : DoublyLinkedListLinkImpl<time_wait_entry> {
+	time_wait_entry*	hash_link;
+	sockaddr_storage	local;
+	sockaddr_storage	peer;
+	bigtime_t			timeout;
+	uint32				send_next;
+	uint32				receive_next;
+	uint32				received_timestamp;
+	uint16				receive_window;
+	bool				use_timestamps;
+};
+
+
+struct TimeWaitHashDefinition {
+	typedef std::pair<const sockaddr*, const sockaddr*> KeyType;
+	typedef time_wait_entry ValueType;
+
+							TimeWaitHashDefinition(
+								net_address_module_info* module)
+								: fModule(module)
+							{
+							}
+							TimeWaitHashDefinition(
+								const TimeWaitHashDefinition& definition)
+								: fModule(definition.fModule)
+							{
+							}
+
+			size_t			HashKey(const KeyType& key) const;
+			size_t			Hash(time_wait_entry* entry) const;
+			bool			Compare(const KeyType& key,
+								time_wait_entry* entry) const;
+			time_wait_entry*& GetLink(time_wait_entry* entry) const;
+
+private:
+	net_address_module_info* fModule;
+};
+
+
+class TimeWaitTable {
+public:
+							TimeWaitTable(EndpointManager* manager);
+							~TimeWaitTable();
+
+			status_t		Init();
+
+			status_t		Add(const sockaddr* local, const sockaddr* peer,
+								uint32 sendNext, uint32 receiveNext,
+								uint16 receiveWindow, bool useTimestamps,
+								uint32 receivedTimestamp);
+			bool			Recycle(const sockaddr* local,
+								const sockaddr* peer);
+			bool			IsBound(const sockaddr* address) const;
+
+			bool			SegmentReceived(tcp_segment_header& segment,
+								net_buffer* buffer);
+
+			bool			IsEmpty() const { return fCount == 0; }
+			void			Timer();
+
+			void			Dump() const;
+
+private:
+	typedef BOpenHashTable<TimeWaitHashDefinition> EntryTable;
+	typedef DoublyLinkedList<time_wait_entry> EntryList;
+
+	struct Stripe {
+								Stripe(net_address_module_info* module);
+								~Stripe();
+
+			mutex				lock;
+			EntryTable			table;
+			EntryList			list;
+				// ordered by timeout
+	};
+
+			Stripe&			_StripeFor(const sockaddr* local,
+								const sockaddr* peer) const;
+			void			_Remove(Stripe& stripe, time_wait_entry* entry);
+			net_buffer*		_CreateAcknowledge(const time_wait_entry& entry);
+
+			EndpointManager* fManager;
+			Stripe*			fStripes[TCP_HASH_STRIPES];
+			int32			fCount;
+};
+
+
+#endif	// TIME_WAIT_TABLE_H
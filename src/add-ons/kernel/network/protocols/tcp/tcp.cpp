@@ -49,13 +49,18 @@ net_datalink_module_info *gDatalinkModule;
 net_socket_module_info *gSocketModule;
 net_stack_module_info *gStackModule;
 
+int32 gSegmentsSent;
+int32 gSuperSegmentsSent;
+int32 gSegmentsReceived;
+int32 gCoalescedSegmentsReceived;
+
 
 static EndpointManager* sEndpointManagers[AF_MAX];
 static rw_lock sEndpointManagersLock;
 
 
-// The TCP header length is at most 64 bytes.
-static const int kMaxOptionSize = 64 - sizeof(tcp_header);
+// The TCP header length is at most 60 bytes.
+static const int kMaxOptionSize = 60 - sizeof(tcp_header);
 
 
 /*!	Returns an endpoint manager for the specified domain, if any.
@@ -142,7 +147,8 @@ add_options(tcp_segment_header &segment, uint8 *buffer, size_t bufferSize)
 	}
 
 	if (segment.sack_count > 0) {
-		int sackCount = ((int)(bufferSize - length) - 4) / sizeof(tcp_sack);
+		int sackCount = ((int)(bufferSize - length) - 4)
+			/ (int)sizeof(tcp_sack);
 		if (sackCount > segment.sack_count)
 			sackCount = segment.sack_count;
 
@@ -153,7 +159,11 @@ add_options(tcp_segment_header &segment, uint8 *buffer, size_t bufferSize)
 			bump_option(option, length);
 			option->kind = TCP_OPTION_SACK;
 			option->length = 2 + sackCount * sizeof(tcp_sack);
-			memcpy(option->sack, segment.sacks, sackCount * sizeof(tcp_sack));
+			for (int i = 0; i < sackCount; i++) {
+				option->sack[i].left_edge = htonl(segment.sacks[i].left_edge);
+				option->sack[i].right_edge
+					= htonl(segment.sacks[i].right_edge);
+			}
 			bump_option(option, length);
 		}
 	}
@@ -219,6 +229,26 @@ process_options(tcp_segment_header &segment, net_buffer *buffer, size_t size)
 				if (option->length == 2 && size >= 2)
 					segment.options |= TCP_SACK_PERMITTED;
 				break;
+			case TCP_OPTION_SACK:
+			{
+				if (option->length < 2 + sizeof(tcp_sack)
+					|| (option->length - 2) % sizeof(tcp_sack) != 0
+					|| option->length > size)
+					break;
+
+				int sackCount = (option->length - 2) / sizeof(tcp_sack);
+				if (sackCount > TCP_MAX_SACK_BLOCKS)
+					sackCount = TCP_MAX_SACK_BLOCKS;
+
+				for (int i = 0; i < sackCount; i++) {
+					segment.sacks[i].left_edge
+						= ntohl(option->sack[i].left_edge);
+					segment.sacks[i].right_edge
+						= ntohl(option->sack[i].right_edge);
+				}
+				segment.sack_count = sackCount;
+				break;
+			}
 		}
 
 		if (length < 0) {
@@ -256,6 +286,10 @@ dump_tcp_header(tcp_header &header)
 static int
 dump_endpoints(int argc, char** argv)
 {
+	kprintf("segments sent: %ld (%ld super-segments), received: %ld (%ld "
+		"coalesced)\n", gSegmentsSent, gSuperSegmentsSent, gSegmentsReceived,
+		gCoalescedSegmentsReceived);
+
 	for (int i = 0; i < AF_MAX; i++) {
 		EndpointManager* manager = sEndpointManagers[i];
 		if (manager != NULL)
@@ -434,8 +468,8 @@ tcp_options_length(tcp_segment_header& segment)
 		length += 2;
 
 	if (segment.sack_count > 0) {
-		int sackCount = min_c((int)((kMaxOptionSize - length - 4)
-			/ sizeof(tcp_sack)), segment.sack_count);
+		int sackCount = min_c(((int)(kMaxOptionSize - length) - 4)
+			/ (int)sizeof(tcp_sack), segment.sack_count);
 		if (sackCount > 0)
 			length += 4 + sackCount * sizeof(tcp_sack);
 	}
@@ -682,6 +716,10 @@ tcp_receive_data(net_buffer* buffer)
 			IPPROTO_TCP) != 0)
 		return B_BAD_DATA;
 
+	atomic_add(&gSegmentsReceived, 1);
+	if (buffer->segment_size != 0)
+		atomic_add(&gCoalescedSegmentsReceived, 1);
+
 	addressModule->set_port(buffer->source, header.source_port);
 	addressModule->set_port(buffer->destination, header.destination_port);
 
@@ -711,6 +749,18 @@ tcp_receive_data(net_buffer* buffer)
 
 	TCPEndpoint* endpoint = endpointManager->FindConnection(
 		buffer->destination, buffer->source);
+	if (endpoint == NULL) {
+		// connections in TIME_WAIT state no longer have an endpoint, their
+		// segments are handled by the time-wait table directly
+		if (endpointManager->GetTimeWaitTable().SegmentReceived(segment,
+				buffer)) {
+			gBufferModule->free(buffer);
+			return B_OK;
+		}
+
+		endpoint = endpointManager->FindListener(buffer->destination);
+	}
+
 	if (endpoint != NULL) {
 		segmentAction = endpoint->SegmentReceived(segment, buffer);
 		gSocketModule->release_socket(endpoint->socket);
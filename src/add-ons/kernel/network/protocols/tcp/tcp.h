@@ -187,6 +187,14 @@ operator==(tcp_sequence a, tcp_sequence b)
 #define TCP_DEFAULT_MAX_SEGMENT_SIZE	536
 #define TCP_MAX_WINDOW					65535
 #define TCP_MAX_SEGMENT_LIFETIME		60000000	// 60 secs
+#define TCP_MIN_RETRANSMIT_TIMEOUT		200000		// 200 msecs
+#define TCP_MAX_RETRANSMIT_TIMEOUT		60000000	// 60 secs
+
+#define TCP_DUPLICATE_ACKNOWLEDGE_THRESHOLD	3
+#define TCP_MAX_SACK_BLOCKS				4
+#define TCP_MAX_SUPER_SEGMENT_SIZE		(65535 - 20 - 60)
+	// the payload of a super-segment has to fit into an IPv4 packet
+#define TCP_TIMESTAMP_RESOLUTION		1024		// usecs per timestamp tick
 
 struct tcp_sack {
 	uint32 left_edge;
@@ -246,7 +254,7 @@ struct tcp_segment_header {
 	uint32	timestamp_value;
 	uint32	timestamp_reply;
 
-	tcp_sack	*sacks;
+	tcp_sack	sacks[TCP_MAX_SACK_BLOCKS];
 	int			sack_count;
 
 	uint32	options;
@@ -273,6 +281,33 @@ extern net_datalink_module_info* gDatalinkModule;
 extern net_socket_module_info* gSocketModule;
 extern net_stack_module_info* gStackModule;
 
+// statistics
+extern int32 gSegmentsSent;
+extern int32 gSuperSegmentsSent;
+extern int32 gSegmentsReceived;
+extern int32 gCoalescedSegmentsReceived;
+
+
+static inline uint32
+tcp_now()
+{
+	return system_time() / TCP_TIMESTAMP_RESOLUTION;
+}
+
+
+// The tables of the endpoint manager are split into this many stripes, each
+// with its own lock, so that connections can be looked up and created on
+// several CPUs in parallel.
+#define TCP_HASH_STRIPES	16
+
+static inline uint32
+tcp_hash_stripe(uint32 hash)
+{
+	// The hash tables themselves use the lower bits of the hash, so we take
+	// the upper bits of a multiplicative hash to choose the stripe
+	return (uint32)(hash * 2654435761U) >> 28;
+}
+
 
 EndpointManager* get_endpoint_manager(net_domain* domain);
 void put_endpoint_manager(EndpointManager* manager);
@@ -27,6 +27,7 @@
 #include "device_interfaces.h"
 #include "domains.h"
 #include "interfaces.h"
+#include "offload.h"
 #include "routes.h"
 #include "stack_private.h"
 #include "utility.h"
@@ -387,6 +388,12 @@ datalink_send_routed_data(struct net_route* route, net_buffer* buffer)
 	// this goes out to the datalink protocols
 	domain_datalink* datalink
 		= interface->DomainDatalink(address->domain->family);
+
+	if (buffer->segment_size != 0) {
+		return send_super_segment(datalink->first_protocol, interface->device,
+			buffer);
+	}
+
 	return datalink->first_info->send_data(datalink->first_protocol, buffer);
 }
 
@@ -10,6 +10,7 @@
 #include "device_interfaces.h"
 #include "domains.h"
 #include "interfaces.h"
+#include "offload.h"
 #include "stack_private.h"
 #include "utility.h"
 
@@ -87,16 +88,25 @@ device_consumer_thread(void* _interface)
 	net_device_interface* interface = (net_device_interface*)_interface;
 	net_device* device = interface->device;
 	net_buffer* buffer;
+	net_buffer* next = NULL;
 
 	while (true) {
-		ssize_t status = fifo_dequeue_buffer(&interface->receive_queue, 0,
-			B_INFINITE_TIMEOUT, &buffer);
-		if (status != B_OK) {
-			if (status == B_INTERRUPTED)
-				continue;
-			break;
+		if (next != NULL) {
+			buffer = next;
+			next = NULL;
+		} else {
+			ssize_t status = fifo_dequeue_buffer(&interface->receive_queue, 0,
+				B_INFINITE_TIMEOUT, &buffer);
+			if (status != B_OK) {
+				if (status == B_INTERRUPTED)
+					continue;
+				break;
+			}
 		}
 
+		// merge the TCP segments that are already waiting in the queue
+		buffer = coalesce_segments(buffer, &interface->receive_queue, &next);
+
 		if (buffer->interface_address != NULL) {
 			// If the interface is already specified, this buffer was
 			// delivered locally.
@@ -70,6 +70,9 @@ struct data_header {
 	uint8*			data_end;
 	header_space	space;
 	uint16			tail_space;
+	void			(*release_external)(void* cookie);
+	void*			external_cookie;
+		// only used for headers that reference external data
 };
 
 struct data_node {
@@ -149,6 +152,8 @@ struct net_buffer_private : net_buffer {
 #define DATA_HEADER_SIZE				_ALIGN(sizeof(data_header))
 #define DATA_NODE_SIZE					_ALIGN(sizeof(data_node))
 #define MAX_FREE_BUFFER_SIZE			(BUFFER_SIZE - DATA_HEADER_SIZE)
+#define MAX_EXTERNAL_NODE_SIZE			32768
+	// data_node::used is only 16 bits wide
 
 
 static object_cache* sNetBufferCache;
@@ -813,6 +818,8 @@ create_data_header(size_t headerSpace)
 	header->tail_space = (uint8*)header + BUFFER_SIZE - header->data_end
 		- headerSpace;
 	header->first_free = NULL;
+	header->release_external = NULL;
+	header->external_cookie = NULL;
 
 	TRACE(("%ld:   create new data header %p\n", find_thread(NULL), header));
 	T2(CreateDataHeader(header));
@@ -829,6 +836,10 @@ release_data_header(data_header* header)
 		return;
 
 	TRACE(("%ld:   free header %p\n", find_thread(NULL), header));
+
+	if (header->release_external != NULL)
+		header->release_external(header->external_cookie);
+
 	free_data_header(header);
 }
 
@@ -1081,6 +1092,7 @@ copy_metadata(net_buffer* destination, const net_buffer* source)
 	destination->offset = source->offset;
 	destination->protocol = source->protocol;
 	destination->type = source->type;
+	destination->segment_size = source->segment_size;
 }
 
 
@@ -1128,6 +1140,7 @@ create_buffer(size_t headerSpace)
 	buffer->offset = 0;
 	buffer->flags = 0;
 	buffer->size = 0;
+	buffer->segment_size = 0;
 
 	CHECK_BUFFER(buffer);
 	CREATE_PARANOIA_CHECK_SET(buffer, "net_buffer");
@@ -2008,6 +2021,72 @@ append_cloned_data(net_buffer* _buffer, net_buffer* _source, uint32 offset,
 }
 
 
+/*!	Appends \a bytes of \a data to the buffer without copying them; the data
+	is referenced just like cloned data, and must not be changed anymore.
+	Once neither this buffer nor any of its clones reference the data anymore,
+	\a release is called with \a cookie. If this function fails, \a release
+	is not called, though.
+*/
+static status_t
+append_external_data(net_buffer* _buffer, const void* data, size_t bytes,
+	void (*release)(void* cookie), void* cookie)
+{
+	net_buffer_private* buffer = (net_buffer_private*)_buffer;
+	TRACE(("%ld: append_external_data(buffer %p, data %p, bytes = %ld)\n",
+		find_thread(NULL), buffer, data, bytes));
+
+	ParanoiaChecker _(buffer);
+
+	if (bytes == 0) {
+		release(cookie);
+		return B_OK;
+	}
+
+	// The header only keeps track of the references to the data; the nodes
+	// themselves are allocated in the buffer's allocation header.
+	data_header* header = create_data_header(0);
+	if (header == NULL)
+		return ENOBUFS;
+
+	header->release_external = release;
+	header->external_cookie = cookie;
+
+	uint8* source = (uint8*)data;
+	size_t sizeAppended = 0;
+
+	while (bytes > 0) {
+		data_node* node = add_data_node(buffer, header);
+		if (node == NULL) {
+			header->release_external = NULL;
+			remove_trailer(buffer, sizeAppended);
+			release_data_header(header);
+			return ENOBUFS;
+		}
+
+		node->offset = buffer->size;
+		node->start = source;
+		node->used = min_c(bytes, MAX_EXTERNAL_NODE_SIZE);
+		node->flags = DATA_NODE_READ_ONLY;
+
+		list_add_item(&buffer->buffers, node);
+
+		source += node->used;
+		bytes -= node->used;
+		buffer->size += node->used;
+		sizeAppended += node->used;
+	}
+
+	// the nodes keep the header alive from now on
+	release_data_header(header);
+
+	CHECK_BUFFER(buffer);
+	SET_PARANOIA_CHECK(PARANOIA_SUSPICIOUS, buffer, &buffer->size,
+		sizeof(buffer->size));
+
+	return B_OK;
+}
+
+
 void
 set_ancillary_data(net_buffer* buffer, ancillary_data_container* container)
 {
@@ -2377,6 +2456,7 @@ net_buffer_module_info gNetBufferModule = {
 	remove_trailer,
 	trim_data,
 	append_cloned_data,
+	append_external_data,
 
 	NULL,	// associate_data
 
@@ -1487,6 +1487,99 @@ socket_send(net_socket* socket, msghdr* header, const void* data, size_t length,
 }
 
 
+/*!	Sends \a length bytes of \a data over the connected \a socket without
+	copying them: the buffers passed to the protocol only reference the data.
+	\a release is called with \a cookie once the data is no longer needed,
+	which for reliable protocols is only after it has been acknowledged.
+	It is always called, even if this function fails.
+*/
+ssize_t
+socket_send_external(net_socket* socket, const void* data, size_t length,
+	int flags, void (*release)(void* cookie), void* cookie)
+{
+	if (length > SSIZE_MAX) {
+		release(cookie);
+		return B_BAD_VALUE;
+	}
+
+	if (socket->first_info->send_data_no_buffer != NULL
+		|| (socket->first_info->flags & NET_PROTOCOL_ATOMIC_MESSAGES) != 0) {
+		// the protocol does not keep the buffers around, or needs the data
+		// in a single buffer anyway, so there is nothing to gain
+		ssize_t bytesSent = socket_send(socket, NULL, data, length, flags);
+		release(cookie);
+		return bytesSent;
+	}
+
+	if (socket->peer.ss_len == 0) {
+		release(cookie);
+		return EDESTADDRREQ;
+	}
+
+	net_buffer* source = gNetBufferModule.create(0);
+	if (source == NULL) {
+		release(cookie);
+		return ENOBUFS;
+	}
+
+	status_t status = gNetBufferModule.append_external(source, data, length,
+		release, cookie);
+	if (status != B_OK) {
+		gNetBufferModule.free(source);
+		release(cookie);
+		return status;
+	}
+
+	// The data is handed to the protocol in chunks of the socket's send
+	// buffer size, all of which share the data of the source buffer.
+	size_t bytesSent = 0;
+
+	while (bytesSent < length) {
+		size_t bytes = min_c(length - bytesSent, socket->send.buffer_size);
+
+		net_buffer* buffer = gNetBufferModule.create(256);
+		if (buffer == NULL) {
+			status = ENOBUFS;
+			break;
+		}
+
+		status = gNetBufferModule.append_cloned(buffer, source, bytesSent,
+			bytes);
+		if (status != B_OK) {
+			gNetBufferModule.free(buffer);
+			break;
+		}
+
+		buffer->flags = flags;
+		memcpy(buffer->source, &socket->address, socket->address.ss_len);
+		memcpy(buffer->destination, &socket->peer, socket->peer.ss_len);
+
+		status = socket->first_info->send_data(socket->first_protocol, buffer);
+		if (status != B_OK) {
+			size_t sizeAfterSend = buffer->size;
+			gNetBufferModule.free(buffer);
+
+			if ((sizeAfterSend != bytes || bytesSent > 0)
+				&& (status == B_INTERRUPTED || status == B_WOULD_BLOCK)) {
+				// this appears to be a partial write
+				bytesSent += bytes - sizeAfterSend;
+				status = B_OK;
+			}
+			break;
+		}
+
+		bytesSent += bytes;
+	}
+
+	gNetBufferModule.free(source);
+
+	if (status != B_OK)
+		return status;
+
+	return bytesSent;
+}
+
+
 status_t
 socket_set_option(net_socket* socket, int level, int option, const void* value,
 	int length)
@@ -1764,6 +1857,7 @@ net_socket_module_info gNetSocketModule = {
 	socket_listen,
 	socket_receive,
 	socket_send,
+	socket_send_external,
 	socket_setsockopt,
 	socket_shutdown,
 	socket_socketpair
@@ -0,0 +1,501 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+/*!	Generic segmentation and receive offload for TCP over IPv4.
+
+	TCP may pass super-segments of up to 64 KB through the stack in a single
+	net_buffer; net_buffer::segment_size is then set to the payload size of
+	the segments it consists of. Unless the device can split them itself,
+	they are split right before they are handed to the datalink protocols of
+	the interface.
+
+	On the receiving side, consecutive in-order segments of the same
+	connection that are already waiting in the receive queue of a device
+	interface are coalesced into a single buffer before they are passed on to
+	the protocols.
+*/
+
+
+#include "offload.h"
+#include "stack_private.h"
+#include "utility.h"
+
+#include <ByteOrder.h>
+#include <KernelExport.h>
+
+#include <NetUtilities.h>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <string.h>
+
+
+//#define TRACE_OFFLOAD
+#ifdef TRACE_OFFLOAD
+#	define TRACE(x) dprintf x
+#else
+#	define TRACE(x) ;
+#endif
+
+
+// TCP header flags, as used here
+#define TCP_FLAG_FINISH						0x01
+#define TCP_FLAG_PUSH						0x08
+#define TCP_FLAG_ACKNOWLEDGE				0x10
+#define TCP_FLAG_CONGESTION_WINDOW_REDUCED	0x80
+
+static const size_t kMaxHeaderLength = 60 + 60;
+	// IPv4 and TCP header, both with the maximum amount of options
+static const uint32 kMaxCoalescedSize = 65535;
+
+struct segment_headers {
+	uint8	data[kMaxHeaderLength];
+	size_t	ip_length;
+	size_t	tcp_length;
+
+	ip& IP()
+		{ return *(ip*)data; }
+	tcphdr& TCP()
+		{ return *(tcphdr*)(data + ip_length); }
+	size_t Length() const
+		{ return ip_length + tcp_length; }
+};
+
+struct coalesce_state {
+	net_buffer*		buffer;
+	segment_headers	headers;
+	uint32			payload_size;
+	uint32			payload_sum;
+	uint32			segment_size;
+	uint32			last_size;
+	uint32			count;
+	bool			verified;
+};
+
+static vint32 sOffloadedSuperSegments;
+static vint32 sSplitSuperSegments;
+static vint32 sSplitSegments;
+static vint32 sCoalescedSegments;
+static vint32 sCoalescedBuffers;
+
+
+/*!	Reads the IPv4 and TCP headers of \a buffer into \a headers. Returns
+	\c false if the buffer does not contain a TCP segment.
+*/
+static bool
+read_segment_headers(net_buffer* buffer, segment_headers& headers)
+{
+	if (buffer->size < sizeof(ip) + sizeof(tcphdr)
+		|| gNetBufferModule.read(buffer, 0, headers.data, sizeof(ip)) != B_OK)
+		return false;
+
+	ip& header = headers.IP();
+	headers.ip_length = header.ip_hl << 2;
+
+	if (header.ip_v != IPVERSION || header.ip_p != IPPROTO_TCP
+		|| headers.ip_length < sizeof(ip)
+		|| ntohs(header.ip_len) != buffer->size
+		|| headers.ip_length + sizeof(tcphdr) > buffer->size)
+		return false;
+
+	if (gNetBufferModule.read(buffer, sizeof(ip), headers.data + sizeof(ip),
+			headers.ip_length - sizeof(ip) + sizeof(tcphdr)) != B_OK)
+		return false;
+
+	// the data offset is in the upper 4 bits of the 13th byte of the header
+	headers.tcp_length = (headers.data[headers.ip_length + 12] >> 4) << 2;
+	if (headers.tcp_length < sizeof(tcphdr)
+		|| headers.Length() > buffer->size)
+		return false;
+
+	if (headers.tcp_length > sizeof(tcphdr)
+		&& gNetBufferModule.read(buffer, headers.ip_length + sizeof(tcphdr),
+			headers.data + headers.ip_length + sizeof(tcphdr),
+			headers.tcp_length - sizeof(tcphdr)) != B_OK)
+		return false;
+
+	return true;
+}
+
+
+/*!	Returns the TCP checksum of \a buffer, including the pseudo header. If
+	the checksum field of the header is already set, this is 0 for a valid
+	segment.
+*/
+static uint16
+tcp_checksum(net_buffer* buffer, segment_headers& headers)
+{
+	uint16 tcpLength = buffer->size - headers.ip_length;
+
+	Checksum checksum;
+	checksum << (uint32)headers.IP().ip_src.s_addr
+		<< (uint32)headers.IP().ip_dst.s_addr
+		<< (uint16)htons(IPPROTO_TCP) << (uint16)htons(tcpLength)
+		<< (uint16)gNetBufferModule.checksum(buffer, headers.ip_length,
+			tcpLength, false);
+	return checksum;
+}
+
+
+//	#pragma mark - segmentation
+
+
+/*!	Prepends the headers to the \a segment, and adapts them to its position
+	in the super-segment.
+*/
+static status_t
+finish_segment(net_buffer* segment, const segment_headers& superHeaders,
+	uint32 sequence, uint16 id, uint8 flags)
+{
+	segment_headers headers = superHeaders;
+
+	ip& ipHeader = headers.IP();
+	ipHeader.ip_len = htons(headers.Length() + segment->size);
+	ipHeader.ip_id = htons(id);
+	ipHeader.ip_sum = 0;
+	ipHeader.ip_sum = checksum(headers.data, headers.ip_length);
+
+	tcphdr& tcpHeader = headers.TCP();
+	tcpHeader.th_seq = htonl(sequence);
+	tcpHeader.th_flags = flags;
+	tcpHeader.th_sum = 0;
+
+	status_t status = gNetBufferModule.prepend(segment, headers.data,
+		headers.Length());
+	if (status != B_OK)
+		return status;
+
+	uint16 sum = tcp_checksum(segment, headers);
+	return gNetBufferModule.write(segment,
+		headers.ip_length + offsetof(tcphdr, th_sum), &sum, sizeof(sum));
+}
+
+
+/*!	Sends the TCP super-segment \a buffer via the datalink \a protocol. If
+	the \a device cannot split it itself, it is split into segments of
+	net_buffer::segment_size bytes of payload here.
+	Like with net_datalink_protocol_module_info::send_data(), the caller
+	keeps ownership of the \a buffer in case of failure. The segments that
+	have already been sent at that point are not taken back.
+*/
+status_t
+send_super_segment(net_datalink_protocol* protocol, net_device* device,
+	net_buffer* buffer)
+{
+	if ((device->offload & NET_DEVICE_OFFLOAD_TCP_SEGMENTATION) != 0) {
+		atomic_add(&sOffloadedSuperSegments, 1);
+		return protocol->module->send_data(protocol, buffer);
+	}
+
+	uint32 segmentSize = buffer->segment_size;
+	buffer->segment_size = 0;
+
+	segment_headers headers;
+	if (!read_segment_headers(buffer, headers))
+		return B_BAD_DATA;
+
+	size_t headerLength = headers.Length();
+	if (buffer->size <= headerLength + segmentSize)
+		return protocol->module->send_data(protocol, buffer);
+
+	TRACE(("send_super_segment(): split buffer %p, %lu bytes into segments "
+		"of %lu bytes\n", buffer, buffer->size - headerLength, segmentSize));
+
+	status_t status = gNetBufferModule.remove_header(buffer, headerLength);
+	if (status != B_OK)
+		return status;
+
+	uint32 sequence = ntohl(headers.TCP().th_seq);
+	uint16 id = ntohs(headers.IP().ip_id);
+		// the IPv4 module reserved IDs for all segments
+	uint8 flags = headers.TCP().th_flags;
+
+	atomic_add(&sSplitSuperSegments, 1);
+
+	// All but the last segment are split off into buffers of their own, the
+	// last one then reuses the original buffer
+
+	while (buffer->size > segmentSize) {
+		net_buffer* segment = gNetBufferModule.split(buffer, segmentSize);
+		if (segment == NULL)
+			return B_NO_MEMORY;
+
+		status = finish_segment(segment, headers, sequence, id,
+			flags & ~(TCP_FLAG_FINISH | TCP_FLAG_PUSH));
+		if (status == B_OK)
+			status = protocol->module->send_data(protocol, segment);
+		if (status != B_OK) {
+			gNetBufferModule.free(segment);
+			return status;
+		}
+
+		atomic_add(&sSplitSegments, 1);
+
+		sequence += segmentSize;
+		id++;
+		flags &= ~TCP_FLAG_CONGESTION_WINDOW_REDUCED;
+			// only the first segment announces the reduced window
+	}
+
+	status = finish_segment(buffer, headers, sequence, id, flags);
+	if (status == B_OK)
+		status = protocol->module->send_data(protocol, buffer);
+	if (status == B_OK)
+		atomic_add(&sSplitSegments, 1);
+
+	return status;
+}
+
+
+//	#pragma mark - receive coalescing
+
+
+/*!	Returns whether or not the segment in \a buffer is a candidate for being
+	coalesced with others: it must be an unfragmented data segment that only
+	carries an acknowledgement.
+*/
+static bool
+is_coalescable(net_buffer* buffer, segment_headers& headers)
+{
+	if (buffer->segment_size != 0 || !read_segment_headers(buffer, headers))
+		return false;
+
+	return headers.ip_length == sizeof(ip)
+		&& (ntohs(headers.IP().ip_off) & (IP_MF | IP_OFFMASK)) == 0
+		&& (headers.TCP().th_flags & ~TCP_FLAG_PUSH) == TCP_FLAG_ACKNOWLEDGE
+		&& buffer->size > headers.Length();
+}
+
+
+/*!	Verifies the IPv4 and TCP checksums of the segment in \a buffer, and
+	computes the (unfinished) checksum of its payload.
+*/
+static bool
+verify_segment(net_buffer* buffer, segment_headers& headers,
+	uint32& payloadSum)
+{
+	if (checksum(headers.data, headers.ip_length) != 0)
+		return false;
+
+	uint16 tcpLength = buffer->size - headers.ip_length;
+	uint16 sum = gNetBufferModule.checksum(buffer, headers.ip_length,
+		tcpLength, false);
+
+	Checksum checksum;
+	checksum << (uint32)headers.IP().ip_src.s_addr
+		<< (uint32)headers.IP().ip_dst.s_addr
+		<< (uint16)htons(IPPROTO_TCP) << (uint16)htons(tcpLength) << sum;
+	if ((uint16)checksum != 0)
+		return false;
+
+	// subtract the header from the sum
+	payloadSum = (uint32)sum + (uint16)~compute_checksum(
+		headers.data + headers.ip_length, headers.tcp_length);
+	while (payloadSum >> 16)
+		payloadSum = (payloadSum & 0xffff) + (payloadSum >> 16);
+
+	return true;
+}
+
+
+/*!	Returns whether or not the segment in \a buffer directly follows the
+	segments collected in \a state, and belongs to the same connection.
+*/
+static bool
+continues_segments(coalesce_state& state, net_buffer* buffer,
+	segment_headers& headers)
+{
+	net_buffer* first = state.buffer;
+	if (buffer->interface_address != first->interface_address
+		|| buffer->flags != first->flags
+		|| (first->interface_address == NULL
+			&& (buffer->type != B_NET_FRAME_TYPE_IPV4
+				|| first->type != B_NET_FRAME_TYPE_IPV4))
+		|| (first->interface_address != NULL
+			&& first->interface_address->domain->family != AF_INET))
+		return false;
+
+	uint32 payloadSize = buffer->size - headers.Length();
+	if (state.last_size != state.segment_size
+		|| payloadSize > state.segment_size
+		|| first->size + payloadSize > kMaxCoalescedSize
+		|| (state.headers.TCP().th_flags & TCP_FLAG_PUSH) != 0)
+		return false;
+
+	ip& ipHeader = headers.IP();
+	ip& firstIPHeader = state.headers.IP();
+	if (ipHeader.ip_src.s_addr != firstIPHeader.ip_src.s_addr
+		|| ipHeader.ip_dst.s_addr != firstIPHeader.ip_dst.s_addr
+		|| ipHeader.ip_tos != firstIPHeader.ip_tos
+		|| ipHeader.ip_ttl != firstIPHeader.ip_ttl
+		|| ipHeader.ip_off != firstIPHeader.ip_off)
+		return false;
+
+	// Everything but the sequence number, and the push flag must match,
+	// including all options
+	tcphdr& tcpHeader = headers.TCP();
+	tcphdr& firstTCPHeader = state.headers.TCP();
+	return headers.tcp_length == state.headers.tcp_length
+		&& tcpHeader.th_sport == firstTCPHeader.th_sport
+		&& tcpHeader.th_dport == firstTCPHeader.th_dport
+		&& tcpHeader.th_ack == firstTCPHeader.th_ack
+		&& tcpHeader.th_win == firstTCPHeader.th_win
+		&& ntohl(tcpHeader.th_seq)
+			== ntohl(firstTCPHeader.th_seq) + state.payload_size
+		&& memcmp(&tcpHeader + 1, &firstTCPHeader + 1,
+			headers.tcp_length - sizeof(tcphdr)) == 0;
+}
+
+
+/*!	Appends the payload of \a buffer to the coalesced buffer. The \a buffer
+	is consumed in any case.
+*/
+static void
+append_segment(coalesce_state& state, net_buffer* buffer,
+	segment_headers& headers, uint32 payloadSum)
+{
+	net_buffer* first = state.buffer;
+	uint32 previousSize = first->size;
+	uint32 payloadSize = buffer->size - headers.Length();
+
+	if (gNetBufferModule.remove_header(buffer, headers.Length()) != B_OK
+		|| gNetBufferModule.merge(first, buffer, true) != B_OK) {
+		// drop the segment, the peer will have to retransmit it
+		gNetBufferModule.trim(first, previousSize);
+		gNetBufferModule.free(buffer);
+		state.last_size = 0;
+		return;
+	}
+
+	if ((state.payload_size & 1) != 0)
+		payloadSum = __swap_int16(payloadSum);
+
+	state.payload_sum += payloadSum;
+	state.payload_size += payloadSize;
+	state.last_size = payloadSize;
+	state.count++;
+
+	state.headers.TCP().th_flags |= headers.TCP().th_flags & TCP_FLAG_PUSH;
+}
+
+
+/*!	Updates the headers of the coalesced buffer. */
+static void
+finish_coalescing(coalesce_state& state)
+{
+	net_buffer* buffer = state.buffer;
+	segment_headers& headers = state.headers;
+
+	ip& ipHeader = headers.IP();
+	ipHeader.ip_len = htons(buffer->size);
+	ipHeader.ip_sum = 0;
+	ipHeader.ip_sum = checksum(headers.data, headers.ip_length);
+
+	tcphdr& tcpHeader = headers.TCP();
+	tcpHeader.th_sum = 0;
+
+	Checksum checksum;
+	checksum << (uint32)ipHeader.ip_src.s_addr << (uint32)ipHeader.ip_dst.s_addr
+		<< (uint16)htons(IPPROTO_TCP)
+		<< (uint16)htons(buffer->size - headers.ip_length)
+		<< compute_checksum(headers.data + headers.ip_length,
+			headers.tcp_length)
+		<< state.payload_sum;
+	tcpHeader.th_sum = checksum;
+
+	gNetBufferModule.write(buffer, 0, headers.data, headers.Length());
+	buffer->segment_size = state.segment_size;
+
+	atomic_add(&sCoalescedSegments, state.count);
+	atomic_add(&sCoalescedBuffers, 1);
+
+	TRACE(("coalesce_segments(): coalesced %lu segments into buffer %p, %lu "
+		"bytes\n", state.count, buffer, buffer->size));
+}
+
+
+/*!	Coalesces the TCP segment in \a buffer with the segments of the same
+	connection that directly follow it in the \a fifo. Only buffers that
+	are already waiting in the \a fifo are considered, so that no delay
+	is introduced.
+	Returns the resulting buffer. If a buffer has been removed from the
+	\a fifo that could not be coalesced, it is returned in \a _next, and
+	must be processed next in order to keep the order of the buffers.
+*/
+net_buffer*
+coalesce_segments(net_buffer* buffer, net_fifo* fifo, net_buffer** _next)
+{
+	*_next = NULL;
+
+	coalesce_state state;
+	if (!is_coalescable(buffer, state.headers))
+		return buffer;
+
+	state.buffer = buffer;
+	state.payload_size = buffer->size - state.headers.Length();
+	state.segment_size = state.payload_size;
+	state.last_size = state.payload_size;
+	state.count = 1;
+	state.verified = false;
+
+	while ((state.headers.TCP().th_flags & TCP_FLAG_PUSH) == 0) {
+		net_buffer* next;
+		if (fifo_dequeue_buffer(fifo, MSG_DONTWAIT, 0, &next) != B_OK)
+			break;
+
+		segment_headers headers;
+		uint32 payloadSum;
+		if (!is_coalescable(next, headers)
+			|| !continues_segments(state, next, headers)
+			|| (!state.verified
+				&& !verify_segment(buffer, state.headers, state.payload_sum))
+			|| !verify_segment(next, headers, payloadSum)) {
+			*_next = next;
+			break;
+		}
+
+		state.verified = true;
+		append_segment(state, next, headers, payloadSum);
+	}
+
+	if (state.count > 1)
+		finish_coalescing(state);
+
+	return buffer;
+}
+
+
+//	#pragma mark -
+
+
+static int
+dump_offload_stats(int argc, char** argv)
+{
+	kprintf("super-segments passed to devices: %7ld\n",
+		sOffloadedSuperSegments);
+	kprintf("super-segments split:             %7ld, into %ld segments\n",
+		sSplitSuperSegments, sSplitSegments);
+	kprintf("received segments coalesced:      %7ld, into %ld buffers\n",
+		sCoalescedSegments, sCoalescedBuffers);
+	return 0;
+}
+
+
+void
+init_offload()
+{
+	add_debugger_command("net_offload_stats", &dump_offload_stats,
+		"Dump network segmentation and receive offload statistics");
+}
+
+
+void
+uninit_offload()
+{
+	remove_debugger_command("net_offload_stats", &dump_offload_stats);
+}
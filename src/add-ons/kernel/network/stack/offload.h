@@ -0,0 +1,23 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+
+#include <net_datalink_protocol.h>
+#include <net_device.h>
+#include <net_stack.h>
+
+
+status_t send_super_segment(net_datalink_protocol* protocol,
+	net_device* device, net_buffer* buffer);
+net_buffer* coalesce_segments(net_buffer* buffer, net_fifo* fifo,
+	net_buffer** _next);
+
+void init_offload();
+void uninit_offload();
+
+
+#endif	// OFFLOAD_H
@@ -12,6 +12,7 @@
 #include "domains.h"
 #include "interfaces.h"
 #include "link.h"
+#include "offload.h"
 #include "stack_private.h"
 #include "utility.h"
 
@@ -828,6 +829,7 @@ init_stack()
 	sInitialized = true;
 
 	link_init();
+	init_offload();
 	scan_modules("network/protocols");
 	scan_modules("network/datalink_protocols");
 
@@ -874,6 +876,7 @@ uninit_stack()
 	TRACE(("Unloading network stack\n"));
 
 	put_module(NET_SOCKET_MODULE_NAME);
+	uninit_offload();
 	uninit_timers();
 	uninit_device_interfaces();
 	uninit_interfaces();
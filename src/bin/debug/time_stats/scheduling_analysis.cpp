@@ -165,6 +165,20 @@ do_scheduling_analysis(bigtime_t startTime, bigtime_t endTime,
 		"%llu thread wait objects\n", analysis.thread_count,
 		analysis.wait_object_count, analysis.thread_wait_object_count);
 
+	// print the per-CPU load distribution
+	bigtime_t totalCPURunTime = 0;
+	for (uint32 i = 0; i < analysis.cpu_count; i++)
+		totalCPURunTime += analysis.cpus[i].total_run_time;
+
+	for (uint32 i = 0; i < analysis.cpu_count; i++) {
+		scheduling_analysis_cpu& cpu = analysis.cpus[i];
+		printf("cpu %lu: run time: %lld us (%lld runs, %.1f%%), migrations: "
+			"%lld\n", i, cpu.total_run_time, cpu.runs,
+			totalCPURunTime > 0
+				? 100.0 * cpu.total_run_time / totalCPURunTime : 0.0,
+			cpu.migrations);
+	}
+
 	// sort the thread by run time
 	std::sort(analysis.threads, analysis.threads + analysis.thread_count,
 		ThreadRunTimeComparator());
@@ -226,6 +240,7 @@ do_scheduling_analysis(bigtime_t startTime, bigtime_t endTime,
 		printf("  preemptions: %lld us (%lld)\n", thread->total_rerun_time,
 			thread->reruns);
 		printf("  unspecified: %lld us\n", thread->unspecified_wait_time);
+		printf("  migrations:  %lld\n", thread->migrations);
 
 		printf("  waited on:\n");
 		for (int32 i = 0; i < groupCount; i++) {
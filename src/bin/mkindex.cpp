@@ -88,7 +88,11 @@ usage(int status)
 		"\t\t\t\"llong\", \"string\", \"float\", or \"double\".\n"
 		"\t\t\tDefaults to \"string\".\n"
 		"      --copy-from\tpath to volume to copy the indexes from.\n"
-		"  -v, --verbose\t\tprint information about the index being created\n",
+		"  -v, --verbose\t\tprint information about the index being created\n"
+		"\n"
+		"On BFS, the string indices \"name:folded\" and \"name:trigram\" are\n"
+		"maintained by the file system itself; they speed up case-insensitive\n"
+		"and substring queries for the name.\n",
 		kProgramName);
 
 	exit(status);
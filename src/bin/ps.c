@@ -13,11 +13,15 @@
 
 #include <OS.h>
 
+#include <syscalls.h>
+#include <system_info.h>
+
 #define SNOOZE_TIME 100000
 
 char *sStates[] = {"run", "rdy", "msg", "zzz", "sus", "wait" };
 
-static void printTeamThreads(team_info *teamInfo, bool printSemaphoreInfo); 
+static void printTeamThreads(team_info *teamInfo, bool printSemaphoreInfo,
+	bool printSchedulerInfo);
 static void printTeamInfo(team_info *teamInfo, bool printHeader);
 
 static void
@@ -34,12 +38,25 @@ printTeamInfo(team_info *teamInfo, bool printHeader)
 
 
 static void
-printTeamThreads(team_info *teamInfo, bool printSemaphoreInfo)
+printThreadHeader(bool printSchedulerInfo)
+{
+	printf("\n%-37s %5s %8s %4s %8s %8s", "Thread", "Id", "State", "Prio",
+		"UTime", "KTime");
+	if (printSchedulerInfo)
+		printf(" %8s %8s %6s %6s", "AvgLat", "MaxLat", "Invol", "Migr");
+	puts("");
+}
+
+
+static void
+printTeamThreads(team_info *teamInfo, bool printSemaphoreInfo,
+	bool printSchedulerInfo)
 {
 	char *threadState;
 	uint32 threadCookie = 0;
 	sem_info semaphoreInfo;
 	thread_info threadInfo;
+	struct scheduler_thread_info schedulerInfo;
 	
 	// Print all info about its threads too
 	while (get_next_thread_info(teamInfo->team, &threadCookie, &threadInfo)
@@ -56,6 +73,19 @@ printTeamThreads(team_info *teamInfo, bool printSemaphoreInfo)
 			threadInfo.priority, (threadInfo.user_time / 1000),
 			(threadInfo.kernel_time / 1000));
 
+		if (printSchedulerInfo) {
+			if (_kern_get_scheduler_thread_info(threadInfo.thread,
+					&schedulerInfo, sizeof(schedulerInfo)) == B_OK) {
+				printf("%8lld %8lld %6lld %6lld ",
+					schedulerInfo.latencies > 0 ? schedulerInfo.total_latency
+						/ schedulerInfo.latencies : 0,
+					schedulerInfo.max_latency,
+					schedulerInfo.involuntary_switches,
+					schedulerInfo.migrations);
+			} else
+				printf("%8s %8s %6s %6s ", "-", "-", "-", "-");
+		}
+
 		if (printSemaphoreInfo) {
 			if (threadInfo.state == B_THREAD_WAITING && threadInfo.sem != -1) {
 				status_t status = get_sem_info(threadInfo.sem, &semaphoreInfo);
@@ -76,25 +106,30 @@ main(int argc, char **argv)
 	team_info teamInfo;
 	uint32 teamCookie = 0;
 	system_info systemInfo;
+	struct system_scheduler_info schedulerInfo;
 	bool printSystemInfo = false;
 	bool printThreads = false;
 	bool printHeader = true;
 	bool printSemaphoreInfo = false;
+	bool printSchedulerInfo = false;
 	// match this in team name
 	char *string_to_match;
 	
 	int c;
 	
-	while ((c = getopt(argc, argv,"ihas")) != EOF) {
+	while ((c = getopt(argc, argv,"ihasl")) != EOF) {
 		switch(c) {
 			case 'i':
 				printSystemInfo = true;
 				break;
 			case 'h':
-				printf( "usage: ps [-hais] [team]\n"
+				printf( "usage: ps [-haisl] [team]\n"
 			   			"-h : show help\n"
 			   			"-i : show system info\n"
 			   			"-s : show semaphore info\n"
+			   			"-l : show scheduling latencies (in us), involuntary "\
+			   				"context switches\n"
+			   			"     and CPU migrations of the threads\n"
 			   			"-a : show threads too (by default only teams are " \
 			   				"displayed)\n");
 				return 0;
@@ -105,6 +140,9 @@ main(int argc, char **argv)
 			case 's':
 				printSemaphoreInfo = true;
 				break;
+			case 'l':
+				printSchedulerInfo = true;
+				break;
 		}
 	}
 
@@ -123,9 +161,9 @@ main(int argc, char **argv)
 			printTeamInfo(&teamInfo,printHeader);
 			printHeader = false;
 			if (printThreads) {
-				printf("\n%-37s %5s %8s %4s %8s %8s\n", "Thread", "Id", \
-					"State", "Prio", "UTime", "KTime");
-				printTeamThreads(&teamInfo,printSemaphoreInfo);
+				printThreadHeader(printSchedulerInfo);
+				printTeamThreads(&teamInfo, printSemaphoreInfo,
+					printSchedulerInfo);
 				printf("----------------------------------------------" \
 					"-----------------------------\n");
 				printHeader = true;
@@ -143,9 +181,9 @@ main(int argc, char **argv)
 			if (strstr(p, string_to_match) == NULL)
 				continue;
 			printTeamInfo(&teamInfo,true);
-			printf("\n%-37s %5s %8s %4s %8s %8s\n", "Thread", "Id", "State", \
-				"Prio", "UTime", "KTime");
-			printTeamThreads(&teamInfo,printSemaphoreInfo);
+			printThreadHeader(printSchedulerInfo);
+			printTeamThreads(&teamInfo, printSemaphoreInfo,
+				printSchedulerInfo);
 		}
 	}
 
@@ -164,6 +202,20 @@ main(int argc, char **argv)
 			(systemInfo.max_pages - systemInfo.used_pages) * B_PAGE_SIZE);
 		printf("%2.1f%% memory utilisation\n",
 			(float)100 * systemInfo.used_pages / systemInfo.max_pages);
+
+		// scheduler stats
+		if (__get_system_info_etc(B_SCHEDULER_INFO, &schedulerInfo,
+				sizeof(schedulerInfo)) == B_OK) {
+			uint32 i;
+			printf("\n%4s %6s %12s %12s %10s\n", "CPU", "Queue", "Switches",
+				"Involuntary", "Migrations");
+			for (i = 0; i < schedulerInfo.cpu_count; i++) {
+				struct scheduler_cpu_info *cpu = &schedulerInfo.cpus[i];
+				printf("%4lu %6ld %12lld %12lld %10lld\n", i,
+					cpu->run_queue_depth, cpu->context_switches,
+					cpu->involuntary_switches, cpu->migrations);
+			}
+		}
 	}
 	return 0;
 }
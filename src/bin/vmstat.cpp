@@ -13,6 +13,7 @@
 
 
 static struct option const kLongOptions[] = {
+	{"caches", no_argument, 0, 'c'},
 	{"periodic", no_argument, 0, 'p'},
 	{"rate", required_argument, 0, 'r'},
 	{"help", no_argument, 0, 'h'},
@@ -26,7 +27,9 @@ static const char *kProgramName = __progname;
 void
 usage(int status)
 {
-	fprintf(stderr, "usage: %s [-p] [-r <time>]\n"
+	fprintf(stderr, "usage: %s [-c] [-p] [-r <time>]\n"
+		" -c,--caches\tDumps the kernel's object caches and how often their\n"
+		"\t\tper-CPU magazine depots have been contended.\n"
 		" -p,--periodic\tDumps changes periodically every second.\n"
 		" -r,--rate\tDumps changes periodically every <time> milli seconds.\n",
 		kProgramName);
@@ -35,6 +38,50 @@ usage(int status)
 }
 
 
+static int
+dump_object_caches()
+{
+	size_t size = 64 * 1024;
+	system_object_cache_info* info = NULL;
+
+	while (true) {
+		info = (system_object_cache_info*)realloc(info, size);
+		if (info == NULL) {
+			fprintf(stderr, "%s: out of memory\n", kProgramName);
+			return 1;
+		}
+
+		status_t status = __get_system_info_etc(B_OBJECT_CACHE_INFO, info,
+			size);
+		if (status != B_OK) {
+			fprintf(stderr, "%s: cannot get object cache info: %s\n",
+				kProgramName, strerror(status));
+			free(info);
+			return 1;
+		}
+
+		if (info->info_count == info->cache_count)
+			break;
+
+		size *= 2;
+	}
+
+	printf("%-32s %8s %10s %10s %6s %12s %10s\n", "name", "objsize", "usage",
+		"used", "magcap", "exchanges", "contended");
+
+	for (uint32 i = 0; i < info->info_count; i++) {
+		object_cache_info& cache = info->caches[i];
+		printf("%-32s %8lu %10lu %10lu %6lu %12Lu %10Lu\n", cache.name,
+			cache.object_size, cache.usage, cache.used_count,
+			cache.magazine_capacity, cache.depot_exchanges,
+			cache.depot_contentions);
+	}
+
+	free(info);
+	return 0;
+}
+
+
 int
 main(int argc, char** argv)
 {
@@ -42,10 +89,12 @@ main(int argc, char** argv)
 	bigtime_t rate = 1000000LL;
 
 	int c;
-	while ((c = getopt_long(argc, argv, "pr:h", kLongOptions, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "cpr:h", kLongOptions, NULL)) != -1) {
 		switch (c) {
 			case 0:
 				break;
+			case 'c':
+				return dump_object_caches();
 			case 'p':
 				periodically = true;
 				break;
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 
 #include <syscall_utils.h>
@@ -286,6 +287,18 @@ send(int socket, const void *data, size_t length, int flags)
 }
 
 
+/*!	Sends \a count bytes from \a inFD, starting at \a offset (or the
+	descriptor's current position, if \c NULL), over the socket \a outFD,
+	without copying them to and from userland.
+*/
+extern "C" ssize_t
+sendfile(int outFD, int inFD, off_t *offset, size_t count)
+{
+	RETURN_AND_SET_ERRNO_TEST_CANCEL(_kern_splice(inFD, offset, outFD, NULL,
+		count, 0));
+}
+
+
 extern "C" ssize_t
 sendto(int socket, const void *data, size_t length, int flags,
 	const struct sockaddr *address, socklen_t addressLength)
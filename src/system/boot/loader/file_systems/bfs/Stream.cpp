@@ -293,6 +293,42 @@ Stream::FindBlockRun(off_t pos, block_run& run, off_t& offset)
 }
 
 
+/*!	Reads from the data of a file that is stored in the small_data section
+	of its inode. Unlike the rest of the small_data section, this is loaded
+	on demand.
+*/
+status_t
+Stream::ReadInlineData(off_t pos, uint8* buffer, size_t* _length)
+{
+	CachedBlock cached(fVolume);
+	const bfs_inode* node = (const bfs_inode*)cached.SetTo(inode_num);
+	if (node == NULL) {
+		*_length = 0;
+		return B_IO_ERROR;
+	}
+
+	const small_data* item = ((bfs_inode*)node)->SmallDataStart();
+	for (; !item->IsLast(node); item = item->Next()) {
+		if (*item->Name() != FILE_DATA_NAME
+			|| item->NameSize() != FILE_DATA_NAME_LENGTH)
+			continue;
+
+		if (pos >= item->DataSize()) {
+			*_length = 0;
+			return B_OK;
+		}
+		if (pos + *_length > item->DataSize())
+			*_length = item->DataSize() - pos;
+
+		memcpy(buffer, item->Data() + pos, *_length);
+		return B_OK;
+	}
+
+	*_length = 0;
+	return B_BAD_DATA;
+}
+
+
 status_t
 Stream::ReadAt(off_t pos, uint8* buffer, size_t* _length)
 {
@@ -310,6 +346,11 @@ Stream::ReadAt(off_t pos, uint8* buffer, size_t* _length)
 	if (pos + length > data.Size())
 		length = data.Size() - pos;
 
+	if ((Flags() & INODE_INLINE_DATA) != 0) {
+		*_length = length;
+		return ReadInlineData(pos, buffer, _length);
+	}
+
 	block_run run;
 	off_t offset;
 	if (FindBlockRun(pos, run, offset) < B_OK) {
@@ -291,6 +291,36 @@ x86_get_mtrr(uint32 index, uint64 *_base, uint64 *_length, uint8 *_type)
 }
 
 
+/*!	Returns whether or not the MTRRs assign the same memory type to the whole
+	physical range. A large page must not span ranges of different memory
+	types, as the processor's behavior is undefined then.
+*/
+bool
+x86_has_uniform_memory_type(phys_addr_t base, phys_size_t size)
+{
+	// the fixed range MTRRs split up the first MB into small ranges
+	if (base < 0x100000)
+		return false;
+
+	uint32 count = x86_count_mtrrs();
+	for (uint32 i = 0; i < count; i++) {
+		uint64 mtrrBase;
+		uint64 mtrrLength;
+		uint8 type;
+		if (x86_get_mtrr(i, &mtrrBase, &mtrrLength, &type) != B_OK)
+			continue;
+
+		// the MTRR must either cover the whole range, or none of it
+		if (mtrrBase >= base + size || mtrrBase + mtrrLength <= base)
+			continue;
+		if (mtrrBase > base || mtrrBase + mtrrLength < base + size)
+			return false;
+	}
+
+	return true;
+}
+
+
 void
 x86_set_mtrrs(uint8 defaultType, const x86_mtrr_info* infos, uint32 count)
 {
@@ -764,6 +794,11 @@ arch_cpu_init_percpu(kernel_args *args, int cpu)
 {
 	detect_cpu(cpu);
 
+	// enable page size extensions, so that 4 MB pages can be used with 32 bit
+	// paging
+	if (x86_check_feature(IA32_FEATURE_PSE, FEATURE_COMMON))
+		x86_write_cr4(x86_read_cr4() | IA32_CR4_PSE);
+
 	// load the TSS for this cpu
 	// note the main cpu gets initialized in arch_cpu_init_post_vm()
 	if (cpu != 0) {
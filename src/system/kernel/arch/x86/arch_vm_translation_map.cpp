@@ -12,6 +12,7 @@
 
 #include <boot/kernel_args.h>
 
+#include "paging/X86VMTranslationMap.h"
 #include "paging/32bit/X86PagingMethod32Bit.h"
 #include "paging/pae/X86PagingMethodPAE.h"
 
@@ -114,6 +115,12 @@ arch_vm_translation_map_init_post_area(kernel_args *args)
 {
 	TRACE("vm_translation_map_init_post_area: entry\n");
 
+	add_debugger_command_etc("large_pages", &dump_large_page_stats,
+		"Print large page mapping statistics",
+		"\n"
+		"Prints the number of large page mappings in use and how often page\n"
+		"tables have been promoted to and demoted from large pages.\n", 0);
+
 	return gX86PagingMethod->InitPostArea(args);
 }
 
@@ -448,7 +448,11 @@ X86PagingMethod32Bit::IsKernelPageAccessible(addr_t virtualAddress,
 	page_table_entry pageTableEntry;
 	index = VADDR_TO_PTENT(virtualAddress);
 
-	if ((pageDirectoryEntry & X86_PDE_PRESENT) != 0
+	if ((pageDirectoryEntry & X86_PDE_LARGE_PAGE) != 0) {
+		// the present and writable flags are where they are for page table
+		// entries
+		pageTableEntry = pageDirectoryEntry;
+	} else if ((pageDirectoryEntry & X86_PDE_PRESENT) != 0
 			&& fPhysicalPageMapper != NULL) {
 		void* handle;
 		addr_t virtualPageTable;
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <heap.h>
 #include <int.h>
 #include <thread.h>
 #include <slab/Slab.h>
@@ -37,9 +38,21 @@
 #endif
 
 
+void
+X86VMTranslationMap32Bit::_DemoteIfLargePage(uint32 index)
+{
+	if ((fPagingStructures->pgdir_virt[index] & X86_PDE_LARGE_PAGE) != 0)
+		_DemoteLargePage(index);
+}
+
+
+// #pragma mark -
+
+
 X86VMTranslationMap32Bit::X86VMTranslationMap32Bit()
 	:
-	fPagingStructures(NULL)
+	fPagingStructures(NULL),
+	fLargePageTables(NULL)
 {
 }
 
@@ -56,9 +69,14 @@ X86VMTranslationMap32Bit::~X86VMTranslationMap32Bit()
 		// cycle through and free all of the user space pgtables
 		for (uint32 i = VADDR_TO_PDENT(USER_BASE);
 				i <= VADDR_TO_PDENT(USER_BASE + (USER_SIZE - 1)); i++) {
-			if ((fPagingStructures->pgdir_virt[i] & X86_PDE_PRESENT) != 0) {
-				addr_t address = fPagingStructures->pgdir_virt[i]
-					& X86_PDE_ADDRESS_MASK;
+			page_directory_entry entry = fPagingStructures->pgdir_virt[i];
+			if ((entry & X86_PDE_LARGE_PAGE) != 0) {
+				entry = fLargePageTables[i];
+				atomic_add(&gX86LargePageStats.in_use, -1);
+			}
+
+			if ((entry & X86_PDE_PRESENT) != 0) {
+				addr_t address = entry & X86_PDE_ADDRESS_MASK;
 				vm_page* page = vm_lookup_page(address / B_PAGE_SIZE);
 				if (!page)
 					panic("destroy_tmap: didn't find pgtable page\n");
@@ -68,6 +86,8 @@ X86VMTranslationMap32Bit::~X86VMTranslationMap32Bit()
 		}
 	}
 
+	free(fLargePageTables);
+
 	fPagingStructures->RemoveReference();
 }
 
@@ -180,7 +200,8 @@ X86VMTranslationMap32Bit::Map(addr_t va, phys_addr_t pa, uint32 attributes,
 		}
 
 		fMapCount++;
-	}
+	} else
+		_DemoteIfLargePage(index);
 
 	// now, fill in the pentry
 	Thread* thread = thread_get_current_thread();
@@ -228,6 +249,8 @@ X86VMTranslationMap32Bit::Unmap(addr_t start, addr_t end)
 			continue;
 		}
 
+		_DemoteIfLargePage(index);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -280,6 +303,8 @@ X86VMTranslationMap32Bit::DebugMarkRangePresent(addr_t start, addr_t end,
 			continue;
 		}
 
+		_DemoteIfLargePage(index);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -335,6 +360,8 @@ X86VMTranslationMap32Bit::UnmapPage(VMArea* area, addr_t address,
 	if ((pd[index] & X86_PDE_PRESENT) == 0)
 		return B_ENTRY_NOT_FOUND;
 
+	_DemoteIfLargePage(index);
+
 	ThreadCPUPinner pinner(thread_get_current_thread());
 
 	page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
@@ -411,6 +438,8 @@ X86VMTranslationMap32Bit::UnmapPages(VMArea* area, addr_t base, size_t size,
 			continue;
 		}
 
+		_DemoteIfLargePage(index);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -546,6 +575,8 @@ X86VMTranslationMap32Bit::UnmapArea(VMArea* area, bool deletingAddressSpace,
 				continue;
 			}
 
+			_DemoteIfLargePage(index);
+
 			ThreadCPUPinner pinner(thread_get_current_thread());
 
 			page_table_entry* pt
@@ -615,7 +646,8 @@ X86VMTranslationMap32Bit::Query(addr_t va, phys_addr_t *_physical,
 
 	int index = VADDR_TO_PDENT(va);
 	page_directory_entry *pd = fPagingStructures->pgdir_virt;
-	if ((pd[index] & X86_PDE_PRESENT) == 0) {
+	page_directory_entry pageDirEntry = pd[index];
+	if ((pageDirEntry & X86_PDE_PRESENT) == 0) {
 		// no pagetable here
 		return B_OK;
 	}
@@ -623,9 +655,18 @@ X86VMTranslationMap32Bit::Query(addr_t va, phys_addr_t *_physical,
 	Thread* thread = thread_get_current_thread();
 	ThreadCPUPinner pinner(thread);
 
-	page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
-		pd[index] & X86_PDE_ADDRESS_MASK);
-	page_table_entry entry = pt[VADDR_TO_PTENT(va)];
+	page_table_entry entry;
+	if ((pageDirEntry & X86_PDE_LARGE_PAGE) != 0) {
+		// The large page's flags are compatible with the page table entry
+		// flags we're interested in.
+		entry = ((pageDirEntry & X86_PDE_LARGE_ADDRESS_MASK)
+				+ (va % kLargePageSize & X86_PTE_ADDRESS_MASK))
+			| (pageDirEntry & ~X86_PDE_ADDRESS_MASK);
+	} else {
+		page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
+			pageDirEntry & X86_PDE_ADDRESS_MASK);
+		entry = pt[VADDR_TO_PTENT(va)];
+	}
 
 	*_physical = entry & X86_PDE_ADDRESS_MASK;
 
@@ -658,16 +699,24 @@ X86VMTranslationMap32Bit::QueryInterrupt(addr_t va, phys_addr_t *_physical,
 
 	int index = VADDR_TO_PDENT(va);
 	page_directory_entry* pd = fPagingStructures->pgdir_virt;
-	if ((pd[index] & X86_PDE_PRESENT) == 0) {
+	page_directory_entry pageDirEntry = pd[index];
+	if ((pageDirEntry & X86_PDE_PRESENT) == 0) {
 		// no pagetable here
 		return B_OK;
 	}
 
-	// map page table entry
-	page_table_entry* pt = (page_table_entry*)X86PagingMethod32Bit::Method()
-		->PhysicalPageMapper()->InterruptGetPageTableAt(
-			pd[index] & X86_PDE_ADDRESS_MASK);
-	page_table_entry entry = pt[VADDR_TO_PTENT(va)];
+	page_table_entry entry;
+	if ((pageDirEntry & X86_PDE_LARGE_PAGE) != 0) {
+		entry = ((pageDirEntry & X86_PDE_LARGE_ADDRESS_MASK)
+				+ (va % kLargePageSize & X86_PTE_ADDRESS_MASK))
+			| (pageDirEntry & ~X86_PDE_ADDRESS_MASK);
+	} else {
+		// map page table entry
+		page_table_entry* pt = (page_table_entry*)X86PagingMethod32Bit::Method()
+			->PhysicalPageMapper()->InterruptGetPageTableAt(
+				pageDirEntry & X86_PDE_ADDRESS_MASK);
+		entry = pt[VADDR_TO_PTENT(va)];
+	}
 
 	*_physical = entry & X86_PDE_ADDRESS_MASK;
 
@@ -718,6 +767,8 @@ X86VMTranslationMap32Bit::Protect(addr_t start, addr_t end, uint32 attributes,
 			continue;
 		}
 
+		_DemoteIfLargePage(index);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -774,6 +825,8 @@ X86VMTranslationMap32Bit::ClearFlags(addr_t va, uint32 flags)
 		return B_OK;
 	}
 
+	_DemoteIfLargePage(index);
+
 	uint32 flagsToClear = ((flags & PAGE_MODIFIED) ? X86_PTE_DIRTY : 0)
 		| ((flags & PAGE_ACCESSED) ? X86_PTE_ACCESSED : 0);
 
@@ -815,6 +868,8 @@ X86VMTranslationMap32Bit::ClearAccessedAndModified(VMArea* area, addr_t address,
 	if ((pd[index] & X86_PDE_PRESENT) == 0)
 		return false;
 
+	_DemoteIfLargePage(index);
+
 	ThreadCPUPinner pinner(thread_get_current_thread());
 
 	page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
@@ -885,8 +940,157 @@ X86VMTranslationMap32Bit::ClearAccessedAndModified(VMArea* area, addr_t address,
 }
 
 
+size_t
+X86VMTranslationMap32Bit::LargePageSize() const
+{
+	return x86_check_feature(IA32_FEATURE_PSE, FEATURE_COMMON)
+		? kLargePageSize : 0;
+}
+
+
+void
+X86VMTranslationMap32Bit::Promote(addr_t base, size_t size)
+{
+	if (LargePageSize() == 0)
+		return;
+
+	addr_t address = ROUNDUP(base, kLargePageSize);
+	while (address >= base && address - base + kLargePageSize <= size) {
+		_PromotePageTable(VADDR_TO_PDENT(address));
+		address += kLargePageSize;
+	}
+}
+
+
 X86PagingStructures*
 X86VMTranslationMap32Bit::PagingStructures() const
 {
 	return fPagingStructures;
 }
+
+
+/*!	Replaces the page directory entry at \a index by a large page mapping, if
+	the page table it refers to maps a physically contiguous, large page aligned
+	range with uniform attributes. The page table itself is kept, so the large
+	page can be demoted again without having to allocate memory.
+	The map must be locked.
+*/
+bool
+X86VMTranslationMap32Bit::_PromotePageTable(uint32 index)
+{
+	page_directory_entry* pd = fPagingStructures->pgdir_virt;
+	page_directory_entry pageDirEntry = pd[index];
+	if ((pageDirEntry & X86_PDE_PRESENT) == 0
+		|| (pageDirEntry & X86_PDE_LARGE_PAGE) != 0) {
+		return false;
+	}
+
+	const page_table_entry kAttributeMask = X86_PTE_PRESENT
+		| X86_PTE_PROTECTION_MASK | X86_PTE_MEMORY_TYPE_MASK | X86_PTE_PAT
+		| X86_PTE_GLOBAL;
+
+	Thread* thread = thread_get_current_thread();
+	ThreadCPUPinner pinner(thread);
+
+	page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
+		pageDirEntry & X86_PDE_ADDRESS_MASK);
+
+	page_table_entry firstEntry = pt[0];
+	page_table_entry attributes = firstEntry & kAttributeMask;
+	phys_addr_t physicalBase = firstEntry & X86_PTE_ADDRESS_MASK;
+	if ((firstEntry & X86_PTE_PRESENT) == 0
+		|| (firstEntry & X86_PTE_PAT) != 0
+		|| physicalBase % kLargePageSize != 0) {
+		return false;
+	}
+
+	for (uint32 i = 1; i < 1024; i++) {
+		if ((pt[i] & (X86_PTE_ADDRESS_MASK | kAttributeMask))
+				!= ((physicalBase + i * B_PAGE_SIZE) | attributes)) {
+			return false;
+		}
+	}
+
+	pinner.Unlock();
+
+	if (!x86_has_uniform_memory_type(physicalBase, kLargePageSize))
+		return false;
+
+	if (fLargePageTables == NULL) {
+		fLargePageTables = (page_directory_entry*)malloc_etc(B_PAGE_SIZE,
+			HEAP_DONT_WAIT_FOR_MEMORY
+				| (fIsKernelMap ? HEAP_DONT_LOCK_KERNEL_SPACE : 0));
+		if (fLargePageTables == NULL)
+			return false;
+		memset(fLargePageTables, 0, B_PAGE_SIZE);
+	}
+
+	// The protection, memory type, and global flags are at the same positions
+	// in page directory and page table entries.
+	page_directory_entry largePageEntry = physicalBase | attributes
+		| X86_PDE_LARGE_PAGE;
+
+	fLargePageTables[index] = pageDirEntry;
+	X86PagingMethod32Bit::SetPageTableEntry(&pd[index], largePageEntry);
+
+	if (index >= FIRST_KERNEL_PGDIR_ENT
+		&& index < (FIRST_KERNEL_PGDIR_ENT + NUM_KERNEL_PGDIR_ENTS)) {
+		X86PagingStructures32Bit::UpdateAllPageDirs(index, largePageEntry);
+	}
+
+	InvalidateAllPages();
+
+	atomic_add(&gX86LargePageStats.in_use, 1);
+	atomic_add(&gX86LargePageStats.promotions, 1);
+
+	TRACE("X86VMTranslationMap32Bit::_PromotePageTable(): %#" B_PRIxADDR
+		" -> %#" B_PRIxPHYSADDR "\n", (addr_t)index * kLargePageSize,
+		physicalBase);
+
+	return true;
+}
+
+
+/*!	Replaces the large page mapping at page directory index \a index by the
+	page table it has been promoted from. The page table entries inherit the
+	large page's accessed and dirty flags.
+	The map must be locked.
+*/
+void
+X86VMTranslationMap32Bit::_DemoteLargePage(uint32 index)
+{
+	page_directory_entry* pd = fPagingStructures->pgdir_virt;
+	page_directory_entry pageDirEntry = fLargePageTables[index];
+	fLargePageTables[index] = 0;
+
+	page_directory_entry oldEntry = X86PagingMethod32Bit::SetPageTableEntry(
+		&pd[index], pageDirEntry);
+
+	uint32 flags = oldEntry & (X86_PTE_ACCESSED | X86_PTE_DIRTY);
+	if (index >= FIRST_KERNEL_PGDIR_ENT
+		&& index < (FIRST_KERNEL_PGDIR_ENT + NUM_KERNEL_PGDIR_ENTS)) {
+		X86PagingStructures32Bit::UpdateAllPageDirs(index, pageDirEntry);
+
+		// The other page directories' copies of the entry may have collected
+		// flags we don't know about.
+		flags = X86_PTE_ACCESSED | X86_PTE_DIRTY;
+	}
+
+	if (flags != 0) {
+		Thread* thread = thread_get_current_thread();
+		ThreadCPUPinner pinner(thread);
+
+		page_table_entry* pt = (page_table_entry*)fPageMapper->GetPageTableAt(
+			pageDirEntry & X86_PDE_ADDRESS_MASK);
+		for (uint32 i = 0; i < 1024; i++)
+			X86PagingMethod32Bit::SetPageTableEntryFlags(&pt[i], flags);
+	}
+
+	InvalidateAllPages();
+
+	atomic_add(&gX86LargePageStats.in_use, -1);
+	atomic_add(&gX86LargePageStats.demotions, 1);
+
+	TRACE("X86VMTranslationMap32Bit::_DemoteLargePage(): %#" B_PRIxADDR "\n",
+		(addr_t)index * kLargePageSize);
+}
@@ -6,6 +6,7 @@
 #define KERNEL_ARCH_X86_PAGING_32_BIT_X86_VM_TRANSLATION_MAP_32_BIT_H
 
 
+#include "paging/32bit/paging.h"
 #include "paging/X86VMTranslationMap.h"
 
 
@@ -56,12 +57,24 @@ struct X86VMTranslationMap32Bit : X86VMTranslationMap {
 									bool unmapIfUnaccessed,
 									bool& _modified);
 
+	virtual	size_t				LargePageSize() const;
+	virtual	void				Promote(addr_t base, size_t size);
+
 	virtual	X86PagingStructures* PagingStructures() const;
 	inline	X86PagingStructures32Bit* PagingStructures32Bit() const
 									{ return fPagingStructures; }
 
+private:
+			bool				_PromotePageTable(uint32 index);
+			void				_DemoteLargePage(uint32 index);
+	inline	void				_DemoteIfLargePage(uint32 index);
+
 private:
 			X86PagingStructures32Bit* fPagingStructures;
+			page_directory_entry* fLargePageTables;
+				// original page directory entries of the page tables that
+				// have been replaced by large pages, indexed like the page
+				// directory
 };
 
 
@@ -27,13 +27,16 @@
 #define X86_PDE_WRITE_THROUGH		0x00000008
 #define X86_PDE_CACHING_DISABLED	0x00000010
 #define X86_PDE_ACCESSED			0x00000020
-#define X86_PDE_IGNORED1			0x00000040
-#define X86_PDE_RESERVED1			0x00000080
-#define X86_PDE_IGNORED2			0x00000100
+#define X86_PDE_DIRTY				0x00000040
+	// large pages only
+#define X86_PDE_LARGE_PAGE			0x00000080
+#define X86_PDE_GLOBAL				0x00000100
+	// large pages only
 #define X86_PDE_IGNORED3			0x00000200
 #define X86_PDE_IGNORED4			0x00000400
 #define X86_PDE_IGNORED5			0x00000800
 #define X86_PDE_ADDRESS_MASK		0xfffff000
+#define X86_PDE_LARGE_ADDRESS_MASK	0xffc00000
 
 // page table entry bits
 #define X86_PTE_PRESENT				0x00000001
@@ -61,6 +64,7 @@
 
 
 static const size_t kPageTableAlignment = 1024 * B_PAGE_SIZE;
+static const size_t kLargePageSize = kPageTableAlignment;
 
 
 typedef uint32 page_table_entry;
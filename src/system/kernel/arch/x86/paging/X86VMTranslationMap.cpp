@@ -24,6 +24,9 @@
 #endif
 
 
+x86_large_page_stats gX86LargePageStats;
+
+
 X86VMTranslationMap::X86VMTranslationMap()
 	:
 	fPageMapper(NULL),
@@ -145,3 +148,18 @@ X86VMTranslationMap::Flush()
 
 	thread_unpin_from_current_cpu(thread);
 }
+
+
+// #pragma mark -
+
+
+int
+dump_large_page_stats(int argc, char** argv)
+{
+	kprintf("large pages in use: %" B_PRId32 "\n", gX86LargePageStats.in_use);
+	kprintf("promotions:         %" B_PRId32 "\n",
+		gX86LargePageStats.promotions);
+	kprintf("demotions:          %" B_PRId32 "\n",
+		gX86LargePageStats.demotions);
+	return 0;
+}
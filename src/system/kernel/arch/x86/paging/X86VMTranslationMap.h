@@ -16,6 +16,15 @@ struct X86PagingStructures;
 class TranslationMapPhysicalPageMapper;
 
 
+struct x86_large_page_stats {
+	int32	in_use;
+	int32	promotions;
+	int32	demotions;
+};
+
+extern x86_large_page_stats gX86LargePageStats;
+
+
 struct X86VMTranslationMap : VMTranslationMap {
 								X86VMTranslationMap();
 	virtual						~X86VMTranslationMap();
@@ -32,6 +41,7 @@ struct X86VMTranslationMap : VMTranslationMap {
 	virtual	X86PagingStructures* PagingStructures() const = 0;
 
 	inline	void				InvalidatePage(addr_t address);
+	inline	void				InvalidateAllPages();
 
 protected:
 			TranslationMapPhysicalPageMapper* fPageMapper;
@@ -51,4 +61,18 @@ X86VMTranslationMap::InvalidatePage(addr_t address)
 }
 
 
+/*!	Makes the next Flush() invalidate the complete TLB. Used when the page size
+	of a mapping changes, since the stale entries could be of either size.
+*/
+void
+X86VMTranslationMap::InvalidateAllPages()
+{
+	if (fInvalidPagesCount <= PAGE_INVALIDATE_CACHE_SIZE)
+		fInvalidPagesCount = PAGE_INVALIDATE_CACHE_SIZE + 1;
+}
+
+
+int dump_large_page_stats(int argc, char** argv);
+
+
 #endif	// KERNEL_ARCH_X86_X86_VM_TRANSLATION_MAP_H
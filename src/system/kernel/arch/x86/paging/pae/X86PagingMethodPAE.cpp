@@ -718,7 +718,11 @@ X86PagingMethodPAE::IsKernelPageAccessible(addr_t virtualAddress,
 
 	// map the page table and get the entry
 	pae_page_table_entry pageTableEntry = 0;
-	if ((pageDirEntry & X86_PAE_PDE_PRESENT) != 0) {
+	if ((pageDirEntry & X86_PAE_PDE_LARGE_PAGE) != 0) {
+		// the present and writable flags are where they are for page table
+		// entries
+		pageTableEntry = pageDirEntry;
+	} else if ((pageDirEntry & X86_PAE_PDE_PRESENT) != 0) {
 		void* handle;
 		addr_t virtualPageTable;
 		status_t error = fPhysicalPageMapper->GetPageDebug(
@@ -10,6 +10,10 @@
 
 #include "paging/pae/X86VMTranslationMapPAE.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <heap.h>
 #include <int.h>
 #include <slab/Slab.h>
 #include <thread.h>
@@ -34,9 +38,29 @@
 #if B_HAIKU_PHYSICAL_BITS == 64
 
 
+void
+X86VMTranslationMapPAE::_DemoteIfLargePage(
+	pae_page_directory_entry* pageDirEntry, addr_t address)
+{
+	if ((*pageDirEntry & X86_PAE_PDE_LARGE_PAGE) != 0)
+		_DemoteLargePage(pageDirEntry, address);
+}
+
+
+/*static*/ uint32
+X86VMTranslationMapPAE::_LargePageTableIndex(addr_t address)
+{
+	return address / kPAEPageTableRange % (2 * kPAEPageDirEntryCount);
+}
+
+
+// #pragma mark -
+
+
 X86VMTranslationMapPAE::X86VMTranslationMapPAE()
 	:
-	fPagingStructures(NULL)
+	fPagingStructures(NULL),
+	fLargePageTables(NULL)
 {
 }
 
@@ -61,8 +85,14 @@ X86VMTranslationMapPAE::~X86VMTranslationMapPAE()
 			continue;
 
 		for (uint32 i = 0; i < kPAEPageDirEntryCount; i++) {
-			if ((pageDir[i] & X86_PAE_PDE_PRESENT) != 0) {
-				phys_addr_t address = pageDir[i] & X86_PAE_PDE_ADDRESS_MASK;
+			pae_page_directory_entry entry = pageDir[i];
+			if ((entry & X86_PAE_PDE_LARGE_PAGE) != 0) {
+				entry = fLargePageTables[k * kPAEPageDirEntryCount + i];
+				atomic_add(&gX86LargePageStats.in_use, -1);
+			}
+
+			if ((entry & X86_PAE_PDE_PRESENT) != 0) {
+				phys_addr_t address = entry & X86_PAE_PDE_ADDRESS_MASK;
 				vm_page* page = vm_lookup_page(address / B_PAGE_SIZE);
 				if (page == NULL)
 					panic("X86VMTranslationMapPAE::~X86VMTranslationMapPAE: "
@@ -76,6 +106,8 @@ X86VMTranslationMapPAE::~X86VMTranslationMapPAE()
 		}
 	}
 
+	free(fLargePageTables);
+
 	fPagingStructures->RemoveReference();
 }
 
@@ -214,7 +246,8 @@ X86VMTranslationMapPAE::Map(addr_t virtualAddress, phys_addr_t physicalAddress,
 						? B_WRITE_AREA : B_KERNEL_WRITE_AREA));
 
 		fMapCount++;
-	}
+	} else
+		_DemoteIfLargePage(pageDirEntry, virtualAddress);
 
 	// now, fill in the page table entry
 	Thread* thread = thread_get_current_thread();
@@ -265,6 +298,8 @@ X86VMTranslationMapPAE::Unmap(addr_t start, addr_t end)
 			continue;
 		}
 
+		_DemoteIfLargePage(pageDirEntry, start);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -320,6 +355,8 @@ X86VMTranslationMapPAE::DebugMarkRangePresent(addr_t start, addr_t end,
 			continue;
 		}
 
+		_DemoteIfLargePage(pageDirEntry, start);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -379,6 +416,8 @@ X86VMTranslationMapPAE::UnmapPage(VMArea* area, addr_t address,
 	if ((*pageDirEntry & X86_PAE_PDE_PRESENT) == 0)
 		return B_ENTRY_NOT_FOUND;
 
+	_DemoteIfLargePage(pageDirEntry, address);
+
 	ThreadCPUPinner pinner(thread_get_current_thread());
 
 	pae_page_table_entry* pageTable
@@ -456,6 +495,8 @@ X86VMTranslationMapPAE::UnmapPages(VMArea* area, addr_t base, size_t size,
 			continue;
 		}
 
+		_DemoteIfLargePage(pageDirEntry, start);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -593,6 +634,8 @@ X86VMTranslationMapPAE::UnmapArea(VMArea* area, bool deletingAddressSpace,
 				continue;
 			}
 
+			_DemoteIfLargePage(pageDirEntry, address);
+
 			ThreadCPUPinner pinner(thread_get_current_thread());
 
 			pae_page_table_entry* pageTable
@@ -665,22 +708,30 @@ X86VMTranslationMapPAE::Query(addr_t virtualAddress,
 	pae_page_directory_entry* pageDirEntry
 		= X86PagingMethodPAE::PageDirEntryForAddress(
 			fPagingStructures->VirtualPageDirs(), virtualAddress);
-	if ((*pageDirEntry & X86_PAE_PDE_PRESENT) == 0) {
+	pae_page_directory_entry pageDirEntryValue = *pageDirEntry;
+	if ((pageDirEntryValue & X86_PAE_PDE_PRESENT) == 0) {
 		// no pagetable here
 		return B_OK;
 	}
 
-	// get the page table entry
-	Thread* thread = thread_get_current_thread();
-	ThreadCPUPinner pinner(thread);
-
-	pae_page_table_entry* pageTable
-		= (pae_page_table_entry*)fPageMapper->GetPageTableAt(
-			*pageDirEntry & X86_PAE_PDE_ADDRESS_MASK);
-	pae_page_table_entry entry
-		= pageTable[virtualAddress / B_PAGE_SIZE % kPAEPageTableEntryCount];
+	pae_page_table_entry entry;
+	if ((pageDirEntryValue & X86_PAE_PDE_LARGE_PAGE) != 0) {
+		// The large page's flags are compatible with the page table entry
+		// flags we're interested in.
+		entry = ((pageDirEntryValue & X86_PAE_PDE_LARGE_ADDRESS_MASK)
+				+ (virtualAddress % kPAELargePageSize & X86_PAE_PTE_ADDRESS_MASK))
+			| (pageDirEntryValue & ~X86_PAE_PDE_ADDRESS_MASK);
+	} else {
+		// get the page table entry
+		Thread* thread = thread_get_current_thread();
+		ThreadCPUPinner pinner(thread);
 
-	pinner.Unlock();
+		pae_page_table_entry* pageTable
+			= (pae_page_table_entry*)fPageMapper->GetPageTableAt(
+				pageDirEntryValue & X86_PAE_PDE_ADDRESS_MASK);
+		entry = pageTable[
+			virtualAddress / B_PAGE_SIZE % kPAEPageTableEntryCount];
+	}
 
 	*_physicalAddress = entry & X86_PAE_PTE_ADDRESS_MASK;
 
@@ -715,18 +766,26 @@ X86VMTranslationMapPAE::QueryInterrupt(addr_t virtualAddress,
 	pae_page_directory_entry* pageDirEntry
 		= X86PagingMethodPAE::PageDirEntryForAddress(
 			fPagingStructures->VirtualPageDirs(), virtualAddress);
-	if ((*pageDirEntry & X86_PAE_PDE_PRESENT) == 0) {
+	pae_page_directory_entry pageDirEntryValue = *pageDirEntry;
+	if ((pageDirEntryValue & X86_PAE_PDE_PRESENT) == 0) {
 		// no pagetable here
 		return B_OK;
 	}
 
-	// get the page table entry
-	pae_page_table_entry* pageTable
-		= (pae_page_table_entry*)X86PagingMethodPAE::Method()
-			->PhysicalPageMapper()->InterruptGetPageTableAt(
-				*pageDirEntry & X86_PAE_PDE_ADDRESS_MASK);
-	pae_page_table_entry entry
-		= pageTable[virtualAddress / B_PAGE_SIZE % kPAEPageTableEntryCount];
+	pae_page_table_entry entry;
+	if ((pageDirEntryValue & X86_PAE_PDE_LARGE_PAGE) != 0) {
+		entry = ((pageDirEntryValue & X86_PAE_PDE_LARGE_ADDRESS_MASK)
+				+ (virtualAddress % kPAELargePageSize & X86_PAE_PTE_ADDRESS_MASK))
+			| (pageDirEntryValue & ~X86_PAE_PDE_ADDRESS_MASK);
+	} else {
+		// get the page table entry
+		pae_page_table_entry* pageTable
+			= (pae_page_table_entry*)X86PagingMethodPAE::Method()
+				->PhysicalPageMapper()->InterruptGetPageTableAt(
+					pageDirEntryValue & X86_PAE_PDE_ADDRESS_MASK);
+		entry = pageTable[
+			virtualAddress / B_PAGE_SIZE % kPAEPageTableEntryCount];
+	}
 
 	*_physicalAddress = entry & X86_PAE_PTE_ADDRESS_MASK;
 
@@ -780,6 +839,8 @@ X86VMTranslationMapPAE::Protect(addr_t start, addr_t end, uint32 attributes,
 			continue;
 		}
 
+		_DemoteIfLargePage(pageDirEntry, start);
+
 		Thread* thread = thread_get_current_thread();
 		ThreadCPUPinner pinner(thread);
 
@@ -840,6 +901,8 @@ X86VMTranslationMapPAE::ClearFlags(addr_t address, uint32 flags)
 		return B_OK;
 	}
 
+	_DemoteIfLargePage(pageDirEntry, address);
+
 	uint64 flagsToClear = ((flags & PAGE_MODIFIED) ? X86_PAE_PTE_DIRTY : 0)
 		| ((flags & PAGE_ACCESSED) ? X86_PAE_PTE_ACCESSED : 0);
 
@@ -882,6 +945,8 @@ X86VMTranslationMapPAE::ClearAccessedAndModified(VMArea* area, addr_t address,
 	if ((*pageDirEntry & X86_PAE_PDE_PRESENT) == 0)
 		return false;
 
+	_DemoteIfLargePage(pageDirEntry, address);
+
 	ThreadCPUPinner pinner(thread_get_current_thread());
 
 	pae_page_table_entry* entry
@@ -951,6 +1016,24 @@ X86VMTranslationMapPAE::ClearAccessedAndModified(VMArea* area, addr_t address,
 }
 
 
+size_t
+X86VMTranslationMapPAE::LargePageSize() const
+{
+	return kPAELargePageSize;
+}
+
+
+void
+X86VMTranslationMapPAE::Promote(addr_t base, size_t size)
+{
+	addr_t address = ROUNDUP(base, kPAELargePageSize);
+	while (address >= base && address - base + kPAELargePageSize <= size) {
+		_PromotePageTable(address);
+		address += kPAELargePageSize;
+	}
+}
+
+
 X86PagingStructures*
 X86VMTranslationMapPAE::PagingStructures() const
 {
@@ -958,4 +1041,124 @@ X86VMTranslationMapPAE::PagingStructures() const
 }
 
 
+/*!	Replaces the page directory entry for \a address by a large page mapping,
+	if the page table it refers to maps a physically contiguous, large page
+	aligned range with uniform attributes. The page table itself is kept, so
+	the large page can be demoted again without having to allocate memory.
+	The map must be locked.
+*/
+bool
+X86VMTranslationMapPAE::_PromotePageTable(addr_t address)
+{
+	pae_page_directory_entry* pageDirEntry
+		= X86PagingMethodPAE::PageDirEntryForAddress(
+			fPagingStructures->VirtualPageDirs(), address);
+	pae_page_directory_entry pageDirEntryValue = *pageDirEntry;
+	if ((pageDirEntryValue & X86_PAE_PDE_PRESENT) == 0
+		|| (pageDirEntryValue & X86_PAE_PDE_LARGE_PAGE) != 0) {
+		return false;
+	}
+
+	const pae_page_table_entry kAttributeMask = X86_PAE_PTE_PRESENT
+		| X86_PAE_PTE_PROTECTION_MASK | X86_PAE_PTE_MEMORY_TYPE_MASK
+		| X86_PAE_PTE_PAT | X86_PAE_PTE_GLOBAL | X86_PAE_PTE_NOT_EXECUTABLE;
+
+	Thread* thread = thread_get_current_thread();
+	ThreadCPUPinner pinner(thread);
+
+	pae_page_table_entry* pageTable
+		= (pae_page_table_entry*)fPageMapper->GetPageTableAt(
+			pageDirEntryValue & X86_PAE_PDE_ADDRESS_MASK);
+
+	pae_page_table_entry firstEntry = pageTable[0];
+	pae_page_table_entry attributes = firstEntry & kAttributeMask;
+	phys_addr_t physicalBase = firstEntry & X86_PAE_PTE_ADDRESS_MASK;
+	if ((firstEntry & X86_PAE_PTE_PRESENT) == 0
+		|| (firstEntry & X86_PAE_PTE_PAT) != 0
+		|| physicalBase % kPAELargePageSize != 0) {
+		return false;
+	}
+
+	for (uint32 i = 1; i < kPAEPageTableEntryCount; i++) {
+		if ((pageTable[i] & (X86_PAE_PTE_ADDRESS_MASK | kAttributeMask))
+				!= ((physicalBase + i * B_PAGE_SIZE) | attributes)) {
+			return false;
+		}
+	}
+
+	pinner.Unlock();
+
+	if (!x86_has_uniform_memory_type(physicalBase, kPAELargePageSize))
+		return false;
+
+	size_t tableSize
+		= 2 * kPAEPageDirEntryCount * sizeof(pae_page_directory_entry);
+	if (fLargePageTables == NULL) {
+		fLargePageTables = (pae_page_directory_entry*)malloc_etc(tableSize,
+			HEAP_DONT_WAIT_FOR_MEMORY
+				| (fIsKernelMap ? HEAP_DONT_LOCK_KERNEL_SPACE : 0));
+		if (fLargePageTables == NULL)
+			return false;
+		memset(fLargePageTables, 0, tableSize);
+	}
+
+	// The protection, memory type, global, and NX flags are at the same
+	// positions in page directory and page table entries. Since the kernel
+	// page directories are shared by all address spaces, there are no copies
+	// to update.
+	fLargePageTables[_LargePageTableIndex(address)] = pageDirEntryValue;
+	X86PagingMethodPAE::SetPageTableEntry(pageDirEntry,
+		physicalBase | attributes | X86_PAE_PDE_LARGE_PAGE);
+
+	InvalidateAllPages();
+
+	atomic_add(&gX86LargePageStats.in_use, 1);
+	atomic_add(&gX86LargePageStats.promotions, 1);
+
+	TRACE("X86VMTranslationMapPAE::_PromotePageTable(): %#" B_PRIxADDR " -> %#"
+		B_PRIxPHYSADDR "\n", ROUNDDOWN(address, kPAELargePageSize),
+		physicalBase);
+
+	return true;
+}
+
+
+/*!	Replaces the large page mapping at \a pageDirEntry by the page table it
+	has been promoted from. The page table entries inherit the large page's
+	accessed and dirty flags.
+	The map must be locked.
+*/
+void
+X86VMTranslationMapPAE::_DemoteLargePage(pae_page_directory_entry* pageDirEntry,
+	addr_t address)
+{
+	uint32 index = _LargePageTableIndex(address);
+	pae_page_directory_entry pageDirEntryValue = fLargePageTables[index];
+	fLargePageTables[index] = 0;
+
+	pae_page_directory_entry oldEntry = X86PagingMethodPAE::SetPageTableEntry(
+		pageDirEntry, pageDirEntryValue);
+
+	uint64 flags = oldEntry & (X86_PAE_PTE_ACCESSED | X86_PAE_PTE_DIRTY);
+	if (flags != 0) {
+		Thread* thread = thread_get_current_thread();
+		ThreadCPUPinner pinner(thread);
+
+		pae_page_table_entry* pageTable
+			= (pae_page_table_entry*)fPageMapper->GetPageTableAt(
+				pageDirEntryValue & X86_PAE_PDE_ADDRESS_MASK);
+		for (uint32 i = 0; i < kPAEPageTableEntryCount; i++)
+			X86PagingMethodPAE::SetPageTableEntryFlags(&pageTable[i], flags);
+	}
+
+	InvalidateAllPages();
+
+	atomic_add(&gX86LargePageStats.in_use, -1);
+	atomic_add(&gX86LargePageStats.demotions, 1);
+
+	TRACE("X86VMTranslationMapPAE::_DemoteLargePage(): %#" B_PRIxADDR "\n",
+		ROUNDDOWN(address, kPAELargePageSize));
+}
+
+
 #endif	// B_HAIKU_PHYSICAL_BITS == 64
@@ -6,6 +6,7 @@
 #define KERNEL_ARCH_X86_PAGING_PAE_X86_VM_TRANSLATION_MAP_PAE_H
 
 
+#include "paging/pae/paging.h"
 #include "paging/X86VMTranslationMap.h"
 
 
@@ -59,12 +60,30 @@ struct X86VMTranslationMapPAE : X86VMTranslationMap {
 									bool unmapIfUnaccessed,
 									bool& _modified);
 
+	virtual	size_t				LargePageSize() const;
+	virtual	void				Promote(addr_t base, size_t size);
+
 	virtual	X86PagingStructures* PagingStructures() const;
 	inline	X86PagingStructuresPAE* PagingStructuresPAE() const
 									{ return fPagingStructures; }
 
+private:
+			bool				_PromotePageTable(addr_t address);
+			void				_DemoteLargePage(
+									pae_page_directory_entry* pageDirEntry,
+									addr_t address);
+	inline	void				_DemoteIfLargePage(
+									pae_page_directory_entry* pageDirEntry,
+									addr_t address);
+
+	static	uint32				_LargePageTableIndex(addr_t address);
+
 private:
 			X86PagingStructuresPAE* fPagingStructures;
+			pae_page_directory_entry* fLargePageTables;
+				// original page directory entries of the page tables that
+				// have been replaced by large pages, indexed by
+				// _LargePageTableIndex()
 };
 
 
@@ -25,13 +25,16 @@
 #define X86_PAE_PDE_WRITE_THROUGH		0x0000000000000008LL
 #define X86_PAE_PDE_CACHING_DISABLED	0x0000000000000010LL
 #define X86_PAE_PDE_ACCESSED			0x0000000000000020LL
-#define X86_PAE_PDE_IGNORED1			0x0000000000000040LL
+#define X86_PAE_PDE_DIRTY				0x0000000000000040LL
+	// large pages only
 #define X86_PAE_PDE_LARGE_PAGE			0x0000000000000080LL
-#define X86_PAE_PDE_IGNORED2			0x0000000000000100LL
+#define X86_PAE_PDE_GLOBAL				0x0000000000000100LL
+	// large pages only
 #define X86_PAE_PDE_IGNORED3			0x0000000000000200LL
 #define X86_PAE_PDE_IGNORED4			0x0000000000000400LL
 #define X86_PAE_PDE_IGNORED5			0x0000000000000800LL
 #define X86_PAE_PDE_ADDRESS_MASK		0x000ffffffffff000LL
+#define X86_PAE_PDE_LARGE_ADDRESS_MASK	0x000fffffffe00000LL
 #define X86_PAE_PDE_NOT_EXECUTABLE		0x8000000000000000LL
 
 // page table entry bits
@@ -60,6 +63,7 @@ static const uint32 kPAEPageTableEntryCount = 512;
 static const size_t kPAEPageTableRange = kPAEPageTableEntryCount * B_PAGE_SIZE;
 static const size_t kPAEPageDirRange
 	= kPAEPageDirEntryCount * kPAEPageTableRange;
+static const size_t kPAELargePageSize = kPAEPageTableRange;
 
 
 typedef uint64 pae_page_directory_pointer_table_entry;
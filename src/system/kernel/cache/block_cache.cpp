@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include <KernelExport.h>
 #include <fs_cache.h>
@@ -18,6 +19,7 @@
 #include <lock.h>
 #include <low_resource_manager.h>
 #include <slab/Slab.h>
+#include <smp.h>
 #include <tracing.h>
 #include <util/kernel_cpp.h>
 #include <util/DoublyLinkedList.h>
@@ -28,9 +30,8 @@
 #include "kernel_debug_config.h"
 
 
-// TODO: this is a naive but growing implementation to test the API:
-//	block reading/writing is not at all optimized for speed, it will
-//	just read and write single blocks.
+// TODO: block reading is not at all optimized for speed, it will just read
+//	single blocks.
 // TODO: the retrieval/copy of the original data could be delayed until the
 //		new data must be written, ie. in low memory situations.
 
@@ -48,6 +49,20 @@
 static const bigtime_t kTransactionIdleTime = 2000000LL;
 	// a transaction is considered idle after 2 seconds of inactivity
 
+static const uint32 kBlockTableStripes = 16;
+	// the number of independently locked parts of a cache's block hash
+static const size_t kMaxWriteVecs = 32;
+	// the maximum number of blocks BlockWriter writes with a single request
+static const size_t kMaxReadVecs = 32;
+	// the maximum number of blocks block_cache_prefetch() reads at once
+static const int32 kMaxUnusedWriteBack = 64;
+	// the maximum number of dirty unused blocks written back to recycle them
+
+// Blocks that are already in the cache can be acquired and released without
+// locking the cache, unless we need to be able to track those accesses.
+#define BLOCK_CACHE_LOCKLESS_ACCESS \
+	(!BLOCK_CACHE_DEBUG_CHANGED && !BLOCK_CACHE_BLOCK_TRACING)
+
 
 struct cache_transaction;
 struct cached_block;
@@ -77,14 +92,18 @@ struct cached_block {
 	void*			compare;
 #endif
 	int32			ref_count;
+		// Changed atomically only, as the lockless block_cache_get_etc(), and
+		// block_cache_put() don't hold the cache's lock.
 	int32			last_accessed;
+	int32			unused_list;
+		// The index of the per-CPU unused list the block is in, or -1. Only
+		// changed with the lock of that list held.
 	bool			busy_reading : 1;
 	bool			busy_writing : 1;
 	bool			is_writing : 1;
 		// Block has been checked out for writing without transactions, and
 		// cannot be written back if set
 	bool			is_dirty : 1;
-	bool			unused : 1;
 	bool			discard : 1;
 	bool			busy_reading_waiters : 1;
 	bool			busy_writing_waiters : 1;
@@ -92,6 +111,8 @@ struct cached_block {
 	cache_transaction* previous_transaction;
 
 	bool CanBeWritten() const;
+	bool IsUnused() const
+		{ return unused_list >= 0; }
 	int32 LastAccess() const
 		{ return system_time() / 1000000L - last_accessed; }
 
@@ -114,8 +135,74 @@ struct cache_notification : DoublyLinkedListLinkImpl<cache_notification> {
 
 typedef DoublyLinkedList<cache_notification> NotificationList;
 
+/*!	The hash of all blocks of a cache, split into stripes by block number.
+	Changes require the cache's lock, and the write lock of the stripe in
+	question; lookups only need either of them. The stripe locks only exist for
+	the lockless block_cache_get_etc(), and block_cache_put() paths, so that
+	those don't serialize on a single lock.
+*/
+class BlockTable {
+public:
+								BlockTable();
+								~BlockTable();
+
+			status_t			Init();
+
+			rw_lock*			StripeLock(off_t blockNumber)
+									{ return &_StripeFor(blockNumber).lock; }
+
+			cached_block*		Lookup(off_t blockNumber);
+			status_t			Insert(cached_block* block);
+			void				Remove(cached_block* block);
+			cached_block*		RemoveFirst(uint32& stripe, uint32& cookie);
+
+			class Iterator;
+
+private:
+			struct table_stripe {
+				rw_lock			lock;
+				hash_table*		hash;
+			};
+
+			table_stripe&		_StripeFor(off_t blockNumber)
+									{ return fStripes[(uint32)blockNumber
+										% kBlockTableStripes]; }
+
+private:
+			table_stripe		fStripes[kBlockTableStripes];
+};
+
+/*!	Iterates over all blocks of a BlockTable. The cache must stay locked
+	while the iterator is in use.
+*/
+class BlockTable::Iterator {
+public:
+								Iterator(BlockTable& table);
+								~Iterator();
+
+			cached_block*		Next();
+
+private:
+			BlockTable&			fTable;
+			uint32				fStripe;
+			hash_iterator		fIterator;
+};
+
+/*!	The per-CPU part of a block cache: the unused blocks that were released
+	on that CPU, ordered by last access, and the statistics of the lockless
+	block accesses.
+*/
+struct block_cache_cpu {
+	mutex			lock;
+	block_list		unused_blocks;
+	uint32			unused_block_count;
+
+	int64			lockless_gets;
+	int64			lockless_puts;
+};
+
 struct block_cache : DoublyLinkedListLinkImpl<block_cache> {
-	hash_table*		hash;
+	BlockTable		table;
 	mutex			lock;
 	int				fd;
 	off_t			max_blocks;
@@ -125,8 +212,8 @@ struct block_cache : DoublyLinkedListLinkImpl<block_cache> {
 	hash_table*		transaction_hash;
 
 	object_cache*	buffer_cache;
-	block_list		unused_blocks;
-	uint32			unused_block_count;
+	block_cache_cpu	cpus[B_MAX_CPU_COUNT];
+	int32			cpu_count;
 
 	ConditionVariable busy_reading_condition;
 	uint32			busy_reading_count;
@@ -139,6 +226,11 @@ struct block_cache : DoublyLinkedListLinkImpl<block_cache> {
 	uint32			num_dirty_blocks;
 	bool			read_only;
 
+	// statistics, protected by the cache's lock
+	int64			read_count;
+	int64			write_count;
+	int64			written_blocks;
+
 	NotificationList pending_notifications;
 	ConditionVariable condition_variable;
 
@@ -154,13 +246,23 @@ struct block_cache : DoublyLinkedListLinkImpl<block_cache> {
 	void			RemoveBlock(cached_block* block);
 	void			DiscardBlock(cached_block* block);
 	void			FreeBlock(cached_block* block);
-	cached_block*	NewBlock(off_t blockNumber);
+	cached_block*	NewBlock(off_t blockNumber, bool* _writeBack = NULL);
+	void			WriteUnusedBlocks();
 
+	void			AddUnused(cached_block* block);
+	bool			RemoveUnused(cached_block* block,
+						bool acquireReference = false);
+	uint32			UnusedBlockCount() const;
+	block_cache_cpu& CurrentCPU();
 
 private:
 	static void		_LowMemoryHandler(void* data, uint32 resources,
 						int32 level);
 	cached_block*	_GetUnusedBlock();
+	int32			_TakeUnusedBlocks(block_cache_cpu& cpu,
+						block_list& blocks, int32 count,
+						int32 minSecondsOld);
+	void			_WriteUnusedBlocks(int32 count, int32 minSecondsOld);
 };
 
 struct cache_listener;
@@ -216,7 +318,9 @@ public:
 
 private:
 			void*				_Data(cached_block* block) const;
-			status_t			_WriteBlock(cached_block* block);
+			size_t				_RunLength(size_t index) const;
+			status_t			_WriteBlocks(cached_block** blocks,
+									size_t count);
 			void				_BlockDone(cached_block* block,
 									hash_iterator* iterator);
 			void				_UnmarkWriting(cached_block* block);
@@ -1016,10 +1120,136 @@ cached_block::Hash(void* _cacheEntry, const void* _block, uint32 range)
 	cached_block* cacheEntry = (cached_block*)_cacheEntry;
 	const off_t* block = (const off_t*)_block;
 
+	// The lower bits select the stripe of the BlockTable already
 	if (cacheEntry != NULL)
-		return cacheEntry->block_number % range;
+		return (uint64)cacheEntry->block_number / kBlockTableStripes % range;
 
-	return (uint64)*block % range;
+	return (uint64)*block / kBlockTableStripes % range;
+}
+
+
+//	#pragma mark - BlockTable
+
+
+BlockTable::BlockTable()
+{
+	for (uint32 i = 0; i < kBlockTableStripes; i++) {
+		rw_lock_init(&fStripes[i].lock, "block cache stripe");
+		fStripes[i].hash = NULL;
+	}
+}
+
+
+BlockTable::~BlockTable()
+{
+	for (uint32 i = 0; i < kBlockTableStripes; i++) {
+		if (fStripes[i].hash != NULL)
+			hash_uninit(fStripes[i].hash);
+		rw_lock_destroy(&fStripes[i].lock);
+	}
+}
+
+
+status_t
+BlockTable::Init()
+{
+	cached_block dummyBlock;
+
+	for (uint32 i = 0; i < kBlockTableStripes; i++) {
+		fStripes[i].hash = hash_init(1024 / kBlockTableStripes,
+			offset_of_member(dummyBlock, next), &cached_block::Compare,
+			&cached_block::Hash);
+		if (fStripes[i].hash == NULL)
+			return B_NO_MEMORY;
+	}
+
+	return B_OK;
+}
+
+
+/*!	Either the cache's lock, or the read lock of the block's stripe must be
+	held.
+*/
+cached_block*
+BlockTable::Lookup(off_t blockNumber)
+{
+	return (cached_block*)hash_lookup(_StripeFor(blockNumber).hash,
+		&blockNumber);
+}
+
+
+/*!	The cache's lock must be held. */
+status_t
+BlockTable::Insert(cached_block* block)
+{
+	table_stripe& stripe = _StripeFor(block->block_number);
+
+	WriteLocker locker(stripe.lock);
+	return hash_insert_grow(stripe.hash, block);
+}
+
+
+/*!	The cache's lock must be held. Once this method returns, no lockless
+	accessor can see the \a block anymore.
+*/
+void
+BlockTable::Remove(cached_block* block)
+{
+	table_stripe& stripe = _StripeFor(block->block_number);
+
+	WriteLocker locker(stripe.lock);
+	hash_remove(stripe.hash, block);
+}
+
+
+/*!	Removes the blocks one by one; \a stripe and \a cookie must be initialized
+	to zero. Only to be used when the cache is deleted.
+*/
+cached_block*
+BlockTable::RemoveFirst(uint32& stripe, uint32& cookie)
+{
+	for (; stripe < kBlockTableStripes; stripe++, cookie = 0) {
+		cached_block* block = (cached_block*)hash_remove_first(
+			fStripes[stripe].hash, &cookie);
+		if (block != NULL)
+			return block;
+	}
+
+	return NULL;
+}
+
+
+BlockTable::Iterator::Iterator(BlockTable& table)
+	:
+	fTable(table),
+	fStripe(0)
+{
+	hash_open(fTable.fStripes[0].hash, &fIterator);
+}
+
+
+BlockTable::Iterator::~Iterator()
+{
+	if (fStripe < kBlockTableStripes)
+		hash_close(fTable.fStripes[fStripe].hash, &fIterator, false);
+}
+
+
+cached_block*
+BlockTable::Iterator::Next()
+{
+	while (fStripe < kBlockTableStripes) {
+		cached_block* block = (cached_block*)hash_next(
+			fTable.fStripes[fStripe].hash, &fIterator);
+		if (block != NULL)
+			return block;
+
+		hash_close(fTable.fStripes[fStripe].hash, &fIterator, false);
+		if (++fStripe < kBlockTableStripes)
+			hash_open(fTable.fStripes[fStripe].hash, &fIterator);
+	}
+
+	return NULL;
 }
 
 
@@ -1146,22 +1376,38 @@ BlockWriter::Write(hash_iterator* iterator, bool canUnlock)
 	qsort(fBlocks, fCount, sizeof(void*), &compare_blocks);
 	fDeletedTransaction = false;
 
-	for (uint32 i = 0; i < fCount; i++) {
-		status_t status = _WriteBlock(fBlocks[i]);
+	// Write runs of consecutive blocks with a single request each
+
+	int64 requests = 0;
+	int64 written = 0;
+
+	for (size_t i = 0; i < fCount;) {
+		size_t count = _RunLength(i);
+
+		status_t status = _WriteBlocks(fBlocks + i, count);
 		if (status != B_OK) {
 			// propagate to global error handling
 			if (fStatus == B_OK)
 				fStatus = status;
 
-			_UnmarkWriting(fBlocks[i]);
-			fBlocks[i] = NULL;
-				// This block will not be marked clean
-		}
+			for (size_t j = i; j < i + count; j++) {
+				_UnmarkWriting(fBlocks[j]);
+				fBlocks[j] = NULL;
+					// This block will not be marked clean
+			}
+		} else
+			written += count;
+
+		requests++;
+		i += count;
 	}
 
 	if (canUnlock)
 		mutex_lock(&fCache->lock);
 
+	fCache->write_count += requests;
+	fCache->written_blocks += written;
+
 	for (uint32 i = 0; i < fCount; i++)
 		_BlockDone(fBlocks[i], iterator);
 
@@ -1195,23 +1441,52 @@ BlockWriter::_Data(cached_block* block) const
 }
 
 
-status_t
-BlockWriter::_WriteBlock(cached_block* block)
+/*!	Returns the number of blocks starting at \a index in the (sorted) array
+	that are consecutive on disk, and can be written with a single request.
+*/
+size_t
+BlockWriter::_RunLength(size_t index) const
 {
-	ASSERT(block->busy_writing);
+	size_t count = 1;
+	while (index + count < fCount && count < kMaxWriteVecs
+		&& fBlocks[index + count]->block_number
+			== fBlocks[index]->block_number + (off_t)count) {
+		count++;
+	}
+
+	return count;
+}
 
-	TRACE(("BlockWriter::_WriteBlock(block %Ld)\n", block->block_number));
-	TB(Write(fCache, block));
-	TB2(BlockData(fCache, block, "before write"));
+
+status_t
+BlockWriter::_WriteBlocks(cached_block** blocks, size_t count)
+{
+	TRACE(("BlockWriter::_WriteBlocks(block %Ld, count %lu)\n",
+		blocks[0]->block_number, count));
 
 	size_t blockSize = fCache->block_size;
+	iovec vecs[kMaxWriteVecs];
+
+	for (size_t i = 0; i < count; i++) {
+		ASSERT(blocks[i]->busy_writing);
+		TB(Write(fCache, blocks[i]));
+		TB2(BlockData(fCache, blocks[i], "before write"));
 
-	ssize_t written = write_pos(fCache->fd,
-		block->block_number * blockSize, _Data(block), blockSize);
+		vecs[i].iov_base = _Data(blocks[i]);
+		vecs[i].iov_len = blockSize;
+	}
+
+	off_t offset = blocks[0]->block_number * blockSize;
+	ssize_t written;
+	if (count == 1)
+		written = write_pos(fCache->fd, offset, vecs[0].iov_base, blockSize);
+	else
+		written = writev_pos(fCache->fd, offset, vecs, count);
 
-	if (written != (ssize_t)blockSize) {
-		TB(Error(fCache, block->block_number, "write failed", written));
-		FATAL(("could not write back block %Ld (%s)\n", block->block_number,
+	if (written != (ssize_t)(count * blockSize)) {
+		TB(Error(fCache, blocks[0]->block_number, "write failed", written));
+		FATAL(("could not write back blocks %Ld - %Ld (%s)\n",
+			blocks[0]->block_number, blocks[0]->block_number + count - 1,
 			strerror(errno)));
 		if (written < 0)
 			return errno;
@@ -1268,11 +1543,9 @@ BlockWriter::_BlockDone(cached_block* block, hash_iterator* iterator)
 			fDeletedTransaction = true;
 		}
 	}
-	if (block->transaction == NULL && block->ref_count == 0) {
-		// the block is no longer used
-		block->unused = true;
-		fCache->unused_blocks.Add(block);
-		fCache->unused_block_count++;
+	if (block->transaction == NULL) {
+		// the block might no longer be used
+		fCache->AddUnused(block);
 	}
 
 	TB2(BlockData(fCache, block, "after write"));
@@ -1302,7 +1575,6 @@ BlockWriter::_UnmarkWriting(cached_block* block)
 block_cache::block_cache(int _fd, off_t numBlocks, size_t blockSize,
 		bool readOnly)
 	:
-	hash(NULL),
 	fd(_fd),
 	max_blocks(numBlocks),
 	block_size(blockSize),
@@ -1310,13 +1582,16 @@ block_cache::block_cache(int _fd, off_t numBlocks, size_t blockSize,
 	last_transaction(NULL),
 	transaction_hash(NULL),
 	buffer_cache(NULL),
-	unused_block_count(0),
+	cpu_count(1),
 	busy_reading_count(0),
 	busy_reading_waiters(false),
 	busy_writing_count(0),
 	busy_writing_waiters(0),
 	num_dirty_blocks(0),
-	read_only(readOnly)
+	read_only(readOnly),
+	read_count(0),
+	write_count(0),
+	written_blocks(0)
 {
 }
 
@@ -1327,10 +1602,11 @@ block_cache::~block_cache()
 	unregister_low_resource_handler(&_LowMemoryHandler, this);
 
 	hash_uninit(transaction_hash);
-	hash_uninit(hash);
 
 	delete_object_cache(buffer_cache);
 
+	for (int32 i = 0; i < B_MAX_CPU_COUNT; i++)
+		mutex_destroy(&cpus[i].lock);
 	mutex_destroy(&lock);
 }
 
@@ -1343,16 +1619,25 @@ block_cache::Init()
 	condition_variable.Init(this, "cache transaction sync");
 	mutex_init(&lock, "block cache");
 
+	for (int32 i = 0; i < B_MAX_CPU_COUNT; i++) {
+		mutex_init(&cpus[i].lock, "block cache unused blocks");
+		cpus[i].unused_block_count = 0;
+		cpus[i].lockless_gets = 0;
+		cpus[i].lockless_puts = 0;
+	}
+
+#ifndef BUILDING_USERLAND_FS_SERVER
+	cpu_count = smp_get_num_cpus();
+#endif
+
 	buffer_cache = create_object_cache_etc("block cache buffers", block_size,
 		8, 0, 0, 0, CACHE_LARGE_SLAB, NULL, NULL, NULL, NULL);
 	if (buffer_cache == NULL)
 		return B_NO_MEMORY;
 
-	cached_block dummyBlock;
-	hash = hash_init(1024, offset_of_member(dummyBlock, next),
-		&cached_block::Compare, &cached_block::Hash);
-	if (hash == NULL)
-		return B_NO_MEMORY;
+	status_t status = table.Init();
+	if (status != B_OK)
+		return status;
 
 	cache_transaction dummyTransaction;
 	transaction_hash = hash_init(16, offset_of_member(dummyTransaction, next),
@@ -1406,17 +1691,29 @@ block_cache::FreeBlock(cached_block* block)
 }
 
 
-/*! Allocates a new block for \a blockNumber, ready for use */
+/*! Allocates a new block for \a blockNumber, ready for use.
+	Since the cache must not be unlocked here, dirty unused blocks cannot be
+	recycled. If there were only those, \a _writeBack is set to \c true, and
+	the caller should call WriteUnusedBlocks() as soon as it can unlock the
+	cache.
+*/
 cached_block*
-block_cache::NewBlock(off_t blockNumber)
+block_cache::NewBlock(off_t blockNumber, bool* _writeBack)
 {
 	cached_block* block = NULL;
+	bool recycle = low_resource_state(B_KERNEL_RESOURCE_PAGES
+		| B_KERNEL_RESOURCE_MEMORY | B_KERNEL_RESOURCE_ADDRESS_SPACE)
+			!= B_NO_LOW_RESOURCE;
 
-	if (low_resource_state(B_KERNEL_RESOURCE_PAGES | B_KERNEL_RESOURCE_MEMORY
-			| B_KERNEL_RESOURCE_ADDRESS_SPACE) != B_NO_LOW_RESOURCE) {
+	if (recycle) {
 		// recycle existing instead of allocating a new one
 		block = _GetUnusedBlock();
 	}
+
+	// Dirty unused blocks can only exist if no transactions are used
+	if (_writeBack != NULL)
+		*_writeBack = block == NULL && recycle && num_dirty_blocks > 0;
+
 	if (block == NULL) {
 		block = (cached_block*)object_cache_alloc(sBlockCache, 0);
 		if (block != NULL) {
@@ -1428,11 +1725,14 @@ block_cache::NewBlock(off_t blockNumber)
 		} else {
 			TB(Error(this, blockNumber, "allocation failed"));
 			dprintf("block allocation failed, unused list is %sempty.\n",
-				unused_blocks.IsEmpty() ? "" : "not ");
+				UnusedBlockCount() == 0 ? "" : "not ");
 
 			// allocation failed, try to reuse an unused block
 			block = _GetUnusedBlock();
 			if (block == NULL) {
+				if (_writeBack != NULL)
+					*_writeBack = num_dirty_blocks > 0;
+
 				TB(Error(this, blockNumber, "get unused failed"));
 				FATAL(("could not allocate block!\n"));
 				return NULL;
@@ -1451,7 +1751,7 @@ block_cache::NewBlock(off_t blockNumber)
 	block->busy_writing = false;
 	block->is_writing = false;
 	block->is_dirty = false;
-	block->unused = false;
+	block->unused_list = -1;
 	block->discard = false;
 	block->busy_reading_waiters = false;
 	block->busy_writing_waiters = false;
@@ -1463,39 +1763,49 @@ block_cache::NewBlock(off_t blockNumber)
 }
 
 
+/*!	Writes back some of the dirty unused blocks, so that NewBlock() can
+	recycle them. The cache will be unlocked meanwhile.
+*/
+void
+block_cache::WriteUnusedBlocks()
+{
+	if (num_dirty_blocks > 0)
+		_WriteUnusedBlocks(kMaxUnusedWriteBack, -1);
+}
+
+
 void
 block_cache::RemoveUnusedBlocks(int32 count, int32 minSecondsOld)
 {
 	TRACE(("block_cache: remove up to %" B_PRId32 " unused blocks\n", count));
 
-	for (block_list::Iterator iterator = unused_blocks.GetIterator();
-			cached_block* block = iterator.Next();) {
-		if (minSecondsOld >= block->LastAccess()) {
-			// The list is sorted by last access
-			break;
+	// this can only happen if no transactions are used
+	if (num_dirty_blocks > 0)
+		_WriteUnusedBlocks(count, minSecondsOld);
+
+	// Take the oldest blocks from all CPU lists alike
+	block_list blocks;
+	while (count > 0) {
+		int32 share = (count + cpu_count - 1) / cpu_count;
+		int32 taken = 0;
+
+		for (int32 i = 0; i < cpu_count && count > 0; i++) {
+			int32 cpuTaken = _TakeUnusedBlocks(cpus[i], blocks,
+				min_c(share, count), minSecondsOld);
+			taken += cpuTaken;
+			count -= cpuTaken;
 		}
-		if (block->busy_reading || block->busy_writing)
-			continue;
 
+		if (taken == 0)
+			break;
+	}
+
+	while (cached_block* block = blocks.RemoveHead()) {
 		TB(Flush(this, block));
 		TRACE(("  remove block %Ld, last accessed %" B_PRId32 "\n",
 			block->block_number, block->last_accessed));
 
-		// this can only happen if no transactions are used
-		if (block->is_dirty && !block->discard) {
-			if (block->busy_writing)
-				continue;
-
-			BlockWriter::WriteBlock(this, block);
-		}
-
-		// remove block from lists
-		iterator.Remove();
-		unused_block_count--;
 		RemoveBlock(block);
-
-		if (--count <= 0)
-			break;
 	}
 }
 
@@ -1503,7 +1813,7 @@ block_cache::RemoveUnusedBlocks(int32 count, int32 minSecondsOld)
 void
 block_cache::RemoveBlock(cached_block* block)
 {
-	hash_remove(hash, block);
+	table.Remove(block);
 	FreeBlock(block);
 }
 
@@ -1545,15 +1855,15 @@ block_cache::_LowMemoryHandler(void* data, uint32 resources, int32 level)
 		case B_NO_LOW_RESOURCE:
 			return;
 		case B_LOW_RESOURCE_NOTE:
-			free = cache->unused_block_count / 8;
+			free = cache->UnusedBlockCount() / 8;
 			secondsOld = 120;
 			break;
 		case B_LOW_RESOURCE_WARNING:
-			free = cache->unused_block_count / 4;
+			free = cache->UnusedBlockCount() / 4;
 			secondsOld = 10;
 			break;
 		case B_LOW_RESOURCE_CRITICAL:
-			free = cache->unused_block_count / 2;
+			free = cache->UnusedBlockCount() / 2;
 			secondsOld = 0;
 			break;
 	}
@@ -1568,48 +1878,193 @@ block_cache::_LowMemoryHandler(void* data, uint32 resources, int32 level)
 	}
 
 #ifdef TRACE_BLOCK_CACHE
-	uint32 oldUnused = cache->unused_block_count;
+	uint32 oldUnused = cache->UnusedBlockCount();
 #endif
 
 	cache->RemoveUnusedBlocks(free, secondsOld);
 
 	TRACE(("block_cache::_LowMemoryHandler(): %p: unused: %lu -> %lu\n", cache,
-		oldUnused, cache->unused_block_count));
+		oldUnused, cache->UnusedBlockCount()));
+}
+
+
+/*!	Puts the \a block into the unused list of the current CPU, unless it is
+	still referenced, or already in an unused list.
+	The cache must be locked.
+*/
+void
+block_cache::AddUnused(cached_block* block)
+{
+	// A lockless getter sets the reference before it removes the block from
+	// its unused list, so this has to be checked in this order.
+	if (block->IsUnused() || atomic_get(&block->ref_count) != 0)
+		return;
+
+	block_cache_cpu& cpu = CurrentCPU();
+	MutexLocker locker(cpu.lock);
+
+	block->unused_list = &cpu - cpus;
+	cpu.unused_blocks.Add(block);
+	cpu.unused_block_count++;
+}
+
+
+/*!	Removes the \a block from the unused list it is in. If \a acquireReference
+	is \c true, the first reference to the block is acquired in the same step;
+	the lockless block_cache_get_etc() path uses this, and holds the read lock
+	of the block's stripe instead of the cache's lock.
+	Returns \c false if the block was not in an unused list (anymore).
+*/
+bool
+block_cache::RemoveUnused(cached_block* block, bool acquireReference)
+{
+	int32 index = block->unused_list;
+	if (index < 0)
+		return false;
+
+	block_cache_cpu& cpu = cpus[index];
+	MutexLocker locker(cpu.lock);
+
+	if (block->unused_list != index)
+		return false;
+
+	if (acquireReference)
+		atomic_set(&block->ref_count, 1);
+
+	cpu.unused_blocks.Remove(block);
+	cpu.unused_block_count--;
+	block->unused_list = -1;
+	return true;
+}
+
+
+uint32
+block_cache::UnusedBlockCount() const
+{
+	uint32 count = 0;
+	for (int32 i = 0; i < cpu_count; i++)
+		count += cpus[i].unused_block_count;
+
+	return count;
+}
+
+
+block_cache_cpu&
+block_cache::CurrentCPU()
+{
+#ifdef BUILDING_USERLAND_FS_SERVER
+	return cpus[0];
+#else
+	return cpus[smp_get_current_cpu()];
+#endif
 }
 
 
+/*!	Removes an unused block from the cache, and returns it for reuse.
+	Dirty blocks are not considered, as writing them back would require to
+	unlock the cache; NewBlock() lets its caller write them back instead.
+*/
 cached_block*
 block_cache::_GetUnusedBlock()
 {
 	TRACE(("block_cache: get unused block\n"));
 
-	for (block_list::Iterator iterator = unused_blocks.GetIterator();
-			cached_block* block = iterator.Next();) {
-		TB(Flush(this, block, true));
-		// this can only happen if no transactions are used
-		if (block->is_dirty && !block->busy_writing && !block->discard)
-			BlockWriter::WriteBlock(this, block);
+	// Prefer the blocks released on this CPU
+	int32 first = &CurrentCPU() - cpus;
 
-		// remove block from lists
-		iterator.Remove();
-		unused_block_count--;
-		hash_remove(hash, block);
+	block_list blocks;
+	for (int32 i = 0; i < cpu_count; i++) {
+		if (_TakeUnusedBlocks(cpus[(first + i) % cpu_count], blocks, 1, -1)
+				> 0) {
+			break;
+		}
+	}
+
+	cached_block* block = blocks.RemoveHead();
+	if (block == NULL)
+		return NULL;
 
-		// TODO: see if parent/compare data is handled correctly here!
-		if (block->parent_data != NULL
-			&& block->parent_data != block->original_data)
-			Free(block->parent_data);
-		if (block->original_data != NULL)
-			Free(block->original_data);
+	TB(Flush(this, block, true));
+	table.Remove(block);
+
+	// TODO: see if parent/compare data is handled correctly here!
+	if (block->parent_data != NULL
+		&& block->parent_data != block->original_data)
+		Free(block->parent_data);
+	if (block->original_data != NULL)
+		Free(block->original_data);
 
 #if BLOCK_CACHE_DEBUG_CHANGED
-		if (block->compare != NULL)
-			Free(block->compare);
+	if (block->compare != NULL)
+		Free(block->compare);
 #endif
-		return block;
+	return block;
+}
+
+
+/*!	Moves up to \a count blocks that can be freed right away from the unused
+	list of \a cpu to \a blocks, starting with the least recently used one.
+	Blocks that were accessed within the last \a minSecondsOld seconds are
+	left alone.
+	Returns the number of blocks moved.
+*/
+int32
+block_cache::_TakeUnusedBlocks(block_cache_cpu& cpu, block_list& blocks,
+	int32 count, int32 minSecondsOld)
+{
+	MutexLocker locker(cpu.lock);
+
+	int32 taken = 0;
+	for (block_list::Iterator iterator = cpu.unused_blocks.GetIterator();
+			taken < count && iterator.HasNext();) {
+		cached_block* block = iterator.Next();
+		if (minSecondsOld >= block->LastAccess()) {
+			// The list is sorted by last access
+			break;
+		}
+		if (block->busy_reading || block->busy_writing
+			|| (block->is_dirty && !block->discard)) {
+			continue;
+		}
+
+		iterator.Remove();
+		cpu.unused_block_count--;
+		block->unused_list = -1;
+
+		blocks.Add(block);
+		taken++;
 	}
 
-	return NULL;
+	return taken;
+}
+
+
+/*!	Writes back up to \a count dirty unused blocks, so that they can be
+	removed afterwards. The blocks stay in their unused lists meanwhile.
+	The cache will be unlocked while the blocks are written.
+*/
+void
+block_cache::_WriteUnusedBlocks(int32 count, int32 minSecondsOld)
+{
+	BlockWriter writer(this, min_c(count, 64));
+	bool full = false;
+
+	for (int32 i = 0; i < cpu_count && !full; i++) {
+		MutexLocker locker(cpus[i].lock);
+
+		for (block_list::Iterator iterator
+				= cpus[i].unused_blocks.GetIterator();
+				!full && iterator.HasNext();) {
+			cached_block* block = iterator.Next();
+			if (minSecondsOld >= block->LastAccess())
+				break;
+
+			if (block->CanBeWritten() && !block->discard)
+				full = !writer.Add(block);
+		}
+	}
+
+	writer.Write();
 }
 
 
@@ -1643,23 +2098,26 @@ mark_block_unbusy_reading(block_cache* cache, cached_block* block)
 }
 
 
-/*!	Cache must be locked.
+/*!	Waits until the block might have been read in.
+	If reading the block failed, it has been freed when this function
+	returns, so the caller must not access it anymore, but look it up again.
+	Cache must be locked.
 */
 static void
 wait_for_busy_reading_block(block_cache* cache, cached_block* block)
 {
-	while (block->busy_reading) {
-		// wait for at least the specified block to be read in
-		ConditionVariableEntry entry;
-		cache->busy_reading_condition.Add(&entry);
-		block->busy_reading_waiters = true;
+	if (!block->busy_reading)
+		return;
 
-		mutex_unlock(&cache->lock);
+	ConditionVariableEntry entry;
+	cache->busy_reading_condition.Add(&entry);
+	block->busy_reading_waiters = true;
 
-		entry.Wait();
+	mutex_unlock(&cache->lock);
 
-		mutex_lock(&cache->lock);
-	}
+	entry.Wait();
+
+	mutex_lock(&cache->lock);
 }
 
 
@@ -1747,12 +2205,12 @@ put_cached_block(block_cache* cache, cached_block* block)
 #endif
 	TB(Put(cache, block));
 
-	if (block->ref_count < 1) {
+	if (atomic_get(&block->ref_count) < 1) {
 		panic("Invalid ref_count for block %p, cache %p\n", block, cache);
 		return;
 	}
 
-	if (--block->ref_count == 0
+	if (atomic_add(&block->ref_count, -1) == 1
 		&& block->transaction == NULL && block->previous_transaction == NULL) {
 		// This block is not used anymore, and not part of any transaction
 		block->is_writing = false;
@@ -1761,11 +2219,9 @@ put_cached_block(block_cache* cache, cached_block* block)
 			cache->RemoveBlock(block);
 		} else {
 			// put this block in the list of unused blocks
-			block->unused = true;
 			ASSERT(block->original_data == NULL
 				&& block->parent_data == NULL);
-			cache->unused_blocks.Add(block);
-			cache->unused_block_count++;
+			cache->AddUnused(block);
 		}
 	}
 }
@@ -1779,7 +2235,7 @@ put_cached_block(block_cache* cache, off_t blockNumber)
 			blockNumber, cache->max_blocks - 1);
 	}
 
-	cached_block* block = (cached_block*)hash_lookup(cache->hash, &blockNumber);
+	cached_block* block = cache->table.Lookup(blockNumber);
 	if (block != NULL)
 		put_cached_block(cache, block);
 	else {
@@ -1796,8 +2252,9 @@ put_cached_block(block_cache* cache, off_t blockNumber)
 		to satisfy your request.
 	\param readBlock if \c false, the block will not be read in case it was
 		not already in the cache. The block you retrieve may contain random
-		data. If \c true, the cache will be temporarily unlocked while the
-		block is read in.
+		data, and is marked busy reading until you initialized it and called
+		mark_block_unbusy_reading(). If \c true, the cache will be temporarily
+		unlocked while the block is read in.
 */
 static cached_block*
 get_cached_block(block_cache* cache, off_t blockNumber, bool* _allocated,
@@ -1811,18 +2268,36 @@ get_cached_block(block_cache* cache, off_t blockNumber, bool* _allocated,
 		return NULL;
 	}
 
+	bool writeBack = false;
+	bool writtenBack = false;
+
 retry:
-	cached_block* block = (cached_block*)hash_lookup(cache->hash,
-		&blockNumber);
+	cached_block* block = cache->table.Lookup(blockNumber);
 	*_allocated = false;
 
 	if (block == NULL) {
 		// put block into cache
-		block = cache->NewBlock(blockNumber);
-		if (block == NULL)
-			return NULL;
+		block = cache->NewBlock(blockNumber, &writeBack);
+		if (block == NULL) {
+			if (!writeBack || writtenBack)
+				return NULL;
+
+			// All unused blocks are dirty - write some of them back, and
+			// try again. Since the cache was unlocked, someone else might
+			// have added the block meanwhile.
+			cache->WriteUnusedBlocks();
+			writtenBack = true;
+			goto retry;
+		}
+
+		// Lockless getters must not see the block before it's initialized
+		mark_block_busy_reading(cache, block);
 
-		hash_insert_grow(cache->hash, block);
+		if (cache->table.Insert(block) != B_OK) {
+			mark_block_unbusy_reading(cache, block);
+			cache->FreeBlock(block);
+			return NULL;
+		}
 		*_allocated = true;
 	} else if (block->busy_reading) {
 		// The block is currently busy_reading - wait and try again later
@@ -1830,18 +2305,14 @@ retry:
 		goto retry;
 	}
 
-	if (block->unused) {
-		//TRACE(("remove block %Ld from unused\n", blockNumber));
-		block->unused = false;
-		cache->unused_blocks.Remove(block);
-		cache->unused_block_count--;
-	}
+	//TRACE(("remove block %Ld from unused\n", blockNumber));
+	cache->RemoveUnused(block);
 
 	if (*_allocated && readBlock) {
 		// read block into cache
 		int32 blockSize = cache->block_size;
 
-		mark_block_busy_reading(cache, block);
+		cache->read_count++;
 		mutex_unlock(&cache->lock);
 
 		ssize_t bytesRead = read_pos(cache->fd, blockNumber * blockSize,
@@ -1849,7 +2320,11 @@ retry:
 
 		mutex_lock(&cache->lock);
 		if (bytesRead < blockSize) {
-			cache->RemoveBlock(block);
+			// Take the block out of the table before waking up its waiters,
+			// so that they will look for it again
+			cache->table.Remove(block);
+			mark_block_unbusy_reading(cache, block);
+			cache->FreeBlock(block);
 			TB(Error(cache, blockNumber, "read failed", bytesRead));
 
 			FATAL(("could not read block %Ld: bytesRead: %ld, error: %s\n",
@@ -1861,13 +2336,90 @@ retry:
 		mark_block_unbusy_reading(cache, block);
 	}
 
-	block->ref_count++;
+	atomic_add(&block->ref_count, 1);
 	block->last_accessed = system_time() / 1000000L;
 
+	if (writeBack && !writtenBack) {
+		// The unused blocks could not be recycled, as they are dirty; write
+		// some of them back, so that this works next time
+		cache->WriteUnusedBlocks();
+	}
+
 	return block;
 }
 
 
+#if BLOCK_CACHE_LOCKLESS_ACCESS
+
+
+/*!	Tries to acquire a reference to the block \a blockNumber without locking
+	the cache. This only works for blocks that are already in the cache, and
+	are not being read in.
+	Returns \c NULL if the caller has to fall back to get_cached_block().
+*/
+static cached_block*
+get_cached_block_lockless(block_cache* cache, off_t blockNumber)
+{
+	ReadLocker locker(cache->table.StripeLock(blockNumber));
+
+	cached_block* block = cache->table.Lookup(blockNumber);
+	if (block == NULL || block->busy_reading)
+		return NULL;
+
+	int32 refCount = atomic_get(&block->ref_count);
+	while (refCount > 0) {
+		int32 previous = atomic_test_and_set(&block->ref_count, refCount + 1,
+			refCount);
+		if (previous == refCount)
+			break;
+
+		refCount = previous;
+	}
+
+	// An unreferenced block can only be taken out of its unused list, the
+	// cache's lock is needed for all others
+	if (refCount <= 0 && !cache->RemoveUnused(block, true))
+		return NULL;
+
+	block->last_accessed = system_time() / 1000000L;
+	atomic_add64(&cache->CurrentCPU().lockless_gets, 1);
+
+	return block;
+}
+
+
+/*!	Tries to release a reference to the block \a blockNumber without locking
+	the cache. This only works if it's not the last reference.
+	Returns \c false if the caller has to fall back to put_cached_block().
+*/
+static bool
+put_cached_block_lockless(block_cache* cache, off_t blockNumber)
+{
+	ReadLocker locker(cache->table.StripeLock(blockNumber));
+
+	cached_block* block = cache->table.Lookup(blockNumber);
+	if (block == NULL)
+		return false;
+
+	int32 refCount = atomic_get(&block->ref_count);
+	while (refCount > 1) {
+		int32 previous = atomic_test_and_set(&block->ref_count, refCount - 1,
+			refCount);
+		if (previous == refCount) {
+			atomic_add64(&cache->CurrentCPU().lockless_puts, 1);
+			return true;
+		}
+
+		refCount = previous;
+	}
+
+	return false;
+}
+
+
+#endif	// BLOCK_CACHE_LOCKLESS_ACCESS
+
+
 /*!	Returns the writable block data for the requested blockNumber.
 	If \a cleared is true, the block is not read from disk; an empty block
 	is returned.
@@ -1901,7 +2453,8 @@ get_writable_cached_block(block_cache* cache, off_t blockNumber, off_t base,
 	// if there is no transaction support, we just return the current block
 	if (transactionID == -1) {
 		if (cleared) {
-			mark_block_busy_reading(cache, block);
+			if (!allocated)
+				mark_block_busy_reading(cache, block);
 			mutex_unlock(&cache->lock);
 
 			memset(block->current_data, 0, cache->block_size);
@@ -2002,7 +2555,8 @@ get_writable_cached_block(block_cache* cache, off_t blockNumber, off_t base,
 		transaction->sub_num_blocks++;
 
 	if (cleared) {
-		mark_block_busy_reading(cache, block);
+		if (!allocated)
+			mark_block_busy_reading(cache, block);
 		mutex_unlock(&cache->lock);
 
 		memset(block->current_data, 0, cache->block_size);
@@ -2031,7 +2585,7 @@ dump_block(cached_block* block)
 		(addr_t)block->parent_data, block->ref_count, block->LastAccess(),
 		block->busy_reading ? 'r' : '-', block->busy_writing ? 'w' : '-',
 		block->is_writing ? 'W' : '-', block->is_dirty ? 'D' : '-',
-		block->unused ? 'U' : '-', block->discard ? 'D' : '-',
+		block->IsUnused() ? 'U' : '-', block->discard ? 'D' : '-',
 		(addr_t)block->transaction,
 		(addr_t)block->previous_transaction);
 }
@@ -2058,8 +2612,8 @@ dump_block_long(cached_block* block)
 		kprintf(" is-writing");
 	if (block->is_dirty)
 		kprintf(" is-dirty");
-	if (block->unused)
-		kprintf(" unused");
+	if (block->IsUnused())
+		kprintf(" unused (%ld)", block->unused_list);
 	if (block->discard)
 		kprintf(" discard");
 	kprintf("\n");
@@ -2133,8 +2687,7 @@ dump_cache(int argc, char** argv)
 	off_t blockNumber = -1;
 	if (i + 1 < argc) {
 		blockNumber = parse_expression(argv[i + 1]);
-		cached_block* block = (cached_block*)hash_lookup(cache->hash,
-			&blockNumber);
+		cached_block* block = cache->table.Lookup(blockNumber);
 		if (block != NULL)
 			dump_block_long(block);
 		else
@@ -2195,10 +2748,8 @@ dump_cache(int argc, char** argv)
 	uint32 count = 0;
 	uint32 dirty = 0;
 	uint32 discarded = 0;
-	hash_iterator iterator;
-	hash_open(cache->hash, &iterator);
-	cached_block* block;
-	while ((block = (cached_block*)hash_next(cache->hash, &iterator)) != NULL) {
+	BlockTable::Iterator iterator(cache->table);
+	while (cached_block* block = iterator.Next()) {
 		if (showBlocks)
 			dump_block(block);
 
@@ -2213,9 +2764,23 @@ dump_cache(int argc, char** argv)
 
 	kprintf(" %ld blocks total, %ld dirty, %ld discarded, %ld referenced, %ld "
 		"busy, %" B_PRIu32 " in unused.\n", count, dirty, discarded, referenced,
-		cache->busy_reading_count, cache->unused_block_count);
+		cache->busy_reading_count, cache->UnusedBlockCount());
+
+	int64 locklessGets = 0;
+	int64 locklessPuts = 0;
+	kprintf(" cpu  unused  lockless gets  lockless puts\n");
+	for (int32 i = 0; i < cache->cpu_count; i++) {
+		block_cache_cpu& cpu = cache->cpus[i];
+		kprintf(" %3ld %7" B_PRIu32 " %14" B_PRId64 " %14" B_PRId64 "\n", i,
+			cpu.unused_block_count, cpu.lockless_gets, cpu.lockless_puts);
+		locklessGets += cpu.lockless_gets;
+		locklessPuts += cpu.lockless_puts;
+	}
 
-	hash_close(cache->hash, &iterator, false);
+	kprintf(" %" B_PRId64 " gets, %" B_PRId64 " puts without locking, %"
+		B_PRId64 " reads.\n", locklessGets, locklessPuts, cache->read_count);
+	kprintf(" %" B_PRId64 " blocks written in %" B_PRId64 " requests.\n",
+		cache->written_blocks, cache->write_count);
 	return 0;
 }
 
@@ -2487,17 +3052,11 @@ block_notifier_and_writer(void* /*data*/)
 			if (cache->num_dirty_blocks) {
 				// This cache is not using transactions, we'll scan the blocks
 				// directly
-				hash_iterator iterator;
-				hash_open(cache->hash, &iterator);
-
-				cached_block* block;
-				while ((block = (cached_block*)hash_next(cache->hash, &iterator))
-						!= NULL) {
+				BlockTable::Iterator iterator(cache->table);
+				while (cached_block* block = iterator.Next()) {
 					if (block->CanBeWritten() && !writer.Add(block))
 						break;
 				}
-
-				hash_close(cache->hash, &iterator, false);
 			} else {
 				hash_iterator iterator;
 				hash_open(cache->transaction_hash, &iterator);
@@ -3271,12 +3830,10 @@ block_cache_delete(void* _cache, bool allowWrites)
 
 	// free all blocks
 
+	uint32 stripe = 0;
 	uint32 cookie = 0;
-	cached_block* block;
-	while ((block = (cached_block*)hash_remove_first(cache->hash,
-			&cookie)) != NULL) {
+	while (cached_block* block = cache->table.RemoveFirst(stripe, cookie))
 		cache->FreeBlock(block);
-	}
 
 	// free all transactions (they will all be aborted)
 
@@ -3322,17 +3879,13 @@ block_cache_sync(void* _cache)
 	MutexLocker locker(&cache->lock);
 
 	BlockWriter writer(cache);
-	hash_iterator iterator;
-	hash_open(cache->hash, &iterator);
+	BlockTable::Iterator iterator(cache->table);
 
-	cached_block* block;
-	while ((block = (cached_block*)hash_next(cache->hash, &iterator)) != NULL) {
+	while (cached_block* block = iterator.Next()) {
 		if (block->CanBeWritten())
 			writer.Add(block);
 	}
 
-	hash_close(cache->hash, &iterator, false);
-
 	status_t status = writer.Write();
 
 	locker.Unlock();
@@ -3362,8 +3915,7 @@ block_cache_sync_etc(void* _cache, off_t blockNumber, size_t numBlocks)
 	BlockWriter writer(cache);
 
 	for (; numBlocks > 0; numBlocks--, blockNumber++) {
-		cached_block* block = (cached_block*)hash_lookup(cache->hash,
-			&blockNumber);
+		cached_block* block = cache->table.Lookup(blockNumber);
 		if (block == NULL)
 			continue;
 
@@ -3397,8 +3949,7 @@ block_cache_discard(void* _cache, off_t blockNumber, size_t numBlocks)
 	BlockWriter writer(cache);
 
 	for (size_t i = 0; i < numBlocks; i++, blockNumber++) {
-		cached_block* block = (cached_block*)hash_lookup(cache->hash,
-			&blockNumber);
+		cached_block* block = cache->table.Lookup(blockNumber);
 		if (block != NULL && block->previous_transaction != NULL)
 			writer.Add(block);
 	}
@@ -3410,16 +3961,13 @@ block_cache_discard(void* _cache, off_t blockNumber, size_t numBlocks)
 		// reset blockNumber to its original value
 
 	for (size_t i = 0; i < numBlocks; i++, blockNumber++) {
-		cached_block* block = (cached_block*)hash_lookup(cache->hash,
-			&blockNumber);
+		cached_block* block = cache->table.Lookup(blockNumber);
 		if (block == NULL)
 			continue;
 
 		ASSERT(block->previous_transaction == NULL);
 
-		if (block->unused) {
-			cache->unused_blocks.Remove(block);
-			cache->unused_block_count--;
+		if (cache->RemoveUnused(block)) {
 			cache->RemoveBlock(block);
 		} else {
 			if (block->transaction != NULL && block->parent_data != NULL
@@ -3503,6 +4051,15 @@ const void*
 block_cache_get_etc(void* _cache, off_t blockNumber, off_t base, off_t length)
 {
 	block_cache* cache = (block_cache*)_cache;
+
+#if BLOCK_CACHE_LOCKLESS_ACCESS
+	if (blockNumber >= 0 && blockNumber < cache->max_blocks) {
+		cached_block* block = get_cached_block_lockless(cache, blockNumber);
+		if (block != NULL)
+			return block->current_data;
+	}
+#endif
+
 	MutexLocker locker(&cache->lock);
 	bool allocated;
 
@@ -3529,6 +4086,106 @@ block_cache_get(void* _cache, off_t blockNumber)
 }
 
 
+/*!	Reads the blocks from \a blockNumber to \a blockNumber + \a numBlocks - 1
+	into the cache that are not already there, without acquiring a reference
+	to them. Consecutive blocks are read with a single request.
+	This allows file systems to read ahead blocks they are going to need
+	soon, like the inodes of a directory that is being listed.
+*/
+status_t
+block_cache_prefetch(void* _cache, off_t blockNumber, size_t numBlocks)
+{
+	block_cache* cache = (block_cache*)_cache;
+
+	if (blockNumber < 0 || blockNumber >= cache->max_blocks
+		|| (off_t)numBlocks > cache->max_blocks - blockNumber) {
+		panic("block_cache_prefetch: invalid block range %" B_PRIdOFF ", %"
+			B_PRIuSIZE " (max %" B_PRIdOFF ")", blockNumber, numBlocks,
+			cache->max_blocks - 1);
+		return B_BAD_VALUE;
+	}
+
+	MutexLocker locker(&cache->lock);
+
+	size_t blockSize = cache->block_size;
+	cached_block* blocks[kMaxReadVecs];
+	iovec vecs[kMaxReadVecs];
+	size_t index = 0;
+
+	while (index < numBlocks) {
+		// collect the following run of blocks that are not in the cache yet
+		size_t count = 0;
+		while (index + count < numBlocks && count < kMaxReadVecs
+			&& cache->table.Lookup(blockNumber + index + count) == NULL) {
+			cached_block* block = cache->NewBlock(blockNumber + index + count);
+			if (block == NULL)
+				break;
+
+			// Lockless getters must not see the block before it's read in
+			mark_block_busy_reading(cache, block);
+
+			if (cache->table.Insert(block) != B_OK) {
+				mark_block_unbusy_reading(cache, block);
+				cache->FreeBlock(block);
+				break;
+			}
+
+			blocks[count] = block;
+			vecs[count].iov_base = block->current_data;
+			vecs[count].iov_len = blockSize;
+			count++;
+		}
+
+		if (count == 0) {
+			if (cache->table.Lookup(blockNumber + index) == NULL)
+				return B_NO_MEMORY;
+
+			// this block is already in the cache
+			index++;
+			continue;
+		}
+
+		cache->read_count++;
+		mutex_unlock(&cache->lock);
+
+		off_t offset = (blockNumber + index) * blockSize;
+		ssize_t bytesRead;
+		if (count == 1)
+			bytesRead = read_pos(cache->fd, offset, vecs[0].iov_base, blockSize);
+		else
+			bytesRead = readv_pos(cache->fd, offset, vecs, count);
+
+		mutex_lock(&cache->lock);
+
+		bool failed = bytesRead != (ssize_t)(count * blockSize);
+		for (size_t i = 0; i < count; i++) {
+			cached_block* block = blocks[i];
+			if (failed) {
+				// Take the block out of the table before waking up its
+				// waiters, so that they will look for it again
+				cache->table.Remove(block);
+				mark_block_unbusy_reading(cache, block);
+				cache->FreeBlock(block);
+				continue;
+			}
+
+			TB(Read(cache, block));
+			cache->AddUnused(block);
+			mark_block_unbusy_reading(cache, block);
+		}
+
+		if (failed) {
+			TB(Error(cache, blockNumber + index, "prefetch failed", bytesRead));
+			return bytesRead < 0 ? bytesRead : B_IO_ERROR;
+		}
+
+		index += count;
+	}
+
+	return B_OK;
+}
+
+
 /*!	Changes the internal status of a writable block to \a dirty. This can be
 	helpful in case you realize you don't need to change that block anymore
 	for whatever reason.
@@ -3543,8 +4200,7 @@ block_cache_set_dirty(void* _cache, off_t blockNumber, bool dirty,
 	block_cache* cache = (block_cache*)_cache;
 	MutexLocker locker(&cache->lock);
 
-	cached_block* block = (cached_block*)hash_lookup(cache->hash,
-		&blockNumber);
+	cached_block* block = cache->table.Lookup(blockNumber);
 	if (block == NULL)
 		return B_BAD_VALUE;
 	if (block->is_dirty == dirty) {
@@ -3564,6 +4220,12 @@ void
 block_cache_put(void* _cache, off_t blockNumber)
 {
 	block_cache* cache = (block_cache*)_cache;
+
+#if BLOCK_CACHE_LOCKLESS_ACCESS
+	if (put_cached_block_lockless(cache, blockNumber))
+		return;
+#endif
+
 	MutexLocker locker(&cache->lock);
 
 	put_cached_block(cache, blockNumber);
@@ -1,5 +1,6 @@
 /*
  * Copyright 2004-2009, Axel Dörfler, axeld@pinc-software.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Distributed under the terms of the MIT License.
  */
 
@@ -42,6 +43,25 @@
 #define BYPASS_IO_SIZE		65536
 #define LAST_ACCESSES		3
 
+// read-ahead parameters
+#define READ_AHEAD_STREAMS		4
+#define MIN_READ_AHEAD_PAGES	4		// 16 kB
+#define MAX_READ_AHEAD_PAGES	256		// 1 MB
+
+/*!	A sequential reader of a file. Several readers may interleave their
+	accesses to the same file, every one of them gets its own read-ahead
+	window.
+*/
+struct read_ahead_stream {
+	off_t			next_offset;
+		// where the next sequential read is expected, -1 if unused
+	off_t			ahead_end;
+		// end of the range that has already been read ahead
+	uint32			window;
+		// current read-ahead window in pages, 0 if not yet sequential
+	uint32			last_used;
+};
+
 struct file_cache_ref {
 	VMCache			*cache;
 	struct vnode	*vnode;
@@ -51,6 +71,9 @@ struct file_cache_ref {
 		//	write vs. read)
 	int32			last_access_index;
 	uint16			disabled_count;
+	uint32			stream_clock;
+	read_ahead_stream streams[READ_AHEAD_STREAMS];
+		// protected by the cache lock
 
 	inline void SetLastAccess(int32 index, off_t access, bool isWrite)
 	{
@@ -113,6 +136,12 @@ static const size_t kZeroVecSize = kZeroVecCount * B_PAGE_SIZE;
 static phys_addr_t sZeroPage;	// physical address
 static generic_io_vec sZeroVecs[kZeroVecCount];
 
+static int64 sReadAheadHits;
+static int64 sReadAheadMisses;
+static int64 sReadAheadPages;
+static int64 sReadAheadWastedPages;
+static int64 sReadAheadStreams;
+
 
 //	#pragma mark -
 
@@ -885,6 +914,274 @@ cache_io(void* _cacheRef, void* cookie, off_t offset, addr_t buffer,
 }
 
 
+//	#pragma mark - read-ahead
+
+
+/*!	Schedules asynchronous reads for all pages in the given range that are
+	not yet in the cache. \a offset and \a size must be page aligned, and
+	the range must lie within the file. Enough pages for the whole range must
+	have been reserved.
+	The cache must be locked; it will be unlocked temporarily to start the
+	I/O requests.
+	Returns the number of pages scheduled to be read. If \a _end is given, it
+	is set to the end of the part of the range that is now either in the
+	cache, or scheduled to be read.
+*/
+static size_t
+precache_range(file_cache_ref* ref, off_t offset, size_t size,
+	vm_page_reservation* reservation, off_t* _end = NULL)
+{
+	VMCache* cache = ref->cache;
+	size_t bytesToRead = 0;
+	size_t bytesScheduled = 0;
+	off_t lastOffset = offset;
+
+	while (true) {
+		// check if this page is already in memory
+		if (size > 0) {
+			vm_page* page = cache->LookupPage(offset);
+
+			offset += B_PAGE_SIZE;
+			size -= B_PAGE_SIZE;
+
+			if (page == NULL) {
+				bytesToRead += B_PAGE_SIZE;
+				continue;
+			}
+		}
+		if (bytesToRead != 0) {
+			// read the part before the current page (or the end of the request)
+			PrecacheIO* io = new(std::nothrow) PrecacheIO(ref, lastOffset,
+				bytesToRead);
+			if (io == NULL || io->Prepare(reservation) != B_OK) {
+				delete io;
+				offset = lastOffset;
+				break;
+			}
+
+			// we must not have the cache locked during I/O
+			cache->Unlock();
+			io->ReadAsync();
+			cache->Lock();
+
+			bytesScheduled += bytesToRead;
+			bytesToRead = 0;
+		}
+
+		if (size == 0) {
+			// we have reached the end of the request
+			break;
+		}
+
+		lastOffset = offset;
+	}
+
+	if (_end != NULL)
+		*_end = offset;
+
+	return bytesScheduled / B_PAGE_SIZE;
+}
+
+
+/*!	Returns the pages of the stream that have been read ahead, but have not
+	been read (yet).
+*/
+static inline uint32
+read_ahead_pending_pages(const read_ahead_stream& stream)
+{
+	off_t nextOffset = ROUNDUP(stream.next_offset, B_PAGE_SIZE);
+	if (stream.next_offset < 0 || stream.ahead_end <= nextOffset)
+		return 0;
+
+	return (stream.ahead_end - nextOffset) / B_PAGE_SIZE;
+}
+
+
+/*!	Finds the stream whose next sequential access would be at \a offset, or
+	replaces the least recently used one, if there is none.
+	\a _isNew is set to \c true in the latter case.
+	The cache must be locked.
+*/
+static read_ahead_stream*
+find_read_ahead_stream(file_cache_ref* ref, off_t offset, bool& _isNew)
+{
+	read_ahead_stream* oldest = &ref->streams[0];
+
+	for (int32 i = 0; i < READ_AHEAD_STREAMS; i++) {
+		read_ahead_stream& stream = ref->streams[i];
+
+		// allow re-reading the last page of the previous access
+		if (stream.next_offset >= 0 && offset <= stream.next_offset
+			&& offset >= ROUNDDOWN(stream.next_offset, B_PAGE_SIZE)) {
+			_isNew = false;
+			return &stream;
+		}
+
+		if (stream.next_offset < 0 || (oldest->next_offset >= 0
+				&& (int32)(stream.last_used - oldest->last_used) < 0)) {
+			// the stream is unused or older than the current candidate
+			oldest = &stream;
+		}
+	}
+
+	// Whatever the replaced stream did read ahead, but did not use, is wasted
+	uint32 wasted = read_ahead_pending_pages(*oldest);
+	if (wasted > 0)
+		atomic_add64(&sReadAheadWastedPages, wasted);
+
+	oldest->next_offset = -1;
+	oldest->ahead_end = 0;
+	oldest->window = 0;
+
+	_isNew = true;
+	return oldest;
+}
+
+
+/*!	Updates the read-ahead state of the file for a read of \a size bytes at
+	\a offset, that is about to be done.
+	If a stream has been detected, and its read-ahead range needs to be
+	extended, \c true is returned, and \a _offset and \a _size are set to
+	the range that should be read ahead after the request has been fulfilled.
+	The stream only covers that range once finish_read_ahead() has been
+	called with what has actually been scheduled.
+
+	The window of a stream starts at MIN_READ_AHEAD_PAGES, and is doubled
+	every time the reader found the data that was read ahead for it, up to
+	MAX_READ_AHEAD_PAGES. If the data has been evicted again before it could
+	be read, the window is halved instead.
+*/
+static bool
+update_read_ahead(file_cache_ref* ref, off_t offset, size_t size,
+	off_t& _offset, size_t& _size)
+{
+	VMCache* cache = ref->cache;
+	AutoLocker<VMCache> locker(cache);
+
+	off_t fileSize = cache->virtual_end;
+	if (size == 0 || offset < 0 || offset >= fileSize)
+		return false;
+
+	off_t end = min_c(offset + (off_t)size, fileSize);
+
+	bool isNew;
+	read_ahead_stream* stream = find_read_ahead_stream(ref, offset, isNew);
+	stream->next_offset = end;
+	stream->last_used = ++ref->stream_clock;
+
+	bool hit = false;
+	if (isNew) {
+		// Reading from the start of a file is almost always sequential, for
+		// everything else, we wait for the second access.
+		if (offset != 0)
+			return false;
+	} else if (stream->ahead_end > offset) {
+		vm_page* page = cache->LookupPage(ROUNDDOWN(offset, B_PAGE_SIZE));
+		if (page == NULL) {
+			// The pages we read ahead have been thrown away again before the
+			// reader got to them -- we're reading ahead too much.
+			atomic_add64(&sReadAheadMisses, 1);
+			atomic_add64(&sReadAheadWastedPages,
+				(stream->ahead_end - ROUNDDOWN(offset, B_PAGE_SIZE))
+					/ B_PAGE_SIZE);
+
+			stream->window = max_c(stream->window / 2,
+				(uint32)MIN_READ_AHEAD_PAGES);
+			stream->ahead_end = 0;
+		} else {
+			atomic_add64(&sReadAheadHits, 1);
+			hit = true;
+		}
+	}
+
+	if (stream->window == 0) {
+		stream->window = MIN_READ_AHEAD_PAGES;
+		atomic_add64(&sReadAheadStreams, 1);
+	}
+
+	// The request itself is read synchronously by the caller
+	if (stream->ahead_end < end)
+		stream->ahead_end = ROUNDUP(end, B_PAGE_SIZE);
+
+	// Don't read ahead when we're already short on memory
+	if (stream->ahead_end >= fileSize
+		|| low_resource_state(B_KERNEL_RESOURCE_PAGES) != B_NO_LOW_RESOURCE)
+		return false;
+
+	// Only read ahead once the reader has consumed half of the window
+	off_t windowSize = (off_t)stream->window * B_PAGE_SIZE;
+	if (stream->ahead_end - end > windowSize / 2)
+		return false;
+
+	if (hit && stream->window < MAX_READ_AHEAD_PAGES) {
+		stream->window *= 2;
+		windowSize *= 2;
+	}
+
+	_offset = stream->ahead_end;
+	_size = ROUNDUP(min_c(windowSize, fileSize - stream->ahead_end),
+		B_PAGE_SIZE);
+	return true;
+}
+
+
+/*!	Reads the given range ahead asynchronously, if there are enough free
+	pages to do so.
+	Returns the end of the part of the range that is either in the cache, or
+	has been scheduled to be read; that is \a offset if nothing could be
+	done.
+*/
+static off_t
+schedule_read_ahead(file_cache_ref* ref, off_t offset, size_t size)
+{
+	VMCache* cache = ref->cache;
+	size_t reservePages = size / B_PAGE_SIZE;
+
+	if (vm_page_num_unused_pages() < 2 * reservePages)
+		return offset;
+
+	vm_page_reservation reservation;
+	if (!vm_page_try_reserve_pages(&reservation, reservePages,
+			VM_PRIORITY_USER)) {
+		return offset;
+	}
+
+	off_t end;
+	cache->Lock();
+	size_t pages = precache_range(ref, offset, size, &reservation, &end);
+	cache->Unlock();
+
+	vm_page_unreserve_pages(&reservation);
+
+	if (pages > 0)
+		atomic_add64(&sReadAheadPages, pages);
+
+	return end;
+}
+
+
+/*!	Extends the read-ahead range of the stream that asked to read ahead from
+	\a offset to \a end, the end of what schedule_read_ahead() actually
+	covered.
+*/
+static void
+finish_read_ahead(file_cache_ref* ref, off_t offset, off_t end)
+{
+	if (end <= offset)
+		return;
+
+	AutoLocker<VMCache> locker(ref->cache);
+
+	for (int32 i = 0; i < READ_AHEAD_STREAMS; i++) {
+		read_ahead_stream& stream = ref->streams[i];
+		if (stream.next_offset >= 0 && stream.ahead_end == offset) {
+			stream.ahead_end = end;
+			break;
+		}
+	}
+}
+
+
 static status_t
 file_cache_control(const char* subsystem, uint32 function, void* buffer,
 	size_t bufferSize)
@@ -929,6 +1226,22 @@ file_cache_control(const char* subsystem, uint32 function, void* buffer,
 
 			return status;
 		}
+
+		case CACHE_GET_READ_AHEAD_STATS:
+		{
+			if (buffer == NULL || !IS_USER_ADDRESS(buffer)
+				|| bufferSize < sizeof(file_cache_read_ahead_stats))
+				return B_BAD_VALUE;
+
+			file_cache_read_ahead_stats stats;
+			stats.hits = atomic_get64(&sReadAheadHits);
+			stats.misses = atomic_get64(&sReadAheadMisses);
+			stats.read_ahead_pages = atomic_get64(&sReadAheadPages);
+			stats.wasted_pages = atomic_get64(&sReadAheadWastedPages);
+			stats.streams = atomic_get64(&sReadAheadStreams);
+
+			return user_memcpy(buffer, &stats, sizeof(stats));
+		}
 	}
 
 	return B_BAD_HANDLER;
@@ -968,51 +1281,11 @@ cache_prefetch_vnode(struct vnode* vnode, off_t offset, size_t size)
 		return;
 	}
 
-	size_t bytesToRead = 0;
-	off_t lastOffset = offset;
-
 	vm_page_reservation reservation;
 	vm_page_reserve_pages(&reservation, reservePages, VM_PRIORITY_USER);
 
 	cache->Lock();
-
-	while (true) {
-		// check if this page is already in memory
-		if (size > 0) {
-			vm_page* page = cache->LookupPage(offset);
-
-			offset += B_PAGE_SIZE;
-			size -= B_PAGE_SIZE;
-
-			if (page == NULL) {
-				bytesToRead += B_PAGE_SIZE;
-				continue;
-			}
-		}
-		if (bytesToRead != 0) {
-			// read the part before the current page (or the end of the request)
-			PrecacheIO* io = new(std::nothrow) PrecacheIO(ref, lastOffset,
-				bytesToRead);
-			if (io == NULL || io->Prepare(&reservation) != B_OK) {
-				delete io;
-				break;
-			}
-
-			// we must not have the cache locked during I/O
-			cache->Unlock();
-			io->ReadAsync();
-			cache->Lock();
-
-			bytesToRead = 0;
-		}
-
-		if (size == 0) {
-			// we have reached the end of the request
-			break;
-		}
-
-		lastOffset = offset;
-	}
+	precache_range(ref, offset, size, &reservation);
 
 	cache->ReleaseRefAndUnlock();
 	vm_page_unreserve_pages(&reservation);
@@ -1133,6 +1406,14 @@ file_cache_create(dev_t mountID, ino_t vnodeID, off_t size)
 	ref->last_access_index = 0;
 	ref->disabled_count = 0;
 
+	ref->stream_clock = 0;
+	for (int32 i = 0; i < READ_AHEAD_STREAMS; i++) {
+		ref->streams[i].next_offset = -1;
+		ref->streams[i].ahead_end = 0;
+		ref->streams[i].window = 0;
+		ref->streams[i].last_used = 0;
+	}
+
 	// TODO: delay VMCache creation until data is
 	//	requested/written for the first time? Listing lots of
 	//	files in Tracker (and elsewhere) could be slowed down.
@@ -1172,6 +1453,12 @@ file_cache_delete(void* _cacheRef)
 
 	TRACE(("file_cache_delete(ref = %p)\n", ref));
 
+	uint32 wasted = 0;
+	for (int32 i = 0; i < READ_AHEAD_STREAMS; i++)
+		wasted += read_ahead_pending_pages(ref->streams[i]);
+	if (wasted > 0)
+		atomic_add64(&sReadAheadWastedPages, wasted);
+
 	ref->cache->ReleaseRef();
 	delete ref;
 }
@@ -1298,7 +1585,20 @@ file_cache_read(void* _cacheRef, void* cookie, off_t offset, void* buffer,
 		return error;
 	}
 
-	return cache_io(ref, cookie, offset, (addr_t)buffer, _size, false);
+	off_t readAheadOffset;
+	size_t readAheadSize;
+	bool readAhead = update_read_ahead(ref, offset, *_size, readAheadOffset,
+		readAheadSize);
+
+	status_t status = cache_io(ref, cookie, offset, (addr_t)buffer, _size,
+		false);
+
+	if (status == B_OK && readAhead) {
+		finish_read_ahead(ref, readAheadOffset,
+			schedule_read_ahead(ref, readAheadOffset, readAheadSize));
+	}
+
+	return status;
 }
 
 
@@ -1345,6 +1645,11 @@ file_cache_write(void* _cacheRef, void* cookie, off_t offset,
 	status_t status = cache_io(ref, cookie, offset,
 		(addr_t)const_cast<void*>(buffer), _size, true);
 
+	// Now that the cache is no longer locked, slow us down, if the pages we
+	// have modified can't be written back fast enough.
+	if (status == B_OK)
+		vm_page_throttle_dirty_pages(ref->cache);
+
 	TRACE(("file_cache_write(ref = %p, offset = %Ld, buffer = %p, size = %lu)"
 		" = %ld\n", ref, offset, buffer, *_size, status));
 
@@ -31,6 +31,8 @@ public:
 									generic_size_t numBytes, uint32 flags,
 									AsyncIOCallback* callback);
 	virtual	bool				CanWritePage(off_t offset);
+	virtual	dev_t				WriteBackDevice() const
+									{ return fDevice; }
 
 	virtual	status_t			Fault(struct VMAddressSpace* aspace,
 									off_t offset);
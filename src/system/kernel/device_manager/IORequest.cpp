@@ -742,6 +742,7 @@ IORequest::Init(off_t offset, generic_size_t firstVecOffset,
 	fBuffer->SetVecs(firstVecOffset, vecs, count, length, flags);
 
 	fOwner = NULL;
+	fQueuedTime = 0;
 	fOffset = offset;
 	fLength = length;
 	fRelativeParentOffset = 0;
@@ -988,6 +989,24 @@ IORequest::SetStatusAndNotify(status_t status)
 }
 
 
+/*!	Sets the status of a request that cannot be processed any further.
+	Unlike SetStatusAndNotify() nobody is notified, since operations of the
+	request might still be in progress. The caller is responsible for calling
+	NotifyFinished() once IsFinished() returns \c true.
+*/
+void
+IORequest::SetFailed(status_t status)
+{
+	MutexLocker _(fLock);
+
+	if (fStatus != 1)
+		return;
+
+	fStatus = status;
+	fPartialTransfer = true;
+}
+
+
 void
 IORequest::OperationFinished(IOOperation* operation, status_t status,
 	bool partialTransfer, generic_size_t transferEndOffset)
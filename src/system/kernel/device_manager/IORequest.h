@@ -231,6 +231,10 @@ struct IORequest : IORequestChunk, DoublyLinkedListLinkImpl<IORequest> {
 									{ fOwner = owner; }
 			IORequestOwner*		Owner() const	{ return fOwner; }
 
+			void				SetQueuedTime(bigtime_t time)
+									{ fQueuedTime = time; }
+			bigtime_t			QueuedTime() const	{ return fQueuedTime; }
+
 			status_t			CreateSubRequest(off_t parentOffset,
 									off_t offset, generic_size_t length,
 									IORequest*& subRequest);
@@ -253,6 +257,7 @@ struct IORequest : IORequestChunk, DoublyLinkedListLinkImpl<IORequest> {
 			void				NotifyFinished();
 			bool				HasCallbacks() const;
 			void				SetStatusAndNotify(status_t status);
+			void				SetFailed(status_t status);
 
 			void				OperationFinished(IOOperation* operation,
 									status_t status, bool partialTransfer,
@@ -320,6 +325,9 @@ private:
 
 			mutex				fLock;
 			IORequestOwner*		fOwner;
+			bigtime_t			fQueuedTime;
+									// when the request has been passed to
+									// the I/O scheduler
 			IOBuffer*			fBuffer;
 			off_t				fOffset;
 			generic_size_t		fLength;
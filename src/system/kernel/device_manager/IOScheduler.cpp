@@ -9,9 +9,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
+#include "dma_resources.h"
 #include "IOSchedulerRoster.h"
 
 
+struct OperationComparator {
+	inline bool operator()(const IOOperation* a, const IOOperation* b)
+	{
+		off_t offsetA = a->Offset();
+		off_t offsetB = b->Offset();
+		return offsetA < offsetB
+			|| (offsetA == offsetB && a->Length() > b->Length());
+	}
+};
+
+
 IOScheduler::IOScheduler(DMAResource* resource)
 	:
 	fDMAResource(resource),
@@ -19,7 +33,9 @@ IOScheduler::IOScheduler(DMAResource* resource)
 	fID(IOSchedulerRoster::Default()->NextID()),
 	fIOCallback(NULL),
 	fIOCallbackData(NULL),
-	fSchedulerRegistered(false)
+	fSchedulerRegistered(false),
+	fOperationArray(NULL),
+	fBlockSize(0)
 {
 }
 
@@ -29,6 +45,11 @@ IOScheduler::~IOScheduler()
 	if (fSchedulerRegistered)
 		IOSchedulerRoster::Default()->RemoveScheduler(this);
 
+	while (IOOperation* operation = fUnusedOperations.RemoveHead())
+		delete operation;
+
+	delete[] fOperationArray;
+
 	free(fName);
 }
 
@@ -72,3 +93,140 @@ void
 IOScheduler::MediaChanged()
 {
 }
+
+
+/*!	Allocates the operations the scheduler hands to the driver, one per DMA
+	buffer, and determines the block size of the device.
+*/
+status_t
+IOScheduler::_InitOperations()
+{
+	size_t count = fDMAResource != NULL ? fDMAResource->BufferCount() : 16;
+	for (size_t i = 0; i < count; i++) {
+		IOOperation* operation = new(std::nothrow) IOOperation;
+		if (operation == NULL)
+			return B_NO_MEMORY;
+
+		fUnusedOperations.Add(operation);
+	}
+
+	fOperationArray = new(std::nothrow) IOOperation*[count];
+	if (fOperationArray == NULL)
+		return B_NO_MEMORY;
+
+	if (fDMAResource != NULL)
+		fBlockSize = fDMAResource->BlockSize();
+	if (fBlockSize == 0)
+		fBlockSize = 512;
+
+	return B_OK;
+}
+
+
+/*!	Translates the next part of \a request into operations, using up to
+	\a quantum bytes of bandwidth. The operations are appended to
+	\a operations, and the bandwidth they need is returned in
+	\a usedBandwidth.
+	Must be called with the scheduler's lock held.
+	Returns \c B_BUSY, if no operation or DMA buffer is available at the
+	moment; the request can be continued later. Any other error means that
+	the request cannot be served, and has to be aborted by the caller.
+	Operations that were prepared before the error are still valid.
+*/
+status_t
+IOScheduler::_PrepareRequestOperations(IORequest* request,
+	IOOperationList& operations, int32& operationsPrepared, off_t quantum,
+	off_t& usedBandwidth)
+{
+	usedBandwidth = 0;
+
+	if (fDMAResource != NULL) {
+		while (quantum >= (off_t)fBlockSize && request->RemainingBytes() > 0) {
+			IOOperation* operation = fUnusedOperations.RemoveHead();
+			if (operation == NULL)
+				return B_BUSY;
+
+			status_t status = fDMAResource->TranslateNext(request, operation,
+				quantum);
+			if (status != B_OK) {
+				// B_BUSY means some resource (DMABuffers or
+				// DMABounceBuffers) was temporarily unavailable. That's OK,
+				// we'll retry later.
+				operation->SetParent(NULL);
+				fUnusedOperations.Add(operation);
+				return status;
+			}
+
+			off_t bandwidth = operation->Length();
+			quantum -= bandwidth;
+			usedBandwidth += bandwidth;
+
+			operations.Add(operation);
+			operationsPrepared++;
+		}
+	} else {
+		// TODO: If the device has block size restrictions, we might need to use
+		// a bounce buffer.
+		IOOperation* operation = fUnusedOperations.RemoveHead();
+		if (operation == NULL)
+			return B_BUSY;
+
+		status_t status = operation->Prepare(request);
+		if (status != B_OK) {
+			operation->SetParent(NULL);
+			fUnusedOperations.Add(operation);
+			return status;
+		}
+
+		operation->SetOriginalRange(request->Offset(), request->Length());
+		request->Advance(request->Length());
+
+		off_t bandwidth = operation->Length();
+		usedBandwidth += bandwidth;
+
+		operations.Add(operation);
+		operationsPrepared++;
+	}
+
+	return B_OK;
+}
+
+
+/*!	Sorts the operations by offset, such that they can be executed in one or
+	more elevator runs starting at \a lastOffset. \a lastOffset is updated
+	to the end of the last operation.
+*/
+void
+IOScheduler::_SortOperations(IOOperationList& operations, off_t& lastOffset)
+{
+	// move operations to an array and sort it
+	int32 count = 0;
+	while (IOOperation* operation = operations.RemoveHead())
+		fOperationArray[count++] = operation;
+
+	std::sort(fOperationArray, fOperationArray + count, OperationComparator());
+
+	// move the sorted operations to a temporary list we can work with
+	IOOperationList sortedOperations;
+	for (int32 i = 0; i < count; i++)
+		sortedOperations.Add(fOperationArray[i]);
+
+	// Sort the operations so that no two adjacent operations overlap. This
+	// might result in several elevator runs.
+	while (!sortedOperations.IsEmpty()) {
+		IOOperation* operation = sortedOperations.Head();
+		while (operation != NULL) {
+			IOOperation* nextOperation = sortedOperations.GetNext(operation);
+			if (operation->Offset() >= lastOffset) {
+				sortedOperations.Remove(operation);
+				operations.Add(operation);
+				lastOffset = operation->Offset() + operation->Length();
+			}
+
+			operation = nextOperation;
+		}
+
+		if (!sortedOperations.IsEmpty())
+			lastOffset = 0;
+	}
+}
@@ -61,6 +61,15 @@ public:
 
 	virtual	void				Dump() const = 0;
 
+protected:
+			status_t			_InitOperations();
+			status_t			_PrepareRequestOperations(IORequest* request,
+									IOOperationList& operations,
+									int32& operationsPrepared, off_t quantum,
+									off_t& usedBandwidth);
+			void				_SortOperations(IOOperationList& operations,
+									off_t& lastOffset);
+
 protected:
 			DMAResource*		fDMAResource;
 			char*				fName;
@@ -68,6 +77,9 @@ protected:
 			io_callback			fIOCallback;
 			void*				fIOCallbackData;
 			bool				fSchedulerRegistered;
+			IOOperation**		fOperationArray;
+			IOOperationList		fUnusedOperations;
+			generic_size_t		fBlockSize;
 };
 
 
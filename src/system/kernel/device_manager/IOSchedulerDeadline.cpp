@@ -0,0 +1,915 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "IOSchedulerDeadline.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <lock.h>
+#include <team.h>
+#include <thread_types.h>
+#include <thread.h>
+#include <util/AutoLock.h>
+
+#include "IOSchedulerRoster.h"
+
+
+//#define TRACE_IO_SCHEDULER
+#ifdef TRACE_IO_SCHEDULER
+#	define TRACE(x...) dprintf(x)
+#else
+#	define TRACE(x...) ;
+#endif
+
+
+// Base deadlines for requests of threads with B_NORMAL_PRIORITY I/O priority
+static const bigtime_t kReadDeadline = 50000;
+static const bigtime_t kWriteDeadline = 500000;
+
+// How many batches of reads may be scheduled in a row while writes are
+// waiting
+static const int32 kMaxStarvedWriteBatches = 4;
+
+
+// #pragma mark - LatencyStatistics
+
+
+void
+IOSchedulerDeadline::LatencyStatistics::Add(bigtime_t latency)
+{
+	count++;
+	total += latency;
+	if (latency > max)
+		max = latency;
+
+	int32 index = 0;
+	for (bigtime_t limit = 1000; index < 4 && latency >= limit; limit *= 10)
+		index++;
+
+	histogram[index]++;
+}
+
+
+void
+IOSchedulerDeadline::LatencyStatistics::Dump(const char* name) const
+{
+	kprintf("  %s queueing latency: %Ld requests, average %Ld us, max %Ld "
+		"us\n", name, count, count > 0 ? total / count : 0, max);
+	kprintf("    < 1 ms: %Ld, < 10 ms: %Ld, < 100 ms: %Ld, < 1 s: %Ld, more: "
+		"%Ld\n", histogram[0], histogram[1], histogram[2], histogram[3],
+		histogram[4]);
+}
+
+
+// #pragma mark - IOSchedulerDeadline
+
+
+struct IOSchedulerDeadline::RequestOwnerHashDefinition {
+	typedef team_id			KeyType;
+	typedef RequestOwner	ValueType;
+
+	size_t HashKey(team_id key) const				{ return key; }
+	size_t Hash(const RequestOwner* value) const	{ return value->team; }
+	bool Compare(team_id key, const RequestOwner* value) const
+		{ return value->team == key; }
+	RequestOwner*& GetLink(RequestOwner* value) const
+		{ return value->team_link; }
+};
+
+struct IOSchedulerDeadline::RequestOwnerHashTable
+		: BOpenHashTable<RequestOwnerHashDefinition, false> {
+};
+
+
+IOSchedulerDeadline::IOSchedulerDeadline(DMAResource* resource)
+	:
+	IOScheduler(resource),
+	fSchedulerThread(-1),
+	fRequestNotifierThread(-1),
+	fAllocatedRequestOwners(NULL),
+	fRequestOwners(NULL),
+	fPendingOperations(0),
+	fPendingReads(0),
+	fPendingWrites(0),
+	fStarvedWriteBatches(0),
+	fVirtualTime(0),
+	fReadDeadline(kReadDeadline),
+	fWriteDeadline(kWriteDeadline),
+	fMergedRequests(0),
+	fExpiredRequests(0),
+	fTerminating(false)
+{
+	mutex_init(&fLock, "I/O scheduler");
+	B_INITIALIZE_SPINLOCK(&fFinisherLock);
+
+	fNewRequestCondition.Init(this, "I/O new request");
+	fFinishedOperationCondition.Init(this, "I/O finished operation");
+	fFinishedRequestCondition.Init(this, "I/O finished request");
+
+	memset(&fReadLatency, 0, sizeof(fReadLatency));
+	memset(&fWriteLatency, 0, sizeof(fWriteLatency));
+}
+
+
+IOSchedulerDeadline::~IOSchedulerDeadline()
+{
+	// shutdown threads
+	MutexLocker locker(fLock);
+	InterruptsSpinLocker finisherLocker(fFinisherLock);
+	fTerminating = true;
+
+	fNewRequestCondition.NotifyAll();
+	fFinishedOperationCondition.NotifyAll();
+	fFinishedRequestCondition.NotifyAll();
+
+	finisherLocker.Unlock();
+	locker.Unlock();
+
+	if (fSchedulerThread >= 0)
+		wait_for_thread(fSchedulerThread, NULL);
+
+	if (fRequestNotifierThread >= 0)
+		wait_for_thread(fRequestNotifierThread, NULL);
+
+	// destroy our belongings
+	mutex_lock(&fLock);
+	mutex_destroy(&fLock);
+
+	delete fRequestOwners;
+	delete[] fAllocatedRequestOwners;
+}
+
+
+status_t
+IOSchedulerDeadline::Init(const char* name)
+{
+	status_t error = IOScheduler::Init(name);
+	if (error != B_OK)
+		return error;
+
+	error = _InitOperations();
+	if (error != B_OK)
+		return error;
+
+	// We need one request owner per team at most
+	fAllocatedRequestOwnerCount = team_max_teams();
+	fAllocatedRequestOwners
+		= new(std::nothrow) RequestOwner[fAllocatedRequestOwnerCount];
+	if (fAllocatedRequestOwners == NULL)
+		return B_NO_MEMORY;
+
+	for (int32 i = 0; i < fAllocatedRequestOwnerCount; i++) {
+		RequestOwner& owner = fAllocatedRequestOwners[i];
+		owner.team = -1;
+		owner.thread = -1;
+		owner.priority = B_IDLE_PRIORITY;
+		owner.virtual_time = 0;
+		fUnusedRequestOwners.Add(&owner);
+	}
+
+	fRequestOwners = new(std::nothrow) RequestOwnerHashTable;
+	if (fRequestOwners == NULL)
+		return B_NO_MEMORY;
+
+	error = fRequestOwners->Init(fAllocatedRequestOwnerCount);
+	if (error != B_OK)
+		return error;
+
+	// An iteration is long enough for sorting the operations to pay off, and
+	// one owner can only get a part of it before the others get their turn.
+	fIterationBandwidth = fBlockSize * 8192;
+	fOwnerQuantum = fBlockSize * 1024;
+
+	// start threads
+	char buffer[B_OS_NAME_LENGTH];
+	strlcpy(buffer, name, sizeof(buffer));
+	strlcat(buffer, " scheduler ", sizeof(buffer));
+	size_t nameLength = strlen(buffer);
+	snprintf(buffer + nameLength, sizeof(buffer) - nameLength, "%" B_PRId32,
+		fID);
+	fSchedulerThread = spawn_kernel_thread(&_SchedulerThread, buffer,
+		B_NORMAL_PRIORITY + 2, (void *)this);
+	if (fSchedulerThread < B_OK)
+		return fSchedulerThread;
+
+	strlcpy(buffer, name, sizeof(buffer));
+	strlcat(buffer, " notifier ", sizeof(buffer));
+	nameLength = strlen(buffer);
+	snprintf(buffer + nameLength, sizeof(buffer) - nameLength, "%" B_PRId32,
+		fID);
+	fRequestNotifierThread = spawn_kernel_thread(&_RequestNotifierThread,
+		buffer, B_NORMAL_PRIORITY + 2, (void *)this);
+	if (fRequestNotifierThread < B_OK)
+		return fRequestNotifierThread;
+
+	resume_thread(fSchedulerThread);
+	resume_thread(fRequestNotifierThread);
+
+	return B_OK;
+}
+
+
+status_t
+IOSchedulerDeadline::ScheduleRequest(IORequest* request)
+{
+	TRACE("%p->IOSchedulerDeadline::ScheduleRequest(%p)\n", this, request);
+
+	IOBuffer* buffer = request->Buffer();
+
+	if (buffer->IsVirtual()) {
+		status_t status = buffer->LockMemory(request->TeamID(),
+			request->IsWrite());
+		if (status != B_OK) {
+			request->SetStatusAndNotify(status);
+			return status;
+		}
+	}
+
+	int32 priority = thread_get_io_priority(request->ThreadID());
+	if (priority < 0)
+		priority = B_NORMAL_PRIORITY;
+
+	MutexLocker locker(fLock);
+
+	RequestOwner* owner = _GetRequestOwner(request->TeamID());
+	if (owner == NULL) {
+		panic("IOSchedulerDeadline: Out of request owners!\n");
+		locker.Unlock();
+		if (buffer->IsVirtual())
+			buffer->UnlockMemory(request->TeamID(), request->IsWrite());
+		request->SetStatusAndNotify(B_NO_MEMORY);
+		return B_NO_MEMORY;
+	}
+
+	if (!owner->IsActive()) {
+		// A team that has been idle doesn't get to use the bandwidth it
+		// didn't need in the meantime.
+		owner->priority = priority;
+		owner->virtual_time = std::max(owner->virtual_time, fVirtualTime);
+		fActiveRequestOwners.Add(owner);
+	} else if (priority > owner->priority) {
+		// the team gets the priority of its most important thread
+		owner->priority = priority;
+	}
+
+	request->SetOwner(owner);
+	request->SetQueuedTime(system_time());
+	owner->Requests(request->IsWrite()).Add(request);
+
+	if (request->IsWrite())
+		fPendingWrites++;
+	else
+		fPendingReads++;
+
+	IOSchedulerRoster::Default()->Notify(IO_SCHEDULER_REQUEST_SCHEDULED, this,
+		request);
+
+	fNewRequestCondition.NotifyAll();
+
+	return B_OK;
+}
+
+
+void
+IOSchedulerDeadline::AbortRequest(IORequest* request, status_t status)
+{
+	MutexLocker _(fLock);
+	_AbortRequest(request, status);
+}
+
+
+void
+IOSchedulerDeadline::OperationCompleted(IOOperation* operation,
+	status_t status, generic_size_t transferredBytes)
+{
+	InterruptsSpinLocker _(fFinisherLock);
+
+	// finish operation only once
+	if (operation->Status() <= 0)
+		return;
+
+	operation->SetStatus(status);
+
+	// set the bytes transferred (of the net data)
+	generic_size_t partialBegin
+		= operation->OriginalOffset() - operation->Offset();
+	operation->SetTransferredBytes(
+		transferredBytes > partialBegin ? transferredBytes - partialBegin : 0);
+
+	fCompletedOperations.Add(operation);
+	fFinishedOperationCondition.NotifyAll();
+}
+
+
+void
+IOSchedulerDeadline::Dump() const
+{
+	kprintf("IOSchedulerDeadline at %p\n", this);
+	kprintf("  DMA resource:      %p\n", fDMAResource);
+	kprintf("  pending reads:     %ld\n", fPendingReads);
+	kprintf("  pending writes:    %ld\n", fPendingWrites);
+	kprintf("  virtual time:      %Ld\n", fVirtualTime);
+	kprintf("  merged requests:   %Ld\n", fMergedRequests);
+	kprintf("  expired requests:  %Ld\n", fExpiredRequests);
+
+	fReadLatency.Dump("read");
+	fWriteLatency.Dump("write");
+
+	kprintf("  active request owners:\n");
+	for (RequestOwnerList::ConstIterator it
+				= fActiveRequestOwners.GetIterator();
+			const RequestOwner* owner = it.Next();) {
+		kprintf("    %p: team %ld, priority %ld, virtual time %Ld\n", owner,
+			owner->team, owner->priority, owner->virtual_time);
+	}
+}
+
+
+/*!	Must not be called with the fLock held. */
+void
+IOSchedulerDeadline::_Finisher()
+{
+	while (true) {
+		InterruptsSpinLocker locker(fFinisherLock);
+		IOOperation* operation = fCompletedOperations.RemoveHead();
+		if (operation == NULL)
+			return;
+
+		locker.Unlock();
+
+		TRACE("IOSchedulerDeadline::_Finisher(): operation: %p\n", operation);
+
+		bool operationFinished = operation->Finish();
+
+		IOSchedulerRoster::Default()->Notify(IO_SCHEDULER_OPERATION_FINISHED,
+			this, operation->Parent(), operation);
+			// Notify for every time the operation is passed to the I/O hook,
+			// not only when it is fully finished.
+
+		if (!operationFinished) {
+			TRACE("  operation: %p not finished yet\n", operation);
+			MutexLocker _(fLock);
+			operation->SetTransferredBytes(0);
+			operation->Parent()->Owner()->operations.Add(operation);
+			fPendingOperations--;
+			continue;
+		}
+
+		// notify request and remove operation
+		IORequest* request = operation->Parent();
+
+		generic_size_t operationOffset
+			= operation->OriginalOffset() - request->Offset();
+		request->OperationFinished(operation, operation->Status(),
+			operation->TransferredBytes() < operation->OriginalLength(),
+			operation->Status() == B_OK
+				? operationOffset + operation->OriginalLength()
+				: operationOffset);
+
+		// recycle the operation
+		MutexLocker _(fLock);
+		if (fDMAResource != NULL)
+			fDMAResource->RecycleBuffer(operation->Buffer());
+
+		fPendingOperations--;
+		fUnusedOperations.Add(operation);
+
+		// If the request is done, we need to perform its notifications.
+		if (request->IsFinished()) {
+			if (request->Status() == B_OK && request->RemainingBytes() > 0) {
+				// The request has been processed OK so far, but it isn't really
+				// finished yet.
+				request->SetUnfinished();
+			} else {
+				// Remove the request from the request owner. If it failed, it
+				// might still be queued.
+				RequestOwner* owner
+					= static_cast<RequestOwner*>(request->Owner());
+				if (owner->completed_requests.Contains(request))
+					owner->completed_requests.Remove(request);
+				else {
+					owner->Requests(request->IsWrite()).Remove(request);
+					if (request->IsWrite())
+						fPendingWrites--;
+					else
+						fPendingReads--;
+				}
+				request->SetOwner(NULL);
+
+				_RequestOwnerIdle(owner);
+
+				if (request->HasCallbacks()) {
+					// The request has callbacks that may take some time to
+					// perform, so we hand it over to the request notifier.
+					fFinishedRequests.Add(request);
+					fFinishedRequestCondition.NotifyAll();
+				} else {
+					// No callbacks -- finish the request right now.
+					IOSchedulerRoster::Default()->Notify(
+						IO_SCHEDULER_REQUEST_FINISHED, this, request);
+					request->NotifyFinished();
+				}
+			}
+		}
+	}
+}
+
+
+/*!	Called with \c fFinisherLock held.
+*/
+bool
+IOSchedulerDeadline::_FinisherWorkPending()
+{
+	return !fCompletedOperations.IsEmpty();
+}
+
+
+/*!	Waits until there are requests or unfinished operations to schedule.
+	Called with \c fLock held; it will be unlocked while waiting.
+	Returns \c false when the scheduler is being terminated.
+*/
+bool
+IOSchedulerDeadline::_WaitForWork()
+{
+	while (true) {
+		if (fTerminating)
+			return false;
+
+		if (fPendingReads > 0 || fPendingWrites > 0)
+			return true;
+
+		for (RequestOwnerList::Iterator it = fActiveRequestOwners.GetIterator();
+				RequestOwner* owner = it.Next();) {
+			if (!owner->operations.IsEmpty())
+				return true;
+		}
+
+		// First check whether any finisher work has to be done.
+		InterruptsSpinLocker finisherLocker(fFinisherLock);
+		if (_FinisherWorkPending()) {
+			finisherLocker.Unlock();
+			mutex_unlock(&fLock);
+			_Finisher();
+			mutex_lock(&fLock);
+			continue;
+		}
+
+		// Wait for new requests.
+		ConditionVariableEntry entry;
+		fNewRequestCondition.Add(&entry);
+
+		finisherLocker.Unlock();
+		mutex_unlock(&fLock);
+
+		entry.Wait(B_CAN_INTERRUPT);
+		_Finisher();
+		mutex_lock(&fLock);
+	}
+}
+
+
+/*!	Decides whether the next batch should contain reads or writes. Reads are
+	preferred, unless a write request has passed its deadline, or writes have
+	been waiting for too many batches.
+	Returns \c true for writes.
+*/
+bool
+IOSchedulerDeadline::_ChooseDirection(bigtime_t now)
+{
+	if (fPendingWrites == 0)
+		return false;
+
+	if (fPendingReads == 0 || fStarvedWriteBatches >= kMaxStarvedWriteBatches
+		|| (_HasExpiredRequest(true, now) && !_HasExpiredRequest(false, now))) {
+		fStarvedWriteBatches = 0;
+		return true;
+	}
+
+	fStarvedWriteBatches++;
+	return false;
+}
+
+
+bool
+IOSchedulerDeadline::_HasExpiredRequest(bool write, bigtime_t now) const
+{
+	for (RequestOwnerList::ConstIterator it
+				= fActiveRequestOwners.GetIterator();
+			const RequestOwner* owner = it.Next();) {
+		const IORequest* request = write
+			? owner->write_requests.Head() : owner->requests.Head();
+		if (request != NULL && request->QueuedTime() != 0
+			&& _Deadline(owner, request) <= now) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*!	Returns the time the request should have been started at the latest.
+	The base deadline is scaled with the I/O priority of the request's owner,
+	such that a lower priority results in a longer deadline.
+*/
+bigtime_t
+IOSchedulerDeadline::_Deadline(const RequestOwner* owner,
+	const IORequest* request) const
+{
+	bigtime_t deadline = request->IsWrite() ? fWriteDeadline : fReadDeadline;
+	int32 priority = std::max(owner->priority,
+		(int32)B_LOWEST_ACTIVE_PRIORITY);
+
+	bigtime_t scaledDeadline = deadline * B_NORMAL_PRIORITY / priority;
+	scaledDeadline = std::max(scaledDeadline, deadline / 4);
+	scaledDeadline = std::min(scaledDeadline, deadline * 4);
+
+	return request->QueuedTime() + scaledDeadline;
+}
+
+
+/*!	Selects the request that should be served next in the given direction:
+	the request with the earliest expired deadline, if there is any, or the
+	first request of the owner that has received the least service in
+	relation to its priority so far.
+*/
+bool
+IOSchedulerDeadline::_NextRequest(bool write, bigtime_t now,
+	RequestOwner*& _owner, IORequest*& _request)
+{
+	RequestOwner* expiredOwner = NULL;
+	RequestOwner* fairOwner = NULL;
+	bigtime_t earliestDeadline = 0;
+
+	for (RequestOwnerList::Iterator it = fActiveRequestOwners.GetIterator();
+			RequestOwner* owner = it.Next();) {
+		IORequest* request = owner->Requests(write).Head();
+		if (request == NULL)
+			continue;
+
+		// only requests that haven't been started yet can expire
+		if (request->QueuedTime() != 0) {
+			bigtime_t deadline = _Deadline(owner, request);
+			if (deadline <= now
+				&& (expiredOwner == NULL || deadline < earliestDeadline)) {
+				expiredOwner = owner;
+				earliestDeadline = deadline;
+			}
+		}
+
+		if (fairOwner == NULL || owner->virtual_time < fairOwner->virtual_time)
+			fairOwner = owner;
+	}
+
+	if (expiredOwner != NULL) {
+		fExpiredRequests++;
+		_owner = expiredOwner;
+	} else if (fairOwner != NULL)
+		_owner = fairOwner;
+	else
+		return false;
+
+	_request = _owner->Requests(write).Head();
+	return true;
+}
+
+
+/*!	Looks for a request of any owner that starts exactly where the previous
+	one ended, so that they can be passed to the device in one go.
+*/
+IORequest*
+IOSchedulerDeadline::_NextAdjacentRequest(bool write, off_t offset,
+	RequestOwner*& _owner)
+{
+	for (RequestOwnerList::Iterator it = fActiveRequestOwners.GetIterator();
+			RequestOwner* owner = it.Next();) {
+		IORequest* request = owner->Requests(write).Head();
+		if (request != NULL && request->QueuedTime() != 0
+			&& request->Offset() == offset) {
+			_owner = owner;
+			return request;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*!	Accounts the bandwidth to the owner's virtual time. The more important
+	the owner is, the slower its virtual time advances.
+*/
+void
+IOSchedulerDeadline::_ChargeRequestOwner(RequestOwner* owner, off_t bandwidth)
+{
+	// The virtual time of the scheduler is the start time of the request
+	// being served.
+	fVirtualTime = std::max(fVirtualTime, owner->virtual_time);
+
+	int32 weight = std::max(owner->priority, (int32)B_LOWEST_ACTIVE_PRIORITY);
+	owner->virtual_time += bandwidth * B_NORMAL_PRIORITY / weight;
+}
+
+
+/*!	Records the queueing latency of the request, if its first operation is
+	about to be prepared.
+*/
+void
+IOSchedulerDeadline::_RequestDispatched(IORequest* request, bigtime_t now)
+{
+	if (request->QueuedTime() == 0)
+		return;
+
+	bigtime_t latency = now - request->QueuedTime();
+	request->SetQueuedTime(0);
+
+	if (request->IsWrite())
+		fWriteLatency.Add(latency);
+	else
+		fReadLatency.Add(latency);
+
+	TRACE("IOSchedulerDeadline: request %p waited %Ld us\n", request, latency);
+}
+
+
+status_t
+IOSchedulerDeadline::_Scheduler()
+{
+	off_t lastOffset = 0;
+
+	while (!fTerminating) {
+		MutexLocker locker(fLock);
+
+		if (!_WaitForWork()) {
+			// we've been asked to terminate
+			return B_OK;
+		}
+
+		bigtime_t now = system_time();
+		bool write = _ChooseDirection(now);
+
+		IOOperationList operations;
+		int32 operationCount = 0;
+		bool resourcesAvailable = true;
+		off_t iterationBandwidth = fIterationBandwidth;
+
+		// There might still be unfinished operations, they come first.
+		for (RequestOwnerList::Iterator it = fActiveRequestOwners.GetIterator();
+				RequestOwner* owner = it.Next();) {
+			while (IOOperation* operation = owner->operations.RemoveHead()) {
+				operations.Add(operation);
+				operationCount++;
+				iterationBandwidth -= operation->Length();
+				_ChargeRequestOwner(owner, operation->Length());
+			}
+		}
+
+		while (resourcesAvailable && iterationBandwidth >= (off_t)fBlockSize) {
+			RequestOwner* owner;
+			IORequest* request;
+			if (!_NextRequest(write, now, owner, request))
+				break;
+
+			off_t quantum = std::min(fOwnerQuantum, iterationBandwidth);
+
+			// Serve the request, and any request of the same direction that
+			// directly follows it, no matter who it belongs to.
+			while (request != NULL) {
+				_RequestDispatched(request, now);
+
+				off_t bandwidth = 0;
+				status_t status = _PrepareRequestOperations(request,
+					operations, operationCount, quantum, bandwidth);
+				resourcesAvailable = status != B_BUSY;
+				quantum -= bandwidth;
+				iterationBandwidth -= bandwidth;
+				_ChargeRequestOwner(owner, bandwidth);
+
+				if (status != B_OK && status != B_BUSY) {
+					// the owner might be gone now
+					_AbortRequest(request, status);
+					break;
+				}
+
+				if (request->RemainingBytes() > 0 && request->Status() > 0)
+					break;
+
+				// The request has been completely scheduled, move it to the
+				// completed list, so we don't pick it up again.
+				owner->Requests(write).Remove(request);
+				owner->completed_requests.Add(request);
+				if (write)
+					fPendingWrites--;
+				else
+					fPendingReads--;
+
+				if (!resourcesAvailable || quantum < (off_t)fBlockSize)
+					break;
+
+				request = _NextAdjacentRequest(write,
+					request->Offset() + request->Length(), owner);
+				if (request != NULL)
+					fMergedRequests++;
+			}
+		}
+
+		if (operations.IsEmpty())
+			continue;
+
+		fPendingOperations = operationCount;
+
+		locker.Unlock();
+
+		// sort the operations
+		_SortOperations(operations, lastOffset);
+
+		// execute the operations
+		while (IOOperation* operation = operations.RemoveHead()) {
+			TRACE("IOSchedulerDeadline::_Scheduler(): calling callback for "
+				"operation: %p\n", operation);
+
+			IOSchedulerRoster::Default()->Notify(IO_SCHEDULER_OPERATION_STARTED,
+				this, operation->Parent(), operation);
+
+			fIOCallback(fIOCallbackData, operation);
+
+			_Finisher();
+		}
+
+		// wait for all operations to finish
+		while (!fTerminating) {
+			locker.Lock();
+
+			if (fPendingOperations == 0)
+				break;
+
+			// Before waiting first check whether any finisher work has to be
+			// done.
+			InterruptsSpinLocker finisherLocker(fFinisherLock);
+			if (_FinisherWorkPending()) {
+				finisherLocker.Unlock();
+				locker.Unlock();
+				_Finisher();
+				continue;
+			}
+
+			// wait for finished operations
+			ConditionVariableEntry entry;
+			fFinishedOperationCondition.Add(&entry);
+
+			finisherLocker.Unlock();
+			locker.Unlock();
+
+			entry.Wait(B_CAN_INTERRUPT);
+			_Finisher();
+		}
+	}
+
+	return B_OK;
+}
+
+
+/*static*/ status_t
+IOSchedulerDeadline::_SchedulerThread(void *_self)
+{
+	IOSchedulerDeadline *self = (IOSchedulerDeadline *)_self;
+	return self->_Scheduler();
+}
+
+
+status_t
+IOSchedulerDeadline::_RequestNotifier()
+{
+	while (true) {
+		MutexLocker locker(fLock);
+
+		// get a request
+		IORequest* request = fFinishedRequests.RemoveHead();
+
+		if (request == NULL) {
+			if (fTerminating)
+				return B_OK;
+
+			ConditionVariableEntry entry;
+			fFinishedRequestCondition.Add(&entry);
+
+			locker.Unlock();
+
+			entry.Wait();
+			continue;
+		}
+
+		locker.Unlock();
+
+		IOSchedulerRoster::Default()->Notify(IO_SCHEDULER_REQUEST_FINISHED,
+			this, request);
+
+		// notify the request
+		request->NotifyFinished();
+	}
+
+	// never can get here
+	return B_OK;
+}
+
+
+/*static*/ status_t
+IOSchedulerDeadline::_RequestNotifierThread(void *_self)
+{
+	IOSchedulerDeadline *self = (IOSchedulerDeadline*)_self;
+	return self->_RequestNotifier();
+}
+
+
+/*!	Fails \a request with \a status. Operations that have already been
+	prepared for it are still executed; the request is completed when the
+	last of them has finished. Otherwise, it is handed to the request
+	notifier right away.
+	Must be called with \c fLock held.
+*/
+void
+IOSchedulerDeadline::_AbortRequest(IORequest* request, status_t status)
+{
+	RequestOwner* owner = static_cast<RequestOwner*>(request->Owner());
+	if (owner == NULL)
+		return;
+
+	TRACE("IOSchedulerDeadline::_AbortRequest(%p, %#" B_PRIx32 ")\n", request,
+		status);
+
+	request->SetFailed(status);
+
+	if (owner->completed_requests.Contains(request))
+		owner->completed_requests.Remove(request);
+	else {
+		owner->Requests(request->IsWrite()).Remove(request);
+		if (request->IsWrite())
+			fPendingWrites--;
+		else
+			fPendingReads--;
+	}
+
+	if (!request->IsFinished()) {
+		// _Finisher() will complete it
+		owner->completed_requests.Add(request);
+		return;
+	}
+
+	request->SetOwner(NULL);
+	_RequestOwnerIdle(owner);
+
+	fFinishedRequests.Add(request);
+	fFinishedRequestCondition.NotifyAll();
+}
+
+
+/*!	Returns the request owner for the given team, and allocates one, if
+	there is none yet. Called with \c fLock held.
+*/
+IOSchedulerDeadline::RequestOwner*
+IOSchedulerDeadline::_GetRequestOwner(team_id team)
+{
+	// lookup in table
+	RequestOwner* owner = fRequestOwners->Lookup(team);
+	if (owner != NULL) {
+		if (!owner->IsActive())
+			fUnusedRequestOwners.Remove(owner);
+		return owner;
+	}
+
+	// not in table -- use the owner that has been unused the longest
+	owner = fUnusedRequestOwners.RemoveHead();
+	if (owner == NULL)
+		return NULL;
+
+	if (owner->team >= 0)
+		fRequestOwners->RemoveUnchecked(owner);
+
+	owner->team = team;
+	owner->priority = B_IDLE_PRIORITY;
+	owner->virtual_time = fVirtualTime;
+	fRequestOwners->InsertUnchecked(owner);
+
+	return owner;
+}
+
+
+/*!	Moves the owner to the unused list, if it has nothing left to do.
+	Called with \c fLock held.
+*/
+void
+IOSchedulerDeadline::_RequestOwnerIdle(RequestOwner* owner)
+{
+	if (owner->IsActive())
+		return;
+
+	fActiveRequestOwners.Remove(owner);
+	fUnusedRequestOwners.Add(owner);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef IO_SCHEDULER_DEADLINE_H
+#define IO_SCHEDULER_DEADLINE_H
+
+
+#include <KernelExport.h>
+
+#include <condition_variable.h>
+#include <lock.h>
+#include <util/OpenHashTable.h>
+
+#include "dma_resources.h"
+#include "IOScheduler.h"
+
+
+/*!	An I/O scheduler that shares the device fairly between teams according to
+	their I/O priority, prefers reads over writes, and guarantees every
+	request a deadline after which it is served before anything else.
+*/
+class IOSchedulerDeadline : public IOScheduler {
+public:
+								IOSchedulerDeadline(DMAResource* resource);
+	virtual						~IOSchedulerDeadline();
+
+	virtual	status_t			Init(const char* name);
+
+	virtual	status_t			ScheduleRequest(IORequest* request);
+
+	virtual	void				AbortRequest(IORequest* request,
+									status_t status = B_CANCELED);
+	virtual	void				OperationCompleted(IOOperation* operation,
+									status_t status,
+									generic_size_t transferredBytes);
+									// called by the driver when the operation
+									// has been completed successfully or failed
+									// for some reason
+
+	virtual	void				Dump() const;
+
+private:
+			struct RequestOwner : IORequestOwner {
+				IORequestList	write_requests;
+				off_t			virtual_time;
+				RequestOwner*	team_link;
+				DoublyLinkedListLink<RequestOwner> owner_link;
+
+				IORequestList&	Requests(bool write)
+									{ return write
+										? write_requests : requests; }
+				bool			IsActive() const
+									{ return IORequestOwner::IsActive()
+										|| !write_requests.IsEmpty(); }
+			};
+
+			struct LatencyStatistics {
+				int64			count;
+				bigtime_t		total;
+				bigtime_t		max;
+				int64			histogram[5];
+					// < 1 ms, < 10 ms, < 100 ms, < 1 s, more
+
+				void			Add(bigtime_t latency);
+				void			Dump(const char* name) const;
+			};
+
+			struct RequestOwnerHashDefinition;
+			struct RequestOwnerHashTable;
+
+			typedef DoublyLinkedList<RequestOwner,
+				DoublyLinkedListMemberGetLink<RequestOwner,
+					&RequestOwner::owner_link> > RequestOwnerList;
+
+			void				_Finisher();
+			bool				_FinisherWorkPending();
+			bool				_WaitForWork();
+			bool				_ChooseDirection(bigtime_t now);
+			bool				_HasExpiredRequest(bool write,
+									bigtime_t now) const;
+			bigtime_t			_Deadline(const RequestOwner* owner,
+									const IORequest* request) const;
+			bool				_NextRequest(bool write, bigtime_t now,
+									RequestOwner*& _owner,
+									IORequest*& _request);
+			IORequest*			_NextAdjacentRequest(bool write, off_t offset,
+									RequestOwner*& _owner);
+			void				_ChargeRequestOwner(RequestOwner* owner,
+									off_t bandwidth);
+			void				_RequestDispatched(IORequest* request,
+									bigtime_t now);
+			status_t			_Scheduler();
+	static	status_t			_SchedulerThread(void* self);
+			status_t			_RequestNotifier();
+	static	status_t			_RequestNotifierThread(void* self);
+
+			void				_AbortRequest(IORequest* request,
+									status_t status);
+
+			RequestOwner*		_GetRequestOwner(team_id team);
+			void				_RequestOwnerIdle(RequestOwner* owner);
+
+private:
+			spinlock			fFinisherLock;
+			mutex				fLock;
+			thread_id			fSchedulerThread;
+			thread_id			fRequestNotifierThread;
+			IORequestList		fFinishedRequests;
+			ConditionVariable	fNewRequestCondition;
+			ConditionVariable	fFinishedOperationCondition;
+			ConditionVariable	fFinishedRequestCondition;
+			IOOperationList		fCompletedOperations;
+			RequestOwner*		fAllocatedRequestOwners;
+			int32				fAllocatedRequestOwnerCount;
+			RequestOwnerList	fActiveRequestOwners;
+			RequestOwnerList	fUnusedRequestOwners;
+			RequestOwnerHashTable* fRequestOwners;
+			int32				fPendingOperations;
+			int32				fPendingReads;
+			int32				fPendingWrites;
+			int32				fStarvedWriteBatches;
+			off_t				fVirtualTime;
+			off_t				fIterationBandwidth;
+			off_t				fOwnerQuantum;
+			bigtime_t			fReadDeadline;
+			bigtime_t			fWriteDeadline;
+			LatencyStatistics	fReadLatency;
+			LatencyStatistics	fWriteLatency;
+			int64				fMergedRequests;
+			int64				fExpiredRequests;
+	volatile bool				fTerminating;
+};
+
+
+#endif	// IO_SCHEDULER_DEADLINE_H
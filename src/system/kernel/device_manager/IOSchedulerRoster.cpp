@@ -1,13 +1,28 @@
 /*
  * Copyright 2009-2010, Ingo Weinhold, ingo_weinhold@gmx.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Distributed under the terms of the MIT License.
  */
 
 
 #include "IOSchedulerRoster.h"
 
+#include <new>
+#include <string.h>
+
+#include <driver_settings.h>
 #include <util/AutoLock.h>
 
+#include "IOSchedulerDeadline.h"
+#include "IOSchedulerSimple.h"
+
+
+enum {
+	SCHEDULER_TYPE_UNKNOWN = 0,
+	SCHEDULER_TYPE_SIMPLE,
+	SCHEDULER_TYPE_DEADLINE
+};
+
 
 /*static*/ IOSchedulerRoster IOSchedulerRoster::sDefaultInstance;
 
@@ -72,10 +87,44 @@ IOSchedulerRoster::NextID()
 }
 
 
+/*!	Creates a new I/O scheduler for the given DMA resource. The type of the
+	scheduler can be chosen with the "io_scheduler" setting in the kernel
+	settings file; "simple" (the default) and "deadline" are supported.
+	The caller is responsible for initializing the scheduler.
+*/
+IOScheduler*
+IOSchedulerRoster::CreateScheduler(DMAResource* resource)
+{
+	AutoLocker<IOSchedulerRoster> locker(this);
+
+	if (fSchedulerType == SCHEDULER_TYPE_UNKNOWN) {
+		fSchedulerType = SCHEDULER_TYPE_SIMPLE;
+
+		void* handle = load_driver_settings("kernel");
+		if (handle != NULL) {
+			const char* type = get_driver_parameter(handle, "io_scheduler",
+				NULL, NULL);
+			if (type != NULL && strcmp(type, "deadline") == 0)
+				fSchedulerType = SCHEDULER_TYPE_DEADLINE;
+
+			unload_driver_settings(handle);
+		}
+	}
+
+	locker.Unlock();
+
+	if (fSchedulerType == SCHEDULER_TYPE_DEADLINE)
+		return new(std::nothrow) IOSchedulerDeadline(resource);
+
+	return new(std::nothrow) IOSchedulerSimple(resource);
+}
+
+
 IOSchedulerRoster::IOSchedulerRoster()
 	:
 	fNextID(1),
-	fNotificationService("I/O")
+	fNotificationService("I/O"),
+	fSchedulerType(SCHEDULER_TYPE_UNKNOWN)
 {
 	mutex_init(&fLock, "IOSchedulerRoster");
 }
@@ -1,5 +1,6 @@
 /*
  * Copyright 2009-2010, Ingo Weinhold, ingo_weinhold@gmx.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Distributed under the terms of the MIT License.
  */
 #ifndef IO_SCHEDULER_ROSTER_H
@@ -48,6 +49,10 @@ public:
 
 			int32				NextID();
 
+			IOScheduler*		CreateScheduler(DMAResource* resource);
+									// returns an uninitialized scheduler of
+									// the type chosen in the kernel settings
+
 private:
 								IOSchedulerRoster();
 								~IOSchedulerRoster();
@@ -58,6 +63,7 @@ private:
 			IOSchedulerList		fSchedulers;
 			DefaultNotificationService fNotificationService;
 			char				fEventBuffer[256];
+			int32				fSchedulerType;
 
 	static	IOSchedulerRoster	sDefaultInstance;
 };
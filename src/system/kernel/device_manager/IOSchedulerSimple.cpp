@@ -90,10 +90,8 @@ IOSchedulerSimple::IOSchedulerSimple(DMAResource* resource)
 	IOScheduler(resource),
 	fSchedulerThread(-1),
 	fRequestNotifierThread(-1),
-	fOperationArray(NULL),
 	fAllocatedRequestOwners(NULL),
 	fRequestOwners(NULL),
-	fBlockSize(0),
 	fPendingOperations(0),
 	fTerminating(false)
 {
@@ -131,11 +129,6 @@ IOSchedulerSimple::~IOSchedulerSimple()
 	mutex_lock(&fLock);
 	mutex_destroy(&fLock);
 
-	while (IOOperation* operation = fUnusedOperations.RemoveHead())
-		delete operation;
-
-	delete[] fOperationArray;
-
 	delete fRequestOwners;
 	delete[] fAllocatedRequestOwners;
 }
@@ -148,21 +141,9 @@ IOSchedulerSimple::Init(const char* name)
 	if (error != B_OK)
 		return error;
 
-	size_t count = fDMAResource != NULL ? fDMAResource->BufferCount() : 16;
-	for (size_t i = 0; i < count; i++) {
-		IOOperation* operation = new(std::nothrow) IOOperation;
-		if (operation == NULL)
-			return B_NO_MEMORY;
-
-		fUnusedOperations.Add(operation);
-	}
-
-	fOperationArray = new(std::nothrow) IOOperation*[count];
-
-	if (fDMAResource != NULL)
-		fBlockSize = fDMAResource->BlockSize();
-	if (fBlockSize == 0)
-		fBlockSize = 512;
+	error = _InitOperations();
+	if (error != B_OK)
+		return error;
 
 	fAllocatedRequestOwnerCount = thread_max_threads();
 	fAllocatedRequestOwners
@@ -277,8 +258,8 @@ IOSchedulerSimple::ScheduleRequest(IORequest* request)
 void
 IOSchedulerSimple::AbortRequest(IORequest* request, status_t status)
 {
-	// TODO:...
-//B_CANCELED
+	MutexLocker _(fLock);
+	_AbortRequest(request, status);
 }
 
 
@@ -414,71 +395,44 @@ IOSchedulerSimple::_FinisherWorkPending()
 }
 
 
-bool
-IOSchedulerSimple::_PrepareRequestOperations(IORequest* request,
-	IOOperationList& operations, int32& operationsPrepared, off_t quantum,
-	off_t& usedBandwidth)
+/*!	Fails \a request with \a status. Operations that have already been
+	prepared for it are still executed; the request is completed when the
+	last of them has finished. Otherwise, it is handed to the request
+	notifier right away.
+	Must be called with \c fLock held.
+*/
+void
+IOSchedulerSimple::_AbortRequest(IORequest* request, status_t status)
 {
-//dprintf("IOSchedulerSimple::_PrepareRequestOperations(%p)\n", request);
-	usedBandwidth = 0;
-
-	if (fDMAResource != NULL) {
-		while (quantum >= (off_t)fBlockSize && request->RemainingBytes() > 0) {
-			IOOperation* operation = fUnusedOperations.RemoveHead();
-			if (operation == NULL)
-				return false;
-
-			status_t status = fDMAResource->TranslateNext(request, operation,
-				quantum);
-			if (status != B_OK) {
-				operation->SetParent(NULL);
-				fUnusedOperations.Add(operation);
-
-				// B_BUSY means some resource (DMABuffers or
-				// DMABounceBuffers) was temporarily unavailable. That's OK,
-				// we'll retry later.
-				if (status == B_BUSY)
-					return false;
-
-				AbortRequest(request, status);
-				return true;
-			}
-//dprintf("  prepared operation %p\n", operation);
+	IORequestOwner* owner = request->Owner();
+	if (owner == NULL)
+		return;
 
-			off_t bandwidth = operation->Length();
-			quantum -= bandwidth;
-			usedBandwidth += bandwidth;
+	TRACE("IOSchedulerSimple::_AbortRequest(%p, %#" B_PRIx32 ")\n", request,
+		status);
 
-			operations.Add(operation);
-			operationsPrepared++;
-		}
-	} else {
-		// TODO: If the device has block size restrictions, we might need to use
-		// a bounce buffer.
-		IOOperation* operation = fUnusedOperations.RemoveHead();
-		if (operation == NULL)
-			return false;
+	request->SetFailed(status);
 
-		status_t status = operation->Prepare(request);
-		if (status != B_OK) {
-			operation->SetParent(NULL);
-			fUnusedOperations.Add(operation);
-			AbortRequest(request, status);
-			return true;
-		}
+	if (owner->completed_requests.Contains(request))
+		owner->completed_requests.Remove(request);
+	else
+		owner->requests.Remove(request);
 
-		operation->SetOriginalRange(request->Offset(), request->Length());
-		request->Advance(request->Length());
+	if (!request->IsFinished()) {
+		// _Finisher() will complete it
+		owner->completed_requests.Add(request);
+		return;
+	}
 
-		off_t bandwidth = operation->Length();
-		quantum -= bandwidth;
-		usedBandwidth += bandwidth;
+	request->SetOwner(NULL);
 
-		operations.Add(operation);
-		operationsPrepared++;
+	if (!owner->IsActive()) {
+		fActiveRequestOwners.Remove(owner);
+		fUnusedRequestOwners.Add(owner);
 	}
 
-	return true;
+	fFinishedRequests.Add(request);
+	fFinishedRequestCondition.NotifyAll();
 }
 
 
@@ -533,60 +487,6 @@ IOSchedulerSimple::_NextActiveRequestOwner(IORequestOwner*& owner,
 }
 
 
-struct OperationComparator {
-	inline bool operator()(const IOOperation* a, const IOOperation* b)
-	{
-		off_t offsetA = a->Offset();
-		off_t offsetB = b->Offset();
-		return offsetA < offsetB
-			|| (offsetA == offsetB && a->Length() > b->Length());
-	}
-};
-
-
-void
-IOSchedulerSimple::_SortOperations(IOOperationList& operations,
-	off_t& lastOffset)
-{
-// TODO: _Scheduler() could directly add the operations to the array.
-	// move operations to an array and sort it
-	int32 count = 0;
-	while (IOOperation* operation = operations.RemoveHead())
-		fOperationArray[count++] = operation;
-
-	std::sort(fOperationArray, fOperationArray + count, OperationComparator());
-
-	// move the sorted operations to a temporary list we can work with
-//dprintf("operations after sorting:\n");
-	IOOperationList sortedOperations;
-	for (int32 i = 0; i < count; i++)
-//{
-//dprintf("  %3ld: %p: offset: %lld, length: %lu\n", i, fOperationArray[i], fOperationArray[i]->Offset(), fOperationArray[i]->Length());
-		sortedOperations.Add(fOperationArray[i]);
-//}
-
-	// Sort the operations so that no two adjacent operations overlap. This
-	// might result in several elevator runs.
-	while (!sortedOperations.IsEmpty()) {
-		IOOperation* operation = sortedOperations.Head();
-		while (operation != NULL) {
-			IOOperation* nextOperation = sortedOperations.GetNext(operation);
-			if (operation->Offset() >= lastOffset) {
-				sortedOperations.Remove(operation);
-//dprintf("  adding operation %p\n", operation);
-				operations.Add(operation);
-				lastOffset = operation->Offset() + operation->Length();
-			}
-
-			operation = nextOperation;
-		}
-
-		if (!sortedOperations.IsEmpty())
-			lastOffset = 0;
-	}
-}
-
-
 status_t
 IOSchedulerSimple::_Scheduler()
 {
@@ -611,7 +511,12 @@ IOSchedulerSimple::_Scheduler()
 		bool resourcesAvailable = true;
 		off_t iterationBandwidth = fIterationBandwidth;
 
-		if (owner == NULL) {
+		if (owner != NULL && !owner->IsActive()) {
+			// The owner's remaining requests have been finished in the
+			// meantime, and it has been removed from the active list.
+			owner = NULL;
+			quantum = 0;
+		} else if (owner == NULL) {
 			owner = fActiveRequestOwners.GetPrevious(&marker);
 			quantum = 0;
 			fActiveRequestOwners.Remove(&marker);
@@ -659,11 +564,17 @@ panic("no more requests for owner %p (thread %ld)", owner, owner->thread);
 				}
 
 				off_t bandwidth = 0;
-				resourcesAvailable = _PrepareRequestOperations(request,
+				status_t status = _PrepareRequestOperations(request,
 					operations, operationCount, quantum, bandwidth);
+				resourcesAvailable = status != B_BUSY;
 				quantum -= bandwidth;
 				iterationBandwidth -= bandwidth;
-				if (request->RemainingBytes() == 0 || request->Status() <= 0) {
+				if (status != B_OK && status != B_BUSY) {
+					_AbortRequest(request, status);
+					if (!owner->IsActive())
+						break;
+				} else if (request->RemainingBytes() == 0
+					|| request->Status() <= 0) {
 					// If the request has been completed, move it to the
 					// completed list, so we don't pick it up again.
 					owner->requests.Remove(request);
@@ -671,15 +582,22 @@ panic("no more requests for owner %p (thread %ld)", owner, owner->thread);
 				}
 			}
 
-			// Get the next owner.
+			// Get the next owner. If we have just aborted the last request of
+			// the current one, it isn't in the list anymore.
+			if (!owner->IsActive())
+				break;
 			if (resourcesAvailable)
 				_NextActiveRequestOwner(owner, quantum);
 		}
 
 		// If the current owner doesn't have anymore requests, we have to
 		// insert our marker, since the owner will be gone in the next
-		// iteration.
-		if (owner->requests.IsEmpty()) {
+		// iteration. If it is gone already, we start over at the head of the
+		// list.
+		if (!owner->IsActive()) {
+			fActiveRequestOwners.Add(&marker, false);
+			owner = NULL;
+		} else if (owner->requests.IsEmpty()) {
 			fActiveRequestOwners.Insert(owner, &marker);
 			owner = NULL;
 		}
@@ -49,15 +49,8 @@ private:
 									int32 priority) const;
 			bool				_NextActiveRequestOwner(IORequestOwner*& owner,
 									off_t& quantum);
-			bool				_PrepareRequestOperations(IORequest* request,
-									IOOperationList& operations,
-									int32& operationsPrepared);
-			bool				_PrepareRequestOperations(IORequest* request,
-									IOOperationList& operations,
-									int32& operationsPrepared, off_t quantum,
-									off_t& usedBandwidth);
-			void				_SortOperations(IOOperationList& operations,
-									off_t& lastOffset);
+			void				_AbortRequest(IORequest* request,
+									status_t status);
 			status_t			_Scheduler();
 	static	status_t			_SchedulerThread(void* self);
 			status_t			_RequestNotifier();
@@ -77,15 +70,12 @@ private:
 			ConditionVariable	fNewRequestCondition;
 			ConditionVariable	fFinishedOperationCondition;
 			ConditionVariable	fFinishedRequestCondition;
-			IOOperation**		fOperationArray;
-			IOOperationList		fUnusedOperations;
 			IOOperationList		fCompletedOperations;
 			IORequestOwner*		fAllocatedRequestOwners;
 			int32				fAllocatedRequestOwnerCount;
 			RequestOwnerList	fActiveRequestOwners;
 			RequestOwnerList	fUnusedRequestOwners;
 			RequestOwnerHashTable* fRequestOwners;
-			generic_size_t		fBlockSize;
 			int32				fPendingOperations;
 			off_t				fIterationBandwidth;
 			off_t				fMinOwnerBandwidth;
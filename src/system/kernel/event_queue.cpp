@@ -0,0 +1,588 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+/*!	Event queues are persistent interest sets for wait_for_objects()-style
+	waiting: objects are added once, and only those that became ready are
+	returned when waiting on the queue.
+
+	Every object in a queue is represented by an event_queue_entry that
+	contains its own select_info and select_sync. The object keeps that
+	select_info in its list (or select_sync_pool) as long as the entry
+	exists, and notify_select_events() hands it over to notify_event_queue(),
+	which puts the entry into the queue's ready list. Waiting therefore only
+	costs as much as there are ready objects, independent of how many objects
+	are in the queue.
+*/
+
+
+#include <event_queue.h>
+
+#include <new>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AutoDeleter.h>
+
+#include <fs/fd.h>
+#include <lock.h>
+#include <syscall_restart.h>
+#include <util/AutoLock.h>
+#include <util/DoublyLinkedList.h>
+#include <util/OpenHashTable.h>
+#include <wait_for_objects.h>
+
+
+//#define TRACE_EVENT_QUEUE
+#ifdef TRACE_EVENT_QUEUE
+#	define TRACE(x) dprintf x
+#else
+#	define TRACE(x) ;
+#endif
+
+
+static const uint16 kAlwaysSelectedEvents
+	= B_EVENT_INVALID | B_EVENT_ERROR | B_EVENT_DISCONNECTED;
+
+
+struct event_queue_entry {
+	select_info			info;
+		// must be the first member, see notify_event_queue()
+	select_sync			sync;
+	DoublyLinkedListLink<event_queue_entry> link;
+	event_queue_entry*	hash_link;
+	void*				user_data;
+	int32				object;
+	uint16				type;
+	uint16				flags;
+	uint16				events;
+	bool				queued;
+	bool				removed;
+};
+
+
+static inline uint64
+event_queue_key(uint16 type, int32 object)
+{
+	return ((uint64)type << 32) | (uint32)object;
+}
+
+
+struct EventQueueHashDefinition {
+	typedef uint64 KeyType;
+	typedef event_queue_entry ValueType;
+
+	size_t HashKey(uint64 key) const
+	{
+		return (size_t)(key ^ (key >> 32)) * 2654435761UL;
+	}
+
+	size_t Hash(event_queue_entry* entry) const
+	{
+		return HashKey(event_queue_key(entry->type, entry->object));
+	}
+
+	bool Compare(uint64 key, event_queue_entry* entry) const
+	{
+		return key == event_queue_key(entry->type, entry->object);
+	}
+
+	event_queue_entry*& GetLink(event_queue_entry* entry) const
+	{
+		return entry->hash_link;
+	}
+};
+
+
+typedef BOpenHashTable<EventQueueHashDefinition> EventQueueTable;
+typedef DoublyLinkedList<event_queue_entry,
+	DoublyLinkedListMemberGetLink<event_queue_entry,
+		&event_queue_entry::link> > EventQueueEntryList;
+
+
+struct event_queue {
+	mutex				lock;
+		// protects the table, and the selection of the entries
+	spinlock			ready_lock;
+		// protects the ready list, and the queued/removed flags of the
+		// entries, since it is used from within notify_select_events()
+	EventQueueTable		table;
+	EventQueueEntryList	ready;
+	io_context*			context;
+	sem_id				sem;
+	vint32				ref_count;
+		// one reference for the file descriptor, and one per entry
+	bool				kernel;
+	bool				closed;
+};
+
+
+static void
+put_event_queue(event_queue* queue)
+{
+	if (atomic_add(&queue->ref_count, -1) != 1)
+		return;
+
+	TRACE(("put_event_queue(%p): deleting queue\n", queue));
+
+	mutex_destroy(&queue->lock);
+	delete queue;
+}
+
+
+/*!	Selects the entry's object again with the events it is interested in.
+	You must hold the lock of the entry's queue.
+*/
+static status_t
+select_entry(event_queue* queue, event_queue_entry* entry)
+{
+	entry->info.selected_events = entry->events | kAlwaysSelectedEvents;
+	entry->info.events = 0;
+
+	return select_object(entry->type, entry->object, &entry->info,
+		queue->kernel);
+}
+
+
+/*!	Releases the queue's reference to an entry that has already been removed
+	from its table. File descriptors are only deselected if \a deselectFDs is
+	\c true; otherwise, the entry stays around until the descriptor is closed.
+	You must hold the lock of the entry's queue.
+*/
+static void
+remove_entry(event_queue* queue, event_queue_entry* entry, bool deselectFDs)
+{
+	if (entry->type != B_OBJECT_TYPE_FD || deselectFDs) {
+		deselect_object(entry->type, entry->object, &entry->info,
+			queue->kernel);
+	}
+
+	InterruptsSpinLocker locker(queue->ready_lock);
+	entry->removed = true;
+	if (entry->queued) {
+		queue->ready.Remove(entry);
+		entry->queued = false;
+	}
+	locker.Unlock();
+
+	put_select_sync(&entry->sync);
+}
+
+
+static status_t
+select_events(event_queue* queue, event_wait_info& info)
+{
+	MutexLocker locker(queue->lock);
+	if (queue->closed)
+		return B_FILE_ERROR;
+
+	event_queue_entry* entry = queue->table.Lookup(
+		event_queue_key(info.type, info.object));
+
+	if (info.events == 0) {
+		if (entry == NULL)
+			return B_ENTRY_NOT_FOUND;
+
+		queue->table.RemoveUnchecked(entry);
+		remove_entry(queue, entry, true);
+		return B_OK;
+	}
+
+	if (entry != NULL) {
+		// change the events of an existing entry
+		deselect_object(entry->type, entry->object, &entry->info,
+			queue->kernel);
+
+		InterruptsSpinLocker readyLocker(queue->ready_lock);
+		if (entry->queued) {
+			queue->ready.Remove(entry);
+			entry->queued = false;
+		}
+		readyLocker.Unlock();
+
+		entry->flags = info.flags;
+		entry->events = info.events;
+		entry->user_data = info.user_data;
+
+		return select_entry(queue, entry);
+	}
+
+	entry = new(std::nothrow) event_queue_entry;
+	if (entry == NULL)
+		return B_NO_MEMORY;
+
+	entry->sync.ref_count = 1;
+		// the queue's reference
+	entry->sync.sem = queue->sem;
+	entry->sync.count = 1;
+	entry->sync.set = &entry->info;
+	entry->sync.queue = queue;
+	entry->info.next = NULL;
+	entry->info.sync = &entry->sync;
+	entry->user_data = info.user_data;
+	entry->object = info.object;
+	entry->type = info.type;
+	entry->flags = info.flags;
+	entry->events = info.events;
+	entry->queued = false;
+	entry->removed = false;
+
+	status_t status = select_entry(queue, entry);
+	if (status != B_OK) {
+		delete entry;
+		return status;
+	}
+
+	atomic_add(&queue->ref_count, 1);
+	queue->table.InsertUnchecked(entry);
+	return B_OK;
+}
+
+
+/*!	Moves up to \a count ready entries into \a infos, and returns how many
+	have been stored there. Level triggered entries are selected again, so
+	that they will be queued right away if their events are still pending.
+*/
+static int32
+collect_events(event_queue* queue, event_wait_info* infos, int32 count)
+{
+	MutexLocker locker(queue->lock);
+	if (queue->closed)
+		return B_FILE_ERROR;
+
+	EventQueueEntryList reselect;
+	int32 collected = 0;
+
+	InterruptsSpinLocker readyLocker(queue->ready_lock);
+
+	while (collected < count) {
+		event_queue_entry* entry = queue->ready.RemoveHead();
+		if (entry == NULL)
+			break;
+
+		uint16 events = atomic_set(&entry->info.events, 0)
+			& entry->info.selected_events;
+
+		if ((entry->flags & B_EVENT_LEVEL_TRIGGERED) != 0) {
+			// keep it marked as queued until it has been selected again
+			reselect.Add(entry);
+		} else
+			entry->queued = false;
+
+		if (events == 0) {
+			// the events have already been reported
+			continue;
+		}
+
+		event_wait_info& info = infos[collected++];
+		info.object = entry->object;
+		info.type = entry->type;
+		info.flags = entry->flags;
+		info.events = events;
+		info.user_data = entry->user_data;
+	}
+
+	readyLocker.Unlock();
+
+	while (event_queue_entry* entry = reselect.RemoveHead()) {
+		deselect_object(entry->type, entry->object, &entry->info,
+			queue->kernel);
+
+		readyLocker.Lock();
+		entry->queued = false;
+		readyLocker.Unlock();
+
+		// this fails if the object is gone, and then it won't be reported
+		// again
+		select_entry(queue, entry);
+	}
+
+	return collected;
+}
+
+
+static ssize_t
+wait_for_events(event_queue* queue, event_wait_info* infos, int32 count,
+	uint32 flags, bigtime_t timeout)
+{
+	while (true) {
+		int32 collected = collect_events(queue, infos, count);
+		if (collected != 0)
+			return collected;
+
+		// Nothing is ready yet; the semaphore is released whenever an entry
+		// is queued, so we might also be woken up for entries that have
+		// been collected already.
+		status_t status = acquire_sem_etc(queue->sem, 1,
+			B_CAN_INTERRUPT | flags, timeout);
+		if (status == B_BAD_SEM_ID)
+			return B_FILE_ERROR;
+		if (status != B_OK)
+			return status;
+	}
+}
+
+
+//	#pragma mark - file descriptor operations
+
+
+static status_t
+event_queue_close(struct file_descriptor* descriptor)
+{
+	event_queue* queue = (event_queue*)descriptor->cookie;
+
+	MutexLocker locker(queue->lock);
+
+	queue->closed = true;
+
+	// We might be called while the I/O context is locked, so file
+	// descriptors cannot be deselected here; those entries are released as
+	// soon as their descriptor is closed.
+	event_queue_entry* entry = queue->table.Clear(true);
+	while (entry != NULL) {
+		event_queue_entry* next = entry->hash_link;
+		remove_entry(queue, entry, false);
+		entry = next;
+	}
+
+	// wake up all waiting threads
+	delete_sem(queue->sem);
+
+	return B_OK;
+}
+
+
+static void
+event_queue_free(struct file_descriptor* descriptor)
+{
+	put_event_queue((event_queue*)descriptor->cookie);
+}
+
+
+static struct fd_ops sEventQueueFDOps = {
+	NULL,	// fd_read
+	NULL,	// fd_write
+	NULL,	// fd_seek
+	NULL,	// fd_ioctl
+	NULL,	// fd_set_flags
+	NULL,	// fd_select
+	NULL,	// fd_deselect
+	NULL,	// fd_read_dir
+	NULL,	// fd_rewind_dir
+	NULL,	// fd_read_stat
+	NULL,	// fd_write_stat
+	&event_queue_close,
+	&event_queue_free
+};
+
+
+static status_t
+get_event_queue(int fd, bool kernel, file_descriptor*& _descriptor,
+	event_queue*& _queue)
+{
+	io_context* context = get_current_io_context(kernel);
+
+	file_descriptor* descriptor = get_fd(context, fd);
+	if (descriptor == NULL)
+		return B_FILE_ERROR;
+
+	if (descriptor->type != FDTYPE_EVENT_QUEUE) {
+		put_fd(descriptor);
+		return B_BAD_VALUE;
+	}
+
+	event_queue* queue = (event_queue*)descriptor->cookie;
+	if (queue->context != context) {
+		// the objects are looked up in the context of the queue's creator
+		put_fd(descriptor);
+		return B_NOT_ALLOWED;
+	}
+
+	_descriptor = descriptor;
+	_queue = queue;
+	return B_OK;
+}
+
+
+static int
+create_event_queue(int openFlags, bool kernel)
+{
+	event_queue* queue = new(std::nothrow) event_queue;
+	if (queue == NULL)
+		return B_NO_MEMORY;
+	ObjectDeleter<event_queue> queueDeleter(queue);
+
+	status_t status = queue->table.Init();
+	if (status != B_OK)
+		return status;
+
+	queue->sem = create_sem(0, "event queue");
+	if (queue->sem < 0)
+		return queue->sem;
+
+	mutex_init(&queue->lock, "event queue");
+	B_INITIALIZE_SPINLOCK(&queue->ready_lock);
+	queue->context = get_current_io_context(kernel);
+	queue->ref_count = 1;
+	queue->kernel = kernel;
+	queue->closed = false;
+
+	file_descriptor* descriptor = alloc_fd();
+	if (descriptor == NULL) {
+		mutex_destroy(&queue->lock);
+		delete_sem(queue->sem);
+		return B_NO_MEMORY;
+	}
+
+	descriptor->type = FDTYPE_EVENT_QUEUE;
+	descriptor->ops = &sEventQueueFDOps;
+	descriptor->cookie = queue;
+	descriptor->open_mode = O_RDWR;
+
+	int fd = new_fd(queue->context, descriptor);
+	if (fd < 0) {
+		free(descriptor);
+		mutex_destroy(&queue->lock);
+		delete_sem(queue->sem);
+		return B_NO_MORE_FDS;
+	}
+
+	mutex_lock(&queue->context->io_mutex);
+	fd_set_close_on_exec(queue->context, fd, (openFlags & O_CLOEXEC) != 0);
+	mutex_unlock(&queue->context->io_mutex);
+
+	queueDeleter.Detach();
+	return fd;
+}
+
+
+//	#pragma mark - kernel private
+
+
+/*!	Called by notify_select_events() for entries of an event queue, possibly
+	with interrupts disabled. Puts the entry into the ready list of its queue,
+	if it isn't there already.
+*/
+status_t
+notify_event_queue(select_info* info)
+{
+	event_queue_entry* entry = (event_queue_entry*)info;
+	event_queue* queue = info->sync->queue;
+
+	InterruptsSpinLocker locker(queue->ready_lock);
+	if (entry->queued || entry->removed)
+		return B_OK;
+
+	entry->queued = true;
+	queue->ready.Add(entry);
+	locker.Unlock();
+
+	return release_sem_etc(queue->sem, 1, B_DO_NOT_RESCHEDULE);
+}
+
+
+/*!	Called by put_select_sync() when the last reference to the select_sync
+	of an event queue entry is gone.
+*/
+void
+event_queue_entry_released(select_sync* sync)
+{
+	event_queue_entry* entry = (event_queue_entry*)sync->set;
+	event_queue* queue = sync->queue;
+
+	delete entry;
+	put_event_queue(queue);
+}
+
+
+//	#pragma mark - syscalls
+
+
+int
+_user_event_queue_create(int openFlags)
+{
+	return create_event_queue(openFlags, false);
+}
+
+
+status_t
+_user_event_queue_select(int fd, event_wait_info* userInfos, int numInfos)
+{
+	if (numInfos <= 0)
+		return B_BAD_VALUE;
+	if (userInfos == NULL || !IS_USER_ADDRESS(userInfos))
+		return B_BAD_ADDRESS;
+
+	file_descriptor* descriptor;
+	event_queue* queue;
+	status_t status = get_event_queue(fd, false, descriptor, queue);
+	if (status != B_OK)
+		return status;
+
+	// Objects that could not be selected are reported back with
+	// B_EVENT_INVALID; the others are left untouched.
+	for (int i = 0; i < numInfos; i++) {
+		event_wait_info info;
+		if (user_memcpy(&info, userInfos + i, sizeof(info)) != B_OK) {
+			status = B_BAD_ADDRESS;
+			break;
+		}
+
+		status_t error = select_events(queue, info);
+		if (error != B_OK) {
+			status = error;
+			info.events = B_EVENT_INVALID;
+			if (user_memcpy(userInfos + i, &info, sizeof(info)) != B_OK) {
+				status = B_BAD_ADDRESS;
+				break;
+			}
+		}
+	}
+
+	put_fd(descriptor);
+	return status;
+}
+
+
+ssize_t
+_user_event_queue_wait(int fd, event_wait_info* userInfos, int numInfos,
+	uint32 flags, bigtime_t timeout)
+{
+	syscall_restart_handle_timeout_pre(flags, timeout);
+
+	if (numInfos <= 0)
+		return B_BAD_VALUE;
+	if (userInfos == NULL || !IS_USER_ADDRESS(userInfos))
+		return B_BAD_ADDRESS;
+
+	file_descriptor* descriptor;
+	event_queue* queue;
+	status_t status = get_event_queue(fd, false, descriptor, queue);
+	if (status != B_OK)
+		return status;
+
+	event_wait_info* infos = (event_wait_info*)malloc(
+		sizeof(event_wait_info) * numInfos);
+	if (infos == NULL) {
+		put_fd(descriptor);
+		return B_NO_MEMORY;
+	}
+
+	ssize_t result = wait_for_events(queue, infos, numInfos, flags, timeout);
+
+	put_fd(descriptor);
+
+	if (result > 0) {
+		if (user_memcpy(userInfos, infos, sizeof(event_wait_info) * result)
+				!= B_OK)
+			result = B_BAD_ADDRESS;
+	} else
+		syscall_restart_handle_timeout_post(result, timeout);
+
+	free(infos);
+	return result;
+}
@@ -1,5 +1,6 @@
 /*
  * Copyright 2008-2010, Ingo Weinhold, ingo_weinhold@gmx.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Distributed under the terms of the MIT License.
  */
 
@@ -8,11 +9,14 @@
 
 #include <new>
 
+#include <cpu.h>
+#include <smp.h>
+#include <util/atomic.h>
+
 
 static const int32 kEntriesPerGeneration = 1024;
 
-static const int32 kEntryNotInArray = -1;
-static const int32 kEntryRemoved = -2;
+static const int32 kMaxRetiredEntries = 128;
 
 
 // #pragma mark - EntryCacheGeneration
@@ -50,37 +54,56 @@ EntryCacheGeneration::Init()
 
 EntryCache::EntryCache()
 	:
-	fCurrentGeneration(0)
+	fBuckets(NULL),
+	fEntryCount(0),
+	fCurrentGeneration(0),
+	fRetiredEntries(NULL),
+	fRetiredCount(0),
+	fEpoch(0)
 {
-	rw_lock_init(&fLock, "entry cache");
+	mutex_init(&fLock, "entry cache");
 
-	new(&fEntries) EntryTable;
+	memset(fReaders, 0, sizeof(fReaders));
 }
 
 
 EntryCache::~EntryCache()
 {
 	// delete entries
-	EntryCacheEntry* entry = fEntries.Clear(true);
-	while (entry != NULL) {
-		EntryCacheEntry* next = entry->hash_link;
-		free(entry);
-		entry = next;
+	if (fBuckets != NULL) {
+		for (uint32 i = 0; i < kBucketCount; i++) {
+			EntryCacheEntry* entry = fBuckets[i];
+			while (entry != NULL) {
+				EntryCacheEntry* next = entry->hash_link;
+				free(entry);
+				entry = next;
+			}
+		}
+
+		delete[] fBuckets;
 	}
 
-	rw_lock_destroy(&fLock);
+	while (fRetiredEntries != NULL) {
+		EntryCacheEntry* next = fRetiredEntries->retired_link;
+		free(fRetiredEntries);
+		fRetiredEntries = next;
+	}
+
+	mutex_destroy(&fLock);
 }
 
 
 status_t
 EntryCache::Init()
 {
-	status_t error = fEntries.Init();
-	if (error != B_OK)
-		return error;
+	fBuckets = new(std::nothrow) EntryCacheEntry*[kBucketCount];
+	if (fBuckets == NULL)
+		return B_NO_MEMORY;
+
+	memset(fBuckets, 0, sizeof(EntryCacheEntry*) * kBucketCount);
 
 	for (int32 i = 0; i < kGenerationCount; i++) {
-		error = fGenerations[i].Init();
+		status_t error = fGenerations[i].Init();
 		if (error != B_OK)
 			return error;
 	}
@@ -89,38 +112,47 @@ EntryCache::Init()
 }
 
 
+/*!	Adds an entry for \a name in the directory \a dirID, or replaces the
+	existing one. If \a missing is \c true, the entry caches the fact that
+	there is no such entry; \a nodeID is ignored in this case.
+*/
 status_t
-EntryCache::Add(ino_t dirID, const char* name, ino_t nodeID)
+EntryCache::Add(ino_t dirID, const char* name, ino_t nodeID, bool missing)
 {
 	EntryCacheKey key(dirID, name);
 
-	WriteLocker _(fLock);
+	MutexLocker _(fLock);
 
-	EntryCacheEntry* entry = fEntries.Lookup(key);
+	EntryCacheEntry* entry = _Lookup(key);
 	if (entry != NULL) {
-		entry->node_id = nodeID;
-		if (entry->generation != fCurrentGeneration) {
-			if (entry->index >= 0) {
-				fGenerations[entry->generation].entries[entry->index] = NULL;
-				_AddEntryToCurrentGeneration(entry);
-			}
+		if (entry->missing == missing
+			&& (missing || entry->node_id == nodeID)) {
+			return B_OK;
 		}
-		return B_OK;
+
+		// Entries cannot be changed while they are visible to lookups, we
+		// need to replace it with a new one.
+		_RemoveEntry(entry);
 	}
 
 	entry = (EntryCacheEntry*)malloc(sizeof(EntryCacheEntry) + strlen(name));
-	if (entry == NULL)
+	if (entry == NULL) {
+		_FreeRetiredEntries();
 		return B_NO_MEMORY;
+	}
 
-	entry->node_id = nodeID;
+	entry->node_id = missing ? -1 : nodeID;
 	entry->dir_id = dirID;
-	entry->generation = fCurrentGeneration;
-	entry->index = kEntryNotInArray;
+	entry->hash = key.hash;
+	entry->referenced = 0;
+	entry->missing = missing;
 	strcpy(entry->name, name);
 
-	fEntries.Insert(entry);
-
 	_AddEntryToCurrentGeneration(entry);
+	_InsertEntry(entry);
+
+	if (fRetiredCount >= kMaxRetiredEntries)
+		_FreeRetiredEntries();
 
 	return B_OK;
 }
@@ -131,95 +163,172 @@ EntryCache::Remove(ino_t dirID, const char* name)
 {
 	EntryCacheKey key(dirID, name);
 
-	WriteLocker writeLocker(fLock);
+	MutexLocker _(fLock);
 
-	EntryCacheEntry* entry = fEntries.Lookup(key);
+	EntryCacheEntry* entry = _Lookup(key);
 	if (entry == NULL)
 		return B_ENTRY_NOT_FOUND;
 
-	fEntries.Remove(entry);
+	_RemoveEntry(entry);
 
-	if (entry->index >= 0) {
-		// remove the entry from its generation and delete it
-		fGenerations[entry->generation].entries[entry->index] = NULL;
-		free(entry);
-	} else {
-		// We can't free it, since another thread is about to try to move it
-		// to another generation. We mark it removed and the other thread will
-		// take care of deleting it.
-		entry->index = kEntryRemoved;
-	}
+	if (fRetiredCount >= kMaxRetiredEntries)
+		_FreeRetiredEntries();
 
 	return B_OK;
 }
 
 
+/*!	Looks up the entry \a name in the directory \a dirID without acquiring
+	any locks.
+	If the cache knows about the entry, \c true is returned. If the entry is
+	known not to exist, \a _missing is set to \c true, otherwise \a _nodeID
+	is set to the ID of the node it refers to.
+*/
 bool
-EntryCache::Lookup(ino_t dirID, const char* name, ino_t& _nodeID)
+EntryCache::Lookup(ino_t dirID, const char* name, ino_t& _nodeID,
+	bool& _missing)
 {
 	EntryCacheKey key(dirID, name);
 
-	ReadLocker readLocker(fLock);
+	reader_slot& slot = fReaders[smp_get_current_cpu()];
+	int32 epoch = _StartLookup(slot);
 
-	EntryCacheEntry* entry = fEntries.Lookup(key);
-	if (entry == NULL)
-		return false;
-
-	int32 oldGeneration = atomic_set(&entry->generation, fCurrentGeneration);
-	if (oldGeneration == fCurrentGeneration || entry->index < 0) {
-		// The entry is already in the current generation or is being moved to
-		// it by another thread.
+	EntryCacheEntry* entry = _Lookup(key);
+	if (entry != NULL) {
 		_nodeID = entry->node_id;
-		return true;
-	}
-
-	// remove from old generation array
-	fGenerations[oldGeneration].entries[entry->index] = NULL;
-	entry->index = kEntryNotInArray;
+		_missing = entry->missing;
 
-	// add to the current generation
-	int32 index = atomic_add(&fGenerations[oldGeneration].next_index, 1);
-	if (index < kEntriesPerGeneration) {
-		fGenerations[fCurrentGeneration].entries[index] = entry;
-		entry->index = index;
-		_nodeID = entry->node_id;
-		return true;
+		// Only touch the entry if necessary, so that its cache line can stay
+		// shared between the CPUs
+		if (entry->referenced == 0)
+			entry->referenced = 1;
 	}
 
-	// The current generation is full, so we probably need to clear the oldest
-	// one to make room. We need the write lock for that.
-	readLocker.Unlock();
-	WriteLocker writeLocker(fLock);
+	atomic_add(&slot.readers[epoch], -1);
+		// from here on "entry" must no longer be accessed
 
-	if (entry->index == kEntryRemoved) {
-		// the entry has been removed in the meantime
-		free(entry);
-		return false;
-	}
-
-	_AddEntryToCurrentGeneration(entry);
+	if (entry == NULL)
+		atomic_add64(&slot.misses, 1);
+	else if (_missing)
+		atomic_add64(&slot.negative_hits, 1);
+	else
+		atomic_add64(&slot.hits, 1);
 
-	_nodeID = entry->node_id;
-	return true;
+	return entry != NULL;
 }
 
 
 const char*
 EntryCache::DebugReverseLookup(ino_t nodeID, ino_t& _dirID)
 {
-	for (EntryTable::Iterator it = fEntries.GetIterator();
-			EntryCacheEntry* entry = it.Next();) {
-		if (nodeID == entry->node_id && strcmp(entry->name, ".") != 0
+	for (uint32 i = 0; i < kBucketCount; i++) {
+		for (EntryCacheEntry* entry = fBuckets[i]; entry != NULL;
+				entry = entry->hash_link) {
+			if (nodeID == entry->node_id && !entry->missing
+				&& strcmp(entry->name, ".") != 0
 				&& strcmp(entry->name, "..") != 0) {
-			_dirID = entry->dir_id;
-			return entry->name;
+				_dirID = entry->dir_id;
+				return entry->name;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+void
+EntryCache::GetStatistics(EntryCacheStatistics& statistics) const
+{
+	statistics.hits = 0;
+	statistics.negative_hits = 0;
+	statistics.misses = 0;
+	statistics.entries = fEntryCount;
+
+	for (int32 i = 0; i < B_MAX_CPU_COUNT; i++) {
+		statistics.hits += fReaders[i].hits;
+		statistics.negative_hits += fReaders[i].negative_hits;
+		statistics.misses += fReaders[i].misses;
+	}
+}
+
+
+/*!	Must be called with either the lock held, or during a lookup.
+*/
+EntryCacheEntry*
+EntryCache::_Lookup(const EntryCacheKey& key) const
+{
+	EntryCacheEntry* entry = atomic_pointer_get(
+		&fBuckets[key.hash & (kBucketCount - 1)]);
+
+	while (entry != NULL) {
+		if (entry->hash == (uint32)key.hash && entry->dir_id == key.dir_id
+			&& strcmp(entry->name, key.name) == 0) {
+			return entry;
 		}
+
+		entry = entry->hash_link;
 	}
 
 	return NULL;
 }
 
 
+/*!	Makes the fully initialized \a entry visible to lookups.
+	The lock must be held.
+*/
+void
+EntryCache::_InsertEntry(EntryCacheEntry* entry)
+{
+	EntryCacheEntry** bucket = &fBuckets[entry->hash & (kBucketCount - 1)];
+
+	entry->hash_link = *bucket;
+	atomic_pointer_set(bucket, entry);
+		// this also makes sure the entry is complete before it is published
+
+	fEntryCount++;
+}
+
+
+/*!	Removes \a entry from the hash table and its generation, and retires it.
+	Lookups that are currently in progress may still see the entry.
+	The lock must be held.
+*/
+void
+EntryCache::_RemoveEntry(EntryCacheEntry* entry)
+{
+	if (entry->index >= 0)
+		fGenerations[entry->generation].entries[entry->index] = NULL;
+
+	EntryCacheEntry** link = &fBuckets[entry->hash & (kBucketCount - 1)];
+	while (*link != entry)
+		link = &(*link)->hash_link;
+
+	// The removed entry keeps its link, so that concurrent lookups can just
+	// continue their walk through the bucket.
+	atomic_pointer_set(link, entry->hash_link);
+	fEntryCount--;
+
+	_RetireEntry(entry);
+}
+
+
+void
+EntryCache::_RetireEntry(EntryCacheEntry* entry)
+{
+	entry->index = -1;
+	entry->retired_link = fRetiredEntries;
+	fRetiredEntries = entry;
+	fRetiredCount++;
+}
+
+
+/*!	Adds the entry to the current generation. If that one is full, the
+	oldest generation is cleared, and becomes the current one. Entries of
+	the oldest generation that have been looked up since they were added get
+	a second chance, and are kept.
+	The lock must be held.
+*/
 void
 EntryCache::_AddEntryToCurrentGeneration(EntryCacheEntry* entry)
 {
@@ -234,20 +343,94 @@ EntryCache::_AddEntryToCurrentGeneration(EntryCacheEntry* entry)
 
 	// we have to clear the oldest generation
 	int32 newGeneration = (fCurrentGeneration + 1) % kGenerationCount;
+	EntryCacheGeneration& generation = fGenerations[newGeneration];
+
+	int32 kept = 0;
 	for (int32 i = 0; i < kEntriesPerGeneration; i++) {
-		EntryCacheEntry* otherEntry = fGenerations[newGeneration].entries[i];
+		EntryCacheEntry* otherEntry = generation.entries[i];
 		if (otherEntry == NULL)
 			continue;
 
-		fGenerations[newGeneration].entries[i] = NULL;
-		fEntries.Remove(otherEntry);
-		free(otherEntry);
+		generation.entries[i] = NULL;
+
+		if (otherEntry->referenced != 0 && kept < kEntriesPerGeneration / 2) {
+			otherEntry->referenced = 0;
+			otherEntry->index = kept;
+			generation.entries[kept++] = otherEntry;
+			continue;
+		}
+
+		otherEntry->index = -1;
+		_RemoveEntry(otherEntry);
 	}
 
 	// set the new generation and add the entry
 	fCurrentGeneration = newGeneration;
-	fGenerations[newGeneration].next_index = 1;
-	fGenerations[newGeneration].entries[0] = entry;
+	generation.next_index = kept + 1;
+	generation.entries[kept] = entry;
 	entry->generation = newGeneration;
-	entry->index = 0;
+	entry->index = kept;
+}
+
+
+/*!	Frees all retired entries. Since there might still be lookups in progress
+	that have seen them, the epoch is advanced first, and we wait until all
+	lookups of the previous epoch are done.
+	The lock must be held.
+*/
+void
+EntryCache::_FreeRetiredEntries()
+{
+	EntryCacheEntry* entry = fRetiredEntries;
+	if (entry == NULL)
+		return;
+
+	fRetiredEntries = NULL;
+	fRetiredCount = 0;
+
+	int32 epoch = fEpoch;
+	atomic_set(&fEpoch, epoch ^ 1);
+
+	int32 cpuCount = smp_get_num_cpus();
+	for (int32 tries = 0;; tries++) {
+		int32 readers = 0;
+		for (int32 i = 0; i < cpuCount; i++)
+			readers += atomic_get(&fReaders[i].readers[epoch]);
+
+		if (readers == 0)
+			break;
+
+		// Lookups are short, but the thread doing it might have been
+		// preempted
+		if (tries < 100)
+			PAUSE();
+		else
+			snooze(100);
+	}
+
+	while (entry != NULL) {
+		EntryCacheEntry* next = entry->retired_link;
+		free(entry);
+		entry = next;
+	}
+}
+
+
+/*!	Announces a lookup in the current epoch, and returns it. The caller must
+	decrement the reader count of the returned epoch when it's done.
+*/
+inline int32
+EntryCache::_StartLookup(reader_slot& slot)
+{
+	while (true) {
+		int32 epoch = atomic_get(&fEpoch);
+		atomic_add(&slot.readers[epoch], 1);
+
+		// If the epoch has been advanced in the meantime, the entries we
+		// might see could already be freed
+		if (atomic_get(&fEpoch) == epoch)
+			return epoch;
+
+		atomic_add(&slot.readers[epoch], -1);
+	}
 }
@@ -1,5 +1,6 @@
 /*
  * Copyright 2008-2010, Ingo Weinhold, ingo_weinhold@gmx.de.
+ * Copyright 2013, Haiku Inc. All rights reserved.
  * Distributed under the terms of the MIT License.
  */
 #ifndef ENTRY_CACHE_H
@@ -10,7 +11,6 @@
 
 #include <util/AutoLock.h>
 #include <util/khash.h>
-#include <util/OpenHashTable.h>
 
 
 struct EntryCacheKey {
@@ -30,18 +30,25 @@ struct EntryCacheKey {
 };
 
 
+/*!	Entries are never changed once they are visible to lookups, besides the
+	\c referenced flag. To change an entry, it is replaced by a new one.
+*/
 struct EntryCacheEntry {
 			EntryCacheEntry*	hash_link;
+			EntryCacheEntry*	retired_link;
 			ino_t				node_id;
 			ino_t				dir_id;
-			vint32				generation;
-			vint32				index;
+			uint32				hash;
+			int32				generation;
+			int32				index;
+			vint32				referenced;
+			bool				missing;
 			char				name[1];
 };
 
 
 struct EntryCacheGeneration {
-			vint32				next_index;
+			int32				next_index;
 			EntryCacheEntry**	entries;
 
 								EntryCacheGeneration();
@@ -51,34 +58,20 @@ struct EntryCacheGeneration {
 };
 
 
-struct EntryCacheHashDefinition {
-	typedef EntryCacheKey	KeyType;
-	typedef EntryCacheEntry	ValueType;
-
-	uint32 HashKey(const EntryCacheKey& key) const
-	{
-		return key.hash;
-	}
-
-	size_t Hash(const EntryCacheEntry* value) const
-	{
-		return (uint32)value->dir_id ^ (uint32)(value->dir_id >> 32)
-			^ hash_hash_string(value->name);
-	}
-
-	bool Compare(const EntryCacheKey& key, const EntryCacheEntry* value) const
-	{
-		return value->dir_id == key.dir_id
-			&& strcmp(value->name, key.name) == 0;
-	}
-
-	EntryCacheEntry*& GetLink(EntryCacheEntry* value) const
-	{
-		return value->hash_link;
-	}
+struct EntryCacheStatistics {
+			int64				hits;
+			int64				negative_hits;
+			int64				misses;
+			int32				entries;
 };
 
 
+/*!	Lookups don't lock at all -- they only announce themselves in a per-CPU
+	reader count for the current epoch. Entries that are removed from the
+	hash table are retired first, and are only freed after all lookups of the
+	epoch they were removed in have finished.
+	Changes are serialized by a mutex.
+*/
 class EntryCache {
 public:
 								EntryCache();
@@ -87,30 +80,51 @@ public:
 			status_t			Init();
 
 			status_t			Add(ino_t dirID, const char* name,
-									ino_t nodeID);
+									ino_t nodeID, bool missing = false);
 
 			status_t			Remove(ino_t dirID, const char* name);
 
 			bool				Lookup(ino_t dirID, const char* name,
-									ino_t& nodeID);
+									ino_t& nodeID, bool& missing);
 
 			const char*			DebugReverseLookup(ino_t nodeID, ino_t& _dirID);
+			void				GetStatistics(
+									EntryCacheStatistics& statistics) const;
 
 private:
 	static	const int32			kGenerationCount = 8;
+	static	const uint32		kBucketCount = 2048;
 
-			typedef BOpenHashTable<EntryCacheHashDefinition> EntryTable;
-			typedef DoublyLinkedList<EntryCacheEntry> EntryList;
+			struct reader_slot {
+				vint32			readers[2];
+				vint64			hits;
+				vint64			negative_hits;
+				vint64			misses;
+				uint8			padding[32];
+					// keep the slots of different CPUs apart
+			};
 
 private:
+			EntryCacheEntry*	_Lookup(const EntryCacheKey& key) const;
+			void				_InsertEntry(EntryCacheEntry* entry);
+			void				_RemoveEntry(EntryCacheEntry* entry);
+			void				_RetireEntry(EntryCacheEntry* entry);
 			void				_AddEntryToCurrentGeneration(
 									EntryCacheEntry* entry);
+			void				_FreeRetiredEntries();
+
+			int32				_StartLookup(reader_slot& slot);
 
 private:
-			rw_lock				fLock;
-			EntryTable			fEntries;
+			mutex				fLock;
+			EntryCacheEntry**	fBuckets;
+			int32				fEntryCount;
 			EntryCacheGeneration fGenerations[kGenerationCount];
 			int32				fCurrentGeneration;
+			EntryCacheEntry*	fRetiredEntries;
+			int32				fRetiredCount;
+			vint32				fEpoch;
+			reader_slot			fReaders[B_MAX_CPU_COUNT];
 };
 
 
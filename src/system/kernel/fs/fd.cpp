@@ -40,8 +40,6 @@ static const size_t kMaxReadDirBufferSize = 64 * 1024;
 static struct file_descriptor* get_fd_locked(struct io_context* context,
 	int fd);
 static struct file_descriptor* remove_fd(struct io_context* context, int fd);
-static void deselect_select_infos(file_descriptor* descriptor,
-	select_info* infos);
 
 
 struct FDGetterLocking {
@@ -523,7 +521,7 @@ fd_ioctl(bool kernelFD, int fd, uint32 op, void* buffer, size_t length)
 }
 
 
-static void
+void
 deselect_select_infos(file_descriptor* descriptor, select_info* infos)
 {
 	TRACE(("deselect_select_infos(%p, %p)\n", descriptor, infos));
@@ -9,7 +9,9 @@
 #include <sys/socket.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdlib.h>
 
 #include <module.h>
 
@@ -31,6 +33,7 @@
 #define MAX_SOCKET_ADDRESS_LENGTH	(sizeof(sockaddr_storage))
 #define MAX_SOCKET_OPTION_LENGTH	128
 #define MAX_ANCILLARY_DATA_LENGTH	1024
+#define SPLICE_CHUNK_SIZE			65536
 
 #define GET_SOCKET_FD_OR_RETURN(fd, kernel, descriptor)	\
 	do {												\
@@ -650,6 +653,116 @@ common_get_next_socket_stat(int family, uint32 *cookie, struct net_stat *stat)
 }
 
 
+static void
+release_splice_chunk(void* chunk)
+{
+	free(chunk);
+}
+
+
+/*!	Transfers up to \a count bytes from \a fromFD to \a toFD without
+	passing them through userland. If the destination is a socket, the data is
+	read into a kernel chunk once, and then handed to the stack by reference,
+	so that it is not copied again while the protocol holds on to it.
+	If \a _fromOffset or \a _toOffset are given, they are used and updated
+	instead of the respective descriptor's position.
+*/
+static ssize_t
+common_splice(int fromFD, off_t* _fromOffset, int toFD, off_t* _toOffset,
+	size_t count, bool kernel)
+{
+	io_context* context = get_current_io_context(kernel);
+
+	file_descriptor* from = get_fd(context, fromFD);
+	if (from == NULL)
+		return B_FILE_ERROR;
+	FDPutter fromPutter(from);
+
+	file_descriptor* to = get_fd(context, toFD);
+	if (to == NULL)
+		return B_FILE_ERROR;
+	FDPutter toPutter(to);
+
+	if ((from->open_mode & O_RWMASK) == O_WRONLY
+		|| (to->open_mode & O_RWMASK) == O_RDONLY)
+		return B_FILE_ERROR;
+	if (from->ops->fd_read == NULL || to->ops->fd_write == NULL)
+		return B_BAD_VALUE;
+
+	bool toSocket = to->type == FDTYPE_SOCKET;
+	if (toSocket && _toOffset != NULL)
+		return ESPIPE;
+
+	off_t fromOffset = _fromOffset != NULL ? *_fromOffset : from->pos;
+	off_t toOffset = _toOffset != NULL ? *_toOffset : to->pos;
+	if (fromOffset < 0 || toOffset < 0)
+		return B_BAD_VALUE;
+
+	if (count > SSIZE_MAX)
+		count = SSIZE_MAX;
+
+	ssize_t transferred = 0;
+	status_t status = B_OK;
+
+	while (count > 0) {
+		size_t length = min_c(count, SPLICE_CHUNK_SIZE);
+		void* chunk = malloc(length);
+		if (chunk == NULL) {
+			status = B_NO_MEMORY;
+			break;
+		}
+
+		status = from->ops->fd_read(from, fromOffset, chunk, &length);
+		if (status != B_OK || length == 0) {
+			free(chunk);
+			break;
+		}
+
+		ssize_t written;
+		if (toSocket) {
+			// the stack releases the chunk when it's done with it
+			written = sStackInterface->send_external(to->u.socket, chunk,
+				length, 0, &release_splice_chunk, chunk);
+		} else {
+			size_t writeLength = length;
+			status = to->ops->fd_write(to, toOffset, chunk, &writeLength);
+			written = status == B_OK ? (ssize_t)writeLength : status;
+			free(chunk);
+		}
+
+		if (written < 0) {
+			status = written;
+			break;
+		}
+
+		// Only advance the source for what has actually been written, so
+		// that seekable sources can be resumed.
+		fromOffset += written;
+		toOffset += written;
+		transferred += written;
+		count -= written;
+
+		if ((size_t)written < length)
+			break;
+	}
+
+	if (_fromOffset != NULL)
+		*_fromOffset = fromOffset;
+	else
+		from->pos = fromOffset;
+
+	if (_toOffset != NULL)
+		*_toOffset = toOffset;
+	else if (!toSocket)
+		to->pos = toOffset;
+
+	if (transferred > 0)
+		return transferred;
+
+	return status;
+}
+
+
 // #pragma mark - kernel sockets API
 
 
@@ -1283,3 +1396,38 @@ _user_get_next_socket_stat(int family, uint32 *_cookie, struct net_stat *_stat)
 
 	return B_OK;
 }
+
+
+ssize_t
+_user_splice(int fromFD, off_t *userFromOffset, int toFD, off_t *userToOffset,
+	size_t count, uint32 flags)
+{
+	if (flags != 0)
+		return B_BAD_VALUE;
+
+	// copy offsets from userland
+	off_t fromOffset;
+	off_t toOffset;
+	if ((userFromOffset != NULL && (!IS_USER_ADDRESS(userFromOffset)
+			|| user_memcpy(&fromOffset, userFromOffset, sizeof(off_t))
+				!= B_OK))
+		|| (userToOffset != NULL && (!IS_USER_ADDRESS(userToOffset)
+			|| user_memcpy(&toOffset, userToOffset, sizeof(off_t))
+				!= B_OK))) {
+		return B_BAD_ADDRESS;
+	}
+
+	SyscallRestartWrapper<ssize_t> result;
+	result = common_splice(fromFD, userFromOffset != NULL ? &fromOffset : NULL,
+		toFD, userToOffset != NULL ? &toOffset : NULL, count, false);
+
+	// copy offsets back to userland
+	if ((userFromOffset != NULL
+			&& user_memcpy(userFromOffset, &fromOffset, sizeof(off_t)) != B_OK)
+		|| (userToOffset != NULL
+			&& user_memcpy(userToOffset, &toOffset, sizeof(off_t)) != B_OK)) {
+		return B_BAD_ADDRESS;
+	}
+
+	return result;
+}
@@ -2073,9 +2073,13 @@ static status_t
 lookup_dir_entry(struct vnode* dir, const char* name, struct vnode** _vnode)
 {
 	ino_t id;
+	bool missing;
 
-	if (dir->mount->entry_cache.Lookup(dir->id, name, id))
+	if (dir->mount->entry_cache.Lookup(dir->id, name, id, missing)) {
+		if (missing)
+			return B_ENTRY_NOT_FOUND;
 		return get_vnode(dir->device, id, _vnode, true, false);
+	}
 
 	status_t status = FS_CALL(dir, lookup, name, &id);
 	if (status != B_OK)
@@ -2981,6 +2985,12 @@ _dump_mount(struct fs_mount* mount)
 	kprintf(" flags:        %s%s\n", mount->unmounting ? " unmounting" : "",
 		mount->owns_file_device ? " owns_file_device" : "");
 
+	EntryCacheStatistics statistics;
+	mount->entry_cache.GetStatistics(statistics);
+	kprintf(" entry cache:   %ld entries, %Ld hits, %Ld negative hits, %Ld "
+		"misses\n", statistics.entries, statistics.hits,
+		statistics.negative_hits, statistics.misses);
+
 	fs_volume* volume = mount->volume;
 	while (volume != NULL) {
 		kprintf(" volume %p:\n", volume);
@@ -3199,6 +3209,39 @@ dump_mounts(int argc, char** argv)
 }
 
 
+static int
+dump_entry_caches(int argc, char** argv)
+{
+	if (argc != 1) {
+		kprintf("usage: %s\n", argv[0]);
+		return 0;
+	}
+
+	kprintf("address     id  entries         hits    neg. hits       misses  "
+		"hit rate\n");
+
+	struct hash_iterator iterator;
+	struct fs_mount* mount;
+
+	hash_open(sMountsTable, &iterator);
+	while ((mount = (struct fs_mount*)hash_next(sMountsTable, &iterator))
+			!= NULL) {
+		EntryCacheStatistics statistics;
+		mount->entry_cache.GetStatistics(statistics);
+
+		int64 lookups = statistics.hits + statistics.negative_hits
+			+ statistics.misses;
+		kprintf("%p%4ld %8ld %12Ld %12Ld %12Ld %8Ld%%\n", mount, mount->id,
+			statistics.entries, statistics.hits, statistics.negative_hits,
+			statistics.misses, lookups > 0
+				? (lookups - statistics.misses) * 100 / lookups : 0);
+	}
+
+	hash_close(sMountsTable, &iterator, false);
+	return 0;
+}
+
+
 static int
 dump_vnode(int argc, char** argv)
 {
@@ -3991,6 +4034,21 @@ entry_cache_remove(dev_t mountID, ino_t dirID, const char* name)
 }
 
 
+extern "C" status_t
+entry_cache_add_missing(dev_t mountID, ino_t dirID, const char* name)
+{
+	// lookup mount -- the caller is required to make sure that the mount
+	// won't go away
+	MutexLocker locker(sMountMutex);
+	struct fs_mount* mount = find_mount(mountID);
+	if (mount == NULL)
+		return B_BAD_VALUE;
+	locker.Unlock();
+
+	return mount->entry_cache.Add(dirID, name, -1, true);
+}
+
+
 //	#pragma mark - private VFS API
 //	Functions the VFS exports for other parts of the kernel
 
@@ -4861,6 +4919,12 @@ vfs_free_io_context(io_context* context)
 
 	for (i = 0; i < context->table_size; i++) {
 		if (struct file_descriptor* descriptor = context->fds[i]) {
+			// event queues may still have the descriptor selected
+			if (context->select_infos[i] != NULL) {
+				deselect_select_infos(descriptor, context->select_infos[i]);
+				context->select_infos[i] = NULL;
+			}
+
 			close_fd(descriptor);
 			put_fd(descriptor);
 		}
@@ -5145,6 +5209,8 @@ vfs_init(kernel_args* args)
 	add_debugger_command("mount", &dump_mount,
 		"info about the specified fs_mount");
 	add_debugger_command("mounts", &dump_mounts, "list all fs_mounts");
+	add_debugger_command("entry_caches", &dump_entry_caches,
+		"list the entry cache statistics of all fs_mounts");
 	add_debugger_command("io_context", &dump_io_context,
 		"info about the I/O context");
 	add_debugger_command("vnode_usage", &dump_vnode_usage,
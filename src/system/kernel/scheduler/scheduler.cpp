@@ -5,9 +5,11 @@
  */
 
 
+#include <kernel.h>
 #include <kscheduler.h>
 #include <listeners.h>
 #include <smp.h>
+#include <system_info.h>
 
 #include "scheduler_affine.h"
 #include "scheduler_simple.h"
@@ -102,6 +104,27 @@ scheduler_enable_scheduling(void)
 }
 
 
+/*!	Fills in the scheduling statistics of all CPUs.
+	Interrupts must be enabled, the scheduler lock must not be held.
+*/
+void
+scheduler_get_info(system_scheduler_info* info)
+{
+	int32 cpuCount = smp_get_num_cpus();
+	info->cpu_count = cpuCount;
+
+	InterruptsSpinLocker locker(gSchedulerLock);
+
+	for (int32 i = 0; i < cpuCount; i++) {
+		scheduler_cpu_info& cpuInfo = info->cpus[i];
+		cpuInfo.run_queue_depth = gScheduler->run_queue_depth(i);
+		cpuInfo.context_switches = gCPU[i].context_switches;
+		cpuInfo.involuntary_switches = gCPU[i].involuntary_switches;
+		cpuInfo.migrations = gCPU[i].migrations;
+	}
+}
+
+
 // #pragma mark - Syscalls
 
 
@@ -126,3 +149,33 @@ _user_estimate_max_scheduling_latency(thread_id id)
 	InterruptsSpinLocker locker(gSchedulerLock);
 	return gScheduler->estimate_max_scheduling_latency(thread);
 }
+
+
+status_t
+_user_get_scheduler_thread_info(thread_id id, scheduler_thread_info* userInfo,
+	size_t size)
+{
+	if (userInfo == NULL || !IS_USER_ADDRESS(userInfo)
+		|| size != sizeof(scheduler_thread_info)) {
+		return B_BAD_VALUE;
+	}
+
+	// get the thread
+	Thread* thread;
+	if (id < 0) {
+		thread = thread_get_current_thread();
+		thread->AcquireReference();
+	} else {
+		thread = Thread::Get(id);
+		if (thread == NULL)
+			return B_BAD_THREAD_ID;
+	}
+	BReference<Thread> threadReference(thread, true);
+
+	// copy the statistics while the scheduler can't update them
+	InterruptsSpinLocker locker(gSchedulerLock);
+	scheduler_thread_info info = thread->scheduler_info;
+	locker.Unlock();
+
+	return user_memcpy(userInfo, &info, sizeof(scheduler_thread_info));
+}
@@ -37,19 +37,134 @@
 #	define TRACE(x) ;
 #endif
 
-// The run queues. Holds the threads ready to run ordered by priority.
+// The run queues. Holds the threads ready to run, one FIFO list per priority
+// level with a bitmap of the non-empty levels, so that both inserting a thread
+// and picking the highest priority one are constant time operations.
 // One queue per schedulable target (CPU, core, etc.).
 // TODO: consolidate this such that HT/SMT entities on the same physical core
 // share a queue, once we have the necessary API for retrieving the topology
 // information
-static Thread* sRunQueue[B_MAX_CPU_COUNT];
-static int32 sRunQueueSize[B_MAX_CPU_COUNT];
+const int32 kPriorityLevels = B_REAL_TIME_PRIORITY + 1;
+const int32 kPriorityBitmapSize = (kPriorityLevels + 31) / 32;
+
+/*!	Returns the index of the most significant bit set in \a bits, which must
+	not be 0.
+*/
+static inline int32
+_highest_bit(uint32 bits)
+{
+	int32 bit = 0;
+	if ((bits & 0xffff0000) != 0) {
+		bits >>= 16;
+		bit += 16;
+	}
+	if ((bits & 0xff00) != 0) {
+		bits >>= 8;
+		bit += 8;
+	}
+	if ((bits & 0xf0) != 0) {
+		bits >>= 4;
+		bit += 4;
+	}
+	if ((bits & 0xc) != 0) {
+		bits >>= 2;
+		bit += 2;
+	}
+	if ((bits & 0x2) != 0)
+		bit++;
+
+	return bit;
+}
+
+
+struct RunQueue {
+	void Init()
+	{
+		memset(this, 0, sizeof(RunQueue));
+	}
+
+	inline bool IsEmpty() const
+	{
+		return count == 0;
+	}
+
+	inline void Append(Thread* thread)
+	{
+		int32 priority = thread->priority;
+		thread->queue_next = NULL;
+		if (tails[priority] != NULL)
+			tails[priority]->queue_next = thread;
+		else
+			heads[priority] = thread;
+		tails[priority] = thread;
+		bitmap[priority / 32] |= 1UL << (priority % 32);
+		count++;
+	}
+
+	inline void Remove(Thread* thread, Thread* previous)
+	{
+		int32 priority = thread->priority;
+		if (previous != NULL)
+			previous->queue_next = thread->queue_next;
+		else
+			heads[priority] = thread->queue_next;
+		if (tails[priority] == thread)
+			tails[priority] = previous;
+		if (heads[priority] == NULL)
+			bitmap[priority / 32] &= ~(1UL << (priority % 32));
+		thread->queue_next = NULL;
+		count--;
+	}
+
+	/*!	Returns the highest non-empty priority level below \a priority, or
+		-1, if there is none.
+	*/
+	inline int32 NextPriorityBelow(int32 priority) const
+	{
+		if (--priority < 0)
+			return -1;
+
+		int32 index = priority / 32;
+		uint32 bits = bitmap[index] & (0xffffffffUL >> (31 - priority % 32));
+		while (bits == 0) {
+			if (--index < 0)
+				return -1;
+			bits = bitmap[index];
+		}
+
+		return index * 32 + _highest_bit(bits);
+	}
+
+	inline int32 HighestPriority() const
+	{
+		return NextPriorityBelow(kPriorityLevels);
+	}
+
+	Thread*		heads[kPriorityLevels];
+	Thread*		tails[kPriorityLevels];
+	uint32		bitmap[kPriorityBitmapSize];
+	int32		count;
+
+	// statistics
+	int64		enqueued;
+	int64		steals;
+	int64		balance_runs;
+	bigtime_t	last_balance;
+};
+
+static RunQueue sRunQueues[B_MAX_CPU_COUNT];
 static Thread* sIdleThreads;
 
 const int32 kMaxTrackingQuantums = 5;
 const bigtime_t kMinThreadQuantum = 3000;
 const bigtime_t kMaxThreadQuantum = 10000;
 
+// A thread that has run within this time is considered to still have its
+// working set in the CPU's caches and is not migrated by the load balancer.
+const bigtime_t kCacheHotTime = 2000;
+// Interval in which each CPU compares its run queue with the other ones.
+const bigtime_t kLoadBalanceInterval = 50000;
+
 
 struct scheduler_thread_data {
 	scheduler_thread_data(void)
@@ -63,6 +178,7 @@ struct scheduler_thread_data {
 		fQuantumAverage = 0;
 		fLastQuantumSlot = 0;
 		fLastQueue = -1;
+		fLastRunTime = 0;
 		memset(fLastThreadQuantums, 0, sizeof(fLastThreadQuantums));
 	}
 
@@ -82,10 +198,16 @@ struct scheduler_thread_data {
 		return fQuantumAverage / kMaxTrackingQuantums;
 	}
 
+	inline bool IsCacheHot(bigtime_t now) const
+	{
+		return now - fLastRunTime < kCacheHotTime;
+	}
+
 	int32 fQuantumAverage;
 	int32 fLastThreadQuantums[kMaxTrackingQuantums];
 	int16 fLastQuantumSlot;
 	int32 fLastQueue;
+	bigtime_t fLastRunTime;
 };
 
 
@@ -105,20 +227,25 @@ _rand(void)
 static int
 dump_run_queue(int argc, char **argv)
 {
-	Thread *thread = NULL;
-
 	for (int32 i = 0; i < smp_get_num_cpus(); i++) {
-		thread = sRunQueue[i];
-		kprintf("Run queue for cpu %ld (%ld threads)\n", i,
-			sRunQueueSize[i]);
-		if (sRunQueueSize[i] > 0) {
-			kprintf("thread      id      priority  avg. quantum  name\n");
-			while (thread) {
-				kprintf("%p  %-7ld %-8ld  %-12ld  %s\n", thread, thread->id,
-					thread->priority,
+		RunQueue& queue = sRunQueues[i];
+		kprintf("Run queue for cpu %ld (%ld threads, %lld enqueued, "
+			"%lld migrated in, %lld stolen, %lld balance runs)\n", i,
+			queue.count, queue.enqueued, gCPU[i].migrations, queue.steals,
+			queue.balance_runs);
+		if (queue.IsEmpty())
+			continue;
+
+		kprintf("thread      id      priority  avg. quantum  migrations  "
+			"name\n");
+		for (int32 priority = queue.HighestPriority(); priority >= 0;
+				priority = queue.NextPriorityBelow(priority)) {
+			for (Thread* thread = queue.heads[priority]; thread != NULL;
+					thread = thread->queue_next) {
+				kprintf("%p  %-7ld %-8ld  %-12ld  %-10lld  %s\n", thread,
+					thread->id, thread->priority,
 					thread->scheduler_data->GetAverageQuantumUsage(),
-					thread->name);
-				thread = thread->queue_next;
+					thread->scheduler_info.migrations, thread->name);
 			}
 		}
 	}
@@ -126,7 +253,7 @@ dump_run_queue(int argc, char **argv)
 }
 
 
-/*!	Returns the most idle CPU based on the active time counters.
+/*!	Returns the most idle CPU based on the run queue sizes.
 	Note: thread lock must be held when entering this function
 */
 static int32
@@ -136,14 +263,60 @@ affine_get_most_idle_cpu()
 	for (int32 i = 0; i < smp_get_num_cpus(); i++) {
 		if (gCPU[i].disabled)
 			continue;
-		if (targetCPU < 0 || sRunQueueSize[i] < sRunQueueSize[targetCPU])
+		if (targetCPU < 0
+			|| sRunQueues[i].count < sRunQueues[targetCPU].count) {
+			targetCPU = i;
+		}
+	}
+
+	return targetCPU;
+}
+
+
+/*!	Returns the CPU with the longest run queue other than \a currentCPU, or
+	-1, if no other CPU has at least \a minCount threads waiting.
+	Note: thread lock must be held when entering this function
+*/
+static int32
+affine_get_busiest_cpu(int32 currentCPU, int32 minCount)
+{
+	int32 targetCPU = -1;
+	for (int32 i = 0; i < smp_get_num_cpus(); i++) {
+		if (i == currentCPU || sRunQueues[i].count < minCount)
+			continue;
+
+		// out of the CPUs with threads available to steal,
+		// pick whichever one is generally the most CPU bound.
+		if (targetCPU < 0
+			|| sRunQueues[i].HighestPriority()
+				> sRunQueues[targetCPU].HighestPriority()
+			|| (sRunQueues[i].HighestPriority()
+					== sRunQueues[targetCPU].HighestPriority()
+				&& sRunQueues[i].count > sRunQueues[targetCPU].count)) {
 			targetCPU = i;
+		}
 	}
 
 	return targetCPU;
 }
 
 
+/*!	Inserts the thread into the run queue of the given CPU.
+	Note: thread lock must be held when entering this function
+*/
+static void
+affine_insert_in_run_queue(Thread *thread, int32 targetCPU)
+{
+	RunQueue& queue = sRunQueues[targetCPU];
+
+	T(EnqueueThread(thread, queue.tails[thread->priority], NULL));
+	queue.Append(thread);
+	queue.enqueued++;
+
+	thread->scheduler_data->fLastQueue = targetCPU;
+}
+
+
 /*!	Enqueues the thread into the run queue.
 	Note: thread lock must be held when entering this function
 */
@@ -155,35 +328,29 @@ affine_enqueue_in_run_queue(Thread *thread)
 		targetCPU = thread->previous_cpu->cpu_num;
 	else if (thread->previous_cpu == NULL || thread->previous_cpu->disabled)
 		targetCPU = affine_get_most_idle_cpu();
-	else
+	else {
 		targetCPU = thread->previous_cpu->cpu_num;
 
+		// Keep the thread on the CPU it ran on last, unless its cache
+		// footprint is gone anyway and another CPU has clearly less work.
+		if (thread->priority != B_IDLE_PRIORITY
+			&& !thread->scheduler_data->IsCacheHot(system_time())) {
+			int32 idleCPU = affine_get_most_idle_cpu();
+			if (idleCPU >= 0 && sRunQueues[idleCPU].count + 1
+					< sRunQueues[targetCPU].count) {
+				targetCPU = idleCPU;
+			}
+		}
+	}
+
 	thread->state = thread->next_state = B_THREAD_READY;
+	scheduler_thread_ready(thread);
 
 	if (thread->priority == B_IDLE_PRIORITY) {
 		thread->queue_next = sIdleThreads;
 		sIdleThreads = thread;
-	} else {
-		Thread *curr, *prev;
-		for (curr = sRunQueue[targetCPU], prev = NULL; curr
-			&& curr->priority >= thread->next_priority;
-			curr = curr->queue_next) {
-			if (prev)
-				prev = prev->queue_next;
-			else
-				prev = sRunQueue[targetCPU];
-		}
-
-		T(EnqueueThread(thread, prev, curr));
-		sRunQueueSize[targetCPU]++;
-		thread->queue_next = curr;
-		if (prev)
-			prev->queue_next = thread;
-		else
-			sRunQueue[targetCPU] = thread;
-
-		thread->scheduler_data->fLastQueue = targetCPU;
-	}
+	} else
+		affine_insert_in_run_queue(thread, targetCPU);
 
 	thread->next_priority = thread->priority;
 
@@ -203,23 +370,46 @@ affine_enqueue_in_run_queue(Thread *thread)
 }
 
 
-/*!	Dequeues the thread after the given \a prevThread from the run queue.
+/*!	Dequeues the given \a thread, which follows \a prevThread in its priority
+	list, from the run queue of \a cpu.
 */
 static inline Thread *
-dequeue_from_run_queue(Thread *prevThread, int32 currentCPU)
+dequeue_from_run_queue(Thread* thread, Thread *prevThread, int32 cpu)
 {
-	Thread *resultThread = NULL;
-	if (prevThread != NULL) {
-		resultThread = prevThread->queue_next;
-		prevThread->queue_next = resultThread->queue_next;
-	} else {
-		resultThread = sRunQueue[currentCPU];
-		sRunQueue[currentCPU] = resultThread->queue_next;
+	sRunQueues[cpu].Remove(thread, prevThread);
+	thread->scheduler_data->fLastQueue = -1;
+
+	return thread;
+}
+
+
+/*!	Removes and returns the highest priority thread from the run queue of
+	\a sourceCPU that may be migrated to another CPU. If \a coldOnly is
+	\c true, threads whose data are likely still in the cache of the source
+	CPU are left alone.
+	Note: thread lock must be held when entering this function
+*/
+static Thread *
+dequeue_migratable_thread(int32 sourceCPU, bool coldOnly)
+{
+	RunQueue& queue = sRunQueues[sourceCPU];
+	bigtime_t now = system_time();
+
+	for (int32 priority = queue.HighestPriority(); priority >= 0;
+			priority = queue.NextPriorityBelow(priority)) {
+		Thread* prevThread = NULL;
+		for (Thread* thread = queue.heads[priority]; thread != NULL;
+				thread = thread->queue_next) {
+			if (thread->pinned_to_cpu <= 0 && (!coldOnly
+					|| !thread->scheduler_data->IsCacheHot(now))) {
+				return dequeue_from_run_queue(thread, prevThread, sourceCPU);
+			}
+
+			prevThread = thread;
+		}
 	}
-	sRunQueueSize[currentCPU]--;
-	resultThread->scheduler_data->fLastQueue = -1;
 
-	return resultThread;
+	return NULL;
 }
 
 
@@ -231,45 +421,52 @@ steal_thread_from_other_cpus(int32 currentCPU)
 {
 	// look through the active CPUs - find the one
 	// that has a) threads available to steal, and
-	// b) out of those, the one that's the most CPU-bound
-	// TODO: make this more intelligent along with enqueue
-	// - we need to try and maintain a reasonable balance
-	// in run queue sizes across CPUs, and also try to maintain
-	// an even distribution of cpu bound / interactive threads
-	int32 targetCPU = -1;
-	for (int32 i = 0; i < smp_get_num_cpus(); i++) {
-		// skip CPUs that have either no or only one thread
-		if (i == currentCPU || sRunQueueSize[i] < 2)
-			continue;
-
-		// out of the CPUs with threads available to steal,
-		// pick whichever one is generally the most CPU bound.
-		if (targetCPU < 0
-			|| sRunQueue[i]->priority > sRunQueue[targetCPU]->priority
-			|| (sRunQueue[i]->priority == sRunQueue[targetCPU]->priority
-				&& sRunQueueSize[i] > sRunQueueSize[targetCPU]))
-			targetCPU = i;
-	}
-
+	// b) out of those, the one that's the most CPU-bound.
+	// Only the queue sizes are looked at until a victim has been chosen.
+	int32 targetCPU = affine_get_busiest_cpu(currentCPU, 2);
 	if (targetCPU < 0)
 		return NULL;
 
-	Thread* nextThread = sRunQueue[targetCPU];
-	Thread* prevThread = NULL;
+	// An idle CPU is worse than a cold cache, so any unpinned thread will do.
+	Thread* thread = dequeue_migratable_thread(targetCPU, false);
+	if (thread != NULL)
+		sRunQueues[currentCPU].steals++;
 
-	while (nextThread != NULL) {
-		// grab the highest priority non-pinned thread
-		// out of this CPU's queue, dequeue and return it
-		if (nextThread->pinned_to_cpu <= 0) {
-			dequeue_from_run_queue(prevThread, targetCPU);
-			return nextThread;
-		}
+	return thread;
+}
 
-		prevThread = nextThread;
-		nextThread = nextThread->queue_next;
+
+/*!	Periodically evens out the run queue lengths by pulling threads from the
+	busiest CPU to the current one. Only threads that haven't been running
+	recently are moved, so that we don't throw away their cache footprint.
+	Note: thread lock must be held when entering this function
+*/
+static void
+affine_balance_load(int32 currentCPU)
+{
+	RunQueue& queue = sRunQueues[currentCPU];
+	bigtime_t now = system_time();
+	if (now - queue.last_balance < kLoadBalanceInterval
+		|| gCPU[currentCPU].disabled) {
+		return;
 	}
 
-	return NULL;
+	queue.last_balance = now;
+	queue.balance_runs++;
+
+	int32 busiestCPU = affine_get_busiest_cpu(currentCPU, queue.count + 2);
+	if (busiestCPU < 0)
+		return;
+
+	int32 toMove = (sRunQueues[busiestCPU].count - queue.count) / 2;
+	while (toMove-- > 0) {
+		Thread* thread = dequeue_migratable_thread(busiestCPU, true);
+		if (thread == NULL)
+			break;
+
+		T(RemoveThread(thread));
+		affine_insert_in_run_queue(thread, currentCPU);
+	}
 }
 
 
@@ -298,22 +495,19 @@ affine_set_thread_priority(Thread *thread, int32 priority)
 	NotifySchedulerListeners(&SchedulerListener::ThreadRemovedFromRunQueue,
 		thread);
 
-	// search run queues for the thread
-	Thread *item = NULL, *prev = NULL;
+	// search the thread's priority list for its predecessor
 	targetCPU = thread->scheduler_data->fLastQueue;
 
-	for (item = sRunQueue[targetCPU], prev = NULL; item && item != thread;
-			item = item->queue_next) {
-		if (prev)
-			prev = prev->queue_next;
-		else
-			prev = item;
+	Thread *item = NULL, *prev = NULL;
+	for (item = sRunQueues[targetCPU].heads[thread->priority]; item != NULL
+			&& item != thread; item = item->queue_next) {
+		prev = item;
 	}
 
 	ASSERT(item == thread);
 
 	// remove the thread
-	thread = dequeue_from_run_queue(prev, targetCPU);
+	thread = dequeue_from_run_queue(thread, prev, targetCPU);
 
 	// set priority and re-insert
 	thread->priority = thread->next_priority = priority;
@@ -371,10 +565,14 @@ affine_reschedule(void)
 		}
 	}
 
-	Thread *nextThread, *prevThread;
+	Thread *nextThread;
 
 	TRACE(("reschedule(): cpu %ld, cur_thread = %ld\n", currentCPU, oldThread->id));
 
+	// the thread's data are in this CPU's caches now
+	if (!thread_is_idle_thread(oldThread))
+		oldThread->scheduler_data->fLastRunTime = system_time();
+
 	oldThread->state = oldThread->next_state;
 	switch (oldThread->next_state) {
 		case B_THREAD_RUNNING:
@@ -392,31 +590,24 @@ affine_reschedule(void)
 			break;
 	}
 
-	nextThread = sRunQueue[currentCPU];
-	prevThread = NULL;
+	// pull over some work from other CPUs, if our share is too small
+	affine_balance_load(currentCPU);
 
-	if (sRunQueue[currentCPU] != NULL) {
+	RunQueue& queue = sRunQueues[currentCPU];
+
+	if (!queue.IsEmpty()) {
 		TRACE(("dequeueing next thread from cpu %ld\n", currentCPU));
 		// select next thread from the run queue
-		while (nextThread->queue_next) {
+		int32 priority = queue.HighestPriority();
+		while (priority < B_FIRST_REAL_TIME_PRIORITY) {
 			// always extract real time threads
-			if (nextThread->priority >= B_FIRST_REAL_TIME_PRIORITY)
-				break;
 
 			// find next thread with lower priority
-			Thread *lowerNextThread = nextThread->queue_next;
-			Thread *lowerPrevThread = nextThread;
-			int32 priority = nextThread->priority;
-
-			while (lowerNextThread != NULL
-				&& priority == lowerNextThread->priority) {
-				lowerPrevThread = lowerNextThread;
-				lowerNextThread = lowerNextThread->queue_next;
-			}
-			if (lowerNextThread == NULL)
+			int32 lowerPriority = queue.NextPriorityBelow(priority);
+			if (lowerPriority < 0)
 				break;
 
-			int32 priorityDiff = priority - lowerNextThread->priority;
+			int32 priorityDiff = priority - lowerPriority;
 			if (priorityDiff > 15)
 				break;
 
@@ -425,14 +616,15 @@ affine_reschedule(void)
 			if ((_rand() >> (15 - priorityDiff)) != 0)
 				break;
 
-			nextThread = lowerNextThread;
-			prevThread = lowerPrevThread;
+			priority = lowerPriority;
 		}
 
+		nextThread = queue.heads[priority];
+
 		TRACE(("dequeuing thread %ld from cpu %ld\n", nextThread->id,
 			currentCPU));
 		// extract selected thread from the run queue
-		dequeue_from_run_queue(prevThread, currentCPU);
+		dequeue_from_run_queue(nextThread, NULL, currentCPU);
 	} else {
 		if (!gCPU[currentCPU].disabled) {
 			TRACE(("CPU %ld stealing thread from other CPUs\n", currentCPU));
@@ -459,6 +651,8 @@ affine_reschedule(void)
 	NotifySchedulerListeners(&SchedulerListener::ThreadScheduled,
 		oldThread, nextThread);
 
+	scheduler_update_statistics(oldThread, nextThread);
+
 	nextThread->state = B_THREAD_RUNNING;
 	nextThread->next_state = B_THREAD_READY;
 	oldThread->was_yielded = false;
@@ -527,6 +721,13 @@ affine_on_thread_create(Thread* thread, bool idleThread)
 }
 
 
+static int32
+affine_run_queue_depth(int32 cpu)
+{
+	return sRunQueues[cpu].count;
+}
+
+
 static void
 affine_on_thread_init(Thread* thread)
 {
@@ -561,7 +762,8 @@ static scheduler_ops kAffineOps = {
 	affine_on_thread_create,
 	affine_on_thread_init,
 	affine_on_thread_destroy,
-	affine_start
+	affine_start,
+	affine_run_queue_depth
 };
 
 
@@ -572,8 +774,8 @@ void
 scheduler_affine_init()
 {
 	gScheduler = &kAffineOps;
-	memset(sRunQueue, 0, sizeof(sRunQueue));
-	memset(sRunQueueSize, 0, sizeof(sRunQueueSize));
+	for (int32 i = 0; i < B_MAX_CPU_COUNT; i++)
+		sRunQueues[i].Init();
 	add_debugger_command_etc("run_queue", &dump_run_queue,
 		"List threads in run queue", "\nLists threads in run queue", 0);
 }
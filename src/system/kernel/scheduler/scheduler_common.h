@@ -8,6 +8,7 @@
 
 #include <kscheduler.h>
 #include <smp.h>
+#include <thread.h>
 #include <user_debugger.h>
 
 
@@ -83,4 +84,69 @@ scheduler_update_thread_times(Thread* oldThread, Thread* nextThread)
 }
 
 
+/*!	Records the time the given thread has become ready to run.
+	This is a service function for scheduler implementations, to be called
+	whenever a thread is added to a run queue.
+*/
+static inline void
+scheduler_thread_ready(Thread* thread)
+{
+	// keep the time of the first enqueuing when a ready thread is requeued
+	if (thread->ready_time == 0)
+		thread->ready_time = system_time();
+}
+
+
+/*!	Updates the scheduling statistics of the current CPU and the involved
+	threads after \a nextThread has been chosen to replace \a oldThread.
+	This is a service function for scheduler implementations, to be called
+	before \c was_yielded of the old thread is reset.
+*/
+static inline void
+scheduler_update_statistics(Thread* oldThread, Thread* nextThread)
+{
+	if (nextThread == oldThread) {
+		// the thread just continues to run
+		nextThread->ready_time = 0;
+		return;
+	}
+
+	cpu_ent* cpu = oldThread->cpu;
+	cpu->context_switches++;
+
+	if (oldThread->state == B_THREAD_READY && !oldThread->was_yielded) {
+		cpu->involuntary_switches++;
+		oldThread->scheduler_info.involuntary_switches++;
+	}
+
+	if (thread_is_idle_thread(nextThread))
+		return;
+
+	if (nextThread->previous_cpu != NULL && nextThread->previous_cpu != cpu) {
+		cpu->migrations++;
+		nextThread->scheduler_info.migrations++;
+	}
+
+	if (nextThread->ready_time != 0) {
+		scheduler_thread_info& info = nextThread->scheduler_info;
+		bigtime_t latency = system_time() - nextThread->ready_time;
+		nextThread->ready_time = 0;
+
+		info.latencies++;
+		info.total_latency += latency;
+		if (latency > info.max_latency)
+			info.max_latency = latency;
+
+		int32 bucket = 0;
+		bigtime_t limit = 16;
+		while (latency >= limit
+			&& bucket < SCHEDULER_LATENCY_BUCKET_COUNT - 1) {
+			limit <<= 2;
+			bucket++;
+		}
+		info.latency_histogram[bucket]++;
+	}
+}
+
+
 #endif	// KERNEL_SCHEDULER_COMMON_H
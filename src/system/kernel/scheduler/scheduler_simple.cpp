@@ -84,6 +84,7 @@ static void
 simple_enqueue_in_run_queue(Thread *thread)
 {
 	thread->state = thread->next_state = B_THREAD_READY;
+	scheduler_thread_ready(thread);
 
 	Thread *curr, *prev;
 	for (curr = sRunQueue, prev = NULL; curr
@@ -297,6 +298,8 @@ simple_reschedule(void)
 	NotifySchedulerListeners(&SchedulerListener::ThreadScheduled,
 		oldThread, nextThread);
 
+	scheduler_update_statistics(oldThread, nextThread);
+
 	nextThread->state = B_THREAD_RUNNING;
 	nextThread->next_state = B_THREAD_READY;
 	oldThread->was_yielded = false;
@@ -343,6 +346,21 @@ simple_on_thread_create(Thread* thread, bool idleThread)
 }
 
 
+static int32
+simple_run_queue_depth(int32 cpu)
+{
+	// there is only the one run queue
+	int32 count = 0;
+	for (Thread* thread = sRunQueue; thread != NULL;
+			thread = thread->queue_next) {
+		if (thread->priority != B_IDLE_PRIORITY)
+			count++;
+	}
+
+	return count;
+}
+
+
 static void
 simple_on_thread_init(Thread* thread)
 {
@@ -377,7 +395,8 @@ static scheduler_ops kSimpleOps = {
 	simple_on_thread_create,
 	simple_on_thread_init,
 	simple_on_thread_destroy,
-	simple_start
+	simple_start,
+	simple_run_queue_depth
 };
 
 
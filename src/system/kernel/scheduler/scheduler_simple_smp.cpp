@@ -127,6 +127,7 @@ static void
 enqueue_in_run_queue(Thread *thread)
 {
 	thread->state = thread->next_state = B_THREAD_READY;
+	scheduler_thread_ready(thread);
 
 	Thread *curr, *prev;
 	for (curr = sRunQueue, prev = NULL; curr
@@ -396,6 +397,8 @@ reschedule(void)
 	NotifySchedulerListeners(&SchedulerListener::ThreadScheduled, oldThread,
 		nextThread);
 
+	scheduler_update_statistics(oldThread, nextThread);
+
 	nextThread->state = B_THREAD_RUNNING;
 	nextThread->next_state = B_THREAD_READY;
 	oldThread->was_yielded = false;
@@ -442,6 +445,21 @@ on_thread_create(Thread* thread, bool idleThread)
 }
 
 
+static int32
+run_queue_depth(int32 cpu)
+{
+	// all CPUs share the one run queue
+	int32 count = 0;
+	for (Thread* thread = sRunQueue; thread != NULL;
+			thread = thread->queue_next) {
+		if (thread->priority != B_IDLE_PRIORITY)
+			count++;
+	}
+
+	return count;
+}
+
+
 static void
 on_thread_init(Thread* thread)
 {
@@ -476,7 +494,8 @@ static scheduler_ops kSimpleSMPOps = {
 	on_thread_create,
 	on_thread_init,
 	on_thread_destroy,
-	start
+	start,
+	run_queue_depth
 };
 
 
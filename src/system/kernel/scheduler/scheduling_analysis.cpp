@@ -8,6 +8,7 @@
 #include <elf.h>
 #include <kernel.h>
 #include <scheduler_defs.h>
+#include <smp.h>
 #include <tracing.h>
 #include <util/AutoLock.h>
 #include <util/khash.h>
@@ -70,12 +71,18 @@ struct Thread : HashObject, scheduling_analysis_thread {
 
 	ThreadWaitObject* waitObject;
 
+	int32 lastCPU;
+	int32 priority;
+
 	Thread(thread_id id)
 		:
 		state(UNKNOWN),
 		lastTime(0),
 
-		waitObject(NULL)
+		waitObject(NULL),
+
+		lastCPU(-1),
+		priority(-1)
 	{
 		this->id = id;
 		name[0] = '\0';
@@ -98,6 +105,7 @@ struct Thread : HashObject, scheduling_analysis_thread {
 		unspecified_wait_time = 0;
 
 		preemptions = 0;
+		migrations = 0;
 
 		wait_objects = NULL;
 	}
@@ -219,6 +227,8 @@ public:
 		fAnalysis.threads = 0;
 		fAnalysis.wait_object_count = 0;
 		fAnalysis.thread_wait_object_count = 0;
+		fAnalysis.cpu_count = 0;
+		fAnalysis.cpus = NULL;
 
 		size_t maxObjectSize = max_c(max_c(sizeof(Thread), sizeof(WaitObject)),
 			sizeof(ThreadWaitObject));
@@ -243,6 +253,25 @@ public:
 		return &fAnalysis;
 	}
 
+	status_t InitCPUs(int32 count)
+	{
+		fAnalysis.cpus = (scheduling_analysis_cpu*)Allocate(
+			sizeof(scheduling_analysis_cpu) * count);
+		if (fAnalysis.cpus == NULL)
+			return B_NO_MEMORY;
+
+		memset(fAnalysis.cpus, 0, sizeof(scheduling_analysis_cpu) * count);
+		fAnalysis.cpu_count = count;
+		return B_OK;
+	}
+
+	scheduling_analysis_cpu* CPUFor(int32 cpu) const
+	{
+		if (cpu < 0 || (uint32)cpu >= fAnalysis.cpu_count)
+			return NULL;
+		return &fAnalysis.cpus[cpu];
+	}
+
 	void* Allocate(size_t size)
 	{
 		size = (size + 7) & ~(size_t)7;
@@ -569,6 +598,10 @@ static status_t
 analyze_scheduling(bigtime_t from, bigtime_t until,
 	SchedulingAnalysisManager& manager)
 {
+	status_t error = manager.InitCPUs(smp_get_num_cpus());
+	if (error != B_OK)
+		return error;
+
 	// analyze how much threads and locking primitives we're talking about
 	TraceEntryIterator iterator;
 	iterator.MoveTo(INT_MAX);
@@ -580,8 +613,7 @@ analyze_scheduling(bigtime_t from, bigtime_t until,
 		if (baseEntry->Time() < from)
 			break;
 
-		status_t error = manager.AddThread(baseEntry->ThreadID(),
-			baseEntry->Name());
+		error = manager.AddThread(baseEntry->ThreadID(), baseEntry->Name());
 		if (error != B_OK)
 			return error;
 
@@ -623,7 +655,7 @@ analyze_scheduling(bigtime_t from, bigtime_t until,
 		// might be info on a wait object
 		if (WaitObjectTraceEntry* waitObjectEntry
 				= dynamic_cast<WaitObjectTraceEntry*>(_entry)) {
-			status_t error = manager.UpdateWaitObject(waitObjectEntry->Type(),
+			error = manager.UpdateWaitObject(waitObjectEntry->Type(),
 				waitObjectEntry->Object(), waitObjectEntry->Name(),
 				waitObjectEntry->ReferencedObject());
 			if (error != B_OK)
@@ -642,9 +674,21 @@ analyze_scheduling(bigtime_t from, bigtime_t until,
 		if (ScheduleThread* entry = dynamic_cast<ScheduleThread*>(_entry)) {
 			// scheduled thread
 			Thread* thread = manager.ThreadFor(entry->ThreadID());
+			scheduling_analysis_cpu* cpu = manager.CPUFor(entry->CPU());
 
 			bigtime_t diffTime = entry->Time() - thread->lastTime;
 
+			thread->priority = entry->Priority();
+			if (thread->priority != B_IDLE_PRIORITY) {
+				if (thread->lastCPU >= 0 && thread->lastCPU != entry->CPU()) {
+					// the thread has been moved to another CPU
+					thread->migrations++;
+					if (cpu != NULL)
+						cpu->migrations++;
+				}
+				thread->lastCPU = entry->CPU();
+			}
+
 			if (thread->state == READY) {
 				// thread scheduled after having been woken up
 				thread->latencies++;
@@ -684,6 +728,13 @@ analyze_scheduling(bigtime_t from, bigtime_t until,
 
 			diffTime = entry->Time() - thread->lastTime;
 
+			if (cpu != NULL && thread->priority != B_IDLE_PRIORITY
+				&& (thread->state == STILL_RUNNING
+					|| thread->state == RUNNING)) {
+				cpu->runs++;
+				cpu->total_run_time += diffTime;
+			}
+
 			if (thread->state == STILL_RUNNING) {
 				// thread preempted
 				thread->runs++;
@@ -722,7 +773,7 @@ analyze_scheduling(bigtime_t from, bigtime_t until,
 							break;
 					}
 
-					status_t error = manager.AddThreadWaitObject(thread,
+					error = manager.AddThreadWaitObject(thread,
 						entry->PreviousWaitObjectType(), waitObject);
 					if (error != B_OK)
 						return error;
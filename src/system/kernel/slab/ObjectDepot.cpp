@@ -45,6 +45,18 @@ struct depot_cpu_store {
 };
 
 
+// The CPU stores are only accessed with interrupts disabled by their own
+// CPU; object_depot_make_empty() and object_depot_contains_object() get at
+// them via call_all_cpus_sync().
+
+
+// The magazine capacity is doubled each time the depot lock has been found
+// contended this often since the last resize.
+static const uint32 kMagazineResizeContentionThreshold = 64;
+// The capacity can grow up to this multiple of the initial one.
+static const size_t kMaxMagazineCapacityFactor = 8;
+
+
 RANGE_MARKER_FUNCTION_BEGIN(SlabObjectDepot)
 
 
@@ -131,12 +143,61 @@ empty_magazine(object_depot* depot, DepotMagazine* magazine, uint32 flags)
 }
 
 
+/*!	Acquires the depot's inner lock and keeps track of how often it had to be
+	waited for.
+*/
+static void
+lock_depot(object_depot* depot)
+{
+	if (!try_acquire_spinlock(&depot->inner_lock)) {
+		acquire_spinlock(&depot->inner_lock);
+		depot->contention_count++;
+		depot->resize_contention_count++;
+	}
+
+	depot->exchange_count++;
+}
+
+
+/*!	Grows the capacity of newly allocated magazines, if the depot lock has
+	been contended too often, so that the CPUs need to exchange their
+	magazines less frequently. Since the empty magazines in the depot
+	would be reused instead of allocating bigger ones, they are detached and
+	returned in \a _staleMagazines, the caller needs to free them.
+	The depot's inner lock must be held.
+*/
+static void
+grow_magazines_if_contended(object_depot* depot,
+	DepotMagazine*& _staleMagazines)
+{
+	if (depot->resize_contention_count < kMagazineResizeContentionThreshold)
+		return;
+
+	depot->resize_contention_count = 0;
+
+	size_t maxCapacity = std::min(
+		depot->min_magazine_capacity * kMaxMagazineCapacityFactor,
+		(size_t)UINT16_MAX);
+	if (depot->magazine_capacity >= maxCapacity)
+		return;
+
+	depot->magazine_capacity = std::min(depot->magazine_capacity * 2,
+		maxCapacity);
+	depot->resize_count++;
+
+	_staleMagazines = depot->empty;
+	depot->empty = NULL;
+	depot->empty_count = 0;
+}
+
+
 static bool
 exchange_with_full(object_depot* depot, DepotMagazine*& magazine)
 {
 	ASSERT(magazine->IsEmpty());
 
-	SpinLocker _(depot->inner_lock);
+	lock_depot(depot);
+	SpinLocker _(depot->inner_lock, true);
 
 	if (depot->full == NULL)
 		return false;
@@ -152,11 +213,14 @@ exchange_with_full(object_depot* depot, DepotMagazine*& magazine)
 
 static bool
 exchange_with_empty(object_depot* depot, DepotMagazine*& magazine,
-	DepotMagazine*& freeMagazine)
+	DepotMagazine*& freeMagazine, DepotMagazine*& staleMagazines)
 {
 	ASSERT(magazine == NULL || magazine->IsFull());
 
-	SpinLocker _(depot->inner_lock);
+	lock_depot(depot);
+	SpinLocker _(depot->inner_lock, true);
+
+	grow_magazines_if_contended(depot, staleMagazines);
 
 	if (depot->empty == NULL)
 		return false;
@@ -180,7 +244,8 @@ exchange_with_empty(object_depot* depot, DepotMagazine*& magazine,
 static void
 push_empty_magazine(object_depot* depot, DepotMagazine* magazine)
 {
-	SpinLocker _(depot->inner_lock);
+	lock_depot(depot);
+	SpinLocker _(depot->inner_lock, true);
 
 	_push(depot->empty, magazine);
 	depot->empty_count++;
@@ -207,6 +272,12 @@ object_depot_init(object_depot* depot, size_t capacity, size_t maxCount,
 	depot->full_count = depot->empty_count = 0;
 	depot->max_count = maxCount;
 	depot->magazine_capacity = capacity;
+	depot->min_magazine_capacity = capacity;
+
+	depot->exchange_count = 0;
+	depot->contention_count = 0;
+	depot->resize_contention_count = 0;
+	depot->resize_count = 0;
 
 	rw_lock_init(&depot->outer_lock, "object depot");
 	B_INITIALIZE_SPINLOCK(&depot->inner_lock);
@@ -245,7 +316,6 @@ object_depot_destroy(object_depot* depot, uint32 flags)
 void*
 object_depot_obtain(object_depot* depot)
 {
-	ReadLocker readLocker(depot->outer_lock);
 	InterruptsLocker interruptsLocker;
 
 	depot_cpu_store* store = object_depot_cpu(depot);
@@ -277,7 +347,6 @@ object_depot_obtain(object_depot* depot)
 void
 object_depot_store(object_depot* depot, void* object, uint32 flags)
 {
-	ReadLocker readLocker(depot->outer_lock);
 	InterruptsLocker interruptsLocker;
 
 	depot_cpu_store* store = object_depot_cpu(depot);
@@ -292,18 +361,22 @@ object_depot_store(object_depot* depot, void* object, uint32 flags)
 			return;
 
 		DepotMagazine* freeMagazine = NULL;
+		DepotMagazine* staleMagazines = NULL;
 		if ((store->previous != NULL && store->previous->IsEmpty())
-			|| exchange_with_empty(depot, store->previous, freeMagazine)) {
+			|| exchange_with_empty(depot, store->previous, freeMagazine,
+				staleMagazines)) {
 			std::swap(store->loaded, store->previous);
 
-			if (freeMagazine != NULL) {
-				// Free the magazine that didn't have space in the list
+			if (freeMagazine != NULL || staleMagazines != NULL) {
+				// Free the magazine that didn't have space in the list and
+				// the empty ones that are too small now
 				interruptsLocker.Unlock();
-				readLocker.Unlock();
 
-				empty_magazine(depot, freeMagazine, flags);
+				if (freeMagazine != NULL)
+					empty_magazine(depot, freeMagazine, flags);
+				while (staleMagazines != NULL)
+					free_magazine(_pop(staleMagazines), flags);
 
-				readLocker.Lock();
 				interruptsLocker.Lock();
 
 				store = object_depot_cpu(depot);
@@ -311,7 +384,9 @@ object_depot_store(object_depot* depot, void* object, uint32 flags)
 		} else {
 			// allocate a new empty magazine
 			interruptsLocker.Unlock();
-			readLocker.Unlock();
+
+			while (staleMagazines != NULL)
+				free_magazine(_pop(staleMagazines), flags);
 
 			DepotMagazine* magazine = alloc_magazine(depot, flags);
 			if (magazine == NULL) {
@@ -319,7 +394,6 @@ object_depot_store(object_depot* depot, void* object, uint32 flags)
 				return;
 			}
 
-			readLocker.Lock();
 			interruptsLocker.Lock();
 
 			push_empty_magazine(depot, magazine);
@@ -329,6 +403,38 @@ object_depot_store(object_depot* depot, void* object, uint32 flags)
 }
 
 
+struct depot_collect_info {
+	object_depot*	depot;
+	DepotMagazine*	magazines;
+};
+
+
+/*!	Called on every CPU by object_depot_make_empty() to move the CPU's
+	magazines to the collect list. Since it runs on the store's own CPU
+	with interrupts disabled, it cannot interfere with that CPU's fast path.
+	The other CPUs are collecting concurrently, so the depot lock protects
+	the list.
+*/
+static void
+collect_cpu_store_magazines(void* _info, int cpu)
+{
+	depot_collect_info* info = (depot_collect_info*)_info;
+	depot_cpu_store& store = info->depot->stores[cpu];
+
+	InterruptsSpinLocker _(info->depot->inner_lock);
+
+	if (store.loaded) {
+		_push(info->magazines, store.loaded);
+		store.loaded = NULL;
+	}
+
+	if (store.previous) {
+		_push(info->magazines, store.previous);
+		store.previous = NULL;
+	}
+}
+
+
 void
 object_depot_make_empty(object_depot* depot, uint32 flags)
 {
@@ -336,31 +442,31 @@ object_depot_make_empty(object_depot* depot, uint32 flags)
 
 	// collect the store magazines
 
-	DepotMagazine* storeMagazines = NULL;
+	depot_collect_info info;
+	info.depot = depot;
+	info.magazines = NULL;
 
-	int cpuCount = smp_get_num_cpus();
-	for (int i = 0; i < cpuCount; i++) {
-		depot_cpu_store& store = depot->stores[i];
+	call_all_cpus_sync(&collect_cpu_store_magazines, &info);
 
-		if (store.loaded) {
-			_push(storeMagazines, store.loaded);
-			store.loaded = NULL;
-		}
+	DepotMagazine* storeMagazines = info.magazines;
 
-		if (store.previous) {
-			_push(storeMagazines, store.previous);
-			store.previous = NULL;
-		}
-	}
+	// detach the depot's full and empty magazines, and go back to the
+	// initial magazine size -- memory is scarce
 
-	// detach the depot's full and empty magazines
+	InterruptsSpinLocker depotLocker(depot->inner_lock);
 
 	DepotMagazine* fullMagazines = depot->full;
 	depot->full = NULL;
+	depot->full_count = 0;
 
 	DepotMagazine* emptyMagazines = depot->empty;
 	depot->empty = NULL;
+	depot->empty_count = 0;
+
+	depot->magazine_capacity = depot->min_magazine_capacity;
+	depot->resize_contention_count = 0;
 
+	depotLocker.Unlock();
 	writeLocker.Unlock();
 
 	// free all magazines
@@ -378,25 +484,44 @@ object_depot_make_empty(object_depot* depot, uint32 flags)
 
 #if PARANOID_KERNEL_FREE
 
+struct depot_contains_info {
+	object_depot*	depot;
+	void*			object;
+	bool			found;
+};
+
+
+/*!	Called on every CPU by object_depot_contains_object() to look for the
+	object in the CPU's own store.
+*/
+static void
+check_cpu_store_contains_object(void* _info, int cpu)
+{
+	depot_contains_info* info = (depot_contains_info*)_info;
+	depot_cpu_store& store = info->depot->stores[cpu];
+
+	if ((store.loaded != NULL && store.loaded->ContainsObject(info->object))
+		|| (store.previous != NULL
+			&& store.previous->ContainsObject(info->object)))
+		info->found = true;
+}
+
+
 bool
 object_depot_contains_object(object_depot* depot, void* object)
 {
 	WriteLocker writeLocker(depot->outer_lock);
 
-	int cpuCount = smp_get_num_cpus();
-	for (int i = 0; i < cpuCount; i++) {
-		depot_cpu_store& store = depot->stores[i];
+	depot_contains_info info;
+	info.depot = depot;
+	info.object = object;
+	info.found = false;
 
-		if (store.loaded != NULL && !store.loaded->IsEmpty()) {
-			if (store.loaded->ContainsObject(object))
-				return true;
-		}
+	call_all_cpus_sync(&check_cpu_store_contains_object, &info);
+	if (info.found)
+		return true;
 
-		if (store.previous != NULL && !store.previous->IsEmpty()) {
-			if (store.previous->ContainsObject(object))
-				return true;
-		}
-	}
+	InterruptsSpinLocker depotLocker(depot->inner_lock);
 
 	for (DepotMagazine* magazine = depot->full; magazine != NULL;
 			magazine = magazine->next) {
@@ -419,7 +544,11 @@ dump_object_depot(object_depot* depot)
 	kprintf("  full:     %p, count %lu\n", depot->full, depot->full_count);
 	kprintf("  empty:    %p, count %lu\n", depot->empty, depot->empty_count);
 	kprintf("  max full: %lu\n", depot->max_count);
-	kprintf("  capacity: %lu\n", depot->magazine_capacity);
+	kprintf("  capacity: %lu (initial %lu, %lu resizes)\n",
+		depot->magazine_capacity, depot->min_magazine_capacity,
+		depot->resize_count);
+	kprintf("  exchanges: %llu, contended: %llu\n", depot->exchange_count,
+		depot->contention_count);
 	kprintf("  stores:\n");
 
 	int cpuCount = smp_get_num_cpus();
@@ -11,17 +11,20 @@
 
 #include <algorithm>
 #include <new>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <KernelExport.h>
 
+#include <AutoDeleter.h>
 #include <condition_variable.h>
 #include <elf.h>
 #include <kernel.h>
 #include <low_resource_manager.h>
 #include <slab/ObjectDepot.h>
 #include <smp.h>
+#include <system_info.h>
 #include <tracing.h>
 #include <util/AutoLock.h>
 #include <util/DoublyLinkedList.h>
@@ -258,18 +261,25 @@ dump_slab(::slab* slab)
 static int
 dump_slabs(int argc, char* argv[])
 {
-	kprintf("%10s %22s %8s %8s %8s %6s %8s %8s %8s\n", "address", "name",
-		"objsize", "align", "usage", "empty", "usedobj", "total", "flags");
+	kprintf("%10s %22s %8s %8s %8s %6s %8s %8s %8s %6s %10s %8s\n",
+		"address", "name", "objsize", "align", "usage", "empty", "usedobj",
+		"total", "flags", "magcap", "exchanges", "contended");
 
 	ObjectCacheList::Iterator it = sObjectCaches.GetIterator();
 
 	while (it.HasNext()) {
 		ObjectCache* cache = it.Next();
 
-		kprintf("%p %22s %8lu %8" B_PRIuSIZE " %8lu %6lu %8lu %8lu %8lx\n",
+		kprintf("%p %22s %8lu %8" B_PRIuSIZE " %8lu %6lu %8lu %8lu %8lx",
 			cache, cache->name, cache->object_size, cache->alignment,
 			cache->usage, cache->empty_count, cache->used_count,
 			cache->total_objects, cache->flags);
+
+		if ((cache->flags & CACHE_NO_DEPOT) == 0) {
+			kprintf(" %6lu %10llu %8llu\n", cache->depot.magazine_capacity,
+				cache->depot.exchange_count, cache->depot.contention_count);
+		} else
+			kprintf(" %6s %10s %8s\n", "-", "-", "-");
 	}
 
 	return 0;
@@ -1338,6 +1348,75 @@ object_cache_get_usage(object_cache* cache, size_t* _allocatedMemory)
 }
 
 
+/*!	Copies statistics of as many object caches as fit into the given userland
+	buffer.
+*/
+status_t
+object_cache_get_user_info(system_object_cache_info* userInfo, size_t size)
+{
+	size_t headerSize = offsetof(system_object_cache_info, caches);
+	if (size < headerSize)
+		return B_BAD_VALUE;
+
+	uint32 maxCount = (size - headerSize) / sizeof(object_cache_info);
+
+	// We can't copy to userland while holding the list lock, so the infos are
+	// collected in a kernel buffer first.
+	MutexLocker cacheListLocker(sObjectCacheListLock);
+	uint32 count = sObjectCaches.Count();
+	cacheListLocker.Unlock();
+
+	maxCount = std::min(maxCount, count);
+	object_cache_info* infos = NULL;
+	if (maxCount > 0) {
+		infos = (object_cache_info*)malloc(maxCount * sizeof(object_cache_info));
+		if (infos == NULL)
+			return B_NO_MEMORY;
+	}
+	MemoryDeleter infosDeleter(infos);
+
+	cacheListLocker.Lock();
+
+	count = 0;
+	ObjectCacheList::Iterator it = sObjectCaches.GetIterator();
+	while (ObjectCache* cache = it.Next()) {
+		if (count < maxCount) {
+			object_cache_info& info = infos[count];
+			strlcpy(info.name, cache->name, sizeof(info.name));
+			info.object_size = cache->object_size;
+			info.usage = cache->usage;
+			info.used_count = cache->used_count;
+			info.total_objects = cache->total_objects;
+
+			if ((cache->flags & CACHE_NO_DEPOT) == 0) {
+				info.magazine_capacity = cache->depot.magazine_capacity;
+				info.depot_exchanges = cache->depot.exchange_count;
+				info.depot_contentions = cache->depot.contention_count;
+			} else {
+				info.magazine_capacity = 0;
+				info.depot_exchanges = 0;
+				info.depot_contentions = 0;
+			}
+		}
+		count++;
+	}
+
+	cacheListLocker.Unlock();
+
+	system_object_cache_info header;
+	header.cache_count = count;
+	header.info_count = std::min(maxCount, count);
+
+	if (user_memcpy(userInfo, &header, headerSize) != B_OK
+		|| (header.info_count > 0 && user_memcpy(userInfo->caches, infos,
+			header.info_count * sizeof(object_cache_info)) != B_OK)) {
+		return B_BAD_ADDRESS;
+	}
+
+	return B_OK;
+}
+
+
 void
 slab_init(kernel_args* args)
 {
@@ -25,12 +25,14 @@
 #include <cpu.h>
 #include <debug.h>
 #include <kernel.h>
+#include <kscheduler.h>
 #include <lock.h>
 #include <Notifications.h>
 #include <messaging.h>
 #include <port.h>
 #include <real_time_clock.h>
 #include <sem.h>
+#include <slab/Slab.h>
 #include <smp.h>
 #include <team.h>
 #include <thread.h>
@@ -506,6 +508,21 @@ _user_get_system_info_etc(int32 id, void* userInfo, size_t size)
 			return user_memcpy(userInfo, &info, sizeof(system_memory_info));
 		}
 
+		case B_OBJECT_CACHE_INFO:
+			return object_cache_get_user_info(
+				(system_object_cache_info*)userInfo, size);
+
+		case B_SCHEDULER_INFO:
+		{
+			if (size < sizeof(system_scheduler_info))
+				return B_BAD_VALUE;
+
+			system_scheduler_info info;
+			scheduler_get_info(&info);
+
+			return user_memcpy(userInfo, &info, sizeof(system_scheduler_info));
+		}
+
 		default:
 			return B_BAD_VALUE;
 	}
@@ -180,6 +180,7 @@ Thread::Thread(const char* name, thread_id threadID, struct cpu_ent* cpu)
 	signal_stack_enabled(false),
 	in_kernel(true),
 	was_yielded(false),
+	ready_time(0),
 	user_thread(NULL),
 	fault_handler(0),
 	page_faults_allowed(1),
@@ -216,6 +217,8 @@ Thread::Thread(const char* name, thread_id threadID, struct cpu_ent* cpu)
 
 	alarm.period = 0;
 
+	memset(&scheduler_info, 0, sizeof(scheduler_info));
+
 	exit.status = 0;
 
 	list_init(&exit.waiters);
@@ -675,6 +675,8 @@ VMCache::Delete()
 		}
 
 		// remove it
+		if (page->State() == PAGE_STATE_MODIFIED && !temporary)
+			vm_page_modified_pages_changed(this, -1);
 		pages.Remove(page);
 		page->SetCacheRef(NULL);
 
@@ -797,6 +799,8 @@ VMCache::InsertPage(vm_page* page, off_t offset)
 
 	if (page->WiredCount() > 0)
 		IncrementWiredPagesCount();
+	if (page->State() == PAGE_STATE_MODIFIED && !temporary)
+		vm_page_modified_pages_changed(this, 1);
 }
 
 
@@ -817,6 +821,9 @@ VMCache::RemovePage(vm_page* page)
 
 	T2(RemovePage(this, page));
 
+	if (page->State() == PAGE_STATE_MODIFIED && !temporary)
+		vm_page_modified_pages_changed(this, -1);
+
 	pages.Remove(page);
 	page_count--;
 	page->SetCacheRef(NULL);
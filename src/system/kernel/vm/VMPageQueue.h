@@ -40,8 +40,11 @@ public:
 	inline	void				AppendUnlocked(vm_page* page);
 	inline	void				AppendUnlocked(PageList& pages, uint32 count);
 	inline	void				PrependUnlocked(vm_page* page);
+	inline	void				PrependUnlocked(PageList& pages);
 	inline	void				RemoveUnlocked(vm_page* page);
 	inline	vm_page*			RemoveHeadUnlocked();
+	inline	uint32				RemoveHeadUnlocked(PageList& pages,
+									uint32 count);
 	inline	void				RequeueUnlocked(vm_page* page, bool tail);
 
 	inline	vm_page*			Head() const;
@@ -217,6 +220,16 @@ VMPageQueue::PrependUnlocked(vm_page* page)
 }
 
 
+void
+VMPageQueue::PrependUnlocked(PageList& pages)
+{
+	InterruptsSpinLocker locker(fLock);
+
+	while (vm_page* page = pages.RemoveTail())
+		Prepend(page);
+}
+
+
 void
 VMPageQueue::RemoveUnlocked(vm_page* page)
 {
@@ -233,6 +246,29 @@ VMPageQueue::RemoveHeadUnlocked()
 }
 
 
+/*!	Moves up to \a count pages from the head of the queue to the tail of
+	\a pages.
+	\return The number of pages actually moved.
+*/
+uint32
+VMPageQueue::RemoveHeadUnlocked(PageList& pages, uint32 count)
+{
+	InterruptsSpinLocker locker(fLock);
+
+	uint32 removed = 0;
+	while (removed < count) {
+		vm_page* page = RemoveHead();
+		if (page == NULL)
+			break;
+
+		pages.Add(page);
+		removed++;
+	}
+
+	return removed;
+}
+
+
 void
 VMPageQueue::RequeueUnlocked(vm_page* page, bool tail)
 {
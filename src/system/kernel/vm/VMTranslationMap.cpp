@@ -39,6 +39,33 @@ VMTranslationMap::DebugMarkRangePresent(addr_t start, addr_t end,
 }
 
 
+/*!	Returns the size of the large pages the map can use, or \c 0, if it
+	doesn't support large pages.
+
+	The default implementation returns \c 0.
+*/
+size_t
+VMTranslationMap::LargePageSize() const
+{
+	return 0;
+}
+
+
+/*!	Replaces the page mappings in the given range by large page mappings where
+	possible, i.e. for every large page sized and aligned block of the range
+	whose pages are all mapped with the same attributes to a physically
+	contiguous and equally aligned range.
+	The map transparently splits a large page into page mappings again as soon
+	as any of its pages is unmapped, protected, or has its flags cleared.
+
+	The default implementation does nothing.
+*/
+void
+VMTranslationMap::Promote(addr_t base, size_t size)
+{
+}
+
+
 /*!	Unmaps a range of pages of an area.
 
 	The default implementation just iterates over all virtual pages of the
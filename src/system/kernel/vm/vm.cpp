@@ -1284,6 +1284,7 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 	// For full lock or contiguous areas we're also going to map the pages and
 	// thus need to reserve pages for the mapping backend upfront.
 	addr_t reservedMapPages = 0;
+	size_t largePageSize = 0;
 	if (wiring == B_FULL_LOCK || wiring == B_CONTIGUOUS) {
 		AddressSpaceWriteLocker locker;
 		status_t status = locker.SetTo(team);
@@ -1292,6 +1293,21 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 
 		VMTranslationMap* map = locker.AddressSpace()->TranslationMap();
 		reservedMapPages = map->MaxPagesNeededToMap(0, size - 1);
+		if (!isStack)
+			largePageSize = map->LargePageSize();
+	}
+
+	// Areas that are large enough to be backed by large pages are aligned
+	// accordingly, if the caller doesn't care about the address.
+	virtual_address_restrictions largePageAddressRestrictions;
+	if (largePageSize != 0 && size >= largePageSize
+		&& virtualAddressRestrictions->alignment == 0
+		&& (virtualAddressRestrictions->address_specification == B_ANY_ADDRESS
+			|| virtualAddressRestrictions->address_specification
+				== B_ANY_KERNEL_ADDRESS)) {
+		largePageAddressRestrictions = *virtualAddressRestrictions;
+		largePageAddressRestrictions.alignment = largePageSize;
+		virtualAddressRestrictions = &largePageAddressRestrictions;
 	}
 
 	int priority;
@@ -1406,12 +1422,47 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 
 		case B_FULL_LOCK:
 		{
-			// Allocate and map all pages for this area
+			// Allocate and map all pages for this area. Where a large page
+			// fits, we try to get a physically contiguous, aligned run of
+			// pages, so that the translation map can use a large page mapping.
+			// Once there is no such run, the physical memory is too
+			// fragmented, and we use single pages for the rest of the area,
+			// as every further attempt would scan all pages again.
+			physical_address_restrictions largePageRestrictions = {};
+			largePageRestrictions.alignment = largePageSize;
+			bool tryLargePages = largePageSize != 0;
 
 			off_t offset = 0;
 			for (addr_t address = area->Base();
 					address < area->Base() + (area->Size() - 1);
 					address += B_PAGE_SIZE, offset += B_PAGE_SIZE) {
+				if (tryLargePages && address % largePageSize == 0
+					&& area->Base() + area->Size() - address >= largePageSize) {
+					page_num_t pageCount = largePageSize / B_PAGE_SIZE;
+					vm_page* page = vm_page_allocate_reserved_page_run(
+						&reservation, PAGE_STATE_WIRED | pageAllocFlags,
+						pageCount, &largePageRestrictions);
+					if (page != NULL) {
+						for (page_num_t i = 0; i < pageCount; i++, page++) {
+							cache->InsertPage(page, offset);
+							map_page(area, page, address, protection,
+								&reservation);
+
+							DEBUG_PAGE_ACCESS_END(page);
+
+							address += B_PAGE_SIZE;
+							offset += B_PAGE_SIZE;
+						}
+
+						// compensate for the loop increment
+						address -= B_PAGE_SIZE;
+						offset -= B_PAGE_SIZE;
+						continue;
+					}
+
+					tryLargePages = false;
+				}
+
 #ifdef DEBUG_KERNEL_STACKS
 #	ifdef STACK_GROWS_DOWNWARDS
 				if (isStack && address < area->Base()
@@ -1422,14 +1473,21 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 #	endif
 					continue;
 #endif
-				vm_page* page = vm_page_allocate_page(&reservation,
-					PAGE_STATE_WIRED | pageAllocFlags);
+				vm_page* page = vm_page_allocate_page_etc(&reservation,
+					PAGE_STATE_WIRED | pageAllocFlags, offset / B_PAGE_SIZE);
 				cache->InsertPage(page, offset);
 				map_page(area, page, address, protection, &reservation);
 
 				DEBUG_PAGE_ACCESS_END(page);
 			}
 
+			if (largePageSize != 0) {
+				VMTranslationMap* map = addressSpace->TranslationMap();
+				map->Lock();
+				map->Promote(area->Base(), area->Size());
+				map->Unlock();
+			}
+
 			break;
 		}
 
@@ -1472,6 +1530,7 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 				DEBUG_PAGE_ACCESS_END(page);
 			}
 
+			map->Promote(area->Base(), area->Size());
 			map->Unlock();
 			break;
 		}
@@ -1506,6 +1565,7 @@ vm_create_anonymous_area(team_id team, const char *name, addr_t size,
 				DEBUG_PAGE_ACCESS_END(page);
 			}
 
+			map->Promote(area->Base(), area->Size());
 			map->Unlock();
 			break;
 		}
@@ -1589,6 +1649,18 @@ vm_map_physical_memory(team_id team, const char* name, void** _address,
 	virtual_address_restrictions addressRestrictions = {};
 	addressRestrictions.address = *_address;
 	addressRestrictions.address_specification = addressSpec & ~B_MTR_MASK;
+
+	// If the range can be mapped with large pages, align the area accordingly.
+	size_t largePageSize
+		= locker.AddressSpace()->TranslationMap()->LargePageSize();
+	if (largePageSize != 0 && size >= largePageSize
+		&& physicalAddress % largePageSize == 0
+		&& (addressRestrictions.address_specification == B_ANY_ADDRESS
+			|| addressRestrictions.address_specification
+				== B_ANY_KERNEL_ADDRESS)) {
+		addressRestrictions.alignment = largePageSize;
+	}
+
 	status = map_backing_store(locker.AddressSpace(), cache, 0, name, size,
 		B_FULL_LOCK, protection, REGION_NO_PRIVATE_MAP, 0, &addressRestrictions,
 		true, &area, _address);
@@ -1621,6 +1693,7 @@ vm_map_physical_memory(team_id team, const char* name, void** _address,
 		// memory type.
 		map->Lock();
 		map->ProtectArea(area, area->protection);
+		map->Promote(area->Base(), area->Size());
 		map->Unlock();
 	} else {
 		// Map the area completely.
@@ -1640,6 +1713,7 @@ vm_map_physical_memory(team_id team, const char* name, void** _address,
 				protection, area->MemoryType(), &reservation);
 		}
 
+		map->Promote(area->Base(), area->Size());
 		map->Unlock();
 
 		vm_page_unreserve_pages(&reservation);
@@ -2658,9 +2732,16 @@ vm_set_area_protection(team_id team, area_id areaID, uint32 newProtection,
 						map->ProtectPage(area, address, newProtection);
 					}
 				}
-			} else
+			} else {
 				map->ProtectArea(area, newProtection);
 
+				// wired areas may still be backed by large pages
+				if (area->wiring == B_FULL_LOCK
+					|| area->wiring == B_CONTIGUOUS) {
+					map->Promote(area->Base(), area->Size());
+				}
+			}
+
 			map->Unlock();
 		}
 
@@ -4299,9 +4380,10 @@ fault_get_page(PageFaultContext& context)
 		// may have direct write access.
 		cache = context.isWrite ? context.topCache : lastCache;
 
-		// allocate a clean page
-		page = vm_page_allocate_page(&context.reservation,
-			PAGE_STATE_ACTIVE | VM_PAGE_ALLOC_CLEAR);
+		// allocate a clean page, coloured by its offset in the cache
+		page = vm_page_allocate_page_etc(&context.reservation,
+			PAGE_STATE_ACTIVE | VM_PAGE_ALLOC_CLEAR,
+			context.cacheOffset / B_PAGE_SIZE);
 		FTRACE(("vm_soft_fault: just allocated page 0x%" B_PRIxPHYSADDR "\n",
 			page->physical_page_number));
 
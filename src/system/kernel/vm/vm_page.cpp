@@ -23,10 +23,12 @@
 #include <block_cache.h>
 #include <boot/kernel_args.h>
 #include <condition_variable.h>
+#include <driver_settings.h>
 #include <elf.h>
 #include <heap.h>
 #include <kernel.h>
 #include <low_resource_manager.h>
+#include <smp.h>
 #include <thread.h>
 #include <tracing.h>
 #include <util/AutoLock.h>
@@ -133,6 +135,86 @@ static mutex sPageDeficitLock = MUTEX_INITIALIZER("page deficit");
 static rw_lock sFreePageQueuesLock
 	= RW_LOCK_INITIALIZER("free/clear page queues");
 
+// Per-CPU free page caches. A cached page is in PAGE_STATE_FREE, but not in
+// sFreePageQueue. The caches are refilled from and drained to the free queue
+// in batches, and may only be accessed with sFreePageQueuesLock read locked
+// (plus the cache's spinlock). Whoever write locks sFreePageQueuesLock and
+// needs to see all free pages in the free queue has to call
+// drain_free_page_caches() first.
+static const uint32 kFreePageCacheBatch = 16;
+static const uint32 kFreePageCacheMax = 4 * kFreePageCacheBatch;
+
+// Number of page colours, i.e. pages of a typical L2 cache way. Page colouring
+// is off by default and can be enabled with the "page_coloring" setting in the
+// virtual_memory settings file.
+static const uint32 kPageColorCount = 16;
+
+struct free_page_cache {
+	spinlock				lock;
+	VMPageQueue::PageList	pages[kPageColorCount];
+	uint32					count;
+	uint32					next_color;
+
+	// statistics
+	uint64					hits;
+	uint64					misses;
+	uint64					color_hits;
+	uint64					color_misses;
+	uint64					refills;
+	uint64					drains;
+};
+
+static free_page_cache sFreePageCaches[B_MAX_CPU_COUNT];
+static bool sFreePageCachesEnabled = false;
+static bool sPageColoring = false;
+
+static void dump_free_page_caches();
+
+// Write-back devices. Modified pages of non-temporary caches are accounted to
+// the device their cache writes back to (VMCache::WriteBackDevice()). The page
+// writer keeps at most one run per device in flight, so that a slow device
+// doesn't hold up write-back to the others, and writers to a device with too
+// many modified pages are throttled in vm_page_throttle_dirty_pages().
+static const int32 kWriteBackDeviceCount = 32;
+static const int32 kPageWriterRunCount = 4;
+static const uint32 kPagesPerWriterRun = 128;
+// The page writer looks at no more than this many pages per free slot in its
+// runs each time it collects pages.
+static const uint32 kPageWriterScanFactor = 4;
+
+// Minimum modified pages limit of a single device.
+static const page_num_t kMinDeviceDirtyPages = 256;
+// A device shall not have more modified pages than it can write in this time.
+static const bigtime_t kMaxDeviceWriteBackTime = 5000000LL;	// 5 secs
+// Maximum time a single write is delayed by write-back throttling.
+static const bigtime_t kMaxDirtyThrottleDelay = 200000LL;	// 0.2 secs
+
+struct writeback_device {
+	volatile dev_t			device;
+	volatile bool			in_use;
+	bool					writing;
+	vint32					dirty_pages;
+	vint32					bandwidth;		// pages per second
+
+	// statistics
+	uint64					written_pages;
+	uint64					failed_pages;
+	uint64					runs;
+	vint64					throttled;
+	vint64					throttle_time;
+};
+
+static writeback_device sWriteBackDevices[kWriteBackDeviceCount];
+static spinlock sWriteBackDevicesLock = B_SPINLOCK_INITIALIZER;
+
+// Percentage of the pageable memory that may be modified before the page
+// writer is started respectively before writers are throttled. Configurable
+// via the "dirty_background_ratio" and "dirty_ratio" virtual_memory settings.
+static uint32 sDirtyBackgroundRatio = 5;
+static uint32 sDirtyRatio = 20;
+
+static ConditionVariable sDirtyThrottleCondition;
+
 #ifdef TRACK_PAGE_USAGE_STATS
 static page_num_t sPageUsageArrays[512];
 static page_num_t* sPageUsage = sPageUsageArrays;
@@ -196,27 +278,21 @@ typedef DoublyLinkedList<PageReservationWaiter> PageReservationWaiterList;
 static PageReservationWaiterList sPageReservationWaiters;
 
 
+/*!	A condition a daemon thread waits on. Since it is protected by a spinlock,
+	WakeUp() may also be called from interrupt context, like the completion
+	callbacks of the page writer's I/O.
+*/
 struct DaemonCondition {
 	void Init(const char* name)
 	{
-		mutex_init(&fLock, "daemon condition");
+		B_INITIALIZE_SPINLOCK(&fLock);
 		fCondition.Init(this, name);
 		fActivated = false;
 	}
 
-	bool Lock()
-	{
-		return mutex_lock(&fLock) == B_OK;
-	}
-
-	void Unlock()
-	{
-		mutex_unlock(&fLock);
-	}
-
 	bool Wait(bigtime_t timeout, bool clearActivated)
 	{
-		MutexLocker locker(fLock);
+		InterruptsSpinLocker locker(fLock);
 		if (clearActivated)
 			fActivated = false;
 		else if (fActivated)
@@ -235,19 +311,19 @@ struct DaemonCondition {
 		if (fActivated)
 			return;
 
-		MutexLocker locker(fLock);
+		InterruptsSpinLocker locker(fLock);
 		fActivated = true;
 		fCondition.NotifyOne();
 	}
 
 	void ClearActivated()
 	{
-		MutexLocker locker(fLock);
+		InterruptsSpinLocker locker(fLock);
 		fActivated = false;
 	}
 
 private:
-	mutex				fLock;
+	spinlock			fLock;
 	ConditionVariable	fCondition;
 	bool				fActivated;
 };
@@ -1148,6 +1224,9 @@ dump_page_stats(int argc, char **argv)
 		&sInactivePageQueue, sInactivePageQueue.Count());
 	kprintf("cached queue: %p, count = %" B_PRIuPHYSADDR "\n",
 		&sCachedPageQueue, sCachedPageQueue.Count());
+
+	kprintf("\n");
+	dump_free_page_caches();
 	return 0;
 }
 
@@ -1483,6 +1562,368 @@ unreserve_pages(uint32 count)
 }
 
 
+// #pragma mark - per-CPU free page caches
+
+
+static inline uint32
+page_color(vm_page* page)
+{
+	return sPageColoring ? page->physical_page_number % kPageColorCount : 0;
+}
+
+
+static inline void
+free_page_cache_add(free_page_cache* cache, vm_page* page)
+{
+	cache->pages[page_color(page)].Add(page, false);
+	cache->count++;
+}
+
+
+/*!	Removes up to \a count pages from the tails (the least recently freed
+	pages) of the cache's colour lists, taking them round-robin from all
+	colours, and adds them to \a pages.
+	The caller must hold the cache's lock.
+*/
+static uint32
+free_page_cache_remove(free_page_cache* cache, VMPageQueue::PageList& pages,
+	uint32 count)
+{
+	uint32 removed = 0;
+	while (removed < count && cache->count > 0) {
+		for (uint32 i = 0; i < kPageColorCount && removed < count; i++) {
+			vm_page* page = cache->pages[i].RemoveTail();
+			if (page != NULL) {
+				pages.Add(page);
+				cache->count--;
+				removed++;
+			}
+		}
+	}
+
+	return removed;
+}
+
+
+/*!	Moves the pages of all per-CPU free page caches back to the free queue.
+	The caller must hold sFreePageQueuesLock write locked.
+*/
+static void
+drain_free_page_caches()
+{
+	if (!sFreePageCachesEnabled)
+		return;
+
+	int32 cpuCount = smp_get_num_cpus();
+	for (int32 i = 0; i < cpuCount; i++) {
+		free_page_cache* cache = &sFreePageCaches[i];
+
+		InterruptsSpinLocker locker(cache->lock);
+		if (cache->count == 0)
+			continue;
+
+		VMPageQueue::PageList pages;
+		free_page_cache_remove(cache, pages, cache->count);
+		cache->drains++;
+
+		while (vm_page* page = pages.RemoveHead())
+			sFreePageQueue.Append(page);
+	}
+}
+
+
+/*!	Tries to allocate a page from the current CPU's free page cache, refilling
+	the cache from the free queue, if necessary.
+	If page colouring is enabled, a page of the colour \a colorHint is
+	preferred; if \a colorOnly is \c true, no page of another colour is
+	returned. Without a hint the colours are used in turn.
+	The caller must hold sFreePageQueuesLock read locked.
+	\return A page in state \c PAGE_STATE_FREE that is in no queue, or \c NULL,
+		if none was available.
+*/
+static vm_page*
+allocate_cached_free_page(page_num_t colorHint, bool colorOnly)
+{
+	if (!sFreePageCachesEnabled)
+		return NULL;
+
+	cpu_status state = disable_interrupts();
+	free_page_cache* cache = &sFreePageCaches[smp_get_current_cpu()];
+	acquire_spinlock(&cache->lock);
+
+	uint32 color = 0;
+	if (sPageColoring) {
+		if (colorHint == VM_PAGE_NO_COLOR_HINT)
+			colorHint = cache->next_color++;
+		color = colorHint % kPageColorCount;
+	} else
+		colorOnly = false;
+
+	if (cache->count < kFreePageCacheBatch
+		|| (colorOnly && cache->pages[color].IsEmpty())) {
+		VMPageQueue::PageList pages;
+		uint32 count = sFreePageQueue.RemoveHeadUnlocked(pages,
+			std::min(kFreePageCacheBatch, kFreePageCacheMax - cache->count));
+		if (count > 0) {
+			cache->refills++;
+			while (vm_page* page = pages.RemoveHead())
+				free_page_cache_add(cache, page);
+		}
+	}
+
+	vm_page* page = cache->pages[color].RemoveHead();
+	if (page != NULL) {
+		cache->hits++;
+		if (sPageColoring)
+			cache->color_hits++;
+	} else if (!colorOnly) {
+		for (uint32 i = 1; i < kPageColorCount; i++) {
+			page = cache->pages[(color + i) % kPageColorCount].RemoveHead();
+			if (page != NULL)
+				break;
+		}
+
+		if (page != NULL) {
+			cache->hits++;
+			cache->color_misses++;
+		}
+	}
+
+	if (page != NULL)
+		cache->count--;
+	else
+		cache->misses++;
+
+	release_spinlock(&cache->lock);
+	restore_interrupts(state);
+
+	return page;
+}
+
+
+/*!	Adds a freed page to the current CPU's free page cache. If the cache is
+	full, a batch of the least recently freed pages is moved to the free queue.
+	The caller must hold sFreePageQueuesLock read locked, and the page must
+	already be in state \c PAGE_STATE_FREE.
+	\return \c false, if the per-CPU caches are disabled.
+*/
+static bool
+free_page_to_cache(vm_page* page)
+{
+	if (!sFreePageCachesEnabled)
+		return false;
+
+	cpu_status state = disable_interrupts();
+	free_page_cache* cache = &sFreePageCaches[smp_get_current_cpu()];
+	acquire_spinlock(&cache->lock);
+
+	free_page_cache_add(cache, page);
+
+	if (cache->count > kFreePageCacheMax) {
+		VMPageQueue::PageList pages;
+		free_page_cache_remove(cache, pages, kFreePageCacheBatch);
+		cache->drains++;
+		sFreePageQueue.PrependUnlocked(pages);
+	}
+
+	release_spinlock(&cache->lock);
+	restore_interrupts(state);
+
+	return true;
+}
+
+
+static void
+dump_free_page_caches()
+{
+	if (!sFreePageCachesEnabled) {
+		kprintf("per-CPU free page caches: disabled\n");
+		return;
+	}
+
+	kprintf("per-CPU free page caches (page colouring %s):\n",
+		sPageColoring ? "enabled" : "disabled");
+	kprintf("cpu  pages         hits       misses  hit rate  colour rate"
+		"     refills      drains\n");
+
+	uint64 totalHits = 0;
+	uint64 totalMisses = 0;
+	int32 cpuCount = smp_get_num_cpus();
+	for (int32 i = 0; i < cpuCount; i++) {
+		free_page_cache& cache = sFreePageCaches[i];
+		uint64 total = cache.hits + cache.misses;
+		uint64 colorTotal = cache.color_hits + cache.color_misses;
+		kprintf("%3" B_PRId32 " %6" B_PRIu32 " %12" B_PRIu64 " %12" B_PRIu64
+			" %8" B_PRIu64 "%% %11" B_PRIu64 "%% %11" B_PRIu64 " %11" B_PRIu64
+			"\n", i, cache.count, cache.hits, cache.misses,
+			total > 0 ? cache.hits * 100 / total : 0,
+			colorTotal > 0 ? cache.color_hits * 100 / colorTotal : 0,
+			cache.refills, cache.drains);
+
+		totalHits += cache.hits;
+		totalMisses += cache.misses;
+	}
+
+	uint64 total = totalHits + totalMisses;
+	kprintf("total hit rate: %" B_PRIu64 "%% (%" B_PRIu64 " of %" B_PRIu64
+		" allocations)\n", total > 0 ? totalHits * 100 / total : 0, totalHits,
+		total);
+}
+
+
+static page_num_t
+count_cached_free_pages()
+{
+	page_num_t count = 0;
+	if (sFreePageCachesEnabled) {
+		int32 cpuCount = smp_get_num_cpus();
+		for (int32 i = 0; i < cpuCount; i++)
+			count += sFreePageCaches[i].count;
+	}
+
+	return count;
+}
+
+
+// #pragma mark - write-back devices
+
+
+/*!	Returns the write-back device structure for the given device, creating it
+	if necessary. Once created, a structure is never removed, so the returned
+	pointer remains valid. Returns \c NULL, if the table is full.
+*/
+static writeback_device*
+get_writeback_device(dev_t device)
+{
+	uint32 start = (uint32)device % kWriteBackDeviceCount;
+	uint32 index = start;
+
+	// fast path: look up the device without locking
+	do {
+		writeback_device& entry = sWriteBackDevices[index];
+		if (!entry.in_use)
+			break;
+		if (entry.device == device)
+			return &entry;
+		index = (index + 1) % kWriteBackDeviceCount;
+	} while (index != start);
+
+	InterruptsSpinLocker locker(sWriteBackDevicesLock);
+
+	index = start;
+	do {
+		writeback_device& entry = sWriteBackDevices[index];
+		if (!entry.in_use) {
+			// Publish the entry only after the device has been set. Entries
+			// are never freed, so all other fields are still zero.
+			entry.device = device;
+			entry.in_use = true;
+			return &entry;
+		}
+		if (entry.device == device)
+			return &entry;
+		index = (index + 1) % kWriteBackDeviceCount;
+	} while (index != start);
+
+	return NULL;
+}
+
+
+static inline writeback_device*
+get_writeback_device(VMCache* cache)
+{
+	return get_writeback_device(cache->WriteBackDevice());
+}
+
+
+/*!	Returns the number of modified pages in non-temporary caches that are
+	allowed before the page writer is started (\a _background) and before
+	writers are throttled (\a _limit).
+*/
+static void
+get_dirty_limits(page_num_t& _background, page_num_t& _limit)
+{
+	page_num_t pageable = sCachedPageQueue.Count()
+		+ sInactivePageQueue.Count() + sActivePageQueue.Count()
+		+ sModifiedPageQueue.Count();
+	int32 freePages = sUnreservedFreePages;
+	if (freePages > 0)
+		pageable += freePages;
+
+	_background = pageable * sDirtyBackgroundRatio / 100;
+	_limit = pageable * sDirtyRatio / 100;
+}
+
+
+/*!	Returns the share of \a limit the given device may use. The global limit
+	is distributed proportionally to the devices' measured write bandwidth,
+	and a device may not accumulate more modified pages than it can write in
+	kMaxDeviceWriteBackTime.
+*/
+static page_num_t
+get_device_dirty_limit(writeback_device* device, page_num_t limit)
+{
+	int32 bandwidth = device->bandwidth;
+	if (bandwidth == 0)
+		return limit;
+
+	uint64 totalBandwidth = 0;
+	for (int32 i = 0; i < kWriteBackDeviceCount; i++) {
+		if (sWriteBackDevices[i].in_use)
+			totalBandwidth += sWriteBackDevices[i].bandwidth;
+	}
+
+	page_num_t deviceLimit = (uint64)limit * bandwidth / totalBandwidth;
+	deviceLimit = std::min(deviceLimit, (page_num_t)((uint64)bandwidth
+		* kMaxDeviceWriteBackTime / 1000000));
+
+	return std::max(deviceLimit, kMinDeviceDirtyPages);
+}
+
+
+static inline page_num_t
+count_dirty_pages()
+{
+	int32 count = (int32)sModifiedPageQueue.Count() - sModifiedTemporaryPages;
+	return count > 0 ? count : 0;
+}
+
+
+static int
+dump_writeback_devices(int argc, char** argv)
+{
+	page_num_t background;
+	page_num_t limit;
+	get_dirty_limits(background, limit);
+
+	kprintf("modified pages: %" B_PRIuPHYSADDR " (background: %"
+		B_PRIuPHYSADDR ", limit: %" B_PRIuPHYSADDR ")\n", count_dirty_pages(),
+		background, limit);
+
+	kprintf("device  dirty    limit  pages/s  writing      written   failed"
+		"     runs  throttled  throttle ms\n");
+
+	for (int32 i = 0; i < kWriteBackDeviceCount; i++) {
+		writeback_device& device = sWriteBackDevices[i];
+		if (!device.in_use)
+			continue;
+
+		kprintf("%6" B_PRId32 " %6" B_PRId32 " %8" B_PRIuPHYSADDR " %8"
+			B_PRId32 " %8s %12" B_PRIu64 " %8" B_PRIu64 " %8" B_PRIu64
+			" %10" B_PRId64 " %12" B_PRId64 "\n", device.device,
+			device.dirty_pages, get_device_dirty_limit(&device, limit),
+			device.bandwidth, device.writing ? "yes" : "no",
+			device.written_pages, device.failed_pages, device.runs,
+			device.throttled, device.throttle_time / 1000);
+	}
+
+	return 0;
+}
+
+
+// #pragma mark -
+
+
 static void
 free_page(vm_page* page, bool clear)
 {
@@ -1542,7 +1983,8 @@ free_page(vm_page* page, bool clear)
 		sClearPageQueue.PrependUnlocked(page);
 	} else {
 		page->SetState(PAGE_STATE_FREE);
-		sFreePageQueue.PrependUnlocked(page);
+		if (!free_page_to_cache(page))
+			sFreePageQueue.PrependUnlocked(page);
 	}
 
 	locker.Unlock();
@@ -1628,6 +2070,11 @@ set_page_state(vm_page *page, int pageState)
 			atomic_add(&sModifiedTemporaryPages, 1);
 		else if (page->State() == PAGE_STATE_MODIFIED)
 			atomic_add(&sModifiedTemporaryPages, -1);
+	} else if (cache != NULL) {
+		if (pageState == PAGE_STATE_MODIFIED)
+			vm_page_modified_pages_changed(cache, 1);
+		else if (page->State() == PAGE_STATE_MODIFIED)
+			vm_page_modified_pages_changed(cache, -1);
 	}
 
 	// move the page
@@ -1710,6 +2157,7 @@ mark_page_range_in_use(page_num_t startPage, page_num_t length, bool wired)
 	}
 
 	WriteLocker locker(sFreePageQueuesLock);
+	drain_free_page_caches();
 
 	for (page_num_t i = 0; i < length; i++) {
 		vm_page *page = &sPages[startPage + i];
@@ -1887,25 +2335,54 @@ class PageWriteTransfer;
 class PageWriteWrapper;
 
 
+/*!	A batch of modified pages of a single write-back device the page writer
+	writes asynchronously. A run is idle, collecting pages, or writing. When
+	all its transfers have finished, the page writer is woken up to complete
+	the run.
+*/
 class PageWriterRun {
 public:
 	status_t Init(uint32 maxPages);
 
 	void PrepareNextRun();
-	void AddPage(vm_page* page);
-	uint32 Go();
+	void AddPage(vm_page* page, writeback_device* device);
+	void Start();
+	uint32 Finish();
+	void Abandon();
+
+	bool IsIdle() const { return fState == RUN_IDLE; }
+	bool IsCollecting() const { return fState == RUN_COLLECTING; }
+	bool IsWriting() const { return fState == RUN_WRITING; }
+	bool IsFinished() const
+		{ return fState == RUN_WRITING && fPendingTransfers == 0; }
+	bool IsFull() const { return fWrapperCount >= fMaxPages; }
+
+	uint32 PageCount() const { return fWrapperCount; }
+	writeback_device* Device() const { return fDevice; }
 
 	void PageWritten(PageWriteTransfer* transfer, status_t status,
 		bool partialTransfer, size_t bytesTransferred);
 
 private:
+	enum {
+		RUN_IDLE,
+		RUN_COLLECTING,
+		RUN_WRITING
+	};
+
+	static bool _ComparePages(const PageWriteWrapper* a,
+		const PageWriteWrapper* b);
+
 	uint32				fMaxPages;
 	uint32				fWrapperCount;
 	uint32				fTransferCount;
 	vint32				fPendingTransfers;
 	PageWriteWrapper*	fWrappers;
+	PageWriteWrapper**	fSortedWrappers;
 	PageWriteTransfer*	fTransfers;
-	ConditionVariable	fAllFinishedCondition;
+	writeback_device*	fDevice;
+	bigtime_t			fStartTime;
+	uint32				fState;
 };
 
 
@@ -1943,6 +2420,8 @@ public:
 	void SetTo(vm_page* page);
 	bool Done(status_t result);
 
+	vm_page* Page() const { return fPage; }
+
 private:
 	vm_page*			fPage;
 	struct VMCache*		fCache;
@@ -2189,10 +2668,13 @@ PageWriterRun::Init(uint32 maxPages)
 	fWrapperCount = 0;
 	fTransferCount = 0;
 	fPendingTransfers = 0;
+	fDevice = NULL;
+	fState = RUN_IDLE;
 
 	fWrappers = new(std::nothrow) PageWriteWrapper[maxPages];
+	fSortedWrappers = new(std::nothrow) PageWriteWrapper*[maxPages];
 	fTransfers = new(std::nothrow) PageWriteTransfer[maxPages];
-	if (fWrappers == NULL || fTransfers == NULL)
+	if (fWrappers == NULL || fSortedWrappers == NULL || fTransfers == NULL)
 		return B_NO_MEMORY;
 
 	return B_OK;
@@ -2205,41 +2687,67 @@ PageWriterRun::PrepareNextRun()
 	fWrapperCount = 0;
 	fTransferCount = 0;
 	fPendingTransfers = 0;
+	fDevice = NULL;
+	fState = RUN_COLLECTING;
 }
 
 
 /*!	The page's cache must be locked.
 */
 void
-PageWriterRun::AddPage(vm_page* page)
+PageWriterRun::AddPage(vm_page* page, writeback_device* device)
 {
-	fWrappers[fWrapperCount++].SetTo(page);
+	if (fWrapperCount == 0)
+		fDevice = device;
 
-	if (fTransferCount == 0 || !fTransfers[fTransferCount - 1].AddPage(page)) {
-		fTransfers[fTransferCount++].SetTo(this, page,
-			page->Cache()->MaxPagesPerAsyncWrite());
-	}
+	fWrappers[fWrapperCount++].SetTo(page);
 }
 
 
-/*!	Writes all pages previously added.
-	\return The number of pages that could not be written or otherwise handled.
+/*!	Sorts the pages previously added by cache and offset, so that adjacent
+	pages are combined into as few transfers as possible, and schedules the
+	writes. Doesn't wait for the I/O to finish.
+	The pages' caches must not be locked. Since the pages are busy, their
+	cache and offset can't change in the meantime.
 */
-uint32
-PageWriterRun::Go()
+void
+PageWriterRun::Start()
 {
-	fPendingTransfers = fTransferCount;
+	for (uint32 i = 0; i < fWrapperCount; i++)
+		fSortedWrappers[i] = &fWrappers[i];
+
+	std::sort(fSortedWrappers, fSortedWrappers + fWrapperCount,
+		&_ComparePages);
+
+	for (uint32 i = 0; i < fWrapperCount; i++) {
+		vm_page* page = fSortedWrappers[i]->Page();
+		if (fTransferCount == 0
+			|| !fTransfers[fTransferCount - 1].AddPage(page)) {
+			fTransfers[fTransferCount++].SetTo(this, page,
+				page->Cache()->MaxPagesPerAsyncWrite());
+		}
+	}
 
-	fAllFinishedCondition.Init(this, "page writer wait for I/O");
-	ConditionVariableEntry waitEntry;
-	fAllFinishedCondition.Add(&waitEntry);
+	if (fDevice != NULL)
+		fDevice->writing = true;
+
+	fState = RUN_WRITING;
+	fStartTime = system_time();
+	fPendingTransfers = fTransferCount;
 
 	// schedule writes
 	for (uint32 i = 0; i < fTransferCount; i++)
 		fTransfers[i].Schedule(B_VIP_IO_REQUEST);
+}
 
-	// wait until all pages have been written
-	waitEntry.Wait();
+
+/*!	Completes a run whose transfers have all finished.
+	\return The number of pages that could not be written or otherwise handled.
+*/
+uint32
+PageWriterRun::Finish()
+{
+	ASSERT(IsFinished());
 
 	// mark pages depending on whether they could be written or not
 
@@ -2250,7 +2758,7 @@ PageWriterRun::Go()
 		transfer.Cache()->Lock();
 
 		for (uint32 j = 0; j < transfer.PageCount(); j++) {
-			if (!fWrappers[wrapperIndex++].Done(transfer.Status()))
+			if (!fSortedWrappers[wrapperIndex++]->Done(transfer.Status()))
 				failedPages++;
 		}
 
@@ -2272,16 +2780,91 @@ PageWriterRun::Go()
 		}
 	}
 
+	if (fDevice != NULL) {
+		// update the device's bandwidth estimate
+		uint32 writtenPages = fWrapperCount - failedPages;
+		bigtime_t elapsed = system_time() - fStartTime;
+		if (writtenPages > 0 && elapsed > 0) {
+			int32 bandwidth = (uint64)writtenPages * 1000000 / elapsed;
+			if (fDevice->bandwidth != 0)
+				bandwidth = (fDevice->bandwidth * 3 + bandwidth) / 4;
+			fDevice->bandwidth = std::max(bandwidth, (int32)1);
+		}
+
+		fDevice->written_pages += writtenPages;
+		fDevice->failed_pages += failedPages;
+		fDevice->runs++;
+		fDevice->writing = false;
+	}
+
+	fState = RUN_IDLE;
+
 	return failedPages;
 }
 
 
+/*!	Returns a collecting run, to which no pages have been added, to the idle
+	state.
+*/
+void
+PageWriterRun::Abandon()
+{
+	ASSERT(IsCollecting() && fWrapperCount == 0);
+	fState = RUN_IDLE;
+}
+
+
+/*!	Called from the I/O completion callback of each transfer, possibly in
+	interrupt context.
+*/
 void
 PageWriterRun::PageWritten(PageWriteTransfer* transfer, status_t status,
 	bool partialTransfer, size_t bytesTransferred)
 {
 	if (atomic_add(&fPendingTransfers, -1) == 1)
-		fAllFinishedCondition.NotifyAll();
+		sPageWriterCondition.WakeUp();
+}
+
+
+/*static*/ bool
+PageWriterRun::_ComparePages(const PageWriteWrapper* a,
+	const PageWriteWrapper* b)
+{
+	VMCache* cacheA = a->Page()->Cache();
+	VMCache* cacheB = b->Page()->Cache();
+	if (cacheA != cacheB)
+		return cacheA < cacheB;
+
+	return a->Page()->cache_offset < b->Page()->cache_offset;
+}
+
+
+/*!	Returns the collecting run the given page shall be added to, or \c NULL,
+	if the page has to wait for a later run. Each run only contains pages of
+	a single device and a device that is still being written to doesn't get
+	another run.
+*/
+static PageWriterRun*
+get_page_writer_run(PageWriterRun* runs, writeback_device* device)
+{
+	PageWriterRun* emptyRun = NULL;
+
+	for (int32 i = 0; i < kPageWriterRunCount; i++) {
+		PageWriterRun& run = runs[i];
+		if (!run.IsCollecting())
+			continue;
+
+		if (run.PageCount() == 0) {
+			if (emptyRun == NULL)
+				emptyRun = &run;
+		} else if (run.Device() == device)
+			return run.IsFull() ? NULL : &run;
+	}
+
+	if (device != NULL && device->writing)
+		return NULL;
+
+	return emptyRun;
 }
 
 
@@ -2290,33 +2873,63 @@ PageWriterRun::PageWritten(PageWriteTransfer* transfer, status_t status,
 	It runs in its own thread, and is only there to keep the number
 	of modified pages low, so that more pages can be reused with
 	fewer costs.
+	The writes are done asynchronously in runs per write-back device, so that
+	a slow device only delays the write-back of its own pages.
 */
 status_t
 page_writer(void* /*unused*/)
 {
-	const uint32 kNumPages = 256;
-#ifdef TRACE_VM_PAGE
-	uint32 writtenPages = 0;
-	bigtime_t lastWrittenTime = 0;
-	bigtime_t pageCollectionTime = 0;
-	bigtime_t pageWritingTime = 0;
-#endif
-
-	PageWriterRun run;
-	if (run.Init(kNumPages) != B_OK) {
-		panic("page writer: Failed to init PageWriterRun!");
-		return B_ERROR;
+	PageWriterRun runs[kPageWriterRunCount];
+	for (int32 i = 0; i < kPageWriterRunCount; i++) {
+		if (runs[i].Init(kPagesPerWriterRun) != B_OK) {
+			panic("page writer: Failed to init PageWriterRun!");
+			return B_ERROR;
+		}
 	}
 
 	page_num_t pagesSinceLastSuccessfulWrite = 0;
+	bool waitForWork = true;
 
 	while (true) {
 // TODO: Maybe wait shorter when memory is low!
-		if (sModifiedPageQueue.Count() < kNumPages) {
-			sPageWriterCondition.Wait(3000000, true);
-				// all 3 seconds when no one triggers us
+		if (waitForWork || sModifiedPageQueue.Count() < kPagesPerWriterRun) {
+			sPageWriterCondition.Wait(3000000, false);
+				// all 3 seconds when no one triggers us -- finished runs do
+				// trigger us, too
+		}
+		sPageWriterCondition.ClearActivated();
+
+		waitForWork = true;
+
+		// complete the runs whose I/O has finished
+		int32 writingRuns = 0;
+		bool runsFinished = false;
+		for (int32 i = 0; i < kPageWriterRunCount; i++) {
+			PageWriterRun& run = runs[i];
+			if (!run.IsWriting())
+				continue;
+
+			if (!run.IsFinished()) {
+				writingRuns++;
+				continue;
+			}
+
+			uint32 numPages = run.PageCount();
+			uint32 failedPages = run.Finish();
+			runsFinished = true;
+
+			if (failedPages == numPages)
+				pagesSinceLastSuccessfulWrite += numPages;
+			else
+				pagesSinceLastSuccessfulWrite = 0;
 		}
 
+		if (runsFinished)
+			sDirtyThrottleCondition.NotifyAll();
+
+		if (writingRuns == kPageWriterRunCount)
+			continue;
+
 		page_num_t modifiedPages = sModifiedPageQueue.Count();
 		if (modifiedPages == 0)
 			continue;
@@ -2349,20 +2962,27 @@ page_writer(void* /*unused*/)
 		thread_set_io_priority(ioPriority);
 
 		uint32 numPages = 0;
-		run.PrepareNextRun();
+		uint32 capacity = 0;
+		for (int32 i = 0; i < kPageWriterRunCount; i++) {
+			if (runs[i].IsIdle()) {
+				runs[i].PrepareNextRun();
+				capacity += kPagesPerWriterRun;
+			}
+		}
 
 		// TODO: make this laptop friendly, too (ie. only start doing
 		// something if someone else did something or there is really
 		// enough to do).
 
-		// collect pages to be written
-#ifdef TRACE_VM_PAGE
-		pageCollectionTime -= system_time();
-#endif
+		// collect pages to be written -- the pages we look at are moved to
+		// the end of the queue, so the next round continues where this one
+		// stopped, and the pages of devices that are still being written to
+		// are not looked at over and over again
 
-		page_num_t maxPagesToSee = modifiedPages;
+		page_num_t maxPagesToSee = std::min(modifiedPages,
+			(page_num_t)capacity * kPageWriterScanFactor);
 
-		while (numPages < kNumPages && maxPagesToSee > 0) {
+		while (numPages < capacity && maxPagesToSee > 0) {
 			vm_page *page = next_modified_page(maxPagesToSee);
 			if (page == NULL)
 				break;
@@ -2406,6 +3026,15 @@ page_writer(void* /*unused*/)
 				continue;
 			}
 
+			// Find a run for the page's device. If there is none, the page
+			// stays in the queue for the next round.
+			writeback_device* device = get_writeback_device(cache);
+			PageWriterRun* run = get_page_writer_run(runs, device);
+			if (run == NULL) {
+				DEBUG_PAGE_ACCESS_END(page);
+				continue;
+			}
+
 			// We need our own reference to the store, as it might currently be
 			// destroyed.
 			if (cache->AcquireUnreferencedStoreRef() != B_OK) {
@@ -2415,7 +3044,7 @@ page_writer(void* /*unused*/)
 				continue;
 			}
 
-			run.AddPage(page);
+			run->AddPage(page, device);
 				// TODO: We're possibly adding pages of different caches and
 				// thus maybe of different underlying file systems here. This
 				// is a potential problem for loop file systems/devices, since
@@ -2431,40 +3060,21 @@ page_writer(void* /*unused*/)
 			numPages++;
 		}
 
-#ifdef TRACE_VM_PAGE
-		pageCollectionTime += system_time();
-#endif
-		if (numPages == 0)
-			continue;
+		// write the pages to disk -- the cleanup is done when the runs have
+		// finished
+		for (int32 i = 0; i < kPageWriterRunCount; i++) {
+			PageWriterRun& run = runs[i];
+			if (!run.IsCollecting())
+				continue;
 
-		// write pages to disk and do all the cleanup
-#ifdef TRACE_VM_PAGE
-		pageWritingTime -= system_time();
-#endif
-		uint32 failedPages = run.Go();
-#ifdef TRACE_VM_PAGE
-		pageWritingTime += system_time();
-
-		// debug output only...
-		writtenPages += numPages;
-		if (writtenPages >= 1024) {
-			bigtime_t now = system_time();
-			TRACE(("page writer: wrote 1024 pages (total: %llu ms, "
-				"collect: %llu ms, write: %llu ms)\n",
-				(now - lastWrittenTime) / 1000,
-				pageCollectionTime / 1000, pageWritingTime / 1000));
-			lastWrittenTime = now;
-
-			writtenPages -= 1024;
-			pageCollectionTime = 0;
-			pageWritingTime = 0;
-		}
-#endif
+			if (run.PageCount() == 0) {
+				run.Abandon();
+				continue;
+			}
 
-		if (failedPages == numPages)
-			pagesSinceLastSuccessfulWrite += modifiedPages - maxPagesToSee;
-		else
-			pagesSinceLastSuccessfulWrite = 0;
+			run.Start();
+			waitForWork = false;
+		}
 	}
 
 	return B_OK;
@@ -3229,6 +3839,78 @@ vm_page_schedule_write_page_range(struct VMCache *cache, uint32 firstPage,
 }
 
 
+/*!	Accounts \a count pages of the given non-temporary cache that entered
+	(positive) or left (negative) the modified state to the device the cache
+	writes back to.
+*/
+void
+vm_page_modified_pages_changed(VMCache* cache, int32 count)
+{
+	writeback_device* device = get_writeback_device(cache);
+	if (device != NULL)
+		atomic_add(&device->dirty_pages, count);
+}
+
+
+/*!	Throttles a writer that has just modified pages of the given cache, if
+	there are too many modified pages in the system or on the cache's device.
+	The page writer is woken up, if the background limit has been reached.
+	Since callers may hold file system locks that the write-back needs, too,
+	the writer is never blocked for longer than kMaxDirtyThrottleDelay.
+	The cache must not be locked.
+*/
+void
+vm_page_throttle_dirty_pages(VMCache* cache)
+{
+	if (cache->temporary)
+		return;
+
+	writeback_device* device = get_writeback_device(cache);
+	bigtime_t startTime = 0;
+
+	while (true) {
+		page_num_t background;
+		page_num_t limit;
+		get_dirty_limits(background, limit);
+
+		page_num_t dirtyPages = count_dirty_pages();
+		page_num_t deviceDirtyPages = 0;
+		page_num_t deviceLimit = limit;
+		if (device != NULL) {
+			deviceDirtyPages = std::max((int32)device->dirty_pages, (int32)0);
+			deviceLimit = get_device_dirty_limit(device, limit);
+		}
+
+		if (dirtyPages > background
+			|| deviceDirtyPages > deviceLimit * sDirtyBackgroundRatio
+				/ sDirtyRatio) {
+			sPageWriterCondition.WakeUp();
+		}
+
+		if (dirtyPages <= limit && deviceDirtyPages <= deviceLimit)
+			break;
+
+		bigtime_t now = system_time();
+		if (startTime == 0)
+			startTime = now;
+		else if (now - startTime >= kMaxDirtyThrottleDelay)
+			break;
+
+		// wait until the page writer has made some progress
+		ConditionVariableEntry entry;
+		sDirtyThrottleCondition.Add(&entry);
+		entry.Wait(B_RELATIVE_TIMEOUT,
+			std::min(kMaxDirtyThrottleDelay - (now - startTime),
+				(bigtime_t)20000));
+	}
+
+	if (startTime != 0 && device != NULL) {
+		atomic_add64(&device->throttled, 1);
+		atomic_add64(&device->throttle_time, system_time() - startTime);
+	}
+}
+
+
 void
 vm_page_init_num_pages(kernel_args *args)
 {
@@ -3370,6 +4052,8 @@ vm_page_init_post_area(kernel_args *args)
 		"search all known address spaces for mappings to that page and print\n"
 		"them.\n", 0);
 	add_debugger_command("page_queue", &dump_page_queue, "Dump page queue");
+	add_debugger_command("writeback_devices", &dump_writeback_devices,
+		"Dump per-device write-back statistics");
 	add_debugger_command("find_page", &find_page,
 		"Find out which queue a page is actually in");
 
@@ -3417,6 +4101,35 @@ vm_page_init_post_thread(kernel_args *args)
 	new (&sFreePageCondition) ConditionVariable;
 	sFreePageCondition.Publish(&sFreePageQueue, "free page");
 
+	// read the page coloring and write-back settings
+
+	void* settings = load_driver_settings("virtual_memory");
+	if (settings != NULL) {
+		sPageColoring = get_driver_boolean_parameter(settings, "page_coloring",
+			false, true);
+
+		const char* value = get_driver_parameter(settings, "dirty_ratio",
+			NULL, NULL);
+		if (value != NULL)
+			sDirtyRatio = std::min(std::max(strtoul(value, NULL, 0), 1UL), 90UL);
+
+		value = get_driver_parameter(settings, "dirty_background_ratio", NULL,
+			NULL);
+		if (value != NULL) {
+			sDirtyBackgroundRatio = std::min(
+				(uint32)strtoul(value, NULL, 0), sDirtyRatio);
+		}
+
+		unload_driver_settings(settings);
+	}
+
+	// enable the per-CPU free page caches
+
+	for (int32 i = 0; i < smp_get_num_cpus(); i++)
+		B_INITIALIZE_SPINLOCK(&sFreePageCaches[i].lock);
+
+	sFreePageCachesEnabled = true;
+
 	// create a kernel thread to clear out pages
 
 	thread_id thread = spawn_kernel_thread(&page_scrubber, "page scrubber",
@@ -3426,6 +4139,8 @@ vm_page_init_post_thread(kernel_args *args)
 	// start page writer
 
 	sPageWriterCondition.Init("page writer");
+	sDirtyThrottleCondition.Init(&sDirtyThrottleCondition,
+		"dirty page throttle");
 
 	thread = spawn_kernel_thread(&page_writer, "page writer",
 		B_NORMAL_PRIORITY + 1, NULL);
@@ -3517,8 +4232,16 @@ vm_page_try_reserve_pages(vm_page_reservation* reservation, uint32 count,
 }
 
 
+/*!	Allocates a page from the given reservation.
+	\param colorHint If page colouring is enabled, a page whose colour matches
+		this hint is preferred. Callers mapping a range of pages should pass
+		consecutive hints (e.g. the page index within the cache) for
+		consecutive pages, so that they don't alias in the CPU caches.
+		\c VM_PAGE_NO_COLOR_HINT, if the caller doesn't care.
+*/
 vm_page *
-vm_page_allocate_page(vm_page_reservation* reservation, uint32 flags)
+vm_page_allocate_page_etc(vm_page_reservation* reservation, uint32 flags,
+	page_num_t colorHint)
 {
 	uint32 pageState = flags & VM_PAGE_ALLOC_STATE;
 	ASSERT(pageState != PAGE_STATE_FREE);
@@ -3529,8 +4252,9 @@ vm_page_allocate_page(vm_page_reservation* reservation, uint32 flags)
 
 	VMPageQueue* queue;
 	VMPageQueue* otherQueue;
+	bool clearRequested = (flags & VM_PAGE_ALLOC_CLEAR) != 0;
 
-	if ((flags & VM_PAGE_ALLOC_CLEAR) != 0) {
+	if (clearRequested) {
 		queue = &sClearPageQueue;
 		otherQueue = &sFreePageQueue;
 	} else {
@@ -3540,22 +4264,37 @@ vm_page_allocate_page(vm_page_reservation* reservation, uint32 flags)
 
 	ReadLocker locker(sFreePageQueuesLock);
 
-	vm_page* page = queue->RemoveHeadUnlocked();
+	// Free pages come from the per-CPU cache first. Pre-cleared pages are
+	// only passed over for a page of the right colour.
+	vm_page* page = NULL;
+	if (!clearRequested
+		|| (sPageColoring && colorHint != VM_PAGE_NO_COLOR_HINT)) {
+		page = allocate_cached_free_page(colorHint, clearRequested);
+	}
+
+	if (page == NULL)
+		page = queue->RemoveHeadUnlocked();
 	if (page == NULL) {
 		// if the primary queue was empty, grab the page from the
 		// secondary queue
 		page = otherQueue->RemoveHeadUnlocked();
 
+		if (page == NULL && clearRequested)
+			page = allocate_cached_free_page(colorHint, false);
+
 		if (page == NULL) {
 			// Unlikely, but possible: the page we have reserved has moved
-			// between the queues after we checked the first queue. Grab the
-			// write locker to make sure this doesn't happen again.
+			// between the queues after we checked the first queue, or it sits
+			// in another CPU's free page cache. Grab the write locker to make
+			// sure this doesn't happen again.
 			locker.Unlock();
 			WriteLocker writeLocker(sFreePageQueuesLock);
 
+			drain_free_page_caches();
+
 			page = queue->RemoveHead();
 			if (page == NULL)
-				otherQueue->RemoveHead();
+				page = otherQueue->RemoveHead();
 
 			if (page == NULL) {
 				panic("Had reserved page, but there is none!");
@@ -3600,6 +4339,13 @@ vm_page_allocate_page(vm_page_reservation* reservation, uint32 flags)
 }
 
 
+vm_page *
+vm_page_allocate_page(vm_page_reservation* reservation, uint32 flags)
+{
+	return vm_page_allocate_page_etc(reservation, flags, VM_PAGE_NO_COLOR_HINT);
+}
+
+
 static void
 allocate_page_run_cleanup(VMPageQueue::PageList& freePages,
 	VMPageQueue::PageList& clearPages)
@@ -3649,6 +4395,9 @@ allocate_page_run(page_num_t start, page_num_t length, uint32 flags,
 	ASSERT(pageState != PAGE_STATE_CLEAR);
 	ASSERT(start + length <= sNumPages);
 
+	// Free pages in the per-CPU caches aren't in the free queue.
+	drain_free_page_caches();
+
 	// Pull the free/clear pages out of their respective queues. Cached pages
 	// are allocated later.
 	page_num_t cachedPages = 0;
@@ -3787,29 +4536,9 @@ allocate_page_run(page_num_t start, page_num_t length, uint32 flags,
 }
 
 
-/*! Allocate a physically contiguous range of pages.
-
-	\param flags Page allocation flags. Encodes the state the function shall
-		set the allocated pages to, whether the pages shall be marked busy
-		(VM_PAGE_ALLOC_BUSY), and whether the pages shall be cleared
-		(VM_PAGE_ALLOC_CLEAR).
-	\param length The number of contiguous pages to allocate.
-	\param restrictions Restrictions to the physical addresses of the page run
-		to allocate, including \c low_address, the first acceptable physical
-		address where the page run may start, \c high_address, the last
-		acceptable physical address where the page run may end (i.e. it must
-		hold \code runStartAddress + length <= high_address \endcode),
-		\c alignment, the alignment of the page run start address, and
-		\c boundary, multiples of which the page run must not cross.
-		Values set to \c 0 are ignored.
-	\param priority The page reservation priority (as passed to
-		vm_page_reserve_pages()).
-	\return The first page of the allocated page run on success; \c NULL
-		when the allocation failed.
-*/
-vm_page*
-vm_page_allocate_page_run(uint32 flags, page_num_t length,
-	const physical_address_restrictions* restrictions, int priority)
+static vm_page*
+allocate_page_run_restricted(uint32 flags, page_num_t length,
+	const physical_address_restrictions* restrictions, bool freePagesOnly)
 {
 	// compute start and end page index
 	page_num_t requestedStart
@@ -3845,9 +4574,6 @@ vm_page_allocate_page_run(uint32 flags, page_num_t length,
 			boundaryShift++;
 	}
 
-	vm_page_reservation reservation;
-	vm_page_reserve_pages(&reservation, length, priority);
-
 	WriteLocker freeClearQueueLocker(sFreePageQueuesLock);
 
 	// First we try to get a run with free pages only. If that fails, we also
@@ -3855,7 +4581,8 @@ vm_page_allocate_page_run(uint32 flags, page_num_t length,
 	// ones, the odds are that we won't find enough contiguous ones, so we skip
 	// the first iteration in this case.
 	int32 freePages = sUnreservedFreePages;
-	int useCached = freePages > 0 && (page_num_t)freePages > 2 * length ? 0 : 1;
+	int useCached = freePagesOnly
+		|| (freePages > 0 && (page_num_t)freePages > 2 * length) ? 0 : 1;
 
 	for (;;) {
 		if (alignmentMask != 0 || boundaryShift != 0) {
@@ -3878,7 +4605,7 @@ vm_page_allocate_page_run(uint32 flags, page_num_t length,
 		}
 
 		if (start + length > end) {
-			if (useCached == 0) {
+			if (useCached == 0 && !freePagesOnly) {
 				// The first iteration with free pages only was unsuccessful.
 				// Try again also considering cached pages.
 				useCached = 1;
@@ -3886,11 +4613,12 @@ vm_page_allocate_page_run(uint32 flags, page_num_t length,
 				continue;
 			}
 
-			dprintf("vm_page_allocate_page_run(): Failed to allocate run of "
-				"length %" B_PRIuPHYSADDR " in second iteration!", length);
+			if (!freePagesOnly) {
+				dprintf("vm_page_allocate_page_run(): Failed to allocate run "
+					"of length %" B_PRIuPHYSADDR " in second iteration!",
+					length);
+			}
 
-			freeClearQueueLocker.Unlock();
-			vm_page_unreserve_pages(&reservation);
 			return NULL;
 		}
 
@@ -3921,6 +4649,69 @@ vm_page_allocate_page_run(uint32 flags, page_num_t length,
 }
 
 
+/*! Allocate a physically contiguous range of pages.
+
+	\param flags Page allocation flags. Encodes the state the function shall
+		set the allocated pages to, whether the pages shall be marked busy
+		(VM_PAGE_ALLOC_BUSY), and whether the pages shall be cleared
+		(VM_PAGE_ALLOC_CLEAR).
+	\param length The number of contiguous pages to allocate.
+	\param restrictions Restrictions to the physical addresses of the page run
+		to allocate, including \c low_address, the first acceptable physical
+		address where the page run may start, \c high_address, the last
+		acceptable physical address where the page run may end (i.e. it must
+		hold \code runStartAddress + length <= high_address \endcode),
+		\c alignment, the alignment of the page run start address, and
+		\c boundary, multiples of which the page run must not cross.
+		Values set to \c 0 are ignored.
+	\param priority The page reservation priority (as passed to
+		vm_page_reserve_pages()).
+	\return The first page of the allocated page run on success; \c NULL
+		when the allocation failed.
+*/
+vm_page*
+vm_page_allocate_page_run(uint32 flags, page_num_t length,
+	const physical_address_restrictions* restrictions, int priority)
+{
+	vm_page_reservation reservation;
+	vm_page_reserve_pages(&reservation, length, priority);
+
+	vm_page* page = allocate_page_run_restricted(flags, length, restrictions,
+		false);
+	if (page == NULL)
+		vm_page_unreserve_pages(&reservation);
+
+	return page;
+}
+
+
+/*!	Allocates a physically contiguous range of pages from an existing
+	reservation.
+	Unlike vm_page_allocate_page_run() only free pages are considered, so no
+	cached pages are sacrificed when the function is used opportunistically,
+	e.g. to back large page mappings.
+	\param reservation The reservation the pages are taken from. On success its
+		count is decremented by \a length, on failure it is left untouched.
+	\return The first page of the allocated page run on success; \c NULL
+		when no suitable run of free pages was found.
+*/
+vm_page*
+vm_page_allocate_reserved_page_run(vm_page_reservation* reservation,
+	uint32 flags, page_num_t length,
+	const physical_address_restrictions* restrictions)
+{
+	if (reservation->count < length)
+		return NULL;
+
+	vm_page* page = allocate_page_run_restricted(flags, length, restrictions,
+		true);
+	if (page != NULL)
+		reservation->count -= length;
+
+	return page;
+}
+
+
 vm_page *
 vm_page_at_index(int32 index)
 {
@@ -4097,7 +4888,7 @@ vm_page_get_stats(system_info *info)
 	// So taking out the cached (including modified non-temporary), free and
 	// clear ones leaves us with all used pages.
 	int32 subtractPages = info->cached_pages + sFreePageQueue.Count()
-		+ sClearPageQueue.Count();
+		+ sClearPageQueue.Count() + count_cached_free_pages();
 	info->used_pages = subtractPages > info->max_pages
 		? 0 : info->max_pages - subtractPages;
 
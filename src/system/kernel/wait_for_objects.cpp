@@ -20,6 +20,7 @@
 
 #include <AutoDeleter.h>
 
+#include <event_queue.h>
 #include <fs/fd.h>
 #include <port.h>
 #include <sem.h>
@@ -398,6 +399,7 @@ create_select_sync(int numFDs, select_sync*& _sync)
 
 	sync->count = numFDs;
 	sync->ref_count = 1;
+	sync->queue = NULL;
 
 	for (int i = 0; i < numFDs; i++) {
 		sync->set[i].next = NULL;
@@ -418,6 +420,12 @@ put_select_sync(select_sync* sync)
 	FUNCTION(("put_select_sync(%p): -> %ld\n", sync, sync->ref_count - 1));
 
 	if (atomic_add(&sync->ref_count, -1) == 1) {
+		if (sync->queue != NULL) {
+			// the sync object is part of an event queue entry
+			event_queue_entry_released(sync);
+			return;
+		}
+
 		delete_sem(sync->sem);
 		delete[] sync->set;
 		delete sync;
@@ -705,8 +713,12 @@ notify_select_events(select_info* info, uint16 events)
 
 	// only wake up the waiting select()/poll() call if the events
 	// match one of the selected ones
-	if (info->selected_events & events)
+	if (info->selected_events & events) {
+		if (info->sync->queue != NULL)
+			return notify_event_queue(info);
+
 		return release_sem_etc(info->sync->sem, 1, B_DO_NOT_RESCHEDULE);
+	}
 
 	return B_OK;
 }
@@ -723,6 +735,29 @@ notify_select_events_list(select_info* list, uint16 events)
 }
 
 
+/*!	Selects the object \a object of type \a type (one of the
+	\c B_OBJECT_TYPE_* constants) with the given \a info.
+*/
+status_t
+select_object(uint32 type, int32 object, select_info* info, bool kernel)
+{
+	if (type >= kSelectOpsCount)
+		return B_BAD_VALUE;
+
+	return kSelectOps[type].select(object, info, kernel);
+}
+
+
+status_t
+deselect_object(uint32 type, int32 object, select_info* info, bool kernel)
+{
+	if (type >= kSelectOpsCount)
+		return B_BAD_VALUE;
+
+	return kSelectOps[type].deselect(object, info, kernel);
+}
+
+
 //	#pragma mark - public kernel API
 
 
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+/*!	Tests that a file keeping its data in the inode stays coherent with its
+	mappings: it is written through a mapping, read back, grown out of the
+	inode, and truncated back into it.
+	Must run on a BFS volume that supports inline data.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+static const size_t kInlineSize = 200;
+static const size_t kStreamSize = 64 * 1024;
+
+
+static void
+fail(const char* what)
+{
+	fprintf(stderr, "%s failed: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+
+static void
+check_contents(int fd, const char* data, size_t size, const char* when)
+{
+	char* buffer = (char*)malloc(size);
+	if (buffer == NULL)
+		fail("malloc");
+
+	ssize_t bytesRead = pread(fd, buffer, size, 0);
+	if (bytesRead != (ssize_t)size) {
+		fprintf(stderr, "%s: read %ld bytes, expected %lu\n", when,
+			(long)bytesRead, (unsigned long)size);
+		exit(1);
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		if (buffer[i] != data[i]) {
+			fprintf(stderr, "%s: byte %lu is %#x, expected %#x\n", when,
+				(unsigned long)i, (unsigned char)buffer[i],
+				(unsigned char)data[i]);
+			exit(1);
+		}
+	}
+
+	free(buffer);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	const char* directory = argc > 1 ? argv[1] : "/boot/home";
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/bfs_inline_data_mmap_test", directory);
+
+	int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0)
+		fail("open");
+
+	char data[kStreamSize];
+	memset(data, 'a', kInlineSize);
+	if (write(fd, data, kInlineSize) != (ssize_t)kInlineSize)
+		fail("write");
+
+	// change the data through a mapping, and read it back
+
+	char* address = (char*)mmap(NULL, kInlineSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED)
+		fail("mmap");
+
+	if (address[0] != 'a' || address[kInlineSize - 1] != 'a') {
+		fprintf(stderr, "mapping does not show the file contents\n");
+		return 1;
+	}
+
+	memset(address + 10, 'm', 20);
+	memset(data + 10, 'm', 20);
+	check_contents(fd, data, kInlineSize, "after writing the mapping");
+
+	// a write() must show up in the mapping
+
+	if (pwrite(fd, "www", 3, 50) != 3)
+		fail("pwrite");
+	memcpy(data + 50, "www", 3);
+	if (memcmp(address, data, kInlineSize) != 0) {
+		fprintf(stderr, "write() is not visible in the mapping\n");
+		return 1;
+	}
+
+	if (msync(address, kInlineSize, MS_SYNC) != 0)
+		fail("msync");
+	if (fsync(fd) != 0)
+		fail("fsync");
+	check_contents(fd, data, kInlineSize, "after fsync");
+
+	// change the mapping again, and let the file outgrow its inode: the
+	// changes must not be overwritten with the old inode contents
+
+	memset(address + 100, 'n', 20);
+	memset(data + 100, 'n', 20);
+	memset(data + kInlineSize, 'b', kStreamSize - kInlineSize);
+	if (pwrite(fd, data + kInlineSize, kStreamSize - kInlineSize, kInlineSize)
+			!= (ssize_t)(kStreamSize - kInlineSize))
+		fail("pwrite");
+	check_contents(fd, data, kStreamSize, "after growing");
+
+	munmap(address, kInlineSize);
+	close(fd);
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		fail("open");
+	check_contents(fd, data, kStreamSize, "after reopening");
+
+	// truncate the file back into its inode while it is mapped
+
+	address = (char*)mmap(NULL, kInlineSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED)
+		fail("mmap");
+
+	if (ftruncate(fd, 0) != 0)
+		fail("ftruncate");
+
+	memset(data, 'c', kInlineSize);
+	if (write(fd, data, kInlineSize) != (ssize_t)kInlineSize)
+		fail("write");
+	if (memcmp(address, data, kInlineSize) != 0) {
+		fprintf(stderr, "mapping is stale after truncating\n");
+		return 1;
+	}
+
+	memset(address, 'd', 5);
+	memset(data, 'd', 5);
+	check_contents(fd, data, kInlineSize, "after truncating");
+
+	munmap(address, kInlineSize);
+	close(fd);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		fail("open");
+	check_contents(fd, data, kInlineSize, "after closing");
+	close(fd);
+
+	unlink(path);
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * This file may be used under the terms of the MIT License.
+ */
+
+
+/*!	Prints the journal statistics of a BFS volume, and optionally moves its
+	log into an area of a different size.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <StorageDefs.h>
+
+#include "bfs_control.h"
+
+
+static void
+usage(const char* programName)
+{
+	fprintf(stderr, "usage: %s [-r <log blocks>] [<volume path>]\n"
+		"  -r  resizes the log to the given number of blocks\n"
+		"The volume defaults to the one of the current directory.\n",
+		programName);
+	exit(1);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	const char* volume = ".";
+	uint32 logSize = 0;
+	int argi = 1;
+
+	for (; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (!strcmp(argv[argi], "-r") && argi + 1 < argc)
+			logSize = strtoul(argv[++argi], NULL, 0);
+		else
+			usage(argv[0]);
+	}
+	if (argi + 1 == argc)
+		volume = argv[argi];
+	else if (argi != argc)
+		usage(argv[0]);
+
+	int fd = open(volume, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open \"%s\": %s\n", volume,
+			strerror(errno));
+		return 1;
+	}
+
+	if (logSize != 0
+		&& ioctl(fd, BFS_IOCTL_RESIZE_LOG, &logSize, sizeof(uint32)) != 0) {
+		fprintf(stderr, "Could not resize log: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	journal_statistics stats;
+	if (ioctl(fd, BFS_IOCTL_JOURNAL_STATISTICS, &stats,
+			sizeof(journal_statistics)) != 0) {
+		fprintf(stderr, "Could not get journal statistics: %s\n",
+			strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	printf("log size:             %" B_PRIu32 " blocks (%" B_PRIu32 " free)\n",
+		stats.log_size, stats.free_log_blocks);
+	printf("max transaction size: %" B_PRIu32 " blocks\n",
+		stats.max_transaction_size);
+	printf("transactions:         %" B_PRId64 "\n", stats.transactions);
+	printf("log writes:           %" B_PRId64 " (%" B_PRId64 " blocks)\n",
+		stats.log_writes, stats.logged_blocks);
+	printf("lock waits:           %" B_PRId64 " (%" B_PRId64 " usecs)\n",
+		stats.lock_waits, stats.lock_wait_time);
+	printf("log full stalls:      %" B_PRId64 " (%" B_PRId64 " usecs)\n",
+		stats.log_full_stalls, stats.log_full_stall_time);
+
+	close(fd);
+	return 0;
+}
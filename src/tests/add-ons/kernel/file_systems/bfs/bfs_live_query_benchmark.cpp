@@ -0,0 +1,224 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * This file may be used under the terms of the MIT License.
+ */
+
+
+/*!	Measures the attribute write throughput on a BFS volume with a varying
+	number of live queries open.
+
+	Every live query looks for a different value of an indexed attribute,
+	so that only few of them are affected by each write. Writes of an
+	attribute that no query depends on are measured as well.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fs_attr.h>
+#include <fs_index.h>
+#include <fs_info.h>
+#include <fs_query.h>
+#include <OS.h>
+#include <TypeConstants.h>
+
+
+static const char* kIndexName = "bench:value";
+static const char* kOtherName = "bench:other";
+static const char* kFileName = "_live_query_bench_file";
+static const int32 kDefaultWriteCount = 20000;
+static const int32 kDefaultQueryCounts[] = {1, 100, 1000};
+
+
+static int32 sReceivedUpdates;
+
+
+static status_t
+drain_port(void* _port)
+{
+	port_id port = (port_id)(addr_t)_port;
+	char buffer[1024];
+
+	while (true) {
+		int32 code;
+		ssize_t bytes = read_port(port, &code, buffer, sizeof(buffer));
+		if (bytes < 0)
+			break;
+
+		atomic_add(&sReceivedUpdates, 1);
+	}
+
+	return B_OK;
+}
+
+
+static bigtime_t
+write_attributes(int fd, const char* attribute, int32 writeCount,
+	int32 firstValue, int32 valueRange)
+{
+	bigtime_t start = system_time();
+
+	for (int32 i = 0; i < writeCount; i++) {
+		int32 value = firstValue + i % valueRange;
+		if (fs_write_attr(fd, attribute, B_INT32_TYPE, 0, &value,
+				sizeof(int32)) != sizeof(int32)) {
+			fprintf(stderr, "Writing attribute failed: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+	}
+
+	return system_time() - start;
+}
+
+
+static void
+print_result(const char* what, int32 writeCount, bigtime_t time)
+{
+	if (time == 0)
+		time = 1;
+
+	printf("  %-22s %8Ld us, %8Ld writes/s\n", what, time,
+		writeCount * 1000000LL / time);
+}
+
+
+static void
+run_benchmark(dev_t device, int fd, int32 queryCount, int32 writeCount,
+	port_id port)
+{
+	DIR** queries = (DIR**)malloc(sizeof(DIR*) * queryCount);
+	if (queries == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(1);
+	}
+
+	for (int32 i = 0; i < queryCount; i++) {
+		char predicate[256];
+		snprintf(predicate, sizeof(predicate),
+			"(%s==%ld)&&(name==%s)", kIndexName, i, kFileName);
+
+		queries[i] = fs_open_live_query(device, predicate, B_LIVE_QUERY, port,
+			i);
+		if (queries[i] == NULL) {
+			fprintf(stderr, "Opening live query failed: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+
+		// we are not interested in the initial results
+		while (fs_read_query(queries[i]) != NULL)
+			;
+	}
+
+	atomic_set(&sReceivedUpdates, 0);
+
+	printf("%ld live queries:\n", queryCount);
+
+	// Writing values that are looked for by the queries (each one a few
+	// times), and values that aren't
+	print_result("matching values:", writeCount,
+		write_attributes(fd, kIndexName, writeCount, 0, queryCount));
+	print_result("other values:", writeCount,
+		write_attributes(fd, kIndexName, writeCount, queryCount, writeCount));
+	print_result("unrelated attribute:", writeCount,
+		write_attributes(fd, kOtherName, writeCount, 0, writeCount));
+
+	// give the notifications some time to arrive
+	snooze(100000);
+	printf("  %ld query updates received\n", atomic_get(&sReceivedUpdates));
+
+	for (int32 i = 0; i < queryCount; i++)
+		fs_close_query(queries[i]);
+
+	free(queries);
+}
+
+
+static void
+usage(const char* programName)
+{
+	fprintf(stderr, "usage: %s [-w <writes>] [<directory> "
+		"[<query count> ...]]\n"
+		"The directory must be on a BFS volume; the default is the current "
+		"directory.\n", programName);
+	exit(1);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	int32 writeCount = kDefaultWriteCount;
+	int argi = 1;
+
+	if (argi < argc && !strcmp(argv[argi], "-w")) {
+		if (argi + 1 >= argc)
+			usage(argv[0]);
+
+		writeCount = strtol(argv[argi + 1], NULL, 0);
+		argi += 2;
+	}
+	if (argi < argc && argv[argi][0] == '-')
+		usage(argv[0]);
+
+	const char* directory = argi < argc ? argv[argi++] : ".";
+	if (chdir(directory) != 0) {
+		fprintf(stderr, "Could not change to \"%s\": %s\n", directory,
+			strerror(errno));
+		return 1;
+	}
+
+	dev_t device = dev_for_path(".");
+	bool createdIndex = fs_create_index(device, kIndexName, B_INT32_TYPE, 0)
+		== 0;
+	if (!createdIndex && errno != B_FILE_EXISTS) {
+		fprintf(stderr, "Could not create index: %s\n", strerror(errno));
+		return 1;
+	}
+
+	int fd = open(kFileName, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Could not create test file: %s\n", strerror(errno));
+		return 1;
+	}
+
+	port_id port = create_port(1000, "live query benchmark");
+	thread_id thread = spawn_thread(&drain_port, "drain port",
+		B_NORMAL_PRIORITY, (void*)(addr_t)port);
+	if (port < 0 || thread < 0) {
+		fprintf(stderr, "Could not create port or thread!\n");
+		return 1;
+	}
+	resume_thread(thread);
+
+	if (argi < argc) {
+		for (; argi < argc; argi++) {
+			run_benchmark(device, fd, strtol(argv[argi], NULL, 0), writeCount,
+				port);
+		}
+	} else {
+		for (size_t i = 0; i < sizeof(kDefaultQueryCounts)
+				/ sizeof(kDefaultQueryCounts[0]); i++) {
+			run_benchmark(device, fd, kDefaultQueryCounts[i], writeCount,
+				port);
+		}
+	}
+
+	delete_port(port);
+
+	status_t status;
+	wait_for_thread(thread, &status);
+
+	close(fd);
+	unlink(kFileName);
+	if (createdIndex)
+		fs_remove_index(device, kIndexName);
+
+	return 0;
+}
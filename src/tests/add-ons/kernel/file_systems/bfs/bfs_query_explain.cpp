@@ -0,0 +1,81 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * This file may be used under the terms of the MIT License.
+ */
+
+
+/*!	Prints how BFS is going to evaluate a query, that is, which indices it
+	scans in which order, and how many entries it expects each of them to
+	find.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fs_query.h>
+
+#include "bfs_control.h"
+
+
+static void
+usage(const char* programName)
+{
+	fprintf(stderr, "usage: %s [-a] [-v <volume path>] <query>\n"
+		"  -a  also consider attributes without an index\n"
+		"The volume defaults to the one of the current directory.\n",
+		programName);
+	exit(1);
+}
+
+
+int
+main(int argc, char** argv)
+{
+	const char* volume = ".";
+	uint32 flags = 0;
+	int argi = 1;
+
+	for (; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (!strcmp(argv[argi], "-a"))
+			flags |= B_QUERY_NON_INDEXED;
+		else if (!strcmp(argv[argi], "-v") && argi + 1 < argc)
+			volume = argv[++argi];
+		else
+			usage(argv[0]);
+	}
+	if (argi + 1 != argc)
+		usage(argv[0]);
+
+	int fd = open(volume, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open \"%s\": %s\n", volume,
+			strerror(errno));
+		return 1;
+	}
+
+	char buffer[4096];
+
+	explain_query explain;
+	explain.query = argv[argi];
+	explain.query_length = strlen(argv[argi]);
+	explain.flags = flags;
+	explain.buffer = buffer;
+	explain.buffer_size = sizeof(buffer);
+
+	if (ioctl(fd, BFS_IOCTL_EXPLAIN_QUERY, &explain, sizeof(explain_query))
+			!= 0 && errno != B_BUFFER_OVERFLOW) {
+		fprintf(stderr, "Could not explain query: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	fputs(buffer, stdout);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,759 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+/*!	Tests packagefs' package content cache: the packages of a directory are
+	parsed, written to a content cache, and loaded from it again. Everything
+	loaded from the cache must equal what the parser created. It also checks
+	that the cache isn't used anymore for a package file whose modification
+	time, size, or node changed, and that a corrupt cache is rejected.
+	The packages are copied into a work directory first, since the test
+	modifies them.
+*/
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <OS.h>
+
+#include <fs/node_monitor.h>
+
+#include "Package.h"
+#include "PackageContentCache.h"
+#include "PackageDirectory.h"
+#include "PackageDomain.h"
+#include "PackageFile.h"
+#include "PackageSymlink.h"
+#include "Version.h"
+
+
+static const char* const kCacheFileName = ".PackageFSContentCache";
+static const int32 kMaxPackages = 1024;
+
+
+struct PackageSet {
+	Package*	packages[kMaxPackages];
+	int32		count;
+
+	PackageSet()
+		:
+		count(0)
+	{
+	}
+
+	~PackageSet()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		for (int32 i = 0; i < count; i++)
+			packages[i]->ReleaseReference();
+		count = 0;
+	}
+};
+
+
+static char* sFileNames[kMaxPackages];
+static int32 sFileNameCount;
+
+
+// #pragma mark - kernel emulation
+
+
+// The test doesn't let the package domain watch its directory.
+
+status_t
+add_node_listener(dev_t device, ino_t node, uint32 flags,
+	NotificationListener& listener)
+{
+	return B_UNSUPPORTED;
+}
+
+
+status_t
+remove_node_listener(dev_t device, ino_t node, NotificationListener& listener)
+{
+	return B_UNSUPPORTED;
+}
+
+
+// #pragma mark - utility functions
+
+
+static void
+fail(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "FAILED: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+
+	exit(1);
+}
+
+
+static void
+copy_file(const char* sourcePath, const char* targetPath)
+{
+	int source = open(sourcePath, O_RDONLY);
+	if (source < 0)
+		fail("open \"%s\": %s", sourcePath, strerror(errno));
+
+	int target = open(targetPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (target < 0)
+		fail("create \"%s\": %s", targetPath, strerror(errno));
+
+	char buffer[64 * 1024];
+	ssize_t bytesRead;
+	while ((bytesRead = read(source, buffer, sizeof(buffer))) > 0) {
+		if (write(target, buffer, bytesRead) != bytesRead)
+			fail("write \"%s\": %s", targetPath, strerror(errno));
+	}
+	if (bytesRead < 0)
+		fail("read \"%s\": %s", sourcePath, strerror(errno));
+
+	close(source);
+	close(target);
+}
+
+
+static bool
+is_package_file_name(const char* name)
+{
+	size_t length = strlen(name);
+	return length > 5 && strcmp(name + length - 5, ".hpkg") == 0;
+}
+
+
+/*!	Copies the packages in \a sourceDirectory into \a workDirectory, and
+	remembers their names.
+*/
+static void
+copy_packages(const char* sourceDirectory, const char* workDirectory)
+{
+	DIR* dir = opendir(sourceDirectory);
+	if (dir == NULL)
+		fail("opendir \"%s\": %s", sourceDirectory, strerror(errno));
+
+	while (dirent* entry = readdir(dir)) {
+		if (!is_package_file_name(entry->d_name))
+			continue;
+		if (sFileNameCount == kMaxPackages)
+			fail("more than %" B_PRId32 " packages", kMaxPackages);
+
+		char sourcePath[B_PATH_NAME_LENGTH];
+		char targetPath[B_PATH_NAME_LENGTH];
+		snprintf(sourcePath, sizeof(sourcePath), "%s/%s", sourceDirectory,
+			entry->d_name);
+		snprintf(targetPath, sizeof(targetPath), "%s/%s", workDirectory,
+			entry->d_name);
+		copy_file(sourcePath, targetPath);
+
+		sFileNames[sFileNameCount++] = strdup(entry->d_name);
+	}
+
+	closedir(dir);
+
+	if (sFileNameCount == 0)
+		fail("no packages in \"%s\"", sourceDirectory);
+}
+
+
+static Package*
+create_package(PackageDomain* domain, const char* fileName)
+{
+	struct stat st;
+	if (fstatat(domain->DirectoryFD(), fileName, &st, 0) < 0)
+		fail("stat \"%s\": %s", fileName, strerror(errno));
+
+	Package* package = new Package(domain, st.st_dev, st.st_ino);
+	status_t error = package->Init(fileName);
+	if (error != B_OK)
+		fail("init package \"%s\": %s", fileName, strerror(error));
+
+	package->SetFileInfo(st.st_size, st.st_mtim);
+	return package;
+}
+
+
+static void
+create_packages(PackageDomain* domain, PackageSet& set)
+{
+	set.Clear();
+	for (int32 i = 0; i < sFileNameCount; i++)
+		set.packages[set.count++] = create_package(domain, sFileNames[i]);
+}
+
+
+static bigtime_t
+parse_packages(PackageSet& set)
+{
+	bigtime_t startTime = system_time();
+
+	for (int32 i = 0; i < set.count; i++) {
+		status_t error = set.packages[i]->Load();
+		if (error != B_OK) {
+			fail("parse \"%s\": %s", set.packages[i]->FileName(),
+				strerror(error));
+		}
+	}
+
+	return system_time() - startTime;
+}
+
+
+static void
+write_cache(PackageDomain* domain, PackageSet& set)
+{
+	PackageContentCacheWriter writer;
+	for (int32 i = 0; i < set.count; i++) {
+		status_t error = writer.AddPackage(set.packages[i]);
+		if (error != B_OK) {
+			fail("add \"%s\" to the cache: %s", set.packages[i]->FileName(),
+				strerror(error));
+		}
+	}
+
+	status_t error = writer.Write(domain->DirectoryFD());
+	if (error != B_OK)
+		fail("write the cache: %s", strerror(error));
+}
+
+
+static bigtime_t
+load_packages(PackageDomain* domain, PackageSet& set)
+{
+	bigtime_t startTime = system_time();
+
+	PackageContentCache cache;
+	status_t error = cache.Init(domain->DirectoryFD());
+	if (error != B_OK)
+		fail("init the cache: %s", strerror(error));
+
+	for (int32 i = 0; i < set.count; i++) {
+		error = cache.LoadPackage(set.packages[i]);
+		if (error != B_OK) {
+			fail("load \"%s\" from the cache: %s",
+				set.packages[i]->FileName(), strerror(error));
+		}
+	}
+
+	return system_time() - startTime;
+}
+
+
+static void
+read_cache_file(PackageDomain* domain, uint8*& _data, off_t& _size)
+{
+	int fd = openat(domain->DirectoryFD(), kCacheFileName, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+		fail("open the cache: %s", strerror(errno));
+
+	_data = (uint8*)malloc(st.st_size);
+	if (_data == NULL
+		|| read_pos(fd, 0, _data, st.st_size) != (ssize_t)st.st_size) {
+		fail("read the cache: %s", strerror(errno));
+	}
+	_size = st.st_size;
+
+	close(fd);
+}
+
+
+static void
+write_cache_file(PackageDomain* domain, const uint8* data, off_t size)
+{
+	int fd = openat(domain->DirectoryFD(), kCacheFileName,
+		O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write_pos(fd, 0, data, size) != (ssize_t)size)
+		fail("write the cache: %s", strerror(errno));
+
+	close(fd);
+}
+
+
+// #pragma mark - comparison
+
+
+static bool
+equal_strings(const char* a, const char* b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+
+static void
+compare_data(const BPackageData& a, const BPackageData& b, const char* what)
+{
+	if (a.Compression() != b.Compression()
+		|| a.ChunkSize() != b.ChunkSize()
+		|| a.UncompressedSize() != b.UncompressedSize()
+		|| a.CompressedSize() != b.CompressedSize()
+		|| a.IsEncodedInline() != b.IsEncodedInline()) {
+		fail("%s: data differs", what);
+	}
+
+	if (a.IsEncodedInline()) {
+		if (memcmp(a.InlineData(), b.InlineData(), a.CompressedSize()) != 0)
+			fail("%s: inline data differs", what);
+	} else if (a.Offset() != b.Offset())
+		fail("%s: data offset differs", what);
+}
+
+
+static void
+compare_versions(const Version* a, const Version* b, const char* what)
+{
+	if (a == NULL || b == NULL) {
+		if (a != b)
+			fail("%s: version differs", what);
+		return;
+	}
+
+	if (!equal_strings(a->Major(), b->Major())
+		|| !equal_strings(a->Minor(), b->Minor())
+		|| !equal_strings(a->Micro(), b->Micro())
+		|| !equal_strings(a->PreRelease(), b->PreRelease())
+		|| a->Release() != b->Release() || a->Compare(*b) != 0) {
+		fail("%s: version differs", what);
+	}
+}
+
+
+/*!	Compares two nodes and their descendants. Besides the node contents, this
+	also covers the state the parser sets up via the package entries' user
+	tokens -- the parent links of the nodes --, the references the nodes
+	hold, and the attributes' index cookies, which must not be set before
+	the nodes are added to a volume.
+*/
+static void
+compare_nodes(PackageNode* a, PackageNode* b, PackageDirectory* parentA,
+	PackageDirectory* parentB, Package* packageA, Package* packageB)
+{
+	const char* name = a->Name();
+	if (!equal_strings(a->Name(), b->Name()))
+		fail("node name \"%s\" vs. \"%s\"", a->Name(), b->Name());
+
+	if (a->Mode() != b->Mode()) {
+		fail("%s: mode %#x vs. %#x", name, (unsigned)a->Mode(),
+			(unsigned)b->Mode());
+	}
+
+	if (a->ModifiedTime().tv_sec != b->ModifiedTime().tv_sec
+		|| a->ModifiedTime().tv_nsec != b->ModifiedTime().tv_nsec) {
+		fail("%s: modification time differs", name);
+	}
+
+	if (a->UserID() != b->UserID() || a->GroupID() != b->GroupID())
+		fail("%s: owner differs", name);
+
+	if (a->Parent() != parentA || b->Parent() != parentB)
+		fail("%s: wrong parent", name);
+
+	if (a->GetPackage() != packageA || b->GetPackage() != packageB)
+		fail("%s: wrong package", name);
+
+	if (a->CountReferences() != b->CountReferences()) {
+		fail("%s: %" B_PRId32 " vs. %" B_PRId32 " references", name,
+			a->CountReferences(), b->CountReferences());
+	}
+
+	if (a->FileSize() != b->FileSize())
+		fail("%s: file size differs", name);
+
+	if (S_ISREG(a->Mode())) {
+		compare_data(static_cast<PackageFile*>(a)->Data(),
+			static_cast<PackageFile*>(b)->Data(), name);
+	} else if (S_ISLNK(a->Mode())) {
+		if (!equal_strings(static_cast<PackageSymlink*>(a)->SymlinkPath(),
+				static_cast<PackageSymlink*>(b)->SymlinkPath())) {
+			fail("%s: symlink path differs", name);
+		}
+	}
+
+	// attributes
+	PackageNodeAttributeList::ConstIterator attributeIteratorA
+		= a->Attributes().GetIterator();
+	PackageNodeAttributeList::ConstIterator attributeIteratorB
+		= b->Attributes().GetIterator();
+	while (true) {
+		PackageNodeAttribute* attributeA = attributeIteratorA.Next();
+		PackageNodeAttribute* attributeB = attributeIteratorB.Next();
+		if (attributeA == NULL || attributeB == NULL) {
+			if (attributeA != attributeB)
+				fail("%s: attribute count differs", name);
+			break;
+		}
+
+		if (!equal_strings(attributeA->Name(), attributeB->Name())
+			|| attributeA->Type() != attributeB->Type()) {
+			fail("%s: attribute \"%s\" vs. \"%s\"", name, attributeA->Name(),
+				attributeB->Name());
+		}
+
+		if (attributeA->IndexCookie() != NULL
+			|| attributeB->IndexCookie() != NULL) {
+			fail("%s: attribute \"%s\" has an index cookie", name,
+				attributeA->Name());
+		}
+
+		compare_data(attributeA->Data(), attributeB->Data(),
+			attributeA->Name());
+	}
+
+	if (!S_ISDIR(a->Mode()))
+		return;
+
+	// children, in order
+	PackageDirectory* directoryA = static_cast<PackageDirectory*>(a);
+	PackageDirectory* directoryB = static_cast<PackageDirectory*>(b);
+	if (directoryA->Children().Size() != directoryB->Children().Size())
+		fail("%s: child count differs", name);
+
+	PackageNodeList::Iterator childIteratorA
+		= directoryA->Children().GetIterator();
+	PackageNodeList::Iterator childIteratorB
+		= directoryB->Children().GetIterator();
+	while (PackageNode* childA = childIteratorA.Next()) {
+		compare_nodes(childA, childIteratorB.Next(), directoryA, directoryB,
+			packageA, packageB);
+	}
+}
+
+
+static void
+compare_packages(Package* a, Package* b)
+{
+	const char* fileName = a->FileName();
+
+	if (!equal_strings(a->Name(), b->Name())
+		|| !equal_strings(a->InstallPath(), b->InstallPath())
+		|| a->Architecture() != b->Architecture()) {
+		fail("%s: package info differs", fileName);
+	}
+	compare_versions(a->Version(), b->Version(), fileName);
+
+	// resolvables
+	ResolvableList::ConstIterator resolvableIteratorA
+		= a->Resolvables().GetIterator();
+	ResolvableList::ConstIterator resolvableIteratorB
+		= b->Resolvables().GetIterator();
+	while (true) {
+		Resolvable* resolvableA = resolvableIteratorA.Next();
+		Resolvable* resolvableB = resolvableIteratorB.Next();
+		if (resolvableA == NULL || resolvableB == NULL) {
+			if (resolvableA != resolvableB)
+				fail("%s: resolvable count differs", fileName);
+			break;
+		}
+
+		if (!equal_strings(resolvableA->Name(), resolvableB->Name())
+			|| resolvableA->Package() != a || resolvableB->Package() != b) {
+			fail("%s: resolvable \"%s\" differs", fileName,
+				resolvableA->Name());
+		}
+		compare_versions(resolvableA->Version(), resolvableB->Version(),
+			resolvableA->Name());
+		compare_versions(resolvableA->CompatibleVersion(),
+			resolvableB->CompatibleVersion(), resolvableA->Name());
+	}
+
+	// dependencies
+	DependencyList::ConstIterator dependencyIteratorA
+		= a->Dependencies().GetIterator();
+	DependencyList::ConstIterator dependencyIteratorB
+		= b->Dependencies().GetIterator();
+	while (true) {
+		Dependency* dependencyA = dependencyIteratorA.Next();
+		Dependency* dependencyB = dependencyIteratorB.Next();
+		if (dependencyA == NULL || dependencyB == NULL) {
+			if (dependencyA != dependencyB)
+				fail("%s: dependency count differs", fileName);
+			break;
+		}
+
+		if (!equal_strings(dependencyA->Name(), dependencyB->Name())
+			|| dependencyA->Package() != a || dependencyB->Package() != b
+			|| (dependencyA->RequiredVersion() != NULL
+				&& dependencyA->VersionOperator()
+					!= dependencyB->VersionOperator())) {
+			fail("%s: dependency \"%s\" differs", fileName,
+				dependencyA->Name());
+		}
+		compare_versions(dependencyA->RequiredVersion(),
+			dependencyB->RequiredVersion(), dependencyA->Name());
+	}
+
+	// nodes
+	if (a->Nodes().Size() != b->Nodes().Size())
+		fail("%s: node count differs", fileName);
+
+	PackageNodeList::Iterator nodeIteratorA = a->Nodes().GetIterator();
+	PackageNodeList::Iterator nodeIteratorB = b->Nodes().GetIterator();
+	while (PackageNode* nodeA = nodeIteratorA.Next())
+		compare_nodes(nodeA, nodeIteratorB.Next(), NULL, NULL, a, b);
+}
+
+
+static bool
+is_empty(Package* package)
+{
+	return package->Name() == NULL && package->Version() == NULL
+		&& package->Nodes().IsEmpty() && package->Resolvables().IsEmpty()
+		&& package->Dependencies().IsEmpty();
+}
+
+
+// #pragma mark - invalidation tests
+
+
+/*!	Checks that loading \a fileName from the cache fails with \a expected,
+	leaving the package untouched, and that parsing the package file still
+	gives the same result as \a parsed, unless \a parsed is NULL.
+*/
+static void
+check_cache_miss(PackageDomain* domain, const char* fileName,
+	status_t expected, Package* parsed, const char* what)
+{
+	PackageContentCache cache;
+	status_t error = cache.Init(domain->DirectoryFD());
+	if (error != B_OK)
+		fail("%s: init the cache: %s", what, strerror(error));
+
+	Package* package = create_package(domain, fileName);
+	error = cache.LoadPackage(package);
+	if (error != expected) {
+		fail("%s: loading from the cache returned \"%s\" instead of \"%s\"",
+			what, strerror(error), strerror(expected));
+	}
+
+	if (!is_empty(package))
+		fail("%s: failed load changed the package", what);
+
+	if (parsed != NULL) {
+		error = package->Load();
+		if (error != B_OK)
+			fail("%s: parse the package: %s", what, strerror(error));
+		compare_packages(parsed, package);
+	}
+
+	package->ReleaseReference();
+	printf("%s: ok\n", what);
+}
+
+
+static void
+test_modified_time(PackageDomain* domain, Package* parsed)
+{
+	const char* fileName = parsed->FileName();
+
+	timespec times[2];
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = parsed->ModifiedTime();
+	times[1].tv_sec++;
+	if (utimensat(domain->DirectoryFD(), fileName, times, 0) != 0)
+		fail("utimensat \"%s\": %s", fileName, strerror(errno));
+
+	check_cache_miss(domain, fileName, B_ENTRY_NOT_FOUND, parsed,
+		"modification time changed");
+
+	// a change of the nanoseconds alone must be noticed as well
+	times[1] = parsed->ModifiedTime();
+	times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+	if (utimensat(domain->DirectoryFD(), fileName, times, 0) != 0)
+		fail("utimensat \"%s\": %s", fileName, strerror(errno));
+
+	check_cache_miss(domain, fileName, B_ENTRY_NOT_FOUND, parsed,
+		"modification time nanoseconds changed");
+}
+
+
+static void
+test_size(PackageDomain* domain, Package* parsed)
+{
+	const char* fileName = parsed->FileName();
+
+	// grow the file, but keep its modification time
+	int fd = openat(domain->DirectoryFD(), fileName, O_WRONLY);
+	if (fd < 0 || ftruncate(fd, parsed->FileSize() + 1) != 0)
+		fail("grow \"%s\": %s", fileName, strerror(errno));
+
+	timespec times[2];
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = parsed->ModifiedTime();
+	if (futimens(fd, times) != 0)
+		fail("futimens \"%s\": %s", fileName, strerror(errno));
+	close(fd);
+
+	// the package file isn't valid anymore, so don't parse it
+	check_cache_miss(domain, fileName, B_ENTRY_NOT_FOUND, NULL,
+		"size changed");
+}
+
+
+static void
+test_node(PackageDomain* domain, Package* parsed)
+{
+	const char* fileName = parsed->FileName();
+
+	// replace the file with a copy of the same size and modification time
+	char path[B_PATH_NAME_LENGTH];
+	char copyPath[B_PATH_NAME_LENGTH];
+	snprintf(path, sizeof(path), "%s/%s", domain->Path(), fileName);
+	snprintf(copyPath, sizeof(copyPath), "%s.copy", path);
+	copy_file(path, copyPath);
+	if (rename(copyPath, path) != 0)
+		fail("rename \"%s\": %s", copyPath, strerror(errno));
+
+	timespec times[2];
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = parsed->ModifiedTime();
+	if (utimensat(domain->DirectoryFD(), fileName, times, 0) != 0)
+		fail("utimensat \"%s\": %s", fileName, strerror(errno));
+
+	check_cache_miss(domain, fileName, B_ENTRY_NOT_FOUND, parsed,
+		"node changed");
+}
+
+
+static void
+test_corruption(PackageDomain* domain, Package* lastParsed)
+{
+	uint8* data;
+	off_t size;
+	read_cache_file(domain, data, size);
+
+	// corrupt the contents of the last package, which are stored last
+	data[size - 1] ^= 0x01;
+	write_cache_file(domain, data, size);
+	check_cache_miss(domain, lastParsed->FileName(), B_BAD_DATA, lastParsed,
+		"package contents corrupted");
+	data[size - 1] ^= 0x01;
+
+	// corrupt the entry table, the cache must not be used at all
+	data[32] ^= 0x01;
+	write_cache_file(domain, data, size);
+
+	PackageContentCache cache;
+	status_t error = cache.Init(domain->DirectoryFD());
+	if (error != B_BAD_DATA) {
+		fail("entry table corrupted: init returned \"%s\"",
+			strerror(error));
+	}
+	printf("entry table corrupted: ok\n");
+	data[32] ^= 0x01;
+
+	// restore the cache, and make sure it's fine again
+	write_cache_file(domain, data, size);
+	free(data);
+
+	PackageContentCache restoredCache;
+	error = restoredCache.Init(domain->DirectoryFD());
+	if (error != B_OK)
+		fail("cache restored: init the cache: %s", strerror(error));
+
+	Package* package = create_package(domain, lastParsed->FileName());
+	error = restoredCache.LoadPackage(package);
+	if (error != B_OK) {
+		fail("cache restored: load \"%s\" from the cache: %s",
+			package->FileName(), strerror(error));
+	}
+	compare_packages(lastParsed, package);
+	package->ReleaseReference();
+	printf("cache restored: ok\n");
+}
+
+
+// #pragma mark -
+
+
+int
+main(int argc, char** argv)
+{
+	if (argc > 3) {
+		fprintf(stderr, "usage: %s [<packages directory> [<work directory>]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	const char* packagesDirectory = argc > 1
+		? argv[1] : "/boot/system/packages";
+	const char* workBaseDirectory = argc > 2 ? argv[2] : "/tmp";
+
+	char workDirectory[B_PATH_NAME_LENGTH];
+	snprintf(workDirectory, sizeof(workDirectory),
+		"%s/packagefs_content_cache_test", workBaseDirectory);
+	if (mkdir(workDirectory, 0755) != 0 && errno != EEXIST)
+		fail("mkdir \"%s\": %s", workDirectory, strerror(errno));
+
+	copy_packages(packagesDirectory, workDirectory);
+
+	PackageDomain* domain = new PackageDomain(NULL);
+	status_t error = domain->Init(workDirectory);
+	if (error == B_OK)
+		error = domain->Prepare(NULL);
+	if (error != B_OK)
+		fail("init the package domain: %s", strerror(error));
+
+	unlinkat(domain->DirectoryFD(), kCacheFileName, 0);
+
+	// parse the packages, write the cache, and load them from it
+	PackageSet parsed;
+	create_packages(domain, parsed);
+	bigtime_t parseTime = parse_packages(parsed);
+
+	write_cache(domain, parsed);
+
+	PackageSet loaded;
+	create_packages(domain, loaded);
+	bigtime_t loadTime = load_packages(domain, loaded);
+
+	for (int32 i = 0; i < parsed.count; i++)
+		compare_packages(parsed.packages[i], loaded.packages[i]);
+	loaded.Clear();
+
+	printf("%" B_PRId32 " packages: parsing took %" B_PRId64 " us, loading "
+		"from the content cache %" B_PRId64 " us\n", parsed.count, parseTime,
+		loadTime);
+
+	// the cache must not be used for changed package files
+	test_corruption(domain, parsed.packages[parsed.count - 1]);
+	test_modified_time(domain, parsed.packages[0]);
+	if (parsed.count > 1)
+		test_node(domain, parsed.packages[1]);
+	if (parsed.count > 2)
+		test_size(domain, parsed.packages[2]);
+
+	// clean up
+	parsed.Clear();
+	unlinkat(domain->DirectoryFD(), kCacheFileName, 0);
+	for (int32 i = 0; i < sFileNameCount; i++) {
+		unlinkat(domain->DirectoryFD(), sFileNames[i], 0);
+		free(sFileNames[i]);
+	}
+	domain->ReleaseReference();
+	rmdir(workDirectory);
+
+	printf("All tests passed.\n");
+	return 0;
+}
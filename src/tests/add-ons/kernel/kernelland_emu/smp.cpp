@@ -4,7 +4,7 @@
  */
 
 
-//!	This is only needed for the debug build.
+//!	The SMP functions used by the kernel sources linked against this library.
 
 
 #include <cpu.h>
@@ -30,3 +30,10 @@ smp_get_current_cpu()
 {
 	return 0;
 }
+
+
+extern "C" int32
+smp_get_num_cpus()
+{
+	return 1;
+}
@@ -7,10 +7,8 @@
  */
 
 
-#define _KERNEL_DEBUG_H
-	// avoid including the private kernel debug.h header
-
 #include "argv.h"
+#include "interfaces.h"
 #include "tcp.h"
 #include "utility.h"
 
@@ -30,6 +28,7 @@
 
 #include <ctype.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <new>
 #include <set>
 #include <stdio.h>
@@ -44,6 +43,14 @@ struct context {
 	net_route	route;
 	bool		server;
 	thread_id	thread;
+	bigtime_t	link_free;
+	bigtime_t	last_due;
+};
+
+struct delayed_packet {
+	struct list_link link;
+	net_buffer*	buffer;
+	bigtime_t	due;
 };
 
 struct cmd_entry {
@@ -54,6 +61,8 @@ struct cmd_entry {
 
 struct net_socket_private : net_socket {
 	struct list_link		link;
+	net_socket_private*		parent;
+	vint32					ref_count;
 	team_id					owner;
 	uint32					max_backlog;
 	uint32					child_count;
@@ -62,6 +71,8 @@ struct net_socket_private : net_socket {
 
 	struct select_sync_pool	*select_pool;
 	mutex					lock;
+
+	bool					is_connected;
 };
 
 
@@ -80,6 +91,7 @@ extern module_info *modules[];
 
 extern struct net_protocol_module_info gDomainModule;
 struct net_interface gInterface;
+static InterfaceAddress sInterfaceAddress;
 extern struct net_socket_module_info gNetSocketModule;
 struct net_protocol_module_info *gTCPModule;
 struct net_socket *gServerSocket, *gClientSocket;
@@ -87,22 +99,28 @@ static struct context sClientContext, sServerContext;
 
 static vint32 sPacketNumber = 1;
 static double sRandomDrop = 0.0;
-static set<uint32> sDropList;
+static std::set<uint32> sDropList;
 static bigtime_t sRoundTripTime = 0;
 static bool sIncreasingRoundTrip = false;
 static bool sRandomRoundTrip = false;
 static bool sTCPDump = true;
 static bigtime_t sStartTime;
 static double sRandomReorder = 0.0;
-static set<uint32> sReorderList;
+static std::set<uint32> sReorderList;
 static bool sSimultaneousConnect = false;
 static bool sSimultaneousClose = false;
 static bool sServerActiveClose = false;
+static bool sClientClosed = false;
+static uint32 sBandwidth = 0;
+	// in kbit/s, 0 means unlimited
+static vint32 sDroppedPackets = 0;
+static vint64 sServerReceivedBytes = 0;
+static bool sMeasuring = false;
+static thread_id sServerThread = -1;
 
 static struct net_domain sDomain = {
 	"ipv4",
 	AF_INET,
-	{},
 	&gDomainModule,
 	&gIPv4AddressModule
 };
@@ -199,6 +217,13 @@ dummy_store_syscall_restart_timeout(bigtime_t timeout)
 }
 
 
+static bigtime_t
+dummy_restore_syscall_restart_timeout(void)
+{
+	return 0;
+}
+
+
 static net_stack_module_info gNetStackModule = {
 	{
 		NET_STACK_MODULE_NAME,
@@ -248,12 +273,42 @@ static net_stack_module_info gNetStackModule = {
 	dummy_is_syscall,
 	dummy_is_restarted_syscall,
 	dummy_store_syscall_restart_timeout,
-	NULL, // restore_syscall_restart_timeout
+	dummy_restore_syscall_restart_timeout,
 
 	// ancillary data is not used by TCP
+	NULL, // create_ancillary_data_container
+	NULL, // delete_ancillary_data_container
+	NULL, // add_ancillary_data
+	NULL, // remove_ancillary_data
+	NULL, // move_ancillary_data
+	NULL, // next_ancillary_data
 };
 
 
+//	#pragma mark - interface address
+
+
+/*!	The buffers reference the interface address they were received on; we
+	only have a single static one that is never freed.
+*/
+InterfaceAddress::InterfaceAddress()
+{
+	interface = NULL;
+	domain = NULL;
+	local = NULL;
+	destination = NULL;
+	mask = NULL;
+	flags = 0;
+	fLink = NULL;
+}
+
+
+InterfaceAddress::~InterfaceAddress()
+{
+}
+
+
+
 //	#pragma mark - socket
 
 
@@ -266,10 +321,13 @@ socket_create(int family, int type, int protocol, net_socket **_socket)
 	if (socket == NULL)
 		return B_NO_MEMORY;
 
-	memset(socket, 0, sizeof(net_socket));
+	memset(socket, 0, sizeof(net_socket_private));
 	socket->family = family;
 	socket->type = type;
 	socket->protocol = protocol;
+	socket->parent = NULL;
+	socket->ref_count = 1;
+	socket->is_connected = false;
 
 	mutex_init(&socket->lock, "socket");
 
@@ -321,6 +379,44 @@ socket_delete(net_socket *_socket)
 }
 
 
+bool
+socket_acquire(net_socket *_socket)
+{
+	net_socket_private *socket = (net_socket_private *)_socket;
+
+	// the endpoint might still try to get a socket that is being deleted
+	if (socket->ref_count == 0)
+		return false;
+
+	atomic_add(&socket->ref_count, 1);
+	return true;
+}
+
+
+bool
+socket_release(net_socket *_socket)
+{
+	net_socket_private *socket = (net_socket_private *)_socket;
+
+	if (atomic_add(&socket->ref_count, -1) != 1)
+		return false;
+
+	socket_delete(socket);
+	return true;
+}
+
+
+/*!	Detaches the socket from its parent, and releases the reference the
+	parent had to it.
+*/
+static void
+socket_remove_from_parent(net_socket_private *socket)
+{
+	socket->parent = NULL;
+	socket_release(socket);
+}
+
+
 int
 socket_accept(net_socket *socket, struct sockaddr *address,
 	socklen_t *_addressLength, net_socket **_acceptedSocket)
@@ -507,9 +603,11 @@ socket_dequeue_connected(net_socket *_parent, net_socket **_socket)
 
 	mutex_lock(&parent->lock);
 
-	net_socket *socket = (net_socket *)list_remove_head_item(&parent->connected_children);
+	net_socket_private *socket = (net_socket_private *)list_remove_head_item(
+		&parent->connected_children);
 	if (socket != NULL) {
-		socket->parent = NULL;
+		socket_acquire(socket);
+		socket_remove_from_parent(socket);
 		parent->child_count--;
 		*_socket = socket;
 	}
@@ -549,16 +647,17 @@ socket_set_max_backlog(net_socket *_socket, uint32 backlog)
 	mutex_lock(&socket->lock);
 
 	// first remove the pending connections, then the already connected ones as needed	
-	net_socket *child;
+	net_socket_private *child;
 	while (socket->child_count > backlog
-		&& (child = (net_socket *)list_remove_tail_item(&socket->pending_children)) != NULL) {
-		child->parent = NULL;
+		&& (child = (net_socket_private *)list_remove_tail_item(
+			&socket->pending_children)) != NULL) {
+		socket_remove_from_parent(child);
 		socket->child_count--;
 	}
 	while (socket->child_count > backlog
-		&& (child = (net_socket *)list_remove_tail_item(&socket->connected_children)) != NULL) {
-		child->parent = NULL;
-		socket_delete(child);
+		&& (child = (net_socket_private *)list_remove_tail_item(
+			&socket->connected_children)) != NULL) {
+		socket_remove_from_parent(child);
 		socket->child_count--;
 	}
 
@@ -568,14 +667,23 @@ socket_set_max_backlog(net_socket *_socket, uint32 backlog)
 }
 
 
+bool
+socket_has_parent(net_socket *_socket)
+{
+	net_socket_private *socket = (net_socket_private *)_socket;
+	return socket->parent != NULL;
+}
+
+
 /*!
 	The socket has been connected. It will be moved to the connected queue
 	of its parent socket.
 */
 status_t
-socket_connected(net_socket *socket)
+socket_connected(net_socket *_socket)
 {
-	net_socket_private *parent = (net_socket_private *)socket->parent;
+	net_socket_private *socket = (net_socket_private *)_socket;
+	net_socket_private *parent = socket->parent;
 	if (parent == NULL)
 		return B_BAD_VALUE;
 
@@ -583,12 +691,38 @@ socket_connected(net_socket *socket)
 
 	list_remove_item(&parent->pending_children, socket);
 	list_add_item(&parent->connected_children, socket);
+	socket->is_connected = true;
 
 	mutex_unlock(&parent->lock);
 	return B_OK;
 }
 
 
+/*!
+	The socket has been aborted before it could be accepted. It is removed
+	from its parent, which also releases the parent's reference.
+*/
+status_t
+socket_aborted(net_socket *_socket)
+{
+	net_socket_private *socket = (net_socket_private *)_socket;
+	net_socket_private *parent = socket->parent;
+	if (parent == NULL)
+		return B_BAD_VALUE;
+
+	MutexLocker _(parent->lock);
+
+	if (socket->is_connected)
+		list_remove_item(&parent->connected_children, socket);
+	else
+		list_remove_item(&parent->pending_children, socket);
+
+	parent->child_count--;
+	socket_remove_from_parent(socket);
+	return B_OK;
+}
+
+
 status_t
 socket_notify(net_socket *_socket, uint8 event, int32 value)
 {
@@ -630,7 +764,7 @@ net_socket_module_info gNetSocketModule = {
 		0,
 		std_ops
 	},
-	NULL, // open,
+	NULL, // open_socket,
 	NULL, // close,
 	NULL, // free,
 
@@ -649,12 +783,15 @@ net_socket_module_info gNetSocketModule = {
 	NULL, // get_next_stat,
 
 	// connections
+	socket_acquire,
+	socket_release,
 	socket_spawn_pending,
-	socket_delete,
 	socket_dequeue_connected,
 	socket_count_connected,
 	socket_set_max_backlog,
+	socket_has_parent,
 	socket_connected,
+	socket_aborted,
 
 	// notifications
 	NULL, // request_notification,
@@ -671,6 +808,7 @@ net_socket_module_info gNetSocketModule = {
 	NULL, // listen,
 	NULL, // receive,
 	NULL, // send,
+	NULL, // send_external,
 	NULL, // setsockopt,
 	NULL, // shutdown,
 	NULL, // socketpair
@@ -700,13 +838,28 @@ init_protocol(net_socket** _socket)
 }
 
 
+/*!	Closes the client socket, unless that already happened, and frees it. */
+static void
+free_client()
+{
+	net_protocol* protocol = gClientSocket->first_protocol;
+	if (!sClientClosed)
+		gTCPModule->close(protocol);
+
+	gTCPModule->free(protocol);
+	socket_release(gClientSocket);
+	gClientSocket = NULL;
+}
+
+
 void
 close_protocol(net_protocol* protocol)
 {
+	net_socket* socket = protocol->socket;
+
 	gTCPModule->close(protocol);
-	if (gTCPModule->free(protocol) == B_OK)
-		gTCPModule->uninit_protocol(protocol);
-		//socket_delete(protocol->socket);
+	gTCPModule->free(protocol);
+	socket_release(socket);
 }
 
 
@@ -718,10 +871,48 @@ datalink_send_data(struct net_route *route, net_buffer *buffer)
 {
 	struct context* context = (struct context*)route->gateway;
 
-	buffer->interface = &gInterface;
+	if ((((sockaddr_in*)buffer->destination)->sin_addr.s_addr
+			& htonl(0xff000000)) == htonl(0x0a000000)) {
+		// the hosts of the SYN flood do not exist, the packet just gets lost
+		gNetBufferModule.free(buffer);
+		return B_OK;
+	}
+
+	if (buffer->interface_address == NULL) {
+		buffer->interface_address = &sInterfaceAddress;
+		sInterfaceAddress.AcquireReference();
+	}
+
+	delayed_packet* packet = new(std::nothrow) delayed_packet;
+	if (packet == NULL)
+		return B_NO_MEMORY;
+
+	packet->buffer = buffer;
+
+	// Like a netem qdisc, every packet is delayed by half the round trip
+	// time, and has to queue behind the previous ones on a link with limited
+	// bandwidth. The packets are still delivered in order.
+	bigtime_t now = system_time();
+	bigtime_t delay = sRoundTripTime / 2;
+	if (sRandomRoundTrip)
+		delay += (bigtime_t)(1.0 * rand() / RAND_MAX * 500000) - 250000;
+	if (sIncreasingRoundTrip)
+		sRoundTripTime += (bigtime_t)(1.0 * rand() / RAND_MAX * 150000);
 
 	context->lock.Lock();
-	list_add_item(&context->list, buffer);
+
+	bigtime_t sent = now;
+	if (sBandwidth > 0) {
+		if (context->link_free > sent)
+			sent = context->link_free;
+		sent += 8000LL * buffer->size / sBandwidth;
+		context->link_free = sent;
+	}
+
+	packet->due = max_c(sent + max_c(delay, 0), context->last_due);
+	context->last_due = packet->due;
+
+	list_add_item(&context->list, packet);
 	context->lock.Unlock();
 
 	release_sem(context->wait_sem);
@@ -750,6 +941,12 @@ get_route(struct net_domain *_domain, const struct sockaddr *address)
 }
 
 
+void
+put_route(struct net_domain *_domain, struct net_route *route)
+{
+}
+
+
 net_datalink_module_info gNetDatalinkModule = {
 	{
 		NET_DATALINK_MODULE_NAME,
@@ -762,13 +959,24 @@ net_datalink_module_info gNetDatalinkModule = {
 	datalink_send_datagram,
 
 	NULL, //is_local_address,
-	NULL, //datalink_get_interface,
-	NULL, //datalink_get_interface_with_address,
+	NULL, //is_local_link_address,
+
+	NULL, //get_interface,
+	NULL, //get_interface_with_address,
+	NULL, //put_interface,
+
+	NULL, //get_interface_address,
+	NULL, //get_next_interface_address,
+	NULL, //put_interface_address,
+
+	NULL, //join_multicast,
+	NULL, //leave_multicast,
 
 	NULL, //add_route,
 	NULL, //remove_route,
 	get_route,
-	NULL, //put_route,
+	NULL, //get_buffer_route,
+	put_route,
 	NULL, //register_route_info,
 	NULL, //unregister_route_info,
 	NULL, //update_route_info
@@ -919,19 +1127,9 @@ domain_receive_data(net_buffer *buffer)
 
 	bool drop = false;
 	if (sDropList.find(packetNumber) != sDropList.end()
-		|| (sRandomDrop > 0.0 && (1.0 * rand() / RAND_MAX) > sRandomDrop))
+		|| (sRandomDrop > 0.0 && (1.0 * rand() / RAND_MAX) < sRandomDrop))
 		drop = true;
 
-	if (!drop && (sRoundTripTime > 0 || sRandomRoundTrip || sIncreasingRoundTrip)) {
-		bigtime_t add = 0;
-		if (sRandomRoundTrip)
-			add = (bigtime_t)(1.0 * rand() / RAND_MAX * 500000) - 250000;
-		if (sIncreasingRoundTrip)
-			sRoundTripTime += (bigtime_t)(1.0 * rand() / RAND_MAX * 150000);
-
-		snooze(sRoundTripTime / 2 + add);
-	}
-
 	if (sTCPDump) {
 		NetBufferHeaderReader<tcp_header> bufferHeader(buffer);
 		if (bufferHeader.Status() < B_OK)
@@ -1006,6 +1204,25 @@ domain_receive_data(net_buffer *buffer)
 						printf(" <ts %lu:%lu>", option->timestamp.value, option->timestamp.reply);
 						length = 10;
 						break;
+					case TCP_OPTION_SACK_PERMITTED:
+						printf(" <sackOK>");
+						length = 2;
+						break;
+					case TCP_OPTION_SACK:
+						length = option->length;
+						if (length < 2) {
+							size = 0;
+							break;
+						}
+
+						printf(" <sack");
+						for (uint32 i = 0; i < (length - 2) / sizeof(tcp_sack);
+								i++) {
+							printf(" %lu:%lu", ntohl(option->sack[i].left_edge),
+								ntohl(option->sack[i].right_edge));
+						}
+						printf(">");
+						break;
 
 					default:
 						length = option->length;
@@ -1027,6 +1244,7 @@ domain_receive_data(net_buffer *buffer)
 		printf("<**** DROPPED %ld ****>\n", packetNumber);
 
 	if (drop) {
+		atomic_add(&sDroppedPackets, 1);
 		gNetBufferModule.free(buffer);
 		return B_OK;
 	}
@@ -1036,15 +1254,15 @@ domain_receive_data(net_buffer *buffer)
 
 
 status_t
-domain_error(uint32 code, net_buffer *data)
+domain_error(net_error error, net_buffer *data)
 {
 	return B_ERROR;
 }
 
 
 status_t
-domain_error_reply(net_protocol *protocol, net_buffer *causedError, uint32 code,
-	void *errorData)
+domain_error_reply(net_protocol *protocol, net_buffer *causedError,
+	net_error error, net_error_data *errorData)
 {
 	return B_ERROR;
 }
@@ -1083,8 +1301,11 @@ net_protocol_module_info gDomainModule = {
 	NULL, // deliver_data
 	domain_error,
 	domain_error_reply,
-	NULL, // attach_ancillary_data
+	NULL, // add_ancillary_data
 	NULL, // process_ancillary_data
+	NULL, // process_ancillary_data_no_container
+	NULL, // send_data_no_buffer
+	NULL, // read_data_no_buffer
 };
 
 
@@ -1108,13 +1329,19 @@ receiving_thread(void* _data)
 
 		while (true) {
 			context->lock.Lock();
-			net_buffer* buffer = (net_buffer*)list_remove_head_item(
+			delayed_packet* packet = (delayed_packet*)list_remove_head_item(
 				&context->list);
 			context->lock.Unlock();
 
-			if (buffer == NULL)
+			if (packet == NULL)
 				break;
 
+			if (packet->due > system_time())
+				snooze_until(packet->due, B_SYSTEM_TIMEBASE);
+
+			net_buffer* buffer = packet->buffer;
+			delete packet;
+
 			if (sSimultaneousConnect && context->server && is_syn(buffer)) {
 				// delay getting the SYN request, and connect as well
 				sockaddr_in address;
@@ -1131,13 +1358,14 @@ receiving_thread(void* _data)
 				sSimultaneousConnect = false;
 			}
 			if (sSimultaneousClose && !context->server && is_fin(buffer)) {
-				close_protocol(gClientSocket->first_protocol);
+				gTCPModule->close(gClientSocket->first_protocol);
+				sClientClosed = true;
 				sSimultaneousClose = false;
 			}
-			if ((sRandomReorder > 0.0
-					|| sReorderList.find(sPacketNumber) != sReorderList.end())
-				&& reorderBuffer == NULL
-				&& (1.0 * rand() / RAND_MAX) > sRandomReorder) {
+			if ((sReorderList.find(sPacketNumber) != sReorderList.end()
+					|| (sRandomReorder > 0.0
+						&& (1.0 * rand() / RAND_MAX) < sRandomReorder))
+				&& reorderBuffer == NULL) {
 				reorderBuffer = buffer;
 			} else {
 				if (sDomain.module->receive_data(buffer) < B_OK)
@@ -1173,24 +1401,31 @@ server_thread(void*)
 
 		printf("server: got connection from %08x\n", address.sin_addr.s_addr);
 
-		char buffer[1024];
+		char buffer[16384];
 		ssize_t bytesRead;
+		bool activeClose = false;
 		while ((bytesRead = socket_recv(connectionSocket, buffer,
 				sizeof(buffer), 0)) > 0) {
-			printf("server: received %ld bytes\n", bytesRead);
+			atomic_add64(&sServerReceivedBytes, bytesRead);
+			if (!sMeasuring)
+				printf("server: received %ld bytes\n", bytesRead);
 
 			if (sServerActiveClose) {
 				printf("server: active close\n");
-				close_protocol(connectionSocket->first_protocol);
-				return 0;
+				sServerActiveClose = false;
+				activeClose = true;
+				break;
 			}
 		}
-		if (bytesRead < 0)
-			printf("server: receiving failed: %s\n", strerror(bytesRead));
-		else
-			printf("server: peer closed connection.\n");
+		if (!activeClose) {
+			if (bytesRead < 0)
+				printf("server: receiving failed: %s\n", strerror(bytesRead));
+			else
+				printf("server: peer closed connection.\n");
+
+			snooze(1000000);
+		}
 
-		snooze(1000000);
 		close_protocol(connectionSocket->first_protocol);
 	}
 
@@ -1221,15 +1456,15 @@ setup_server()
 		exit(1);
 	}
 
-	thread_id serverThread = spawn_thread(server_thread, "server",
-		B_NORMAL_PRIORITY, NULL);
-	if (serverThread < B_OK) {
+	sServerThread = spawn_thread(server_thread, "server", B_NORMAL_PRIORITY,
+		NULL);
+	if (sServerThread < B_OK) {
 		fprintf(stderr, "tcp_tester: cannot start server: %s\n",
-			strerror(serverThread));
+			strerror(sServerThread));
 		exit(1);
 	}
 
-	resume_thread(serverThread);
+	resume_thread(sServerThread);
 }
 
 
@@ -1237,11 +1472,13 @@ void
 setup_context(struct context& context, bool server)
 {
 	list_init(&context.list);
-	context.route.interface = &gInterface;
+	context.route.interface_address = &sInterfaceAddress;
 	context.route.gateway = (sockaddr *)&context;
 		// backpointer to the context
 	context.route.mtu = 1500;
 	context.server = server;
+	context.link_free = 0;
+	context.last_due = 0;
 	context.wait_sem = create_sem(0, "receive wait");
 
 	context.thread = spawn_thread(receiving_thread,
@@ -1366,17 +1603,28 @@ static void
 do_close(int argc, char** argv)
 {
 	sSimultaneousClose = false;
-	sServerActiveClose = true;
 
 	if (argc > 1) {
+		if (!strcmp(argv[1], "-c")) {
+			// the client closes first, and ends up in TIME_WAIT state
+			status_t status = gTCPModule->close(gClientSocket->first_protocol);
+			if (status != B_OK) {
+				fprintf(stderr, "could not close the client: %s\n",
+					strerror(status));
+			}
+			sClientClosed = true;
+			return;
+		}
 		if (!strcmp(argv[1], "-s"))
 			sSimultaneousClose = true;
 		else {
-			fprintf(stderr, "usage: close [-s]\n");
+			fprintf(stderr, "usage: close [-s|-c]\n");
 			return;
 		}
 	}
 
+	sServerActiveClose = true;
+
 	gClientSocket->send.timeout = 0;
 
 	char buffer[32767] = {'q'};
@@ -1388,6 +1636,104 @@ do_close(int argc, char** argv)
 }
 
 
+/*!	Replaces the client socket with a new one that is bound to the same
+	local port, and connects it to the server again. Use it after "close" or
+	"close -c" to see how the new connection gets past the TIME_WAIT state
+	the previous one left behind on either side.
+*/
+static void
+do_reconnect(int argc, char** argv)
+{
+	sockaddr_in address;
+	memcpy(&address, &gClientSocket->address, sizeof(sockaddr_in));
+	if (address.sin_len == 0) {
+		fprintf(stderr, "The client has not been connected yet.\n");
+		return;
+	}
+
+	free_client();
+	if (init_protocol(&gClientSocket) == NULL)
+		exit(1);
+	sClientClosed = false;
+
+	gClientSocket->options |= SO_REUSEADDR;
+
+	status_t status = socket_bind(gClientSocket, (struct sockaddr *)&address,
+		sizeof(struct sockaddr));
+	if (status < B_OK) {
+		fprintf(stderr, "Could not bind to port %u: %s\n",
+			ntohs(address.sin_port), strerror(status));
+		return;
+	}
+
+	printf("Reconnecting from port %u.\n", ntohs(address.sin_port));
+	sStartTime = system_time();
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(1024);
+	address.sin_addr.s_addr = htonl(0xc0a80001);
+
+	status = socket_connect(gClientSocket, (struct sockaddr *)&address,
+		sizeof(struct sockaddr));
+	if (status < B_OK)
+		fprintf(stderr, "tcp_tester: could not connect: %s\n", strerror(status));
+}
+
+
+/*!	Sends SYNs from hosts that never answer to the server, so that its SYN
+	cache fills up, and the next connections have to be established with
+	SYN cookies.
+*/
+static void
+do_syn_flood(int argc, char** argv)
+{
+	int32 count = 4096;
+	if (argc > 1 && isdigit(argv[1][0]))
+		count = strtoul(argv[1], NULL, 0);
+	else if (argc > 1) {
+		fprintf(stderr, "usage: synflood [<count>]\n");
+		return;
+	}
+
+	for (int32 i = 0; i < count; i++) {
+		net_buffer* buffer = gNetBufferModule.create(256);
+		if (buffer == NULL) {
+			fprintf(stderr, "not enough memory!\n");
+			return;
+		}
+
+		sockaddr_in* source = (sockaddr_in*)buffer->source;
+		memset(source, 0, sizeof(sockaddr_in));
+		source->sin_len = sizeof(sockaddr_in);
+		source->sin_family = AF_INET;
+		source->sin_port = htons(2048);
+		source->sin_addr.s_addr = htonl(0x0a000001 + i);
+
+		sockaddr_in* destination = (sockaddr_in*)buffer->destination;
+		memset(destination, 0, sizeof(sockaddr_in));
+		destination->sin_len = sizeof(sockaddr_in);
+		destination->sin_family = AF_INET;
+		destination->sin_port = htons(1024);
+		destination->sin_addr.s_addr = htonl(0xc0a80001);
+
+		buffer->interface_address = &sInterfaceAddress;
+		sInterfaceAddress.AcquireReference();
+
+		tcp_segment_header segment(TCP_FLAG_SYNCHRONIZE);
+		segment.sequence = rand();
+		segment.advertised_window = 65535;
+		segment.max_segment_size = 1460;
+
+		if (add_tcp_header(&gIPv4AddressModule, segment, buffer) != B_OK
+			|| gTCPModule->receive_data(buffer) < B_OK)
+			gNetBufferModule.free(buffer);
+	}
+
+	printf("Sent %ld SYNs to the server.\n", count);
+}
+
+
 static void
 do_drop(int argc, char** argv)
 {
@@ -1398,7 +1744,7 @@ do_drop(int argc, char** argv)
 
 		printf("Drop pakets:\n");
 
-		set<uint32>::iterator iterator = sDropList.begin();
+		std::set<uint32>::iterator iterator = sDropList.begin();
 		uint32 count = 0;
 		for (; iterator != sDropList.end(); iterator++) {
 			printf("%4lu\n", *iterator);
@@ -1455,7 +1801,7 @@ do_reorder(int argc, char** argv)
 
 		printf("Reorder packets:\n");
 
-		set<uint32>::iterator iterator = sReorderList.begin();
+		std::set<uint32>::iterator iterator = sReorderList.begin();
 		uint32 count = 0;
 		for (; iterator != sReorderList.end(); iterator++) {
 			printf("%4lu\n", *iterator);
@@ -1529,6 +1875,142 @@ do_round_trip_time(int argc, char** argv)
 }
 
 
+static void
+do_bandwidth(int argc, char** argv)
+{
+	if (argc == 1) {
+		if (sBandwidth == 0)
+			printf("Bandwidth is unlimited.\n");
+		else
+			printf("Bandwidth: %lu kbit/s\n", sBandwidth);
+	} else if (isdigit(argv[1][0])) {
+		sBandwidth = strtoul(argv[1], NULL, 0);
+	} else {
+		puts("usage: bandwidth [<kbit/s>]\n\n"
+			"Limits the bandwidth of the link in each direction, 0 means\n"
+			"unlimited; without any arguments, the current limit is printed.");
+	}
+}
+
+
+static void
+do_congestion_control(int argc, char** argv)
+{
+	if (argc == 1) {
+		char name[TCP_CA_NAME_MAX];
+		int length = sizeof(name);
+		status_t status = gTCPModule->getsockopt(gClientSocket->first_protocol,
+			IPPROTO_TCP, TCP_CONGESTION, name, &length);
+		if (status != B_OK) {
+			fprintf(stderr, "could not get congestion control: %s\n",
+				strerror(status));
+			return;
+		}
+
+		printf("Congestion control: %s\n", name);
+		return;
+	}
+
+	status_t status = gTCPModule->setsockopt(gClientSocket->first_protocol,
+		IPPROTO_TCP, TCP_CONGESTION, argv[1], strlen(argv[1]));
+	if (status != B_OK) {
+		fprintf(stderr, "could not set congestion control \"%s\": %s\n",
+			argv[1], strerror(status));
+	}
+}
+
+
+/*!	Sends the specified amount of data from the client to the server, and
+	measures how long it takes until the server has received all of it.
+	Use it together with "drop -r", "rtt", and "bandwidth" to compare how
+	the congestion control and loss recovery perform under loss and delay.
+*/
+static void
+do_goodput(int argc, char** argv)
+{
+	size_t size = 4 * 1024 * 1024;
+	if (argc > 1 && isdigit(argv[1][0])) {
+		char *unit;
+		size = strtoul(argv[1], &unit, 0);
+		if (unit != NULL && unit[0]) {
+			if (unit[0] == 'k' || unit[0] == 'K')
+				size *= 1024;
+			else if (unit[0] == 'm' || unit[0] == 'M')
+				size *= 1024 * 1024;
+			else {
+				fprintf(stderr, "unknown unit specified!\n");
+				return;
+			}
+		}
+	} else if (argc > 1) {
+		fprintf(stderr, "usage: goodput [<size>[k|m]]\n");
+		return;
+	}
+
+	const size_t kChunkSize = 65536;
+	char* buffer = (char*)malloc(kChunkSize);
+	if (buffer == NULL) {
+		fprintf(stderr, "not enough memory!\n");
+		return;
+	}
+
+	for (uint32 i = 0; i < kChunkSize; i++)
+		buffer[i] = (char)(i & 0xff);
+
+	bool tcpDump = sTCPDump;
+	sTCPDump = false;
+	sMeasuring = true;
+
+	int64 startBytes = atomic_get64(&sServerReceivedBytes);
+	int32 startDropped = atomic_get(&sDroppedPackets);
+	bigtime_t start = system_time();
+
+	size_t left = size;
+	while (left > 0) {
+		ssize_t bytesWritten = socket_send(gClientSocket, buffer,
+			min_c(left, kChunkSize), 0);
+		if (bytesWritten < B_OK) {
+			fprintf(stderr, "failed sending buffer: %s\n",
+				strerror(bytesWritten));
+			break;
+		}
+
+		left -= bytesWritten;
+	}
+
+	// wait until the server has received everything we sent
+	size_t sent = size - left;
+	bigtime_t timeout = system_time() + 120000000LL;
+	while (atomic_get64(&sServerReceivedBytes) - startBytes < (int64)sent
+		&& system_time() < timeout) {
+		snooze(1000);
+	}
+
+	bigtime_t duration = system_time() - start;
+	int64 received = atomic_get64(&sServerReceivedBytes) - startBytes;
+
+	sMeasuring = false;
+	sTCPDump = tcpDump;
+	free(buffer);
+
+	printf("%lld bytes in %g s: %g Mbit/s, %ld packets dropped\n", received,
+		duration / 1000000.0, received * 8.0 / duration,
+		atomic_get(&sDroppedPackets) - startDropped);
+}
+
+
+static void
+do_tcpdump(int argc, char** argv)
+{
+	if (argc > 1)
+		sTCPDump = !strcmp(argv[1], "on");
+	else
+		sTCPDump = !sTCPDump;
+
+	printf("tcpdump output turned %s.\n", sTCPDump ? "on" : "off");
+}
+
+
 static void
 do_dprintf(int argc, char** argv)
 {
@@ -1545,11 +2027,19 @@ static cmd_entry sBuiltinCommands[] = {
 	{"connect", do_connect, "Connects the client"},
 	{"send", do_send, "Sends data from the client to the server"},
 	{"close", do_close, "Performs an active or simultaneous close"},
+	{"reconnect", do_reconnect,
+		"Connects again from the same port with a new client socket"},
+	{"synflood", do_syn_flood, "Fills the SYN cache of the server"},
 	{"dprintf", do_dprintf, "Toggles debug output"},
 	{"drop", do_drop, "Lets you drop packets during transfer"},
 	{"reorder", do_reorder, "Lets you reorder packets during transfer"},
 	{"help", do_help, "prints this help text"},
 	{"rtt", do_round_trip_time, "Specifies the round trip time"},
+	{"bandwidth", do_bandwidth, "Limits the bandwidth of the link"},
+	{"cc", do_congestion_control,
+		"Shows or sets the congestion control of the client"},
+	{"goodput", do_goodput, "Measures the goodput of a transfer"},
+	{"tcpdump", do_tcpdump, "Toggles the packet dump"},
 	{"quit", NULL, "exits the application"},
 	{NULL, NULL, NULL},
 };
@@ -1594,8 +2084,9 @@ main(int argc, char** argv)
 	interfaceAddress.sin_len = sizeof(sockaddr_in);
 	interfaceAddress.sin_family = AF_INET;
 	interfaceAddress.sin_addr.s_addr = htonl(0xc0a80001);
-	gInterface.address = (sockaddr*)&interfaceAddress;
-	gInterface.domain = &sDomain;
+	sInterfaceAddress.interface = &gInterface;
+	sInterfaceAddress.domain = &sDomain;
+	sInterfaceAddress.local = (sockaddr*)&interfaceAddress;
 
 	status = get_module("network/protocols/tcp/v1", (module_info **)&gTCPModule);
 	if (status < B_OK) {
@@ -1661,8 +2152,15 @@ main(int argc, char** argv)
 		free(argv);
 	}
 
-	close_protocol(client);
-	close_protocol(server);
+	free_client();
+
+	// closing the server socket makes the server thread leave accept(), it
+	// must be gone before the socket can be freed
+	gTCPModule->close(server);
+	status_t threadStatus;
+	wait_for_thread(sServerThread, &threadStatus);
+	gTCPModule->free(server);
+	socket_release(gServerSocket);
 
 	snooze(2000000);
 
@@ -5,12 +5,16 @@
 
 
 #define write_pos	block_cache_write_pos
+#define writev_pos	block_cache_writev_pos
 #define read_pos	block_cache_read_pos
+#define readv_pos	block_cache_readv_pos
 
 #include "block_cache.cpp"
 
 #undef write_pos
+#undef writev_pos
 #undef read_pos
+#undef readv_pos
 
 
 #define MAX_BLOCKS				100
@@ -49,6 +53,7 @@ struct test_block {
 	bool	write;
 
 	bool	read;
+	bool	read_fails;
 	bool	written;
 	bool	present;
 };
@@ -123,20 +128,59 @@ block_cache_write_pos(int fd, off_t offset, const void* buffer, size_t size)
 }
 
 
+ssize_t
+block_cache_writev_pos(int fd, off_t offset, const iovec* vecs, size_t count)
+{
+	ssize_t written = 0;
+	for (size_t i = 0; i < count; i++) {
+		ssize_t result = block_cache_write_pos(fd, offset + written,
+			vecs[i].iov_base, vecs[i].iov_len);
+		if (result != (ssize_t)vecs[i].iov_len)
+			error(__LINE__, "Write of %ld bytes failed: %ld!\n",
+				vecs[i].iov_len, result);
+
+		written += result;
+	}
+
+	return written;
+}
+
+
 ssize_t
 block_cache_read_pos(int fd, off_t offset, void* buffer, size_t size)
 {
 	int32 index = offset / gBlockSize;
 
-	memset(buffer, 0xcc, size);
-	reset_block(buffer, index);
 	if (!gBlocks[index].read)
-		error(__LINE__, "Block %ld should not be written!\n", index);
+		error(__LINE__, "Block %ld should not be read!\n", index);
+	if (gBlocks[index].read_fails)
+		return B_IO_ERROR;
 
+	memset(buffer, 0xcc, size);
+	reset_block(buffer, index);
 	return size;
 }
 
 
+ssize_t
+block_cache_readv_pos(int fd, off_t offset, const iovec* vecs, size_t count)
+{
+	ssize_t bytesRead = 0;
+	for (size_t i = 0; i < count; i++) {
+		ssize_t result = block_cache_read_pos(fd, offset + bytesRead,
+			vecs[i].iov_base, vecs[i].iov_len);
+		if (result < 0)
+			return result;
+		if (result != (ssize_t)vecs[i].iov_len)
+			error(__LINE__, "Short read of %ld bytes!\n", result);
+
+		bytesRead += result;
+	}
+
+	return bytesRead;
+}
+
+
 void
 init_test_blocks()
 {
@@ -157,7 +201,7 @@ test_blocks(off_t number, int32 count, int32 line)
 	for (int32 i = 0; i < count; i++, number++) {
 		MutexLocker locker(&gCache->lock);
 
-		cached_block* block = (cached_block*)hash_lookup(gCache->hash, &number);
+		cached_block* block = gCache->table.Lookup(number);
 		if (block == NULL) {
 			if (gBlocks[number].present)
 				error(line, "Block %Ld not found!", number);
@@ -171,9 +215,9 @@ test_blocks(off_t number, int32 count, int32 line)
 				number, block->is_dirty, gBlocks[number].is_dirty);
 		}
 #if 0
-		if (block->unused != gBlocks[number].unused) {
+		if (block->IsUnused() != gBlocks[number].unused) {
 			error("Block %ld: discard bit differs (%d should be %d)!", number,
-				block->unused, gBlocks[number].unused);
+				block->IsUnused(), gBlocks[number].unused);
 		}
 #endif
 		if (block->discard != gBlocks[number].discard) {
@@ -428,6 +472,53 @@ main(int argc, char** argv)
 	cache_end_transaction(gCache, id, NULL, NULL);
 	cache_sync_transaction(gCache, id);
 
+	// Test prefetching
+
+	start_test("Prefetch", true);
+
+	gBlocks[5].present = true;
+	gBlocks[5].read = true;
+
+	block_cache_get(gCache, 5);
+	block_cache_put(gCache, 5);
+
+	for (int32 i = 3; i < 8; i++) {
+		gBlocks[i].present = true;
+		gBlocks[i].read = i != 5;
+	}
+
+	TEST_ASSERT(block_cache_prefetch(gCache, 3, 5) == B_OK);
+	TEST_BLOCKS(0, 10);
+
+	// the prefetched blocks must not be read again
+	for (int32 i = 3; i < 8; i++)
+		gBlocks[i].read = false;
+
+	block_cache_get(gCache, 4);
+	block_cache_put(gCache, 4);
+	block_cache_get(gCache, 7);
+	block_cache_put(gCache, 7);
+
+	TEST_BLOCKS(0, 10);
+
+	// a failing prefetch must not leave any of its blocks behind
+
+	for (int32 i = 10; i < 14; i++)
+		gBlocks[i].read = true;
+	gBlocks[12].read_fails = true;
+
+	TEST_ASSERT(block_cache_prefetch(gCache, 10, 4) == B_IO_ERROR);
+	TEST_BLOCKS(10, 4);
+	TEST_ASSERT(gCache->busy_reading_count == 0);
+
+	gBlocks[12].read_fails = false;
+	gBlocks[11].present = true;
+
+	block_cache_get(gCache, 11);
+	block_cache_put(gCache, 11);
+
+	TEST_BLOCKS(10, 4);
+
 	stop_test();
 	return 0;
 }
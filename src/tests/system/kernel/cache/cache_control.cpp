@@ -20,7 +20,7 @@ extern const char *__progname;
 void
 usage()
 {
-	fprintf(stderr, "usage: %s [clear | unset | set <module-name>]\n", __progname);
+	fprintf(stderr, "usage: %s [clear | unset | set <module-name> | stats]\n", __progname);
 	exit(0);
 }
 
@@ -50,6 +50,19 @@ main(int argc, char **argv)
 		status = _kern_generic_syscall(CACHE_SYSCALLS, CACHE_SET_MODULE, argv[2], strlen(argv[2]));
 		if (status != B_OK)
 			fprintf(stderr, "%s: setting the module failed: %s\n", __progname, strerror(status));
+	} else if (!strcmp(argv[1], "stats")) {
+		file_cache_read_ahead_stats stats;
+		status = _kern_generic_syscall(CACHE_SYSCALLS, CACHE_GET_READ_AHEAD_STATS, &stats, sizeof(stats));
+		if (status != B_OK) {
+			fprintf(stderr, "%s: getting the read-ahead statistics failed: %s\n", __progname, strerror(status));
+			return 1;
+		}
+
+		printf("read-ahead streams: %Lu\n", stats.streams);
+		printf("hits:               %Lu\n", stats.hits);
+		printf("misses:             %Lu\n", stats.misses);
+		printf("pages read ahead:   %Lu\n", stats.read_ahead_pages);
+		printf("pages wasted:       %Lu\n", stats.wasted_pages);
 	} else
 		usage();
 
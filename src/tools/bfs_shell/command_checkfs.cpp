@@ -17,15 +17,20 @@ namespace FSShell {
 fssh_status_t
 command_checkfs(int argc, const char* const* argv)
 {
-	if (argc == 2 && !strcmp(argv[1], "--help")) {
-		fssh_dprintf("Usage: %s [-c]\n"
-			"  -c  Check only; don't perform any changes\n", argv[0]);
-		return B_OK;
-	}
-
 	bool checkOnly = false;
-	if (argc == 2 && !strcmp(argv[1], "-c"))
-		checkOnly = true;
+	bool optimize = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c"))
+			checkOnly = true;
+		else if (!strcmp(argv[i], "-o"))
+			optimize = true;
+		else {
+			fssh_dprintf("Usage: %s [-c] [-o]\n"
+				"  -c  Check only; don't perform any changes\n"
+				"  -o  Also compact B+trees, and defragment files\n", argv[0]);
+			return B_OK;
+		}
+	}
 
 	int rootDir = _kern_open_dir(-1, "/myfs");
 	if (rootDir < 0)
@@ -34,10 +39,12 @@ command_checkfs(int argc, const char* const* argv)
 	struct check_control result;
 	memset(&result, 0, sizeof(result));
 	result.magic = BFS_IOCTL_CHECK_MAGIC;
-	result.flags = 0;
+	result.flags = BFS_CHECK_EXTENDED_STATS;
 	if (!checkOnly) {
 		result.flags |= BFS_FIX_BITMAP_ERRORS | BFS_REMOVE_WRONG_TYPES
 			| BFS_REMOVE_INVALID | BFS_FIX_NAME_MISMATCHES | BFS_FIX_BPLUSTREES;
+		if (optimize)
+			result.flags |= BFS_COMPACT_BPLUSTREES | BFS_DEFRAGMENT_FILES;
 	}
 
 	// start checking
@@ -103,6 +110,10 @@ command_checkfs(int argc, const char* const* argv)
 		return errno;
 	}
 
+	struct free_space_report freeSpace;
+	fssh_status_t freeSpaceStatus = _kern_ioctl(rootDir,
+		BFS_IOCTL_FREE_SPACE_REPORT, &freeSpace, sizeof(freeSpace));
+
 	_kern_close(rootDir);
 
 	fssh_dprintf("        %" B_PRIu64 " nodes checked,\n\t%" B_PRIu64 " blocks "
@@ -125,6 +136,38 @@ command_checkfs(int argc, const char* const* argv)
 		" array blocks, %lld)\n", result.stats.double_indirect_block_runs,
 		result.stats.double_indirect_array_blocks,
 		result.stats.blocks_in_double_indirect * result.stats.block_size);
+	fssh_dprintf("\tfile fragments\t\t\t%" B_PRIu64 " (%" B_PRIu64
+		" fragmented files)\n", result.extended_stats.file_fragments,
+		result.extended_stats.fragmented_files);
+	fssh_dprintf("\tinline files\t\t\t%" B_PRIu64 "\n",
+		result.extended_stats.inline_files);
+
+	if ((result.flags & (BFS_COMPACT_BPLUSTREES | BFS_DEFRAGMENT_FILES))
+			!= 0) {
+		fssh_dprintf("\n\tcompacted b+trees\t\t%" B_PRIu64 " (%" B_PRIu64
+			" nodes freed, %" B_PRIu64 " levels removed)\n",
+			result.extended_stats.compacted_trees,
+			result.extended_stats.freed_tree_nodes,
+			result.extended_stats.removed_tree_levels);
+		fssh_dprintf("\tdefragmented files\t\t%" B_PRIu64 " (%" B_PRIu64
+			" fragments removed)\n",
+			result.extended_stats.defragmented_files,
+			result.extended_stats.removed_fragments);
+	}
+
+	if (freeSpaceStatus == B_OK) {
+		fssh_dprintf("\n\tfree extents\t\t\t%" B_PRIu64 " (%" B_PRIu64
+			" blocks, largest %" B_PRIu64 ")\n", freeSpace.free_extents,
+			freeSpace.free_blocks, freeSpace.largest_free_extent);
+		for (int32 i = 0; i < BFS_FREE_EXTENT_SIZE_CLASSES; i++) {
+			if (freeSpace.extents_by_size[i] == 0)
+				continue;
+			fssh_dprintf("\t  %6" B_PRIu64 "+ blocks\t\t%" B_PRIu64 "\n",
+				(uint64)1 << i, freeSpace.extents_by_size[i]);
+		}
+		fssh_dprintf("\tfragmented groups\t\t%" B_PRIu32 "\n",
+			freeSpace.fragmented_groups);
+	}
 
 	if (result.status == B_ENTRY_NOT_FOUND)
 		result.status = B_OK;
@@ -14,13 +14,14 @@
 #include "fssh_kernel_export.h"
 #include "fssh_lock.h"
 #include "fssh_string.h"
+#include "fssh_uio.h"
 #include "fssh_unistd.h"
 #include "hash.h"
 #include "vfs.h"
 
 // TODO: this is a naive but growing implementation to test the API:
-//	1) block reading/writing is not at all optimized for speed, it will
-//	   just read and write single blocks.
+//	1) block reading is not at all optimized for speed, it will just read
+//	   single blocks.
 //	2) the locking could be improved; getting a block should not need to
 //	   wait for blocks to be written
 // TODO: the retrieval/copy of the original data could be delayed until the
@@ -133,6 +134,8 @@ struct block_cache {
 };
 
 static const int32_t kMaxBlockCount = 1024;
+static const int32_t kMaxWriteVecs = 32;
+static const int32_t kMaxReadVecs = 32;
 
 struct cache_listener;
 typedef DoublyLinkedListLink<cache_listener> listener_link;
@@ -546,6 +549,7 @@ block_cache::FreeBlock(cached_block* block)
 #endif
 
 	delete block;
+	allocated_block_count--;
 }
 
 
@@ -873,35 +877,40 @@ get_writable_cached_block(block_cache* cache, fssh_off_t blockNumber, fssh_off_t
 }
 
 
-/*!	Writes the specified \a block back to disk. It will always only write back
-	the oldest change of the block if it is part of more than one transaction.
-	It will automatically send out TRANSACTION_WRITTEN notices, as well as
-	delete transactions when they are no longer used, and \a deleteTransaction
-	is \c true.
-*/
-static fssh_status_t
-write_cached_block(block_cache* cache, cached_block* block,
-	bool deleteTransaction)
+static int
+compare_blocks(const void* _blockA, const void* _blockB)
 {
-	cache_transaction* previous = block->previous_transaction;
-	int32_t blockSize = cache->block_size;
+	cached_block* blockA = *(cached_block**)_blockA;
+	cached_block* blockB = *(cached_block**)_blockB;
 
-	void* data = previous && block->original_data
-		? block->original_data : block->current_data;
-		// we first need to write back changes from previous transactions
+	fssh_off_t diff = blockA->block_number - blockB->block_number;
+	if (diff > 0)
+		return 1;
 
-	TRACE(("write_cached_block(block %Ld)\n", block->block_number));
+	return diff < 0 ? -1 : 0;
+}
 
-	fssh_ssize_t written = fssh_write_pos(cache->fd, block->block_number * blockSize,
-		data, blockSize);
 
-	if (written < blockSize) {
-		FATAL(("could not write back block %" FSSH_B_PRIdOFF " (%s)\n",
-			block->block_number, fssh_strerror(fssh_get_errno())));
-		return FSSH_B_IO_ERROR;
-	}
+/*!	Returns the data of the \a block that has to be written back: changes
+	from previous transactions need to be written first.
+*/
+static void*
+block_write_data(cached_block* block)
+{
+	return block->previous_transaction && block->original_data
+		? block->original_data : block->current_data;
+}
+
 
-	if (data == block->current_data)
+/*!	Updates the state of the \a block after its data has been written back
+	to disk.
+*/
+static void
+block_written(block_cache* cache, cached_block* block, bool deleteTransaction)
+{
+	cache_transaction* previous = block->previous_transaction;
+
+	if (block_write_data(block) == block->current_data)
 		block->is_dirty = false;
 
 	if (previous != NULL) {
@@ -927,11 +936,88 @@ write_cached_block(block_cache* cache, cached_block* block,
 			}
 		}
 	}
-	if (block->transaction == NULL && block->ref_count == 0) {
+	if (block->transaction == NULL && block->ref_count == 0
+		&& !block->unused) {
 		// the block is no longer used
 		block->unused = true;
 		cache->unused_blocks.Add(block);
 	}
+}
+
+
+/*!	Writes the specified \a block back to disk. It will always only write back
+	the oldest change of the block if it is part of more than one transaction.
+	It will automatically send out TRANSACTION_WRITTEN notices, as well as
+	delete transactions when they are no longer used, and \a deleteTransaction
+	is \c true.
+*/
+static fssh_status_t
+write_cached_block(block_cache* cache, cached_block* block,
+	bool deleteTransaction)
+{
+	int32_t blockSize = cache->block_size;
+
+	TRACE(("write_cached_block(block %Ld)\n", block->block_number));
+
+	fssh_ssize_t written = fssh_write_pos(cache->fd, block->block_number * blockSize,
+		block_write_data(block), blockSize);
+
+	if (written < blockSize) {
+		FATAL(("could not write back block %" FSSH_B_PRIdOFF " (%s)\n",
+			block->block_number, fssh_strerror(fssh_get_errno())));
+		return FSSH_B_IO_ERROR;
+	}
+
+	block_written(cache, block, deleteTransaction);
+	return FSSH_B_OK;
+}
+
+
+/*!	Writes back the \a count \a blocks like write_cached_block() does, but
+	sorts them by block number first, and writes runs of consecutive blocks
+	with a single request.
+	The \a blocks array is reordered.
+*/
+static fssh_status_t
+write_cached_blocks(block_cache* cache, cached_block** blocks, int32_t count,
+	bool deleteTransaction)
+{
+	qsort(blocks, count, sizeof(cached_block*), &compare_blocks);
+
+	int32_t blockSize = cache->block_size;
+
+	for (int32_t i = 0; i < count;) {
+		int32_t runLength = 1;
+		while (i + runLength < count && runLength < kMaxWriteVecs
+			&& blocks[i + runLength]->block_number
+				== blocks[i]->block_number + runLength) {
+			runLength++;
+		}
+
+		fssh_iovec vecs[kMaxWriteVecs];
+		for (int32_t j = 0; j < runLength; j++) {
+			vecs[j].iov_base = block_write_data(blocks[i + j]);
+			vecs[j].iov_len = blockSize;
+		}
+
+		TRACE(("write_cached_blocks(block %Ld, count %ld)\n",
+			blocks[i]->block_number, runLength));
+
+		fssh_ssize_t written = fssh_writev_pos(cache->fd,
+			blocks[i]->block_number * blockSize, vecs, runLength);
+		if (written < (fssh_ssize_t)runLength * blockSize) {
+			FATAL(("could not write back blocks %" FSSH_B_PRIdOFF " - %"
+				FSSH_B_PRIdOFF " (%s)\n", blocks[i]->block_number,
+				blocks[i]->block_number + runLength - 1,
+				fssh_strerror(fssh_get_errno())));
+			return FSSH_B_IO_ERROR;
+		}
+
+		for (int32_t j = 0; j < runLength; j++)
+			block_written(cache, blocks[i + j], deleteTransaction);
+
+		i += runLength;
+	}
 
 	return FSSH_B_OK;
 }
@@ -1010,6 +1096,23 @@ fssh_cache_sync_transaction(void* _cache, int32_t id)
 
 		if (transaction->id <= id && !transaction->open) {
 			// write back all of their remaining dirty blocks
+			int32_t count = 0;
+			cached_block** blocks = (cached_block**)malloc(
+				transaction->num_blocks * sizeof(cached_block*));
+			if (blocks != NULL) {
+				block_list::Iterator blockIterator
+					= transaction->blocks.GetIterator();
+				while (count < transaction->num_blocks
+					&& blockIterator.HasNext()) {
+					blocks[count++] = blockIterator.Next();
+				}
+
+				status = write_cached_blocks(cache, blocks, count, false);
+				free(blocks);
+				if (status != FSSH_B_OK)
+					return status;
+			}
+
 			while (transaction->num_blocks > 0) {
 				status = write_cached_block(cache, transaction->blocks.Head(),
 					false);
@@ -1522,21 +1625,30 @@ fssh_block_cache_sync(void* _cache)
 	// transaction or no transaction only
 
 	MutexLocker locker(&cache->lock);
+
+	cached_block** blocks = (cached_block**)malloc(
+		cache->allocated_block_count * sizeof(cached_block*));
+	if (blocks == NULL)
+		return FSSH_B_NO_MEMORY;
+
+	int32_t count = 0;
 	hash_iterator iterator;
 	hash_open(cache->hash, &iterator);
 
 	cached_block* block;
-	while ((block = (cached_block*)hash_next(cache->hash, &iterator)) != NULL) {
+	while (count < cache->allocated_block_count
+		&& (block = (cached_block*)hash_next(cache->hash, &iterator)) != NULL) {
 		if (block->previous_transaction != NULL
 			|| (block->transaction == NULL && block->is_dirty)) {
-			fssh_status_t status = write_cached_block(cache, block);
-			if (status != FSSH_B_OK)
-				return status;
+			blocks[count++] = block;
 		}
 	}
 
 	hash_close(cache->hash, &iterator, false);
-	return FSSH_B_OK;
+
+	fssh_status_t status = write_cached_blocks(cache, blocks, count, true);
+	free(blocks);
+	return status;
 }
 
 
@@ -1702,6 +1814,84 @@ fssh_block_cache_get(void* _cache, fssh_off_t blockNumber)
 }
 
 
+fssh_status_t
+fssh_block_cache_prefetch(void* _cache, fssh_off_t blockNumber,
+	fssh_size_t numBlocks)
+{
+	block_cache* cache = (block_cache*)_cache;
+
+	if (blockNumber < 0 || blockNumber >= cache->max_blocks
+		|| (fssh_off_t)numBlocks > cache->max_blocks - blockNumber) {
+		fssh_panic("block_cache_prefetch: invalid block range %"
+			FSSH_B_PRIdOFF ", %" FSSH_B_PRIuSIZE " (max %" FSSH_B_PRIdOFF ")",
+			blockNumber, numBlocks, cache->max_blocks - 1);
+		return FSSH_B_BAD_VALUE;
+	}
+
+	MutexLocker locker(&cache->lock);
+
+	fssh_size_t blockSize = cache->block_size;
+	cached_block* blocks[kMaxReadVecs];
+	fssh_iovec vecs[kMaxReadVecs];
+	fssh_size_t index = 0;
+
+	while (index < numBlocks) {
+		// collect the following run of blocks that are not in the cache yet
+		fssh_size_t count = 0;
+		while (index + count < numBlocks && count < (fssh_size_t)kMaxReadVecs) {
+			fssh_off_t number = blockNumber + index + count;
+			if (hash_lookup(cache->hash, &number) != NULL)
+				break;
+
+			cached_block* block = cache->NewBlock(number);
+			if (block == NULL)
+				break;
+
+			hash_insert(cache->hash, block);
+
+			blocks[count] = block;
+			vecs[count].iov_base = block->current_data;
+			vecs[count].iov_len = blockSize;
+			count++;
+		}
+
+		if (count == 0) {
+			fssh_off_t number = blockNumber + index;
+			if (hash_lookup(cache->hash, &number) == NULL)
+				return FSSH_B_NO_MEMORY;
+
+			// this block is already in the cache
+			index++;
+			continue;
+		}
+
+		fssh_ssize_t bytesRead = fssh_readv_pos(cache->fd,
+			(blockNumber + index) * blockSize, vecs, count);
+		bool failed = bytesRead != (fssh_ssize_t)(count * blockSize);
+
+		for (fssh_size_t i = 0; i < count; i++) {
+			if (failed) {
+				cache->RemoveBlock(blocks[i]);
+				continue;
+			}
+
+			blocks[i]->unused = true;
+			cache->unused_blocks.Add(blocks[i]);
+		}
+
+		if (failed) {
+			FATAL(("could not prefetch blocks %" FSSH_B_PRIdOFF "\n",
+				blockNumber + index));
+			return bytesRead < 0 ? fssh_errno : FSSH_B_IO_ERROR;
+		}
+
+		index += count;
+	}
+
+	return FSSH_B_OK;
+}
+
+
 /*!	Changes the internal status of a writable block to \a dirty. This can be
 	helpful in case you realize you don't need to change that block anymore
 	for whatever reason.
@@ -0,0 +1,448 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+
+#include "compatibility.h"
+
+#include "command_replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "fssh_errors.h"
+#include "fssh_fcntl.h"
+#include "fssh_os.h"
+#include "fssh_stat.h"
+#include "fssh_string.h"
+#include "fssh_type_constants.h"
+#include "syscalls.h"
+
+
+/*!	The "replay" command runs a metadata workload against the mounted file
+	system, and reports how long each kind of operation took. It can be used
+	to measure changes to the file system or the block cache on the host.
+
+	A workload file contains one operation per line; empty lines, and lines
+	starting with '#' are ignored. Paths are relative to the current directory
+	of the shell:
+		mkdir <path>
+		create <path> [<size>]
+		attr <path> <name> [<size>]
+		stat <path>
+		rename <path> <new path>
+		rm <path>
+		rmdir <path>
+		sync
+*/
+
+
+namespace FSShell {
+
+
+enum replay_op_type {
+	REPLAY_MKDIR = 0,
+	REPLAY_CREATE,
+	REPLAY_ATTR,
+	REPLAY_STAT,
+	REPLAY_RENAME,
+	REPLAY_REMOVE,
+	REPLAY_REMOVE_DIR,
+	REPLAY_SYNC,
+
+	REPLAY_OP_TYPE_COUNT
+};
+
+static const char* const kOpNames[REPLAY_OP_TYPE_COUNT] = {
+	"mkdir",
+	"create",
+	"attr",
+	"stat",
+	"rename",
+	"rm",
+	"rmdir",
+	"sync"
+};
+
+struct replay_op {
+	replay_op_type	type;
+	std::string		path;
+	std::string		argument;
+	fssh_off_t		size;
+};
+
+struct replay_op_stats {
+	uint32_t		count;
+	uint32_t		errors;
+	fssh_bigtime_t	time;
+};
+
+typedef std::vector<replay_op> OpList;
+
+static char sDataBuffer[16 * 1024];
+
+
+static void
+add_op(OpList& ops, replay_op_type type, const std::string& path,
+	const std::string& argument = std::string(), fssh_off_t size = 0)
+{
+	replay_op op;
+	op.type = type;
+	op.path = path;
+	op.argument = argument;
+	op.size = size;
+	ops.push_back(op);
+}
+
+
+static fssh_status_t
+parse_workload(const char* fileName, OpList& ops)
+{
+	FILE* file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Error: Could not open workload \"%s\"\n", fileName);
+		return FSSH_B_ENTRY_NOT_FOUND;
+	}
+
+	char line[1024];
+	int32_t lineNumber = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+
+		char command[32];
+		char path[FSSH_B_PATH_NAME_LENGTH];
+		char argument[FSSH_B_PATH_NAME_LENGTH];
+		long long size = 0;
+		int count = sscanf(line, "%31s %1023s %1023s %lld", command, path,
+			argument, &size);
+		if (count <= 0 || command[0] == '#')
+			continue;
+
+		int32_t type = 0;
+		for (; type < REPLAY_OP_TYPE_COUNT; type++) {
+			if (!strcmp(command, kOpNames[type]))
+				break;
+		}
+
+		// check the number of arguments
+		int minCount = 2;
+		int maxCount = 2;
+		switch (type) {
+			case REPLAY_CREATE:
+				maxCount = 3;
+				if (count == 3)
+					size = strtoll(argument, NULL, 0);
+				argument[0] = '\0';
+				break;
+			case REPLAY_ATTR:
+				minCount = 3;
+				maxCount = 4;
+				break;
+			case REPLAY_RENAME:
+				minCount = maxCount = 3;
+				break;
+			case REPLAY_SYNC:
+				minCount = maxCount = 1;
+				break;
+			case REPLAY_OP_TYPE_COUNT:
+				minCount = maxCount = -1;
+				break;
+		}
+
+		if (count < minCount || count > maxCount) {
+			fprintf(stderr, "Error: Invalid operation in line %d of "
+				"\"%s\"\n", (int)lineNumber, fileName);
+			fclose(file);
+			return FSSH_B_BAD_VALUE;
+		}
+
+		add_op(ops, (replay_op_type)type, count > 1 ? path : "",
+			count > 2 ? argument : "", size);
+	}
+
+	fclose(file);
+	return FSSH_B_OK;
+}
+
+
+/*!	Generates a workload similar to unpacking a source tree: \a directories
+	directories containing \a files files of \a size bytes each, with a type
+	attribute. All entries are stat()ed, half of the files are renamed, and
+	everything is removed again.
+*/
+static void
+generate_workload(OpList& ops, int32_t directories, int32_t files,
+	fssh_off_t size)
+{
+	char name[FSSH_B_PATH_NAME_LENGTH];
+	char newName[FSSH_B_PATH_NAME_LENGTH];
+
+	add_op(ops, REPLAY_MKDIR, "replay");
+
+	for (int32_t i = 0; i < directories; i++) {
+		snprintf(name, sizeof(name), "replay/dir%d", (int)i);
+		add_op(ops, REPLAY_MKDIR, name);
+
+		for (int32_t j = 0; j < files; j++) {
+			snprintf(name, sizeof(name), "replay/dir%d/file%d.cpp", (int)i,
+				(int)j);
+			add_op(ops, REPLAY_CREATE, name, "", size);
+			add_op(ops, REPLAY_ATTR, name, "BEOS:TYPE", 16);
+		}
+	}
+
+	for (int32_t i = 0; i < directories; i++) {
+		for (int32_t j = 0; j < files; j++) {
+			snprintf(name, sizeof(name), "replay/dir%d/file%d.cpp", (int)i,
+				(int)j);
+			add_op(ops, REPLAY_STAT, name);
+
+			if (j % 2 == 0) {
+				snprintf(newName, sizeof(newName), "replay/dir%d/file%d.o",
+					(int)i, (int)j);
+				add_op(ops, REPLAY_RENAME, name, newName);
+			}
+		}
+	}
+
+	for (int32_t i = 0; i < directories; i++) {
+		for (int32_t j = 0; j < files; j++) {
+			snprintf(name, sizeof(name), "replay/dir%d/file%d.%s", (int)i,
+				(int)j, j % 2 == 0 ? "o" : "cpp");
+			add_op(ops, REPLAY_REMOVE, name);
+		}
+
+		snprintf(name, sizeof(name), "replay/dir%d", (int)i);
+		add_op(ops, REPLAY_REMOVE_DIR, name);
+	}
+
+	add_op(ops, REPLAY_REMOVE_DIR, "replay");
+}
+
+
+static fssh_status_t
+write_data(int fd, fssh_off_t size)
+{
+	fssh_off_t offset = 0;
+	while (offset < size) {
+		fssh_size_t toWrite = sizeof(sDataBuffer);
+		if ((fssh_off_t)toWrite > size - offset)
+			toWrite = size - offset;
+
+		fssh_ssize_t written = _kern_write(fd, offset, sDataBuffer, toWrite);
+		if (written < 0)
+			return written;
+		if (written == 0)
+			return FSSH_B_IO_ERROR;
+
+		offset += written;
+	}
+
+	return FSSH_B_OK;
+}
+
+
+static fssh_status_t
+run_op(const replay_op& op)
+{
+	const char* path = op.path.c_str();
+
+	switch (op.type) {
+		case REPLAY_MKDIR:
+			return _kern_create_dir(-1, path, 0755);
+
+		case REPLAY_CREATE:
+		{
+			int fd = _kern_open(-1, path,
+				FSSH_O_CREAT | FSSH_O_TRUNC | FSSH_O_WRONLY, 0644);
+			if (fd < 0)
+				return fd;
+
+			fssh_status_t status = write_data(fd, op.size);
+			_kern_close(fd);
+			return status;
+		}
+
+		case REPLAY_ATTR:
+		{
+			int fd = _kern_open(-1, path, FSSH_O_RDONLY, 0);
+			if (fd < 0)
+				return fd;
+
+			int attr = _kern_create_attr(fd, op.argument.c_str(),
+				FSSH_B_RAW_TYPE, FSSH_O_WRONLY | FSSH_O_TRUNC);
+			_kern_close(fd);
+			if (attr < 0)
+				return attr;
+
+			fssh_status_t status = write_data(attr, op.size);
+			_kern_close(attr);
+			return status;
+		}
+
+		case REPLAY_STAT:
+		{
+			struct fssh_stat st;
+			return _kern_read_stat(-1, path, false, &st, sizeof(st));
+		}
+
+		case REPLAY_RENAME:
+			return _kern_rename(-1, path, -1, op.argument.c_str());
+
+		case REPLAY_REMOVE:
+			return _kern_unlink(-1, path);
+
+		case REPLAY_REMOVE_DIR:
+			return _kern_remove_dir(-1, path);
+
+		case REPLAY_SYNC:
+			return _kern_sync();
+
+		default:
+			return FSSH_B_BAD_VALUE;
+	}
+}
+
+
+static void
+print_usage(const char* name)
+{
+	printf("Usage: %s [ -r <rounds> ] [ -s ] <workload>\n"
+		"       %s [ -r <rounds> ] [ -s ] -g <directories> <files> "
+			"[ <size> ]\n"
+		"Replays the metadata operations of the <workload> file, or a "
+			"generated\n"
+		"workload that creates, and removes a source tree like hierarchy, "
+			"and\n"
+		"prints how long the operations took.\n"
+		"  -g  generate the workload instead of reading it\n"
+		"  -r  run the workload <rounds> times (default is 1)\n"
+		"  -s  sync the file system after each round, and include it in the "
+			"time\n", name, name);
+}
+
+
+fssh_status_t
+command_replay(int argc, const char* const* argv)
+{
+	int32_t rounds = 1;
+	bool sync = false;
+	bool generate = false;
+
+	// parse parameters
+	int argi = 1;
+	for (; argi < argc; argi++) {
+		const char* arg = argv[argi];
+		if (arg[0] != '-')
+			break;
+
+		if (!strcmp(arg, "-g"))
+			generate = true;
+		else if (!strcmp(arg, "-s"))
+			sync = true;
+		else if (!strcmp(arg, "-r") && argi + 1 < argc)
+			rounds = atol(argv[++argi]);
+		else {
+			print_usage(argv[0]);
+			return FSSH_B_BAD_VALUE;
+		}
+	}
+
+	OpList ops;
+	if (generate) {
+		if (argc - argi < 2 || argc - argi > 3) {
+			print_usage(argv[0]);
+			return FSSH_B_BAD_VALUE;
+		}
+
+		int32_t directories = atol(argv[argi]);
+		int32_t files = atol(argv[argi + 1]);
+		fssh_off_t size = argc - argi > 2 ? strtoll(argv[argi + 2], NULL, 0)
+			: 2048;
+		if (directories <= 0 || files <= 0 || size < 0) {
+			print_usage(argv[0]);
+			return FSSH_B_BAD_VALUE;
+		}
+
+		generate_workload(ops, directories, files, size);
+	} else {
+		if (argc - argi != 1) {
+			print_usage(argv[0]);
+			return FSSH_B_BAD_VALUE;
+		}
+
+		fssh_status_t status = parse_workload(argv[argi], ops);
+		if (status != FSSH_B_OK)
+			return status;
+	}
+
+	if (rounds < 1)
+		rounds = 1;
+
+	memset(sDataBuffer, 'x', sizeof(sDataBuffer));
+
+	replay_op_stats stats[REPLAY_OP_TYPE_COUNT];
+	memset(stats, 0, sizeof(stats));
+
+	fssh_bigtime_t start = fssh_system_time();
+
+	for (int32_t round = 0; round < rounds; round++) {
+		for (size_t i = 0; i < ops.size(); i++) {
+			const replay_op& op = ops[i];
+			replay_op_stats& opStats = stats[op.type];
+
+			fssh_bigtime_t opStart = fssh_system_time();
+			fssh_status_t status = run_op(op);
+			opStats.time += fssh_system_time() - opStart;
+			opStats.count++;
+
+			if (status != FSSH_B_OK) {
+				if (opStats.errors++ == 0) {
+					fprintf(stderr, "Error: %s \"%s\" failed: %s\n",
+						kOpNames[op.type], op.path.c_str(),
+						fssh_strerror(status));
+				}
+			}
+		}
+
+		if (sync) {
+			replay_op_stats& opStats = stats[REPLAY_SYNC];
+
+			fssh_bigtime_t opStart = fssh_system_time();
+			if (_kern_sync() != FSSH_B_OK)
+				opStats.errors++;
+			opStats.time += fssh_system_time() - opStart;
+			opStats.count++;
+		}
+	}
+
+	fssh_bigtime_t totalTime = fssh_system_time() - start;
+
+	printf("operation      count  errors   total (ms)  per op (us)\n");
+
+	uint32_t totalCount = 0;
+	for (int32_t type = 0; type < REPLAY_OP_TYPE_COUNT; type++) {
+		const replay_op_stats& opStats = stats[type];
+		if (opStats.count == 0)
+			continue;
+
+		printf("%-10s %9u %7u %12.3f %12.2f\n", kOpNames[type],
+			(unsigned)opStats.count, (unsigned)opStats.errors,
+			opStats.time / 1000.0, (double)opStats.time / opStats.count);
+		totalCount += opStats.count;
+	}
+
+	printf("%u operations in %.3f ms, %.1f operations/s\n",
+		(unsigned)totalCount, totalTime / 1000.0,
+		totalTime > 0 ? totalCount * 1000000.0 / totalTime : 0.0);
+
+	return FSSH_B_OK;
+}
+
+
+}	// namespace FSShell
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2013, Haiku Inc. All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+#ifndef _FSSH_COMMAND_REPLAY_H
+#define _FSSH_COMMAND_REPLAY_H
+
+
+#include "fssh_defs.h"
+
+
+namespace FSShell {
+
+
+fssh_status_t	command_replay(int argc, const char* const* argv);
+
+
+}	// namespace FSShell
+
+
+#endif	// _FSSH_COMMAND_REPLAY_H
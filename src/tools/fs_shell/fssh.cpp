@@ -18,6 +18,7 @@
 #include <vector>
 
 #include "command_cp.h"
+#include "command_replay.h"
 #include "driver_settings.h"
 #include "external_commands.h"
 #include "fd.h"
@@ -1224,6 +1225,7 @@ register_commands()
 		command_mv,			"mv",			"move/rename files and directories",
 		command_query,		"query",		"query for files",
 		command_quit,		"quit/exit",	"quit the shell",
+		command_replay,		"replay",		"replay a metadata workload, and time it",
 		command_rm,			"rm",			"remove files and directories",
 		command_sync,		"sync",			"syncs the file system",
 		NULL